@@ -149,6 +149,14 @@ bool		client_add(RADCLIENT_LIST *clients, RADCLIENT *client);
 void		client_delete(RADCLIENT_LIST *clients, RADCLIENT *client);
 
 RADCLIENT	*client_afrom_request(RADCLIENT_LIST *clients, REQUEST *request);
+
+void		client_add_deferred(RADCLIENT *client);
+
+void		client_delete_deferred(RADCLIENT *client);
+
+void		client_deferred_notify(void (*notify)(void));
+
+void		client_deferred_process(void);
 #endif
 
 int		client_map_section(CONF_SECTION *out, CONF_SECTION const *map, client_value_cb_t func, void *data);
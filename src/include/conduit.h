@@ -38,7 +38,9 @@ typedef enum fr_conduit_type_t {
 	FR_CONDUIT_AUTH_CHALLENGE,
 	FR_CONDUIT_AUTH_RESPONSE,
 	FR_CONDUIT_WANT_MORE,
-	FR_CONDUIT_NOTIFY
+	FR_CONDUIT_NOTIFY,
+	FR_CONDUIT_BATCH,			//!< Several commands, one per line.
+	FR_CONDUIT_BATCH_RESULT			//!< Result of one command in a batch.
 } fr_conduit_type_t;
 
 typedef enum fr_conduit_result_t {
@@ -52,7 +54,24 @@ typedef enum fr_conduit_notify_t {
 	FR_NOTIFY_UNBUFFERED
 } fr_conduit_notify_t;
 
-#define COMMAND_BUFFER_SIZE (1024)
+#define COMMAND_BUFFER_SIZE (65536)
+
+/*
+ *	The largest message the server will read.  Batches of commands
+ *	must be split into messages no larger than this.
+ */
+#define FR_CONDUIT_MAX_PAYLOAD (COMMAND_BUFFER_SIZE - 16)
+
+/** Header of a FR_CONDUIT_BATCH_RESULT
+ *
+ * Followed by out_len bytes of output, and then err_len bytes of
+ * errors from the command.  All fields are in network byte order.
+ */
+typedef struct fr_conduit_batch_result_t {
+	uint32_t	status;			//!< fr_conduit_result_t of the command.
+	uint32_t	out_len;		//!< Length of the output.
+	uint32_t	err_len;		//!< Length of the errors.
+} fr_conduit_batch_result_t;
 
 typedef struct fr_cs_buffer_t {
 	int		auth;
@@ -66,6 +85,12 @@ ssize_t fr_conduit_drain(int fd, fr_conduit_type_t *pconduit, void *inbuf, size_
 ssize_t fr_conduit_read(int fd, fr_conduit_type_t *pconduit, void *buffer, size_t buflen);
 ssize_t fr_conduit_write(int fd, fr_conduit_type_t conduit, void const *buffer, size_t buflen);
 
+bool	fr_conduit_batch_is_command(char const *line, size_t len);
+ssize_t fr_conduit_batch_result_write(int fd, uint32_t status,
+				      void const *out, size_t out_len, void const *err, size_t err_len);
+int	fr_conduit_batch_result_parse(uint32_t *status, char const **out, size_t *out_len,
+				      char const **err, size_t *err_len, void const *data, size_t data_len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,6 +66,17 @@ typedef struct fr_connection_pool_state {
 	bool		reconnecting;		//!< We are currently reconnecting the pool.
 } fr_connection_pool_state_t;
 
+/** Called for each connection pool by #fr_connection_pool_walk
+ *
+ * @param[in] uctx passed to #fr_connection_pool_walk.
+ * @param[in] name of the pool, as used in log messages.
+ * @param[in] state a copy of the pool's state.
+ * @return
+ *	- 0 to continue the walk.
+ *	- -1 to stop the walk.
+ */
+typedef int (*fr_connection_pool_walk_t)(void *uctx, char const *name, fr_connection_pool_state_t const *state);
+
 /** Alter the opaque data of a connection pool during reconnection event
  *
  * This function will be called whenever we have been signalled to
@@ -148,6 +159,8 @@ void	fr_connection_pool_ref(fr_connection_pool_t *pool);
 
 fr_connection_pool_state_t const *fr_connection_pool_state(fr_connection_pool_t *pool);
 
+int	fr_connection_pool_walk(fr_connection_pool_walk_t callback, void *uctx);
+
 void	fr_connection_pool_reconnect_func(fr_connection_pool_t *pool, fr_connection_pool_reconnect_t reconnect);
 
 /*
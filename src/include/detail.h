@@ -29,10 +29,57 @@ RCSIDH(detail_h, "$Id$")
 extern "C" {
 #endif
 
+/*
+ *	Binary detail records.
+ *
+ *	Each record is a fixed size header, followed by a RADIUS packet.
+ *	All header fields are in network byte order.  The first octet
+ *	of the magic can't start a line of a text detail file, so text
+ *	and binary records can be told apart, even in the same file.
+ */
+#define DETAIL_BINARY_MAGIC		"\376FRD"
+#define DETAIL_BINARY_MAGIC_LEN		4
+#define DETAIL_BINARY_VERSION		1
+
+/*
+ *	The RADIUS packets are encoded with a fixed secret.  It's only
+ *	there to keep the encoder happy, encrypted attributes are no more
+ *	secret than they are in text detail files.
+ */
+#define DETAIL_BINARY_SECRET		"detail"
+
+#define DETAIL_BINARY_FLAG_DONE		0x01	//!< Record has been replayed.
+
+/** Header of a binary detail record
+ *
+ */
+typedef struct detail_binary_hdr_t {
+	uint8_t		magic[DETAIL_BINARY_MAGIC_LEN];	//!< DETAIL_BINARY_MAGIC.
+	uint8_t		version;		//!< DETAIL_BINARY_VERSION.
+	uint8_t		flags;			//!< DETAIL_BINARY_FLAG_* values.  Not covered by the checksum,
+						//!< so records can be marked as done in place.
+	uint8_t		af;			//!< Address family of src/dst, 4, 6 or 0 if the record
+						//!< doesn't hold the src/dst addresses and ports.
+	uint8_t		client_af;		//!< Address family of the client, 4, 6 or 0 for none.
+	uint32_t	length;			//!< Length of the RADIUS packet following the header.
+	uint32_t	timestamp;		//!< When the packet was received.
+	uint32_t	checksum;		//!< Of the header (with flags and checksum zeroed) and the packet.
+	uint8_t		src_ipaddr[16];
+	uint8_t		dst_ipaddr[16];
+	uint8_t		client_ipaddr[16];
+	uint16_t	src_port;
+	uint16_t	dst_port;
+} detail_binary_hdr_t;
+
+#define DETAIL_BINARY_HDR_LEN		(sizeof(detail_binary_hdr_t))
+#define DETAIL_BINARY_FLAGS_OFFSET	(DETAIL_BINARY_MAGIC_LEN + 1)
+
 typedef enum detail_file_state_t {
 	STATE_UNOPENED = 0,
 	STATE_UNLOCKED,
 	STATE_PROCESSING,
+	STATE_DRAINING				//!< File has been read, waiting for outstanding
+						//!< records to complete before removing it.
 } detail_file_state_t;
 
 typedef enum detail_entry_state_t {
@@ -44,14 +91,35 @@ typedef enum detail_entry_state_t {
 	STATE_REPLIED
 } detail_entry_state_t;
 
+/** A record which has been read from the detail file, and not yet completed
+ *
+ */
+typedef struct detail_entry_t {
+	detail_entry_state_t	state;		//!< STATE_QUEUED, STATE_RUNNING, STATE_NO_REPLY or STATE_REPLIED.
+	VALUE_PAIR		*vps;		//!< Read from the file, used to (re)build the packet.
+	fr_ipaddr_t		client_ip;	//!< Client-IP-Address from the file.
+	time_t			timestamp;	//!< Timestamp from the file.
+	off_t			timestamp_offset;	//!< Offset of the Timestamp line, for marking the
+							//!< record as done.
+	off_t			end_offset;	//!< Offset of the end of the record.
+	time_t			running;	//!< When the record was last sent, or found to have no reply.
+	uint32_t		id;		//!< Counter value of the last packet sent for the record.
+	int			tries;		//!< How many times the record has been sent.
+	bool			binary;		//!< Record was read from a binary entry.
+} detail_entry_t;
+
 typedef struct listen_detail_t {
 	fr_event_timer_t	*ev;	/* has to be first entry (ugh) */
 	char const 	*name;			//!< Identifier used in log messages
 	int		delay_time;
 	char const	*filename;
 	char const	*filename_work;
+	char const	*filename_index;	//!< Sidecar file holding done_offset, so a restarted
+						//!< reader can resume where it left off.
 	VALUE_PAIR	*vps;
 	int		work_fd;
+	ino_t		work_inode;		//!< Of the work file, to check the index applies to it.
+	int		index_fd;
 
 	int		master_pipe[2];
 	int		child_pipe[2];
@@ -68,6 +136,7 @@ typedef struct listen_detail_t {
 	off_t		last_offset;
 	off_t		timestamp_offset;
 	bool		done_entry;		//!< Are we done reading this entry?
+	bool		binary;			//!< Is the current entry a binary record?
 	bool		track;			//!< Do we track progress through the file?
 
 	uint32_t	load_factor; /* 1..100 */
@@ -78,7 +147,15 @@ typedef struct listen_detail_t {
 	int		packets;
 	int		tries;
 	bool		one_shot;
-	int		outstanding;
+	int		outstanding;		//!< Records in the window, sent or waiting to be retired.
+	uint32_t	max_outstanding;	//!< Maximum size of the window.
+	uint32_t	latency_target;		//!< Grow the window while SRTT (in ms) is below this.
+						//!< 0 means the window is fixed at max_outstanding.
+	uint32_t	window;			//!< Current size of the window.
+	uint32_t	window_acks;		//!< Replies received since the window was last resized.
+	detail_entry_t	*entries;		//!< Ring of max_outstanding records, in file order.
+	uint32_t	head;			//!< Oldest record in the ring.
+	off_t		done_offset;		//!< Offset past the last contiguous completed record.
 	int		has_rtt;
 	int		srtt;
 	int		rttvar;
@@ -87,6 +164,14 @@ typedef struct listen_detail_t {
 	RADCLIENT	detail_client;
 } listen_detail_t;
 
+/* detail.c */
+ssize_t	detail_binary_encode(TALLOC_CTX *ctx, uint8_t **out, RADIUS_PACKET const *packet, VALUE_PAIR *vps,
+			     fr_ipaddr_t const *client_ipaddr, time_t timestamp, bool srcdst);
+int	detail_binary_read(FILE *fp, detail_binary_hdr_t *hdr, uint8_t *data, size_t data_len);
+int	detail_binary_decode(TALLOC_CTX *ctx, VALUE_PAIR **out, detail_binary_hdr_t const *hdr,
+			     uint8_t const *data);
+void	detail_binary_ipaddr(fr_ipaddr_t *out, uint8_t af, uint8_t const *addr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,65 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_HIST_H
+#define _FR_HIST_H
+/**
+ * $Id$
+ *
+ * @file include/hist.h
+ * @brief Log-linear histograms, for latency.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSIDH(hist_h, "$Id$")
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *	Each power of two is split into FR_HIST_SUB buckets, so values
+ *	are recorded to within 1/FR_HIST_SUB of their real value.
+ *	Values below 2 * FR_HIST_SUB get a bucket each.  Anything over
+ *	2^FR_HIST_MAX_BITS goes into the last bucket.
+ *
+ *	The unit is up to the caller.  2^34 is ~17s in nanoseconds,
+ *	or ~4.7 hours in microseconds.
+ */
+#define FR_HIST_SUB_BITS	3
+#define FR_HIST_SUB		(1 << FR_HIST_SUB_BITS)
+#define FR_HIST_MAX_BITS	34
+#define FR_HIST_BUCKETS		((FR_HIST_MAX_BITS - FR_HIST_SUB_BITS + 1) * FR_HIST_SUB)
+
+typedef struct fr_hist_t {
+	uint64_t	count;				//!< Number of values recorded.
+	uint64_t	sum;				//!< Of all values recorded.
+	uint64_t	min;				//!< Smallest value recorded.
+	uint64_t	max;				//!< Largest value recorded.
+	uint64_t	bucket[FR_HIST_BUCKETS];
+} fr_hist_t;
+
+unsigned int	fr_hist_bucket(uint64_t value);
+uint64_t	fr_hist_bucket_max(unsigned int bucket);
+void		fr_hist_add(fr_hist_t *hist, uint64_t value);
+void		fr_hist_merge(fr_hist_t *out, fr_hist_t const *in);
+uint64_t	fr_hist_percentile(fr_hist_t const *hist, unsigned int permille);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_HIST_H */
@@ -26,6 +26,7 @@
 #include <freeradius-devel/conf_file.h> /* Need CONF_* definitions */
 #include <freeradius-devel/map_proc.h>
 #include <freeradius-devel/modpriv.h>
+#include <freeradius-devel/profile.h>
 #include <freeradius-devel/rad_assert.h>
 
 #ifdef __cplusplus
@@ -170,6 +171,8 @@ typedef struct {
 						//!< be called when the request is poked via an action
 	void const		*ctx;		//!< Context data for the callback.  Usually represents
 						//!< the module's internal state at the time of yielding.
+	fr_profile_call_t	profile;	//!< Timing for the call, carried across yields.
+						//!< Also used for the module's latency statistics.
 } unlang_resumption_t;
 
 /** A naked xlat
@@ -0,0 +1,81 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_METRICS_H
+#define _FR_METRICS_H
+/**
+ * $Id$
+ *
+ * @file include/metrics.h
+ * @brief Prometheus / OpenMetrics text format, and the scraper allow-list.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSIDH(metrics_h, "$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WITH_METRICS
+typedef enum {
+	METRICS_COUNTER = 0,
+	METRICS_GAUGE,
+	METRICS_HISTOGRAM
+} metrics_type_t;
+
+/*
+ *	The response body is built in one talloced buffer, so it can
+ *	be written with a correct Content-Length.
+ */
+typedef struct {
+	char		*out;			//!< Response body.  NULL if we ran out of memory.
+	bool		openmetrics;		//!< Use OpenMetrics, instead of the Prometheus text format.
+} metrics_ctx_t;
+
+/*
+ *	A set of counters, and the latency histogram, with the labels
+ *	which identify them.
+ */
+typedef struct {
+	char		labels[512];		//!< Escaped label pairs, without the braces.
+	fr_stats_t	stats;			//!< Counters, summed over all workers.
+	fr_hist_t	hist;			//!< Latency histogram, summed over all workers.
+	bool		no_hist;		//!< The source doesn't keep a histogram.
+} metrics_source_t;
+
+typedef struct {
+	metrics_source_t	*source;
+	uint32_t		num;
+	uint32_t		size;
+} metrics_sources_t;
+
+void		metrics_printf(metrics_ctx_t *mc, char const *fmt, ...) CC_HINT(format (printf, 2, 3));
+void		metrics_family(metrics_ctx_t *mc, char const *name, metrics_type_t type, char const *help);
+char const	*metrics_label(char *out, size_t outlen, char const *in);
+void		metrics_print_counters(metrics_ctx_t *mc, char const *prefix, metrics_sources_t const *sources);
+void		metrics_print_latency(metrics_ctx_t *mc, char const *prefix, char const *help,
+				      metrics_sources_t const *sources);
+
+bool		metrics_ipaddr_is_loopback(fr_ipaddr_t const *ipaddr);
+bool		metrics_ipaddr_allowed(fr_ipaddr_t const *allow, fr_ipaddr_t const *peer);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_METRICS_H */
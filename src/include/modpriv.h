@@ -58,6 +58,10 @@ typedef struct {
 
 	rlm_rcode_t			code;		//!< Code module will return when 'force' has
 							//!< has been set to true.
+
+#ifdef WITH_STATS
+	fr_stats_t			stats;		//!< Number of calls, and how long they took.
+#endif
 } module_instance_t;
 
 /** Per thread per instance data
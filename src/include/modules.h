@@ -136,6 +136,25 @@ typedef int (*module_thread_t)(CONF_SECTION const *mod_cs, void *instance, fr_ev
  */
 typedef int (*module_thread_detach_t)(void *thread);
 
+/** Write a line of module statistics
+ *
+ * @param[in] uctx		passed to the module's stats callback.
+ * @param[in] fmt		printf style format string.
+ * @param[in] ...		arguments for the format string.
+ */
+typedef void (*module_stats_print_t)(void *uctx, char const *fmt, ...) CC_HINT(format (printf, 2, 3));
+
+/** Module statistics callback
+ *
+ * Called from radmin to print statistics kept by a module instance.
+ * May be called from any thread, while the worker threads are running.
+ *
+ * @param[in] instance		data, specific to an instantiated module.
+ * @param[in] print		function to write each line with.
+ * @param[in] uctx		to pass to print.
+ */
+typedef void (*module_stats_t)(void *instance, module_stats_print_t print, void *uctx);
+
 /** Struct exported by a rlm_* module
  *
  * Determines the capabilities of the module, and maps internal functions
@@ -155,6 +174,8 @@ typedef struct rad_module_t {
 	size_t			thread_inst_size;	//!< Size of data to allocate to the thread instance.
 
 	module_method_t		methods[MOD_COUNT];	//!< Pointers to the various section callbacks.
+
+	module_stats_t		stats;			//!< Print statistics kept by the module, for radmin.
 } rad_module_t;
 
 /*
@@ -0,0 +1,85 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_PROFILE_H
+#define _FR_PROFILE_H
+/**
+ * $Id$
+ *
+ * @file include/profile.h
+ * @brief Time spent in module calls and xlat expansions.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(profile_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern bool fr_profile_enabled;
+
+typedef enum {
+	FR_PROFILE_MODULE = 0,				//!< Call to a module method.
+	FR_PROFILE_XLAT					//!< xlat expansion.
+} fr_profile_type_t;
+
+/** Timing for a single call, which may yield and be resumed several times
+ *
+ */
+typedef struct fr_profile_call_t {
+	bool			active;			//!< Whether profiling was enabled when the call started.
+	struct timeval		start;			//!< When the call started.  Also used for module
+							//!< latency statistics.
+	struct timeval		yielded;		//!< When the call last yielded.
+	uint64_t		cpu_start;		//!< Thread CPU time when the call last started running.
+	uint64_t		cpu;			//!< CPU time used so far, in microseconds.
+	uint64_t		yield;			//!< Time spent yielded so far, in microseconds.
+} fr_profile_call_t;
+
+/** Totals for one module instance or xlat, in one section of one virtual server
+ *
+ */
+typedef struct fr_profile_entry_t {
+	char const		*server;		//!< Virtual server.
+	char const		*section;		//!< Section, e.g. authorize.
+	char const		*name;			//!< Module instance or xlat name.
+	fr_profile_type_t	type;
+
+	uint64_t		calls;
+	uint64_t		wall;			//!< Total wall time, in microseconds.
+	uint64_t		cpu;			//!< Total CPU time, in microseconds.
+	uint64_t		yield;			//!< Total time spent yielded, in microseconds.
+	uint64_t		max;			//!< Longest call (wall time), in microseconds.
+} fr_profile_entry_t;
+
+typedef int (*fr_profile_walk_t)(void *uctx, fr_profile_entry_t const *entry);
+
+void	fr_profile_call_start(fr_profile_call_t *call, bool timed);
+void	fr_profile_call_yield(fr_profile_call_t *call);
+void	fr_profile_call_resume(fr_profile_call_t *call);
+void	fr_profile_call_end(REQUEST *request, fr_profile_type_t type, char const *name, fr_profile_call_t *call,
+			    struct timeval *end);
+
+void	fr_profile_thread_stop(void);
+
+int	fr_profile_walk(fr_profile_walk_t callback, void *uctx);
+void	fr_profile_reset(void);
+void	fr_profile_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_PROFILE_H */
@@ -88,6 +88,53 @@ struct rc_request {
 	char const	*name;		//!< Test name (as specified in the request).
 };
 
+/** A packet to send in benchmark mode
+ *
+ * The packet is encoded once, and copied for each request.  Only the
+ * ID, the counter, the User-Name and the authenticators are changed.
+ */
+typedef struct rc_bench_template {
+	uint8_t		*data;		//!< Encoded packet, without User-Name if names are being
+					//!< substituted.
+	size_t		data_len;	//!< Length of the encoded packet.
+	size_t		counter_offset;	//!< Of the characters to replace with a counter.  0 if none.
+	size_t		counter_len;	//!< Number of characters to replace with a counter.
+	size_t		ma_offset;	//!< Of the Message-Authenticator value.  0 if none.
+	size_t		password_offset;	//!< Of the User-Password value.  0 if none.
+	char		*password;	//!< User-Password plaintext, encrypted for each packet.
+	size_t		password_len;	//!< Length of the plaintext.
+} rc_bench_template_t;
+
+typedef struct rc_bench_config {
+	fr_ipaddr_t		server_ipaddr;	//!< Where to send packets.
+	uint16_t		server_port;
+	fr_ipaddr_t		client_ipaddr;	//!< Where to send packets from.
+	char const		*secret;
+
+	rc_bench_template_t	*templates;	//!< Packets to send, in turn.
+	uint32_t		num_templates;
+
+	char			**names;	//!< User-Name values to pick from at random.
+	uint32_t		num_names;	//!< 0 if the User-Name in the template is used.
+
+	uint32_t		threads;	//!< Number of sending threads, each with its own socket.
+	uint32_t		rate;		//!< Packets per second, over all threads.  0 for no limit.
+	uint32_t		parallel;	//!< Outstanding packets per thread.
+	uint64_t		count;		//!< Total number of packets to send.
+	float			timeout;	//!< Seconds before a packet is counted as lost.
+	bool			output;		//!< Whether to print the results.
+} rc_bench_config_t;
+
+int rc_bench_template_prepare(RADIUS_PACKET *packet, bool names);
+
+int rc_bench_template_init(TALLOC_CTX *ctx, rc_bench_template_t *tmpl, RADIUS_PACKET *packet,
+			   bool names, char const *secret);
+
+size_t rc_bench_packet(uint8_t *out, rc_bench_template_t const *tmpl, char const *secret,
+		       uint64_t counter, char const *name, uint8_t const *vector, uint8_t id);
+
+int rc_bench_run(rc_bench_config_t const *config);
+
 #ifdef __cplusplus
 }
 #endif
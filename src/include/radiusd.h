@@ -183,6 +183,12 @@ typedef struct main_config {
 
 	size_t		talloc_memory_limit;		//!< Limit the amount of talloced memory the server uses.
 							//!< Only applicable in single threaded mode.
+
+	bool		profile;			//!< Record the time spent in module calls and xlats.
+	uint32_t	profile_interval;		//!< How often to write the profile to the log.
+							//!< 0 disables the periodic dump.
+
+	bool		stats_client_latency;		//!< Keep a latency histogram for each client.
 } main_config_t;
 
 #ifdef WITH_VERIFY_PTR
@@ -385,7 +391,8 @@ typedef enum {
 	RADIUS_SIGNAL_SELF_EXIT		= (1 << 2),
 	RADIUS_SIGNAL_SELF_DETAIL	= (1 << 3),
 	RADIUS_SIGNAL_SELF_NEW_FD	= (1 << 4),
-	RADIUS_SIGNAL_SELF_MAX		= (1 << 5)
+	RADIUS_SIGNAL_SELF_CLIENTS	= (1 << 5),
+	RADIUS_SIGNAL_SELF_MAX		= (1 << 6)
 } radius_signal_t;
 /*
  *	Function prototypes.
@@ -574,9 +581,23 @@ int radius_copy_vp(TALLOC_CTX *ctx, VALUE_PAIR **out, REQUEST *request, char con
 #define pair_make_config(_a, _b, _c) fr_pair_make(request, &request->control, _a, _b, _c)
 
 /* threads.c */
+
+/** Called for each worker thread by #thread_pool_walk
+ *
+ * @param[in] uctx passed to #thread_pool_walk.
+ * @param[in] thread_num of the worker.
+ * @param[in] backlog number of requests queued for the worker.
+ * @param[in] requests the worker has handled.
+ * @return
+ *	- 0 to continue the walk.
+ *	- -1 to stop the walk.
+ */
+typedef int (*thread_pool_walk_t)(void *uctx, int thread_num, uint32_t backlog, uint64_t requests);
+
 int		thread_pool_bootstrap(CONF_SECTION *cs, bool *spawn_workers);
 int		thread_pool_init(void);
 void		thread_pool_stop(void);
+int		thread_pool_walk(thread_pool_walk_t callback, void *uctx);
 
 /*
  *	In threads.c
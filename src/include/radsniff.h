@@ -28,10 +28,18 @@
 RCSIDH(radsniff_h, "$Id$")
 
 #include <sys/types.h>
+#include <pthread.h>
 
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/pcap.h>
 #include <freeradius-devel/event.h>
+#include <freeradius-devel/io/atomic_queue.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
 
 #ifdef HAVE_COLLECTDC_H
 #  include <collectd/client.h>
@@ -44,6 +52,10 @@ RCSIDH(radsniff_h, "$Id$")
 #define RS_RETRANSMIT_MAX	5		//!< Maximum number of times we expect to see a packet retransmitted
 #define RS_MAX_ATTRS		50		//!< Maximum number of attributes we can filter on.
 #define RS_SOCKET_REOPEN_DELAY  5000		//!< How long we delay re-opening a collectd socket.
+#define RS_MAX_WORKERS		64		//!< Maximum number of matcher threads.
+#define RS_WORKER_QUEUE_SIZE	65536		//!< Packets which can be waiting for each matcher thread.
+#define RS_WORKER_STATS_WAIT	100		//!< How long we wait for matcher threads to reach a stats
+						//!< marker when capturing live (milliseconds).
 
 /*
  *	Logging macros
@@ -218,6 +230,53 @@ typedef struct rs_event {
 	rs_stats_t		*stats;			//!< Where to write stats.
 } rs_event_t;
 
+/** A captured packet, or a stats marker, passed from the capture thread to a matcher thread
+ *
+ */
+typedef struct rs_work {
+	uint64_t		count;			//!< Packet number.
+	uint64_t		marker;			//!< Stats interval this marks the end of, or 0 for
+							//!< a packet.
+	fr_pcap_t		*in;			//!< PCAP handle the packet was received on.
+	struct pcap_pkthdr	header;			//!< PCAP packet header.  For markers, only the
+							//!< timestamp is set.
+	uint8_t			data[];			//!< PCAP packet data.
+} rs_work_t;
+
+/** A matcher thread
+ *
+ * Packets are assigned to workers using a hash of the addresses, ports and RADIUS ID, which
+ * is the same for a request and its response.  Each worker has its own request tree, event
+ * list and statistics, so the workers don't share any state.
+ */
+typedef struct rs_worker {
+	pthread_t		pthread_id;
+	int			id;			//!< Number of the worker.
+	bool			running;		//!< Whether the thread was started.
+
+	fr_atomic_queue_t	*queue;			//!< Of rs_work_t, written by the capture thread.
+	_Atomic(bool)		idle;			//!< Waiting for work to be queued.
+
+	pthread_mutex_t		mutex;			//!< Protects the snapshot, and waiting for work.
+	pthread_cond_t		work_cond;		//!< Signalled when work is queued for an idle worker.
+	pthread_cond_t		snapshot_cond;		//!< Signalled when the worker processes a marker.
+
+	TALLOC_CTX		*ctx;			//!< For requests being tracked by this worker.
+	fr_event_list_t		*list;			//!< Request timeouts.
+	rbtree_t		*request_tree;		//!< Requests waiting for a response.
+	rs_event_t		event;			//!< Passed to rs_packet_process().
+
+	rs_stats_t		stats;			//!< Written only by the worker.
+	rs_stats_t		snapshot;		//!< Interval stats, added to when the worker processes
+							//!< a marker, and cleared when they're collected.
+	uint64_t		snapshot_marker;	//!< Last marker processed.
+
+	uint64_t		processed;		//!< Packets processed (written by the worker).
+	uint64_t		dropped;		//!< Packets dropped because the queue was full
+							//!< (written by the capture thread).
+	uint64_t		dropped_reported;	//!< Drops which have already been reported.
+} rs_worker_t;
+
 typedef struct rs_update rs_update_t;
 
 /** Callback for printing stats header.
@@ -288,6 +347,11 @@ struct rs {
 	int			buffer_pkts;		//!< Size of the ring buffer to setup for live capture.
 	uint64_t		limit;			//!< Maximum number of packets to capture
 
+	int			num_workers;		//!< Number of matcher threads.  0 if packets are
+							//!< matched by the capture thread.
+	rs_worker_t		*workers;		//!< Array of matcher threads.
+	bool			benchmark;		//!< Print how quickly the pcap files were processed.
+
 	struct {
 		int			interval;		//!< Time between stats updates in seconds.
 		stats_out_t		out;			//!< Where to write stats.
@@ -54,6 +54,8 @@ typedef struct regex {
 
 	bool		jitd;		//!< Whether JIT data is available.
 	pcre_extra	*extra;		//!< Result of studying a regular expression.
+
+	bool		cached;		//!< Owned by the thread local regex cache.
 } regex_t;
 #  else
 #    include <regex.h>
@@ -72,6 +74,20 @@ typedef struct regex {
 ssize_t regex_compile(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_t len,
 		      bool ignore_case, bool multiline, bool subcaptures, bool runtime);
 int	regex_exec(regex_t *preg, char const *string, size_t len, regmatch_t pmatch[], size_t *nmatch);
+
+/*
+ *	Default maximum number of compiled expressions held in each
+ *	thread's regex cache.  Set at runtime with "regex_cache_size"
+ *	in radiusd.conf, which writes fr_regex_cache_size.
+ */
+#  ifndef REGEX_CACHE_SIZE
+#    define REGEX_CACHE_SIZE	256
+#  endif
+extern uint32_t	fr_regex_cache_size;
+
+ssize_t	regex_compile_cached(regex_t **out, char const *pattern, size_t len,
+			     bool ignore_case, bool multiline, bool subcaptures);
+void	regex_cache_stats(uint64_t *hits, uint64_t *misses, uint64_t *evictions, uint32_t *entries);
 #  ifdef __cplusplus
 }
 #  endif
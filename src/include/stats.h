@@ -36,6 +36,15 @@ typedef uint32_t fr_uint_t;
 #endif
 
 #ifdef WITH_STATS
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+#include <freeradius-devel/hist.h>
+
+typedef struct fr_stats_workers_t fr_stats_workers_t;
+
 typedef struct fr_stats_t {
 	fr_uint_t	total_requests;
 	fr_uint_t	total_invalid_requests;
@@ -52,6 +61,12 @@ typedef struct fr_stats_t {
 	fr_uint_t	total_timeouts;
 	time_t		last_packet;
 	fr_uint_t	elapsed[8];
+
+	_Atomic(fr_stats_workers_t *) workers;		//!< Per-worker counters and latency histograms.
+							//!< Allocated on first use, and added to the
+							//!< counters above by #fr_stats_read.
+	bool		no_hist;			//!< Only keep counters, not a latency histogram.
+							//!< Must be set before the first update.
 } fr_stats_t;
 
 typedef struct fr_stats_ema_t {
@@ -86,20 +101,35 @@ void request_stats_reply(REQUEST *request);
 void radius_stats_ema(fr_stats_ema_t *ema,
 		      struct timeval *start, struct timeval *end);
 void fr_stats_bins(fr_stats_t *stats, struct timeval *start, struct timeval *end);
+
+int fr_stats_slots_init(uint32_t num);
+void fr_stats_thread_start(void);
+void fr_stats_thread_stop(void);
+fr_stats_t *fr_stats_local(fr_stats_t *stats);
+void fr_stats_latency(fr_stats_t *stats, struct timeval *start, struct timeval *end);
+void fr_stats_read(fr_stats_t *out, fr_stats_t const *stats);
+void fr_stats_hist_read(fr_hist_t *out, fr_stats_t const *stats);
+void fr_stats_free(fr_stats_t *stats);
+
 int fr_snmp_process(REQUEST *request);
 int fr_snmp_init(void);
 
 
-#define FR_STATS_INC(_x, _y) radius_ ## _x ## _stats._y++;if (listener) listener->stats._y++;if (client) client->_x._y++;
-#define FR_STATS_TYPE_INC(_x) _x++
+#define FR_STATS_INC(_x, _y) fr_stats_local(&radius_ ## _x ## _stats)->_y++;if (listener) fr_stats_local(&listener->stats)->_y++;if (client) fr_stats_local(&client->_x)->_y++;
+#define FR_STATS_TYPE_INC(_s, _x) fr_stats_local(&(_s))->_x++
 
 #else  /* WITH_STATS */
 #define request_stats_init(_x)
 #define request_stats_final(_x)
 #define fr_stats_bins(_x, _y, _z)
+#define fr_stats_slots_init(_x) (0)
+#define fr_stats_thread_start()
+#define fr_stats_thread_stop()
+#define fr_stats_latency(_x, _y, _z)
+#define fr_stats_free(_x)
 
 #define FR_STATS_INC(_x, _y)
-#define FR_STATS_TYPE_INC(_x)
+#define FR_STATS_TYPE_INC(_s, _x)
 
 #endif
 
@@ -4,7 +4,7 @@ ifneq "$(TARGETNAME)" ""
 TARGET		:= $(TARGETNAME).a
 endif
 
-SOURCES		:= libfreeradius-ldap.c control.c directory.c edir.c util.c 
+SOURCES		:= libfreeradius-ldap.c async.c control.c directory.c edir.c util.c 
 
 SRC_CFLAGS	:=     
 TGT_LDLIBS	:=  -lldap 
@@ -0,0 +1,744 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/ldap/async.c
+ * @brief Asynchronous LDAP operations, serviced by a worker's event loop
+ *
+ * Searches are sent with ldap_search_ext(), and many may be outstanding on
+ * a single connection.  The connection's file descriptor is registered with
+ * the event list, and when it becomes readable all complete results are read
+ * with ldap_result(), matched to the queries that generated them by message
+ * ID, and the requests that sent those queries are marked as resumable.
+ *
+ * Binds change the identity associated with a connection, so they can't
+ * share connections with searches, or with each other.  Each bind is sent on
+ * a connection of its own, which is reused for later binds once the result
+ * has been received.  Binds can't be abandoned, so if one times out, or the
+ * request that sent it is cancelled, its connection is closed instead.
+ *
+ * Connections are opened (and bound as the admin user) synchronously, using
+ * the same callback as the connection pool.  This only happens when no
+ * existing connection has capacity, or after a connection fails.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+#include <freeradius-devel/rad_assert.h>
+
+#define LOG_PREFIX "%s - "
+#define LOG_PREFIX_ARGS handle_config->name
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+#include "libfreeradius-ldap.h"
+
+typedef struct fr_ldap_async_conn fr_ldap_async_conn_t;
+
+/** A set of connections used by a single thread
+ *
+ * Must only be used by the thread which allocated it.
+ */
+struct fr_ldap_async {
+	fr_event_list_t			*el;			//!< Event list servicing the connections.
+	ldap_handle_config_t const	*config;		//!< Connection configuration.
+	fr_connection_create_t		create;			//!< Opens and binds new connections.
+	void				*uctx;			//!< To pass to the create callback.
+
+	uint32_t			max_outstanding;	//!< Maximum number of searches to send
+								//!< on a single connection.
+	bool				session_tracking;	//!< Add session tracking controls to
+								//!< searches.
+
+	fr_ldap_async_conn_t		*conns;			//!< Live connections.
+	fr_ldap_async_conn_t		*failed;		//!< Failed connections, still referenced
+								//!< by queries.
+};
+
+/** A connection, with the queries outstanding on it
+ */
+struct fr_ldap_async_conn {
+	fr_ldap_async_t			*async;			//!< Set of connections this belongs to.
+	ldap_handle_t			*conn;			//!< libldap handle.
+	int				fd;			//!< Registered with the event list.
+
+	bool				bind;			//!< Connection is used for user binds.
+	bool				failed;			//!< No further operations may be sent.
+
+	rbtree_t			*queries;		//!< Outstanding queries, by message ID.
+	uint32_t			refs;			//!< Queries referencing the connection.
+
+	fr_ldap_async_conn_t		*next;			//!< Next connection in the same list.
+};
+
+/** An operation sent by a request
+ */
+struct fr_ldap_query {
+	fr_ldap_async_conn_t		*aconn;			//!< Connection the query was sent on.
+	REQUEST				*request;		//!< That sent the query.
+
+	int				msgid;			//!< Message ID of the operation.
+	char const			*dn;			//!< Search base, or bind DN.
+	bool				bind;			//!< Whether this is a bind.
+
+	bool				pending;		//!< Still waiting for a result.
+	ldap_rcode_t			status;			//!< Result of the operation.
+	LDAPMessage			*result;		//!< Search results.
+
+	fr_event_timer_t		*ev;			//!< Result timeout.
+};
+
+static int _ldap_async_query_cmp(void const *one, void const *two)
+{
+	fr_ldap_query_t const *a = one, *b = two;
+
+	return (a->msgid > b->msgid) - (a->msgid < b->msgid);
+}
+
+/** Remove a connection from the list of live, or failed, connections
+ */
+static void ldap_async_conn_unlink(fr_ldap_async_conn_t *aconn)
+{
+	fr_ldap_async_conn_t **last;
+
+	for (last = aconn->failed ? &aconn->async->failed : &aconn->async->conns; *last; last = &(*last)->next) {
+		if (*last != aconn) continue;
+
+		*last = aconn->next;
+		break;
+	}
+	aconn->next = NULL;
+}
+
+static int _ldap_async_query_fail(void *ctx, void *data)
+{
+	fr_ldap_query_t		*query = data;
+	REQUEST			*request = query->request;
+	int			*status = ctx;
+
+	query->pending = false;
+	query->status = *status;
+	if (query->ev) fr_event_timer_delete(query->aconn->async->el, &query->ev);
+
+	REDEBUG("Connection failed whilst waiting for result");
+	unlang_resumable(request);
+
+	return 0;
+}
+
+/** Mark a connection as failed, failing any queries outstanding on it
+ *
+ * @param[in] aconn	that failed.
+ * @param[in] status	to give the outstanding queries.
+ */
+static void ldap_async_conn_fail(fr_ldap_async_conn_t *aconn, ldap_rcode_t status)
+{
+	ldap_handle_config_t const	*handle_config = aconn->async->config;
+	int				my_status = status;
+
+	if (aconn->failed) return;
+
+	ERROR("Connection failed: %s", fr_ldap_error_str(aconn->conn));
+
+	(void) fr_event_fd_delete(aconn->async->el, aconn->fd);
+
+	(void) rbtree_walk(aconn->queries, RBTREE_IN_ORDER, _ldap_async_query_fail, &my_status);
+	talloc_free(aconn->queries);
+	aconn->queries = NULL;
+
+	if (aconn->refs == 0) {
+		talloc_free(aconn);
+		return;
+	}
+
+	/*
+	 *	Keep the connection around until the requests
+	 *	have finished with the results they received
+	 *	on it.
+	 */
+	ldap_async_conn_unlink(aconn);
+	aconn->failed = true;
+	aconn->next = aconn->async->failed;
+	aconn->async->failed = aconn;
+}
+
+/** Process the result of a query
+ *
+ * @param[in] query	the result is for.
+ * @param[in] msg	the result, freed or consumed.
+ */
+static void ldap_async_query_complete(fr_ldap_query_t *query, LDAPMessage *msg)
+{
+	fr_ldap_async_conn_t	*aconn = query->aconn;
+	REQUEST			*request = query->request;
+	char const		*error = NULL;
+	char			*extra = NULL;
+	int			count;
+
+	rbtree_deletebydata(aconn->queries, query);
+	query->pending = false;
+	if (query->ev) fr_event_timer_delete(aconn->async->el, &query->ev);
+
+	query->status = fr_ldap_result_parse(aconn->conn, query->dn, &msg, &error, &extra);
+	if (query->bind) {
+		switch (query->status) {
+		case LDAP_PROC_SUCCESS:
+			RDEBUG("Bind successful");
+			break;
+
+		case LDAP_PROC_NOT_PERMITTED:
+			REDEBUG("Bind as \"%s\" to \"%s\" not permitted: %s", *query->dn ? query->dn : "(anonymous)",
+				aconn->async->config->server, error);
+			if (extra) REDEBUG("%s", extra);
+			break;
+
+		default:
+			REDEBUG("Bind as \"%s\" to \"%s\" failed: %s", *query->dn ? query->dn : "(anonymous)",
+				aconn->async->config->server, error);
+			if (extra) REDEBUG("%s", extra);
+			break;
+		}
+
+		if (msg) ldap_msgfree(msg);
+		goto finish;
+	}
+
+	switch (query->status) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	/*
+	 *	As with synchronous searches, an invalid
+	 *	DN is the same as notfound.
+	 */
+	case LDAP_PROC_BAD_DN:
+		RDEBUG("%s", error);
+		if (extra) RDEBUG("%s", extra);
+		goto finish;
+
+	case LDAP_PROC_BAD_CONN:
+		query->status = LDAP_PROC_ERROR;
+		goto finish;
+
+	default:
+		REDEBUG("Failed performing search: %s", error);
+		if (extra) REDEBUG("%s", extra);
+		goto finish;
+	}
+
+	count = ldap_count_entries(aconn->conn->handle, msg);
+	if (count < 0) {
+		REDEBUG("Error counting results: %s", fr_ldap_error_str(aconn->conn));
+		query->status = LDAP_PROC_ERROR;
+		ldap_msgfree(msg);
+	} else if (count == 0) {
+		RDEBUG("Search returned no results");
+		query->status = LDAP_PROC_NO_RESULT;
+		ldap_msgfree(msg);
+	} else {
+		query->result = msg;
+	}
+
+finish:
+	talloc_free(extra);
+	unlang_resumable(request);
+}
+
+/** Read all complete results from a connection
+ *
+ * libldap may read more than one result from the socket at a time, so
+ * we keep calling ldap_result() until it has nothing more to give us.
+ */
+static void _ldap_async_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	fr_ldap_async_conn_t	*aconn = talloc_get_type_abort(ctx, fr_ldap_async_conn_t);
+	fr_ldap_query_t		find, *query;
+	LDAPMessage		*msg;
+	struct timeval		poll = { 0, 0 };
+	int			ret;
+
+	while (!aconn->failed) {
+		msg = NULL;
+		ret = ldap_result(aconn->conn->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &poll, &msg);
+		if (ret == 0) break;
+		if (ret < 0) {
+			ldap_async_conn_fail(aconn, LDAP_PROC_BAD_CONN);
+			return;
+		}
+
+		find.msgid = ldap_msgid(msg);
+		query = rbtree_finddata(aconn->queries, &find);
+		if (!query) {
+			/*
+			 *	Abandoned, or an unsolicited notification.
+			 *	Notice of disconnection is the only one
+			 *	defined, and the connection will fail on
+			 *	the next read.
+			 */
+			ldap_msgfree(msg);
+			continue;
+		}
+
+		ldap_async_query_complete(query, msg);
+	}
+}
+
+static void _ldap_async_conn_errored(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	fr_ldap_async_conn_t	*aconn = talloc_get_type_abort(ctx, fr_ldap_async_conn_t);
+
+	ldap_async_conn_fail(aconn, LDAP_PROC_BAD_CONN);
+}
+
+static int _ldap_async_conn_free(fr_ldap_async_conn_t *aconn)
+{
+	if (!aconn->async) return 0;
+
+	if (!aconn->failed) (void) fr_event_fd_delete(aconn->async->el, aconn->fd);
+	ldap_async_conn_unlink(aconn);
+
+	return 0;
+}
+
+/** Open a new connection, and add it to the set of live connections
+ */
+static fr_ldap_async_conn_t *ldap_async_conn_alloc(fr_ldap_async_t *async, bool bind)
+{
+	ldap_handle_config_t const	*handle_config = async->config;
+	fr_ldap_async_conn_t		*aconn;
+	struct timeval			timeout = handle_config->net_timeout;
+
+	MEM(aconn = talloc_zero(async, fr_ldap_async_conn_t));
+	aconn->async = async;
+	aconn->bind = bind;
+	aconn->fd = -1;
+
+	aconn->conn = async->create(aconn, async->uctx, &timeout);
+	if (!aconn->conn) {
+	error:
+		talloc_free(aconn);
+		return NULL;
+	}
+
+	if ((ldap_get_option(aconn->conn->handle, LDAP_OPT_DESC, &aconn->fd) != LDAP_OPT_SUCCESS) ||
+	    (aconn->fd < 0)) {
+		ERROR("Failed retrieving file descriptor for connection");
+		goto error;
+	}
+
+	MEM(aconn->queries = rbtree_create(aconn, _ldap_async_query_cmp, NULL, RBTREE_FLAG_NONE));
+
+	if (fr_event_fd_insert(async->el, aconn->fd, _ldap_async_conn_readable, NULL,
+			       _ldap_async_conn_errored, aconn) < 0) {
+		ERROR("Failed inserting file descriptor into event list: %s", fr_strerror());
+		goto error;
+	}
+
+	aconn->next = async->conns;
+	async->conns = aconn;
+	talloc_set_destructor(aconn, _ldap_async_conn_free);
+
+	DEBUG2("Opened %s connection (fd %i)", bind ? "bind" : "search", aconn->fd);
+
+	return aconn;
+}
+
+/** Find a connection with spare capacity, opening one if necessary
+ *
+ * Searches are sent on the least loaded search connection.  Binds are
+ * only sent on idle bind connections.
+ */
+static fr_ldap_async_conn_t *ldap_async_conn_get(fr_ldap_async_t *async, bool bind)
+{
+	fr_ldap_async_conn_t	*aconn, *found = NULL;
+	uint32_t		num, found_num = 0;
+
+	for (aconn = async->conns; aconn; aconn = aconn->next) {
+		if (aconn->bind != bind) continue;
+
+		num = rbtree_num_elements(aconn->queries);
+		if (bind ? (num > 0) : (num >= async->max_outstanding)) continue;
+
+		if (!found || (num < found_num)) {
+			found = aconn;
+			found_num = num;
+			if (num == 0) break;
+		}
+	}
+	if (found) return found;
+
+	return ldap_async_conn_alloc(async, bind);
+}
+
+static void _ldap_async_query_timeout(UNUSED struct timeval *now, void *ctx)
+{
+	fr_ldap_query_t		*query = talloc_get_type_abort(ctx, fr_ldap_query_t);
+	REQUEST			*request = query->request;
+
+	query->ev = NULL;
+
+	REDEBUG("Timed out while waiting for server to respond");
+
+	rbtree_deletebydata(query->aconn->queries, query);
+	query->pending = false;
+	query->status = LDAP_PROC_TIMEOUT;
+
+	/*
+	 *	Binds can't be abandoned (RFC 4511 section 4.11),
+	 *	and we don't know what identity the connection
+	 *	will have if the result ever arrives, so give up
+	 *	on it.  A new one is opened for the next bind.
+	 */
+	if (query->bind) {
+		ldap_async_conn_fail(query->aconn, LDAP_PROC_TIMEOUT);
+	} else {
+		(void) ldap_abandon_ext(query->aconn->conn->handle, query->msgid, NULL, NULL);
+	}
+
+	unlang_resumable(request);
+}
+
+static int _ldap_async_query_free(fr_ldap_query_t *query)
+{
+	fr_ldap_async_conn_t *aconn = query->aconn;
+
+	if (query->result) ldap_msgfree(query->result);
+
+	if (query->ev) fr_event_timer_delete(aconn->async->el, &query->ev);
+
+	/*
+	 *	Request was cancelled before the
+	 *	result arrived.
+	 */
+	if (query->pending) {
+		rbtree_deletebydata(aconn->queries, query);
+		query->pending = false;
+
+		if (query->bind) {
+			ldap_async_conn_fail(aconn, LDAP_PROC_ERROR);
+		} else {
+			(void) ldap_abandon_ext(aconn->conn->handle, query->msgid, NULL, NULL);
+		}
+	}
+
+	if ((--aconn->refs == 0) && aconn->failed) talloc_free(aconn);
+
+	return 0;
+}
+
+/** Allocate a query, and associate it with a connection
+ */
+static fr_ldap_query_t *ldap_async_query_alloc(fr_ldap_async_conn_t *aconn, REQUEST *request,
+					       char const *dn, bool bind)
+{
+	fr_ldap_query_t *query;
+
+	query = talloc_zero(request, fr_ldap_query_t);
+	if (!query) return NULL;
+
+	query->request = request;
+	query->bind = bind;
+	query->status = LDAP_PROC_ERROR;
+	query->dn = talloc_typed_strdup(query, dn ? dn : "");
+
+	query->aconn = aconn;
+	aconn->refs++;
+	talloc_set_destructor(query, _ldap_async_query_free);
+
+	return query;
+}
+
+/** Register a query which has been sent, so its result can be matched to it
+ */
+static int ldap_async_query_sent(fr_ldap_query_t *query, int msgid)
+{
+	fr_ldap_async_conn_t	*aconn = query->aconn;
+	REQUEST			*request = query->request;
+	struct timeval		now, when;
+
+	query->msgid = msgid;
+	if (!rbtree_insert(aconn->queries, query)) {
+		REDEBUG("Failed tracking message ID %i", msgid);
+		if (query->bind) {
+			ldap_async_conn_fail(aconn, LDAP_PROC_ERROR);
+		} else {
+			(void) ldap_abandon_ext(aconn->conn->handle, msgid, NULL, NULL);
+		}
+		return -1;
+	}
+	query->pending = true;
+
+	gettimeofday(&now, NULL);
+	fr_timeval_add(&when, &now, &aconn->async->config->res_timeout);
+	if (fr_event_timer_insert(aconn->async->el, _ldap_async_query_timeout, query, &when, &query->ev) < 0) {
+		REDEBUG("Failed inserting timeout event: %s", fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Send a search, the request will be marked as resumable when the result is available
+ *
+ * @param[in] async		Connections to send the search on.
+ * @param[in] request		Current request.
+ * @param[in] dn		to use as base for the search.
+ * @param[in] scope		to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter		to use, should be pre-escaped.
+ * @param[in] attrs		to retrieve.
+ * @param[in] serverctrls	Search controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Search controls for ldap_search.  May be NULL.
+ * @return
+ *	- A new query, allocated in the context of the request.  Free it to
+ *	  cancel the search, or once the result has been processed.
+ *	- NULL on error.
+ */
+fr_ldap_query_t *fr_ldap_async_search(fr_ldap_async_t *async, REQUEST *request,
+				      char const *dn, int scope, char const *filter, char const * const *attrs,
+				      LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	fr_ldap_async_conn_t	*aconn;
+	fr_ldap_query_t		*query;
+	char			**search_attrs;
+	int			msgid = -1;
+	int			ret;
+
+	LDAPControl		*our_serverctrls[LDAP_MAX_CONTROLS];
+	LDAPControl		*our_clientctrls[LDAP_MAX_CONTROLS];
+
+	aconn = ldap_async_conn_get(async, false);
+	if (!aconn) return NULL;
+
+#ifdef LDAP_CONTROL_X_SESSION_TRACKING
+	/*
+	 *	Controls are encoded when the search is
+	 *	sent, so they can be removed from the
+	 *	connection straight after.
+	 */
+	if (async->session_tracking && (fr_ldap_control_add_session_tracking(aconn->conn, request) < 0)) {
+		return NULL;
+	}
+#endif
+
+	fr_ldap_control_merge(our_serverctrls, our_clientctrls,
+			      sizeof(our_serverctrls) / sizeof(*our_serverctrls),
+			      sizeof(our_clientctrls) / sizeof(*our_clientctrls),
+			      aconn->conn, serverctrls, clientctrls);
+
+	if (filter) {
+		RDEBUG("Performing search in \"%s\" with filter \"%s\", scope \"%s\"", dn, filter,
+		       fr_int2str(ldap_scope, scope, "<INVALID>"));
+	} else {
+		RDEBUG("Performing unfiltered search in \"%s\", scope \"%s\"", dn,
+		       fr_int2str(ldap_scope, scope, "<INVALID>"));
+	}
+
+	/*
+	 *	OpenLDAP library doesn't declare attrs array as const, but
+	 *	it really should be *sigh*.
+	 */
+	memcpy(&search_attrs, &attrs, sizeof(attrs));
+
+	ret = ldap_search_ext(aconn->conn->handle, dn, scope, filter, search_attrs,
+			      0, our_serverctrls, our_clientctrls, NULL, 0, &msgid);
+	fr_ldap_control_clear(aconn->conn);
+	if (ret != LDAP_SUCCESS) {
+		REDEBUG("Failed sending search: %s", ldap_err2string(ret));
+		if ((ret == LDAP_SERVER_DOWN) || (ret == LDAP_UNAVAILABLE)) ldap_async_conn_fail(aconn, LDAP_PROC_BAD_CONN);
+		return NULL;
+	}
+
+	query = ldap_async_query_alloc(aconn, request, dn, false);
+	if (!query) {
+		(void) ldap_abandon_ext(aconn->conn->handle, msgid, NULL, NULL);
+		return NULL;
+	}
+
+	if (ldap_async_query_sent(query, msgid) < 0) {
+		talloc_free(query);
+		return NULL;
+	}
+
+	RDEBUG2("Waiting for search result...");
+
+	return query;
+}
+
+/** Send a simple bind, the request will be marked as resumable when the result is available
+ *
+ * SASL binds require multiple round trips, and are only available with #fr_ldap_bind.
+ *
+ * @param[in] async		Connections to send the bind on.
+ * @param[in] request		Current request.
+ * @param[in] dn		of the user, may be NULL to bind anonymously.
+ * @param[in] password		of the user, may be NULL if no password is specified.
+ * @param[in] serverctrls	Controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Controls for ldap_sasl_bind.  May be NULL.
+ * @return
+ *	- A new query, allocated in the context of the request.  Free it to
+ *	  cancel the bind, or once the result has been processed.
+ *	- NULL on error.
+ */
+fr_ldap_query_t *fr_ldap_async_bind(fr_ldap_async_t *async, REQUEST *request,
+				    char const *dn, char const *password,
+				    LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	fr_ldap_async_conn_t	*aconn;
+	fr_ldap_query_t		*query;
+	struct berval		cred;
+	int			msgid = -1;
+	int			ret;
+
+	aconn = ldap_async_conn_get(async, true);
+	if (!aconn) return NULL;
+
+	if (!dn) dn = "";
+
+	if (password) {
+		memcpy(&cred.bv_val, &password, sizeof(cred.bv_val));
+		cred.bv_len = talloc_array_length(password) - 1;
+	} else {
+		cred.bv_val = NULL;
+		cred.bv_len = 0;
+	}
+
+	/*
+	 *	Any previous identity is lost as soon
+	 *	as the bind is sent.
+	 */
+	aconn->conn->rebound = true;
+
+	ret = ldap_sasl_bind(aconn->conn->handle, dn, LDAP_SASL_SIMPLE, &cred,
+			     serverctrls, clientctrls, &msgid);
+	if (ret != LDAP_SUCCESS) {
+		REDEBUG("Failed sending bind: %s", ldap_err2string(ret));
+		if ((ret == LDAP_SERVER_DOWN) || (ret == LDAP_UNAVAILABLE)) ldap_async_conn_fail(aconn, LDAP_PROC_BAD_CONN);
+		return NULL;
+	}
+
+	query = ldap_async_query_alloc(aconn, request, dn, true);
+	if (!query) {
+		ldap_async_conn_fail(aconn, LDAP_PROC_ERROR);
+		return NULL;
+	}
+
+	if (ldap_async_query_sent(query, msgid) < 0) {
+		talloc_free(query);
+		return NULL;
+	}
+
+	RDEBUG2("Waiting for bind result...");
+
+	return query;
+}
+
+/** Retrieve the result of a completed query
+ *
+ * @param[out] result	Search results, owned by the query.  May be NULL.
+ * @param[out] conn	the query was sent on, for use with the functions which
+ *			process results.  May be NULL.
+ * @param[in] query	to retrieve the result of.
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t fr_ldap_async_result(LDAPMessage **result, ldap_handle_t **conn, fr_ldap_query_t *query)
+{
+	rad_assert(!query->pending);
+
+	if (result) *result = query->result;
+	if (conn) *conn = query->aconn->conn;
+
+	return query->status;
+}
+
+static int _ldap_async_query_orphan(UNUSED void *ctx, void *data)
+{
+	fr_ldap_query_t *query = data;
+
+	if (query->ev) fr_event_timer_delete(query->aconn->async->el, &query->ev);
+	query->pending = false;
+
+	return 0;
+}
+
+/** Detach a connection from the set, leaving it to the queries which still reference it
+ */
+static void ldap_async_conn_orphan(fr_ldap_async_conn_t *aconn)
+{
+	if (!aconn->failed) {
+		(void) fr_event_fd_delete(aconn->async->el, aconn->fd);
+		(void) rbtree_walk(aconn->queries, RBTREE_IN_ORDER, _ldap_async_query_orphan, NULL);
+		aconn->failed = true;
+	}
+	aconn->async = NULL;
+	aconn->next = NULL;
+
+	if (aconn->refs) (void) talloc_steal(NULL, aconn);
+}
+
+static int _ldap_async_free(fr_ldap_async_t *async)
+{
+	fr_ldap_async_conn_t *aconn;
+
+	/*
+	 *	Should only happen if requests are still
+	 *	running when the thread exits.
+	 */
+	while ((aconn = async->conns)) {
+		async->conns = aconn->next;
+		ldap_async_conn_orphan(aconn);
+	}
+
+	while ((aconn = async->failed)) {
+		async->failed = aconn->next;
+		ldap_async_conn_orphan(aconn);
+	}
+
+	return 0;
+}
+
+/** Allocate a set of connections for use by the current thread
+ *
+ * @param[in] ctx		to allocate the set in.
+ * @param[in] el		servicing the connections.
+ * @param[in] config		for the connections.
+ * @param[in] create		callback to open and bind a connection.
+ * @param[in] uctx		to pass to the create callback.
+ * @param[in] max_outstanding	Maximum number of searches to send on a single connection.
+ * @param[in] session_tracking	Whether to add session tracking controls to searches.
+ * @return
+ *	- A new set of connections.
+ *	- NULL on error.
+ */
+fr_ldap_async_t *fr_ldap_async_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, ldap_handle_config_t const *config,
+				     fr_connection_create_t create, void *uctx,
+				     uint32_t max_outstanding, bool session_tracking)
+{
+	fr_ldap_async_t *async;
+
+	async = talloc_zero(ctx, fr_ldap_async_t);
+	if (!async) return NULL;
+
+	async->el = el;
+	async->config = config;
+	async->create = create;
+	async->uctx = uctx;
+	async->max_outstanding = max_outstanding;
+	async->session_tracking = session_tracking;
+
+	talloc_set_destructor(async, _ldap_async_free);
+
+	return async;
+}
@@ -137,36 +137,26 @@ char const *fr_ldap_error_str(ldap_handle_t const *conn)
 	return ldap_err2string(lib_errno);
 }
 
-/** Parse response from LDAP server dealing with any errors
- *
- * Should be called after an LDAP operation. Will check result of operation
- * and if it was successful, then attempt to retrieve and parse the result.
- *
- * Will also produce extended error output including any messages the server
- * sent, and information about partial DN matches.
+/** Turn the library and server error codes for an operation into an #ldap_rcode_t
  *
  * @param[in] conn	Current connection.
- * @param[in] msgid	returned from last operation. May be -1 if no result
- *			processing is required.
+ * @param[in] lib_errno	Error from the library, LDAP_SUCCESS if the result
+ *			was received.
  * @param[in] dn	Last search or bind DN.
- * @param[in] timeout	Override the default result timeout.
- * @param[out] result	Where to write result, if NULL result will be freed.
- * @param[out] error	Where to write the error string, may be NULL, must
- *			not be freed.
+ * @param[in,out] result	Message to parse, may point to NULL if none was
+ *			received.  Freed if freeit is true, or on error.
+ * @param[in] freeit	Whether to free the message once it's been parsed.
+ * @param[out] error	Where to write the error string, must not be freed.
  * @param[out] extra	Where to write additional error string to, may be NULL
  *			(faster) or must be freed (with talloc_free).
  * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
  */
-ldap_rcode_t fr_ldap_result(ldap_handle_t const *conn,
-			    int msgid,
-			    char const *dn,
-			    struct timeval const *timeout,
-			    LDAPMessage **result,
-			    char const **error, char **extra)
+static ldap_rcode_t ldap_result_process(ldap_handle_t const *conn, int lib_errno, char const *dn,
+					LDAPMessage **result, bool freeit,
+					char const **error, char **extra)
 {
 	ldap_rcode_t status = LDAP_PROC_SUCCESS;
 
-	int lib_errno = LDAP_SUCCESS;	// errno returned by the library.
 	int srv_errno = LDAP_SUCCESS;	// errno in the result message.
 
 	char *part_dn = NULL;		// Partial DN match.
@@ -174,58 +164,9 @@ ldap_rcode_t fr_ldap_result(ldap_handle_t const *conn,
 	char *srv_err = NULL;		// Server's extended error message.
 	char *p, *a;
 
-	bool freeit = false;		// Whether the message should be freed after being processed.
 	int len;
 
-	struct timeval tv;		// Holds timeout values.
-
-	LDAPMessage *tmp_msg = NULL;	// Temporary message pointer storage if we weren't provided with one.
-
-	char const *tmp_err;		// Temporary error pointer storage if we weren't provided with one.
-
-	if (!error) error = &tmp_err;
-	*error = NULL;
-
-	if (extra) *extra = NULL;
-	if (result) *result = NULL;
-
-	/*
-	 *	We always need the result, but our caller may not
-	 */
-	if (!result) {
-		result = &tmp_msg;
-		freeit = true;
-	}
-
-	/*
-	 *	Check if there was an error sending the request
-	 */
-	ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
 	if (lib_errno != LDAP_SUCCESS) goto process_error;
-	if (msgid < 0) return LDAP_SUCCESS;	/* No msgid and no error, return now */
-
-	if (!timeout) {
-		tv = conn->config->res_timeout;
-	} else {
-		tv = *timeout;
-	}
-
-	/*
-	 *	Now retrieve the result and check for errors
-	 *	ldap_result returns -1 on failure, and 0 on timeout
-	 */
-	lib_errno = ldap_result(conn->handle, msgid, 1, &tv, result);
-	if (lib_errno == 0) {
-		lib_errno = LDAP_TIMEOUT;
-
-		goto process_error;
-	}
-
-	if (lib_errno == -1) {
-		ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
-
-		goto process_error;
-	}
 
 	/*
 	 *	Parse the result and check for errors sent by the server
@@ -382,6 +323,120 @@ process_error:
 	return status;
 }
 
+/** Parse response from LDAP server dealing with any errors
+ *
+ * Should be called after an LDAP operation. Will check result of operation
+ * and if it was successful, then attempt to retrieve and parse the result.
+ *
+ * Will also produce extended error output including any messages the server
+ * sent, and information about partial DN matches.
+ *
+ * @param[in] conn	Current connection.
+ * @param[in] msgid	returned from last operation. May be -1 if no result
+ *			processing is required.
+ * @param[in] dn	Last search or bind DN.
+ * @param[in] timeout	Override the default result timeout.
+ * @param[out] result	Where to write result, if NULL result will be freed.
+ * @param[out] error	Where to write the error string, may be NULL, must
+ *			not be freed.
+ * @param[out] extra	Where to write additional error string to, may be NULL
+ *			(faster) or must be freed (with talloc_free).
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t fr_ldap_result(ldap_handle_t const *conn,
+			    int msgid,
+			    char const *dn,
+			    struct timeval const *timeout,
+			    LDAPMessage **result,
+			    char const **error, char **extra)
+{
+	int lib_errno = LDAP_SUCCESS;	// errno returned by the library.
+
+	bool freeit = false;		// Whether the message should be freed after being processed.
+
+	struct timeval tv;		// Holds timeout values.
+
+	LDAPMessage *tmp_msg = NULL;	// Temporary message pointer storage if we weren't provided with one.
+
+	char const *tmp_err;		// Temporary error pointer storage if we weren't provided with one.
+
+	if (!error) error = &tmp_err;
+	*error = NULL;
+
+	if (extra) *extra = NULL;
+	if (result) *result = NULL;
+
+	/*
+	 *	We always need the result, but our caller may not
+	 */
+	if (!result) {
+		result = &tmp_msg;
+		freeit = true;
+	}
+
+	/*
+	 *	Check if there was an error sending the request
+	 */
+	ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
+	if (lib_errno != LDAP_SUCCESS) goto process_error;
+	if (msgid < 0) return LDAP_SUCCESS;	/* No msgid and no error, return now */
+
+	if (!timeout) {
+		tv = conn->config->res_timeout;
+	} else {
+		tv = *timeout;
+	}
+
+	/*
+	 *	Now retrieve the result and check for errors
+	 *	ldap_result returns -1 on failure, and 0 on timeout
+	 */
+	lib_errno = ldap_result(conn->handle, msgid, 1, &tv, result);
+	if (lib_errno == 0) {
+		lib_errno = LDAP_TIMEOUT;
+
+		goto process_error;
+	}
+
+	if (lib_errno == -1) {
+		ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
+
+		goto process_error;
+	}
+
+	lib_errno = LDAP_SUCCESS;
+
+process_error:
+	return ldap_result_process(conn, lib_errno, dn, result, freeit, error, extra);
+}
+
+/** Parse a response which has already been retrieved from the LDAP server
+ *
+ * Used when results are read asynchronously, so there's no need (or opportunity)
+ * to wait for them with #fr_ldap_result.
+ *
+ * @param[in] conn	the response was received on.
+ * @param[in] dn	Last search or bind DN.
+ * @param[in,out] result	The response.  Will be freed, and set to NULL, on error.
+ * @param[out] error	Where to write the error string, may be NULL, must
+ *			not be freed.
+ * @param[out] extra	Where to write additional error string to, may be NULL
+ *			(faster) or must be freed (with talloc_free).
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t fr_ldap_result_parse(ldap_handle_t const *conn, char const *dn, LDAPMessage **result,
+				  char const **error, char **extra)
+{
+	char const *tmp_err;
+
+	if (!error) error = &tmp_err;
+	*error = NULL;
+
+	if (extra) *extra = NULL;
+
+	return ldap_result_process(conn, LDAP_SUCCESS, dn, result, false, error, extra);
+}
+
 /** Bind to the LDAP directory as a user
  *
  * Performs a simple bind to the LDAP directory, and handles any errors that occur.
@@ -16,6 +16,7 @@
 #define	LIBFREERADIUS_LDAP_H
 
 #include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/connection.h>
 #include <lber.h>
 #include <ldap.h>
 #include "config.h"
@@ -356,6 +357,9 @@ ldap_rcode_t	fr_ldap_result(ldap_handle_t const *conn, int msgid, char const *dn
 			       struct timeval const *timeout,
 			       LDAPMessage **result, char const **error, char **extra);
 
+ldap_rcode_t	fr_ldap_result_parse(ldap_handle_t const *conn, char const *dn, LDAPMessage **result,
+				     char const **error, char **extra);
+
 ldap_handle_t	*fr_ldap_conn_alloc(TALLOC_CTX *ctx, ldap_handle_config_t const *handle_config);
 
 int		fr_ldap_conn_timeout_set(ldap_handle_t const *conn, struct timeval const *timeout);
@@ -368,6 +372,26 @@ int		fr_ldap_global_init(void);
 
 void		fr_ldap_global_free(void);
 
+/*
+ *	async.c - Asynchronous operations
+ */
+typedef struct fr_ldap_async fr_ldap_async_t;
+typedef struct fr_ldap_query fr_ldap_query_t;
+
+fr_ldap_async_t	*fr_ldap_async_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, ldap_handle_config_t const *config,
+				     fr_connection_create_t create, void *uctx,
+				     uint32_t max_outstanding, bool session_tracking);
+
+fr_ldap_query_t	*fr_ldap_async_search(fr_ldap_async_t *async, REQUEST *request,
+				      char const *dn, int scope, char const *filter, char const * const *attrs,
+				      LDAPControl **serverctrls, LDAPControl **clientctrls);
+
+fr_ldap_query_t	*fr_ldap_async_bind(fr_ldap_async_t *async, REQUEST *request,
+				    char const *dn, char const *password,
+				    LDAPControl **serverctrls, LDAPControl **clientctrls);
+
+ldap_rcode_t	fr_ldap_async_result(LDAPMessage **result, ldap_handle_t **conn, fr_ldap_query_t *query);
+
 /*
  *	control.c - Connection based client/server controls
  */
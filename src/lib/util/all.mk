@@ -46,6 +46,7 @@ SOURCES		:= cbuff.c \
 		   event.c \
 		   getaddrinfo.c \
 		   heap.c \
+		   hist.c \
 		   tcp.c \
 		   udp.c \
 		   base64.c \
@@ -0,0 +1,115 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * @file lib/util/hist.c
+ * @brief Log-linear histograms, for latency.
+ *
+ * Used for the server statistics, and by the benchmarks.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/hist.h>
+
+/** Map a value to a histogram bucket
+ *
+ */
+unsigned int fr_hist_bucket(uint64_t value)
+{
+	unsigned int msb, shift;
+
+	if (value < (2 * FR_HIST_SUB)) return value;
+	if (value >= ((uint64_t) 1 << FR_HIST_MAX_BITS)) return FR_HIST_BUCKETS - 1;
+
+	for (msb = FR_HIST_SUB_BITS + 1; (value >> (msb + 1)) != 0; msb++);
+	shift = msb - FR_HIST_SUB_BITS;
+
+	return ((shift + 1) * FR_HIST_SUB) + (value >> shift) - FR_HIST_SUB;
+}
+
+/** Return the largest value which is recorded in a histogram bucket
+ *
+ */
+uint64_t fr_hist_bucket_max(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < (2 * FR_HIST_SUB)) return bucket;
+
+	shift = (bucket / FR_HIST_SUB) - 1;
+
+	return ((uint64_t) ((bucket % FR_HIST_SUB) + FR_HIST_SUB) << shift) + ((uint64_t) 1 << shift) - 1;
+}
+
+/** Record a value in a histogram
+ *
+ * The histogram must only be updated by one thread.
+ */
+void fr_hist_add(fr_hist_t *hist, uint64_t value)
+{
+	hist->bucket[fr_hist_bucket(value)]++;
+	if (!hist->count || (value < hist->min)) hist->min = value;
+	if (value > hist->max) hist->max = value;
+	hist->count++;
+	hist->sum += value;
+}
+
+/** Add one histogram to another
+ *
+ */
+void fr_hist_merge(fr_hist_t *out, fr_hist_t const *in)
+{
+	unsigned int i;
+
+	if (!in->count) return;
+
+	if (!out->count || (in->min < out->min)) out->min = in->min;
+	if (in->max > out->max) out->max = in->max;
+	out->count += in->count;
+	out->sum += in->sum;
+
+	for (i = 0; i < FR_HIST_BUCKETS; i++) out->bucket[i] += in->bucket[i];
+}
+
+/** Return a percentile from a histogram
+ *
+ * @param[in] hist to read.
+ * @param[in] permille The percentile, in tenths of a percent.  e.g. 999 for p99.9.
+ * @return the upper bound of the bucket containing the percentile.
+ */
+uint64_t fr_hist_percentile(fr_hist_t const *hist, unsigned int permille)
+{
+	uint64_t	target, seen = 0, value;
+	unsigned int	i;
+
+	if (!hist->count) return 0;
+
+	target = ((hist->count * permille) + 999) / 1000;
+	if (!target) target = 1;
+
+	for (i = 0; i < FR_HIST_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen < target) continue;
+
+		value = fr_hist_bucket_max(i);
+		return (value < hist->max) ? value : hist->max;
+	}
+
+	return hist->max;
+}
@@ -26,6 +26,14 @@
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/regex.h>
 
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 /*
  *	Wrapper functions for libpcre. Much more powerful, and guaranteed
  *	to be binary safe but require libpcre.
@@ -461,4 +469,291 @@ int regex_exec(regex_t *preg, char const *subject, size_t len, regmatch_t pmatch
 	return 1;
 }
 #  endif
+
+/*
+ *	Thread local cache of compiled expressions.
+ *
+ *	Expressions which are only known at runtime (i.e. where the
+ *	pattern is the result of an xlat expansion) would otherwise
+ *	be compiled, and then freed, for every request.
+ */
+typedef struct regex_cache_entry {
+	char const			*pattern;	//!< Copy of the pattern.
+	size_t				len;		//!< Length of the pattern.
+	uint8_t				flags;		//!< Compilation flags.
+	uint32_t			hash;		//!< Of pattern and flags.
+
+	regex_t				*preg;		//!< The compiled expression.
+
+	struct regex_cache_entry	*prev;		//!< Towards the most recently used entry.
+	struct regex_cache_entry	*next;		//!< Towards the least recently used entry.
+} regex_cache_entry_t;
+
+typedef struct regex_cache {
+	fr_hash_table_t			*ht;		//!< Entries indexed by pattern and flags.
+	regex_cache_entry_t		*head;		//!< Most recently used entry.
+	regex_cache_entry_t		*tail;		//!< Least recently used entry.
+
+	/*
+	 *	Only written by the thread which owns the cache,
+	 *	but may be read by any thread.
+	 */
+	atomic_uint_fast32_t		num;		//!< Number of entries in the cache.
+	atomic_uint_fast64_t		hits;		//!< Lookups satisfied from the cache.
+	atomic_uint_fast64_t		misses;		//!< Lookups which required a compilation.
+	atomic_uint_fast64_t		evictions;	//!< Entries freed to make room for new ones.
+
+	struct regex_cache		*prev;		//!< Previous cache in regex_caches.
+	struct regex_cache		*next;		//!< Next cache in regex_caches.
+} regex_cache_t;
+
+/*
+ *	Every thread's cache, so the counters can be totalled.
+ *	Counters from caches which have been freed are kept
+ *	in the regex_cache_freed_* totals.
+ */
+static pthread_mutex_t		regex_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static regex_cache_t		*regex_caches;
+static uint64_t			regex_cache_freed_hits;
+static uint64_t			regex_cache_freed_misses;
+static uint64_t			regex_cache_freed_evictions;
+
+uint32_t			fr_regex_cache_size = REGEX_CACHE_SIZE;
+
+#define REGEX_CACHE_FLAG_IGNORE_CASE	0x01
+#define REGEX_CACHE_FLAG_MULTILINE	0x02
+#define REGEX_CACHE_FLAG_SUBCAPTURES	0x04
+
+fr_thread_local_setup(regex_cache_t *, fr_regex_cache)	/* macro */
+
+static uint32_t regex_cache_hash(void const *data)
+{
+	regex_cache_entry_t const *entry = data;
+
+	return entry->hash;
+}
+
+static int regex_cache_cmp(void const *one, void const *two)
+{
+	regex_cache_entry_t const *a = one;
+	regex_cache_entry_t const *b = two;
+
+	if (a->flags != b->flags) return a->flags - b->flags;
+	if (a->len != b->len) return (a->len > b->len) - (a->len < b->len);
+
+	return memcmp(a->pattern, b->pattern, a->len);
+}
+
+/** Free the thread local regex cache on exit
+ *
+ * @param[in] cache to free.
+ */
+static void _regex_cache_free(void *data)
+{
+	regex_cache_t *cache = data;
+
+	pthread_mutex_lock(&regex_cache_mutex);
+	regex_cache_freed_hits += atomic_load_explicit(&cache->hits, memory_order_relaxed);
+	regex_cache_freed_misses += atomic_load_explicit(&cache->misses, memory_order_relaxed);
+	regex_cache_freed_evictions += atomic_load_explicit(&cache->evictions, memory_order_relaxed);
+
+	if (cache->prev) {
+		cache->prev->next = cache->next;
+	} else {
+		regex_caches = cache->next;
+	}
+	if (cache->next) cache->next->prev = cache->prev;
+	pthread_mutex_unlock(&regex_cache_mutex);
+
+	talloc_free(cache);
+}
+
+static void regex_cache_unlink(regex_cache_t *cache, regex_cache_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void regex_cache_link_head(regex_cache_t *cache, regex_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head) cache->head->prev = entry;
+	cache->head = entry;
+	if (!cache->tail) cache->tail = entry;
+}
+
+/** Compile an expression, or retrieve a previously compiled copy
+ *
+ * Looks up the pattern in a per-thread LRU cache, compiling (and where
+ * possible JITing) the expression on a miss.  Each thread's cache holds
+ * at most #fr_regex_cache_size expressions.
+ *
+ * @note The compiled expression is owned by the cache and must NOT be freed
+ *	by the caller.  It remains valid until the next call to this function
+ *	from the same thread.  It must not be shared with other threads, or kept
+ *	past the end of the current call.  Anything which is needed later, e.g.
+ *	for named subcaptures, must be copied, as regex_sub_to_request() does.
+ *
+ * @param[out] out		Where to write out a pointer to the compiled expression.
+ * @param[in] pattern		to compile.
+ * @param[in] len		of pattern.
+ * @param[in] ignore_case	Whether to do case insensitive matching.
+ * @param[in] multiline		If true $ matches newlines.
+ * @param[in] subcaptures	Whether to compile the regular expression to store subcapture
+ *				data.
+ * @return
+ *	- >= 1 on success.
+ *	- <= 0 on error. Negative value is offset of parse error.
+ */
+ssize_t regex_compile_cached(regex_t **out, char const *pattern, size_t len,
+			     bool ignore_case, bool multiline, bool subcaptures)
+{
+	regex_cache_t		*cache;
+	regex_cache_entry_t	*entry, my_entry;
+	ssize_t			slen;
+
+	*out = NULL;
+
+	cache = fr_regex_cache;
+	if (!cache) {
+		cache = talloc_zero(NULL, regex_cache_t);
+		if (!cache) {
+		oom:
+			fr_strerror_printf("Out of memory");
+			return 0;
+		}
+
+		cache->ht = fr_hash_table_create(cache, regex_cache_hash, regex_cache_cmp, NULL);
+		if (!cache->ht) {
+			talloc_free(cache);
+			goto oom;
+		}
+
+		pthread_mutex_lock(&regex_cache_mutex);
+		cache->next = regex_caches;
+		if (regex_caches) regex_caches->prev = cache;
+		regex_caches = cache;
+		pthread_mutex_unlock(&regex_cache_mutex);
+
+		fr_thread_local_set_destructor(fr_regex_cache, _regex_cache_free, cache);
+	}
+
+	my_entry.pattern = pattern;
+	my_entry.len = len;
+	my_entry.flags = (ignore_case ? REGEX_CACHE_FLAG_IGNORE_CASE : 0) |
+			 (multiline ? REGEX_CACHE_FLAG_MULTILINE : 0) |
+			 (subcaptures ? REGEX_CACHE_FLAG_SUBCAPTURES : 0);
+	my_entry.hash = fr_hash_update(&my_entry.flags, sizeof(my_entry.flags), fr_hash(pattern, len));
+
+	entry = fr_hash_table_finddata(cache->ht, &my_entry);
+	if (entry) {
+		if (entry != cache->head) {
+			regex_cache_unlink(cache, entry);
+			regex_cache_link_head(cache, entry);
+		}
+
+		atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+
+		*out = entry->preg;
+		return len;
+	}
+	atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+
+	/*
+	 *	Evict the least recently used entry.
+	 */
+	if (cache->tail && (atomic_load_explicit(&cache->num, memory_order_relaxed) >= fr_regex_cache_size)) {
+		regex_cache_entry_t *lru = cache->tail;
+
+		regex_cache_unlink(cache, lru);
+		fr_hash_table_delete(cache->ht, lru);
+		atomic_fetch_sub_explicit(&cache->num, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&cache->evictions, 1, memory_order_relaxed);
+
+		talloc_free(lru);
+	}
+
+	entry = talloc_zero(cache, regex_cache_entry_t);
+	if (!entry) goto oom;
+
+	/*
+	 *	Compile as if this were a static expression, so
+	 *	that the pattern is studied and JITed.  The cost
+	 *	is amortised over all the requests which hit the
+	 *	entry.
+	 */
+	slen = regex_compile(entry, &entry->preg, pattern, len, ignore_case, multiline, subcaptures, false);
+	if (slen <= 0) {
+		talloc_free(entry);
+		return slen;
+	}
+#ifdef HAVE_PCRE
+	entry->preg->cached = true;
+#endif
+
+	entry->pattern = talloc_memdup(entry, pattern, len);
+	if (!entry->pattern) {
+		talloc_free(entry);
+		goto oom;
+	}
+	entry->len = len;
+	entry->flags = my_entry.flags;
+	entry->hash = my_entry.hash;
+
+	if (!fr_hash_table_insert(cache->ht, entry)) {
+		talloc_free(entry);
+		fr_strerror_printf("Failed inserting expression into regex cache");
+		return 0;
+	}
+	regex_cache_link_head(cache, entry);
+	atomic_fetch_add_explicit(&cache->num, 1, memory_order_relaxed);
+
+	*out = entry->preg;
+
+	return len;
+}
+
+/** Total the regex cache counters of all threads
+ *
+ * @param[out] hits		Lookups satisfied from a cache.  May be NULL.
+ * @param[out] misses		Lookups which required a compilation.  May be NULL.
+ * @param[out] evictions	Expressions freed to make room for new ones.  May be NULL.
+ * @param[out] entries		Expressions currently cached.  May be NULL.
+ */
+void regex_cache_stats(uint64_t *hits, uint64_t *misses, uint64_t *evictions, uint32_t *entries)
+{
+	regex_cache_t	*cache;
+	uint64_t	h, m, e;
+	uint32_t	n = 0;
+
+	pthread_mutex_lock(&regex_cache_mutex);
+	h = regex_cache_freed_hits;
+	m = regex_cache_freed_misses;
+	e = regex_cache_freed_evictions;
+
+	for (cache = regex_caches; cache; cache = cache->next) {
+		h += atomic_load_explicit(&cache->hits, memory_order_relaxed);
+		m += atomic_load_explicit(&cache->misses, memory_order_relaxed);
+		e += atomic_load_explicit(&cache->evictions, memory_order_relaxed);
+		n += atomic_load_explicit(&cache->num, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&regex_cache_mutex);
+
+	if (hits) *hits = h;
+	if (misses) *misses = m;
+	if (evictions) *evictions = e;
+	if (entries) *entries = n;
+}
 #endif
@@ -58,6 +58,29 @@ static RADCLIENT_LIST	*root_clients = NULL;	//!< Global client list.
 
 #ifdef WITH_DYNAMIC_CLIENTS
 static fr_fifo_t	*deleted_clients = NULL;
+
+/** A client change made by another thread, waiting to be applied by the main thread
+ *
+ */
+typedef struct client_deferred client_deferred_t;
+struct client_deferred {
+	RADCLIENT		*client;		//!< To add or delete.
+	bool			add;			//!< Whether the client is being added.
+	client_deferred_t	*next;			//!< Next change, in the order they were made.
+};
+
+static client_deferred_t	*deferred_head = NULL;
+static client_deferred_t	**deferred_tail = &deferred_head;
+static void			(*deferred_notify)(void) = NULL;
+
+#  ifdef HAVE_PTHREAD_H
+static pthread_mutex_t		deferred_mutex = PTHREAD_MUTEX_INITIALIZER;
+#    define DEFERRED_LOCK	pthread_mutex_lock(&deferred_mutex)
+#    define DEFERRED_UNLOCK	pthread_mutex_unlock(&deferred_mutex)
+#  else
+#    define DEFERRED_LOCK
+#    define DEFERRED_UNLOCK
+#  endif
 #endif
 
 void client_list_free(void)
@@ -104,6 +127,17 @@ void client_free(RADCLIENT *client)
 	}
 #endif
 
+#ifdef WITH_STATS
+	fr_stats_free(&client->auth);
+#  ifdef WITH_ACCOUNTING
+	fr_stats_free(&client->acct);
+#  endif
+#  ifdef WITH_COA
+	fr_stats_free(&client->coa);
+	fr_stats_free(&client->dsc);
+#  endif
+#endif
+
 	talloc_free(client);
 }
 
@@ -205,6 +239,23 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	fr_inet_ntop_prefix(buffer, sizeof(buffer), &client->ipaddr);
 	DEBUG3("Adding client %s (%s) to prefix tree %i", buffer, client->longname, client->ipaddr.prefix);
 
+#ifdef WITH_STATS
+	/*
+	 *	Histograms are allocated for every worker, which
+	 *	is too much to do for every client by default.
+	 */
+	if (!main_config.stats_client_latency) {
+		client->auth.no_hist = true;
+#  ifdef WITH_ACCOUNTING
+		client->acct.no_hist = true;
+#  endif
+#  ifdef WITH_COA
+		client->coa.no_hist = true;
+		client->dsc.no_hist = true;
+#  endif
+	}
+#endif
+
 	/*
 	 *	If the client also defines a server, do that now.
 	 */
@@ -266,6 +317,11 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 
 	/*
 	 *	Create a tree for it.
+	 *
+	 *	Changes from modules (e.g. rlm_ldap) are queued with
+	 *	client_add_deferred(), and applied by the main thread,
+	 *	the same as other dynamic clients.  So the trees don't
+	 *	need locking.
 	 */
 	if (!clients->trees[client->ipaddr.prefix]) {
 		clients->trees[client->ipaddr.prefix] = rbtree_create(clients, client_ipaddr_cmp, NULL, 0);
@@ -377,6 +433,133 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 #endif
 	rbtree_deletebydata(clients->trees[client->ipaddr.prefix], client);
 }
+
+/** Find the client list a client would be added to by client_add()
+ *
+ * @param[in] client to find the list for.
+ * @return
+ *	- The client list.
+ *	- NULL if the list hasn't been created yet.
+ */
+static RADCLIENT_LIST *client_list_find(RADCLIENT const *client)
+{
+	CONF_SECTION *cs;
+
+	if (!client->server) return root_clients;
+
+	cs = cf_section_sub_find_name2(main_config.config, "server", client->server);
+	if (!cs) return NULL;
+	if (!cf_section_sub_find(cs, "listen")) return root_clients;
+
+	return cf_data_find(cs, RADCLIENT_LIST, NULL);
+}
+
+static void client_deferred_queue(RADCLIENT *client, bool add)
+{
+	client_deferred_t	*change;
+	void			(*notify)(void);
+
+	MEM(change = talloc_zero(NULL, client_deferred_t));
+	change->client = client;
+	change->add = add;
+
+	DEFERRED_LOCK;
+	*deferred_tail = change;
+	deferred_tail = &change->next;
+	notify = deferred_notify;
+	DEFERRED_UNLOCK;
+
+	if (notify) notify();
+}
+
+/** Add a client from a thread other than the main thread
+ *
+ * The client lists are only modified by the main thread, so the client
+ * is queued, and added when the main thread calls #client_deferred_process.
+ *
+ * The caller must not free the client.  Once it's no longer needed it
+ * must be passed to #client_delete_deferred, even if it couldn't be added.
+ *
+ * @param[in] client to add.
+ */
+void client_add_deferred(RADCLIENT *client)
+{
+	client_deferred_queue(client, true);
+}
+
+/** Delete and free a client previously passed to #client_add_deferred
+ *
+ * @param[in] client to delete.
+ */
+void client_delete_deferred(RADCLIENT *client)
+{
+	client_deferred_queue(client, false);
+}
+
+/** Set the function used to wake the main thread when client changes are queued
+ *
+ * @param[in] notify function, called from the thread queuing the change.
+ */
+void client_deferred_notify(void (*notify)(void))
+{
+	DEFERRED_LOCK;
+	deferred_notify = notify;
+	DEFERRED_UNLOCK;
+}
+
+/** Apply queued client changes
+ *
+ * Must only be called from the main thread.
+ */
+void client_deferred_process(void)
+{
+	client_deferred_t	*change, *next;
+	RADCLIENT_LIST		*clients;
+	RADCLIENT		*client;
+	bool			add;
+
+	DEFERRED_LOCK;
+	change = deferred_head;
+	deferred_head = NULL;
+	deferred_tail = &deferred_head;
+	DEFERRED_UNLOCK;
+
+	for (; change; change = next) {
+		next = change->next;
+		client = change->client;
+		add = change->add;
+		talloc_free(change);
+
+		if (!add) {
+			client_delete(client_list_find(client), client);
+			client_free(client);
+			continue;
+		}
+
+		/*
+		 *	client_add() frees exact duplicates, but the
+		 *	caller still owns the client, so leave it
+		 *	un-added instead.
+		 */
+		clients = client_list_find(client);
+		if (clients && (client->ipaddr.prefix <= 128) && clients->trees[client->ipaddr.prefix] &&
+		    rbtree_finddata(clients->trees[client->ipaddr.prefix], client)) {
+			ERROR("Failed to add duplicate client %s", client->shortname);
+			continue;
+		}
+
+		if (!client_add(NULL, client)) {
+			ERROR("Failed to add client %s", client->shortname);
+			continue;
+		}
+
+		/*
+		 *	Set after adding, so the client doesn't
+		 *	inherit the lifetime of a dynamic network.
+		 */
+		client->dynamic = true;
+	}
+}
 #endif
 
 #ifdef WITH_STATS
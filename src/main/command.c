@@ -27,6 +27,7 @@
 #include <freeradius-devel/md5.h>
 #include <freeradius-devel/conduit.h>
 #include <freeradius-devel/state.h>
+#include <freeradius-devel/profile.h>
 
 #include <libgen.h>
 #ifdef HAVE_INTTYPES_H
@@ -782,6 +783,19 @@ static int command_socket_write(void *cookie, char const *buffer, int len)
 }
 #endif
 
+/*
+ *	Output from commands run in a batch is collected, and sent
+ *	back as one result per command.  Commands are only run by the
+ *	main thread, so there's only ever one capture.
+ */
+typedef struct command_capture_t {
+	rad_listen_t	*listener;	//!< Whose output is being collected.
+	char		*out;		//!< Output of the command.
+	char		*err;		//!< Errors from the command.
+} command_capture_t;
+
+static command_capture_t *command_capture = NULL;
+
 static ssize_t CC_HINT(format (printf, 2, 3)) cprintf(rad_listen_t *listener, char const *fmt, ...)
 {
 	ssize_t r, len;
@@ -794,6 +808,11 @@ static ssize_t CC_HINT(format (printf, 2, 3)) cprintf(rad_listen_t *listener, ch
 
 	if (listener->status == RAD_LISTEN_STATUS_EOL) return 0;
 
+	if (command_capture && (command_capture->listener == listener)) {
+		command_capture->out = talloc_strdup_append_buffer(command_capture->out, buffer);
+		return len;
+	}
+
 	r = fr_conduit_write(listener->fd, FR_CONDUIT_STDOUT, buffer, len);
 	if (r <= 0) command_close_socket(listener);
 
@@ -815,6 +834,11 @@ static ssize_t CC_HINT(format (printf, 2, 3)) cprintf_error(rad_listen_t *listen
 
 	if (listener->status == RAD_LISTEN_STATUS_EOL) return 0;
 
+	if (command_capture && (command_capture->listener == listener)) {
+		command_capture->err = talloc_strdup_append_buffer(command_capture->err, buffer);
+		return len;
+	}
+
 	r = fr_conduit_write(listener->fd, FR_CONDUIT_STDERR, buffer, len);
 	if (r <= 0) command_close_socket(listener);
 
@@ -2231,6 +2255,308 @@ static int command_inject_file(rad_listen_t *listener, int argc, char *argv[])
 	return CMD_OK;
 }
 
+#ifdef WITH_STATS
+/** Print the latency histogram for a set of statistics
+ *
+ * @param[in] listener to print to.
+ * @param[in] stats to print.
+ * @param[in] buckets Whether to print the non-empty buckets, or just the percentiles.
+ */
+static void command_print_latency(rad_listen_t *listener, fr_stats_t const *stats, bool buckets)
+{
+	fr_hist_t	hist;
+	unsigned int	i;
+
+	fr_stats_hist_read(&hist, stats);
+
+	cprintf(listener, "latency_us.count\t%" PRIu64 "\n", hist.count);
+	if (!hist.count) return;
+
+	cprintf(listener, "latency_us.mean\t%" PRIu64 "\n", hist.sum / hist.count);
+	cprintf(listener, "latency_us.p50\t%" PRIu64 "\n", fr_hist_percentile(&hist, 500));
+	cprintf(listener, "latency_us.p90\t%" PRIu64 "\n", fr_hist_percentile(&hist, 900));
+	cprintf(listener, "latency_us.p99\t%" PRIu64 "\n", fr_hist_percentile(&hist, 990));
+	cprintf(listener, "latency_us.p999\t%" PRIu64 "\n", fr_hist_percentile(&hist, 999));
+	cprintf(listener, "latency_us.max\t%" PRIu64 "\n", hist.max);
+
+	if (!buckets) return;
+
+	for (i = 0; i < FR_HIST_BUCKETS; i++) {
+		if (!hist.bucket[i]) continue;
+
+		cprintf(listener, "latency_us.le.%" PRIu64 "\t%" PRIu64 "\n", fr_hist_bucket_max(i), hist.bucket[i]);
+	}
+}
+
+/** Find the statistics for a client, or for all clients
+ *
+ */
+static fr_stats_t *get_client_stats(rad_listen_t *listener, int argc, char *argv[], bool *auth)
+{
+	RADCLIENT *client = NULL;
+
+	if (argc < 1) {
+		cprintf_error(listener, "Must specify [auth/acct]\n");
+		return NULL;
+	}
+
+	/*
+	 *	Per-client statistics, otherwise global statistics.
+	 */
+	if (argc > 1) {
+		client = get_client(listener, argc - 1, argv + 1);
+		if (!client) return NULL;
+	}
+
+	if (strcmp(argv[0], "auth") == 0) {
+		*auth = true;
+		return client ? &client->auth : &radius_auth_stats;
+	}
+
+	if (strcmp(argv[0], "acct") == 0) {
+#ifdef WITH_ACCOUNTING
+		*auth = false;
+		return client ? &client->acct : &radius_acct_stats;
+#else
+		cprintf_error(listener, "This server was built without accounting support.\n");
+		return NULL;
+#endif
+	}
+
+	if (strcmp(argv[0], "coa") == 0) {
+#ifdef WITH_COA
+		*auth = false;
+		return client ? &client->coa : &radius_coa_stats;
+#else
+		cprintf_error(listener, "This server was built without CoA support.\n");
+		return NULL;
+#endif
+	}
+
+	if (strcmp(argv[0], "disconnect") == 0) {
+#ifdef WITH_COA
+		*auth = false;
+		return client ? &client->dsc : &radius_dsc_stats;
+#else
+		cprintf_error(listener, "This server was built without CoA support.\n");
+		return NULL;
+#endif
+	}
+
+	cprintf_error(listener, "Unknown statistics type\n");
+	return NULL;
+}
+
+#ifdef WITH_PROXY
+/** Find the statistics for a home server, or for all home servers
+ *
+ * @param[in] listener to print errors to.
+ * @param[in] argc number of arguments.
+ * @param[in] argv arguments.
+ * @param[out] home Where to write the home server.  NULL if the statistics are global.
+ * @return the statistics, or NULL on error.
+ */
+static fr_stats_t *get_home_server_stats(rad_listen_t *listener, int argc, char *argv[], home_server_t **home)
+{
+	*home = NULL;
+
+	if (argc == 0) {
+		cprintf_error(listener, "Must specify [auth|acct|coa|disconnect] OR <ipaddr> <port>\n");
+		return NULL;
+	}
+
+	if (argc == 1) {
+		if (strcmp(argv[0], "auth") == 0) return &proxy_auth_stats;
+
+#ifdef WITH_ACCOUNTING
+		if (strcmp(argv[0], "acct") == 0) return &proxy_acct_stats;
+#endif
+
+#ifdef WITH_COA
+		if (strcmp(argv[0], "coa") == 0) return &proxy_coa_stats;
+
+		if (strcmp(argv[0], "disconnect") == 0) return &proxy_dsc_stats;
+#endif
+
+		cprintf_error(listener, "Should specify [auth|acct|coa|disconnect]\n");
+		return NULL;
+	}
+
+	*home = get_home_server(listener, argc, argv, NULL);
+	if (!*home) return NULL;
+
+	return &(*home)->stats;
+}
+
+static int command_show_latency_home_server(rad_listen_t *listener, int argc, char *argv[])
+{
+	fr_stats_t	*stats;
+	home_server_t	*home;
+
+	stats = get_home_server_stats(listener, argc, argv, &home);
+	if (!stats) return 0;
+
+	command_print_latency(listener, stats, true);
+
+	return CMD_OK;
+}
+#endif
+
+static int command_show_latency_client(rad_listen_t *listener, int argc, char *argv[])
+{
+	fr_stats_t	*stats;
+	bool		auth;
+
+	stats = get_client_stats(listener, argc, argv, &auth);
+	if (!stats) return 0;
+
+	if (stats->no_hist) {
+		cprintf_error(listener, "Client latency histograms are disabled, see 'statistics { client_latency }'\n");
+		return 0;
+	}
+
+	command_print_latency(listener, stats, true);
+
+	return CMD_OK;
+}
+
+static int command_show_latency_socket(rad_listen_t *listener, int argc, char *argv[])
+{
+	rad_listen_t *sock;
+
+	sock = get_socket(listener, argc, argv, NULL);
+	if (!sock) return 0;
+
+	command_print_latency(listener, &sock->stats, true);
+
+	return CMD_OK;
+}
+
+static int command_show_module_latency(rad_listen_t *listener, int argc, char *argv[])
+{
+	CONF_SECTION		*cs;
+	module_instance_t	*instance;
+	fr_stats_t		stats;
+
+	if (argc != 1) {
+		cprintf_error(listener, "No module name was given\n");
+		return CMD_FAIL;
+	}
+
+	cs = cf_section_sub_find(main_config.config, "modules");
+	if (!cs) return CMD_FAIL;
+
+	instance = module_find(cs, argv[0]);
+	if (!instance) {
+		cprintf_error(listener, "No such module \"%s\"\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	fr_stats_read(&stats, &instance->stats);
+
+	cprintf(listener, "calls\t%" PRIu64 "\n", (uint64_t) stats.total_requests);
+	command_print_latency(listener, &instance->stats, true);
+
+	return CMD_OK;
+}
+
+/** Write a line of output for a module's stats callback
+ *
+ */
+static void CC_HINT(format (printf, 2, 3)) command_module_stats_print(void *uctx, char const *fmt, ...)
+{
+	va_list	ap;
+	char	buffer[256];
+
+	va_start(ap, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, ap);
+	va_end(ap);
+
+	(void) cprintf(uctx, "%s", buffer);
+}
+
+static int command_stats_module(rad_listen_t *listener, int argc, char *argv[])
+{
+	CONF_SECTION		*cs;
+	module_instance_t	*instance;
+
+	if (argc != 1) {
+		cprintf_error(listener, "No module name was given\n");
+		return CMD_FAIL;
+	}
+
+	cs = cf_section_sub_find(main_config.config, "modules");
+	if (!cs) return CMD_FAIL;
+
+	instance = module_find(cs, argv[0]);
+	if (!instance) {
+		cprintf_error(listener, "No such module \"%s\"\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	if (!instance->module->stats) {
+		cprintf_error(listener, "Module \"%s\" doesn't keep any statistics\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	instance->module->stats(instance->data, command_module_stats_print, listener);
+
+	return CMD_OK;
+}
+#endif	/* WITH_STATS */
+
+static int _command_print_profile(void *uctx, fr_profile_entry_t const *entry)
+{
+	rad_listen_t *listener = uctx;
+
+	if (!entry->calls) return 0;
+
+	cprintf(listener, "%s\t%s\t%s%s%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+		entry->server, entry->section,
+		(entry->type == FR_PROFILE_XLAT) ? "%{" : "", entry->name,
+		(entry->type == FR_PROFILE_XLAT) ? "}" : "",
+		entry->calls, entry->wall, entry->cpu, entry->yield, entry->max);
+
+	return 0;
+}
+
+static int command_show_profile(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	if (!fr_profile_enabled) cprintf(listener, "# profiling is disabled\n");
+
+	cprintf(listener, "# server\tsection\tname\tcalls\twall_us\tcpu_us\tyield_us\tmax_us\n");
+	if (fr_profile_walk(_command_print_profile, listener) < 0) {
+		cprintf_error(listener, "Failed reading profile\n");
+		return CMD_FAIL;
+	}
+
+	return CMD_OK;
+}
+
+static int command_set_profile(rad_listen_t *listener, int argc, char *argv[])
+{
+	if (argc < 1) {
+		cprintf_error(listener, "Must specify <on|off|reset>\n");
+		return CMD_FAIL;
+	}
+
+	if (strcmp(argv[0], "on") == 0) {
+		fr_profile_enabled = true;
+
+	} else if (strcmp(argv[0], "off") == 0) {
+		fr_profile_enabled = false;
+
+	} else if (strcmp(argv[0], "reset") == 0) {
+		fr_profile_reset();
+
+	} else {
+		cprintf_error(listener, "Unknown argument \"%s\"\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	return CMD_OK;
+}
+
 
 static fr_command_table_t command_table_inject[] = {
 	{ "to", FR_WRITE,
@@ -2343,6 +2669,11 @@ static fr_command_table_t command_table_show_module[] = {
 	{ "flags", FR_READ,
 	  "show module flags <module> - show other module properties",
 	  command_show_module_flags, NULL },
+#ifdef WITH_STATS
+	{ "latency", FR_READ,
+	  "show module latency <module> - show how long calls to <module> took",
+	  command_show_module_latency, NULL },
+#endif
 	{ "list", FR_READ,
 	  "show module list - shows list of loaded modules",
 	  command_show_modules, NULL },
@@ -2378,6 +2709,29 @@ static fr_command_table_t command_table_show_home[] = {
 };
 #endif
 
+#ifdef WITH_STATS
+static fr_command_table_t command_table_show_latency[] = {
+	{ "client", FR_READ,
+	  "show latency client [auth/acct] <ipaddr> [udp|tcp] [listen <ipaddr> <port>] "
+	  "- show latency histogram for given client, or for all clients",
+	  command_show_latency_client, NULL },
+
+#ifdef WITH_PROXY
+	{ "home_server", FR_READ,
+	  "show latency home_server [<ipaddr>|auth|acct|coa|disconnect] <port> [udp|tcp] "
+	  "- show latency histogram for given home server, or for all home servers",
+	  command_show_latency_home_server, NULL },
+#endif
+
+	{ "socket", FR_READ,
+	  "show latency socket <ipaddr> <port> [udp|tcp] "
+	  "- show latency histogram for given socket",
+	  command_show_latency_socket, NULL },
+
+	{ NULL, 0, NULL, NULL, NULL }
+};
+#endif
+
 static fr_command_table_t command_table_show_listener[] = {
 	{ "enabled", FR_READ,
 	  "show listener all enabled - shows whether the server is configured to accept packets",
@@ -2438,6 +2792,11 @@ static fr_command_table_t command_table_show[] = {
 	{ "home_server", FR_READ,
 	  "show home_server <command> - do sub-command of home_server",
 	  NULL, command_table_show_home },
+#endif
+#ifdef WITH_STATS
+	{ "latency", FR_READ,
+	  "show latency <command> - show latency histograms",
+	  NULL, command_table_show_latency },
 #endif
 	{ "listener", FR_READ,
 	  "show listener <command> - do sub-command of listener",
@@ -2453,6 +2812,10 @@ static fr_command_table_t command_table_show[] = {
 	  "show module <command> - do sub-command of module",
 	  NULL, command_table_show_module },
 
+	{ "profile", FR_READ,
+	  "show profile - show time spent in module calls and xlat expansions",
+	  command_show_profile, NULL },
+
 #ifdef HAVE_GPERFTOOLS_PROFILER_H
 	{ "profiler", FR_READ,
 	  "show profiler <command> - do sub-command of profiler",
@@ -2631,10 +2994,13 @@ static char const *elapsed_names[8] = {
 #endif
 #endif
 
-static int command_print_stats(rad_listen_t *listener, fr_stats_t *stats,
+static int command_print_stats(rad_listen_t *listener, fr_stats_t *in,
 			       int auth, int server)
 {
 	int i;
+	fr_stats_t sum, *stats = &sum;
+
+	fr_stats_read(&sum, in);
 
 	cprintf(listener, "requests\t" PU "\n", stats->total_requests);
 	cprintf(listener, "responses\t" PU "\n", stats->total_responses);
@@ -2665,6 +3031,8 @@ static int command_print_stats(rad_listen_t *listener, fr_stats_t *stats,
 			elapsed_names[i], stats->elapsed[i]);
 	}
 
+	command_print_latency(listener, in, false);
+
 	return CMD_OK;
 }
 
@@ -2677,6 +3045,23 @@ static int command_stats_state(rad_listen_t *listener, UNUSED int argc, UNUSED c
 	return CMD_OK;
 }
 
+#ifdef HAVE_REGEX
+static int command_stats_regex(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	uint64_t	hits, misses, evictions;
+	uint32_t	entries;
+
+	regex_cache_stats(&hits, &misses, &evictions, &entries);
+
+	cprintf(listener, "regex_cache_hits\t%" PRIu64 "\n", hits);
+	cprintf(listener, "regex_cache_misses\t%" PRIu64 "\n", misses);
+	cprintf(listener, "regex_cache_evictions\t%" PRIu64 "\n", evictions);
+	cprintf(listener, "regex_cache_entries\t%" PRIu32 "\n", entries);
+
+	return CMD_OK;
+}
+#endif
+
 #ifndef NDEBUG
 static int command_stats_memory(rad_listen_t *listener, int argc, char *argv[])
 {
@@ -2708,6 +3093,7 @@ static FR_NAME_NUMBER state_names[] = {
 	{ "unopened", STATE_UNOPENED },
 	{ "unlocked", STATE_UNLOCKED },
 	{ "processing", STATE_PROCESSING },
+	{ "draining", STATE_DRAINING },
 
 	{ "header", STATE_HEADER },
 	{ "vps", STATE_VPS },
@@ -2767,8 +3153,10 @@ static int command_stats_detail(rad_listen_t *listener, int argc, char *argv[])
 
 	cprintf(listener, "packets\t%d\n", data->packets);
 	cprintf(listener, "tries\t%d\n", data->tries);
-	cprintf(listener, "offset\t%u\n", (unsigned int) data->offset);
+	cprintf(listener, "offset\t%u\n", (unsigned int) data->done_offset);
 	cprintf(listener, "size\t%u\n", (unsigned int) buf.st_size);
+	cprintf(listener, "outstanding\t%d\n", data->outstanding);
+	cprintf(listener, "window\t%u\n", data->window);
 
 	return CMD_OK;
 }
@@ -2777,48 +3165,18 @@ static int command_stats_detail(rad_listen_t *listener, int argc, char *argv[])
 #ifdef WITH_PROXY
 static int command_stats_home_server(rad_listen_t *listener, int argc, char *argv[])
 {
-	home_server_t *home;
+	fr_stats_t	*stats;
+	home_server_t	*home;
 
-	if (argc == 0) {
-		cprintf_error(listener, "Must specify [auth|acct|coa|disconnect] OR <ipaddr> <port>\n");
-		return 0;
-	}
+	stats = get_home_server_stats(listener, argc, argv, &home);
+	if (!stats) return 0;
 
-	if (argc == 1) {
-		if (strcmp(argv[0], "auth") == 0) {
-			return command_print_stats(listener,
-						   &proxy_auth_stats, 1, 1);
-		}
-
-#ifdef WITH_ACCOUNTING
-		if (strcmp(argv[0], "acct") == 0) {
-			return command_print_stats(listener,
-						   &proxy_acct_stats, 0, 1);
-		}
-#endif
-
-#ifdef WITH_ACCOUNTING
-		if (strcmp(argv[0], "coa") == 0) {
-			return command_print_stats(listener,
-						   &proxy_coa_stats, 0, 1);
-		}
-#endif
-
-#ifdef WITH_ACCOUNTING
-		if (strcmp(argv[0], "disconnect") == 0) {
-			return command_print_stats(listener,
-						   &proxy_dsc_stats, 0, 1);
-		}
-#endif
-
-		cprintf_error(listener, "Should specify [auth|acct|coa|disconnect]\n");
-		return 0;
+	if (!home) {
+		return command_print_stats(listener, stats,
+					   (stats == &proxy_auth_stats), 1);
 	}
 
-	home = get_home_server(listener, argc, argv, NULL);
-	if (!home) return 0;
-
-	command_print_stats(listener, &home->stats,
+	command_print_stats(listener, stats,
 			    (home->type == HOME_TYPE_AUTH), 1);
 	cprintf(listener, "outstanding\t%d\n", home->currently_outstanding);
 	return CMD_OK;
@@ -2829,83 +3187,9 @@ static int command_stats_client(rad_listen_t *listener, int argc, char *argv[])
 {
 	bool auth = true;
 	fr_stats_t *stats;
-	RADCLIENT *client, fake;
-
-	if (argc < 1) {
-		cprintf_error(listener, "Must specify [auth/acct]\n");
-		return 0;
-	}
-
-	if (argc == 1) {
-		/*
-		 *	Global statistics.
-		 */
-		fake.auth = radius_auth_stats;
-#ifdef WITH_ACCOUNTING
-		fake.acct = radius_acct_stats;
-#endif
-#ifdef WITH_COA
-		fake.coa = radius_coa_stats;
-		fake.dsc = radius_dsc_stats;
-#endif
-		client = &fake;
-
-	} else {
-		/*
-		 *	Per-client statistics.
-		 */
-		client = get_client(listener, argc - 1, argv + 1);
-		if (!client) return 0;
-	}
-
-	if (strcmp(argv[0], "auth") == 0) {
-		auth = true;
-		stats = &client->auth;
-
-	} else if (strcmp(argv[0], "acct") == 0) {
-#ifdef WITH_ACCOUNTING
-		auth = false;
-		stats = &client->acct;
-#else
-		cprintf_error(listener, "This server was built without accounting support.\n");
-		return 0;
-#endif
 
-	} else if (strcmp(argv[0], "coa") == 0) {
-#ifdef WITH_COA
-		auth = false;
-		stats = &client->coa;
-#else
-		cprintf_error(listener, "This server was built without CoA support.\n");
-		return 0;
-#endif
-
-	} else if (strcmp(argv[0], "disconnect") == 0) {
-#ifdef WITH_COA
-		auth = false;
-		stats = &client->dsc;
-#else
-		cprintf_error(listener, "This server was built without CoA support.\n");
-		return 0;
-#endif
-
-	} else {
-		cprintf_error(listener, "Unknown statistics type\n");
-		return 0;
-	}
-
-	/*
-	 *	Global results for all client.
-	 */
-	if (argc == 1) {
-#ifdef WITH_ACCOUNTING
-		if (!auth) {
-			return command_print_stats(listener,
-						   &radius_acct_stats, auth, 0);
-		}
-#endif
-		return command_print_stats(listener, &radius_auth_stats, auth, 0);
-	}
+	stats = get_client_stats(listener, argc, argv, &auth);
+	if (!stats) return 0;
 
 	return command_print_stats(listener, stats, auth, 0);
 }
@@ -3067,6 +3351,9 @@ static fr_command_table_t command_table_set[] = {
 	{ "listener", FR_WRITE,
 	  "set listener <command> - set listener commands",
 	  NULL, command_table_set_listeners },
+	{ "profile", FR_WRITE,
+	  "set profile <on|off|reset> - enable, disable or reset module and xlat timing",
+	  command_set_profile, NULL },
 
 	{ NULL, 0, NULL, NULL, NULL }
 };
@@ -3091,6 +3378,16 @@ static fr_command_table_t command_table_stats[] = {
 	  command_stats_home_server, NULL },
 #endif
 
+	{ "module", FR_READ,
+	  "stats module <module> - show statistics kept by the given module",
+	  command_stats_module, NULL },
+
+#ifdef HAVE_REGEX
+	{ "regex", FR_READ,
+	  "stats regex - show statistics for the caches of runtime regular expressions",
+	  command_stats_regex, NULL },
+#endif
+
 	{ "state", FR_READ,
 	  "stats state - show statistics for states",
 	  command_stats_state, NULL },
@@ -3385,54 +3682,35 @@ static void print_help(rad_listen_t *listener, int argc, char *argv[],
 #define MAX_ARGV (16)
 
 /*
- *	Check if an incoming request is "ok"
+ *	Parse and run one command.
  *
- *	It takes packets, not requests.  It sees if the packet looks
- *	OK.  If so, it does a number of sanity checks on it.
+ *	Returns -1 if the socket should be closed, 0 otherwise.  The
+ *	status of the command is written to *status.
  */
-static int command_domain_recv_co(rad_listen_t *listener, fr_cs_buffer_t *co)
+static int command_run(rad_listen_t *listener, fr_cs_buffer_t *co, char *command, size_t command_len,
+		       uint32_t *status)
 {
 	int i;
-	uint32_t status;
-	ssize_t r, len;
+	ssize_t len;
 	int argc;
-	fr_conduit_type_t conduit;
 	char *my_argv[MAX_ARGV], **argv;
 	fr_command_table_t *table;
-	uint8_t *command;
-
-	r = fr_conduit_drain(listener->fd, &conduit, co->buffer, sizeof(co->buffer) - 1, &command, &co->offset);
-	if ((r < 0) && ((errno == EINTR) || (errno == EAGAIN))) return 0;
-
-	if (r <= 0) {
-	do_close:
-		command_close_socket(listener);
-		return 0;
-	}
-
-	/*
-	 *	We need more data.  Go read it.
-	 */
-	if (conduit == FR_CONDUIT_WANT_MORE) {
-		return 0;
-	}
 
-	status = 0;
-	command[r] = '\0';
+	*status = 0;
 	DEBUG("radmin> %s", command);
 
-	argc = dict_str_to_argvX((char *) command, my_argv, MAX_ARGV);
-	if (argc == 0) goto do_next; /* empty strings are OK */
+	argc = dict_str_to_argvX(command, my_argv, MAX_ARGV);
+	if (argc == 0) return 0; /* empty strings are OK */
 
 	if (argc < 0) {
 		cprintf_error(listener, "Failed parsing command '%s'.\n",
 			command);
-		goto do_next;
+		return 0;
 	}
 
 	argv = my_argv;
 
-	for (len = 0; len <= co->offset; len++) {
+	for (len = 0; len <= (ssize_t) command_len; len++) {
 		if (command[len] < 0x20) {
 			command[len] = '\0';
 			break;
@@ -3443,7 +3721,7 @@ static int command_domain_recv_co(rad_listen_t *listener, fr_cs_buffer_t *co)
 	 *	Hard-code exit && quit.
 	 */
 	if ((strcmp(argv[0], "exit") == 0) ||
-	    (strcmp(argv[0], "quit") == 0)) goto do_close;
+	    (strcmp(argv[0], "quit") == 0)) return -1;
 
 	table = command_table;
  retry:
@@ -3456,7 +3734,7 @@ static int command_domain_recv_co(rad_listen_t *listener, fr_cs_buffer_t *co)
 			if (((co->mode & FR_WRITE) == 0) &&
 			    ((table[i].mode & FR_WRITE) != 0)) {
 				cprintf_error(listener, "You do not have write permission.  See \"mode = rw\" in the \"listen\" section for this socket.\n");
-				goto do_next;
+				return 0;
 			}
 
 			if (table[i].table) {
@@ -3480,11 +3758,11 @@ static int command_domain_recv_co(rad_listen_t *listener, fr_cs_buffer_t *co)
 
 			if (!table[i].func) {
 				cprintf_error(listener, "Invalid command\n");
-				goto do_next;
+				return 0;
 			}
 
-			status = table[i].func(listener, argc - 1, argv + 1);
-			goto do_next;
+			*status = table[i].func(listener, argc - 1, argv + 1);
+			return 0;
 		}
 	}
 
@@ -3506,14 +3784,126 @@ static int command_domain_recv_co(rad_listen_t *listener, fr_cs_buffer_t *co)
 			}
 
 			print_help(listener, argc - 1, argv + 1, table, recursive);
-			goto do_next;
+			return 0;
 		}
 
 		cprintf_error(listener, "Unknown command \"%s\"\n",
 			      argv[0]);
 	}
 
- do_next:
+	return 0;
+}
+
+/*
+ *	Send the result of one command in a batch.
+ */
+/*
+ *	Run a batch of commands, one per line.
+ *
+ *	Each command which isn't blank gets one FR_CONDUIT_BATCH_RESULT,
+ *	in the same order as the commands.  The batch is finished with
+ *	a FR_CONDUIT_CMD_STATUS, which is FR_CONDUIT_SUCCESS only if
+ *	every command succeeded.
+ *
+ *	Returns -1 if the socket should be closed, 0 otherwise.
+ */
+static int command_batch(rad_listen_t *listener, fr_cs_buffer_t *co, char *commands, size_t commands_len)
+{
+	char			*p, *next, *end;
+	uint32_t		status, batch_status = CMD_OK;
+	command_capture_t	capture;
+	int			rcode;
+	ssize_t			r;
+
+	end = commands + commands_len;
+
+	for (p = commands; p < end; p = next) {
+		next = memchr(p, '\n', end - p);
+		if (next) {
+			*next++ = '\0';
+		} else {
+			next = end;
+		}
+
+		if (!fr_conduit_batch_is_command(p, strlen(p))) continue;
+
+		capture.listener = listener;
+		capture.out = talloc_strdup(listener, "");
+		capture.err = talloc_strdup(listener, "");
+		if (!capture.out || !capture.err) {
+		error:
+			talloc_free(capture.out);
+			talloc_free(capture.err);
+			return -1;
+		}
+
+		command_capture = &capture;
+		rcode = command_run(listener, co, p, strlen(p), &status);
+		command_capture = NULL;
+
+		if ((rcode < 0) || !capture.out || !capture.err) goto error;
+
+		if (status != CMD_OK) batch_status = CMD_FAIL;
+
+		r = fr_conduit_batch_result_write(listener->fd, status,
+						  capture.out, talloc_array_length(capture.out) - 1,
+						  capture.err, talloc_array_length(capture.err) - 1);
+		talloc_free(capture.out);
+		talloc_free(capture.err);
+		if (r <= 0) return -1;
+	}
+
+	batch_status = htonl(batch_status);
+	r = fr_conduit_write(listener->fd, FR_CONDUIT_CMD_STATUS, &batch_status, sizeof(batch_status));
+	if (r <= 0) return -1;
+
+	return 0;
+}
+
+/*
+ *	Check if an incoming request is "ok"
+ *
+ *	It takes packets, not requests.  It sees if the packet looks
+ *	OK.  If so, it does a number of sanity checks on it.
+ */
+static int command_domain_recv_co(rad_listen_t *listener, fr_cs_buffer_t *co)
+{
+	uint32_t status;
+	ssize_t r;
+	fr_conduit_type_t conduit;
+	uint8_t *command;
+
+	r = fr_conduit_drain(listener->fd, &conduit, co->buffer, sizeof(co->buffer) - 1, &command, &co->offset);
+	if ((r < 0) && ((errno == EINTR) || (errno == EAGAIN))) return 0;
+
+	if (r <= 0) {
+	do_close:
+		command_close_socket(listener);
+		return 0;
+	}
+
+	/*
+	 *	We need more data.  Go read it.
+	 */
+	if (conduit == FR_CONDUIT_WANT_MORE) {
+		return 0;
+	}
+
+	command[r] = '\0';
+
+	if (conduit == FR_CONDUIT_BATCH) {
+		/*
+		 *	Reset offset now that the batch has been fully read
+		 */
+		co->offset = 0;
+
+		if (command_batch(listener, co, (char *) command, r) < 0) goto do_close;
+
+		return 0;
+	}
+
+	if (command_run(listener, co, (char *) command, r, &status) < 0) goto do_close;
+
 	/*
 	 * Reset offset now that command has been fully read
 	 */
@@ -232,3 +232,88 @@ ssize_t fr_conduit_write(int fd, fr_conduit_type_t conduit, void const *inbuf, s
 
 	return buflen;
 }
+
+/** Whether a line of a batch holds a command
+ *
+ * Blank lines are skipped by both radmin and the server, so that
+ * they don't get a FR_CONDUIT_BATCH_RESULT.
+ */
+bool fr_conduit_batch_is_command(char const *line, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if ((line[i] != ' ') && (line[i] != '\t') && (line[i] != '\r')) return true;
+	}
+
+	return false;
+}
+
+/** Write the result of one command in a batch
+ *
+ * @return the length of the message, or <= 0 on error.
+ */
+ssize_t fr_conduit_batch_result_write(int fd, uint32_t status,
+				      void const *out, size_t out_len, void const *err, size_t err_len)
+{
+	ssize_t				r;
+	rconduit_t			hdr;
+	fr_conduit_batch_result_t	result;
+
+	hdr.conduit = htonl(FR_CONDUIT_BATCH_RESULT);
+	hdr.length = htonl(sizeof(result) + out_len + err_len);
+
+	result.status = htonl(status);
+	result.out_len = htonl(out_len);
+	result.err_len = htonl(err_len);
+
+	r = lo_write(fd, &hdr, sizeof(hdr));
+	if (r <= 0) return r;
+
+	r = lo_write(fd, &result, sizeof(result));
+	if (r <= 0) return r;
+
+	if (out_len) {
+		r = lo_write(fd, out, out_len);
+		if (r <= 0) return r;
+	}
+
+	if (err_len) {
+		r = lo_write(fd, err, err_len);
+		if (r <= 0) return r;
+	}
+
+	return sizeof(result) + out_len + err_len;
+}
+
+/** Split a FR_CONDUIT_BATCH_RESULT into its parts
+ *
+ * If the message was truncated by fr_conduit_read(), the output and
+ * errors are truncated to fit.
+ *
+ * @return 0 on success, -1 if the message is too short to hold a result.
+ */
+int fr_conduit_batch_result_parse(uint32_t *status, char const **out, size_t *out_len,
+				  char const **err, size_t *err_len, void const *data, size_t data_len)
+{
+	fr_conduit_batch_result_t	result;
+	char const			*p = data;
+
+	if (data_len < sizeof(result)) return -1;
+
+	memcpy(&result, p, sizeof(result));
+	p += sizeof(result);
+	data_len -= sizeof(result);
+
+	*status = ntohl(result.status);
+
+	*out_len = ntohl(result.out_len);
+	if (*out_len > data_len) *out_len = data_len;
+	*out = p;
+
+	*err_len = ntohl(result.err_len);
+	if (*err_len > (data_len - *out_len)) *err_len = data_len - *out_len;
+	*err = p + *out_len;
+
+	return 0;
+}
@@ -139,8 +139,18 @@ struct fr_connection_pool_t {
 	fr_connection_pool_reconnect_t	reconnect;	//!< Called during connection pool reconnect.
 
 	fr_connection_pool_state_t	state;	//!< Stats and state of the connection pool.
+
+	bool		in_list;		//!< Whether the pool is in the list of all pools.
+	fr_connection_pool_t	*prev;		//!< Previous pool in the list of all pools.
+	fr_connection_pool_t	*next;		//!< Next pool in the list of all pools.
 };
 
+/*
+ *	All pools, so their state can be exported.
+ */
+static pthread_mutex_t		pool_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_connection_pool_t	*pool_list = NULL;
+
 static const CONF_PARSER connection_config[] = {
 	{ FR_CONF_OFFSET("start", PW_TYPE_INTEGER, fr_connection_pool_t, start), .dflt = "5" },
 	{ FR_CONF_OFFSET("min", PW_TYPE_INTEGER, fr_connection_pool_t, min), .dflt = "5" },
@@ -160,6 +170,50 @@ static const CONF_PARSER connection_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/** Add a pool to the list of all pools
+ *
+ */
+static void connection_pool_list_add(fr_connection_pool_t *pool)
+{
+	pthread_mutex_lock(&pool_list_mutex);
+	pool->prev = NULL;
+	pool->next = pool_list;
+	if (pool_list) pool_list->prev = pool;
+	pool_list = pool;
+	pool->in_list = true;
+	pthread_mutex_unlock(&pool_list_mutex);
+}
+
+/** Remove a pool from the list of all pools
+ *
+ * May be called multiple times for the same pool.
+ */
+static void connection_pool_list_remove(fr_connection_pool_t *pool)
+{
+	pthread_mutex_lock(&pool_list_mutex);
+	if (pool->in_list) {
+		if (pool->prev) {
+			pool->prev->next = pool->next;
+		} else {
+			pool_list = pool->next;
+		}
+		if (pool->next) pool->next->prev = pool->prev;
+		pool->in_list = false;
+	}
+	pthread_mutex_unlock(&pool_list_mutex);
+}
+
+/** Remove a pool from the list of all pools when it's freed
+ *
+ * Pools may be freed via their parent ctx, without calling #fr_connection_pool_free.
+ */
+static int _connection_pool_free(fr_connection_pool_t *pool)
+{
+	connection_pool_list_remove(pool);
+
+	return 0;
+}
+
 /** Order connections by reserved most recently
  */
 static int last_reserved_cmp(void const *one, void const *two)
@@ -1039,6 +1093,9 @@ fr_connection_pool_t *fr_connection_pool_init(TALLOC_CTX *ctx,
 	pthread_cond_init(&pool->done_spawn, NULL);
 	pthread_cond_init(&pool->done_reconnecting, NULL);
 
+	talloc_set_destructor(pool, _connection_pool_free);
+	connection_pool_list_add(pool);
+
 	DEBUG2("Initialising connection pool");
 
 	{
@@ -1146,6 +1203,37 @@ fr_connection_pool_state_t const *fr_connection_pool_state(fr_connection_pool_t
 	return &pool->state;
 }
 
+/** Call a function with the state of every connection pool
+ *
+ * The state is copied with the pool's mutex held, so the callback sees
+ * consistent values.  The callback must not create or free pools.
+ *
+ * @param[in] callback to call for each pool.  If it returns < 0, the walk stops.
+ * @param[in] uctx passed to the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the callback returned < 0.
+ */
+int fr_connection_pool_walk(fr_connection_pool_walk_t callback, void *uctx)
+{
+	fr_connection_pool_t		*pool;
+	fr_connection_pool_state_t	state;
+	int				ret = 0;
+
+	pthread_mutex_lock(&pool_list_mutex);
+	for (pool = pool_list; pool != NULL; pool = pool->next) {
+		pthread_mutex_lock(&pool->mutex);
+		memcpy(&state, &pool->state, sizeof(state));
+		pthread_mutex_unlock(&pool->mutex);
+
+		ret = callback(uctx, pool->log_prefix, &state);
+		if (ret < 0) break;
+	}
+	pthread_mutex_unlock(&pool_list_mutex);
+
+	return (ret < 0) ? -1 : 0;
+}
+
 /** Connection pool get timeout
  *
  * @param[in] pool to get connection timeout for.
@@ -1304,6 +1392,8 @@ void fr_connection_pool_free(fr_connection_pool_t *pool)
 
 	DEBUG2("Removing connection pool");
 
+	connection_pool_list_remove(pool);
+
 	pthread_mutex_lock(&pool->mutex);
 
 	/*
@@ -0,0 +1,343 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file detail.c
+ * @brief Encode and decode binary detail records.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+
+/** Pack an IP address into a record header
+ *
+ * @return the address family as written to the header.
+ */
+static uint8_t detail_binary_af(uint8_t *out, fr_ipaddr_t const *ipaddr)
+{
+	switch (ipaddr->af) {
+	case AF_INET:
+		memcpy(out, &ipaddr->ipaddr.ip4addr, sizeof(ipaddr->ipaddr.ip4addr));
+		return 4;
+
+	case AF_INET6:
+		memcpy(out, &ipaddr->ipaddr.ip6addr, sizeof(ipaddr->ipaddr.ip6addr));
+		return 6;
+
+	default:
+		return 0;
+	}
+}
+
+/** Unpack an IP address from a record header
+ *
+ * @param[out] out Where to write the address.  af is AF_UNSPEC if the header has no address.
+ * @param[in] af from the record header.
+ * @param[in] addr from the record header.
+ */
+void detail_binary_ipaddr(fr_ipaddr_t *out, uint8_t af, uint8_t const *addr)
+{
+	memset(out, 0, sizeof(*out));
+
+	switch (af) {
+	case 4:
+		out->af = AF_INET;
+		out->prefix = 32;
+		memcpy(&out->ipaddr.ip4addr, addr, sizeof(out->ipaddr.ip4addr));
+		break;
+
+	case 6:
+		out->af = AF_INET6;
+		out->prefix = 128;
+		memcpy(&out->ipaddr.ip6addr, addr, sizeof(out->ipaddr.ip6addr));
+		break;
+
+	default:
+		out->af = AF_UNSPEC;
+		break;
+	}
+}
+
+/** Calculate the checksum of a record
+ *
+ * The flags are excluded, as they're updated in place.
+ */
+static uint32_t detail_binary_checksum(detail_binary_hdr_t const *hdr, uint8_t const *data, size_t data_len)
+{
+	detail_binary_hdr_t copy;
+
+	memcpy(&copy, hdr, sizeof(copy));
+	copy.flags = 0;
+	copy.checksum = 0;
+
+	return fr_hash_update(data, data_len, fr_hash(&copy, sizeof(copy)));
+}
+
+/** Encode a packet as a binary detail record
+ *
+ * @param[in] ctx to allocate the record in.
+ * @param[out] out Where to write a pointer to the record.
+ * @param[in] packet to encode.  Only the code, id and addresses are used.
+ * @param[in] vps to encode.  Attributes which can't be sent in a RADIUS packet are skipped.
+ * @param[in] client_ipaddr the packet was received from.  May be NULL.
+ * @param[in] timestamp when the packet was received.
+ * @param[in] srcdst Whether to include the src/dst addresses and ports of the packet.
+ * @return
+ *	- The length of the record.
+ *	- -1 on error.
+ */
+ssize_t detail_binary_encode(TALLOC_CTX *ctx, uint8_t **out, RADIUS_PACKET const *packet, VALUE_PAIR *vps,
+			     fr_ipaddr_t const *client_ipaddr, time_t timestamp, bool srcdst)
+{
+	RADIUS_PACKET		*encoded, *original;
+	detail_binary_hdr_t	hdr;
+	uint8_t			*record;
+	size_t			len;
+
+	*out = NULL;
+
+	encoded = fr_radius_alloc(ctx, false);
+	if (!encoded) return -1;
+
+	/*
+	 *	All the vectors are zero, so encrypted attributes
+	 *	can be decoded without knowing what the original
+	 *	request was.
+	 */
+	original = fr_radius_alloc(encoded, false);
+	if (!original) {
+	error:
+		encoded->vps = NULL;
+		talloc_free(encoded);
+		return -1;
+	}
+
+	encoded->code = packet->code;
+	encoded->id = packet->id & 0xff;
+	encoded->vps = vps;
+
+	if (fr_radius_encode(encoded, original, DETAIL_BINARY_SECRET) < 0) goto error;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DETAIL_BINARY_MAGIC, sizeof(hdr.magic));
+	hdr.version = DETAIL_BINARY_VERSION;
+	hdr.length = htonl(encoded->data_len);
+	hdr.timestamp = htonl((uint32_t) timestamp);
+
+	if (client_ipaddr) hdr.client_af = detail_binary_af(hdr.client_ipaddr, client_ipaddr);
+
+	if (srcdst) {
+		hdr.af = detail_binary_af(hdr.src_ipaddr, &packet->src_ipaddr);
+		(void) detail_binary_af(hdr.dst_ipaddr, &packet->dst_ipaddr);
+		hdr.src_port = htons(packet->src_port);
+		hdr.dst_port = htons(packet->dst_port);
+	}
+
+	hdr.checksum = htonl(detail_binary_checksum(&hdr, encoded->data, encoded->data_len));
+
+	len = sizeof(hdr) + encoded->data_len;
+	record = talloc_array(ctx, uint8_t, len);
+	if (!record) {
+		fr_strerror_printf("Out of memory");
+		goto error;
+	}
+
+	memcpy(record, &hdr, sizeof(hdr));
+	memcpy(record + sizeof(hdr), encoded->data, encoded->data_len);
+
+	encoded->vps = NULL;
+	talloc_free(encoded);
+
+	*out = record;
+
+	return len;
+}
+
+/** Read a binary detail record, and check it's intact
+ *
+ * The header is left in network byte order.  A corrupt record whose
+ * length is sane is read in full, so the caller can skip it and carry
+ * on with the next one.
+ *
+ * @param[in] fp to read from.  Must be positioned at the start of a record.
+ * @param[out] hdr Where to write the record header.
+ * @param[out] data Where to write the RADIUS packet.
+ * @param[in] data_len Size of the data buffer.  Should be at least MAX_PACKET_LEN.
+ * @return
+ *	- 1 if a record was read.
+ *	- 0 on EOF.
+ *	- -1 if the record was truncated, or its length is invalid, so the
+ *	  start of the next record can't be found.
+ *	- -2 if the record was corrupt.  fp is positioned after it.
+ */
+int detail_binary_read(FILE *fp, detail_binary_hdr_t *hdr, uint8_t *data, size_t data_len)
+{
+	size_t		len;
+	uint32_t	length;
+
+	len = fread(hdr, 1, sizeof(*hdr), fp);
+	if (len == 0) {
+		if (!ferror(fp)) return 0;
+
+		fr_strerror_printf("Failed reading record: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (len < sizeof(*hdr)) {
+		fr_strerror_printf("Truncated record header");
+		return -1;
+	}
+
+	/*
+	 *	Without a sane length there's no way of finding the
+	 *	next record.
+	 */
+	length = ntohl(hdr->length);
+	if ((length < 20) || (length > data_len)) {	/* RADIUS header */
+		fr_strerror_printf("Invalid record length %u", length);
+		return -1;
+	}
+
+	if (fread(data, 1, length, fp) < length) {
+		fr_strerror_printf("Truncated record");
+		return -1;
+	}
+
+	/*
+	 *	The framing is intact, so only this record is lost.
+	 */
+	if (memcmp(hdr->magic, DETAIL_BINARY_MAGIC, sizeof(hdr->magic)) != 0) {
+		fr_strerror_printf("Invalid record magic");
+		return -2;
+	}
+
+	if (hdr->version != DETAIL_BINARY_VERSION) {
+		fr_strerror_printf("Unsupported record version %u", hdr->version);
+		return -2;
+	}
+
+	if (detail_binary_checksum(hdr, data, length) != ntohl(hdr->checksum)) {
+		fr_strerror_printf("Record checksum mismatch");
+		return -2;
+	}
+
+	if ((((size_t) data[2] << 8) | data[3]) != length) {
+		fr_strerror_printf("Packet length doesn't match record length");
+		return -2;
+	}
+
+	return 1;
+}
+
+/** Decode a binary detail record
+ *
+ * Produces the same attributes a text detail entry would, including
+ * Packet-Type, and the packet src/dst attributes if the record has them.
+ *
+ * @param[in] ctx to allocate attributes in.
+ * @param[out] out Where to write the attributes.
+ * @param[in] hdr of the record, as returned by #detail_binary_read.
+ * @param[in] data of the record, as returned by #detail_binary_read.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int detail_binary_decode(TALLOC_CTX *ctx, VALUE_PAIR **out, detail_binary_hdr_t const *hdr, uint8_t const *data)
+{
+	RADIUS_PACKET	*packet, *original;
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp, *head = NULL;
+	fr_ipaddr_t	ipaddr;
+
+	*out = NULL;
+
+	packet = fr_radius_alloc(ctx, false);
+	if (!packet) return -1;
+
+	original = fr_radius_alloc(packet, false);
+	if (!original) {
+	error:
+		packet->data = NULL;
+		talloc_free(packet);
+		fr_pair_list_free(&head);
+		return -1;
+	}
+
+	memcpy(&packet->data, &data, sizeof(packet->data));
+	packet->data_len = ntohl(hdr->length);
+	packet->code = data[0];
+	packet->id = data[1];
+
+	fr_pair_cursor_init(&cursor, &head);
+
+#define ADD_PAIR(_attr, _field, _value) do { \
+	vp = fr_pair_afrom_num(ctx, 0, _attr); \
+	if (!vp) goto error; \
+	vp->_field = _value; \
+	vp->type = VT_DATA; \
+	fr_pair_cursor_append(&cursor, vp); \
+} while (0)
+
+	ADD_PAIR(PW_PACKET_TYPE, vp_integer, packet->code);
+
+	if (hdr->af) {
+		detail_binary_ipaddr(&ipaddr, hdr->af, hdr->src_ipaddr);
+		if (ipaddr.af == AF_INET) {
+			ADD_PAIR(PW_PACKET_SRC_IP_ADDRESS, vp_ipaddr, ipaddr.ipaddr.ip4addr.s_addr);
+		} else {
+			vp = fr_pair_afrom_num(ctx, 0, PW_PACKET_SRC_IPV6_ADDRESS);
+			if (!vp) goto error;
+			memcpy(&vp->vp_ipv6addr, &ipaddr.ipaddr.ip6addr, sizeof(vp->vp_ipv6addr));
+			vp->type = VT_DATA;
+			fr_pair_cursor_append(&cursor, vp);
+		}
+
+		detail_binary_ipaddr(&ipaddr, hdr->af, hdr->dst_ipaddr);
+		if (ipaddr.af == AF_INET) {
+			ADD_PAIR(PW_PACKET_DST_IP_ADDRESS, vp_ipaddr, ipaddr.ipaddr.ip4addr.s_addr);
+		} else {
+			vp = fr_pair_afrom_num(ctx, 0, PW_PACKET_DST_IPV6_ADDRESS);
+			if (!vp) goto error;
+			memcpy(&vp->vp_ipv6addr, &ipaddr.ipaddr.ip6addr, sizeof(vp->vp_ipv6addr));
+			vp->type = VT_DATA;
+			fr_pair_cursor_append(&cursor, vp);
+		}
+
+		ADD_PAIR(PW_PACKET_SRC_PORT, vp_integer, ntohs(hdr->src_port));
+		ADD_PAIR(PW_PACKET_DST_PORT, vp_integer, ntohs(hdr->dst_port));
+	}
+
+	if (fr_radius_decode(packet, original, DETAIL_BINARY_SECRET) < 0) goto error;
+
+	/*
+	 *	The decoder allocates attributes in the packet.
+	 */
+	for (vp = packet->vps; vp; vp = vp->next) fr_pair_steal(ctx, vp);
+	fr_pair_cursor_merge(&cursor, packet->vps);
+	packet->vps = NULL;
+
+	packet->data = NULL;
+	talloc_free(packet);
+
+	*out = head;
+
+	return 0;
+}
@@ -2,15 +2,19 @@ TARGET	:= libfreeradius-server.a
 
 SOURCES	:=	cond_eval.c \
 		cond_tokenize.c \
+		conduit.c \
 		conf_file.c \
 		conf_eval.c \
 		connection.c \
+		detail.c \
 		dl.c \
 		exec.c \
 		exfile.c \
 		log.c \
 		map_proc.c \
 		map.c \
+		metrics_format.c \
+		profile.c \
 		regex.c \
 		request.c \
 		trigger.c \
@@ -156,10 +156,11 @@ int listen_bootstrap(CONF_SECTION *server, CONF_SECTION *cs, char const *server_
 
 #ifdef WITH_PROXY
 	/*
-	 *	Only control sockets and proxy sockets are global for now.
+	 *	Only control, metrics and proxy sockets are global for now.
 	 */
 	if (!server_name) {
 		if ((strcmp(value, "control") != 0) &&
+		    (strcmp(value, "metrics") != 0) &&
 		    (strcmp(value, "proxy") != 0)) {
 			cf_log_err_cs(cs, "Listeners of type '%s' MUST be defined in a server.", value);
 			return -1;
@@ -167,6 +168,7 @@ int listen_bootstrap(CONF_SECTION *server, CONF_SECTION *cs, char const *server_
 
 	} else {
 		if ((strcmp(value, "control") == 0) ||
+		    (strcmp(value, "metrics") == 0) ||
 		    (strcmp(value, "proxy") == 0)) {
 			cf_log_err_cs(cs, "Listeners of type '%s' MUST NOT be defined in a server.", value);
 			return -1;
@@ -185,6 +187,7 @@ int listen_bootstrap(CONF_SECTION *server, CONF_SECTION *cs, char const *server_
 	 *	At some point, we'll move all of these to plugins.
 	 */
 	if (cp || !((strcmp(value, "control") == 0) ||
+		    (strcmp(value, "metrics") == 0) ||
 		    (strcmp(value, "status") == 0) ||
 		    (strcmp(value, "coa") == 0) ||
 		    (strcmp(value, "auth") == 0) ||
@@ -1775,7 +1778,7 @@ static int stats_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	FR_STATS_TYPE_INC(client->auth.total_requests);
+	FR_STATS_TYPE_INC(client->auth, total_requests);
 
 	/*
 	 *	We only understand Status-Server on this socket.
@@ -1845,7 +1848,7 @@ static int auth_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	FR_STATS_TYPE_INC(client->auth.total_requests);
+	FR_STATS_TYPE_INC(client->auth, total_requests);
 
 	/*
 	 *	Some sanity checks, based on the packet code.
@@ -1959,7 +1962,7 @@ static int acct_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	FR_STATS_TYPE_INC(client->acct.total_requests);
+	FR_STATS_TYPE_INC(client->acct, total_requests);
 
 	/*
 	 *	Some sanity checks, based on the packet code.
@@ -2343,7 +2346,7 @@ static int proxy_socket_recv(rad_listen_t *listener)
 		      fr_inet_ntoh(&packet->src_ipaddr, buffer, sizeof(buffer)),
 		      packet->src_port, packet->id);
 #  ifdef WITH_STATS
-		listener->stats.total_unknown_types++;
+		fr_stats_local(&listener->stats)->total_unknown_types++;
 #  endif
 		fr_radius_free(&packet);
 		return 0;
@@ -2356,7 +2359,7 @@ static int proxy_socket_recv(rad_listen_t *listener)
 
 	if (!request_proxy_reply(packet)) {
 #  ifdef WITH_STATS
-		listener->stats.total_packets_dropped++;
+		fr_stats_local(&listener->stats)->total_packets_dropped++;
 #  endif
 		fr_radius_free(&packet);
 		return 0;
@@ -2532,6 +2535,7 @@ static int proxy_socket_decode(UNUSED rad_listen_t *listener, REQUEST *request)
 #endif
 
 #include "command.c"
+#include "metrics.c"
 
 #define NO_LISTENER { .name = "undefined", }
 
@@ -2669,6 +2673,26 @@ static rad_protocol_t master_listen[] = {
 	NO_LISTENER,
 #endif
 
+#ifdef WITH_METRICS
+	/* OpenMetrics exporter */
+	{
+		.magic = RLM_MODULE_INIT,
+		.name = "metrics",
+		.inst_size = sizeof(fr_metrics_socket_t),
+		.tls = false,
+		.parse = metrics_socket_parse,
+		.open = metrics_socket_open,
+		.recv = metrics_socket_accept,
+		.send = metrics_socket_send,
+		.print = metrics_socket_print,
+		.debug = common_packet_debug,
+		.encode = metrics_socket_encode,
+		.decode = metrics_socket_decode
+	},
+#else
+	NO_LISTENER,
+#endif
+
 	NO_LISTENER		/* bfd */
 };
 
@@ -2872,6 +2896,10 @@ static int _listener_free(rad_listen_t *this)
 	 */
 	if (this->fd >= 0) close(this->fd);
 
+#ifdef WITH_STATS
+	fr_stats_free(&this->stats);
+#endif
+
 #ifdef WITH_TCP
 	if ((this->type == RAD_LISTEN_AUTH)
 #ifdef WITH_ACCT
@@ -3155,6 +3183,7 @@ int listen_init(rad_listen_t **head,
 	for (lc = listen_config; lc != NULL; lc = lc->next) {
 		if (lc->type == RAD_LISTEN_COMMAND) continue;
 		if (lc->type == RAD_LISTEN_PROXY) continue;
+		if (lc->type == RAD_LISTEN_METRICS) continue;
 
 		incoming_sockets = true;
 		break;
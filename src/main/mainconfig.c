@@ -27,6 +27,7 @@ RCSID("$Id$")
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/modpriv.h>
 #include <freeradius-devel/map_proc.h>
+#include <freeradius-devel/profile.h>
 #include <freeradius-devel/rad_assert.h>
 
 #include <sys/stat.h>
@@ -191,6 +192,17 @@ static const CONF_PARSER resources[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER profile_config[] = {
+	{ FR_CONF_POINTER("enable", PW_TYPE_BOOLEAN, &main_config.profile), .dflt = "no" },
+	{ FR_CONF_POINTER("dump_interval", PW_TYPE_INTEGER, &main_config.profile_interval), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+static const CONF_PARSER statistics_config[] = {
+	{ FR_CONF_POINTER("client_latency", PW_TYPE_BOOLEAN, &main_config.stats_client_latency), .dflt = "no" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER server_config[] = {
 	/*
 	 *	FIXME: 'prefix' is the ONLY one which should be
@@ -213,6 +225,9 @@ static const CONF_PARSER server_config[] = {
 	{ FR_CONF_POINTER("cleanup_delay", PW_TYPE_INTEGER, &main_config.cleanup_delay), .dflt = STRINGIFY(CLEANUP_DELAY) },
 	{ FR_CONF_POINTER("continuation_timeout", PW_TYPE_INTEGER, &main_config.continuation_timeout), .dflt = "15" },
 	{ FR_CONF_POINTER("max_requests", PW_TYPE_INTEGER, &main_config.max_requests), .dflt = STRINGIFY(MAX_REQUESTS) },
+#ifdef HAVE_REGEX
+	{ FR_CONF_POINTER("regex_cache_size", PW_TYPE_INTEGER, &fr_regex_cache_size), .dflt = STRINGIFY(REGEX_CACHE_SIZE) },
+#endif
 	{ FR_CONF_POINTER("pidfile", PW_TYPE_STRING, &main_config.pid_file), .dflt = "${run_dir}/radiusd.pid"},
 	{ FR_CONF_POINTER("checkrad", PW_TYPE_STRING, &main_config.checkrad), .dflt = "${sbindir}/checkrad" },
 
@@ -239,6 +254,10 @@ static const CONF_PARSER server_config[] = {
 	{ FR_CONF_POINTER("log_stripped_names", PW_TYPE_BOOLEAN | PW_TYPE_DEPRECATED, &log_stripped_names) },
 
 	{ FR_CONF_POINTER("security", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) security_config },
+
+	{ FR_CONF_POINTER("profile", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) profile_config },
+
+	{ FR_CONF_POINTER("statistics", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) statistics_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -881,6 +900,8 @@ do {\
 	 */
 	if (cf_section_parse(cs, NULL, server_config) < 0) return -1;
 
+	fr_profile_enabled = main_config.profile;
+
 	/*
 	 *	We ignore colourization of output until after the
 	 *	configuration files have been parsed.
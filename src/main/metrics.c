@@ -0,0 +1,909 @@
+/*
+ * metrics.c	Serve statistics in the Prometheus / OpenMetrics text format.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017 The FreeRADIUS server project
+ */
+
+#ifdef WITH_METRICS
+
+#include <freeradius-devel/state.h>
+#include <freeradius-devel/connection.h>
+#include <freeradius-devel/metrics.h>
+
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+
+/*
+ *	The port allocated to FreeRADIUS exporters in the Prometheus
+ *	default port allocations list.
+ */
+#define METRICS_PORT	9812
+
+typedef struct fr_metrics_socket_t {
+	fr_ipaddr_t	ipaddr;			//!< Address to listen on.
+	uint16_t	port;			//!< Port to listen on.
+	bool		per_client;		//!< Export statistics for each client.
+	uint32_t	send_timeout;		//!< How long a scraper has to send its request
+						///< and read the response.
+	fr_ipaddr_t	*allow;			//!< Networks scrapers may connect from.
+
+	/*
+	 *	For connections from scrapers.
+	 */
+	bool		connection;		//!< Whether this is an accepted connection.
+	fr_ipaddr_t	peer_ipaddr;		//!< Address of the scraper.
+	uint16_t	peer_port;		//!< Port of the scraper.
+	fr_event_list_t	*el;			//!< Event list the connection is serviced by.
+	fr_event_timer_t *ev;			//!< Deadline for the whole exchange.
+	char		*out;			//!< Response being written.
+	size_t		out_len;		//!< Length of the response.
+	size_t		out_sent;		//!< How much of the response has been written.
+	size_t		offset;			//!< How much of the request we've read.
+	char		buffer[4096];		//!< The HTTP request.
+} fr_metrics_socket_t;
+
+static const CONF_PARSER metrics_config[] = {
+	{ FR_CONF_OFFSET("ipaddr", PW_TYPE_COMBO_IP_ADDR, fr_metrics_socket_t, ipaddr), .dflt = "127.0.0.1" },
+	{ FR_CONF_OFFSET("port", PW_TYPE_SHORT, fr_metrics_socket_t, port), .dflt = STRINGIFY(METRICS_PORT) },
+	{ FR_CONF_OFFSET("per_client", PW_TYPE_BOOLEAN, fr_metrics_socket_t, per_client), .dflt = "yes" },
+	{ FR_CONF_OFFSET("send_timeout", PW_TYPE_INTEGER, fr_metrics_socket_t, send_timeout), .dflt = "5" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Add a set of statistics to the list of sources
+ *
+ * @param[in] ctx to allocate the list in.
+ * @param[in] sources to add to.
+ * @param[in] stats to read.
+ * @param[in] fmt for the labels.  Values must already be escaped.
+ */
+static void metrics_source_add(TALLOC_CTX *ctx, metrics_sources_t *sources, fr_stats_t const *stats,
+			       char const *fmt, ...) CC_HINT(format (printf, 4, 5));
+static void metrics_source_add(TALLOC_CTX *ctx, metrics_sources_t *sources, fr_stats_t const *stats,
+			       char const *fmt, ...)
+{
+	va_list			ap;
+	metrics_source_t	*source;
+
+	if (sources->num == sources->size) {
+		uint32_t size = sources->size ? (sources->size * 2) : 16;
+
+		source = talloc_realloc(ctx, sources->source, metrics_source_t, size);
+		if (!source) return;
+
+		sources->source = source;
+		sources->size = size;
+	}
+
+	source = &sources->source[sources->num++];
+
+	va_start(ap, fmt);
+	vsnprintf(source->labels, sizeof(source->labels), fmt, ap);
+	va_end(ap);
+
+	fr_stats_read(&source->stats, stats);
+	fr_stats_hist_read(&source->hist, stats);
+	source->no_hist = stats->no_hist;
+}
+
+/*
+ *	Global, and proxy statistics.
+ */
+static void metrics_print_global(metrics_ctx_t *mc, TALLOC_CTX *ctx)
+{
+	metrics_sources_t sources;
+
+	memset(&sources, 0, sizeof(sources));
+
+	metrics_source_add(ctx, &sources, &radius_auth_stats, "type=\"auth\"");
+#ifdef WITH_ACCOUNTING
+	metrics_source_add(ctx, &sources, &radius_acct_stats, "type=\"acct\"");
+#endif
+#ifdef WITH_COA
+	metrics_source_add(ctx, &sources, &radius_coa_stats, "type=\"coa\"");
+	metrics_source_add(ctx, &sources, &radius_dsc_stats, "type=\"disconnect\"");
+#endif
+
+	metrics_print_counters(mc, "freeradius", &sources);
+	metrics_print_latency(mc, "freeradius", "Time taken to process requests", &sources);
+
+#ifdef WITH_PROXY
+	sources.num = 0;
+
+	metrics_source_add(ctx, &sources, &proxy_auth_stats, "type=\"auth\"");
+#  ifdef WITH_ACCOUNTING
+	metrics_source_add(ctx, &sources, &proxy_acct_stats, "type=\"acct\"");
+#  endif
+#  ifdef WITH_COA
+	metrics_source_add(ctx, &sources, &proxy_coa_stats, "type=\"coa\"");
+	metrics_source_add(ctx, &sources, &proxy_dsc_stats, "type=\"disconnect\"");
+#  endif
+
+	metrics_print_counters(mc, "freeradius_proxy", &sources);
+	metrics_print_latency(mc, "freeradius_proxy", "Time taken for home servers to respond", &sources);
+#endif
+
+	talloc_free(sources.source);
+}
+
+static void metrics_print_listeners(metrics_ctx_t *mc, TALLOC_CTX *ctx)
+{
+	metrics_sources_t	sources;
+	rad_listen_t		*this;
+	char			buffer[256], label[512];
+
+	memset(&sources, 0, sizeof(sources));
+
+	for (this = main_config.listen; this != NULL; this = this->next) {
+		switch (this->type) {
+#ifdef WITH_COMMAND_SOCKET
+		case RAD_LISTEN_COMMAND:
+#endif
+#ifdef WITH_PROXY
+		case RAD_LISTEN_PROXY:
+#endif
+		case RAD_LISTEN_METRICS:
+			continue;
+
+		default:
+			break;
+		}
+
+		this->print(this, buffer, sizeof(buffer));
+		metrics_source_add(ctx, &sources, &this->stats, "listener=\"%s\"",
+				   metrics_label(label, sizeof(label), buffer));
+	}
+
+	metrics_print_counters(mc, "freeradius_listener", &sources);
+	metrics_print_latency(mc, "freeradius_listener", "Time taken to process requests", &sources);
+
+	talloc_free(sources.source);
+}
+
+static void metrics_print_clients(metrics_ctx_t *mc, TALLOC_CTX *ctx)
+{
+	metrics_sources_t	sources;
+	RADCLIENT		*client;
+	int			i;
+	char			buffer[INET6_ADDRSTRLEN + 8], ipaddr[INET6_ADDRSTRLEN], shortname[256];
+
+	memset(&sources, 0, sizeof(sources));
+
+	for (i = 0; (client = client_findbynumber(NULL, i)) != NULL; i++) {
+		fr_inet_ntoh(&client->ipaddr, ipaddr, sizeof(ipaddr));
+
+		if (((client->ipaddr.af == AF_INET) && (client->ipaddr.prefix != 32)) ||
+		    ((client->ipaddr.af == AF_INET6) && (client->ipaddr.prefix != 128))) {
+			snprintf(buffer, sizeof(buffer), "%s/%d", ipaddr, client->ipaddr.prefix);
+		} else {
+			strlcpy(buffer, ipaddr, sizeof(buffer));
+		}
+
+		metrics_label(shortname, sizeof(shortname), client->shortname);
+
+		metrics_source_add(ctx, &sources, &client->auth, "client=\"%s\",shortname=\"%s\",type=\"auth\"",
+				   buffer, shortname);
+#ifdef WITH_ACCOUNTING
+		metrics_source_add(ctx, &sources, &client->acct, "client=\"%s\",shortname=\"%s\",type=\"acct\"",
+				   buffer, shortname);
+#endif
+	}
+
+	metrics_print_counters(mc, "freeradius_client", &sources);
+	metrics_print_latency(mc, "freeradius_client", "Time taken to process requests", &sources);
+
+	talloc_free(sources.source);
+}
+
+#ifdef WITH_PROXY
+static char const *metrics_home_type(home_server_t const *home)
+{
+	switch (home->type) {
+	case HOME_TYPE_AUTH:
+		return "auth";
+
+	case HOME_TYPE_ACCT:
+		return "acct";
+
+	case HOME_TYPE_AUTH_ACCT:
+		return "auth+acct";
+
+#ifdef WITH_COA
+	case HOME_TYPE_COA:
+		return "coa";
+#endif
+
+	default:
+		return "unknown";
+	}
+}
+
+static void metrics_print_home_servers(metrics_ctx_t *mc, TALLOC_CTX *ctx)
+{
+	metrics_sources_t	sources;
+	home_server_t		*home;
+	int			i;
+	char			name[256];
+
+	memset(&sources, 0, sizeof(sources));
+
+	for (i = 0; (home = home_server_bynumber(i)) != NULL; i++) {
+		/*
+		 *	Internal "virtual" home server.
+		 */
+		if (home->ipaddr.af == AF_UNSPEC) continue;
+
+		metrics_source_add(ctx, &sources, &home->stats, "home_server=\"%s\",type=\"%s\"",
+				   metrics_label(name, sizeof(name), home->log_name),
+				   metrics_home_type(home));
+	}
+
+	metrics_print_counters(mc, "freeradius_home_server", &sources);
+	metrics_print_latency(mc, "freeradius_home_server", "Time taken for the home server to respond", &sources);
+
+	talloc_free(sources.source);
+}
+#endif
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	metrics_sources_t	*sources;
+} metrics_module_walk_t;
+
+static int _metrics_module_add(void *instance, void *uctx)
+{
+	module_instance_t	*mi = talloc_get_type_abort(instance, module_instance_t);
+	metrics_module_walk_t	*walk = uctx;
+	char			name[256];
+
+	metrics_source_add(walk->ctx, walk->sources, &mi->stats, "module=\"%s\"",
+			   metrics_label(name, sizeof(name), mi->name));
+
+	return 0;
+}
+
+static void metrics_print_modules(metrics_ctx_t *mc, TALLOC_CTX *ctx)
+{
+	metrics_sources_t	sources;
+	metrics_module_walk_t	walk;
+	CONF_SECTION		*cs;
+	uint32_t		i;
+
+	cs = cf_section_sub_find(main_config.config, "modules");
+	if (!cs) return;
+
+	memset(&sources, 0, sizeof(sources));
+	walk.ctx = ctx;
+	walk.sources = &sources;
+
+	(void) cf_data_walk(cs, module_instance_t, _metrics_module_add, &walk);
+
+	if (sources.num) {
+		metrics_family(mc, "freeradius_module_calls", METRICS_COUNTER, "Calls to module methods");
+		for (i = 0; i < sources.num; i++) {
+			metrics_printf(mc, "freeradius_module_calls_total{%s} %" PRIu64 "\n",
+				       sources.source[i].labels, (uint64_t) sources.source[i].stats.total_requests);
+		}
+	}
+	metrics_print_latency(mc, "freeradius_module", "Time spent in module methods", &sources);
+
+	talloc_free(sources.source);
+}
+
+typedef struct {
+	char		labels[512];
+	uint32_t	num;
+	uint32_t	active;
+	uint32_t	pending;
+	uint64_t	count;
+} metrics_pool_t;
+
+typedef struct {
+	TALLOC_CTX	*ctx;
+	metrics_pool_t	*pool;
+	uint32_t	num;
+} metrics_pool_walk_t;
+
+static int _metrics_pool_add(void *uctx, char const *name, fr_connection_pool_state_t const *state)
+{
+	metrics_pool_walk_t	*walk = uctx;
+	metrics_pool_t		*pool;
+	char			label[256];
+
+	pool = talloc_realloc(walk->ctx, walk->pool, metrics_pool_t, walk->num + 1);
+	if (!pool) return -1;
+	walk->pool = pool;
+
+	pool = &walk->pool[walk->num++];
+	snprintf(pool->labels, sizeof(pool->labels), "pool=\"%s\"", metrics_label(label, sizeof(label), name));
+	pool->num = state->num;
+	pool->active = state->active;
+	pool->pending = state->pending;
+	pool->count = state->count;
+
+	return 0;
+}
+
+static void metrics_print_pools(metrics_ctx_t *mc, TALLOC_CTX *ctx)
+{
+	metrics_pool_walk_t	walk;
+	uint32_t		i;
+
+	memset(&walk, 0, sizeof(walk));
+	walk.ctx = ctx;
+
+	(void) fr_connection_pool_walk(_metrics_pool_add, &walk);
+	if (!walk.num) return;
+
+#define POOL_METRIC(_name, _type, _help, _field, _suffix) \
+	metrics_family(mc, "freeradius_pool_" _name, _type, _help); \
+	for (i = 0; i < walk.num; i++) { \
+		metrics_printf(mc, "freeradius_pool_" _name _suffix "{%s} %" PRIu64 "\n", \
+			       walk.pool[i].labels, (uint64_t) walk.pool[i]._field); \
+	}
+
+	POOL_METRIC("connections", METRICS_GAUGE, "Open connections", num, "");
+	POOL_METRIC("connections_active", METRICS_GAUGE, "Connections reserved by a request", active, "");
+	POOL_METRIC("connections_pending", METRICS_GAUGE, "Connections being opened", pending, "");
+	POOL_METRIC("connections_opened", METRICS_COUNTER, "Connections opened", count, "_total");
+
+	talloc_free(walk.pool);
+}
+
+static void metrics_print_state(metrics_ctx_t *mc)
+{
+	if (!global_state) return;
+
+	metrics_family(mc, "freeradius_state_entries", METRICS_GAUGE, "Multi-round sessions being tracked");
+	metrics_printf(mc, "freeradius_state_entries %" PRIu32 "\n", fr_state_entries_tracked(global_state));
+
+	metrics_family(mc, "freeradius_state_entries_created", METRICS_COUNTER, "Multi-round sessions started");
+	metrics_printf(mc, "freeradius_state_entries_created_total %" PRIu64 "\n",
+		       fr_state_entries_created(global_state));
+
+	metrics_family(mc, "freeradius_state_entries_timeout", METRICS_COUNTER,
+		       "Multi-round sessions which timed out");
+	metrics_printf(mc, "freeradius_state_entries_timeout_total %" PRIu64 "\n",
+		       fr_state_entries_timeout(global_state));
+}
+
+#ifdef HAVE_REGEX
+static void metrics_print_regex(metrics_ctx_t *mc)
+{
+	uint64_t	hits, misses, evictions;
+	uint32_t	entries;
+
+	regex_cache_stats(&hits, &misses, &evictions, &entries);
+
+	metrics_family(mc, "freeradius_regex_cache_entries", METRICS_GAUGE,
+		       "Runtime regular expressions cached by all threads");
+	metrics_printf(mc, "freeradius_regex_cache_entries %" PRIu32 "\n", entries);
+
+	metrics_family(mc, "freeradius_regex_cache_hits", METRICS_COUNTER,
+		       "Runtime regular expressions found in a cache");
+	metrics_printf(mc, "freeradius_regex_cache_hits_total %" PRIu64 "\n", hits);
+
+	metrics_family(mc, "freeradius_regex_cache_misses", METRICS_COUNTER,
+		       "Runtime regular expressions which had to be compiled");
+	metrics_printf(mc, "freeradius_regex_cache_misses_total %" PRIu64 "\n", misses);
+
+	metrics_family(mc, "freeradius_regex_cache_evictions", METRICS_COUNTER,
+		       "Runtime regular expressions freed to make room in a cache");
+	metrics_printf(mc, "freeradius_regex_cache_evictions_total %" PRIu64 "\n", evictions);
+}
+#endif
+
+typedef struct {
+	int		thread_num;
+	uint32_t	backlog;
+	uint64_t	requests;
+} metrics_worker_t;
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	metrics_worker_t	*worker;
+	uint32_t		num;
+} metrics_worker_walk_t;
+
+static int _metrics_worker_add(void *uctx, int thread_num, uint32_t backlog, uint64_t requests)
+{
+	metrics_worker_walk_t	*walk = uctx;
+	metrics_worker_t	*worker;
+
+	worker = talloc_realloc(walk->ctx, walk->worker, metrics_worker_t, walk->num + 1);
+	if (!worker) return -1;
+	walk->worker = worker;
+
+	worker = &walk->worker[walk->num++];
+	worker->thread_num = thread_num;
+	worker->backlog = backlog;
+	worker->requests = requests;
+
+	return 0;
+}
+
+static void metrics_print_workers(metrics_ctx_t *mc, TALLOC_CTX *ctx)
+{
+	metrics_worker_walk_t	walk;
+	uint32_t		i;
+
+	memset(&walk, 0, sizeof(walk));
+	walk.ctx = ctx;
+
+	(void) thread_pool_walk(_metrics_worker_add, &walk);
+	if (!walk.num) return;
+
+	metrics_family(mc, "freeradius_worker_backlog", METRICS_GAUGE, "Requests queued for the worker");
+	for (i = 0; i < walk.num; i++) {
+		metrics_printf(mc, "freeradius_worker_backlog{thread=\"%d\"} %" PRIu32 "\n",
+			       walk.worker[i].thread_num, walk.worker[i].backlog);
+	}
+
+	metrics_family(mc, "freeradius_worker_requests", METRICS_COUNTER, "Requests handled by the worker");
+	for (i = 0; i < walk.num; i++) {
+		metrics_printf(mc, "freeradius_worker_requests_total{thread=\"%d\"} %" PRIu64 "\n",
+			       walk.worker[i].thread_num, walk.worker[i].requests);
+	}
+
+	talloc_free(walk.worker);
+}
+
+/** Build the response body
+ *
+ * @return the body, or NULL if we ran out of memory.
+ */
+static char *metrics_build(TALLOC_CTX *ctx, fr_metrics_socket_t const *sock, bool openmetrics)
+{
+	metrics_ctx_t	mc;
+	TALLOC_CTX	*tmp;
+
+	mc.openmetrics = openmetrics;
+	mc.out = talloc_strdup(ctx, "");
+	if (!mc.out) return NULL;
+
+	tmp = talloc_new(ctx);
+	if (!tmp) {
+		talloc_free(mc.out);
+		return NULL;
+	}
+
+	metrics_print_global(&mc, tmp);
+	metrics_print_listeners(&mc, tmp);
+	if (sock->per_client) metrics_print_clients(&mc, tmp);
+#ifdef WITH_PROXY
+	metrics_print_home_servers(&mc, tmp);
+#endif
+	metrics_print_modules(&mc, tmp);
+	metrics_print_pools(&mc, tmp);
+	metrics_print_state(&mc);
+#ifdef HAVE_REGEX
+	metrics_print_regex(&mc);
+#endif
+	metrics_print_workers(&mc, tmp);
+
+	if (openmetrics) metrics_printf(&mc, "# EOF\n");
+
+	talloc_free(tmp);
+
+	return mc.out;
+}
+
+static void metrics_close_socket(rad_listen_t *this)
+{
+	fr_metrics_socket_t *sock = this->data;
+
+	if (sock->ev) fr_event_timer_delete(sock->el, &sock->ev);
+	TALLOC_FREE(sock->out);
+
+	this->status = RAD_LISTEN_STATUS_EOL;
+
+	/*
+	 *	This removes the socket from the event fd, so no one
+	 *	will be calling us any more.
+	 */
+	radius_update_listener(this);
+}
+
+/*
+ *	The scraper took too long to send its request, or to read
+ *	the response.
+ */
+static void metrics_socket_timeout(UNUSED struct timeval *now, void *ctx)
+{
+	rad_listen_t	*this = talloc_get_type_abort(ctx, rad_listen_t);
+	char		buffer[256];
+
+	this->print(this, buffer, sizeof(buffer));
+	DEBUG2("Timed out %s", buffer);
+
+	metrics_close_socket(this);
+}
+
+static void metrics_socket_error(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	metrics_close_socket(talloc_get_type_abort(ctx, rad_listen_t));
+}
+
+/*
+ *	Write as much of the response as the socket will take, and
+ *	close the connection once it's all gone.
+ */
+static void metrics_socket_write(UNUSED fr_event_list_t *el, int fd, void *ctx)
+{
+	rad_listen_t		*this = talloc_get_type_abort(ctx, rad_listen_t);
+	fr_metrics_socket_t	*sock = this->data;
+	ssize_t			r;
+
+	while (sock->out_sent < sock->out_len) {
+		r = write(fd, sock->out + sock->out_sent, sock->out_len - sock->out_sent);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			break;
+		}
+
+		sock->out_sent += r;
+	}
+
+	metrics_close_socket(this);
+}
+
+/** Queue an HTTP response, and close the connection once it's written
+ *
+ * The response is written from the event loop as the socket becomes
+ * writable, so a slow scraper can't block the main thread.
+ */
+static void metrics_respond(rad_listen_t *this, int code, char const *reason,
+			    char const *content_type, char const *body, bool head)
+{
+	fr_metrics_socket_t	*sock = this->data;
+	size_t			len = body ? strlen(body) : 0;
+
+	sock->out = talloc_asprintf(this,
+				    "HTTP/1.1 %d %s\r\n"
+				    "Content-Type: %s\r\n"
+				    "Content-Length: %zu\r\n"
+				    "Connection: close\r\n"
+				    "\r\n"
+				    "%s", code, reason, content_type, len, (body && !head) ? body : "");
+	if (!sock->out) {
+		metrics_close_socket(this);
+		return;
+	}
+	sock->out_len = talloc_array_length(sock->out) - 1;
+	sock->out_sent = 0;
+
+	/*
+	 *	Stop reading, and wait for the socket to become
+	 *	writable.
+	 */
+	if (fr_event_fd_insert(sock->el, this->fd, NULL, metrics_socket_write, metrics_socket_error, this) < 0) {
+		ERROR("Failed waiting to write metrics response: %s", fr_strerror());
+		metrics_close_socket(this);
+	}
+}
+
+/*
+ *	Read an HTTP request from a scraper.
+ *
+ *	Only "GET /metrics" is supported, and the connection is
+ *	closed after each response.
+ */
+static int metrics_socket_recv(rad_listen_t *this)
+{
+	fr_metrics_socket_t	*sock = this->data;
+	ssize_t			len;
+	char			*method, *path, *headers, *p;
+	char			*body;
+	bool			head, openmetrics;
+
+	len = read(this->fd, sock->buffer + sock->offset, sizeof(sock->buffer) - sock->offset - 1);
+	if ((len < 0) && ((errno == EINTR) || (errno == EAGAIN))) return 0;
+	if (len <= 0) {
+		metrics_close_socket(this);
+		return 0;
+	}
+
+	sock->offset += len;
+	sock->buffer[sock->offset] = '\0';
+
+	/*
+	 *	Wait for the end of the headers.
+	 */
+	if (!strstr(sock->buffer, "\r\n\r\n") && !strstr(sock->buffer, "\n\n")) {
+		if (sock->offset < (sizeof(sock->buffer) - 1)) return 0;
+
+		metrics_respond(this, 400, "Bad Request", "text/plain", "Request too large\n", false);
+		return 0;
+	}
+
+	headers = strchr(sock->buffer, '\n');
+	rad_assert(headers != NULL);
+	*headers++ = '\0';
+
+	method = sock->buffer;
+	p = strchr(method, ' ');
+	if (!p) {
+	bad_request:
+		metrics_respond(this, 400, "Bad Request", "text/plain", "Bad request\n", false);
+		return 0;
+	}
+	*p++ = '\0';
+
+	path = p;
+	p += strcspn(p, " ?\r");
+	if (p == path) goto bad_request;
+	*p = '\0';
+
+	if (strcmp(method, "GET") == 0) {
+		head = false;
+
+	} else if (strcmp(method, "HEAD") == 0) {
+		head = true;
+
+	} else {
+		metrics_respond(this, 405, "Method Not Allowed", "text/plain", "Method not allowed\n", false);
+		return 0;
+	}
+
+	if (strcmp(path, "/metrics") != 0) {
+		metrics_respond(this, 404, "Not Found", "text/plain", "Not found\n", head);
+		return 0;
+	}
+
+	/*
+	 *	Prometheus asks for OpenMetrics in the Accept header
+	 *	if it supports it.
+	 */
+	openmetrics = (strstr(headers, "application/openmetrics-text") != NULL);
+
+	body = metrics_build(this, sock, openmetrics);
+	if (!body) {
+		metrics_respond(this, 500, "Internal Server Error", "text/plain", "Out of memory\n", head);
+		return 0;
+	}
+
+	metrics_respond(this, 200, "OK",
+			openmetrics ? "application/openmetrics-text; version=1.0.0; charset=utf-8" :
+				      "text/plain; version=0.0.4; charset=utf-8",
+			body, head);
+	talloc_free(body);
+
+	return 0;
+}
+
+static int _metrics_connection_free(fr_metrics_socket_t *sock)
+{
+	if (sock->ev) fr_event_timer_delete(sock->el, &sock->ev);
+
+	return 0;
+}
+
+static int metrics_socket_accept(rad_listen_t *listener)
+{
+	int			newfd;
+	rad_listen_t		*this;
+	socklen_t		salen;
+	struct sockaddr_storage	src;
+	struct timeval		when;
+	fr_metrics_socket_t	*sock = listener->data;
+	fr_ipaddr_t		peer_ipaddr;
+	uint16_t		peer_port;
+
+	salen = sizeof(src);
+
+	newfd = accept(listener->fd, (struct sockaddr *) &src, &salen);
+	if (newfd < 0) {
+		/*
+		 *	Non-blocking sockets must handle this.
+		 */
+		if (errno == EWOULDBLOCK) return 0;
+
+		DEBUG2(" ... failed to accept connection");
+		return 0;
+	}
+
+	if (!fr_ipaddr_from_sockaddr(&src, salen, &peer_ipaddr, &peer_port)) {
+		if (sock->allow) {
+			close(newfd);
+			return 0;
+		}
+		peer_ipaddr.af = AF_UNSPEC;
+		peer_port = 0;
+	}
+
+	if (!metrics_ipaddr_allowed(sock->allow, &peer_ipaddr)) {
+		char ipaddr[INET6_ADDRSTRLEN];
+
+		RATE_LIMIT(INFO("Ignoring metrics connection from unlisted client %s",
+				fr_inet_ntoh(&peer_ipaddr, ipaddr, sizeof(ipaddr))));
+		close(newfd);
+		return 0;
+	}
+
+	/*
+	 *	accept() doesn't inherit non-blocking from the
+	 *	listener, and everything on this socket is done by
+	 *	the main thread, so it must never block.
+	 */
+	if (fr_nonblock(newfd) < 0) {
+		ERROR("Failed setting metrics connection non-blocking: %s", fr_syserror(errno));
+		close(newfd);
+		return 0;
+	}
+
+	this = listen_alloc(listener, listener->type, listener->proto);
+	if (!this) {
+		close(newfd);
+		return 0;
+	}
+	this->fd = newfd;
+
+	sock = this->data;
+	memcpy(sock, listener->data, offsetof(fr_metrics_socket_t, connection));
+	sock->connection = true;
+	sock->peer_ipaddr = peer_ipaddr;
+	sock->peer_port = peer_port;
+	sock->offset = 0;
+	sock->el = radius_event_list_corral(EVENT_CORRAL_MAIN);
+
+	/*
+	 *	One deadline for reading the request, and writing
+	 *	the response, so an idle or slow scraper can't hold
+	 *	the connection open.
+	 */
+	fr_event_list_time(&when, sock->el);
+	when.tv_sec += sock->send_timeout;
+	if (fr_event_timer_insert(sock->el, metrics_socket_timeout, this, &when, &sock->ev) < 0) {
+		ERROR("Failed inserting metrics connection timer: %s", fr_strerror());
+		talloc_free(this);
+		return 0;
+	}
+	talloc_set_destructor(sock, _metrics_connection_free);
+
+	this->server = listener->server;
+	this->cs = listener->cs;
+	this->status = RAD_LISTEN_STATUS_INIT;
+	this->recv = metrics_socket_recv;
+
+	/*
+	 *	Tell the event loop that we have a new FD
+	 */
+	radius_update_listener(this);
+
+	return 0;
+}
+
+static int metrics_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
+{
+	fr_metrics_socket_t	*sock = this->data;
+	CONF_PAIR		*cp;
+	size_t			num = 0;
+
+	if (cf_section_parse(cs, sock, metrics_config) < 0) return -1;
+
+	if (sock->port == 0) {
+		cf_log_err_cs(cs, "Invalid value for 'port'");
+		return -1;
+	}
+
+	FR_INTEGER_BOUND_CHECK("send_timeout", sock->send_timeout, >=, 1);
+	FR_INTEGER_BOUND_CHECK("send_timeout", sock->send_timeout, <=, 60);
+
+	for (cp = cf_pair_find(cs, "allow"); cp; cp = cf_pair_find_next(cs, cp, "allow")) {
+		fr_ipaddr_t *allow;
+
+		allow = talloc_realloc(this, sock->allow, fr_ipaddr_t, num + 1);
+		if (!allow) return -1;
+		sock->allow = allow;
+
+		if (!cf_pair_value(cp) ||
+		    (fr_inet_pton(&sock->allow[num], cf_pair_value(cp), -1, AF_UNSPEC, true, true) < 0)) {
+			cf_log_err_cp(cp, "Invalid value for 'allow': %s", fr_strerror());
+			return -1;
+		}
+		num++;
+	}
+
+	/*
+	 *	There's no authentication, so anything which isn't
+	 *	only reachable from this host needs an explicit list
+	 *	of scrapers.
+	 */
+	if (!sock->allow && !metrics_ipaddr_is_loopback(&sock->ipaddr)) {
+		cf_log_err_cs(cs, "'allow' must be set when 'ipaddr' is not a loopback address");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int metrics_socket_open(UNUSED CONF_SECTION *cs, rad_listen_t *this)
+{
+	fr_metrics_socket_t	*sock = this->data;
+	int			port = sock->port;
+	int			rcode;
+
+	this->fd = fr_socket_server_base(IPPROTO_TCP, &sock->ipaddr, &port, NULL, true);
+	if (this->fd < 0) {
+		ERROR("Failed opening metrics socket: %s", fr_strerror());
+		return -1;
+	}
+
+	rad_suid_up();
+	rcode = fr_socket_server_bind(this->fd, &sock->ipaddr, &port, NULL);
+	rad_suid_down();
+	if (rcode < 0) {
+		ERROR("Failed binding metrics socket: %s", fr_strerror());
+	error:
+		close(this->fd);
+		this->fd = -1;
+		return -1;
+	}
+
+	if (listen(this->fd, 8) < 0) {
+		ERROR("Failed in listen(): %s", fr_syserror(errno));
+		goto error;
+	}
+
+	return 0;
+}
+
+static int metrics_socket_print(rad_listen_t const *this, char *buffer, size_t bufsize)
+{
+	fr_metrics_socket_t	*sock = this->data;
+	char			ipaddr[INET6_ADDRSTRLEN];
+
+	if (sock->connection) {
+		if (sock->peer_ipaddr.af == AF_UNSPEC) {
+			strlcpy(buffer, "metrics from client unknown", bufsize);
+			return 1;
+		}
+
+		snprintf(buffer, bufsize, "metrics from client %s port %u",
+			 fr_inet_ntoh(&sock->peer_ipaddr, ipaddr, sizeof(ipaddr)), sock->peer_port);
+		return 1;
+	}
+
+	snprintf(buffer, bufsize, "metrics address %s port %u",
+		 fr_inet_ntoh(&sock->ipaddr, ipaddr, sizeof(ipaddr)), sock->port);
+	return 1;
+}
+
+/*
+ *	Responses are queued by the recv function, and written by
+ *	metrics_socket_write().
+ */
+static int metrics_socket_send(UNUSED rad_listen_t *listener, UNUSED REQUEST *request)
+{
+	return 0;
+}
+
+static int metrics_socket_encode(UNUSED rad_listen_t *listener, UNUSED REQUEST *request)
+{
+	return 0;
+}
+
+static int metrics_socket_decode(UNUSED rad_listen_t *listener, UNUSED REQUEST *request)
+{
+	return 0;
+}
+
+#endif /* WITH_METRICS */
@@ -0,0 +1,261 @@
+/*
+ * metrics_format.c	The Prometheus / OpenMetrics text format.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/metrics.h>
+
+#ifdef WITH_METRICS
+
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+
+#ifndef USEC
+#  define USEC (1000000)
+#endif
+
+static char const *metrics_types[] = {
+	[METRICS_COUNTER] = "counter",
+	[METRICS_GAUGE] = "gauge",
+	[METRICS_HISTOGRAM] = "histogram"
+};
+
+static const struct {
+	char const	*name;
+	char const	*help;
+	size_t		offset;
+} metrics_counters[] = {
+	{ "requests",		"Requests received",				offsetof(fr_stats_t, total_requests) },
+	{ "invalid_requests",	"Requests from unknown clients",		offsetof(fr_stats_t, total_invalid_requests) },
+	{ "dup_requests",	"Duplicate requests",				offsetof(fr_stats_t, total_dup_requests) },
+	{ "responses",		"Responses sent",				offsetof(fr_stats_t, total_responses) },
+	{ "access_accepts",	"Access-Accepts sent",				offsetof(fr_stats_t, total_access_accepts) },
+	{ "access_rejects",	"Access-Rejects sent",				offsetof(fr_stats_t, total_access_rejects) },
+	{ "access_challenges",	"Access-Challenges sent",			offsetof(fr_stats_t, total_access_challenges) },
+	{ "malformed_requests",	"Malformed requests",				offsetof(fr_stats_t, total_malformed_requests) },
+	{ "bad_authenticators",	"Requests with an invalid authenticator",	offsetof(fr_stats_t, total_bad_authenticators) },
+	{ "packets_dropped",	"Packets dropped",				offsetof(fr_stats_t, total_packets_dropped) },
+	{ "no_records",		"Accounting requests which weren't recorded",	offsetof(fr_stats_t, total_no_records) },
+	{ "unknown_types",	"Packets with an unknown code",			offsetof(fr_stats_t, total_unknown_types) },
+	{ "timeouts",		"Requests which timed out",			offsetof(fr_stats_t, total_timeouts) },
+};
+
+/*
+ *	Histogram boundaries, in microseconds, and as the "le" label.
+ *	Histograms are recorded with finer buckets than these, see
+ *	hist.h.  A recorded bucket is counted against the first
+ *	boundary which is at least the largest value in it.
+ */
+static const struct {
+	uint64_t	usec;
+	char const	*le;
+} metrics_buckets[] = {
+	{ 100,		"0.0001" },
+	{ 250,		"0.00025" },
+	{ 500,		"0.0005" },
+	{ 1000,		"0.001" },
+	{ 2500,		"0.0025" },
+	{ 5000,		"0.005" },
+	{ 10000,	"0.01" },
+	{ 25000,	"0.025" },
+	{ 50000,	"0.05" },
+	{ 100000,	"0.1" },
+	{ 250000,	"0.25" },
+	{ 500000,	"0.5" },
+	{ 1000000,	"1.0" },
+	{ 2500000,	"2.5" },
+	{ 5000000,	"5.0" },
+	{ 10000000,	"10.0" },
+};
+
+void metrics_printf(metrics_ctx_t *mc, char const *fmt, ...)
+{
+	va_list ap;
+
+	if (!mc->out) return;
+
+	va_start(ap, fmt);
+	mc->out = talloc_vasprintf_append_buffer(mc->out, fmt, ap);
+	va_end(ap);
+}
+
+/** Print the HELP and TYPE lines for a metric family
+ *
+ * OpenMetrics names counter families without the "_total" suffix,
+ * the Prometheus text format names them with it.  The samples have
+ * the suffix in both.
+ */
+void metrics_family(metrics_ctx_t *mc, char const *name, metrics_type_t type, char const *help)
+{
+	char const *suffix = ((type == METRICS_COUNTER) && !mc->openmetrics) ? "_total" : "";
+
+	metrics_printf(mc, "# HELP %s%s %s\n", name, suffix, help);
+	metrics_printf(mc, "# TYPE %s%s %s\n", name, suffix, metrics_types[type]);
+}
+
+/** Escape a label value
+ *
+ */
+char const *metrics_label(char *out, size_t outlen, char const *in)
+{
+	char *p = out, *end = out + outlen - 1;
+
+	if (!in) in = "";
+
+	while (*in && (p < end)) {
+		switch (*in) {
+		case '\\':
+		case '"':
+		case '\n':
+			if ((end - p) < 2) goto done;
+			*p++ = '\\';
+			*p++ = (*in == '\n') ? 'n' : *in;
+			break;
+
+		default:
+			*p++ = *in;
+			break;
+		}
+		in++;
+	}
+
+done:
+	*p = '\0';
+
+	return out;
+}
+
+void metrics_print_counters(metrics_ctx_t *mc, char const *prefix, metrics_sources_t const *sources)
+{
+	unsigned int	i;
+	uint32_t	j;
+	char		name[128];
+
+	if (!sources->num) return;
+
+	for (i = 0; i < (sizeof(metrics_counters) / sizeof(metrics_counters[0])); i++) {
+		snprintf(name, sizeof(name), "%s_%s", prefix, metrics_counters[i].name);
+		metrics_family(mc, name, METRICS_COUNTER, metrics_counters[i].help);
+
+		for (j = 0; j < sources->num; j++) {
+			fr_uint_t const *value;
+
+			value = (fr_uint_t const *) (((uint8_t const *) &sources->source[j].stats) +
+						     metrics_counters[i].offset);
+
+			metrics_printf(mc, "%s_total{%s} %" PRIu64 "\n", name, sources->source[j].labels,
+				       (uint64_t) *value);
+		}
+	}
+}
+
+void metrics_print_latency(metrics_ctx_t *mc, char const *prefix, char const *help,
+			   metrics_sources_t const *sources)
+{
+	unsigned int	i, k;
+	uint32_t	j;
+	uint64_t	cumulative, total;
+	char		name[128];
+
+	/*
+	 *	Sources which don't keep a histogram have no latency
+	 *	samples, rather than a histogram which is always empty.
+	 */
+	for (j = 0; j < sources->num; j++) if (!sources->source[j].no_hist) break;
+	if (j == sources->num) return;
+
+	snprintf(name, sizeof(name), "%s_latency_seconds", prefix);
+	metrics_family(mc, name, METRICS_HISTOGRAM, help);
+
+	for (; j < sources->num; j++) {
+		metrics_source_t const *source = &sources->source[j];
+
+		if (source->no_hist) continue;
+
+		/*
+		 *	The counts are read without locking, so use
+		 *	the sum of the buckets as the total, which
+		 *	keeps the histogram consistent.
+		 */
+		for (i = 0, total = 0; i < FR_HIST_BUCKETS; i++) total += source->hist.bucket[i];
+
+		for (k = 0, i = 0, cumulative = 0; k < (sizeof(metrics_buckets) / sizeof(metrics_buckets[0])); k++) {
+			while ((i < FR_HIST_BUCKETS) &&
+			       (fr_hist_bucket_max(i) <= metrics_buckets[k].usec)) {
+				cumulative += source->hist.bucket[i++];
+			}
+
+			metrics_printf(mc, "%s_bucket{%s,le=\"%s\"} %" PRIu64 "\n",
+				       name, source->labels, metrics_buckets[k].le, cumulative);
+		}
+		metrics_printf(mc, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, source->labels, total);
+		metrics_printf(mc, "%s_count{%s} %" PRIu64 "\n", name, source->labels, total);
+		metrics_printf(mc, "%s_sum{%s} %" PRIu64 ".%06u\n", name, source->labels,
+			       source->hist.sum / USEC, (unsigned int) (source->hist.sum % USEC));
+	}
+}
+
+bool metrics_ipaddr_is_loopback(fr_ipaddr_t const *ipaddr)
+{
+	switch (ipaddr->af) {
+	case AF_INET:
+		return ((ntohl(ipaddr->ipaddr.ip4addr.s_addr) >> 24) == IN_LOOPBACKNET);
+
+#ifdef HAVE_STRUCT_SOCKADDR_IN6
+	case AF_INET6:
+		return IN6_IS_ADDR_LOOPBACK(&ipaddr->ipaddr.ip6addr);
+#endif
+
+	default:
+		return false;
+	}
+}
+
+/** Check a scraper's address against an "allow" list
+ *
+ * @param[in] allow talloced array of networks.  With no list, we're
+ *	only listening on a loopback address, so everything is allowed.
+ * @param[in] peer address of the scraper.
+ */
+bool metrics_ipaddr_allowed(fr_ipaddr_t const *allow, fr_ipaddr_t const *peer)
+{
+	size_t		i, num;
+	fr_ipaddr_t	masked;
+
+	if (!allow) return true;
+
+	num = talloc_array_length(allow);
+	for (i = 0; i < num; i++) {
+		if (peer->af != allow[i].af) continue;
+
+		masked = *peer;
+		masked.zone_id = allow[i].zone_id;
+		fr_ipaddr_mask(&masked, allow[i].prefix);
+
+		if (fr_ipaddr_cmp(&masked, &allow[i]) == 0) return true;
+	}
+
+	return false;
+}
+#endif /* WITH_METRICS */
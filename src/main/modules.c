@@ -786,6 +786,8 @@ static int _module_instance_free(module_instance_t *instance)
 
 	xlat_unregister(instance->data, instance->name, NULL);
 
+	fr_stats_free(&instance->stats);
+
 	/*
 	 *	Remove all xlat's registered to module instance.
 	 */
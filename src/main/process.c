@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/process.h>
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/state.h>
+#include <freeradius-devel/profile.h>
 
 #include <freeradius-devel/rad_assert.h>
 
@@ -58,6 +59,8 @@ extern uint64_t sd_watchdog_interval;
 static fr_event_timer_t *sd_watchdog_ev;
 #endif
 
+static fr_event_timer_t *profile_ev;
+
 static bool spawn_workers = false;
 static bool just_started = true;
 time_t fr_start_time = (time_t)-1;
@@ -1777,14 +1780,17 @@ REQUEST *request_setup(TALLOC_CTX *ctx, rad_listen_t *listener, RADIUS_PACKET *p
 	NO_CHILD_THREAD;
 
 #ifdef WITH_STATS
-	request->listener->stats.last_packet = request->packet->timestamp.tv_sec;
+	/*
+	 *	Kept per worker, fr_stats_read() returns the latest.
+	 */
+	fr_stats_local(&request->listener->stats)->last_packet = request->packet->timestamp.tv_sec;
 	if (packet->code == PW_CODE_ACCESS_REQUEST) {
-		request->client->auth.last_packet = request->packet->timestamp.tv_sec;
-		radius_auth_stats.last_packet = request->packet->timestamp.tv_sec;
+		fr_stats_local(&request->client->auth)->last_packet = request->packet->timestamp.tv_sec;
+		fr_stats_local(&radius_auth_stats)->last_packet = request->packet->timestamp.tv_sec;
 #ifdef WITH_ACCOUNTING
 	} else if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
-		request->client->acct.last_packet = request->packet->timestamp.tv_sec;
-		radius_acct_stats.last_packet = request->packet->timestamp.tv_sec;
+		fr_stats_local(&request->client->acct)->last_packet = request->packet->timestamp.tv_sec;
+		fr_stats_local(&radius_acct_stats)->last_packet = request->packet->timestamp.tv_sec;
 #endif
 	}
 #endif	/* WITH_STATS */
@@ -2350,6 +2356,9 @@ int request_proxy_reply(RADIUS_PACKET *reply)
 	REQUEST *request, *proxy;
 	struct timeval now;
 	char buffer[INET6_ADDRSTRLEN];
+#ifdef WITH_STATS
+	fr_stats_t *stats;
+#endif
 
 	VERIFY_PACKET(reply);
 
@@ -2449,42 +2458,40 @@ int request_proxy_reply(RADIUS_PACKET *reply)
 	if (!proxy->listener) goto global_stats;
 
 	/*
-	 *	Update the proxy listener stats here, because only one
-	 *	thread accesses that at a time.  The home_server and
-	 *	main proxy_*_stats structures are updated once the
-	 *	request is cleaned up.
+	 *	The home_server and main proxy_*_stats counters are
+	 *	updated once the request is cleaned up.
 	 */
-	proxy->listener->stats.total_responses++;
-
-	proxy->listener->stats.last_packet = reply->timestamp.tv_sec;
+	stats = fr_stats_local(&proxy->listener->stats);
+	stats->total_responses++;
+	stats->last_packet = reply->timestamp.tv_sec;
 
 	switch (proxy->packet->code) {
 	case PW_CODE_ACCESS_REQUEST:
 		if (proxy->reply->code == PW_CODE_ACCESS_ACCEPT) {
-			proxy->listener->stats.total_access_accepts++;
+			stats->total_access_accepts++;
 
 		} else if (proxy->reply->code == PW_CODE_ACCESS_REJECT) {
-			proxy->listener->stats.total_access_rejects++;
+			stats->total_access_rejects++;
 
 		} else if (proxy->reply->code == PW_CODE_ACCESS_CHALLENGE) {
-			proxy->listener->stats.total_access_challenges++;
+			stats->total_access_challenges++;
 		}
 		break;
 
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_REQUEST:
-		proxy->listener->stats.total_responses++;
+		stats->total_responses++;
 		break;
 
 #endif
 
 #ifdef WITH_COA
 	case PW_CODE_COA_REQUEST:
-		proxy->listener->stats.total_responses++;
+		stats->total_responses++;
 		break;
 
 	case PW_CODE_DISCONNECT_REQUEST:
-		proxy->listener->stats.total_responses++;
+		stats->total_responses++;
 		break;
 
 #endif
@@ -2493,27 +2500,27 @@ int request_proxy_reply(RADIUS_PACKET *reply)
 	}
 
 global_stats:
-	proxy->home_server->stats.last_packet = reply->timestamp.tv_sec;
+	fr_stats_local(&proxy->home_server->stats)->last_packet = reply->timestamp.tv_sec;
 
 	switch (proxy->packet->code) {
 	case PW_CODE_ACCESS_REQUEST:
-		proxy_auth_stats.last_packet = reply->timestamp.tv_sec;
+		fr_stats_local(&proxy_auth_stats)->last_packet = reply->timestamp.tv_sec;
 		break;
 
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_REQUEST:
-		proxy_acct_stats.last_packet = reply->timestamp.tv_sec;
+		fr_stats_local(&proxy_acct_stats)->last_packet = reply->timestamp.tv_sec;
 		break;
 
 #endif
 
 #ifdef WITH_COA
 	case PW_CODE_COA_REQUEST:
-		proxy_coa_stats.last_packet = reply->timestamp.tv_sec;
+		fr_stats_local(&proxy_coa_stats)->last_packet = reply->timestamp.tv_sec;
 		break;
 
 	case PW_CODE_DISCONNECT_REQUEST:
-		proxy_dsc_stats.last_packet = reply->timestamp.tv_sec;
+		fr_stats_local(&proxy_dsc_stats)->last_packet = reply->timestamp.tv_sec;
 		break;
 
 #endif
@@ -3910,25 +3917,25 @@ static bool proxy_keep_waiting(REQUEST *request, struct timeval *now)
 			mark_home_server_zombie(home, now, &request->proxy->response_delay);
 	}
 
-	FR_STATS_TYPE_INC(home->stats.total_timeouts);
+	FR_STATS_TYPE_INC(home->stats, total_timeouts);
 	if (home->type == HOME_TYPE_AUTH) {
-		if (request->proxy->listener) FR_STATS_TYPE_INC(request->proxy->listener->stats.total_timeouts);
-		FR_STATS_TYPE_INC(proxy_auth_stats.total_timeouts);
+		if (request->proxy->listener) FR_STATS_TYPE_INC(request->proxy->listener->stats, total_timeouts);
+		FR_STATS_TYPE_INC(proxy_auth_stats, total_timeouts);
 	}
 #ifdef WITH_ACCT
 	else if (home->type == HOME_TYPE_ACCT) {
-		if (request->proxy->listener) FR_STATS_TYPE_INC(request->proxy->listener->stats.total_timeouts);
-		FR_STATS_TYPE_INC(proxy_acct_stats.total_timeouts);
+		if (request->proxy->listener) FR_STATS_TYPE_INC(request->proxy->listener->stats, total_timeouts);
+		FR_STATS_TYPE_INC(proxy_acct_stats, total_timeouts);
 	}
 #endif
 #ifdef WITH_COA
 	else if (home->type == HOME_TYPE_COA) {
-		if (request->proxy->listener) FR_STATS_TYPE_INC(request->proxy->listener->stats.total_timeouts);
+		if (request->proxy->listener) FR_STATS_TYPE_INC(request->proxy->listener->stats, total_timeouts);
 
 		if (request->packet->code == PW_CODE_COA_REQUEST) {
-			FR_STATS_TYPE_INC(proxy_coa_stats.total_timeouts);
+			FR_STATS_TYPE_INC(proxy_coa_stats, total_timeouts);
 		} else {
-			FR_STATS_TYPE_INC(proxy_dsc_stats.total_timeouts);
+			FR_STATS_TYPE_INC(proxy_dsc_stats, total_timeouts);
 		}
 	}
 #endif
@@ -4022,7 +4029,7 @@ static void proxy_retransmit(REQUEST *request, struct timeval *now)
 	request->proxy->packet->count++;
 
 	rad_assert(request->proxy->listener != NULL);
-	FR_STATS_TYPE_INC(home->stats.total_requests);
+	FR_STATS_TYPE_INC(home->stats, total_requests);
 	home->last_packet_sent = now->tv_sec;
 	request->proxy->listener->debug(request, request->proxy->packet, false);
 	request->proxy->listener->send(request->proxy->listener, request);
@@ -4485,7 +4492,7 @@ static bool coa_keep_waiting(REQUEST *request)
 
 	request->proxy->packet->count++;
 
-	FR_STATS_TYPE_INC(home->stats.total_requests);
+	FR_STATS_TYPE_INC(home->stats, total_requests);
 
 	RDEBUG2("Sending duplicate CoA request to home server %s port %d - ID: %d",
 		inet_ntop(request->proxy->packet->dst_ipaddr.af,
@@ -4899,6 +4906,14 @@ static int event_new_fd(rad_listen_t *this)
 			 *	FIXME: put idle timers on command sockets.
 			 */
 
+#ifdef WITH_METRICS
+		/*
+		 *	Metrics connections are closed after one response.
+		 */
+		case RAD_LISTEN_METRICS:
+			break;
+#endif
+
 		default:
 #ifdef WITH_TCP
 			/*
@@ -5021,15 +5036,23 @@ static int event_new_fd(rad_listen_t *this)
 			/*
 			 *	EOL all requests using this socket.
 			 *
-			 *	Except for control sockets, which
-			 *	don't have any requests associated
+			 *	Except for control and metrics sockets,
+			 *	which don't have any requests associated
 			 *	with them.
 			 */
+			switch (this->type) {
 #ifdef WITH_COMMAND_SOCKET
-			if (this->type != RAD_LISTEN_COMMAND)
+			case RAD_LISTEN_COMMAND:
+#endif
+#ifdef WITH_METRICS
+			case RAD_LISTEN_METRICS:
 #endif
+				break;
 
-			rbtree_walk(pl, RBTREE_DELETE_ORDER, eol_listener, this);
+			default:
+				rbtree_walk(pl, RBTREE_DELETE_ORDER, eol_listener, this);
+				break;
+			}
 		}
 
 
@@ -5085,6 +5108,22 @@ static void sd_watchdog_event(struct timeval *now, UNUSED void *ctx)
 }
 #endif
 
+/*
+ *	Write the module and xlat timings to the log, and reschedule the event.
+ */
+static void profile_dump_event(struct timeval *now, UNUSED void *ctx)
+{
+	struct timeval when;
+
+	if (fr_profile_enabled) fr_profile_dump();
+
+	when = *now;
+	when.tv_sec += main_config.profile_interval;
+	if (fr_event_timer_insert(el, profile_dump_event, NULL, &when, &profile_ev) < 0) {
+		ERROR("Failed to insert profile event");
+	}
+}
+
 /***********************************************************************
  *
  *	Signal handlers.
@@ -5153,6 +5192,14 @@ static void handle_signal_self(int flag)
 		FD_MUTEX_UNLOCK(&fd_mutex);
 	}
 #endif
+
+#ifdef WITH_DYNAMIC_CLIENTS
+	/*
+	 *	Modules in other threads have queued
+	 *	client additions or deletions.
+	 */
+	if ((flag & RADIUS_SIGNAL_SELF_CLIENTS) != 0) client_deferred_process();
+#endif
 }
 
 static int self_pipe[2] = { -1, -1 };
@@ -5203,6 +5250,13 @@ static void event_signal_handler(UNUSED fr_event_list_t *xel,
 	handle_signal_self(buffer[0]);
 }
 
+#ifdef WITH_DYNAMIC_CLIENTS
+static void event_signal_clients(void)
+{
+	radius_signal_self(RADIUS_SIGNAL_SELF_CLIENTS);
+}
+#endif
+
 /***********************************************************************
  *
  *	Bootstrapping code.
@@ -5226,6 +5280,17 @@ int radius_event_init(TALLOC_CTX *ctx)
 	}
 #endif
 
+	if (main_config.profile_interval > 0) {
+		struct timeval when;
+
+		fr_event_list_time(&when, el);
+		when.tv_sec += main_config.profile_interval;
+		if (fr_event_timer_insert(el, profile_dump_event, NULL, &when, &profile_ev) < 0) {
+			ERROR("Failed to insert profile event");
+			return 0;
+		}
+	}
+
 	return 1;
 }
 
@@ -5433,6 +5498,15 @@ int radius_event_start(bool have_children)
 		return -1;
 	}
 
+#ifdef WITH_DYNAMIC_CLIENTS
+	/*
+	 *	Apply any client changes queued before
+	 *	we could be signalled.
+	 */
+	client_deferred_notify(event_signal_clients);
+	client_deferred_process();
+#endif
+
 	DEBUG("%s: #### Opening IP addresses and Ports ####", main_config.name);
 
 	/*
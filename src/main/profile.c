@@ -0,0 +1,435 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file profile.c
+ * @brief Record the wall, CPU and yield time of module calls and xlat expansions.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/profile.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifndef USEC
+#  define USEC (1000000)
+#endif
+
+/** Whether new calls should be profiled
+ *
+ * Calls which are in progress when this changes are finished as they started.
+ */
+bool fr_profile_enabled = false;
+
+/*
+ *	Each thread records calls in its own tree.  The counters are
+ *	only written by the owning thread, so the only locking needed
+ *	is when an entry is added, or when the trees are read.
+ *
+ *	When a thread exits, its tree is kept, and adopted by the next
+ *	thread which records a call.
+ */
+typedef struct profile_thread_t {
+	pthread_mutex_t		mutex;		//!< Protects the tree, but not the counters in it.
+	rbtree_t		*tree;		//!< Of fr_profile_entry_t.
+	bool			in_use;		//!< Whether a thread owns this tree.
+	struct profile_thread_t	*next;
+} profile_thread_t;
+
+static pthread_mutex_t		profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static profile_thread_t		*profile_threads = NULL;
+
+static _Thread_local profile_thread_t *profile_thread;
+
+static char const *profile_types[] = {
+	[FR_PROFILE_MODULE] = "module",
+	[FR_PROFILE_XLAT] = "xlat"
+};
+
+/** Return the CPU time used by the current thread, in microseconds
+ *
+ */
+static uint64_t profile_cpu(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) return 0;
+
+	return ((uint64_t) ts.tv_sec * USEC) + (ts.tv_nsec / 1000);
+#else
+	return 0;
+#endif
+}
+
+static uint64_t profile_elapsed(struct timeval const *start, struct timeval const *end)
+{
+	struct timeval diff;
+
+	if (fr_timeval_cmp(end, start) <= 0) return 0;
+
+	fr_timeval_subtract(&diff, end, start);
+
+	return ((uint64_t) diff.tv_sec * USEC) + diff.tv_usec;
+}
+
+static int profile_entry_cmp(void const *one, void const *two)
+{
+	fr_profile_entry_t const *a = one;
+	fr_profile_entry_t const *b = two;
+	int ret;
+
+	if (a->type != b->type) return (a->type < b->type) ? -1 : +1;
+
+	ret = strcmp(a->name, b->name);
+	if (ret != 0) return ret;
+
+	ret = strcmp(a->section, b->section);
+	if (ret != 0) return ret;
+
+	return strcmp(a->server, b->server);
+}
+
+/** Find or adopt a tree for the current thread
+ *
+ */
+static profile_thread_t *profile_thread_find(void)
+{
+	profile_thread_t *pt;
+
+	if (profile_thread) return profile_thread;
+
+	pthread_mutex_lock(&profile_mutex);
+	for (pt = profile_threads; pt != NULL; pt = pt->next) {
+		if (!pt->in_use) break;
+	}
+
+	if (!pt) {
+		pt = calloc(1, sizeof(*pt));
+		if (!pt) {
+		oom:
+			pthread_mutex_unlock(&profile_mutex);
+			return NULL;
+		}
+
+		pt->tree = rbtree_create(NULL, profile_entry_cmp, NULL, RBTREE_FLAG_NONE);
+		if (!pt->tree) {
+			free(pt);
+			goto oom;
+		}
+		pthread_mutex_init(&pt->mutex, NULL);
+
+		pt->next = profile_threads;
+		profile_threads = pt;
+	}
+	pt->in_use = true;
+	pthread_mutex_unlock(&profile_mutex);
+
+	profile_thread = pt;
+
+	return pt;
+}
+
+/** Release the tree for the current thread
+ *
+ * Should be called by threads which record calls, before they exit.
+ */
+void fr_profile_thread_stop(void)
+{
+	if (!profile_thread) return;
+
+	pthread_mutex_lock(&profile_mutex);
+	profile_thread->in_use = false;
+	pthread_mutex_unlock(&profile_mutex);
+
+	profile_thread = NULL;
+}
+
+/** Start timing a call
+ *
+ * @param[out] call to initialise.
+ * @param[in] timed Set call->start even if profiling is disabled, so the
+ *	caller can use it for its own statistics.
+ */
+void fr_profile_call_start(fr_profile_call_t *call, bool timed)
+{
+	call->active = fr_profile_enabled;
+	if (call->active || timed) gettimeofday(&call->start, NULL);
+	if (!call->active) return;
+
+	call->cpu_start = profile_cpu();
+	call->cpu = 0;
+	call->yield = 0;
+}
+
+/** Note that a call has yielded
+ *
+ */
+void fr_profile_call_yield(fr_profile_call_t *call)
+{
+	if (!call->active) return;
+
+	call->cpu += profile_cpu() - call->cpu_start;
+	gettimeofday(&call->yielded, NULL);
+}
+
+/** Note that a call has been resumed
+ *
+ */
+void fr_profile_call_resume(fr_profile_call_t *call)
+{
+	struct timeval now;
+
+	if (!call->active) return;
+
+	gettimeofday(&now, NULL);
+	call->yield += profile_elapsed(&call->yielded, &now);
+	call->cpu_start = profile_cpu();
+}
+
+/** Finish timing a call, and add it to the totals
+ *
+ * @param[in] request the call was made for.  The totals are kept per virtual server and section.
+ * @param[in] type of call.
+ * @param[in] name of the module instance or xlat.
+ * @param[in] call to finish.
+ * @param[out] end Where to write the time the call finished, even if profiling
+ *	is disabled.  May be NULL.
+ */
+void fr_profile_call_end(REQUEST *request, fr_profile_type_t type, char const *name, fr_profile_call_t *call,
+			 struct timeval *end)
+{
+	profile_thread_t	*pt;
+	fr_profile_entry_t	find, *entry;
+	struct timeval		now;
+	uint64_t		wall;
+
+	if (!call->active) {
+		if (end) gettimeofday(end, NULL);
+		return;
+	}
+	call->active = false;
+
+	gettimeofday(&now, NULL);
+	if (end) *end = now;
+	call->cpu += profile_cpu() - call->cpu_start;
+	wall = profile_elapsed(&call->start, &now);
+
+	pt = profile_thread_find();
+	if (!pt) return;
+
+	find.type = type;
+	find.name = name;
+	find.section = request->component ? request->component : "";
+	find.server = request->server ? request->server : "";
+
+	entry = rbtree_finddata(pt->tree, &find);
+	if (!entry) {
+		/*
+		 *	Copy the names, they may be freed on HUP.
+		 */
+		entry = talloc_zero(pt->tree, fr_profile_entry_t);
+		if (!entry) return;
+
+		entry->type = type;
+		entry->name = talloc_typed_strdup(entry, find.name);
+		entry->section = talloc_typed_strdup(entry, find.section);
+		entry->server = talloc_typed_strdup(entry, find.server);
+
+		pthread_mutex_lock(&pt->mutex);
+		if (!rbtree_insert(pt->tree, entry)) {
+			pthread_mutex_unlock(&pt->mutex);
+			talloc_free(entry);
+			return;
+		}
+		pthread_mutex_unlock(&pt->mutex);
+	}
+
+	entry->calls++;
+	entry->wall += wall;
+	entry->cpu += call->cpu;
+	entry->yield += call->yield;
+	if (wall > entry->max) entry->max = wall;
+}
+
+static int _profile_sum(void *ctx, void *data)
+{
+	rbtree_t		*sum = talloc_get_type_abort(ctx, rbtree_t);
+	fr_profile_entry_t	*in = data, *out;
+
+	out = rbtree_finddata(sum, in);
+	if (!out) {
+		out = talloc_zero(sum, fr_profile_entry_t);
+		if (!out) return -1;
+
+		out->type = in->type;
+		out->name = in->name;
+		out->section = in->section;
+		out->server = in->server;
+
+		if (!rbtree_insert(sum, out)) return -1;
+	}
+
+	out->calls += in->calls;
+	out->wall += in->wall;
+	out->cpu += in->cpu;
+	out->yield += in->yield;
+	if (in->max > out->max) out->max = in->max;
+
+	return 0;
+}
+
+typedef struct {
+	fr_profile_entry_t	**entries;
+	uint32_t		num;
+} profile_flatten_t;
+
+static int _profile_flatten(void *ctx, void *data)
+{
+	profile_flatten_t *flat = ctx;
+
+	flat->entries[flat->num++] = data;
+
+	return 0;
+}
+
+/** Sort by total wall time, most expensive first
+ *
+ */
+static int profile_wall_cmp(void const *one, void const *two)
+{
+	fr_profile_entry_t const * const *a = one;
+	fr_profile_entry_t const * const *b = two;
+
+	if ((*a)->wall == (*b)->wall) return 0;
+
+	return ((*a)->wall > (*b)->wall) ? -1 : +1;
+}
+
+/** Call a function for the totals of every module instance and xlat
+ *
+ * The totals from all threads are added together, and the entries
+ * are passed to the callback in order of total wall time, most
+ * expensive first.
+ *
+ * @param[in] callback to call for each entry.  If it returns < 0, the walk stops.
+ * @param[in] uctx passed to the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error, or if the callback returned < 0.
+ */
+int fr_profile_walk(fr_profile_walk_t callback, void *uctx)
+{
+	TALLOC_CTX		*ctx;
+	rbtree_t		*sum;
+	profile_thread_t	*pt;
+	profile_flatten_t	flat;
+	uint32_t		i;
+	int			ret = 0;
+
+	ctx = talloc_init("profile");
+	if (!ctx) return -1;
+
+	sum = rbtree_create(ctx, profile_entry_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!sum) {
+	error:
+		talloc_free(ctx);
+		return -1;
+	}
+
+	pthread_mutex_lock(&profile_mutex);
+	for (pt = profile_threads; pt != NULL; pt = pt->next) {
+		pthread_mutex_lock(&pt->mutex);
+		ret = rbtree_walk(pt->tree, RBTREE_IN_ORDER, _profile_sum, sum);
+		pthread_mutex_unlock(&pt->mutex);
+
+		if (ret < 0) break;
+	}
+	pthread_mutex_unlock(&profile_mutex);
+
+	if (ret < 0) goto error;
+
+	flat.num = 0;
+	flat.entries = talloc_array(ctx, fr_profile_entry_t *, rbtree_num_elements(sum) + 1);
+	if (!flat.entries) goto error;
+
+	(void) rbtree_walk(sum, RBTREE_IN_ORDER, _profile_flatten, &flat);
+
+	qsort(flat.entries, flat.num, sizeof(flat.entries[0]), profile_wall_cmp);
+
+	for (i = 0; i < flat.num; i++) {
+		ret = callback(uctx, flat.entries[i]);
+		if (ret < 0) break;
+	}
+
+	talloc_free(ctx);
+
+	return (ret < 0) ? -1 : 0;
+}
+
+static int _profile_reset(UNUSED void *ctx, void *data)
+{
+	fr_profile_entry_t *entry = data;
+
+	entry->calls = 0;
+	entry->wall = 0;
+	entry->cpu = 0;
+	entry->yield = 0;
+	entry->max = 0;
+
+	return 0;
+}
+
+/** Zero the totals
+ *
+ * Calls which are being recorded at the same time may be lost.
+ */
+void fr_profile_reset(void)
+{
+	profile_thread_t *pt;
+
+	pthread_mutex_lock(&profile_mutex);
+	for (pt = profile_threads; pt != NULL; pt = pt->next) {
+		pthread_mutex_lock(&pt->mutex);
+		(void) rbtree_walk(pt->tree, RBTREE_IN_ORDER, _profile_reset, NULL);
+		pthread_mutex_unlock(&pt->mutex);
+	}
+	pthread_mutex_unlock(&profile_mutex);
+}
+
+static int _profile_log(UNUSED void *uctx, fr_profile_entry_t const *entry)
+{
+	if (!entry->calls) return 0;
+
+	INFO("profile: server %s section %s %s %s calls %" PRIu64 " wall %" PRIu64 "us cpu %" PRIu64
+	     "us yield %" PRIu64 "us max %" PRIu64 "us",
+	     entry->server, entry->section, profile_types[entry->type], entry->name,
+	     entry->calls, entry->wall, entry->cpu, entry->yield, entry->max);
+
+	return 0;
+}
+
+/** Write the totals to the log
+ *
+ */
+void fr_profile_dump(void)
+{
+	(void) fr_profile_walk(_profile_log, NULL);
+}
@@ -26,6 +26,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/radclient.h>
 #include <freeradius-devel/conf.h>
+#include <freeradius-devel/net.h>
 #include <ctype.h>
 
 #ifdef HAVE_GETOPT_H
@@ -81,6 +82,8 @@ static void NEVER_RETURNS usage(void)
 	fprintf(stderr, "  <command>              One of auth, acct, status, coa, disconnect or auto.\n");
 	fprintf(stderr, "  -4                     Use IPv4 address of server\n");
 	fprintf(stderr, "  -6                     Use IPv6 address of server.\n");
+	fprintf(stderr, "  -B <threads>           Benchmark mode.  Send packets from 'threads' threads, and print\n");
+	fprintf(stderr, "                         the rate and latency of replies.\n");
 	fprintf(stderr, "  -c <count>             Send each packet 'count' times.\n");
 	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
 	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
@@ -96,6 +99,7 @@ static void NEVER_RETURNS usage(void)
 	fprintf(stderr, "  -s                     Print out summary information of auth results.\n");
 	fprintf(stderr, "  -S <file>              read secret from file, not command line.\n");
 	fprintf(stderr, "  -t <timeout>           Wait 'timeout' seconds before retrying (may be a floating point number).\n");
+	fprintf(stderr, "  -U <file>              In benchmark mode, use a random User-Name from file.\n");
 	fprintf(stderr, "  -v                     Show program version information.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
@@ -817,6 +821,33 @@ static void deallocate_id(rc_request_t *request)
 /*
  *	Send one packet.
  */
+/*
+ *	Update the password attributes from the Cleartext-Password,
+ *	so they can be encrypted with the current authentication vector.
+ */
+static void radclient_password(rc_request_t *request)
+{
+	VALUE_PAIR *vp;
+
+	if (!request->password) return;
+
+	if ((vp = fr_pair_find_by_num(request->packet->vps, 0, PW_USER_PASSWORD, TAG_ANY)) != NULL) {
+		fr_pair_value_strcpy(vp, request->password->vp_strvalue);
+
+	} else if ((vp = fr_pair_find_by_num(request->packet->vps, 0, PW_CHAP_PASSWORD, TAG_ANY)) != NULL) {
+		uint8_t buffer[17];
+
+		fr_radius_encode_chap_password(buffer, request->packet, fr_rand() & 0xff, request->password);
+		fr_pair_value_memcpy(vp, buffer, 17);
+
+	} else if (fr_pair_find_by_num(request->packet->vps, 0, PW_MS_CHAP_PASSWORD, TAG_ANY) != NULL) {
+		mschapv1_encode(request->packet, &request->packet->vps, request->password->vp_strvalue);
+
+	} else {
+		DEBUG("WARNING: No password in the request");
+	}
+}
+
 static int send_one_packet(rc_request_t *request)
 {
 	assert(request->done == false);
@@ -874,25 +905,7 @@ static int send_one_packet(rc_request_t *request)
 		 *	Update the password, so it can be encrypted with the
 		 *	new authentication vector.
 		 */
-		if (request->password) {
-			VALUE_PAIR *vp;
-
-			if ((vp = fr_pair_find_by_num(request->packet->vps, 0, PW_USER_PASSWORD, TAG_ANY)) != NULL) {
-				fr_pair_value_strcpy(vp, request->password->vp_strvalue);
-
-			} else if ((vp = fr_pair_find_by_num(request->packet->vps, 0, PW_CHAP_PASSWORD, TAG_ANY)) != NULL) {
-				uint8_t buffer[17];
-
-				fr_radius_encode_chap_password(buffer, request->packet, fr_rand() & 0xff, request->password);
-				fr_pair_value_memcpy(vp, buffer, 17);
-
-			} else if (fr_pair_find_by_num(request->packet->vps, 0, PW_MS_CHAP_PASSWORD, TAG_ANY) != NULL) {
-				mschapv1_encode(request->packet, &request->packet->vps, request->password->vp_strvalue);
-
-			} else {
-				DEBUG("WARNING: No password in the request");
-			}
-		}
+		radclient_password(request);
 
 		request->timestamp = time(NULL);
 		request->tries = 1;
@@ -1142,6 +1155,141 @@ fr_radius_free(&request->reply);
 	return 0;
 }
 
+/*
+ *	Read the User-Name values for benchmark mode, one per line.
+ */
+static char **radclient_bench_names(TALLOC_CTX *ctx, char const *filename, uint32_t *num)
+{
+	FILE	*fp;
+	char	buffer[1024];
+	char	**names;
+	size_t	len;
+
+	*num = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		ERROR("Error opening %s: %s", filename, fr_syserror(errno));
+		return NULL;
+	}
+
+	names = talloc_array(ctx, char *, 64);
+	if (!names) {
+	error:
+		fclose(fp);
+		talloc_free(names);
+		return NULL;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		len = strlen(buffer);
+		while ((len > 0) && (buffer[len - 1] < ' ')) buffer[--len] = '\0';
+		if (!len) continue;
+
+		if (len > 253) {
+			ERROR("User-Name \"%s\" in %s is too long", buffer, filename);
+			goto error;
+		}
+
+		if (*num == talloc_array_length(names)) {
+			names = talloc_realloc(ctx, names, char *, *num * 2);
+			if (!names) goto error;
+		}
+
+		names[*num] = talloc_strndup(names, buffer, len);
+		if (!names[*num]) goto error;
+		(*num)++;
+	}
+	fclose(fp);
+
+	if (!*num) {
+		ERROR("No User-Name values in %s", filename);
+		talloc_free(names);
+		return NULL;
+	}
+
+	return names;
+}
+
+/*
+ *	Encode a request once, and remember where the parts which
+ *	change for each packet are.
+ */
+static int radclient_bench_template(rc_bench_template_t *tmpl, rc_request_t *request, bool names)
+{
+	if (rc_bench_template_prepare(request->packet, names) < 0) {
+		ERROR("Failed preparing packet from %s: %s", request->files->packets, fr_strerror());
+		return -1;
+	}
+
+	radclient_password(request);
+
+	if (rc_bench_template_init(request, tmpl, request->packet, names, secret) < 0) {
+		ERROR("Failed encoding packet from %s: %s", request->files->packets, fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Send the requests as templates, from multiple threads.
+ */
+static int radclient_bench(uint32_t threads, char const *names_file, int persec, int parallel)
+{
+	rc_bench_config_t	config;
+	rc_request_t		*this;
+	int			rcode;
+
+	memset(&config, 0, sizeof(config));
+
+	config.server_ipaddr = server_ipaddr;
+	config.server_port = server_port;
+	config.client_ipaddr = client_ipaddr;
+	config.secret = secret;
+	/*
+	 *	Each thread sends at least one packet per second, so
+	 *	a low rate means fewer threads.
+	 */
+	if ((persec > 0) && (threads > (uint32_t) persec)) {
+		fprintf(stderr, "radclient: WARNING: Rate of %d packets per second is too low for %u threads, "
+			"using %d threads\n", persec, threads, persec);
+		threads = persec;
+	}
+
+	config.threads = threads;
+	config.rate = persec;
+	config.parallel = (parallel > 256) ? 256 : parallel;
+	config.timeout = timeout;
+	config.output = do_output;
+
+	if (names_file) {
+		config.names = radclient_bench_names(request_head, names_file, &config.num_names);
+		if (!config.names) return -1;
+	}
+
+	for (this = request_head; this != NULL; this = this->next) config.num_templates++;
+
+	config.templates = talloc_zero_array(request_head, rc_bench_template_t, config.num_templates);
+	if (!config.templates) {
+		ERROR("Out of memory");
+		return -1;
+	}
+
+	config.num_templates = 0;
+	for (this = request_head; this != NULL; this = this->next) {
+		if (radclient_bench_template(&config.templates[config.num_templates++],
+					     this, (config.num_names > 0)) < 0) return -1;
+	}
+
+	config.count = (uint64_t) resend_count * config.num_templates;
+
+	rcode = rc_bench_run(&config);
+	if (rcode < 0) ERROR("%s", fr_strerror());
+
+	return rcode;
+}
+
 int main(int argc, char **argv)
 {
 	int		c;
@@ -1151,7 +1299,9 @@ int main(int argc, char **argv)
 	FILE		*fp;
 	int		do_summary = false;
 	int		persec = 0;
-	int		parallel = 1;
+	int		parallel = 0;
+	uint32_t	bench = 0;
+	char const	*names_file = NULL;
 	rc_request_t	*this;
 	int		force_af = AF_UNSPEC;
 	fr_dict_t	*dict = NULL;
@@ -1180,7 +1330,7 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	while ((c = getopt(argc, argv, "46c:d:D:f:Fhi:n:p:qr:sS:t:vx"
+	while ((c = getopt(argc, argv, "46B:c:d:D:f:Fhi:n:p:qr:sS:t:U:vx"
 #ifdef WITH_TCP
 		"P:"
 #endif
@@ -1193,6 +1343,12 @@ int main(int argc, char **argv)
 			force_af = AF_INET6;
 			break;
 
+		case 'B':
+			if (!isdigit((int) *optarg)) usage();
+			bench = atoi(optarg);
+			if ((bench == 0) || (bench > 1024)) usage();
+			break;
+
 		case 'c':
 			if (!isdigit((int) *optarg))
 				usage();
@@ -1325,6 +1481,10 @@ int main(int argc, char **argv)
 			timeout = atof(optarg);
 			break;
 
+		case 'U':
+			names_file = optarg;
+			break;
+
 		case 'v':
 			fr_debug_lvl = 1;
 			DEBUG("%s", radclient_version);
@@ -1345,6 +1505,25 @@ int main(int argc, char **argv)
 		ERROR("Insufficient arguments");
 		usage();
 	}
+
+	if (!bench && names_file) {
+		ERROR("-U can only be used with -B");
+		usage();
+	}
+
+#ifdef WITH_TCP
+	if (bench && proto) {
+		ERROR("Benchmark mode only supports UDP");
+		usage();
+	}
+#endif
+
+	/*
+	 *	In benchmark mode, '-p' is the number of packets
+	 *	each thread has outstanding.
+	 */
+	if (!parallel) parallel = bench ? 256 : 1;
+
 	/*
 	 *	Mismatch between the binary and the libraries it depends on
 	 */
@@ -1475,6 +1654,20 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (bench) {
+		int rcode;
+
+		rcode = radclient_bench(bench, names_file, persec, parallel);
+
+		rbtree_free(filename_tree);
+		fr_packet_list_free(pl);
+		while (request_head) TALLOC_FREE(request_head);
+		talloc_free(dict);
+		talloc_free(secret);
+
+		exit((rcode == 0) ? 0 : 1);
+	}
+
 	/*
 	 *	Walk over the packets to send, until
 	 *	we're all done.
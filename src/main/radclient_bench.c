@@ -0,0 +1,790 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file radclient_bench.c
+ * @brief Benchmark mode for radclient.
+ *
+ * Several threads each send packets over their own socket, as fast as
+ * the server answers them, or at a fixed rate.  Packets are copied from
+ * pre-encoded templates, and a latency histogram is kept for the replies.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radclient.h>
+#include <freeradius-devel/md5.h>
+#include <freeradius-devel/hist.h>
+#include <freeradius-devel/net.h>
+
+#include <pthread.h>
+#include <poll.h>
+
+#ifndef USEC
+#  define USEC (1000000)
+#endif
+
+/*
+ *	Maximum number of packets sent or received with one system call.
+ */
+#define BENCH_BATCH		(64)
+
+/*
+ *	A request which has been sent, and is waiting for a reply.
+ */
+typedef struct rc_bench_slot {
+	bool		in_use;
+	uint64_t	sent;				//!< When the request was sent.
+	uint8_t		vector[AUTH_VECTOR_LEN];	//!< Request authenticator.
+} rc_bench_slot_t;
+
+typedef struct rc_bench_thread {
+	pthread_t		pthread_id;
+	int			id;			//!< Number of this thread.
+	rc_bench_config_t const	*config;
+
+	int			sockfd;			//!< Connected to the server.
+	uint64_t		to_send;		//!< Number of packets this thread sends.
+	uint32_t		rate;			//!< Packets per second for this thread.  0 for no limit.
+	uint64_t		seq;			//!< Counter for the next packet.
+	uint64_t		state;			//!< For picking names, and Request Authenticators.
+
+	rc_bench_slot_t		slot[256];		//!< Indexed by packet ID.
+	uint8_t			free_ids[256];		//!< Stack of unused IDs.
+	unsigned int		num_free;
+
+	uint8_t			*send_buffer;		//!< BENCH_BATCH packets of MAX_PACKET_LEN.
+	uint8_t			*recv_buffer;		//!< BENCH_BATCH packets of MAX_PACKET_LEN.
+
+	/*
+	 *	Results
+	 */
+	uint64_t		sent;
+	uint64_t		received;
+	uint64_t		lost;
+	uint64_t		unexpected;		//!< Replies which didn't match a request.
+	uint64_t		bad;			//!< Malformed replies, or replies with a bad authenticator.
+	uint64_t		send_errors;
+	uint64_t		codes[FR_MAX_PACKET_CODE];
+	fr_hist_t		hist;			//!< Latency, in microseconds.
+} rc_bench_thread_t;
+
+/** Return the current time, in microseconds
+ *
+ */
+static uint64_t bench_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) return ((uint64_t) ts.tv_sec * USEC) + (ts.tv_nsec / 1000);
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return ((uint64_t) tv.tv_sec * USEC) + tv.tv_usec;
+	}
+}
+
+/*
+ *	xorshift64*, so that threads don't contend for fr_rand().
+ */
+static uint64_t bench_rand(rc_bench_thread_t *thread)
+{
+	thread->state ^= thread->state >> 12;
+	thread->state ^= thread->state << 25;
+	thread->state ^= thread->state >> 27;
+
+	return thread->state * UINT64_C(2685821657736338717);
+}
+
+/** Prepare a request to be used as a template
+ *
+ * Must be called before the passwords in the request are encoded.
+ *
+ * @param packet	to prepare.
+ * @param names		Whether the User-Name is substituted for each packet,
+ *			in which case it's removed from the template.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rc_bench_template_prepare(RADIUS_PACKET *packet, bool names)
+{
+	VALUE_PAIR *vp;
+
+	if (names) fr_pair_delete_by_num(&packet->vps, 0, PW_USER_NAME, TAG_ANY);
+
+	/*
+	 *	Each packet gets a new Request Authenticator, so CHAP
+	 *	needs an explicit challenge.
+	 */
+	if (fr_pair_find_by_num(packet->vps, 0, PW_CHAP_PASSWORD, TAG_ANY) &&
+	    !fr_pair_find_by_num(packet->vps, 0, PW_CHAP_CHALLENGE, TAG_ANY)) {
+		vp = fr_pair_afrom_num(packet, 0, PW_CHAP_CHALLENGE);
+		if (!vp) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		fr_pair_value_memcpy(vp, packet->vector, sizeof(packet->vector));
+		fr_pair_add(&packet->vps, vp);
+	}
+
+	return 0;
+}
+
+/** Encode a prepared request, and find the parts which change for each packet
+ *
+ * @param ctx		to allocate the template data in.
+ * @param tmpl		to initialise.
+ * @param packet	prepared with #rc_bench_template_prepare, with its
+ *			passwords encoded.
+ * @param names		Whether the User-Name is substituted for each packet.
+ * @param secret	to sign the packet with.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rc_bench_template_init(TALLOC_CTX *ctx, rc_bench_template_t *tmpl, RADIUS_PACKET *packet,
+			   bool names, char const *secret)
+{
+	VALUE_PAIR	*vp, *counter = NULL;
+	vp_cursor_t	cursor;
+	char const	*hash = NULL;
+	size_t		hash_len = 0;
+
+	memset(tmpl, 0, sizeof(*tmpl));
+
+	/*
+	 *	The first run of '#' in a string attribute is replaced
+	 *	with a counter.  Encrypted attributes can't be changed.
+	 */
+	for (vp = fr_pair_cursor_init(&cursor, &packet->vps);
+	     vp;
+	     vp = fr_pair_cursor_next(&cursor)) {
+		if ((vp->da->type != PW_TYPE_STRING) || vp->da->flags.encrypt) continue;
+
+		hash = memchr(vp->vp_strvalue, '#', vp->vp_length);
+		if (!hash) continue;
+
+		counter = vp;
+		hash_len = strspn(hash, "#");
+		break;
+	}
+
+	/*
+	 *	The User-Password plaintext is kept so it can be
+	 *	encrypted again with each Request Authenticator.
+	 */
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_USER_PASSWORD, TAG_ANY);
+	if (vp && (packet->code == PW_CODE_ACCESS_REQUEST)) {
+		tmpl->password_len = (vp->vp_length > MAX_PASS_LEN) ? MAX_PASS_LEN : vp->vp_length;
+		tmpl->password = talloc_memdup(ctx, vp->vp_strvalue, tmpl->password_len + 1);
+		if (!tmpl->password) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+	}
+
+	packet->id = 0;
+	if ((fr_radius_encode(packet, NULL, secret) < 0) ||
+	    (fr_radius_sign(packet, NULL, secret) < 0)) return -1;
+
+	if (counter) {
+		uint8_t const *value;
+
+		value = memmem(packet->data + RADIUS_HDR_LEN, packet->data_len - RADIUS_HDR_LEN,
+			       counter->vp_strvalue, counter->vp_length);
+		if (value) {
+			tmpl->counter_offset = (value - packet->data) + (hash - counter->vp_strvalue);
+			tmpl->counter_len = hash_len;
+		}
+	}
+
+	if (packet->offset > 0) tmpl->ma_offset = packet->offset + 2;
+
+	if (tmpl->password) {
+		uint8_t const	*attr = packet->data + RADIUS_HDR_LEN;
+		uint8_t const	*end = packet->data + packet->data_len;
+		size_t		encrypted_len;
+
+		while (((attr + 2) <= end) && (attr[1] >= 2) && (attr[0] != PW_USER_PASSWORD)) attr += attr[1];
+
+		/*
+		 *	Must be the same length as the password will be
+		 *	when it's encrypted again.
+		 */
+		encrypted_len = tmpl->password_len ? tmpl->password_len : 1;
+		encrypted_len += (AUTH_PASS_LEN - (encrypted_len % AUTH_PASS_LEN)) % AUTH_PASS_LEN;
+
+		if (((attr + 2) > end) || (attr[0] != PW_USER_PASSWORD) || ((size_t) (attr[1] - 2) != encrypted_len)) {
+			fr_strerror_printf("Failed finding User-Password in encoded packet");
+			return -1;
+		}
+		tmpl->password_offset = (attr + 2) - packet->data;
+	}
+
+	if (names && ((packet->data_len + 255) > MAX_PACKET_LEN)) {
+		fr_strerror_printf("Packet is too large to add a User-Name");
+		return -1;
+	}
+
+	tmpl->data_len = packet->data_len;
+	tmpl->data = talloc_memdup(ctx, packet->data, packet->data_len);
+	if (!tmpl->data) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Build a request from a template
+ *
+ * @param out		Where to write the packet.  Must be MAX_PACKET_LEN bytes.
+ * @param tmpl		to copy.
+ * @param secret	talloced, shared with the server.
+ * @param counter	to write over the '#' characters in the template.
+ * @param name		talloced User-Name to add.  NULL to leave the packet as it is.
+ * @param vector	Request Authenticator, used for Access-Request and
+ *			Status-Server.
+ * @param id		of the packet.
+ * @return the length of the packet.
+ */
+size_t rc_bench_packet(uint8_t *out, rc_bench_template_t const *tmpl, char const *secret,
+		       uint64_t counter, char const *name, uint8_t const *vector, uint8_t id)
+{
+	uint8_t	*p;
+	size_t	len, shift;
+
+	memcpy(out, tmpl->data, RADIUS_HDR_LEN);
+	p = out + RADIUS_HDR_LEN;
+
+	/*
+	 *	The User-Name goes first, so that the offsets in the
+	 *	template only have to be shifted by its length.
+	 */
+	if (name) {
+		size_t name_len = talloc_array_length(name) - 1;
+
+		*p++ = PW_USER_NAME;
+		*p++ = name_len + 2;
+		memcpy(p, name, name_len);
+		p += name_len;
+	}
+	shift = p - (out + RADIUS_HDR_LEN);
+
+	memcpy(p, tmpl->data + RADIUS_HDR_LEN, tmpl->data_len - RADIUS_HDR_LEN);
+	len = tmpl->data_len + shift;
+
+	out[1] = id;
+	out[2] = (len >> 8) & 0xff;
+	out[3] = len & 0xff;
+
+	/*
+	 *	Write the counter as zero-padded decimal.  Digits which
+	 *	don't fit are dropped from the left.
+	 */
+	if (tmpl->counter_offset) {
+		size_t i;
+
+		for (i = tmpl->counter_len; i > 0; i--) {
+			out[tmpl->counter_offset + shift + i - 1] = '0' + (counter % 10);
+			counter /= 10;
+		}
+	}
+
+	switch (out[0]) {
+	case PW_CODE_ACCESS_REQUEST:
+	case PW_CODE_STATUS_SERVER:
+		/*
+		 *	Each request gets a new Request Authenticator,
+		 *	so the User-Password has to be encrypted again.
+		 */
+		memcpy(out + 4, vector, AUTH_VECTOR_LEN);
+
+		if (tmpl->password_offset) {
+			char	password[MAX_PASS_LEN];
+			size_t	password_len = tmpl->password_len;
+
+			memcpy(password, tmpl->password, password_len);
+			fr_radius_encode_password(password, &password_len, secret, out + 4);
+			memcpy(out + tmpl->password_offset + shift, password, password_len);
+		}
+
+		if (tmpl->ma_offset) {
+			uint8_t *ma = out + tmpl->ma_offset + shift;
+
+			memset(ma, 0, AUTH_VECTOR_LEN);
+			fr_hmac_md5(ma, out, len, (uint8_t const *) secret, talloc_array_length(secret) - 1);
+		}
+		break;
+
+	default:
+	{
+		FR_MD5_CTX ctx;
+
+		memset(out + 4, 0, AUTH_VECTOR_LEN);
+
+		if (tmpl->ma_offset) {
+			uint8_t *ma = out + tmpl->ma_offset + shift;
+
+			memset(ma, 0, AUTH_VECTOR_LEN);
+			fr_hmac_md5(ma, out, len, (uint8_t const *) secret, talloc_array_length(secret) - 1);
+		}
+
+		fr_md5_init(&ctx);
+		fr_md5_update(&ctx, out, len);
+		fr_md5_update(&ctx, (uint8_t const *) secret, talloc_array_length(secret) - 1);
+		fr_md5_final(out + 4, &ctx);
+	}
+		break;
+	}
+
+	return len;
+}
+
+/** Build the next request for a thread
+ *
+ * @return the length of the packet.
+ */
+static size_t bench_build(rc_bench_thread_t *thread, uint8_t *out, uint8_t id)
+{
+	rc_bench_config_t const	*config = thread->config;
+	uint64_t		counter;
+	uint64_t		vector[AUTH_VECTOR_LEN / sizeof(uint64_t)];
+	char const		*name = NULL;
+	size_t			i;
+
+	counter = thread->seq;
+	thread->seq += config->threads;
+
+	if (config->num_names) name = config->names[bench_rand(thread) % config->num_names];
+
+	for (i = 0; i < (sizeof(vector) / sizeof(vector[0])); i++) vector[i] = bench_rand(thread);
+
+	return rc_bench_packet(out, &config->templates[counter % config->num_templates], config->secret,
+			       counter, name, (uint8_t const *) vector, id);
+}
+
+/** Send as many requests as we're allowed to
+ *
+ * @return the number of requests sent.
+ */
+static unsigned int bench_send(rc_bench_thread_t *thread, uint64_t now, unsigned int num)
+{
+	unsigned int	i, sent;
+	uint8_t		ids[BENCH_BATCH];
+	size_t		lens[BENCH_BATCH];
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr	msgs[BENCH_BATCH];
+	struct iovec	iov[BENCH_BATCH];
+	int		r;
+#endif
+
+	if (num > BENCH_BATCH) num = BENCH_BATCH;
+
+	for (i = 0; i < num; i++) {
+		uint8_t *packet = thread->send_buffer + (i * MAX_PACKET_LEN);
+
+		ids[i] = thread->free_ids[--thread->num_free];
+		lens[i] = bench_build(thread, packet, ids[i]);
+
+		thread->slot[ids[i]].in_use = true;
+		thread->slot[ids[i]].sent = now;
+		memcpy(thread->slot[ids[i]].vector, packet + 4, AUTH_VECTOR_LEN);
+	}
+
+#ifdef HAVE_SENDMMSG
+	memset(msgs, 0, sizeof(msgs[0]) * num);
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = thread->send_buffer + (i * MAX_PACKET_LEN);
+		iov[i].iov_len = lens[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	r = sendmmsg(thread->sockfd, msgs, num, 0);
+	sent = (r < 0) ? 0 : r;
+#else
+	for (sent = 0; sent < num; sent++) {
+		if (send(thread->sockfd, thread->send_buffer + (sent * MAX_PACKET_LEN), lens[sent], 0) < 0) break;
+	}
+#endif
+
+	/*
+	 *	The kernel queues are full, or there was an error.
+	 *	Give back the IDs for the packets which weren't sent,
+	 *	in reverse order, so the counters are reused in order.
+	 */
+	if (sent < num) {
+		if (!sent && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS) && (errno != EINTR)) {
+			thread->send_errors++;
+		}
+
+		for (i = num; i > sent; i--) {
+			thread->slot[ids[i - 1]].in_use = false;
+			thread->free_ids[thread->num_free++] = ids[i - 1];
+			thread->seq -= thread->config->threads;
+		}
+	}
+
+	thread->sent += sent;
+
+	return sent;
+}
+
+/** Process one reply
+ *
+ */
+static void bench_reply(rc_bench_thread_t *thread, uint64_t now, uint8_t *packet, size_t len)
+{
+	rc_bench_slot_t		*slot;
+	uint8_t			vector[AUTH_VECTOR_LEN];
+	uint8_t			digest[AUTH_VECTOR_LEN];
+	FR_MD5_CTX		ctx;
+	char const		*secret = thread->config->secret;
+
+	if ((len < RADIUS_HDR_LEN) || ((((size_t) packet[2] << 8) | packet[3]) != len)) {
+		thread->bad++;
+		return;
+	}
+
+	slot = &thread->slot[packet[1]];
+	if (!slot->in_use) {
+		thread->unexpected++;
+		return;
+	}
+
+	/*
+	 *	Check the response authenticator, so late replies to
+	 *	an earlier request with the same ID aren't counted.
+	 */
+	memcpy(vector, packet + 4, AUTH_VECTOR_LEN);
+	memcpy(packet + 4, slot->vector, AUTH_VECTOR_LEN);
+
+	fr_md5_init(&ctx);
+	fr_md5_update(&ctx, packet, len);
+	fr_md5_update(&ctx, (uint8_t const *) secret, talloc_array_length(secret) - 1);
+	fr_md5_final(digest, &ctx);
+
+	if (fr_radius_digest_cmp(digest, vector, AUTH_VECTOR_LEN) != 0) {
+		thread->bad++;
+		return;
+	}
+
+	slot->in_use = false;
+	thread->free_ids[thread->num_free++] = packet[1];
+
+	thread->received++;
+	if (is_radius_code(packet[0])) thread->codes[packet[0]]++;
+	fr_hist_add(&thread->hist, (now > slot->sent) ? (now - slot->sent) : 0);
+}
+
+/** Read as many replies as are waiting
+ *
+ * @return the number of replies read.
+ */
+static int bench_recv(rc_bench_thread_t *thread)
+{
+	int		num;
+	uint64_t	now;
+#ifdef HAVE_RECVMMSG
+	int		i;
+	struct mmsghdr	msgs[BENCH_BATCH];
+	struct iovec	iov[BENCH_BATCH];
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < BENCH_BATCH; i++) {
+		iov[i].iov_base = thread->recv_buffer + (i * MAX_PACKET_LEN);
+		iov[i].iov_len = MAX_PACKET_LEN;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	num = recvmmsg(thread->sockfd, msgs, BENCH_BATCH, MSG_DONTWAIT, NULL);
+	if (num <= 0) return 0;
+
+	now = bench_now();
+	for (i = 0; i < num; i++) {
+		bench_reply(thread, now, thread->recv_buffer + (i * MAX_PACKET_LEN), msgs[i].msg_len);
+	}
+#else
+	ssize_t len;
+
+	for (num = 0; num < BENCH_BATCH; num++) {
+		len = recv(thread->sockfd, thread->recv_buffer, MAX_PACKET_LEN, MSG_DONTWAIT);
+		if (len < 0) break;
+
+		now = bench_now();
+		bench_reply(thread, now, thread->recv_buffer, len);
+	}
+#endif
+
+	return num;
+}
+
+/** Count requests which haven't had a reply in time as lost
+ *
+ */
+static void bench_expire(rc_bench_thread_t *thread, uint64_t now)
+{
+	uint64_t	timeout = thread->config->timeout * USEC;
+	unsigned int	i;
+
+	for (i = 0; i < 256; i++) {
+		if (!thread->slot[i].in_use) continue;
+		if ((now - thread->slot[i].sent) < timeout) continue;
+
+		thread->slot[i].in_use = false;
+		thread->free_ids[thread->num_free++] = i;
+		thread->lost++;
+	}
+}
+
+static void *bench_thread(void *arg)
+{
+	rc_bench_thread_t	*thread = arg;
+	uint64_t		start, now, next_expire;
+	unsigned int		window = thread->config->parallel;
+	struct pollfd		pfd;
+
+	pfd.fd = thread->sockfd;
+	pfd.events = POLLIN;
+
+	start = now = bench_now();
+	next_expire = now + (USEC / 100);
+
+	while ((thread->sent < thread->to_send) || (thread->num_free < 256)) {
+		uint64_t	allowed;
+		unsigned int	outstanding = 256 - thread->num_free;
+		int		wait = 10;
+		bool		busy = false;
+
+		/*
+		 *	Work out how many more packets we're allowed to
+		 *	send now, given the window, and the rate.
+		 */
+		allowed = thread->to_send - thread->sent;
+		if (allowed > (window - outstanding)) allowed = window - outstanding;
+
+		if (thread->rate && allowed) {
+			uint64_t due = ((now - start) * thread->rate) / USEC + 1;
+
+			if (due <= thread->sent) {
+				allowed = 0;
+				wait = 1;
+			} else if (allowed > (due - thread->sent)) {
+				allowed = due - thread->sent;
+			}
+		}
+
+		if (allowed && (bench_send(thread, now, allowed) > 0)) busy = true;
+
+		if (bench_recv(thread) > 0) busy = true;
+
+		now = bench_now();
+		if (now >= next_expire) {
+			bench_expire(thread, now);
+			next_expire = now + (USEC / 100);
+		}
+
+		if (busy) continue;
+
+		/*
+		 *	Nothing to do.  Wait for a reply, the next
+		 *	packet to be due, or for a request to time out.
+		 */
+		if (poll(&pfd, 1, wait) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		now = bench_now();
+	}
+
+	return NULL;
+}
+
+static void bench_print(rc_bench_config_t const *config, rc_bench_thread_t const *threads, uint64_t elapsed)
+{
+	rc_bench_thread_t	total;
+	uint32_t		i;
+	unsigned int		j;
+	double			secs = (double) elapsed / USEC;
+
+	memset(&total, 0, sizeof(total));
+
+	for (i = 0; i < config->threads; i++) {
+		total.sent += threads[i].sent;
+		total.received += threads[i].received;
+		total.lost += threads[i].lost;
+		total.unexpected += threads[i].unexpected;
+		total.bad += threads[i].bad;
+		total.send_errors += threads[i].send_errors;
+		for (j = 0; j < FR_MAX_PACKET_CODE; j++) total.codes[j] += threads[i].codes[j];
+		fr_hist_merge(&total.hist, &threads[i].hist);
+	}
+
+	if (!secs) secs = 1.0 / USEC;
+
+	printf("Benchmark summary:\n");
+	printf("\tThreads       : %u\n", config->threads);
+	printf("\tDuration      : %.3f s\n", secs);
+	printf("\tSent          : %" PRIu64 " (%.0f/s)\n", total.sent, total.sent / secs);
+	printf("\tReceived      : %" PRIu64 " (%.0f/s)\n", total.received, total.received / secs);
+	printf("\tLost          : %" PRIu64 "\n", total.lost);
+	if (total.unexpected) printf("\tUnexpected    : %" PRIu64 "\n", total.unexpected);
+	if (total.bad) printf("\tInvalid       : %" PRIu64 "\n", total.bad);
+	if (total.send_errors) printf("\tSend errors   : %" PRIu64 "\n", total.send_errors);
+
+	for (j = 0; j < FR_MAX_PACKET_CODE; j++) {
+		if (!total.codes[j]) continue;
+
+		printf("\t%-14s: %" PRIu64 "\n", fr_packet_codes[j], total.codes[j]);
+	}
+
+	if (!total.hist.count) return;
+
+	printf("Latency (us):\n");
+	printf("\tmin %" PRIu64 " mean %" PRIu64 " p50 %" PRIu64 " p90 %" PRIu64 " p99 %" PRIu64
+	       " p99.9 %" PRIu64 " max %" PRIu64 "\n",
+	       total.hist.min, total.hist.sum / total.hist.count,
+	       fr_hist_percentile(&total.hist, 500), fr_hist_percentile(&total.hist, 900),
+	       fr_hist_percentile(&total.hist, 990), fr_hist_percentile(&total.hist, 999),
+	       total.hist.max);
+
+	if (fr_debug_lvl == 0) return;
+
+	printf("Latency histogram (us):\n");
+	for (j = 0; j < FR_HIST_BUCKETS; j++) {
+		if (!total.hist.bucket[j]) continue;
+
+		printf("\t<= %-10" PRIu64 " %" PRIu64 "\n", fr_hist_bucket_max(j), total.hist.bucket[j]);
+	}
+}
+
+/** Run the benchmark, and print the results
+ *
+ * @param[in] config for the benchmark.
+ * @return
+ *	- 0 if every packet got a reply.
+ *	- 1 if packets were lost.
+ *	- -1 on error.
+ */
+int rc_bench_run(rc_bench_config_t const *config)
+{
+	rc_bench_thread_t	*threads;
+	struct sockaddr_storage	dst;
+	socklen_t		dst_len;
+	uint32_t		i, started = 0;
+	unsigned int		j;
+	uint64_t		start, lost = 0;
+	int			rcode = 0;
+
+	if (!config->threads || !config->num_templates || !config->count) return -1;
+
+	/*
+	 *	Every thread must get a share of the rate, otherwise
+	 *	its share of the packets would never be sent.
+	 */
+	if (config->rate && (config->rate < config->threads)) {
+		fr_strerror_printf("Rate must be at least one packet per second per thread");
+		return -1;
+	}
+
+	if (!fr_ipaddr_to_sockaddr(&config->server_ipaddr, config->server_port, &dst, &dst_len)) {
+		fr_strerror_printf("Invalid server address");
+		return -1;
+	}
+
+	threads = talloc_zero_array(NULL, rc_bench_thread_t, config->threads);
+	if (!threads) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	/*
+	 *	Everything is allocated here, so the threads don't
+	 *	need to use talloc.
+	 */
+	for (i = 0; i < config->threads; i++) {
+		rc_bench_thread_t *thread = &threads[i];
+
+		thread->id = i;
+		thread->config = config;
+		thread->seq = i;
+		thread->state = ((uint64_t) fr_rand() << 32) | fr_rand() | 1;
+		thread->to_send = config->count / config->threads;
+		if (i < (config->count % config->threads)) thread->to_send++;
+		thread->rate = config->rate / config->threads;
+		if (config->rate && (i < (config->rate % config->threads))) thread->rate++;
+
+		for (j = 0; j < 256; j++) thread->free_ids[j] = 255 - j;
+		thread->num_free = 256;
+
+		thread->send_buffer = talloc_array(threads, uint8_t, BENCH_BATCH * MAX_PACKET_LEN);
+		thread->recv_buffer = talloc_array(threads, uint8_t, BENCH_BATCH * MAX_PACKET_LEN);
+		if (!thread->send_buffer || !thread->recv_buffer) {
+			fr_strerror_printf("Out of memory");
+			rcode = -1;
+			goto done;
+		}
+
+		thread->sockfd = fr_socket(&config->client_ipaddr, 0);
+		if (thread->sockfd < 0) {
+			rcode = -1;
+			goto done;
+		}
+
+		if (connect(thread->sockfd, (struct sockaddr *) &dst, dst_len) < 0) {
+			fr_strerror_printf("Failed connecting socket: %s", fr_syserror(errno));
+			rcode = -1;
+			goto done;
+		}
+	}
+
+	start = bench_now();
+
+	for (i = 0; i < config->threads; i++) {
+		if (pthread_create(&threads[i].pthread_id, NULL, bench_thread, &threads[i]) != 0) {
+			fr_strerror_printf("Failed creating thread: %s", fr_syserror(errno));
+			rcode = -1;
+			break;
+		}
+		started++;
+	}
+
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i].pthread_id, NULL);
+		lost += threads[i].lost;
+	}
+
+	if (started && config->output) bench_print(config, threads, bench_now() - start);
+
+	if ((rcode == 0) && (lost > 0)) rcode = 1;
+
+done:
+	for (i = 0; i < config->threads; i++) {
+		if (threads[i].sockfd > 0) close(threads[i].sockfd);
+	}
+	talloc_free(threads);
+
+	return rcode;
+}
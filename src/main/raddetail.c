@@ -0,0 +1,459 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @brief Convert detail files between the text and binary formats.
+ * @file main/raddetail.c
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+static char const *raddetail_version = RADIUSD_VERSION_STRING_BUILD("raddetail");
+
+#undef DEBUG
+#define DEBUG(fmt, ...)		if (fr_debug_lvl > 0) fprintf(stderr, "raddetail (debug): " fmt "\n", ## __VA_ARGS__)
+#undef WARN
+#define WARN(fmt, ...)		fprintf(stderr, "raddetail (warning): " fmt "\n", ## __VA_ARGS__)
+#undef ERROR
+#define ERROR(fmt, ...)		fprintf(stderr, "raddetail (error): " fmt "\n", ## __VA_ARGS__)
+
+/** An entry read from a detail file
+ *
+ */
+typedef struct raddetail_entry {
+	VALUE_PAIR	*vps;			//!< Including Packet-Type, and the packet src/dst attributes.
+	fr_ipaddr_t	client_ipaddr;		//!< af is AF_UNSPEC if the entry didn't have one.
+	time_t		timestamp;		//!< When the packet was received.
+	bool		done;			//!< Entry has already been replayed.
+} raddetail_entry_t;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "Usage: raddetail [options] <input> [<output>]\n");
+
+	fprintf(stderr, "  <input>                Detail file to read, or '-' for stdin.\n");
+	fprintf(stderr, "  <output>               File to write, or '-' for stdout (the default).\n");
+	fprintf(stderr, "  -a                     Copy entries which have already been replayed.\n");
+	fprintf(stderr, "  -b                     Write binary records (the default).\n");
+	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -h                     Print usage help information.\n");
+	fprintf(stderr, "  -t                     Write text entries.\n");
+	fprintf(stderr, "  -v                     Show program version information.\n");
+	fprintf(stderr, "  -x                     Increase debug level.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "The input may contain text entries, binary records, or both.\n");
+	fprintf(stderr, "Corrupt binary records are skipped with a warning.\n");
+
+	exit(EXIT_SUCCESS);
+}
+
+/** Read a text entry
+ *
+ * @return
+ *	- 1 if an entry was read.
+ *	- 0 on EOF.
+ *	- -1 on error.
+ */
+static int read_text(TALLOC_CTX *ctx, FILE *fp, raddetail_entry_t *entry)
+{
+	char		buffer[2048];
+	char		key[256], op[8], value[1024];
+	bool		header = false;
+	VALUE_PAIR	*vp;
+	vp_cursor_t	cursor;
+
+	fr_pair_cursor_init(&cursor, &entry->vps);
+
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		if (!strchr(buffer, '\n') && !feof(fp)) {
+			ERROR("Line too long: %s", buffer);
+			return -1;
+		}
+
+		if (!header) {
+			int y;
+
+			if (sscanf(buffer, "%*s %*s %*d %*d:%*d:%*d %d", &y) == 1) header = true;
+			continue;
+		}
+
+		if (buffer[0] == '\n') return 1;
+
+		if (sscanf(buffer, "%255s %7s %1023s", key, op, value) != 3) {
+			WARN("Skipping badly formatted line %s", buffer);
+			continue;
+		}
+
+		if (!strcasecmp(key, "Request-Authenticator")) continue;
+
+		if (!strcasecmp(key, "Client-IP-Address")) {
+			if (fr_inet_hton(&entry->client_ipaddr, AF_INET, value, false) < 0) {
+				ERROR("Failed parsing Client-IP-Address: %s", fr_strerror());
+				return -1;
+			}
+			continue;
+		}
+
+		if (!strcasecmp(key, "Timestamp")) {
+			entry->timestamp = atoi(value);
+			continue;
+		}
+
+		if (!strcasecmp(key, "Donestamp")) {
+			entry->timestamp = atoi(value);
+			entry->done = true;
+			continue;
+		}
+
+		vp = NULL;
+		if ((fr_pair_list_afrom_str(ctx, buffer, &vp) > 0) && vp) {
+			fr_pair_cursor_merge(&cursor, vp);
+		} else {
+			WARN("Failed reading VP from line - %s", buffer);
+		}
+	}
+
+	if (ferror(fp)) {
+		ERROR("Failed reading input: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	The last entry doesn't need a blank line after it.
+	 */
+	return header ? 1 : 0;
+}
+
+/** Read a binary record
+ *
+ * @return
+ *	- 1 if an entry was read.
+ *	- 0 on EOF.
+ *	- -1 on error.
+ *	- -2 if the record was corrupt, and has been skipped.
+ */
+static int read_binary(TALLOC_CTX *ctx, FILE *fp, raddetail_entry_t *entry)
+{
+	detail_binary_hdr_t	hdr;
+	uint8_t			buffer[MAX_PACKET_LEN];
+	int			rcode;
+
+	rcode = detail_binary_read(fp, &hdr, buffer, sizeof(buffer));
+	if (rcode <= 0) return rcode;
+
+	entry->timestamp = ntohl(hdr.timestamp);
+	entry->done = ((hdr.flags & DETAIL_BINARY_FLAG_DONE) != 0);
+	detail_binary_ipaddr(&entry->client_ipaddr, hdr.client_af, hdr.client_ipaddr);
+
+	if (detail_binary_decode(ctx, &entry->vps, &hdr, buffer) < 0) return -2;
+
+	return 1;
+}
+
+/** Read an entry in either format
+ *
+ * @return the same values as #read_binary.
+ */
+static int read_entry(TALLOC_CTX *ctx, FILE *fp, raddetail_entry_t *entry)
+{
+	int c;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->client_ipaddr.af = AF_UNSPEC;
+
+	c = getc(fp);
+	if (c == EOF) return 0;
+	ungetc(c, fp);
+
+	if (c == (uint8_t) DETAIL_BINARY_MAGIC[0]) return read_binary(ctx, fp, entry);
+
+	return read_text(ctx, fp, entry);
+}
+
+/** Write an entry as text
+ *
+ */
+static int write_text(FILE *out, raddetail_entry_t *entry)
+{
+	VALUE_PAIR	*vp;
+	vp_cursor_t	cursor;
+	struct tm	tm;
+	char		buffer[INET6_ADDRSTRLEN];
+
+	localtime_r(&entry->timestamp, &tm);
+	strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Y", &tm);
+	fprintf(out, "%s\n", buffer);
+
+	for (vp = fr_pair_cursor_init(&cursor, &entry->vps);
+	     vp;
+	     vp = fr_pair_cursor_next(&cursor)) {
+		vp->op = T_OP_EQ;
+		fr_pair_fprint(out, vp);
+	}
+
+	if (entry->client_ipaddr.af != AF_UNSPEC) {
+		inet_ntop(entry->client_ipaddr.af, &entry->client_ipaddr.ipaddr, buffer, sizeof(buffer));
+		fprintf(out, "\tClient-IP-Address = %s\n", buffer);
+	}
+
+	if (fprintf(out, "\tTimestamp = %ld\n\n", (long) entry->timestamp) < 0) return -1;
+
+	return 0;
+}
+
+/** Write an entry as a binary record
+ *
+ */
+static int write_binary(TALLOC_CTX *ctx, FILE *out, raddetail_entry_t *entry)
+{
+	RADIUS_PACKET	*packet;
+	VALUE_PAIR	*vp;
+	uint8_t		*record;
+	ssize_t		len;
+	bool		srcdst = false;
+
+	packet = fr_radius_alloc(ctx, false);
+	if (!packet) return -1;
+
+	packet->code = PW_CODE_ACCOUNTING_REQUEST;
+	vp = fr_pair_find_by_num(entry->vps, 0, PW_PACKET_TYPE, TAG_ANY);
+	if (vp) packet->code = vp->vp_integer;
+
+	vp = fr_pair_find_by_num(entry->vps, 0, PW_PACKET_SRC_IP_ADDRESS, TAG_ANY);
+	if (vp) {
+		fr_ipaddr_t ipaddr = { .af = AF_INET, .prefix = 32, .ipaddr.ip4addr.s_addr = vp->vp_ipaddr };
+
+		packet->src_ipaddr = ipaddr;
+		srcdst = true;
+	} else {
+		vp = fr_pair_find_by_num(entry->vps, 0, PW_PACKET_SRC_IPV6_ADDRESS, TAG_ANY);
+		if (vp) {
+			packet->src_ipaddr.af = AF_INET6;
+			packet->src_ipaddr.prefix = 128;
+			memcpy(&packet->src_ipaddr.ipaddr.ip6addr, &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+			srcdst = true;
+		}
+	}
+
+	vp = fr_pair_find_by_num(entry->vps, 0, PW_PACKET_DST_IP_ADDRESS, TAG_ANY);
+	if (vp) {
+		fr_ipaddr_t ipaddr = { .af = AF_INET, .prefix = 32, .ipaddr.ip4addr.s_addr = vp->vp_ipaddr };
+
+		packet->dst_ipaddr = ipaddr;
+	} else {
+		vp = fr_pair_find_by_num(entry->vps, 0, PW_PACKET_DST_IPV6_ADDRESS, TAG_ANY);
+		if (vp) {
+			packet->dst_ipaddr.af = AF_INET6;
+			packet->dst_ipaddr.prefix = 128;
+			memcpy(&packet->dst_ipaddr.ipaddr.ip6addr, &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+		}
+	}
+
+	vp = fr_pair_find_by_num(entry->vps, 0, PW_PACKET_SRC_PORT, TAG_ANY);
+	if (vp) packet->src_port = vp->vp_integer;
+
+	vp = fr_pair_find_by_num(entry->vps, 0, PW_PACKET_DST_PORT, TAG_ANY);
+	if (vp) packet->dst_port = vp->vp_integer;
+
+	len = detail_binary_encode(ctx, &record, packet, entry->vps,
+				   (entry->client_ipaddr.af != AF_UNSPEC) ? &entry->client_ipaddr : NULL,
+				   entry->timestamp, srcdst);
+	talloc_free(packet);
+	if (len < 0) {
+		ERROR("Failed encoding record: %s", fr_strerror());
+		return -1;
+	}
+
+	if (fwrite(record, 1, len, out) < (size_t) len) {
+		talloc_free(record);
+		return -1;
+	}
+	talloc_free(record);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int		c;
+	char const	*radius_dir = RADDBDIR;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+	bool		binary = true;
+	bool		all = false;
+	FILE		*in, *out;
+	TALLOC_CTX	*ctx;
+	uint64_t	read_count = 0, written = 0, skipped = 0;
+	int		rcode;
+	int		ret = EXIT_SUCCESS;
+
+#ifndef NDEBUG
+	if (fr_fault_setup(getenv("PANIC_ACTION"), argv[0]) < 0) {
+		fr_perror("raddetail");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	talloc_set_log_stderr();
+
+	while ((c = getopt(argc, argv, "abd:D:htvx")) != EOF) switch (c) {
+		case 'a':
+			all = true;
+			break;
+
+		case 'b':
+			binary = true;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'd':
+			radius_dir = optarg;
+			break;
+
+		case 't':
+			binary = false;
+			break;
+
+		case 'v':
+			fprintf(stderr, "%s\n", raddetail_version);
+			exit(EXIT_SUCCESS);
+
+		case 'x':
+			fr_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= (optind - 1);
+	argv += (optind - 1);
+
+	if ((argc < 2) || (argc > 3)) {
+		ERROR("Insufficient arguments");
+		usage();
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("raddetail");
+		return EXIT_FAILURE;
+	}
+
+	if (fr_dict_from_file(NULL, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("raddetail");
+		return EXIT_FAILURE;
+	}
+
+	if (fr_dict_read(dict, radius_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("raddetail");
+		return EXIT_FAILURE;
+	}
+	fr_strerror();	/* Clear the error buffer */
+
+	if (strcmp(argv[1], "-") == 0) {
+		in = stdin;
+	} else {
+		in = fopen(argv[1], "r");
+		if (!in) {
+			ERROR("Failed opening %s: %s", argv[1], fr_syserror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((argc < 3) || (strcmp(argv[2], "-") == 0)) {
+		out = stdout;
+	} else {
+		out = fopen(argv[2], "w");
+		if (!out) {
+			ERROR("Failed opening %s: %s", argv[2], fr_syserror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	ctx = talloc_init("raddetail");
+
+	while (true) {
+		raddetail_entry_t entry;
+
+		rcode = read_entry(ctx, in, &entry);
+		if (rcode == 0) break;
+		if (rcode == -2) {
+			WARN("Skipping corrupt entry %" PRIu64 ": %s", read_count + 1, fr_strerror());
+			read_count++;
+			skipped++;
+			continue;
+		}
+		if (rcode < 0) {
+			ERROR("Failed reading entry %" PRIu64 ": %s", read_count + 1, fr_strerror());
+			ret = EXIT_FAILURE;
+			break;
+		}
+		read_count++;
+
+		if (entry.done && !all) {
+			DEBUG("Skipping entry %" PRIu64 " which has already been replayed", read_count);
+			goto next;
+		}
+
+		if (!entry.vps) {
+			WARN("Skipping empty entry %" PRIu64, read_count);
+			goto next;
+		}
+
+		rcode = binary ? write_binary(ctx, out, &entry) : write_text(out, &entry);
+		if (rcode < 0) {
+			ERROR("Failed writing entry %" PRIu64 ": %s", read_count, fr_syserror(errno));
+			ret = EXIT_FAILURE;
+			break;
+		}
+		written++;
+
+	next:
+		fr_pair_list_free(&entry.vps);
+	}
+
+	if (fflush(out) != 0) {
+		ERROR("Failed writing output: %s", fr_syserror(errno));
+		ret = EXIT_FAILURE;
+	}
+
+	DEBUG("Read %" PRIu64 " entries, wrote %" PRIu64 ", skipped %" PRIu64 " corrupt",
+	      read_count, written, skipped);
+
+	if (in != stdin) fclose(in);
+	if (out != stdout) fclose(out);
+	talloc_free(ctx);
+	talloc_free(dict);
+
+	return ret;
+}
@@ -1,7 +1,6 @@
 TARGET	:= radiusd
 SOURCES := acct.c \
     auth.c \
-    conduit.c \
     client.c \
     crypt.c \
     files.c \
@@ -128,6 +128,14 @@ main_config_t main_config;
 static bool echo = false;
 static char const *secret = "testing123";
 static bool unbuffered = false;
+
+/*
+ *	Commands waiting to be sent as a batch, one per line.
+ */
+static char batch_buffer[FR_CONDUIT_MAX_PAYLOAD];
+static size_t batch_len = 0;
+
+#define BATCH_REPLY_SIZE (1024 * 1024)
 static fr_log_t radmin_log = {
 	.dst = L_DST_NULL,
 	.colourise = false,
@@ -148,6 +156,7 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "  -f socket_file  Open socket_file directly, without reading radius.conf\n");
 	fprintf(output, "  -h              Print usage help information.\n");
 	fprintf(output, "  -i input_file   Read commands from 'input_file'.\n");
+	fprintf(output, "  -j              Send commands in batches, and print results as JSON lines.\n");
 	fprintf(output, "  -l <log_file>   Commands which are executed will be written to this file.\n");
 	fprintf(output, "  -n name         Read raddb/name.conf instead of raddb/radiusd.conf\n");
 	fprintf(output, "  -q              Reduce output verbosity\n");
@@ -298,6 +307,183 @@ static ssize_t run_command(int sockfd, char const *command,
 	return flush_conduits(sockfd, buffer, bufsize);
 }
 
+/*
+ *	Print a string as a JSON string.
+ */
+static void json_print_string(FILE *fp, char const *in, size_t inlen)
+{
+	char const *p, *end = in + inlen;
+
+	fputc('"', fp);
+
+	for (p = in; p < end; p++) {
+		switch (*p) {
+		case '"':
+			fputs("\\\"", fp);
+			break;
+
+		case '\\':
+			fputs("\\\\", fp);
+			break;
+
+		case '\n':
+			fputs("\\n", fp);
+			break;
+
+		case '\r':
+			fputs("\\r", fp);
+			break;
+
+		case '\t':
+			fputs("\\t", fp);
+			break;
+
+		default:
+			if ((uint8_t) *p < 0x20) {
+				fprintf(fp, "\\u%04x", (uint8_t) *p);
+				break;
+			}
+			fputc(*p, fp);
+			break;
+		}
+	}
+
+	fputc('"', fp);
+}
+
+/*
+ *	Send the batched commands, and print the result of each one as
+ *	a line of JSON.
+ *
+ *	Returns -1 on failure.  FR_CONDUIT_SUCCESS if all of the
+ *	commands succeeded, FR_CONDUIT_FAIL otherwise.
+ */
+static ssize_t flush_batch(int sockfd, char *buffer, size_t bufsize)
+{
+	ssize_t				r;
+	ssize_t				rcode = FR_CONDUIT_SUCCESS;
+	fr_conduit_type_t		conduit;
+	char const			*command, *next, *end;
+	char const			*out, *err;
+	size_t				out_len, err_len;
+	uint32_t			status;
+
+	if (!batch_len) return FR_CONDUIT_SUCCESS;
+
+	r = fr_conduit_write(sockfd, FR_CONDUIT_BATCH, batch_buffer, batch_len);
+	if (r <= 0) return -1;
+
+	command = batch_buffer;
+	end = batch_buffer + batch_len;
+	batch_len = 0;
+
+	while (true) {
+		r = fr_conduit_read(sockfd, &conduit, buffer, bufsize);
+		if (r <= 0) return -1;
+
+		switch (conduit) {
+		case FR_CONDUIT_BATCH_RESULT:
+			/*
+			 *	Results larger than the buffer are truncated.
+			 */
+			if (fr_conduit_batch_result_parse(&status, &out, &out_len, &err, &err_len, buffer, r) < 0) {
+				return -1;
+			}
+
+			if (command >= end) {
+				fprintf(stderr, "%s: Server sent more results than there were commands\n", progname);
+				return -1;
+			}
+
+			next = memchr(command, '\n', end - command);
+			if (!next) next = end;
+
+			fputs("{\"command\":", stdout);
+			json_print_string(stdout, command, next - command);
+			fprintf(stdout, ",\"status\":\"%s\",\"output\":",
+				(status == FR_CONDUIT_SUCCESS) ? "ok" : "fail");
+			json_print_string(stdout, out, out_len);
+			fputs(",\"error\":", stdout);
+			json_print_string(stdout, err, err_len);
+			fputs("}\n", stdout);
+
+			if (status != FR_CONDUIT_SUCCESS) rcode = FR_CONDUIT_FAIL;
+
+			command = next + 1;
+			break;
+
+		case FR_CONDUIT_CMD_STATUS:
+			if (command < end) {
+				fprintf(stderr, "%s: Server did not return results for all commands.  "
+					"Does it support batches?\n", progname);
+				return -1;
+			}
+			fflush(stdout);
+			return rcode;
+
+		/*
+		 *	Debug output, or changes to buffering,
+		 *	which aren't part of the results.
+		 */
+		case FR_CONDUIT_STDOUT:
+		case FR_CONDUIT_STDERR:
+		case FR_CONDUIT_NOTIFY:
+			break;
+
+		default:
+			fprintf(stderr, "Unexpected response %02x\n", conduit);
+			return -1;
+		}
+	}
+
+	/* never gets here */
+}
+
+/*
+ *	Add a command to the batch, sending the batch first if there's
+ *	no room left in it.
+ *
+ *	Returns -1 on failure.  FR_CONDUIT_SUCCESS if all of the
+ *	commands sent so far succeeded, FR_CONDUIT_FAIL otherwise.
+ */
+static ssize_t batch_command(int sockfd, char const *command, char *buffer, size_t bufsize)
+{
+	size_t len = strlen(command);
+	ssize_t rcode = FR_CONDUIT_SUCCESS;
+
+	/*
+	 *	The server skips blank lines, so they mustn't be
+	 *	counted as commands here.  And each command must be
+	 *	exactly one line of the batch.
+	 */
+	if (!fr_conduit_batch_is_command(command, len)) return FR_CONDUIT_SUCCESS;
+
+	if (memchr(command, '\n', len)) {
+		fprintf(stderr, "%s: Commands in a batch can't contain newlines\n", progname);
+		return -1;
+	}
+
+	if ((len + 1) > sizeof(batch_buffer)) {
+		fprintf(stderr, "%s: Command too long\n", progname);
+		return -1;
+	}
+
+	if (radmin_log.dst == L_DST_FILES) {
+		fr_log(&radmin_log, L_INFO, "%s", command);
+	}
+
+	if ((batch_len + len + 1) > sizeof(batch_buffer)) {
+		rcode = flush_batch(sockfd, buffer, bufsize);
+		if (rcode < 0) return rcode;
+	}
+
+	memcpy(batch_buffer + batch_len, command, len);
+	batch_len += len;
+	batch_buffer[batch_len++] = '\n';
+
+	return rcode;
+}
+
 static int do_connect(int *out, char const *file, char const *server)
 {
 	int sockfd;
@@ -390,6 +576,7 @@ int main(int argc, char **argv)
 {
 	int		argval;
 	bool		quiet = false;
+	bool		json = false;
 	int		sockfd = -1;
 	char		*line = NULL;
 	ssize_t		len;
@@ -426,7 +613,7 @@ int main(int argc, char **argv)
 
 	rad_debug_lvl = L_DBG_LVL_1;
 
-	while ((argval = getopt(argc, argv, "d:D:hi:e:Ef:n:qs:Sx")) != EOF) {
+	while ((argval = getopt(argc, argv, "d:D:hi:e:Ef:jn:qs:Sx")) != EOF) {
 		switch (argval) {
 		case 'd':
 			if (file) {
@@ -475,6 +662,10 @@ int main(int argc, char **argv)
 			quiet = true;
 			break;
 
+		case 'j':
+			json = true;
+			break;
+
 		case 'l':
 			radmin_log.file = optarg;
 			break;
@@ -697,6 +888,66 @@ int main(int argc, char **argv)
 
 	if (do_connect(&sockfd, file, server) < 0) exit(1);
 
+	/*
+	 *	Send commands in batches, instead of one at a time,
+	 *	and print machine readable results.
+	 */
+	if (json) {
+		char *reply;
+
+		if (server && !secret) {
+			fprintf(stderr, "%s: A secret is required for batches\n", progname);
+			exit(1);
+		}
+
+		reply = talloc_array(NULL, char, BATCH_REPLY_SIZE);
+		if (!reply) exit(1);
+
+		if (num_commands >= 0) {
+			int i;
+
+			for (i = 0; i <= num_commands; i++) {
+				len = batch_command(sockfd, commands[i], reply, BATCH_REPLY_SIZE);
+				if (len < 0) exit(1);
+
+				if (len == FR_CONDUIT_FAIL) exit_status = EXIT_FAILURE;
+			}
+
+		} else while (fgets(buffer, sizeof(buffer), inputfp)) {
+			p = strchr(buffer, '\n');
+			if (!p) {
+				fprintf(stderr, "%s: Input line too long\n", progname);
+				exit(1);
+			}
+			*p = '\0';
+
+			for (line = buffer; (*line == ' ') || (*line == '\t'); line++);
+			if (!*line || (*line == '#')) continue;
+
+			for (p = line; *p != '\0'; p++) {
+				if (*p == '\r') {
+					*p = '\0';
+					break;
+				}
+			}
+
+			len = batch_command(sockfd, line, reply, BATCH_REPLY_SIZE);
+			if (len < 0) exit(1);
+
+			if (len == FR_CONDUIT_FAIL) exit_status = EXIT_FAILURE;
+		}
+
+		len = flush_batch(sockfd, reply, BATCH_REPLY_SIZE);
+		if (len < 0) exit(1);
+
+		if (len == FR_CONDUIT_FAIL) exit_status = EXIT_FAILURE;
+
+		talloc_free(reply);
+		if (inputfp != stdin) fclose(inputfp);
+
+		exit(exit_status);
+	}
+
 	/*
 	 *	Run commans from the command-line.
 	 */
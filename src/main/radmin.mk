@@ -4,7 +4,7 @@ ifneq "$(LIBREADLINE)" ""
 TARGET		:= $(TARGETNAME)
 endif
 
-SOURCES		:= radmin.c conduit.c
+SOURCES		:= radmin.c
 
 TGT_INSTALLDIR  := ${sbindir}
 TGT_PREREQS	:= libfreeradius-server.a libfreeradius-util.a
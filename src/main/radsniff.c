@@ -29,6 +29,7 @@ RCSID("$Id$")
 #define _LIBRADIUS 1
 #include <time.h>
 #include <math.h>
+#include <sys/resource.h>
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/event.h>
 
@@ -45,12 +46,22 @@ RCSID("$Id$")
 
 static rs_t *conf;
 static struct timeval start_pcap = {0, 0};
-static char timestr[50];
+static uint64_t count_in = 0;			//!< Packets read from the pcap handles.
 
-static rbtree_t *request_tree = NULL;
-static rbtree_t *link_tree = NULL;
-static fr_event_list_t *events;
-static bool cleanup;
+/*
+ *	With matcher threads, each thread has its own request tree,
+ *	event list and memory, so these are per-thread.
+ */
+static _Thread_local char timestr[50];
+
+static _Thread_local TALLOC_CTX *packet_ctx;	//!< For requests and packets.
+static _Thread_local rbtree_t *request_tree = NULL;
+static _Thread_local rbtree_t *link_tree = NULL;
+static _Thread_local fr_event_list_t *events;
+static _Thread_local bool cleanup;
+
+static atomic_bool workers_stop;		//!< Tell the matcher threads to exit once their queue is empty.
+static atomic_uint_fast64_t captured;		//!< RADIUS packets processed, for the capture limit.
 
 static int self_pipe[2] = {-1, -1};		//!< Signals from sig handlers
 
@@ -86,6 +97,7 @@ static const FR_NAME_NUMBER rs_events[] = {
 };
 
 static void NEVER_RETURNS usage(int status);
+static void rs_signal_self(int sig);
 
 /** Fork and kill the parent process, writing out our PID
  *
@@ -783,6 +795,140 @@ static void rs_stats_print_csv(rs_update_t *this, rs_stats_t *stats, UNUSED stru
 	fprintf(stdout , "%s\n", buffer);
 }
 
+/** Queue a packet or marker for a matcher thread
+ *
+ * @param[in] worker to queue the packet for.
+ * @param[in] work to queue.
+ * @param[in] wait for space in the queue if it's full.
+ * @return
+ *	- true if the packet was queued.
+ *	- false if the queue was full.
+ */
+static bool rs_worker_push(rs_worker_t *worker, rs_work_t *work, bool wait)
+{
+	while (!fr_atomic_queue_push(worker->queue, work)) {
+		if (!wait) return false;
+		usleep(10);
+	}
+
+	/*
+	 *	Pairs with the fence in rs_worker_pop(), so either
+	 *	the worker sees the work, or we see it's idle.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&worker->idle, memory_order_relaxed)) {
+		pthread_mutex_lock(&worker->mutex);
+		pthread_cond_signal(&worker->work_cond);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	return true;
+}
+
+/** Add the interval stats from a matcher thread to the totals
+ *
+ */
+static void rs_stats_merge_latency(rs_latency_t *out, rs_latency_t const *in)
+{
+	int i;
+
+	out->interval.received_total += in->interval.received_total;
+	out->interval.linked_total += in->interval.linked_total;
+	out->interval.unlinked_total += in->interval.unlinked_total;
+	out->interval.reused_total += in->interval.reused_total;
+	out->interval.lost_total += in->interval.lost_total;
+
+	for (i = 0; i <= RS_RETRANSMIT_MAX; i++) out->interval.rt_total[i] += in->interval.rt_total[i];
+
+	out->interval.latency_total += in->interval.latency_total;
+	if (in->interval.latency_high > out->interval.latency_high) {
+		out->interval.latency_high = in->interval.latency_high;
+	}
+	if (in->interval.latency_low &&
+	    (!out->interval.latency_low || (in->interval.latency_low < out->interval.latency_low))) {
+		out->interval.latency_low = in->interval.latency_low;
+	}
+}
+
+/** Collect the stats for an interval from the matcher threads
+ *
+ * Each matcher thread is sent a marker.  When it reaches the marker, it has processed
+ * every packet captured before the end of the interval, and adds its interval stats
+ * to a snapshot, which we collect.
+ *
+ * When reading files we wait for every thread to reach the marker, so the results are
+ * the same as with a single thread.  When capturing live we only wait for
+ * #RS_WORKER_STATS_WAIT milliseconds.  The stats of threads which are behind are
+ * included in the next interval.
+ */
+static void rs_stats_merge(rs_stats_t *stats, struct timeval *now)
+{
+	static uint64_t	marker = 0;
+	size_t		rs_codes_len = (sizeof(rs_useful_codes) / sizeof(*rs_useful_codes));
+	size_t		j;
+	int		i;
+	struct timeval	when;
+	struct timespec	deadline;
+
+	marker++;
+
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_work_t *work;
+
+		work = calloc(1, sizeof(*work));
+		if (!work) {
+			ERROR("Failed allocating stats marker");
+			return;
+		}
+		work->marker = marker;
+		work->header.ts = *now;
+
+		rs_worker_push(&conf->workers[i], work, true);
+	}
+
+	gettimeofday(&when, NULL);
+	deadline.tv_sec = when.tv_sec + (RS_WORKER_STATS_WAIT / 1000);
+	deadline.tv_nsec = (when.tv_usec + ((RS_WORKER_STATS_WAIT % 1000) * 1000)) * 1000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_nsec -= 1000000000;
+		deadline.tv_sec++;
+	}
+
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_worker_t *worker = &conf->workers[i];
+
+		pthread_mutex_lock(&worker->mutex);
+		while (worker->snapshot_marker < marker) {
+			if (!conf->from_dev) {
+				pthread_cond_wait(&worker->snapshot_cond, &worker->mutex);
+				continue;
+			}
+
+			if (pthread_cond_timedwait(&worker->snapshot_cond, &worker->mutex, &deadline) != 0) {
+				DEBUG("Worker %i is behind, its stats will be included in the next interval", i);
+				break;
+			}
+		}
+
+		for (j = 0; j < rs_codes_len; j++) {
+			rs_latency_t *snapshot = &worker->snapshot.exchange[rs_useful_codes[j]];
+
+			rs_stats_merge_latency(&stats->exchange[rs_useful_codes[j]], snapshot);
+			memset(&snapshot->interval, 0, sizeof(snapshot->interval));
+		}
+
+		if (timercmp(&worker->snapshot.quiet, &stats->quiet, >)) stats->quiet = worker->snapshot.quiet;
+		pthread_mutex_unlock(&worker->mutex);
+
+		if (worker->dropped != worker->dropped_reported) {
+			ERROR("Worker %i dropped %" PRIu64 " packets: Queue full", i,
+			      worker->dropped - worker->dropped_reported);
+			worker->dropped_reported = worker->dropped;
+			rs_tv_add_ms(now, conf->stats.timeout, &stats->quiet);
+		}
+	}
+}
+
 /** Process stats for a single interval
  *
  */
@@ -799,6 +945,8 @@ static void rs_stats_process(struct timeval *now, void *ctx)
 		this->done_header = true;
 	}
 
+	if (conf->num_workers) rs_stats_merge(stats, now);
+
 	stats->intervals++;
 
 	for (in_p = this->in;
@@ -1173,6 +1321,25 @@ static inline int rs_request_to_pcap(rs_event_t *event, rs_request_t *request, s
 		_x = NULL;\
 	} while (0)
 
+/** Stop library functions logging while we decode packets
+ *
+ * fr_log_fp is shared by all threads, and matcher threads may be logging, so it's
+ * only muted when there's a single thread.
+ */
+static inline FILE *rs_log_mute(void)
+{
+	FILE *log_fp = fr_log_fp;
+
+	if (!conf->num_workers) fr_log_fp = NULL;
+
+	return log_fp;
+}
+
+static inline void rs_log_unmute(FILE *log_fp)
+{
+	if (!conf->num_workers) fr_log_fp = log_fp;
+}
+
 static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkthdr const *header, uint8_t const *data)
 {
 	rs_stats_t		*stats = event->stats;
@@ -1192,7 +1359,6 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	bool			response;		/* Was it a response code */
 
 	decode_fail_t		reason;			/* Why we failed decoding the packet */
-	static uint64_t		captured = 0;
 
 	rs_status_t		status = RS_NORMAL;	/* Any special conditions (RTX, Unlinked, ID-Reused) */
 	RADIUS_PACKET		*current;		/* Current packet were processing */
@@ -1297,7 +1463,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	 *	recover once some requests timeout, so make an effort to deal
 	 *	with allocation failures gracefully.
 	 */
-	current = fr_radius_alloc(conf, false);
+	current = fr_radius_alloc(packet_ctx, false);
 	if (!current) {
 		REDEBUG("Failed allocating memory to hold decoded packet");
 		rs_tv_add_ms(&header->ts, conf->stats.timeout, &stats->quiet);
@@ -1372,11 +1538,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 
 		if (conf->verify_radius_authenticator && original) {
 			int ret;
-			FILE *log_fp = fr_log_fp;
+			FILE *log_fp = rs_log_mute();
 
-			fr_log_fp = NULL;
 			ret = fr_radius_verify(current, original->expect, conf->radius_secret);
-			fr_log_fp = log_fp;
+			rs_log_unmute(log_fp);
 			if (ret != 0) {
 				REDEBUG("Failed verifying packet ID %d", current->id);
 				fr_radius_free(&current);
@@ -1390,11 +1555,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 */
 		if (conf->decode_attrs) {
 			int ret;
-			FILE *log_fp = fr_log_fp;
+			FILE *log_fp = rs_log_mute();
 
-			fr_log_fp = NULL;
 			ret = fr_radius_decode(current, original ? original->expect : NULL, conf->radius_secret);
-			fr_log_fp = log_fp;
+			rs_log_unmute(log_fp);
 			if (ret != 0) {
 				fr_radius_free(&current);
 				REDEBUG("Failed decoding");
@@ -1496,11 +1660,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 */
 		if (conf->decode_attrs) {
 			int ret;
-			FILE *log_fp = fr_log_fp;
+			FILE *log_fp = rs_log_mute();
 
-			fr_log_fp = NULL;
 			ret = fr_radius_decode(current, NULL, conf->radius_secret);
-			fr_log_fp = log_fp;
+			rs_log_unmute(log_fp);
 
 			if (ret != 0) {
 				fr_radius_free(&current);
@@ -1613,7 +1776,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	...nope it's a new request.
 		 */
 		} else {
-			original = talloc_zero(conf, rs_request_t);
+			original = talloc_zero(packet_ctx, rs_request_t);
 			talloc_set_destructor(original, _request_free);
 
 			original->id = count;
@@ -1749,19 +1912,240 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		fr_radius_free(&current);
 	}
 
-	captured++;
 	/*
-	 *	We've hit our capture limit, break out of the event loop
+	 *	We've hit our capture limit, break out of the event loop.
+	 *	Matcher threads can't exit the capture thread's event loop,
+	 *	so they wake it as if it had been signalled.  When reading
+	 *	files, it checks the limit before dispatching each packet.
 	 */
-	if ((conf->limit > 0) && (captured >= conf->limit)) {
-		INFO("Captured %" PRIu64 " packets, exiting...", captured);
+	if ((conf->limit > 0) && ((atomic_fetch_add(&captured, 1) + 1) == conf->limit)) {
+		INFO("Captured %" PRIu64 " packets, exiting...", conf->limit);
+		if (!conf->num_workers) {
+			fr_event_loop_exit(events, 1);
+		} else if (self_pipe[1] >= 0) {
+			rs_signal_self(SIGTERM);
+		}
+	}
+}
+
+/** Pick the matcher thread for a packet
+ *
+ * The hashes of the source and destination address and port are combined so that a
+ * request and its response go to the same thread.  Packets we can't parse go to the
+ * first thread, which will complain about them.
+ */
+static int rs_packet_worker(fr_pcap_t *in, struct pcap_pkthdr const *header, uint8_t const *data)
+{
+	uint8_t const		*p = data;
+	uint8_t const		*src_addr, *dst_addr;
+	size_t			addr_len;
+	ssize_t			len;
+	udp_header_t const	*udp;
+	uint32_t		src, dst;
+
+	len = fr_link_layer_offset(data, header->caplen, in->link_layer);
+	if ((len < 0) || ((size_t) len >= header->caplen)) return 0;
+	p += len;
+
+	switch ((p[0] & 0xf0) >> 4) {
+	case 4:
+	{
+		ip_header_t const *ip = (ip_header_t const *)p;
+
+		if (((p - data) + sizeof(*ip)) > header->caplen) return 0;
+
+		src_addr = (uint8_t const *) &ip->ip_src;
+		dst_addr = (uint8_t const *) &ip->ip_dst;
+		addr_len = sizeof(ip->ip_src);
+		p += (0x0f & ip->ip_vhl) * 4;
+	}
+		break;
+
+	case 6:
+	{
+		ip_header6_t const *ip6 = (ip_header6_t const *)p;
+
+		if (((p - data) + sizeof(*ip6)) > header->caplen) return 0;
+
+		src_addr = (uint8_t const *) &ip6->ip_src;
+		dst_addr = (uint8_t const *) &ip6->ip_dst;
+		addr_len = sizeof(ip6->ip_src);
+		p += sizeof(*ip6);
+	}
+		break;
+
+	default:
+		return 0;
+	}
+
+	if (((p - data) + sizeof(udp_header_t) + sizeof(radius_packet_t)) > header->caplen) return 0;
+	udp = (udp_header_t const *)p;
+
+	src = fr_hash_update(&udp->src, sizeof(udp->src), fr_hash(src_addr, addr_len));
+	dst = fr_hash_update(&udp->dst, sizeof(udp->dst), fr_hash(dst_addr, addr_len));
+
+	/*
+	 *	...and the RADIUS ID.
+	 */
+	return fr_hash_update(p + sizeof(udp_header_t) + 1, 1, src ^ dst) % conf->num_workers;
+}
+
+/** Copy a packet to the queue of a matcher thread
+ *
+ */
+static void rs_packet_dispatch(uint64_t count, fr_pcap_t *in, struct pcap_pkthdr const *header,
+			       uint8_t const *data)
+{
+	rs_worker_t	*worker;
+	rs_work_t	*work;
+
+	if ((conf->limit > 0) && (atomic_load(&captured) >= conf->limit)) {
 		fr_event_loop_exit(events, 1);
+		return;
+	}
+
+	if (!start_pcap.tv_sec) start_pcap = header->ts;
+
+	worker = &conf->workers[rs_packet_worker(in, header, data)];
+
+	work = malloc(sizeof(*work) + header->caplen);
+	if (!work) {
+		worker->dropped++;
+		return;
+	}
+	work->count = count;
+	work->marker = 0;
+	work->in = in;
+	work->header = *header;
+	memcpy(work->data, data, header->caplen);
+
+	/*
+	 *	When reading from files, wait for the thread to catch
+	 *	up, so we get the same results as with a single thread.
+	 */
+	if (!rs_worker_push(worker, work, (in->type != PCAP_INTERFACE_IN))) {
+		free(work);
+		worker->dropped++;
+	}
+}
+
+/** Wait for a packet or marker to be queued for this thread
+ *
+ * For live captures, requests expire in real time, so we wake up to run timer events.
+ *
+ * @param[in] worker to wait for work for.
+ * @return
+ *	- The next packet or marker.
+ *	- NULL if the thread should exit.
+ */
+static rs_work_t *rs_worker_pop(rs_worker_t *worker)
+{
+	void		*data;
+	struct timeval	when;
+	struct timespec	ts;
+
+	for (;;) {
+		if (fr_atomic_queue_pop(worker->queue, &data)) return data;
+
+		if (atomic_load(&workers_stop)) return NULL;
+
+		timerclear(&when);
+		if (conf->from_dev) {
+			gettimeofday(&when, NULL);
+			while (fr_event_timer_run(events, &when) == 1);	/* Leaves when set to the next timer */
+		}
+
+		pthread_mutex_lock(&worker->mutex);
+		atomic_store_explicit(&worker->idle, true, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		if (fr_atomic_queue_pop(worker->queue, &data)) {
+			atomic_store_explicit(&worker->idle, false, memory_order_relaxed);
+			pthread_mutex_unlock(&worker->mutex);
+			return data;
+		}
+
+		if (!atomic_load(&workers_stop)) {
+			if (timerisset(&when)) {
+				ts.tv_sec = when.tv_sec;
+				ts.tv_nsec = when.tv_usec * 1000;
+				(void) pthread_cond_timedwait(&worker->work_cond, &worker->mutex, &ts);
+			} else {
+				pthread_cond_wait(&worker->work_cond, &worker->mutex);
+			}
+		}
+
+		atomic_store_explicit(&worker->idle, false, memory_order_relaxed);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+}
+
+/** Match requests and responses for the packets assigned to this thread
+ *
+ */
+static void *rs_worker_thread(void *arg)
+{
+	rs_worker_t	*worker = arg;
+	rs_work_t	*work;
+	struct timeval	now;
+	size_t		rs_codes_len = (sizeof(rs_useful_codes) / sizeof(*rs_useful_codes));
+	size_t		i;
+
+	packet_ctx = worker->ctx;
+	events = worker->list;
+	request_tree = worker->request_tree;
+
+	while ((work = rs_worker_pop(worker))) {
+		/*
+		 *	Expire any requests which timed out before this
+		 *	packet was captured.
+		 */
+		now = work->header.ts;
+		while (fr_event_timer_run(events, &now) == 1);
+
+		if (work->marker) {
+			pthread_mutex_lock(&worker->mutex);
+			for (i = 0; i < rs_codes_len; i++) {
+				rs_latency_t *stats = &worker->stats.exchange[rs_useful_codes[i]];
+
+				rs_stats_merge_latency(&worker->snapshot.exchange[rs_useful_codes[i]], stats);
+				memset(&stats->interval, 0, sizeof(stats->interval));
+			}
+			worker->snapshot.quiet = worker->stats.quiet;
+			worker->snapshot_marker = work->marker;
+			pthread_cond_signal(&worker->snapshot_cond);
+			pthread_mutex_unlock(&worker->mutex);
+
+			free(work);
+			continue;
+		}
+
+		/*
+		 *	Other threads have reached the capture limit.
+		 */
+		if ((conf->limit > 0) && (atomic_load(&captured) >= conf->limit)) {
+			free(work);
+			continue;
+		}
+
+		worker->event.in = work->in;
+		rs_packet_process(work->count, &worker->event, &work->header, work->data);
+		worker->processed++;
+
+		free(work);
 	}
+
+	/*
+	 *	Don't count the requests we're still tracking as lost.
+	 */
+	cleanup = true;
+	TALLOC_FREE(worker->ctx);
+
+	return NULL;
 }
 
 static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 {
-	static uint64_t	count = 0;	/* Packets seen */
 	rs_event_t	*event = ctx;
 	pcap_t		*handle = event->in->handle;
 
@@ -1812,9 +2196,13 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 			do {
 				now = header->ts;
 			} while (fr_event_timer_run(el, &now) == 1);
-			count++;
+			count_in++;
 
-			rs_packet_process(count, event, header, data);
+			if (conf->num_workers) {
+				rs_packet_dispatch(count_in, event->in, header, data);
+			} else {
+				rs_packet_process(count_in, event, header, data);
+			}
 			total++;
 		}
 		return;
@@ -1835,8 +2223,12 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 			return;
 		}
 
-		count++;
-		rs_packet_process(count, event, header, data);
+		count_in++;
+		if (conf->num_workers) {
+			rs_packet_dispatch(count_in, event->in, header, data);
+		} else {
+			rs_packet_process(count_in, event, header, data);
+		}
 	}
 }
 
@@ -1996,6 +2388,138 @@ static void _unmark_link(void *request)
 	this->in_link_tree = false;
 }
 
+/** Start the matcher threads
+ *
+ */
+static int rs_workers_start(void)
+{
+	sigset_t	sigmask, old;
+	int		i;
+
+	conf->workers = talloc_zero_array(conf, rs_worker_t, conf->num_workers);
+	if (!conf->workers) {
+		ERROR("Failed allocating matcher threads");
+		return -1;
+	}
+
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_worker_t *worker = &conf->workers[i];
+
+		worker->id = i;
+		atomic_init(&worker->idle, false);
+		pthread_mutex_init(&worker->mutex, NULL);
+		pthread_cond_init(&worker->work_cond, NULL);
+		pthread_cond_init(&worker->snapshot_cond, NULL);
+
+		/*
+		 *	Not parented by conf, as talloc isn't thread-safe.
+		 */
+		worker->ctx = talloc_init("rs_worker");
+		if (!worker->ctx) {
+		oom:
+			ERROR("Failed allocating matcher thread");
+			return -1;
+		}
+
+		worker->queue = fr_atomic_queue_create(conf->workers, RS_WORKER_QUEUE_SIZE);
+		if (!worker->queue) goto oom;
+
+		worker->list = fr_event_list_create(worker->ctx, NULL, NULL);
+		if (!worker->list) goto oom;
+
+		worker->request_tree = rbtree_create(worker->ctx, (rbcmp) rs_packet_cmp, _unmark_request, 0);
+		if (!worker->request_tree) goto oom;
+
+		worker->event.list = worker->list;
+		worker->event.stats = &worker->stats;
+	}
+
+	/*
+	 *	Signals are handled by the main thread.
+	 */
+	sigfillset(&sigmask);
+	pthread_sigmask(SIG_BLOCK, &sigmask, &old);
+
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_worker_t *worker = &conf->workers[i];
+
+		if (pthread_create(&worker->pthread_id, NULL, rs_worker_thread, worker) != 0) {
+			ERROR("Failed creating matcher thread: %s", fr_syserror(errno));
+			pthread_sigmask(SIG_SETMASK, &old, NULL);
+			return -1;
+		}
+		worker->running = true;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	DEBUG("Matching packets with %i threads", conf->num_workers);
+
+	return 0;
+}
+
+/** Wait for the matcher threads to process their queues, and exit
+ *
+ */
+static void rs_workers_stop(void)
+{
+	int i;
+
+	if (!conf->workers) return;
+
+	atomic_store(&workers_stop, true);
+
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_worker_t *worker = &conf->workers[i];
+
+		pthread_mutex_lock(&worker->mutex);
+		pthread_cond_signal(&worker->work_cond);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_worker_t *worker = &conf->workers[i];
+
+		if (!worker->running) {
+			TALLOC_FREE(worker->ctx);
+			continue;
+		}
+
+		pthread_join(worker->pthread_id, NULL);
+		worker->running = false;
+	}
+}
+
+/** Print how quickly the capture files were processed
+ *
+ */
+static void rs_benchmark_print(struct timeval const *start, struct rusage const *start_usage)
+{
+	struct timeval	now, elapsed;
+	struct rusage	usage;
+	double		secs, cpu;
+	int		i;
+
+	gettimeofday(&now, NULL);
+	getrusage(RUSAGE_SELF, &usage);
+
+	fr_timeval_subtract(&elapsed, &now, start);
+	secs = elapsed.tv_sec + (elapsed.tv_usec / 1000000.0);
+	if (secs <= 0) secs = 0.000001;
+
+	cpu = (usage.ru_utime.tv_sec - start_usage->ru_utime.tv_sec) +
+	      ((usage.ru_utime.tv_usec - start_usage->ru_utime.tv_usec) / 1000000.0) +
+	      (usage.ru_stime.tv_sec - start_usage->ru_stime.tv_sec) +
+	      ((usage.ru_stime.tv_usec - start_usage->ru_stime.tv_usec) / 1000000.0);
+
+	fprintf(stdout, "Processed %" PRIu64 " packets in %.3lfs (%.0lf packets/s), CPU time %.3lfs\n",
+		count_in, secs, count_in / secs, cpu);
+
+	for (i = 0; i < conf->num_workers; i++) {
+		fprintf(stdout, "\tWorker %i : %" PRIu64 " packets\n", i, conf->workers[i].processed);
+	}
+}
+
 #ifdef HAVE_COLLECTDC_H
 /** Re-open the collectd socket
  *
@@ -2090,7 +2614,9 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "Usage: radsniff [options][stats options] -- [pcap files]\n");
 	fprintf(output, "options:\n");
 	fprintf(output, "  -a                    List all interfaces available for capture.\n");
-	fprintf(output, "  -c <count>            Number of packets to capture.\n");
+	fprintf(output, "  -B                    Print how quickly the packets in the pcap files were processed.\n");
+	fprintf(output, "  -c <count>            Number of RADIUS packets to capture.  With -j, up to\n");
+	fprintf(output, "                        <threads> - 1 more may be processed.\n");
 	fprintf(output, "  -C                    Enable UDP checksum validation.\n");
 	fprintf(output, "  -d <raddb>            Set configuration directory (defaults to " RADDBDIR ").\n");
 	fprintf(output, "  -D <dictdir>          Set main dictionary directory (defaults to " DICTDIR ").\n");
@@ -2106,6 +2632,7 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "  -h                    This help message.\n");
 	fprintf(output, "  -i <interface>        Capture packets from interface (defaults to all if supported).\n");
 	fprintf(output, "  -I <file>             Read packets from <file>\n");
+	fprintf(output, "  -j <threads>          Match requests and responses using <threads> threads.\n");
 	fprintf(output, "  -l <attr>[,<attr>]    Output packet sig and a list of attributes.\n");
 	fprintf(output, "  -L <attr>[,<attr>]    Detect retransmissions using these attributes to link requests.\n");
 	fprintf(output, "  -m                    Don't put interface(s) into promiscuous mode.\n");
@@ -2170,6 +2697,7 @@ int main(int argc, char *argv[])
 	RS_ASSERT(conf);
 
 	stats = talloc_zero(conf, rs_stats_t);
+	packet_ctx = conf;
 
 	/*
 	 *  We don't really want probes taking down machines
@@ -2200,7 +2728,7 @@ int main(int argc, char *argv[])
 	/*
 	 *  Get options
 	 */
-	while ((opt = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:")) != EOF) {
+	while ((opt = getopt(argc, argv, "ab:Bc:C:d:D:e:Ef:hi:I:j:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:")) != EOF) {
 		switch (opt) {
 		case 'a':
 		{
@@ -2231,6 +2759,10 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'B':
+			conf->benchmark = true;
+			break;
+
 		case 'c':
 			conf->limit = atoi(optarg);
 			if (conf->limit == 0) {
@@ -2292,6 +2824,14 @@ int main(int argc, char *argv[])
 			conf->from_file = true;
 			break;
 
+		case 'j':
+			conf->num_workers = atoi(optarg);
+			if ((conf->num_workers <= 0) || (conf->num_workers > RS_MAX_WORKERS)) {
+				ERROR("Invalid number of threads \"%s\"", optarg);
+				usage(1);
+			}
+			break;
+
 		case 'l':
 			conf->list_attributes = optarg;
 			break;
@@ -2425,6 +2965,21 @@ int main(int argc, char *argv[])
 		usage(64);
 	}
 
+	/*
+	 *	Requests linked by attributes may not go to the same matcher
+	 *	thread, and the pcap output isn't thread-safe.
+	 */
+	if (conf->num_workers && (conf->link_attributes || conf->to_file || conf->to_stdout)) {
+		ERROR("-j can't be used with -L, -w or -S");
+		usage(64);
+	}
+
+	/* Benchmarks are only meaningful when reading from files */
+	if (conf->benchmark && !conf->from_file) {
+		ERROR("-B requires pcap files");
+		usage(64);
+	}
+
 	/* Can't set stats export mode if we're not writing stats */
 	if ((conf->stats.out == RS_STATS_OUT_STDIO_CSV) && !conf->stats.interval) {
 		usage(64);
@@ -2857,13 +3412,28 @@ int main(int argc, char *argv[])
 #ifdef SIGQUIT
 	fr_set_signal(SIGQUIT, rs_signal_self);
 #endif
+	if (conf->num_workers && (rs_workers_start() < 0)) goto finish;
+
 	DEBUG2("Entering event loop");
 
-	fr_event_loop(events);	/* Enter the main event loop */
+	{
+		struct timeval	start;
+		struct rusage	start_usage;
+
+		gettimeofday(&start, NULL);
+		getrusage(RUSAGE_SELF, &start_usage);
+
+		fr_event_loop(events);	/* Enter the main event loop */
+
+		rs_workers_stop();
+
+		if (conf->benchmark) rs_benchmark_print(&start, &start_usage);
+	}
 
 	DEBUG2("Done sniffing");
 
 finish:
+	rs_workers_stop();
 	cleanup = true;
 
 	/*
@@ -122,6 +122,7 @@ static void home_server_free(void *data)
 {
 	home_server_t *home = talloc_get_type_abort(data, home_server_t);
 
+	fr_stats_free(&home->stats);
 	talloc_free(home);
 }
 
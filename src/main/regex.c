@@ -39,6 +39,37 @@ typedef struct regcapture {
 	size_t		nmatch;		//!< Number of match vectors.
 } regcapture_t;
 
+#ifdef HAVE_PCRE
+/** Copy what's needed for named subcaptures out of a cached expression
+ *
+ * Cached expressions belong to the thread which compiled them, and may be
+ * freed when the cache is full.  Requests may be freed by a different thread,
+ * so they can't hold a reference to them.  Instead the compiled pattern,
+ * which contains the name table, is copied.
+ *
+ * @param ctx to allocate the copy in.
+ * @param preg to copy.
+ * @return
+ *	- A copy which can only be used to look up named subcaptures.
+ *	- NULL if the expression has no named subcaptures.
+ */
+static regex_t *regex_copy_names(TALLOC_CTX *ctx, regex_t const *preg)
+{
+	regex_t	*copy;
+	size_t	size;
+	int	names;
+
+	if ((pcre_fullinfo(preg->compiled, NULL, PCRE_INFO_NAMECOUNT, &names) != 0) || (names == 0)) return NULL;
+	if (pcre_fullinfo(preg->compiled, NULL, PCRE_INFO_SIZE, &size) != 0) return NULL;
+
+	MEM(copy = talloc_zero(ctx, regex_t));
+	MEM(copy->compiled = talloc_memdup(copy, preg->compiled, size));
+	copy->precompiled = true;
+
+	return copy;
+}
+#endif
+
 /** Adds subcapture values to request data
  *
  * Allows use of %{n} expansions.
@@ -94,6 +125,8 @@ void regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value, s
 	if (!(*preg)->precompiled) {
 		new_sc->preg = talloc_steal(new_sc, *preg);
 		*preg = NULL;
+	} else if ((*preg)->cached) {
+		new_sc->preg = regex_copy_names(new_sc, *preg);
 	} else
 #endif
 	{
@@ -188,6 +221,15 @@ int regex_request_to_sub_named(TALLOC_CTX *ctx, char **out, REQUEST *request, ch
 		return 1;
 	}
 
+	/*
+	 *	The expression had no named subcaptures.
+	 */
+	if (!cap->preg) {
+		RDEBUG4("No named capture group \"%s\"", name);
+		*out = NULL;
+		return -1;
+	}
+
 	ret = pcre_get_named_substring(cap->preg->compiled, cap->value,
 				       (int *)cap->rxmatch, (int)cap->nmatch, name, &p);
 	switch (ret) {
@@ -155,9 +155,12 @@ static int snmp_config_reset_set(NDEBUG_UNUSED fr_snmp_map_t const *map, UNUSED
 static int snmp_auth_stats_offset_get(UNUSED TALLOC_CTX *ctx, value_box_t *out,
 				      fr_snmp_map_t const *map, UNUSED void *snmp_ctx)
 {
+	fr_stats_t stats;
+
 	rad_assert(map->da->type == PW_TYPE_INTEGER);
 
-	out->datum.integer = *(uint32_t *)((uint8_t *)(&radius_auth_stats) + map->offset);
+	fr_stats_read(&stats, &radius_auth_stats);
+	out->datum.integer = *(uint32_t *)((uint8_t *)(&stats) + map->offset);
 	out->length = dict_attr_sizes[PW_TYPE_INTEGER][0];
 
 	return 0;
@@ -236,11 +239,13 @@ static int snmp_auth_client_stats_offset_get(UNUSED TALLOC_CTX *ctx, value_box_t
 				  	     fr_snmp_map_t const *map, void *snmp_ctx)
 {
 	RADCLIENT *client = snmp_ctx;
+	fr_stats_t stats;
 
 	rad_assert(client);
 	rad_assert(map->da->type == PW_TYPE_INTEGER);
 
-	out->datum.integer = *(uint32_t *)((uint8_t *)(&client->auth) + map->offset);
+	fr_stats_read(&stats, &client->auth);
+	out->datum.integer = *(uint32_t *)((uint8_t *)(&stats) + map->offset);
 	out->length = dict_attr_sizes[PW_TYPE_INTEGER][0];
 
 	return 0;
@@ -79,25 +79,25 @@ void request_stats_final(REQUEST *request)
 		return;
 
 #undef INC_AUTH
-#define INC_AUTH(_x) radius_auth_stats._x++;request->listener->stats._x++;request->client->auth._x++;
+#define INC_AUTH(_x) fr_stats_local(&radius_auth_stats)->_x++;fr_stats_local(&request->listener->stats)->_x++;fr_stats_local(&request->client->auth)->_x++;
 
 #undef INC_ACCT
 #ifdef WITH_ACCOUNTING
-#define INC_ACCT(_x) radius_acct_stats._x++;request->listener->stats._x++;request->client->acct._x++
+#define INC_ACCT(_x) fr_stats_local(&radius_acct_stats)->_x++;fr_stats_local(&request->listener->stats)->_x++;fr_stats_local(&request->client->acct)->_x++
 #else
 #define INC_ACCT(_x)
 #endif
 
 #undef INC_COA
 #ifdef WITH_COA
-#define INC_COA(_x) radius_coa_stats._x++;request->listener->stats._x++;request->client->coa._x++
+#define INC_COA(_x) fr_stats_local(&radius_coa_stats)->_x++;fr_stats_local(&request->listener->stats)->_x++;fr_stats_local(&request->client->coa)->_x++
 #else
 #define INC_COA(_x)
 #endif
 
 #undef INC_DSC
 #ifdef WITH_DSC
-#define INC_DSC(_x) radius_dsc_stats._x++;request->listener->stats._x++;request->client->dsc._x++
+#define INC_DSC(_x) fr_stats_local(&radius_dsc_stats)->_x++;fr_stats_local(&request->listener->stats)->_x++;fr_stats_local(&request->client->dsc)->_x++
 #else
 #define INC_DSC(_x)
 #endif
@@ -105,10 +105,9 @@ void request_stats_final(REQUEST *request)
 	/*
 	 *	Update the statistics.
 	 *
-	 *	Note that we do NOT do this in a child thread.
-	 *	Instead, we update the stats when a request is
-	 *	deleted, because only the main server thread calls
-	 *	this function, which makes it thread-safe.
+	 *	This is called from whichever thread deletes the
+	 *	request, so all updates go to the per-worker
+	 *	counters.
 	 */
 	if (request->reply && request->packet && (request->packet->code != PW_CODE_STATUS_SERVER)) switch (request->reply->code) {
 	case PW_CODE_ACCESS_ACCEPT:
@@ -120,15 +119,15 @@ void request_stats_final(REQUEST *request)
 		/*
 		 *	FIXME: Do the time calculations once...
 		 */
-		fr_stats_bins(&radius_auth_stats,
-			      &request->packet->timestamp,
-			      &request->reply->timestamp);
-		fr_stats_bins(&request->client->auth,
-			      &request->packet->timestamp,
-			      &request->reply->timestamp);
-		fr_stats_bins(&request->listener->stats,
-			      &request->packet->timestamp,
-			      &request->reply->timestamp);
+		fr_stats_latency(&radius_auth_stats,
+				 &request->packet->timestamp,
+				 &request->reply->timestamp);
+		fr_stats_latency(&request->client->auth,
+				 &request->packet->timestamp,
+				 &request->reply->timestamp);
+		fr_stats_latency(&request->listener->stats,
+				 &request->packet->timestamp,
+				 &request->reply->timestamp);
 		break;
 
 	case PW_CODE_ACCESS_REJECT:
@@ -142,12 +141,12 @@ void request_stats_final(REQUEST *request)
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_RESPONSE:
 		INC_ACCT(total_responses);
-		fr_stats_bins(&radius_acct_stats,
-			      &request->packet->timestamp,
-			      &request->reply->timestamp);
-		fr_stats_bins(&request->client->acct,
-			      &request->packet->timestamp,
-			      &request->reply->timestamp);
+		fr_stats_latency(&radius_acct_stats,
+				 &request->packet->timestamp,
+				 &request->reply->timestamp);
+		fr_stats_latency(&request->client->acct,
+				 &request->packet->timestamp,
+				 &request->reply->timestamp);
 		break;
 #endif
 
@@ -156,9 +155,9 @@ void request_stats_final(REQUEST *request)
 		INC_COA(total_access_accepts);
 	  coa_stats:
 		INC_COA(total_responses);
-		fr_stats_bins(&request->client->coa,
-			      &request->packet->timestamp,
-			      &request->reply->timestamp);
+		fr_stats_latency(&request->client->coa,
+				 &request->packet->timestamp,
+				 &request->reply->timestamp);
 		break;
 
 	case PW_CODE_COA_NAK:
@@ -169,9 +168,9 @@ void request_stats_final(REQUEST *request)
 		INC_DSC(total_access_accepts);
 	  dsc_stats:
 		INC_DSC(total_responses);
-		fr_stats_bins(&request->client->dsc,
-			      &request->packet->timestamp,
-			      &request->reply->timestamp);
+		fr_stats_latency(&request->client->dsc,
+				 &request->packet->timestamp,
+				 &request->reply->timestamp);
 		break;
 
 	case PW_CODE_DISCONNECT_NAK:
@@ -208,26 +207,26 @@ void request_stats_final(REQUEST *request)
 
 	switch (request->proxy->packet->code) {
 	case PW_CODE_ACCESS_REQUEST:
-		proxy_auth_stats.total_requests += request->proxy->packet->count;
-		request->proxy->home_server->stats.total_requests += request->proxy->packet->count;
+		fr_stats_local(&proxy_auth_stats)->total_requests += request->proxy->packet->count;
+		fr_stats_local(&request->proxy->home_server->stats)->total_requests += request->proxy->packet->count;
 		break;
 
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_REQUEST:
-		proxy_acct_stats.total_requests += request->proxy->packet->count;
-		request->proxy->home_server->stats.total_requests += request->proxy->packet->count;
+		fr_stats_local(&proxy_acct_stats)->total_requests += request->proxy->packet->count;
+		fr_stats_local(&request->proxy->home_server->stats)->total_requests += request->proxy->packet->count;
 		break;
 #endif
 
 #ifdef WITH_COA
 	case PW_CODE_COA_REQUEST:
-		proxy_coa_stats.total_requests += request->proxy->packet->count;
-		request->proxy->home_server->stats.total_requests += request->proxy->packet->count;
+		fr_stats_local(&proxy_coa_stats)->total_requests += request->proxy->packet->count;
+		fr_stats_local(&request->proxy->home_server->stats)->total_requests += request->proxy->packet->count;
 		break;
 
 	case PW_CODE_DISCONNECT_REQUEST:
-		proxy_dsc_stats.total_requests += request->proxy->packet->count;
-		request->proxy->home_server->stats.total_requests += request->proxy->packet->count;
+		fr_stats_local(&proxy_dsc_stats)->total_requests += request->proxy->packet->count;
+		fr_stats_local(&request->proxy->home_server->stats)->total_requests += request->proxy->packet->count;
 		break;
 #endif
 
@@ -238,19 +237,19 @@ void request_stats_final(REQUEST *request)
 	if (!request->proxy->reply) goto done;	/* simplifies formatting */
 
 #undef INC
-#define INC(_x) proxy_auth_stats._x += request->proxy->reply->count; request->proxy->home_server->stats._x += request->proxy->reply->count;
+#define INC(_x) fr_stats_local(&proxy_auth_stats)->_x += request->proxy->reply->count; fr_stats_local(&request->proxy->home_server->stats)->_x += request->proxy->reply->count;
 
 	switch (request->proxy->reply->code) {
 	case PW_CODE_ACCESS_ACCEPT:
 		INC(total_access_accepts);
 	proxy_stats:
 		INC(total_responses);
-		fr_stats_bins(&proxy_auth_stats,
-			      &request->proxy->packet->timestamp,
-			      &request->proxy->reply->timestamp);
-		fr_stats_bins(&request->proxy->home_server->stats,
-			      &request->proxy->packet->timestamp,
-			      &request->proxy->reply->timestamp);
+		fr_stats_latency(&proxy_auth_stats,
+				 &request->proxy->packet->timestamp,
+				 &request->proxy->reply->timestamp);
+		fr_stats_latency(&request->proxy->home_server->stats,
+				 &request->proxy->packet->timestamp,
+				 &request->proxy->reply->timestamp);
 		break;
 
 	case PW_CODE_ACCESS_REJECT:
@@ -263,46 +262,46 @@ void request_stats_final(REQUEST *request)
 
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_RESPONSE:
-		proxy_acct_stats.total_responses++;
-		request->proxy->home_server->stats.total_responses++;
-		fr_stats_bins(&proxy_acct_stats,
-			      &request->proxy->packet->timestamp,
-			      &request->proxy->reply->timestamp);
-		fr_stats_bins(&request->proxy->home_server->stats,
-			      &request->proxy->packet->timestamp,
-			      &request->proxy->reply->timestamp);
+		fr_stats_local(&proxy_acct_stats)->total_responses++;
+		fr_stats_local(&request->proxy->home_server->stats)->total_responses++;
+		fr_stats_latency(&proxy_acct_stats,
+				 &request->proxy->packet->timestamp,
+				 &request->proxy->reply->timestamp);
+		fr_stats_latency(&request->proxy->home_server->stats,
+				 &request->proxy->packet->timestamp,
+				 &request->proxy->reply->timestamp);
 		break;
 #endif
 
 #ifdef WITH_COA
 	case PW_CODE_COA_ACK:
 	case PW_CODE_COA_NAK:
-		proxy_coa_stats.total_responses++;
-		request->proxy->home_server->stats.total_responses++;
-		fr_stats_bins(&proxy_coa_stats,
-			      &request->proxy->packet->timestamp,
-			      &request->proxy->reply->timestamp);
-		fr_stats_bins(&request->proxy->home_server->stats,
-			      &request->proxy->packet->timestamp,
-			      &request->proxy->reply->timestamp);
+		fr_stats_local(&proxy_coa_stats)->total_responses++;
+		fr_stats_local(&request->proxy->home_server->stats)->total_responses++;
+		fr_stats_latency(&proxy_coa_stats,
+				 &request->proxy->packet->timestamp,
+				 &request->proxy->reply->timestamp);
+		fr_stats_latency(&request->proxy->home_server->stats,
+				 &request->proxy->packet->timestamp,
+				 &request->proxy->reply->timestamp);
 		break;
 
 	case PW_CODE_DISCONNECT_ACK:
 	case PW_CODE_DISCONNECT_NAK:
-		proxy_dsc_stats.total_responses++;
-		request->proxy->home_server->stats.total_responses++;
-		fr_stats_bins(&proxy_dsc_stats,
-			      &request->proxy->packet->timestamp,
-			      &request->proxy->reply->timestamp);
-		fr_stats_bins(&request->proxy->home_server->stats,
-			      &request->proxy->packet->timestamp,
-			      &request->proxy->reply->timestamp);
+		fr_stats_local(&proxy_dsc_stats)->total_responses++;
+		fr_stats_local(&request->proxy->home_server->stats)->total_responses++;
+		fr_stats_latency(&proxy_dsc_stats,
+				 &request->proxy->packet->timestamp,
+				 &request->proxy->reply->timestamp);
+		fr_stats_latency(&request->proxy->home_server->stats,
+				 &request->proxy->packet->timestamp,
+				 &request->proxy->reply->timestamp);
 		break;
 #endif
 
 	default:
-		proxy_auth_stats.total_unknown_types++;
-		request->proxy->home_server->stats.total_unknown_types++;
+		fr_stats_local(&proxy_auth_stats)->total_unknown_types++;
+		fr_stats_local(&request->proxy->home_server->stats)->total_unknown_types++;
 		break;
 	}
 
@@ -313,10 +312,17 @@ void request_stats_final(REQUEST *request)
 }
 
 typedef struct fr_stats2vp {
-	int	attribute;
-	size_t	offset;
+	int		attribute;
+	size_t		offset;
+	unsigned int	permille;	//!< If set, the attribute is a latency percentile.
 } fr_stats2vp;
 
+#define LATENCY_VPS(_prefix) \
+	{ PW_FREERADIUS_ ## _prefix ## _LATENCY_USEC_P50, 0, 500 }, \
+	{ PW_FREERADIUS_ ## _prefix ## _LATENCY_USEC_P90, 0, 900 }, \
+	{ PW_FREERADIUS_ ## _prefix ## _LATENCY_USEC_P99, 0, 990 }, \
+	{ PW_FREERADIUS_ ## _prefix ## _LATENCY_USEC_P999, 0, 999 }
+
 /*
  *	Authentication
  */
@@ -331,6 +337,7 @@ static fr_stats2vp authvp[] = {
 	{ PW_FREERADIUS_TOTAL_AUTH_INVALID_REQUESTS, offsetof(fr_stats_t, total_bad_authenticators) },
 	{ PW_FREERADIUS_TOTAL_AUTH_DROPPED_REQUESTS, offsetof(fr_stats_t, total_packets_dropped) },
 	{ PW_FREERADIUS_TOTAL_AUTH_UNKNOWN_TYPES, offsetof(fr_stats_t, total_unknown_types) },
+	LATENCY_VPS(AUTH),
 	{ 0, 0 }
 };
 
@@ -350,6 +357,7 @@ static fr_stats2vp proxy_authvp[] = {
 	{ PW_FREERADIUS_TOTAL_PROXY_AUTH_INVALID_REQUESTS, offsetof(fr_stats_t, total_bad_authenticators) },
 	{ PW_FREERADIUS_TOTAL_PROXY_AUTH_DROPPED_REQUESTS, offsetof(fr_stats_t, total_packets_dropped) },
 	{ PW_FREERADIUS_TOTAL_PROXY_AUTH_UNKNOWN_TYPES, offsetof(fr_stats_t, total_unknown_types) },
+	LATENCY_VPS(PROXY_AUTH),
 	{ 0, 0 }
 };
 #endif
@@ -367,6 +375,7 @@ static fr_stats2vp acctvp[] = {
 	{ PW_FREERADIUS_TOTAL_ACCT_INVALID_REQUESTS, offsetof(fr_stats_t, total_bad_authenticators) },
 	{ PW_FREERADIUS_TOTAL_ACCT_DROPPED_REQUESTS, offsetof(fr_stats_t, total_packets_dropped) },
 	{ PW_FREERADIUS_TOTAL_ACCT_UNKNOWN_TYPES, offsetof(fr_stats_t, total_unknown_types) },
+	LATENCY_VPS(ACCT),
 	{ 0, 0 }
 };
 
@@ -379,6 +388,7 @@ static fr_stats2vp proxy_acctvp[] = {
 	{ PW_FREERADIUS_TOTAL_PROXY_ACCT_INVALID_REQUESTS, offsetof(fr_stats_t, total_bad_authenticators) },
 	{ PW_FREERADIUS_TOTAL_PROXY_ACCT_DROPPED_REQUESTS, offsetof(fr_stats_t, total_packets_dropped) },
 	{ PW_FREERADIUS_TOTAL_PROXY_ACCT_UNKNOWN_TYPES, offsetof(fr_stats_t, total_unknown_types) },
+	LATENCY_VPS(PROXY_ACCT),
 	{ 0, 0 }
 };
 #endif
@@ -395,6 +405,7 @@ static fr_stats2vp client_authvp[] = {
 	{ PW_FREERADIUS_TOTAL_AUTH_INVALID_REQUESTS, offsetof(fr_stats_t, total_bad_authenticators) },
 	{ PW_FREERADIUS_TOTAL_AUTH_DROPPED_REQUESTS, offsetof(fr_stats_t, total_packets_dropped) },
 	{ PW_FREERADIUS_TOTAL_AUTH_UNKNOWN_TYPES, offsetof(fr_stats_t, total_unknown_types) },
+	LATENCY_VPS(AUTH),
 	{ 0, 0 }
 };
 
@@ -407,6 +418,7 @@ static fr_stats2vp client_acctvp[] = {
 	{ PW_FREERADIUS_TOTAL_ACCT_INVALID_REQUESTS, offsetof(fr_stats_t, total_bad_authenticators) },
 	{ PW_FREERADIUS_TOTAL_ACCT_DROPPED_REQUESTS, offsetof(fr_stats_t, total_packets_dropped) },
 	{ PW_FREERADIUS_TOTAL_ACCT_UNKNOWN_TYPES, offsetof(fr_stats_t, total_unknown_types) },
+	LATENCY_VPS(ACCT),
 	{ 0, 0 }
 };
 #endif
@@ -417,13 +429,28 @@ static void request_stats_addvp(REQUEST *request,
 	int i;
 	fr_uint_t counter;
 	VALUE_PAIR *vp;
+	fr_stats_t sum;
+	fr_hist_t hist;
+
+	fr_stats_read(&sum, stats);
+	fr_stats_hist_read(&hist, stats);
 
 	for (i = 0; table[i].attribute != 0; i++) {
+		/*
+		 *	No percentiles if nothing has been recorded.
+		 */
+		if (table[i].permille && !hist.count) continue;
+
 		vp = radius_pair_create(request->reply, &request->reply->vps,
 				       table[i].attribute, VENDORPEC_FREERADIUS);
 		if (!vp) continue;
 
-		counter = *(fr_uint_t *) (((uint8_t *) stats) + table[i].offset);
+		if (table[i].permille) {
+			vp->vp_integer = fr_hist_percentile(&hist, table[i].permille);
+			continue;
+		}
+
+		counter = *(fr_uint_t *) (((uint8_t *) &sum) + table[i].offset);
 		vp->vp_integer = counter;
 	}
 }
@@ -824,4 +851,335 @@ void radius_stats_ema(fr_stats_ema_t *ema,
 #endif
 }
 
+/*
+ *	Per-worker statistics.
+ *
+ *	Each thread which updates statistics has a slot, and the
+ *	counters for each fr_stats_t are kept in a separate
+ *	cache-line aligned block for each slot.  A thread only ever
+ *	writes to the block for its own slot, so the hot path needs
+ *	no locks, and no atomic read-modify-write operations.
+ *
+ *	Readers sum the blocks.  The result may be slightly stale,
+ *	but counters only ever go up, so that's fine.
+ *
+ *	Slot 0 belongs to the main thread.  Workers claim a slot when
+ *	they start, and any other thread claims one of the spare
+ *	slots the first time it updates a counter.  If there are no
+ *	slots left, that thread's updates are discarded, rather than
+ *	racing with another thread's.
+ */
+#define STATS_CACHE_LINE	(64)
+#define STATS_SLOTS_SPARE	(8)
+
+typedef struct fr_stats_worker_t {
+	fr_stats_t		stats;		//!< workers is always NULL.
+	fr_hist_t		hist;		//!< Latency, in microseconds.  Not allocated
+						//!< if the fr_stats_t has no_hist set.
+} fr_stats_worker_t;
+
+struct fr_stats_workers_t {
+	uint32_t		num;		//!< Number of slots, including slot 0.
+	_Atomic(fr_stats_worker_t *) block[];
+};
+
+typedef struct stats_slot_t {
+	uint32_t		id;
+	atomic_bool		used;
+} stats_slot_t;
+
+static stats_slot_t	*stats_slots;
+static uint32_t		stats_slots_num;	//!< Not including slot 0.
+
+static _Thread_local stats_slot_t *stats_slot;
+static _Thread_local fr_stats_t	stats_discard;	//!< For threads which couldn't get a slot.
+static _Thread_local bool	stats_no_slot;	//!< Whether the current thread has given up on a slot.
+
+/** Allocate slots for worker threads
+ *
+ * Must be called from the main thread, before any other threads
+ * are started.  If it's not called, the server is assumed to be
+ * single threaded, and all updates go to slot 0.
+ *
+ * @param[in] num The maximum number of worker threads.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_stats_slots_init(uint32_t num)
+{
+	uint32_t i;
+
+	if (stats_slots) return 0;	/* not changed on HUP */
+
+	num += STATS_SLOTS_SPARE;
+
+	stats_slots = calloc(num + 1, sizeof(*stats_slots));
+	if (!stats_slots) {
+		ERROR("Out of memory");
+		return -1;
+	}
+
+	for (i = 0; i <= num; i++) {
+		stats_slots[i].id = i;
+		atomic_init(&stats_slots[i].used, (i == 0));
+	}
+	stats_slots_num = num;
+	stats_slot = &stats_slots[0];
+
+	return 0;
+}
+
+/** Claim a free statistics slot for the current thread
+ *
+ * @return
+ *	- true if the thread has a slot.
+ *	- false if there are none left.
+ */
+static bool stats_slot_claim(void)
+{
+	uint32_t i;
+
+	if (stats_slot) return true;
+	if (stats_no_slot) return false;
+
+	for (i = 1; i <= stats_slots_num; i++) {
+		bool expected = false;
+
+		if (atomic_compare_exchange_strong(&stats_slots[i].used, &expected, true)) {
+			stats_slot = &stats_slots[i];
+			return true;
+		}
+	}
+
+	WARN("No statistics slot free, discarding statistics updates from this thread");
+	stats_no_slot = true;
+
+	return false;
+}
+
+/** Claim a statistics slot for the current thread
+ *
+ */
+void fr_stats_thread_start(void)
+{
+	if (!stats_slots) return;
+
+	stats_no_slot = false;
+	(void) stats_slot_claim();
+}
+
+/** Release the statistics slot for the current thread
+ *
+ * The counters are left alone, and will be added to by the next
+ * thread which claims the slot.
+ */
+void fr_stats_thread_stop(void)
+{
+	if (!stats_slot || (stats_slot->id == 0)) return;
+
+	atomic_store(&stats_slot->used, false);
+	stats_slot = NULL;
+}
+
+/** Find or allocate the block for the current thread
+ *
+ * @return
+ *	- The block for the current thread.
+ *	- NULL if the thread has no slot, or we're out of memory.
+ */
+static fr_stats_worker_t *stats_worker(fr_stats_t *stats)
+{
+	fr_stats_workers_t	*workers, *expected = NULL;
+	fr_stats_worker_t	*block;
+	uint32_t		i, id = 0;
+	size_t			size;
+	void			*mem;
+
+	if (stats_slots) {
+		if (!stats_slot_claim()) return NULL;
+		id = stats_slot->id;
+	}
+
+	workers = atomic_load_explicit(&stats->workers, memory_order_acquire);
+	if (!workers) {
+		workers = malloc(sizeof(*workers) + ((stats_slots_num + 1) * sizeof(workers->block[0])));
+		if (!workers) return NULL;
+
+		workers->num = stats_slots_num + 1;
+		for (i = 0; i < workers->num; i++) atomic_init(&workers->block[i], NULL);
+
+		/*
+		 *	Another thread got there first, use theirs.
+		 */
+		if (!atomic_compare_exchange_strong_explicit(&stats->workers, &expected, workers,
+							     memory_order_acq_rel, memory_order_acquire)) {
+			free(workers);
+			workers = expected;
+		}
+	}
+
+	if (id >= workers->num) return NULL;
+
+	block = atomic_load_explicit(&workers->block[id], memory_order_acquire);
+	if (block) return block;
+
+	/*
+	 *	Only this thread writes to this slot, so there's no
+	 *	need to check if someone else allocated the block.
+	 *
+	 *	The histogram is most of the block, so it's left
+	 *	off if it won't be used.
+	 */
+	size = stats->no_hist ? offsetof(fr_stats_worker_t, hist) : sizeof(*block);
+	if (posix_memalign(&mem, STATS_CACHE_LINE,
+			   ((size + STATS_CACHE_LINE - 1) / STATS_CACHE_LINE) * STATS_CACHE_LINE) != 0) {
+		return NULL;
+	}
+	block = mem;
+	memset(block, 0, size);
+
+	atomic_store_explicit(&workers->block[id], block, memory_order_release);
+
+	return block;
+}
+
+/** Return the counters the current thread should update
+ *
+ * @param[in] stats to update.
+ * @return the per-thread counters for stats, or counters which are
+ *	discarded if they couldn't be allocated.
+ */
+fr_stats_t *fr_stats_local(fr_stats_t *stats)
+{
+	fr_stats_worker_t *block;
+
+	block = stats_worker(stats);
+	if (!block) return &stats_discard;
+
+	return &block->stats;
+}
+
+/** Record the latency of a request
+ *
+ * Updates the elapsed bins, and the latency histogram.
+ *
+ * @param[in] stats to update.
+ * @param[in] start of the request.
+ * @param[in] end of the request.
+ */
+void fr_stats_latency(fr_stats_t *stats, struct timeval *start, struct timeval *end)
+{
+	fr_stats_worker_t	*block;
+	struct timeval		diff;
+
+	if ((start->tv_sec == 0) || (end->tv_sec == 0) || (end->tv_sec < start->tv_sec)) return;
+
+	block = stats_worker(stats);
+	if (!block) return;
+
+	fr_stats_bins(&block->stats, start, end);
+
+	if (stats->no_hist) return;
+
+	fr_timeval_subtract(&diff, end, start);
+	if (diff.tv_sec < 0) return;
+
+	fr_hist_add(&block->hist, ((uint64_t) diff.tv_sec * USEC) + diff.tv_usec);
+}
+
+static void stats_add(fr_stats_t *out, fr_stats_t const *in)
+{
+	int i;
+
+	out->total_requests += in->total_requests;
+	out->total_invalid_requests += in->total_invalid_requests;
+	out->total_dup_requests += in->total_dup_requests;
+	out->total_responses += in->total_responses;
+	out->total_access_accepts += in->total_access_accepts;
+	out->total_access_rejects += in->total_access_rejects;
+	out->total_access_challenges += in->total_access_challenges;
+	out->total_malformed_requests += in->total_malformed_requests;
+	out->total_bad_authenticators += in->total_bad_authenticators;
+	out->total_packets_dropped += in->total_packets_dropped;
+	out->total_no_records += in->total_no_records;
+	out->total_unknown_types += in->total_unknown_types;
+	out->total_timeouts += in->total_timeouts;
+	if (in->last_packet > out->last_packet) out->last_packet = in->last_packet;
+
+	for (i = 0; i < 8; i++) out->elapsed[i] += in->elapsed[i];
+}
+
+/** Get the current value of a set of counters
+ *
+ * @param[out] out Where to write the sum of the shared and per-worker counters.
+ * @param[in] stats to read.
+ */
+void fr_stats_read(fr_stats_t *out, fr_stats_t const *stats)
+{
+	fr_stats_workers_t	*workers;
+	fr_stats_worker_t	*block;
+	fr_stats_t		*mutable;
+	uint32_t		i;
+
+	memset(out, 0, sizeof(*out));
+	stats_add(out, stats);
+
+	memcpy(&mutable, &stats, sizeof(mutable));
+
+	workers = atomic_load_explicit(&mutable->workers, memory_order_acquire);
+	if (!workers) return;
+
+	for (i = 0; i < workers->num; i++) {
+		block = atomic_load_explicit(&workers->block[i], memory_order_acquire);
+		if (block) stats_add(out, &block->stats);
+	}
+}
+
+/** Get the current latency histogram for a set of counters
+ *
+ * @param[out] out Where to write the sum of the per-worker histograms.
+ * @param[in] stats to read.
+ */
+void fr_stats_hist_read(fr_hist_t *out, fr_stats_t const *stats)
+{
+	fr_stats_workers_t	*workers;
+	fr_stats_worker_t	*block;
+	fr_stats_t		*mutable;
+	uint32_t		i;
+
+	memset(out, 0, sizeof(*out));
+	if (stats->no_hist) return;
+
+	memcpy(&mutable, &stats, sizeof(mutable));
+
+	workers = atomic_load_explicit(&mutable->workers, memory_order_acquire);
+	if (!workers) return;
+
+	for (i = 0; i < workers->num; i++) {
+		block = atomic_load_explicit(&workers->block[i], memory_order_acquire);
+		if (!block) continue;
+
+		fr_hist_merge(out, &block->hist);
+	}
+}
+
+/** Free the per-worker counters
+ *
+ * Must only be called when no other thread can be using stats.
+ */
+void fr_stats_free(fr_stats_t *stats)
+{
+	fr_stats_workers_t	*workers;
+	uint32_t		i;
+
+	workers = atomic_load_explicit(&stats->workers, memory_order_acquire);
+	if (!workers) return;
+
+	for (i = 0; i < workers->num; i++) free(atomic_load_explicit(&workers->block[i], memory_order_relaxed));
+	free(workers);
+
+	atomic_store_explicit(&stats->workers, NULL, memory_order_release);
+}
+
 #endif /* WITH_STATS */
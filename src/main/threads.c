@@ -29,6 +29,7 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/heap.h>
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/modules.h>
+#include <freeradius-devel/profile.h>
 
 #ifdef HAVE_SYS_WAIT_H
 #  include <sys/wait.h>
@@ -479,6 +480,8 @@ static void *thread_handler(void *arg)
 		goto done;
 	}
 
+	fr_stats_thread_start();
+
 	thread->status = THREAD_ACTIVE;
 
 	/*
@@ -602,6 +605,9 @@ static void *thread_handler(void *arg)
 done:
 	DEBUG2("Thread %d exiting...", thread->thread_num);
 
+	fr_stats_thread_stop();
+	fr_profile_thread_stop();
+
 	talloc_free(ctx);
 
 #ifdef HAVE_OPENSSL_ERR_H
@@ -807,6 +813,11 @@ int thread_pool_bootstrap(CONF_SECTION *cs, bool *spawn_workers)
 	fr_tls_max_threads = thread_pool.max_threads;
 #endif
 
+	/*
+	 *	One set of statistics counters per worker.
+	 */
+	if (fr_stats_slots_init(thread_pool.max_threads) < 0) return -1;
+
 	if (!thread_pool.queue_priority ||
 	    (strcmp(thread_pool.queue_priority, "default") == 0)) {
 		thread_pool.heap_cmp = default_cmp;
@@ -929,6 +940,39 @@ int thread_pool_init(void)
 }
 
 
+/** Call a function with the backlog of each worker thread
+ *
+ * Must be called from the main thread, as that's the only thread which
+ * adds requests to the backlogs.
+ *
+ * @param[in] callback to call for each worker.  If it returns < 0, the walk stops.
+ * @param[in] uctx passed to the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the callback returned < 0.
+ */
+int thread_pool_walk(thread_pool_walk_t callback, void *uctx)
+{
+#ifndef WITH_GCD
+	THREAD_HANDLE	*thread;
+	uint32_t	backlog;
+
+	if (!pool_initialized || !thread_pool.spawn_workers) return 0;
+
+	for (thread = thread_pool.thread_head; thread; thread = thread->next) {
+		if (thread->status != THREAD_ACTIVE) continue;
+
+		pthread_mutex_lock(&thread->backlog_mutex);
+		backlog = fr_heap_num_elements(thread->backlog);
+		pthread_mutex_unlock(&thread->backlog_mutex);
+
+		if (callback(uctx, thread->thread_num, backlog, thread->request_count) < 0) return -1;
+	}
+#endif
+
+	return 0;
+}
+
 /*
  *	Stop all threads in the pool.
  */
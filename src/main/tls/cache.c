@@ -33,6 +33,14 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/rad_assert.h>
 
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  include <openssl/core_names.h>
+#else
+#  include <openssl/hmac.h>
+#endif
+
 /** Add attributes identifying the TLS session to be acted upon, and the action to be performed
  *
  * Adds the following attributes to the request:
@@ -159,6 +167,252 @@ inline static ssize_t tls_cache_id(uint8_t const **out, SSL_SESSION *sess)
 #endif
 }
 
+/*
+ *	In-memory session cache.
+ *
+ *	Sessions are stored in serialised form, so the cache
+ *	can be shared between all SSL_CTXs created from the same
+ *	configuration (and so all workers).  To reduce lock
+ *	contention the cache is split into shards, each with
+ *	its own lock, LRU list and limit.
+ */
+#define TLS_CACHE_SHARDS	16
+
+typedef struct tls_cache_entry {
+	uint8_t			*id;		//!< Session ID.
+	size_t			id_len;		//!< Length of the session ID.
+	uint32_t		hash;		//!< Of the session ID.
+
+	uint8_t			*data;		//!< Serialised session.
+	size_t			data_len;	//!< Length of the serialised session.
+
+	time_t			expires;	//!< When the session can no longer be resumed.
+
+	struct tls_cache_entry	*prev;		//!< Towards the most recently used entry.
+	struct tls_cache_entry	*next;		//!< Towards the least recently used entry.
+} tls_cache_entry_t;
+
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects everything below.
+	fr_hash_table_t		*ht;		//!< Entries indexed by session ID.
+	tls_cache_entry_t	*head;		//!< Most recently used entry.
+	tls_cache_entry_t	*tail;		//!< Least recently used entry.
+	uint32_t		num;		//!< Number of entries in this shard.
+	uint32_t		max;		//!< Maximum number of entries in this shard.
+} tls_cache_shard_t;
+
+struct fr_tls_session_cache {
+	uint32_t		lifetime;	//!< How long sessions are cached for.
+	tls_cache_shard_t	shard[TLS_CACHE_SHARDS];
+};
+
+static uint32_t tls_cache_entry_hash(void const *data)
+{
+	tls_cache_entry_t const *entry = data;
+
+	return entry->hash;
+}
+
+static int tls_cache_entry_cmp(void const *one, void const *two)
+{
+	tls_cache_entry_t const *a = one;
+	tls_cache_entry_t const *b = two;
+
+	if (a->id_len != b->id_len) return (a->id_len > b->id_len) - (a->id_len < b->id_len);
+
+	return memcmp(a->id, b->id, a->id_len);
+}
+
+static void tls_cache_entry_unlink(tls_cache_shard_t *shard, tls_cache_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		shard->head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		shard->tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void tls_cache_entry_link_head(tls_cache_shard_t *shard, tls_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = shard->head;
+	if (shard->head) shard->head->prev = entry;
+	shard->head = entry;
+	if (!shard->tail) shard->tail = entry;
+}
+
+/** Remove an entry from a shard and free it
+ *
+ * @note Must be called with the shard mutex held.
+ */
+static void tls_cache_entry_remove(tls_cache_shard_t *shard, tls_cache_entry_t *entry)
+{
+	tls_cache_entry_unlink(shard, entry);
+	fr_hash_table_delete(shard->ht, entry);
+	shard->num--;
+	talloc_free(entry);
+}
+
+/** Find the entry for a session ID, and the shard it belongs to
+ *
+ * @note Returns with the shard mutex held.
+ */
+static tls_cache_entry_t *tls_cache_entry_find(tls_cache_shard_t **out, fr_tls_session_cache_t *cache,
+					       uint8_t const *id, size_t id_len)
+{
+	tls_cache_entry_t	my_entry;
+	tls_cache_shard_t	*shard;
+
+	memcpy(&my_entry.id, &id, sizeof(my_entry.id));
+	my_entry.id_len = id_len;
+	my_entry.hash = fr_hash(id, id_len);
+
+	*out = shard = &cache->shard[my_entry.hash % TLS_CACHE_SHARDS];
+
+	pthread_mutex_lock(&shard->mutex);
+
+	return fr_hash_table_finddata(shard->ht, &my_entry);
+}
+
+/** Write a serialised session to the in-memory cache
+ *
+ * @param[in] cache	to write the session to.
+ * @param[in] id	of the session.
+ * @param[in] id_len	Length of the session ID.
+ * @param[in] data	Serialised session.
+ * @param[in] data_len	Length of the serialised session.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_cache_mem_insert(fr_tls_session_cache_t *cache, uint8_t const *id, size_t id_len,
+				uint8_t const *data, size_t data_len)
+{
+	tls_cache_shard_t	*shard;
+	tls_cache_entry_t	*entry;
+	uint8_t			*copy;
+
+	entry = tls_cache_entry_find(&shard, cache, id, id_len);
+	if (entry) {
+		copy = talloc_memdup(entry, data, data_len);
+		if (!copy) {
+			pthread_mutex_unlock(&shard->mutex);
+			return -1;
+		}
+		talloc_free(entry->data);
+		entry->data = copy;
+		entry->data_len = data_len;
+
+		tls_cache_entry_unlink(shard, entry);
+	} else {
+		/*
+		 *	Evict the least recently used entry.
+		 */
+		if (shard->num >= shard->max) tls_cache_entry_remove(shard, shard->tail);
+
+		entry = talloc_zero(shard->ht, tls_cache_entry_t);
+		if (!entry) {
+		error:
+			pthread_mutex_unlock(&shard->mutex);
+			return -1;
+		}
+
+		entry->id = talloc_memdup(entry, id, id_len);
+		entry->data = talloc_memdup(entry, data, data_len);
+		if (!entry->id || !entry->data) {
+			talloc_free(entry);
+			goto error;
+		}
+		entry->id_len = id_len;
+		entry->data_len = data_len;
+		entry->hash = fr_hash(id, id_len);
+
+		if (!fr_hash_table_insert(shard->ht, entry)) {
+			talloc_free(entry);
+			goto error;
+		}
+		shard->num++;
+	}
+	entry->expires = time(NULL) + cache->lifetime;
+
+	tls_cache_entry_link_head(shard, entry);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return 0;
+}
+
+/** Retrieve a copy of a serialised session from the in-memory cache
+ *
+ * @param[in] ctx	to allocate the copy in.
+ * @param[in] cache	to read the session from.
+ * @param[in] id	of the session.
+ * @param[in] id_len	Length of the session ID.
+ * @return
+ *	- A copy of the serialised session.
+ *	- NULL if the session wasn't found, or had expired.
+ */
+static uint8_t *tls_cache_mem_find(TALLOC_CTX *ctx, fr_tls_session_cache_t *cache, uint8_t const *id, size_t id_len)
+{
+	tls_cache_shard_t	*shard;
+	tls_cache_entry_t	*entry;
+	uint8_t			*data;
+
+	entry = tls_cache_entry_find(&shard, cache, id, id_len);
+	if (!entry) {
+		pthread_mutex_unlock(&shard->mutex);
+		return NULL;
+	}
+
+	if (time(NULL) >= entry->expires) {
+		tls_cache_entry_remove(shard, entry);
+		pthread_mutex_unlock(&shard->mutex);
+		return NULL;
+	}
+
+	if (entry != shard->head) {
+		tls_cache_entry_unlink(shard, entry);
+		tls_cache_entry_link_head(shard, entry);
+	}
+
+	data = talloc_memdup(ctx, entry->data, entry->data_len);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return data;
+}
+
+/** Remove a session from the in-memory cache
+ *
+ * @param[in] cache	to remove the session from.
+ * @param[in] id	of the session.
+ * @param[in] id_len	Length of the session ID.
+ */
+static void tls_cache_mem_delete(fr_tls_session_cache_t *cache, uint8_t const *id, size_t id_len)
+{
+	tls_cache_shard_t	*shard;
+	tls_cache_entry_t	*entry;
+
+	entry = tls_cache_entry_find(&shard, cache, id, id_len);
+	if (entry) tls_cache_entry_remove(shard, entry);
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+static int _tls_cache_mem_free(fr_tls_session_cache_t *cache)
+{
+	int i;
+
+	for (i = 0; i < TLS_CACHE_SHARDS; i++) pthread_mutex_destroy(&cache->shard[i].mutex);
+
+	return 0;
+}
+
 /** Write a newly created session data to the tls_session structure
  *
  * @note If you hit an assert in this function, it was likely called twice, which shouldn't happen
@@ -266,6 +520,19 @@ int tls_cache_write(REQUEST *request, tls_session_t *tls_session)
 		return 1;
 	}
 
+	if (conf->session_cache) {
+		if (tls_cache_mem_insert(conf->session_cache,
+					 tls_session->session_id, talloc_array_length(tls_session->session_id),
+					 tls_session->session_blob, talloc_array_length(tls_session->session_blob)) < 0) {
+			RWDEBUG("Failed storing session data in memory");
+			ret = -1;
+		} else {
+			RDEBUG2("Stored session data in memory");
+		}
+	}
+
+	if (!conf->session_cache_server) return ret;
+
 	if (tls_cache_attrs(request, tls_session->session_id, talloc_array_length(tls_session->session_id),
 			    CACHE_ACTION_SESSION_WRITE) < 0) {
 		RWDEBUG("Failed adding session key to the request");
@@ -309,71 +576,31 @@ int tls_cache_write(REQUEST *request, tls_session_t *tls_session)
 	return ret;
 }
 
-/** Read session data from the cache
+/** Deserialise session data and set it as the session to resume
  *
- * @param[in] ssl session state.
- * @param[in] key to retrieve session data for.
- * @param[in] key_len The length of the key.
- * @param[out] copy Indicates whether OpenSSL should increment the reference
- *	count on SSL_SESSION to prevent it being automatically freed.  We always
- *	set this to 0.
+ * @param[in] request	The current request.
+ * @param[in] ssl	session state.
+ * @param[in] data	Serialised session.
+ * @param[in] data_len	Length of the serialised session.
  * @return
  *	- Deserialised session data on success.
  *	- NULL on error.
  */
-static SSL_SESSION *tls_cache_read(SSL *ssl,
-#if OPENSSL_VERSION_NUMBER >= 0x10100000L
-				   unsigned char const *key,
-#else
-				   unsigned char *key,
-#endif
-				   int key_len, int *copy)
+static SSL_SESSION *tls_cache_session_load(REQUEST *request, SSL *ssl, uint8_t const *data, size_t data_len)
 {
-	fr_tls_conf_t		*conf;
-	REQUEST			*request;
 	unsigned char const	**p;
 	uint8_t const		*q;
-	VALUE_PAIR		*vp;
 	SSL_SESSION		*sess;
 
-	request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
-	conf = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
-
-	if (tls_cache_attrs(request, key, key_len, CACHE_ACTION_SESSION_READ) < 0) {
-		RWDEBUG("Failed adding session key to the request");
-		return NULL;
-	}
-
-	*copy = 0;
-
-	/*
-	 *	Call the virtual server to read the session
-	 */
-	switch (tls_cache_process(request, conf->session_cache_server, CACHE_ACTION_SESSION_READ)) {
-	case RLM_MODULE_OK:
-	case RLM_MODULE_UPDATED:
-		break;
-
-	default:
-		RWDEBUG("Failed acquiring session data");
-		return NULL;
-	}
-
-	vp = fr_pair_find_by_num(request->state, 0, PW_TLS_SESSION_DATA, TAG_ANY);
-	if (!vp) {
-		RWDEBUG("No cached session found");
-		return NULL;
-	}
-
-	q = vp->vp_octets;	/* openssl will mutate q, so we can't use vp_octets directly */
+	q = data;	/* openssl will mutate q, so we can't use data directly */
 	p = (unsigned char const **)&q;
 
-	sess = d2i_SSL_SESSION(NULL, p, vp->vp_length);
+	sess = d2i_SSL_SESSION(NULL, p, data_len);
 	if (!sess) {
 		RWDEBUG("Failed loading persisted session: %s", ERR_error_string(ERR_get_error(), NULL));
 		return NULL;
 	}
-	RDEBUG3("Read %zu bytes of session data.  Session deserialized successfully", vp->vp_length);
+	RDEBUG3("Read %zu bytes of session data.  Session deserialized successfully", data_len);
 
 	/*
 	 *	OpenSSL's API is very inconsistent.
@@ -402,11 +629,173 @@ static SSL_SESSION *tls_cache_read(SSL *ssl,
 		SSL_SESSION_set_timeout(sess, 0);
 	}
 
+	return sess;
+}
+
+/** Find serialised session data in memory, or by calling the virtual server
+ *
+ * @param[in] ctx		to allocate the session data in.
+ * @param[in] request		The current request.
+ * @param[in] conf		TLS configuration.
+ * @param[in] key		to retrieve session data for.
+ * @param[in] key_len		The length of the key.
+ * @param[out] from_server	Set to true if the data was provided by the virtual server.
+ * @return
+ *	- Serialised session data.
+ *	- NULL if no session data was found.
+ */
+static uint8_t *tls_cache_find(TALLOC_CTX *ctx, REQUEST *request, fr_tls_conf_t *conf,
+			       uint8_t const *key, size_t key_len, bool *from_server)
+{
+	VALUE_PAIR	*vp;
+	uint8_t		*data;
+
+	*from_server = false;
+
+	/*
+	 *	Check the in-memory cache first, so resumption
+	 *	doesn't require running the virtual server.
+	 */
+	if (conf->session_cache) {
+		data = tls_cache_mem_find(ctx, conf->session_cache, key, key_len);
+		if (data) {
+			RDEBUG2("Found session data in memory");
+			return data;
+		}
+	}
+
+	if (!conf->session_cache_server) return NULL;
+
+	if (tls_cache_attrs(request, key, key_len, CACHE_ACTION_SESSION_READ) < 0) {
+		RWDEBUG("Failed adding session key to the request");
+		return NULL;
+	}
+
+	/*
+	 *	Call the virtual server to read the session
+	 */
+	switch (tls_cache_process(request, conf->session_cache_server, CACHE_ACTION_SESSION_READ)) {
+	case RLM_MODULE_OK:
+	case RLM_MODULE_UPDATED:
+		break;
+
+	default:
+		RWDEBUG("Failed acquiring session data");
+		return NULL;
+	}
+
+	vp = fr_pair_find_by_num(request->state, 0, PW_TLS_SESSION_DATA, TAG_ANY);
+	if (!vp) return NULL;
+
+	MEM(data = talloc_memdup(ctx, vp->vp_octets, vp->vp_length));
+	*from_server = true;
+
 	/*
 	 *	Ensure that the session data can't be used by anyone else.
 	 */
 	fr_pair_delete_by_num(&request->state, 0, PW_TLS_SESSION_DATA, TAG_ANY);
 
+	return data;
+}
+
+/** Look up the session a ClientHello asks to resume, before the handshake is started
+ *
+ * The result is kept in the tls_session, and used by #tls_cache_read when
+ * OpenSSL asks for the session.  This lets the caller find out whether the
+ * session id really resumes a session, and means the virtual server isn't
+ * run from within the handshake.
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	The handshake will be performed for.
+ * @param[in] id		Session id from the ClientHello.
+ * @param[in] id_len		Length of the session id.
+ * @return
+ *	- 1 if session data was found.
+ *	- 0 if no session data was found.
+ */
+int tls_cache_prefetch(REQUEST *request, tls_session_t *tls_session, uint8_t const *id, size_t id_len)
+{
+	fr_tls_conf_t *conf = SSL_get_ex_data(tls_session->ssl, FR_TLS_EX_INDEX_CONF);
+
+	TALLOC_FREE(tls_session->prefetch_id);
+	TALLOC_FREE(tls_session->prefetch_data);
+
+	if (!conf || (!conf->session_cache && !conf->session_cache_server)) return 0;
+
+	MEM(tls_session->prefetch_id = talloc_memdup(tls_session, id, id_len));
+	tls_session->prefetch_data = tls_cache_find(tls_session, request, conf, id, id_len,
+						    &tls_session->prefetch_from_server);
+
+	return tls_session->prefetch_data ? 1 : 0;
+}
+
+/** Read session data from the cache
+ *
+ * @param[in] ssl session state.
+ * @param[in] key to retrieve session data for.
+ * @param[in] key_len The length of the key.
+ * @param[out] copy Indicates whether OpenSSL should increment the reference
+ *	count on SSL_SESSION to prevent it being automatically freed.  We always
+ *	set this to 0.
+ * @return
+ *	- Deserialised session data on success.
+ *	- NULL on error.
+ */
+static SSL_SESSION *tls_cache_read(SSL *ssl,
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+				   unsigned char const *key,
+#else
+				   unsigned char *key,
+#endif
+				   int key_len, int *copy)
+{
+	fr_tls_conf_t		*conf;
+	REQUEST			*request;
+	tls_session_t		*tls_session;
+	SSL_SESSION		*sess;
+	uint8_t			*data;
+	bool			from_server;
+
+	request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
+	conf = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
+	tls_session = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TLS_SESSION);
+
+	*copy = 0;
+
+	/*
+	 *	Use the result of tls_cache_prefetch if it was
+	 *	for this session id, so the virtual server isn't
+	 *	run from within an async job.
+	 */
+	if (tls_session && tls_session->prefetch_id &&
+	    (talloc_array_length(tls_session->prefetch_id) == (size_t)key_len) &&
+	    (memcmp(tls_session->prefetch_id, key, key_len) == 0)) {
+		data = tls_session->prefetch_data;
+		from_server = tls_session->prefetch_from_server;
+
+		TALLOC_FREE(tls_session->prefetch_id);
+		tls_session->prefetch_data = NULL;
+		if (!data) return NULL;
+	} else {
+		data = tls_cache_find(request, request, conf, key, key_len, &from_server);
+		if (!data) {
+			RWDEBUG("No cached session found");
+			return NULL;
+		}
+	}
+
+	sess = tls_cache_session_load(request, ssl, data, talloc_array_length(data));
+
+	/*
+	 *	Populate the in-memory cache, so the next
+	 *	resumption doesn't need the virtual server.
+	 */
+	if (sess && from_server && conf->session_cache &&
+	    (tls_cache_mem_insert(conf->session_cache, key, key_len, data, talloc_array_length(data)) < 0)) {
+		RWDEBUG("Failed storing session data in memory");
+	}
+	talloc_free(data);
+
 	return sess;
 }
 
@@ -441,6 +830,10 @@ static void tls_cache_delete(SSL_CTX *ctx, SSL_SESSION *sess)
 		return;
 	}
 
+	if (conf->session_cache) tls_cache_mem_delete(conf->session_cache, key, (size_t)key_len);
+
+	if (!conf->session_cache_server) return;
+
 	if (tls_cache_attrs(request, key, (size_t)key_len, CACHE_ACTION_SESSION_DELETE) < 0) {
 		RWDEBUG("Failed adding session key to the request");
 		goto error;
@@ -540,6 +933,12 @@ int tls_cache_disable_cb(SSL *ssl,
 		RDEBUG2("&control:Allow-Session-Resumption == no, disabling session resumption");
 	disable:
 		SSL_CTX_remove_session(session->ctx, session->ssl_session);
+
+		/*
+		 *	It's too late to set SSL_OP_NO_TICKET, OpenSSL
+		 *	has already decided whether to send a ticket.
+		 *	tls_cache_ticket_key_cb declines to encrypt one.
+		 */
 		session->allow_session_resumption = false;
 		return 1;
 	}
@@ -547,24 +946,299 @@ int tls_cache_disable_cb(SSL *ssl,
 	return 0;
 }
 
+/*
+ *	RFC 5077 session tickets.
+ *
+ *	A new key is generated every ticket_key_rotation seconds.
+ *	Enough previous keys are retained to decrypt tickets for
+ *	the lifetime of the session.  Tickets encrypted with a
+ *	previous key are accepted, and the client is issued with
+ *	a new ticket.
+ */
+#define TLS_TICKET_KEYS_MAX	256
+
+typedef struct {
+	uint8_t			name[16];	//!< Identifies the key used to encrypt a ticket.
+	uint8_t			aes_key[32];	//!< Ticket encryption key.
+	uint8_t			hmac_key[32];	//!< Ticket authentication key.
+	time_t			created;	//!< When the key was generated.  0 if unused.
+} tls_ticket_key_t;
+
+struct fr_tls_ticket_keys {
+	pthread_mutex_t		mutex;		//!< Protects the keys.
+	uint32_t		rotation;	//!< How often a new key is generated.
+	time_t			max_age;	//!< After which a key is no longer used for decryption.
+	uint32_t		current;	//!< Index of the key used for encryption.
+	uint32_t		num;		//!< Number of keys retained.
+	tls_ticket_key_t	*keys;		//!< Array of keys.
+};
+
+/** Generate a new ticket key
+ *
+ * @note Must be called with the key mutex held.
+ */
+static int tls_ticket_key_generate(tls_ticket_key_t *key, time_t now)
+{
+	if ((RAND_bytes(key->name, sizeof(key->name)) != 1) ||
+	    (RAND_bytes(key->aes_key, sizeof(key->aes_key)) != 1) ||
+	    (RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) != 1)) {
+		memset(key, 0, sizeof(*key));
+		return -1;
+	}
+	key->created = now;
+
+	return 0;
+}
+
+/** Retrieve a copy of the key to encrypt a ticket with, or the key to decrypt it with
+ *
+ * @param[out] out	Where to write the key.
+ * @param[in] tk	Ticket keys.
+ * @param[in] name	of the key used to encrypt the ticket.  NULL to retrieve the
+ *			current encryption key.
+ * @return
+ *	- 1 if the key is the current key.
+ *	- 2 if the key is a previous key, and the ticket should be renewed.
+ *	- 0 if no key was found.
+ *	- -1 if a new key was required, but could not be generated.
+ */
+static int tls_ticket_key_find(tls_ticket_key_t *out, fr_tls_ticket_keys_t *tk, uint8_t const *name)
+{
+	tls_ticket_key_t	*key;
+	time_t			now = time(NULL);
+	uint32_t		i;
+	int			ret = 0;
+
+	pthread_mutex_lock(&tk->mutex);
+
+	/*
+	 *	Rotate the encryption key if it's too old.
+	 */
+	key = &tk->keys[tk->current];
+	if ((now - key->created) >= (time_t)tk->rotation) {
+		uint32_t next = (tk->current + 1) % tk->num;
+
+		if (tls_ticket_key_generate(&tk->keys[next], now) == 0) {
+			tk->current = next;
+		} else if (!name) {
+			ret = -1;
+			goto finish;
+		}
+	}
+
+	if (!name) {
+		*out = tk->keys[tk->current];
+		ret = 1;
+		goto finish;
+	}
+
+	for (i = 0; i < tk->num; i++) {
+		key = &tk->keys[i];
+
+		if (!key->created || ((now - key->created) >= tk->max_age)) continue;
+		if (memcmp(key->name, name, sizeof(key->name)) != 0) continue;
+
+		*out = *key;
+		ret = (i == tk->current) ? 1 : 2;
+		break;
+	}
+
+finish:
+	pthread_mutex_unlock(&tk->mutex);
+
+	return ret;
+}
+
+/** Provide OpenSSL with the keys to encrypt and authenticate or decrypt and verify a ticket
+ *
+ * @param[in] ssl	session state.
+ * @param[in] key_name	Identifies the key used to encrypt the ticket.
+ * @param[in] iv	Initialisation vector.  Written to if enc is 1.
+ * @param[in] ectx	Cipher context to initialise.
+ * @param[in] hctx	HMAC context to initialise.
+ * @param[in] enc	1 if encrypting a new ticket, 0 if decrypting.
+ * @return
+ *	- 1 on success.
+ *	- 2 if the ticket was decrypted with a previous key and should be renewed.
+ *	- 0 if the key used to encrypt the ticket wasn't found.  OpenSSL performs a
+ *	  full handshake.
+ *	- -1 on error.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int tls_cache_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+				   EVP_CIPHER_CTX *ectx, EVP_MAC_CTX *hctx, int enc)
+#else
+static int tls_cache_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+				   EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc)
+#endif
+{
+	fr_tls_conf_t		*conf;
+	tls_session_t		*session;
+	tls_ticket_key_t	key;
+	int			ret;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM		params[3];
+#endif
+
+	conf = talloc_get_type_abort(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)), fr_tls_conf_t);
+	if (!conf->session_ticket_keys) return 0;
+
+	session = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TLS_SESSION);
+
+	if (enc) {
+		/*
+		 *	Resumption was disabled for this session
+		 *	after OpenSSL decided to send a ticket.
+		 *	Returning 0 sends an empty ticket.
+		 */
+		if (session && !session->allow_session_resumption) return 0;
+
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) return -1;
+
+		ret = tls_ticket_key_find(&key, conf->session_ticket_keys, NULL);
+		if (ret != 1) return -1;
+
+		memcpy(key_name, key.name, sizeof(key.name));
+	} else {
+		ret = tls_ticket_key_find(&key, conf->session_ticket_keys, key_name);
+		if (ret <= 0) return 0;
+
+		/*
+		 *	The certificate chain must be checked again
+		 *	once the session has been resumed, as it is
+		 *	for sessions read from the cache.
+		 */
+		if (session) session->ticket_decrypted = true;
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if (EVP_MAC_CTX_set_params(hctx, params) != 1) ret = -1;
+#else
+	if (HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key), EVP_sha256(), NULL) != 1) ret = -1;
+#endif
+
+	if (ret >= 0) {
+		if (enc) {
+			if (EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1) ret = -1;
+		} else {
+			if (EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1) ret = -1;
+		}
+	}
+
+	OPENSSL_cleanse(&key, sizeof(key));
+
+	return ret;
+}
+
+static int _tls_ticket_keys_free(fr_tls_ticket_keys_t *tk)
+{
+	OPENSSL_cleanse(tk->keys, sizeof(tk->keys[0]) * tk->num);
+	pthread_mutex_destroy(&tk->mutex);
+
+	return 0;
+}
+
+/** Allocate the in-memory session cache and session ticket keys
+ *
+ * Both are shared by all SSL_CTXs created from the configuration.
+ *
+ * @param[in] conf	to allocate the cache and keys for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int tls_cache_alloc(fr_tls_conf_t *conf)
+{
+	if (conf->session_cache_size) {
+		fr_tls_session_cache_t	*cache;
+		uint32_t		max;
+		int			i;
+
+		/*
+		 *	Round up, so each shard can hold at least one entry.
+		 */
+		max = (conf->session_cache_size + (TLS_CACHE_SHARDS - 1)) / TLS_CACHE_SHARDS;
+
+		MEM(cache = talloc_zero(conf, fr_tls_session_cache_t));
+		cache->lifetime = conf->session_cache_lifetime;
+
+		for (i = 0; i < TLS_CACHE_SHARDS; i++) {
+			tls_cache_shard_t *shard = &cache->shard[i];
+
+			shard->max = max;
+			shard->ht = fr_hash_table_create(cache, tls_cache_entry_hash, tls_cache_entry_cmp, NULL);
+			if (!shard->ht) {
+				ERROR("Failed creating session cache");
+				talloc_free(cache);
+				return -1;
+			}
+		}
+
+		for (i = 0; i < TLS_CACHE_SHARDS; i++) pthread_mutex_init(&cache->shard[i].mutex, NULL);
+		talloc_set_destructor(cache, _tls_cache_mem_free);
+
+		conf->session_cache = cache;
+	}
+
+	if (conf->session_tickets) {
+		fr_tls_ticket_keys_t	*tk;
+		uint32_t		num;
+
+		if (conf->session_ticket_key_rotation < 60) conf->session_ticket_key_rotation = 60;
+
+		/*
+		 *	Retain keys for long enough that tickets can
+		 *	be decrypted for the lifetime of the session.
+		 */
+		num = (conf->session_cache_lifetime / conf->session_ticket_key_rotation) + 2;
+		if (num > TLS_TICKET_KEYS_MAX) {
+			WARN("ticket_key_rotation is too short to retain keys for the session lifetime, "
+			     "tickets will expire after %u seconds", conf->session_ticket_key_rotation * (TLS_TICKET_KEYS_MAX - 1));
+			num = TLS_TICKET_KEYS_MAX;
+		}
+
+		MEM(tk = talloc_zero(conf, fr_tls_ticket_keys_t));
+		MEM(tk->keys = talloc_zero_array(tk, tls_ticket_key_t, num));
+		tk->num = num;
+		tk->rotation = conf->session_ticket_key_rotation;
+		tk->max_age = (time_t)conf->session_ticket_key_rotation * (num - 1);
+
+		if (tls_ticket_key_generate(&tk->keys[0], time(NULL)) < 0) {
+			tls_log_error(NULL, "Failed generating session ticket key");
+			talloc_free(tk);
+			return -1;
+		}
+
+		pthread_mutex_init(&tk->mutex, NULL);
+		talloc_set_destructor(tk, _tls_ticket_keys_free);
+
+		conf->session_ticket_keys = tk;
+	}
+
+	return 0;
+}
+
 /** Sets callbacks on a SSL_CTX to enable/disable session resumption
  *
  * @param ctx			to modify.
- * @param enabled		Whether session caching should be enabled.
- * @param session_context	under which cache entries should be stored.
- *				Prevents sessions being restored between
- *				different rlm_eap instances.
- * @param lifetime		The maximum period a cached session remains
- *				valid for.
+ * @param conf			containing the session cache configuration.
+ *				conf->session_context_id prevents sessions
+ *				being restored between different rlm_eap
+ *				instances.
  */
-void tls_cache_init(SSL_CTX *ctx, bool enabled, char const *session_context, uint32_t lifetime)
+void tls_cache_init(SSL_CTX *ctx, fr_tls_conf_t const *conf)
 {
-	if (!enabled) {
+	char const *session_context = conf->session_context_id;
+
+	if (!conf->session_cache_server && !conf->session_cache && !conf->session_ticket_keys) {
 		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
 		return;
 	}
 
-	rad_assert(session_context);
+	rad_assert(*session_context);
 
 	SSL_CTX_sess_set_new_cb(ctx, tls_cache_serialize);
 	SSL_CTX_sess_set_get_cb(ctx, tls_cache_read);
@@ -572,7 +1246,20 @@ void tls_cache_init(SSL_CTX *ctx, bool enabled, char const *session_context, uin
 	SSL_CTX_set_quiet_shutdown(ctx, 1);
 
 	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
-	SSL_CTX_set_timeout(ctx, lifetime);
+	SSL_CTX_set_timeout(ctx, conf->session_cache_lifetime);
+
+	/*
+	 *	Session tickets are encrypted with our keys,
+	 *	which are shared between all contexts, not
+	 *	the random per-context keys OpenSSL generates.
+	 */
+	if (conf->session_ticket_keys) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, tls_cache_ticket_key_cb);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx, tls_cache_ticket_key_cb);
+#endif
+	}
 
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 	SSL_CTX_set_not_resumable_session_callback(ctx, tls_cache_disable_cb);
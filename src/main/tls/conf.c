@@ -39,11 +39,18 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef SSL_MODE_ASYNC
+#  include <openssl/async.h>
+#endif
+
 static CONF_PARSER cache_config[] = {
 	{ FR_CONF_OFFSET("virtual_server", PW_TYPE_STRING, fr_tls_conf_t, session_cache_server) },
 	{ FR_CONF_OFFSET("name", PW_TYPE_STRING, fr_tls_conf_t, session_id_name) },
 	{ FR_CONF_OFFSET("lifetime", PW_TYPE_INTEGER, fr_tls_conf_t, session_cache_lifetime), .dflt = "86400" },
 	{ FR_CONF_OFFSET("verify", PW_TYPE_BOOLEAN, fr_tls_conf_t, session_cache_verify), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_entries", PW_TYPE_INTEGER, fr_tls_conf_t, session_cache_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("tickets", PW_TYPE_BOOLEAN, fr_tls_conf_t, session_tickets), .dflt = "no" },
+	{ FR_CONF_OFFSET("ticket_key_rotation", PW_TYPE_INTEGER, fr_tls_conf_t, session_ticket_key_rotation), .dflt = "3600" },
 
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 	{ FR_CONF_OFFSET("require_extended_master_secret", PW_TYPE_BOOLEAN, fr_tls_conf_t, session_cache_require_extms), .dflt = "yes" },
@@ -51,7 +58,6 @@ static CONF_PARSER cache_config[] = {
 #endif
 
 	{ FR_CONF_DEPRECATED("enable", PW_TYPE_BOOLEAN, fr_tls_conf_t, NULL) },
-	{ FR_CONF_DEPRECATED("max_entries", PW_TYPE_INTEGER, fr_tls_conf_t, NULL) },
 	{ FR_CONF_DEPRECATED("persist_dir", PW_TYPE_STRING, fr_tls_conf_t, NULL) },
 
 	CONF_PARSER_TERMINATOR
@@ -75,6 +81,10 @@ static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("timeout", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, timeout), .dflt = "yes" },
 	{ FR_CONF_OFFSET("softfail", PW_TYPE_BOOLEAN, fr_tls_ocsp_conf_t, softfail), .dflt = "no" },
 
+	{ FR_CONF_OFFSET("cache_size", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, cache_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("cache_lifetime", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, cache_lifetime), .dflt = "3600" },
+	{ FR_CONF_OFFSET("cache_prefetch", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, cache_prefetch), .dflt = "60" },
+
 	CONF_PARSER_TERMINATOR
 };
 #endif
@@ -103,6 +113,7 @@ static CONF_PARSER tls_server_config[] = {
 #endif
 	{ FR_CONF_OFFSET("allow_expired_crl", PW_TYPE_BOOLEAN, fr_tls_conf_t, allow_expired_crl) },
 	{ FR_CONF_OFFSET("check_cert_cn", PW_TYPE_STRING, fr_tls_conf_t, check_cert_cn) },
+	{ FR_CONF_OFFSET("cert_attr_cache_size", PW_TYPE_INTEGER, fr_tls_conf_t, cert_attr_cache_size), .dflt = "1024" },
 	{ FR_CONF_OFFSET("cipher_list", PW_TYPE_STRING, fr_tls_conf_t, cipher_list) },
 	{ FR_CONF_OFFSET("cipher_server_preference", PW_TYPE_BOOLEAN, fr_tls_conf_t, cipher_server_preference), .dflt = "yes" },
 #ifdef SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS
@@ -110,6 +121,9 @@ static CONF_PARSER tls_server_config[] = {
 #endif
 	{ FR_CONF_OFFSET("check_cert_issuer", PW_TYPE_STRING, fr_tls_conf_t, check_cert_issuer) },
 	{ FR_CONF_OFFSET("require_client_cert", PW_TYPE_BOOLEAN, fr_tls_conf_t, require_client_cert) },
+#ifdef SSL_MODE_ASYNC
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, fr_tls_conf_t, async), .dflt = "no" },
+#endif
 
 #if OPENSSL_VERSION_NUMBER >= 0x0090800fL
 #ifndef OPENSSL_NO_ECDH
@@ -274,6 +288,13 @@ static int _conf_server_free(fr_tls_conf_t *conf)
 	for (i = 0; i < conf->ctx_count; i++) SSL_CTX_free(conf->ctx[i]);
 
 #ifdef HAVE_OPENSSL_OCSP_H
+	/*
+	 *	Must be freed before the stores, the
+	 *	prefetch threads use them.
+	 */
+	TALLOC_FREE(conf->ocsp.cache);
+	TALLOC_FREE(conf->staple.cache);
+
 	if (conf->ocsp.store) X509_STORE_free(conf->ocsp.store);
 	conf->ocsp.store = NULL;
 	if (conf->staple.store) X509_STORE_free(conf->staple.store);
@@ -329,10 +350,20 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 	 */
 	if (conf->fragment_size < 100) conf->fragment_size = 100;
 
+#ifdef SSL_MODE_ASYNC
+	/*
+	 *	Without support for fibres OpenSSL can't pause
+	 *	a handshake, and runs async jobs synchronously.
+	 */
+	if (conf->async && !ASYNC_is_capable()) {
+		WARN("Async TLS jobs are not supported on this platform, handshakes will not be offloaded");
+	}
+#endif
+
 	/*
 	 *	Setup session caching
 	 */
-	if (conf->session_cache_server) {
+	if (conf->session_cache_server || conf->session_cache_size || conf->session_tickets) {
 		/*
 		 *	Create a unique context Id per EAP-TLS configuration.
 		 */
@@ -343,6 +374,16 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 			snprintf(conf->session_context_id, sizeof(conf->session_context_id),
 				 "FR eap %p", conf);
 		}
+
+		if (tls_cache_alloc(conf) < 0) goto error;
+	}
+
+	/*
+	 *	Setup caching of certificate attributes
+	 */
+	if (conf->cert_attr_cache_size) {
+		conf->cert_attr_cache = tls_session_cert_attr_cache_alloc(conf, conf->cert_attr_cache_size);
+		if (!conf->cert_attr_cache) goto error;
 	}
 
 #ifdef __APPLE__
@@ -379,11 +420,21 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 	if (conf->ocsp.enable) {
 		conf->ocsp.store = conf_ocsp_revocation_store(conf);
 		if (conf->ocsp.store == NULL) goto error;
+
+		if (conf->ocsp.cache_size) {
+			conf->ocsp.cache = tls_ocsp_cache_alloc(conf, &conf->ocsp);
+			if (!conf->ocsp.cache) goto error;
+		}
 	}
 
 	if (conf->staple.enable) {
 		conf->staple.store = conf_ocsp_revocation_store(conf);
 		if (conf->staple.store == NULL) goto error;
+
+		if (conf->staple.cache_size) {
+			conf->staple.cache = tls_ocsp_cache_alloc(conf, &conf->staple);
+			if (!conf->staple.cache) goto error;
+		}
 	}
 #endif /*HAVE_OPENSSL_OCSP_H*/
 
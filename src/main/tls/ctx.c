@@ -319,7 +319,7 @@ post_ca:
 	}
 
 #ifdef SSL_OP_NO_TICKET
-	ctx_options |= SSL_OP_NO_TICKET;
+	if (!conf->session_tickets) ctx_options |= SSL_OP_NO_TICKET;
 #endif
 
 	if (!conf->disable_single_dh_use) {
@@ -396,6 +396,14 @@ post_ca:
 		SSL_CTX_set_mode(ctx, SSL_MODE_NO_AUTO_CHAIN);
 	}
 
+#ifdef SSL_MODE_ASYNC
+	/*
+	 *	Allow the handshake to pause whilst an async
+	 *	capable engine performs private key operations.
+	 */
+	if (conf->async) SSL_CTX_set_mode(ctx, SSL_MODE_ASYNC);
+#endif
+
 	/* Set Info callback */
 	SSL_CTX_set_info_callback(ctx, tls_session_info_cb);
 
@@ -465,7 +473,7 @@ post_ca:
 	/*
 	 *	Setup session caching
 	 */
-	tls_cache_init(ctx, (bool)conf->session_cache_server, conf->session_context_id, conf->session_cache_lifetime);
+	tls_cache_init(ctx, conf);
 
 	/*
 	 *	Load dh params
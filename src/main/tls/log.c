@@ -263,6 +263,9 @@ int tls_log_io_error(REQUEST *request, tls_session_t *session, int ret, char con
 	case SSL_ERROR_WANT_READ:
 	case SSL_ERROR_WANT_WRITE:
 	case SSL_ERROR_WANT_X509_LOOKUP:
+#ifdef SSL_ERROR_WANT_ASYNC
+	case SSL_ERROR_WANT_ASYNC:
+#endif
 	case SSL_ERROR_ZERO_RETURN:
 		break;
 
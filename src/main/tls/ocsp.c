@@ -240,14 +240,28 @@ int tls_ocsp_staple_cb(SSL *ssl, void *data)
 	return ret;
 }
 
-/** Sends a OCSP request to a defined OCSP responder
+/** Send an OCSP request to the responder, and verify the response
+ *
+ * @note Logging is done at the request level if a request is provided, or globally
+ *	if it's not (i.e. when called by the prefetch thread).
  *
+ * @param[out] resp_out		Where to write the response received from the responder.
+ * @param[out] bresp_out	Where to write the basic response contained in resp_out.
+ * @param[in] request		The current request.  May be NULL.
+ * @param[in] store		used to verify the signature of the response.
+ * @param[in] certid		of the certificate to retrieve the status of.
+ * @param[in] client_cert	to retrieve the status of.  Used to determine the
+ *				responder URL.
+ * @param[in] conf		OCSP configuration.
+ * @return
+ *	- OCSP_STATUS_OK if a response was received, and its signature verified.
+ *	- OCSP_STATUS_SKIPPED if we couldn't get a response from the responder.
+ *	- OCSP_STATUS_FAILED if the response was invalid.
  */
-int tls_ocsp_check(REQUEST *request, SSL *ssl,
-		   X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
-		   fr_tls_ocsp_conf_t *conf, bool staple_response)
+static ocsp_status_t ocsp_response_fetch(OCSP_RESPONSE **resp_out, OCSP_BASICRESP **bresp_out, REQUEST *request,
+					 X509_STORE *store, OCSP_CERTID *certid, X509 *client_cert,
+					 fr_tls_ocsp_conf_t *conf)
 {
-	OCSP_CERTID	*certid;
 	OCSP_REQUEST	*req = NULL;
 	OCSP_RESPONSE	*resp = NULL;
 	OCSP_BASICRESP	*bresp = NULL;
@@ -256,97 +270,23 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 	char		*path = NULL;
 	char		host_header[1024];
 	int		use_ssl = -1;
-	long		this_fudge = OCSP_MAX_VALIDITY_PERIOD, this_max_age = -1;
-	BIO		*conn = NULL, *ssl_log = NULL;
-	ocsp_status_t   ocsp_status = OCSP_STATUS_FAILED;
-	ocsp_status_t	status;
-	ASN1_GENERALIZEDTIME *rev, *this_update, *next_update;
-	int		reason;
+	BIO		*conn = NULL;
+	ocsp_status_t	ocsp_status = OCSP_STATUS_SKIPPED;
+	int		status;
 #if OPENSSL_VERSION_NUMBER >= 0x1000003f
-	OCSP_REQ_CTX	*ctx;
+	OCSP_REQ_CTX	*ctx = NULL;
 	int		rc;
-	struct timeval	when;
+	struct timeval	when, now;
 #endif
-	struct timeval	now = { 0, 0 };
-	time_t		next;
-	VALUE_PAIR	*vp;
 
-	if (conf->cache_server) switch (tls_cache_process(request, conf->cache_server,
-							       CACHE_ACTION_OCSP_READ)) {
-	case RLM_MODULE_REJECT:
-		REDEBUG("Told to force OCSP validation failure from cached response");
-		return OCSP_STATUS_FAILED;
-
-	case RLM_MODULE_OK:
-	case RLM_MODULE_UPDATED:
-	/*
-	 *	These are fine for OCSP too, we don't *expect* to always
-	 *	have a cached OCSP status.
-	 */
-	case RLM_MODULE_NOTFOUND:
-	case RLM_MODULE_NOOP:
-		break;
-
-	default:
-		RWDEBUG("Failed retrieving cached OCSP status");
-		break;
-	}
-
-	/*
-	 *	Allow us to cache the OCSP verified state externally
-	 */
-	vp = fr_pair_find_by_num(request->control, 0, PW_TLS_OCSP_CERT_VALID, TAG_ANY);
-	if (vp) switch (vp->vp_integer) {
-	case 0:	/* no */
-		RDEBUG2("Found &control:TLS-OCSP-Cert-Valid = no, forcing OCSP failure");
-		return OCSP_STATUS_FAILED;
-
-	case 1: /* yes */
-		RDEBUG2("Found &control:TLS-OCSP-Cert-Valid = yes, forcing OCSP success");
-
-		/*
-		 *	If this fails, and an OCSP stapled response is required,
-		 *	we need to run the full OCSP check.
-		 */
-		if (staple_response) {
-			vp = fr_pair_find_by_num(request->control, 0, PW_TLS_OCSP_RESPONSE, TAG_ANY);
-			if (!vp) {
-				RDEBUG2("No &control:TLS-OCSP-Response attribute found, performing full OCSP check");
-				break;
-			}
-			if (ocsp_staple_from_pair(request, ssl, vp) < 0) {
-				RWDEBUG("Failed setting OCSP staple response in SSL session");
-				return OCSP_STATUS_FAILED;
-			}
-		}
-
-		return OCSP_STATUS_OK;
-
-	case 2: /* skipped */
-		RDEBUG2("Found &control:TLS-OCSP-Cert-Valid = skipped, skipping OCSP check");
-		return conf->softfail ? OCSP_STATUS_OK : OCSP_STATUS_FAILED;
-
-	case 3: /* unknown */
-	default:
-		break;
-	}
-
-	/*
-	 *	Setup logging for this OCSP operation
-	 */
-	ssl_log = BIO_new(BIO_s_mem());
-	if (!ssl_log) {
-		REDEBUG("Failed creating log queue");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
+	*resp_out = NULL;
+	*bresp_out = NULL;
 
 	/*
 	 *	Create OCSP Request
 	 */
-	certid = OCSP_cert_to_id(NULL, client_cert, issuer_cert);
 	req = OCSP_REQUEST_new();
-	OCSP_request_add0_id(req, certid);
+	OCSP_request_add0_id(req, OCSP_CERTID_dup(certid));
 	if (conf->use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
 
 	/*
@@ -362,8 +302,9 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		/* Reading the libssl src, they do a strdup on the URL, so it could of been const *sigh* */
 		OCSP_parse_url(url, &host, &port, &path, &use_ssl);
 		if (!host || !port || !path) {
-			RWDEBUG("Host or port or path missing from configured URL \"%s\".  Not doing OCSP", url);
-			goto skipped;
+			ROPTIONAL(RWDEBUG, WARN, "Host or port or path missing from configured URL \"%s\".  "
+				  "Not doing OCSP", url);
+			goto finish;
 		}
 	} else {
 		int ret;
@@ -371,16 +312,16 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		ret = ocsp_cert_url_parse(client_cert, &host, &port, &path, &use_ssl);
 		switch (ret) {
 		case -1:
-			RWDEBUG("Invalid URL in certificate.  Not doing OCSP");
-			break;
+			ROPTIONAL(RWDEBUG, WARN, "Invalid URL in certificate.  Not doing OCSP");
+			goto finish;
 
 		case 0:
 			if (conf->url) {
-				RWDEBUG("No OCSP URL in certificate, falling back to configured URL");
+				ROPTIONAL(RWDEBUG, WARN, "No OCSP URL in certificate, falling back to configured URL");
 				goto use_url;
 			}
-			RWDEBUG("No OCSP URL in certificate.  Not doing OCSP");
-			goto skipped;
+			ROPTIONAL(RWDEBUG, WARN, "No OCSP URL in certificate.  Not doing OCSP");
+			goto finish;
 
 		case 1:
 			rad_assert(host && port && path);
@@ -388,12 +329,12 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		}
 	}
 
-	RDEBUG2("Using responder URL \"http://%s:%s%s\"", host, port, path);
+	ROPTIONAL(RDEBUG2, DEBUG2, "Using responder URL \"http://%s:%s%s\"", host, port, path);
 
 	/* Check host and port length are sane, then create Host: HTTP header */
 	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
-		RWDEBUG("Host and port too long");
-		goto skipped;
+		ROPTIONAL(RWDEBUG, WARN, "Host and port too long");
+		goto finish;
 	}
 	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
 
@@ -407,8 +348,7 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 	/* Send OCSP request and wait for response */
 	resp = OCSP_sendreq_bio(conn, path, req);
 	if (!resp) {
-		REDEBUG("Couldn't get OCSP response");
-		ocsp_status = OCSP_STATUS_SKIPPED;
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't get OCSP response");
 		goto finish;
 	}
 #else
@@ -416,27 +356,23 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 
 	rc = BIO_do_connect(conn);
 	if ((rc <= 0) && ((!conf->timeout) || !BIO_should_retry(conn))) {
-		REDEBUG("Couldn't connect to OCSP responder");
-		ocsp_status = OCSP_STATUS_SKIPPED;
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't connect to OCSP responder");
 		goto finish;
 	}
 
 	ctx = OCSP_sendreq_new(conn, path, NULL, -1);
 	if (!ctx) {
-		REDEBUG("Couldn't create OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't create OCSP request");
 		goto finish;
 	}
 
 	if (!OCSP_REQ_CTX_add1_header(ctx, "Host", host_header)) {
-		REDEBUG("Couldn't set Host header");
-		ocsp_status = OCSP_STATUS_SKIPPED;
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't set Host header");
 		goto finish;
 	}
 
 	if (!OCSP_REQ_CTX_set1_req(ctx, req)) {
-		REDEBUG("Couldn't add data to OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't add data to OCSP request");
 		goto finish;
 	}
 
@@ -452,39 +388,733 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 	} while ((rc == -1) && BIO_should_retry(conn));
 
 	if (conf->timeout && (rc == -1) && BIO_should_retry(conn)) {
-		REDEBUG("Response timed out");
-		ocsp_status = OCSP_STATUS_SKIPPED;
+		ROPTIONAL(REDEBUG, ERROR, "Response timed out");
 		goto finish;
 	}
 
-	OCSP_REQ_CTX_free(ctx);
-
 	if (rc == 0) {
-		REDEBUG("Couldn't get OCSP response");
-		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
-		ocsp_status = OCSP_STATUS_SKIPPED;
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't get OCSP response");
 		goto finish;
 	}
 #endif /* OPENSSL_VERSION_NUMBER < 0x1000003f */
 
+	ocsp_status = OCSP_STATUS_FAILED;
+
 	/* Verify OCSP response status */
 	status = OCSP_response_status(resp);
 	if (status != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
-		REDEBUG("Response status: %s", OCSP_response_status_str(status));
+		ROPTIONAL(REDEBUG, ERROR, "Response status: %s", OCSP_response_status_str(status));
 		goto finish;
 	}
 	bresp = OCSP_response_get1_basic(resp);
 	if (conf->use_nonce && OCSP_check_nonce(req, bresp) != 1) {
-		REDEBUG("Response has wrong nonce value");
+		ROPTIONAL(REDEBUG, ERROR, "Response has wrong nonce value");
 		goto finish;
 	}
 	if (OCSP_basic_verify(bresp, NULL, store, 0) != 1){
-		REDEBUG("Couldn't verify OCSP basic response");
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't verify OCSP basic response");
 		goto finish;
 	}
 
+	*resp_out = resp;
+	*bresp_out = bresp;
+	resp = NULL;
+	bresp = NULL;
+	ocsp_status = OCSP_STATUS_OK;
+
+finish:
+#if OPENSSL_VERSION_NUMBER >= 0x1000003f
+	if (ctx) OCSP_REQ_CTX_free(ctx);
+#endif
+	OCSP_REQUEST_free(req);
+	OCSP_BASICRESP_free(bresp);
+	OCSP_RESPONSE_free(resp);
+	OPENSSL_free(host);
+	OPENSSL_free(port);
+	OPENSSL_free(path);
+	BIO_free_all(conn);
+
+	return ocsp_status;
+}
+
+/*
+ *	In memory cache of OCSP responses.
+ *
+ *	Responses are indexed by the DER encoded CertID they're
+ *	for, and are served from the cache until their nextUpdate
+ *	time (or cache_lifetime) is reached.
+ *
+ *	Shortly before a response expires, the first request to
+ *	use it queues it for refreshing by a background thread,
+ *	and continues using the cached response.  If responses
+ *	are refreshed successfully, requests never wait on the
+ *	OCSP responder for certificates they've seen recently.
+ */
+
+/** Minimum interval between attempts to refresh a cached response
+ *
+ */
+#define OCSP_CACHE_RETRY_INTERVAL	10
+
+/** A cached OCSP response
+ *
+ */
+typedef struct ocsp_cache_entry {
+	uint8_t			*key;		//!< DER encoded CertID.
+	size_t			key_len;	//!< Length of the DER encoded CertID.
+	uint32_t		hash;		//!< Of the key.
+
+	uint8_t			*resp;		//!< DER encoded OCSP response.
+	size_t			resp_len;	//!< Length of the DER encoded OCSP response.
+
+	time_t			expires;	//!< When the response must no longer be used.
+	time_t			prefetch;	//!< When we should start trying to refresh the response.
+	bool			refreshing;	//!< Whether the response is queued for refreshing.
+
+	struct ocsp_cache_entry	*prev;		//!< Towards the most recently used entry.
+	struct ocsp_cache_entry	*next;		//!< Towards the least recently used entry.
+} ocsp_cache_entry_t;
+
+/** A cached OCSP response which needs refreshing
+ *
+ * Holds copies of the certificates, as the entry may be evicted
+ * while the refresh is in progress.
+ */
+typedef struct ocsp_cache_refresh {
+	X509			*issuer_cert;	//!< Issuer of the certificate.
+	X509			*cert;		//!< Certificate to retrieve the status of.
+
+	struct ocsp_cache_refresh *next;	//!< Next response to refresh.
+} ocsp_cache_refresh_t;
+
+struct fr_tls_ocsp_cache {
+	fr_tls_ocsp_conf_t	*conf;		//!< OCSP configuration this cache belongs to.
+
+	pthread_mutex_t		mutex;		//!< Protects everything below.
+	fr_hash_table_t		*ht;		//!< Entries indexed by CertID.
+	ocsp_cache_entry_t	*head;		//!< Most recently used entry.
+	ocsp_cache_entry_t	*tail;		//!< Least recently used entry.
+	uint32_t		num;		//!< Number of entries in the cache.
+
+	ocsp_cache_refresh_t	*refresh_head;	//!< Next response to refresh.
+	ocsp_cache_refresh_t	*refresh_tail;	//!< Last response to refresh.
+
+	pthread_cond_t		cond;		//!< Signalled when there are responses to refresh.
+	pthread_t		thread;		//!< Refreshes responses.
+	bool			thread_running;	//!< Whether the prefetch thread was started.
+	bool			stop;		//!< Tells the prefetch thread to exit.
+};
+
+static uint32_t ocsp_cache_hash(void const *data)
+{
+	ocsp_cache_entry_t const *entry = data;
+
+	return entry->hash;
+}
+
+static int ocsp_cache_cmp(void const *one, void const *two)
+{
+	ocsp_cache_entry_t const *a = one;
+	ocsp_cache_entry_t const *b = two;
+
+	if (a->key_len != b->key_len) return (a->key_len > b->key_len) - (a->key_len < b->key_len);
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static void ocsp_cache_unlink(fr_tls_ocsp_cache_t *cache, ocsp_cache_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void ocsp_cache_link_head(fr_tls_ocsp_cache_t *cache, ocsp_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head) cache->head->prev = entry;
+	cache->head = entry;
+	if (!cache->tail) cache->tail = entry;
+}
+
+/** Remove an entry from the cache and free it
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void ocsp_cache_remove(fr_tls_ocsp_cache_t *cache, ocsp_cache_entry_t *entry)
+{
+	ocsp_cache_unlink(cache, entry);
+	fr_hash_table_delete(cache->ht, entry);
+	cache->num--;
+	talloc_free(entry);
+}
+
+/** DER encode a CertID so it can be used as a cache key
+ *
+ * @param[out] out	Where to write the encoded CertID.  Must be freed with OPENSSL_free().
+ * @param[in] certid	to encode.
+ * @return
+ *	- Length of the encoded CertID.
+ *	- <= 0 on error.
+ */
+static int ocsp_cache_key(uint8_t **out, OCSP_CERTID *certid)
+{
+	*out = NULL;
+
+	return i2d_OCSP_CERTID(certid, out);
+}
+
+static int _ocsp_cache_refresh_free(ocsp_cache_refresh_t *refresh)
+{
+	if (refresh->issuer_cert) X509_free(refresh->issuer_cert);
+	if (refresh->cert) X509_free(refresh->cert);
+
+	return 0;
+}
+
+/** Find an entry in the cache
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static ocsp_cache_entry_t *ocsp_cache_entry_find(fr_tls_ocsp_cache_t *cache, uint8_t *key, size_t key_len)
+{
+	ocsp_cache_entry_t my_entry;
+
+	my_entry.key = key;
+	my_entry.key_len = key_len;
+	my_entry.hash = fr_hash(key, key_len);
+
+	return fr_hash_table_finddata(cache->ht, &my_entry);
+}
+
+/** Add a response to the cache, replacing any existing response for the same CertID
+ *
+ * @param[in] cache		to add the response to.
+ * @param[in] request		The current request.  May be NULL.
+ * @param[in] certid		the response is for.
+ * @param[in] resp		to cache.
+ * @param[in] next_update	from the response.  May be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the response could not be cached.
+ */
+static int ocsp_cache_insert(fr_tls_ocsp_cache_t *cache, REQUEST *request,
+			     OCSP_CERTID *certid, OCSP_RESPONSE *resp, ASN1_GENERALIZEDTIME *next_update)
+{
+	fr_tls_ocsp_conf_t	*conf = cache->conf;
+	ocsp_cache_entry_t	*entry;
+	uint8_t			*key = NULL, *p;
+	int			key_len, resp_len;
+	time_t			now, next = 0, expires;
+
+	now = time(NULL);
+
+	if (next_update && (tls_utils_asn1time_to_epoch(&next, next_update) < 0)) {
+		ROPTIONAL(RWDEBUG, WARN, "Not caching OCSP response: Failed parsing next_update time: %s",
+			  fr_strerror());
+		return -1;
+	}
+
+	/*
+	 *	Responses without a nextUpdate time can be
+	 *	cached for cache_lifetime, if it's set.
+	 */
+	if (!next) {
+		if (!conf->cache_lifetime) {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Not caching OCSP response: No next_update time");
+			return -1;
+		}
+		expires = now + conf->cache_lifetime;
+	} else {
+		expires = next;
+		if (conf->cache_lifetime && ((now + conf->cache_lifetime) < expires)) {
+			expires = now + conf->cache_lifetime;
+		}
+	}
+
+	if (expires <= now) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Not caching OCSP response: Already expired");
+		return -1;
+	}
+
+	key_len = ocsp_cache_key(&key, certid);
+	if (key_len <= 0) {
+		ROPTIONAL(RWDEBUG, WARN, "Not caching OCSP response: Failed serialising CertID");
+		return -1;
+	}
+
+	resp_len = i2d_OCSP_RESPONSE(resp, NULL);
+	if (resp_len <= 0) {
+		ROPTIONAL(RWDEBUG, WARN, "Not caching OCSP response: Failed getting OCSP response length");
+		OPENSSL_free(key);
+		return -1;
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = ocsp_cache_entry_find(cache, key, key_len);
+	if (entry) {
+		ocsp_cache_unlink(cache, entry);
+		TALLOC_FREE(entry->resp);
+	} else {
+		/*
+		 *	Evict the least recently used entry.
+		 */
+		if (cache->num >= conf->cache_size) ocsp_cache_remove(cache, cache->tail);
+
+		entry = talloc_zero(cache, ocsp_cache_entry_t);
+		if (!entry) {
+		oom:
+			pthread_mutex_unlock(&cache->mutex);
+			OPENSSL_free(key);
+			ROPTIONAL(RWDEBUG, WARN, "Not caching OCSP response: Out of memory");
+			return -1;
+		}
+		entry->key = talloc_memdup(entry, key, key_len);
+		if (!entry->key) {
+			talloc_free(entry);
+			goto oom;
+		}
+		entry->key_len = key_len;
+		entry->hash = fr_hash(key, key_len);
+
+		if (!fr_hash_table_insert(cache->ht, entry)) {
+			talloc_free(entry);
+			goto oom;
+		}
+		cache->num++;
+	}
+
+	entry->resp = p = talloc_array(entry, uint8_t, resp_len);
+	if (!entry->resp || (i2d_OCSP_RESPONSE(resp, &p) != resp_len)) {
+		fr_hash_table_delete(cache->ht, entry);
+		cache->num--;
+		talloc_free(entry);
+		goto oom;
+	}
+	entry->resp_len = resp_len;
+	entry->expires = expires;
+	entry->refreshing = false;
+
+	/*
+	 *	If the response is too short lived to prefetch
+	 *	cache_prefetch seconds before it expires, start
+	 *	trying to refresh it half way through its life.
+	 */
+	if (!conf->cache_prefetch) {
+		entry->prefetch = expires;
+	} else if ((expires - now) <= conf->cache_prefetch) {
+		entry->prefetch = now + ((expires - now) / 2);
+	} else {
+		entry->prefetch = expires - conf->cache_prefetch;
+	}
+
+	ocsp_cache_link_head(cache, entry);
+	pthread_mutex_unlock(&cache->mutex);
+
+	OPENSSL_free(key);
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Cached OCSP response for %u seconds", (unsigned int)(expires - now));
+
+	return 0;
+}
+
+/** Retrieve a cached response
+ *
+ * If the response is due to be refreshed, queue it for the prefetch thread.
+ *
+ * @param[in] cache		to search in.
+ * @param[in] request		The current request.
+ * @param[in] certid		to retrieve the response for.
+ * @param[in] issuer_cert	Issuer of client_cert.  Copied if the response
+ *				needs refreshing.
+ * @param[in] client_cert	Certificate the response is for.  Copied if the
+ *				response needs refreshing.
+ * @return
+ *	- A copy of the cached response.  Must be freed with OCSP_RESPONSE_free().
+ *	- NULL if no usable response was found.
+ */
+static OCSP_RESPONSE *ocsp_cache_find(fr_tls_ocsp_cache_t *cache, REQUEST *request,
+				      OCSP_CERTID *certid, X509 *issuer_cert, X509 *client_cert)
+{
+	ocsp_cache_entry_t	*entry;
+	OCSP_RESPONSE		*resp;
+	uint8_t			*key;
+	uint8_t const		*p;
+	int			key_len;
+	time_t			now;
+
+	key_len = ocsp_cache_key(&key, certid);
+	if (key_len <= 0) {
+		RWDEBUG("Failed serialising CertID");
+		return NULL;
+	}
+
+	now = time(NULL);
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = ocsp_cache_entry_find(cache, key, key_len);
+	OPENSSL_free(key);
+	if (!entry) {
+		pthread_mutex_unlock(&cache->mutex);
+		RDEBUG2("No cached OCSP response found");
+		return NULL;
+	}
+
+	if (now >= entry->expires) {
+		ocsp_cache_remove(cache, entry);
+		pthread_mutex_unlock(&cache->mutex);
+		RDEBUG2("Cached OCSP response has expired");
+		return NULL;
+	}
+
+	if (cache->thread_running && !entry->refreshing && (now >= entry->prefetch)) {
+		ocsp_cache_refresh_t *refresh;
+
+		refresh = talloc_zero(cache, ocsp_cache_refresh_t);
+		if (refresh) {
+			talloc_set_destructor(refresh, _ocsp_cache_refresh_free);
+			refresh->issuer_cert = X509_dup(issuer_cert);
+			refresh->cert = X509_dup(client_cert);
+		}
+
+		if (!refresh || !refresh->issuer_cert || !refresh->cert) {
+			RWDEBUG("Failed queueing cached OCSP response for refresh");
+			talloc_free(refresh);
+		} else {
+			if (cache->refresh_tail) {
+				cache->refresh_tail->next = refresh;
+			} else {
+				cache->refresh_head = refresh;
+			}
+			cache->refresh_tail = refresh;
+			entry->refreshing = true;
+			pthread_cond_signal(&cache->cond);
+
+			RDEBUG2("Cached OCSP response expires in %u seconds, queued for refresh",
+				(unsigned int)(entry->expires - now));
+		}
+	}
+
+	if (entry != cache->head) {
+		ocsp_cache_unlink(cache, entry);
+		ocsp_cache_link_head(cache, entry);
+	}
+
+	p = entry->resp;
+	resp = d2i_OCSP_RESPONSE(NULL, &p, entry->resp_len);
+	pthread_mutex_unlock(&cache->mutex);
+
+	if (!resp) {
+		RWDEBUG("Failed parsing cached OCSP response");
+		return NULL;
+	}
+
+	return resp;
+}
+
+/** Retrieve a new response for a cached response which is about to expire
+ *
+ * @param[in] cache	the response belongs to.
+ * @param[in] refresh	the certificates the response is for.
+ */
+static void ocsp_cache_refresh(fr_tls_ocsp_cache_t *cache, ocsp_cache_refresh_t *refresh)
+{
+	fr_tls_ocsp_conf_t	*conf = cache->conf;
+	REQUEST			*request = NULL;	/* Log globally */
+	OCSP_CERTID		*certid;
+	OCSP_RESPONSE		*resp = NULL;
+	OCSP_BASICRESP		*bresp = NULL;
+	ASN1_GENERALIZEDTIME	*rev, *this_update, *next_update;
+	int			status, reason;
+	uint8_t			*key;
+	int			key_len;
+
+	certid = OCSP_cert_to_id(NULL, refresh->cert, refresh->issuer_cert);
+	if (!certid) goto error;
+
+	if (ocsp_response_fetch(&resp, &bresp, request, conf->store, certid, refresh->cert, conf) != OCSP_STATUS_OK) {
+		goto error;
+	}
+
+	if (!OCSP_resp_find_status(bresp, certid, &status, &reason, &rev, &this_update, &next_update)) {
+		ERROR("No status found in OCSP response");
+		goto error;
+	}
+
+	if (!OCSP_check_validity(this_update, next_update, OCSP_MAX_VALIDITY_PERIOD, -1)) {
+		RATE_LIMIT(ERROR("Delta +/- between OCSP response time and our time is greater than %i "
+				 "seconds.  Check servers are synchronised to a common time source",
+				 OCSP_MAX_VALIDITY_PERIOD));
+		goto error;
+	}
+
+	if (ocsp_cache_insert(cache, request, certid, resp, next_update) < 0) {
+	error:
+		/*
+		 *	Leave the existing response in place, it's
+		 *	still valid.  We'll try again when it's
+		 *	next used.
+		 */
+		if (certid && ((key_len = ocsp_cache_key(&key, certid)) > 0)) {
+			ocsp_cache_entry_t *entry;
+
+			pthread_mutex_lock(&cache->mutex);
+			entry = ocsp_cache_entry_find(cache, key, key_len);
+			if (entry) {
+				entry->refreshing = false;
+				entry->prefetch = time(NULL) + OCSP_CACHE_RETRY_INTERVAL;
+			}
+			pthread_mutex_unlock(&cache->mutex);
+			OPENSSL_free(key);
+		}
+		WARN("Failed refreshing cached OCSP response");
+	}
+
+	OCSP_CERTID_free(certid);
+	OCSP_BASICRESP_free(bresp);
+	OCSP_RESPONSE_free(resp);
+
+	/* Remove OpenSSL errors from queue, they're not associated with any request */
+	while (ERR_get_error());
+}
+
+/** Refreshes cached responses in the background
+ *
+ * @param[in] arg	the cache.
+ */
+static void *ocsp_cache_refresh_thread(void *arg)
+{
+	fr_tls_ocsp_cache_t	*cache = talloc_get_type_abort(arg, fr_tls_ocsp_cache_t);
+	ocsp_cache_refresh_t	*refresh;
+
+	pthread_mutex_lock(&cache->mutex);
+	for (;;) {
+		while (!cache->stop && !cache->refresh_head) pthread_cond_wait(&cache->cond, &cache->mutex);
+		if (cache->stop) break;
+
+		refresh = cache->refresh_head;
+		cache->refresh_head = refresh->next;
+		if (!cache->refresh_head) cache->refresh_tail = NULL;
+		pthread_mutex_unlock(&cache->mutex);
+
+		ocsp_cache_refresh(cache, refresh);
+
+		pthread_mutex_lock(&cache->mutex);
+		talloc_free(refresh);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	FR_TLS_REMOVE_THREAD_STATE();
+
+	return NULL;
+}
+
+static int _ocsp_cache_free(fr_tls_ocsp_cache_t *cache)
+{
+	if (cache->thread_running) {
+		pthread_mutex_lock(&cache->mutex);
+		cache->stop = true;
+		pthread_cond_signal(&cache->cond);
+		pthread_mutex_unlock(&cache->mutex);
+
+		pthread_join(cache->thread, NULL);
+	}
+
+	pthread_cond_destroy(&cache->cond);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate an in memory cache for OCSP responses
+ *
+ * If conf->cache_prefetch is set, also starts a thread to refresh cached
+ * responses before they expire.
+ *
+ * @param[in] ctx	to allocate the cache in.
+ * @param[in] conf	OCSP configuration.  Must outlive the cache.
+ * @return
+ *	- A new cache.
+ *	- NULL on error.
+ */
+fr_tls_ocsp_cache_t *tls_ocsp_cache_alloc(TALLOC_CTX *ctx, fr_tls_ocsp_conf_t *conf)
+{
+	fr_tls_ocsp_cache_t	*cache;
+	int			ret;
+
+	cache = talloc_zero(ctx, fr_tls_ocsp_cache_t);
+	if (!cache) {
+		ERROR("Out of memory");
+		return NULL;
+	}
+	cache->conf = conf;
+
+	cache->ht = fr_hash_table_create(cache, ocsp_cache_hash, ocsp_cache_cmp, NULL);
+	if (!cache->ht) {
+		ERROR("Failed creating OCSP cache");
+		talloc_free(cache);
+		return NULL;
+	}
+
+	pthread_mutex_init(&cache->mutex, NULL);
+	pthread_cond_init(&cache->cond, NULL);
+	talloc_set_destructor(cache, _ocsp_cache_free);
+
+	if (!conf->cache_prefetch) return cache;
+
+	ret = pthread_create(&cache->thread, NULL, ocsp_cache_refresh_thread, cache);
+	if (ret != 0) {
+		ERROR("Failed creating OCSP prefetch thread: %s", fr_syserror(ret));
+		talloc_free(cache);
+		return NULL;
+	}
+	cache->thread_running = true;
+
+	return cache;
+}
+
+/** Sends a OCSP request to a defined OCSP responder
+ *
+ */
+int tls_ocsp_check(REQUEST *request, SSL *ssl,
+		   X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
+		   fr_tls_ocsp_conf_t *conf, bool staple_response)
+{
+	OCSP_CERTID	*certid = NULL;
+	OCSP_RESPONSE	*resp = NULL;
+	OCSP_BASICRESP	*bresp = NULL;
+	long		this_fudge = OCSP_MAX_VALIDITY_PERIOD, this_max_age = -1;
+	BIO		*ssl_log = NULL;
+	ocsp_status_t   ocsp_status = OCSP_STATUS_FAILED;
+	int		status;
+	ASN1_GENERALIZEDTIME *rev, *this_update, *next_update;
+	int		reason;
+	struct timeval	now = { 0, 0 };
+	time_t		next;
+	bool		cached = false;
+	VALUE_PAIR	*vp;
+
+	if (conf->cache_server) switch (tls_cache_process(request, conf->cache_server,
+							       CACHE_ACTION_OCSP_READ)) {
+	case RLM_MODULE_REJECT:
+		REDEBUG("Told to force OCSP validation failure from cached response");
+		return OCSP_STATUS_FAILED;
+
+	case RLM_MODULE_OK:
+	case RLM_MODULE_UPDATED:
+	/*
+	 *	These are fine for OCSP too, we don't *expect* to always
+	 *	have a cached OCSP status.
+	 */
+	case RLM_MODULE_NOTFOUND:
+	case RLM_MODULE_NOOP:
+		break;
+
+	default:
+		RWDEBUG("Failed retrieving cached OCSP status");
+		break;
+	}
+
+	/*
+	 *	Allow us to cache the OCSP verified state externally
+	 */
+	vp = fr_pair_find_by_num(request->control, 0, PW_TLS_OCSP_CERT_VALID, TAG_ANY);
+	if (vp) switch (vp->vp_integer) {
+	case 0:	/* no */
+		RDEBUG2("Found &control:TLS-OCSP-Cert-Valid = no, forcing OCSP failure");
+		return OCSP_STATUS_FAILED;
+
+	case 1: /* yes */
+		RDEBUG2("Found &control:TLS-OCSP-Cert-Valid = yes, forcing OCSP success");
+
+		/*
+		 *	If this fails, and an OCSP stapled response is required,
+		 *	we need to run the full OCSP check.
+		 */
+		if (staple_response) {
+			vp = fr_pair_find_by_num(request->control, 0, PW_TLS_OCSP_RESPONSE, TAG_ANY);
+			if (!vp) {
+				RDEBUG2("No &control:TLS-OCSP-Response attribute found, performing full OCSP check");
+				break;
+			}
+			if (ocsp_staple_from_pair(request, ssl, vp) < 0) {
+				RWDEBUG("Failed setting OCSP staple response in SSL session");
+				return OCSP_STATUS_FAILED;
+			}
+		}
+
+		return OCSP_STATUS_OK;
+
+	case 2: /* skipped */
+		RDEBUG2("Found &control:TLS-OCSP-Cert-Valid = skipped, skipping OCSP check");
+		return conf->softfail ? OCSP_STATUS_OK : OCSP_STATUS_FAILED;
+
+	case 3: /* unknown */
+	default:
+		break;
+	}
+
+	/*
+	 *	Setup logging for this OCSP operation
+	 */
+	ssl_log = BIO_new(BIO_s_mem());
+	if (!ssl_log) {
+		REDEBUG("Failed creating log queue");
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+
+	certid = OCSP_cert_to_id(NULL, client_cert, issuer_cert);
+	if (!certid) {
+		REDEBUG("Failed creating CertID");
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+
+	/*
+	 *	Use a response from the in memory cache if
+	 *	we have one.  The responder's signature was
+	 *	verified when the response was cached.
+	 */
+	if (conf->cache) {
+		resp = ocsp_cache_find(conf->cache, request, certid, issuer_cert, client_cert);
+		if (resp) {
+			bresp = OCSP_response_get1_basic(resp);
+			if (!bresp) {
+				OCSP_RESPONSE_free(resp);
+				resp = NULL;
+			} else {
+				RDEBUG2("Using cached OCSP response");
+				cached = true;
+			}
+		}
+	}
+
+	/*
+	 *	Send OCSP Request and get OCSP Response
+	 */
+	if (!resp) {
+		ocsp_status = ocsp_response_fetch(&resp, &bresp, request, store, certid, client_cert, conf);
+		if (ocsp_status != OCSP_STATUS_OK) {
+			if (ocsp_status == OCSP_STATUS_SKIPPED) SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
+			goto finish;
+		}
+		ocsp_status = OCSP_STATUS_FAILED;
+	}
+
 	/*	Verify OCSP cert status */
-	if (!OCSP_resp_find_status(bresp, certid, (int *)&status, &reason, &rev, &this_update, &next_update)) {
+	if (!OCSP_resp_find_status(bresp, certid, &status, &reason, &rev, &this_update, &next_update)) {
 		REDEBUG("No Status found");
 		goto finish;
 	}
@@ -510,6 +1140,8 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		goto finish;
 	}
 
+	if (conf->cache && !cached) ocsp_cache_insert(conf->cache, request, certid, resp, next_update);
+
 	/*
 	 *	Print any messages we may have accumulated
 	 */
@@ -600,7 +1232,10 @@ finish:
 			 *	Set the stapled response for the current
 			 *	SSL session.
 			 */
-			if (ocsp_staple_from_pair(request, ssl, vp) < 0) return -1;
+			if (ocsp_staple_from_pair(request, ssl, vp) < 0) {
+				ocsp_status = OCSP_STATUS_FAILED;
+				goto done;
+			}
 			vp = NULL;	/* It's in the request, don't need to free it! */
 		}
 
@@ -612,7 +1247,7 @@ finish:
 
 	case OCSP_STATUS_SKIPPED:
 	skipped:
-		SSL_DRAIN_ERROR_QUEUE(RWDEBUG, "", ssl_log);
+		if (ssl_log) SSL_DRAIN_ERROR_QUEUE(RWDEBUG, "", ssl_log);
 		vp = pair_make_request("TLS-OCSP-Cert-Valid", NULL, T_OP_SET);
 		vp->vp_integer = 2;	/* skipped */
 		if (conf->softfail) {
@@ -632,7 +1267,7 @@ finish:
 		break;
 
 	default:
-		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
+		if (ssl_log) SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
 		vp = pair_make_request("TLS-OCSP-Cert-Valid", NULL, T_OP_SET);
 		vp->vp_integer = 0;	/* no */
 		REDEBUG("Failed to validate certificate");
@@ -650,14 +1285,11 @@ finish:
 		break;
 	}
 
+done:
 	/* Free OCSP Stuff */
-	OCSP_REQUEST_free(req);
+	OCSP_CERTID_free(certid);
 	OCSP_BASICRESP_free(bresp);
 	OCSP_RESPONSE_free(resp);
-	OPENSSL_free(host);
-	OPENSSL_free(port);
-	OPENSSL_free(path);
-	BIO_free_all(conn);
 	BIO_free(ssl_log);
 
 	return ocsp_status;
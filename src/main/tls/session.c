@@ -32,6 +32,10 @@
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/rad_assert.h>
 #include <openssl/x509v3.h>
+#include <openssl/sha.h>
+#ifdef SSL_MODE_ASYNC
+#  include <openssl/async.h>
+#endif
 
 /*
  *	For creating certificate attributes.
@@ -307,6 +311,14 @@ void tls_session_info_cb(SSL const *ssl, int where, int ret)
 	char const	*role, *state;
 	REQUEST		*request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
 
+#ifdef SSL_MODE_ASYNC
+	/*
+	 *	We're running on an async job's fibre, which
+	 *	has a small stack, so don't log.
+	 */
+	if (ASYNC_get_current_job()) return;
+#endif
+
 	if ((where & ~SSL_ST_MASK) & SSL_ST_CONNECT) {
 		role = "Client ";
 	} else if (((where & ~SSL_ST_MASK)) & SSL_ST_ACCEPT) {
@@ -832,10 +844,208 @@ void tls_session_msg_cb(int write_p, int msg_version, int content_type,
 		break;
 	}
 
+#ifdef SSL_MODE_ASYNC
+	if (ASYNC_get_current_job()) return;	/* Small stack, see tls_session_info_cb */
+#endif
+
 	session_msg_log(request, session);
 }
 
-/** Extract attributes from an X509 certificate
+/*
+ *	Cache of attributes decoded from certificates.
+ *
+ *	The same client and intermediate certificates are presented
+ *	over and over again, so we only decode each of them once.
+ *	Entries are indexed by the fingerprint of the certificate, and
+ *	whether it's the leaf, as that determines which attributes
+ *	are created.  The cache is shared by all workers.
+ */
+typedef struct tls_cert_attr_entry {
+	uint8_t			fingerprint[SHA256_DIGEST_LENGTH];	//!< Of the DER encoded certificate.
+	int			attr_index;	//!< 0 for the leaf certificate, 1 for issuers.
+	uint32_t		hash;		//!< Of the fingerprint.
+
+	VALUE_PAIR		*vps;		//!< Attributes decoded from the certificate.
+
+	struct tls_cert_attr_entry	*prev;	//!< Towards the most recently used entry.
+	struct tls_cert_attr_entry	*next;	//!< Towards the least recently used entry.
+} tls_cert_attr_entry_t;
+
+struct fr_tls_cert_attr_cache {
+	pthread_mutex_t		mutex;		//!< Protects everything below.
+	fr_hash_table_t		*ht;		//!< Entries indexed by fingerprint.
+	tls_cert_attr_entry_t	*head;		//!< Most recently used entry.
+	tls_cert_attr_entry_t	*tail;		//!< Least recently used entry.
+	uint32_t		num;		//!< Number of entries in the cache.
+	uint32_t		max;		//!< Maximum number of entries in the cache.
+};
+
+static uint32_t tls_cert_attr_entry_hash(void const *data)
+{
+	tls_cert_attr_entry_t const *entry = data;
+
+	return entry->hash;
+}
+
+static int tls_cert_attr_entry_cmp(void const *one, void const *two)
+{
+	tls_cert_attr_entry_t const *a = one;
+	tls_cert_attr_entry_t const *b = two;
+
+	if (a->attr_index != b->attr_index) return a->attr_index - b->attr_index;
+
+	return memcmp(a->fingerprint, b->fingerprint, sizeof(a->fingerprint));
+}
+
+static void tls_cert_attr_entry_unlink(fr_tls_cert_attr_cache_t *cache, tls_cert_attr_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void tls_cert_attr_entry_link_head(fr_tls_cert_attr_cache_t *cache, tls_cert_attr_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head) cache->head->prev = entry;
+	cache->head = entry;
+	if (!cache->tail) cache->tail = entry;
+}
+
+/** Retrieve a copy of the attributes decoded from a certificate
+ *
+ * @param[in] ctx		to allocate the copy in.
+ * @param[in] cache		to search in.
+ * @param[in] fingerprint	of the certificate.
+ * @param[in] attr_index	0 for the leaf certificate, 1 for issuers.
+ * @return
+ *	- A copy of the attributes.
+ *	- NULL if the certificate wasn't found.
+ */
+static VALUE_PAIR *tls_cert_attr_cache_find(TALLOC_CTX *ctx, fr_tls_cert_attr_cache_t *cache,
+					    uint8_t const *fingerprint, int attr_index)
+{
+	tls_cert_attr_entry_t	my_entry, *entry;
+	VALUE_PAIR		*vps = NULL;
+
+	memcpy(my_entry.fingerprint, fingerprint, sizeof(my_entry.fingerprint));
+	my_entry.attr_index = attr_index;
+	my_entry.hash = fr_hash(fingerprint, sizeof(my_entry.fingerprint));
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_hash_table_finddata(cache->ht, &my_entry);
+	if (entry) {
+		if (entry != cache->head) {
+			tls_cert_attr_entry_unlink(cache, entry);
+			tls_cert_attr_entry_link_head(cache, entry);
+		}
+		vps = fr_pair_list_copy(ctx, entry->vps);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return vps;
+}
+
+/** Add the attributes decoded from a certificate to the cache
+ *
+ * @param[in] cache		to insert into.
+ * @param[in] fingerprint	of the certificate.
+ * @param[in] attr_index	0 for the leaf certificate, 1 for issuers.
+ * @param[in] vps		to copy into the cache.
+ */
+static void tls_cert_attr_cache_insert(fr_tls_cert_attr_cache_t *cache,
+				       uint8_t const *fingerprint, int attr_index, VALUE_PAIR *vps)
+{
+	tls_cert_attr_entry_t	my_entry, *entry;
+
+	memcpy(my_entry.fingerprint, fingerprint, sizeof(my_entry.fingerprint));
+	my_entry.attr_index = attr_index;
+	my_entry.hash = fr_hash(fingerprint, sizeof(my_entry.fingerprint));
+
+	pthread_mutex_lock(&cache->mutex);
+
+	/*
+	 *	Another worker may have beaten us to it.
+	 */
+	if (fr_hash_table_finddata(cache->ht, &my_entry)) goto done;
+
+	/*
+	 *	Evict the least recently used entry.
+	 */
+	if (cache->num >= cache->max) {
+		entry = cache->tail;
+
+		tls_cert_attr_entry_unlink(cache, entry);
+		fr_hash_table_delete(cache->ht, entry);
+		cache->num--;
+		talloc_free(entry);
+	}
+
+	entry = talloc_zero(cache->ht, tls_cert_attr_entry_t);
+	if (!entry) goto done;
+
+	memcpy(entry->fingerprint, fingerprint, sizeof(entry->fingerprint));
+	entry->attr_index = attr_index;
+	entry->hash = my_entry.hash;
+	entry->vps = fr_pair_list_copy(entry, vps);
+
+	if (!entry->vps || !fr_hash_table_insert(cache->ht, entry)) {
+		talloc_free(entry);
+		goto done;
+	}
+	tls_cert_attr_entry_link_head(cache, entry);
+	cache->num++;
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+static int _tls_cert_attr_cache_free(fr_tls_cert_attr_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate a cache for attributes decoded from certificates
+ *
+ * @param[in] ctx	to allocate the cache in.
+ * @param[in] max	number of certificates to cache.
+ * @return
+ *	- A new cache.
+ *	- NULL on error.
+ */
+fr_tls_cert_attr_cache_t *tls_session_cert_attr_cache_alloc(TALLOC_CTX *ctx, uint32_t max)
+{
+	fr_tls_cert_attr_cache_t *cache;
+
+	MEM(cache = talloc_zero(ctx, fr_tls_cert_attr_cache_t));
+	cache->max = max;
+	cache->ht = fr_hash_table_create(cache, tls_cert_attr_entry_hash, tls_cert_attr_entry_cmp, NULL);
+	if (!cache->ht) {
+		ERROR("Failed creating certificate attribute cache");
+		talloc_free(cache);
+		return NULL;
+	}
+
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _tls_cert_attr_cache_free);
+
+	return cache;
+}
+
+/** Decode attributes from an X509 certificate
  *
  * @param cursor	to copy attributes to.
  * @param ctx		to allocate attributes in.
@@ -846,8 +1056,8 @@ void tls_session_msg_cb(int write_p, int msg_version, int content_type,
  *	- 0 on success.
  *	- < 0 on failure.
  */
-int tls_session_pairs_from_x509_cert(vp_cursor_t *cursor, TALLOC_CTX *ctx,
-				     tls_session_t *session, X509 *cert, int depth)
+static int tls_session_pairs_decode(vp_cursor_t *cursor, TALLOC_CTX *ctx,
+				    tls_session_t *session, X509 *cert, int depth)
 {
 	char		buffer[1024];
 	char		attribute[256];
@@ -1062,7 +1272,7 @@ do { \
 
 				value[len] = '\0';
 
-				vp = fr_pair_make(request, NULL, attribute, value, T_OP_ADD);
+				vp = fr_pair_make(ctx, NULL, attribute, value, T_OP_ADD);
 				if (!vp) {
 					RDEBUG3("Skipping: %s += '%s'", attribute, value);
 				} else {
@@ -1076,6 +1286,64 @@ do { \
 	return 0;
 }
 
+/** Extract attributes from an X509 certificate
+ *
+ * If the certificate has been seen before, the attributes are copied
+ * from the certificate attribute cache, instead of being decoded again.
+ *
+ * @param cursor	to copy attributes to.
+ * @param ctx		to allocate attributes in.
+ * @param session	current TLS session.
+ * @param cert		to validate.
+ * @param depth		the certificate is in the certificate chain (0 == leaf).
+ * @return
+ *	- 0 on success.
+ *	- < 0 on failure.
+ */
+int tls_session_pairs_from_x509_cert(vp_cursor_t *cursor, TALLOC_CTX *ctx,
+				     tls_session_t *session, X509 *cert, int depth)
+{
+	fr_tls_conf_t	*conf;
+	uint8_t		fingerprint[SHA256_DIGEST_LENGTH];
+	unsigned int	len = sizeof(fingerprint);
+	int		attr_index = (depth > 1) ? 1 : depth;
+	VALUE_PAIR	*vps = NULL;
+	vp_cursor_t	our_cursor;
+	REQUEST		*request;
+
+	/*
+	 *	Which attributes are created depends on whether
+	 *	we have an identity, so only cache the common
+	 *	case.
+	 */
+	conf = SSL_get_ex_data(session->ssl, FR_TLS_EX_INDEX_CONF);
+	if (!conf || !conf->cert_attr_cache || !SSL_get_ex_data(session->ssl, FR_TLS_EX_INDEX_IDENTITY) ||
+	    (X509_digest(cert, EVP_sha256(), fingerprint, &len) != 1)) {
+		return tls_session_pairs_decode(cursor, ctx, session, cert, depth);
+	}
+
+	request = (REQUEST *)SSL_get_ex_data(session->ssl, FR_TLS_EX_INDEX_REQUEST);
+	rad_assert(request != NULL);
+
+	vps = tls_cert_attr_cache_find(ctx, conf->cert_attr_cache, fingerprint, attr_index);
+	if (vps) {
+		RDEBUG2("Using cached attributes for certificate");
+		fr_pair_cursor_merge(cursor, vps);
+		return 0;
+	}
+
+	fr_pair_cursor_init(&our_cursor, &vps);
+	if (tls_session_pairs_decode(&our_cursor, ctx, session, cert, depth) < 0) {
+		fr_pair_list_free(&vps);
+		return -1;
+	}
+
+	if (vps) tls_cert_attr_cache_insert(conf->cert_attr_cache, fingerprint, attr_index, vps);
+	fr_pair_cursor_merge(cursor, vps);
+
+	return 0;
+}
+
 /** Decrypt application data
  *
  * @note Handshake must have completed before this function may be called.
@@ -1226,11 +1494,17 @@ int tls_session_handshake_alert(UNUSED REQUEST *request, tls_session_t *session,
  * Advance the TLS handshake by feeding OpenSSL data from dirty_in,
  * and reading data from OpenSSL into dirty_out.
  *
+ * If the handshake pauses whilst an async engine performs a private key
+ * operation, this function should be called again (with no new data in
+ * dirty_in) once one of the fds returned by SSL_get_all_async_fds becomes
+ * readable.
+ *
  * @param request The current request.
  * @param session The current TLS session.
  * @return
  *	- 0 on error.
  *	- 1 on success.
+ *	- 2 if the handshake is waiting on an async job.
  */
 int tls_session_handshake(REQUEST *request, tls_session_t *session)
 {
@@ -1291,6 +1565,12 @@ int tls_session_handshake(REQUEST *request, tls_session_t *session)
 		session->clean_out.used += ret;
 		return 1;
 	}
+#ifdef SSL_MODE_ASYNC
+	if (SSL_get_error(session->ssl, ret) == SSL_ERROR_WANT_ASYNC) {
+		RDEBUG2("TLS handshake waiting on async job");
+		return 2;
+	}
+#endif
 	if (!tls_log_io_error(request, session, ret, "Failed in SSL_read")) return 0;
 
 	/*
@@ -1358,6 +1638,16 @@ int tls_session_handshake(REQUEST *request, tls_session_t *session)
 		 *	Session was resumed, add attribute to mark it as such.
 		 */
 		if (SSL_session_reused(session->ssl)) {
+			/*
+			 *	Sessions resumed from a ticket haven't
+			 *	been through certificate validation or
+			 *	OCSP checks since the ticket was issued.
+			 */
+			if (session->ticket_decrypted && (tls_validate_client_cert_chain(session->ssl) != 1)) {
+				REDEBUG("Validation failed for session resumed from ticket");
+				return 0;
+			}
+
 			/*
 			 *	Mark the request as resumed.
 			 */
@@ -1688,7 +1978,9 @@ tls_session_t *tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *conf, REQ
 		session->mtu = vp->vp_integer;
 	}
 
-	if (conf->session_cache_server) session->allow_session_resumption = true; /* otherwise it's false */
+	if (conf->session_cache_server || conf->session_cache || conf->session_ticket_keys) {
+		session->allow_session_resumption = true; /* otherwise it's false */
+	}
 
 	return session;
 }
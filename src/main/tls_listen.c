@@ -138,6 +138,14 @@ static int tls_socket_recv(rad_listen_t *listener)
 
 		SSL_set_ex_data(sock->tls_session->ssl, FR_TLS_EX_INDEX_REQUEST, (void *)request);
 
+#ifdef SSL_MODE_ASYNC
+		/*
+		 *	We can't wait for async jobs here, so
+		 *	run them to completion.
+		 */
+		SSL_clear_mode(sock->tls_session->ssl, SSL_MODE_ASYNC);
+#endif
+
 		doing_init = true;
 	}
 
@@ -682,6 +682,10 @@ static unlang_action_t unlang_module_call(REQUEST *request, unlang_stack_t *stac
 	unlang_module_call_t		*sp;
 	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
 	unlang_t			*instruction = frame->instruction;
+	fr_profile_call_t		call;
+#ifdef WITH_STATS
+	struct timeval			end;
+#endif
 
 	/*
 	 *	Process a stand-alone child, and fall through
@@ -712,10 +716,39 @@ static unlang_action_t unlang_module_call(REQUEST *request, unlang_stack_t *stac
 	 */
 	request->module = sp->module_instance->name;
 
+	/*
+	 *	The statistics and the profiler share one
+	 *	set of timestamps.
+	 */
+#ifdef WITH_STATS
+	fr_profile_call_start(&call, true);
+#else
+	fr_profile_call_start(&call, false);
+#endif
+
 	safe_lock(sp->module_instance);
 	request->rcode = sp->method(sp->module_instance->data, frame->modcall.thread, request);
 	safe_unlock(sp->module_instance);
 
+	/*
+	 *	If the module yielded, the timing is carried in the
+	 *	resumption frame until the call completes.
+	 */
+	if ((request->rcode == RLM_MODULE_YIELD) && (frame->instruction->type == UNLANG_TYPE_RESUME)) {
+		unlang_resumption_t *mr = unlang_generic_to_resumption(frame->instruction);
+
+		mr->profile = call;
+		fr_profile_call_yield(&mr->profile);
+	} else {
+#ifdef WITH_STATS
+		fr_profile_call_end(request, FR_PROFILE_MODULE, sp->module_instance->name, &call, &end);
+		fr_stats_local(&sp->module_instance->stats)->total_requests++;
+		fr_stats_latency(&sp->module_instance->stats, &call.start, &end);
+#else
+		fr_profile_call_end(request, FR_PROFILE_MODULE, sp->module_instance->name, &call, NULL);
+#endif
+	}
+
 	request->module = NULL;
 
 	/*
@@ -854,6 +887,9 @@ static unlang_action_t unlang_resumption(REQUEST *request, unlang_stack_t *stack
 	unlang_resumption_t	*mr = unlang_generic_to_resumption(instruction);
 	unlang_module_call_t	*sp;
 	void 			*mutable;
+#ifdef WITH_STATS
+	struct timeval		end;
+#endif
 
 	sp = &mr->module;
 
@@ -863,10 +899,28 @@ static unlang_action_t unlang_resumption(REQUEST *request, unlang_stack_t *stack
 
 	memcpy(&mutable, &mr->ctx, sizeof(mutable));
 
+	fr_profile_call_resume(&mr->profile);
+
 	safe_lock(sp->module_instance);
 	*presult = mr->callback(request, mr->module.module_instance->data, mr->thread, mutable);
 	safe_unlock(sp->module_instance);
 
+	if (*presult == RLM_MODULE_YIELD) {
+		fr_profile_call_yield(&mr->profile);
+	} else {
+#ifdef WITH_STATS
+		/*
+		 *	One sample per call, covering everything
+		 *	from the first call to the final resume.
+		 */
+		fr_profile_call_end(request, FR_PROFILE_MODULE, sp->module_instance->name, &mr->profile, &end);
+		fr_stats_local(&sp->module_instance->stats)->total_requests++;
+		fr_stats_latency(&sp->module_instance->stats, &mr->profile.start, &end);
+#else
+		fr_profile_call_end(request, FR_PROFILE_MODULE, sp->module_instance->name, &mr->profile, NULL);
+#endif
+	}
+
 	RDEBUG2("%s (%s)", instruction->name ? instruction->name : "",
 		fr_int2str(mod_rcode_table, *presult, "<invalid>"));
 
@@ -1354,6 +1408,24 @@ static void unlang_event_fd_handler(UNUSED fr_event_list_t *el, int fd, void *ct
 	ev->fd_callback(ev->request, mutable_inst, ev->thread, mutable_ctx, fd);
 }
 
+/** Return the module call which is running in the current frame
+ *
+ * Modules may add events and yield either from their original method,
+ * or from a resumption callback, in which case the frame holds a
+ * resumption wrapping the original module call.
+ *
+ * @param[in] frame	at the top of the stack.
+ * @return the module call.
+ */
+static unlang_module_call_t *unlang_frame_module_call(unlang_stack_frame_t *frame)
+{
+	if (frame->instruction->type == UNLANG_TYPE_RESUME) {
+		return &unlang_generic_to_resumption(frame->instruction)->module;
+	}
+
+	return unlang_generic_to_module_call(frame->instruction);
+}
+
 /** Set a timeout for the request.
  *
  * Used when a module needs wait for an event.  Typically the callback is set, and then the
@@ -1381,8 +1453,7 @@ int unlang_event_timeout_add(REQUEST *request, fr_unlang_timeout_callback_t call
 
 	frame = &stack->frame[stack->depth];
 
-	rad_assert(frame->instruction->type == UNLANG_TYPE_MODULE_CALL);
-	sp = unlang_generic_to_module_call(frame->instruction);
+	sp = unlang_frame_module_call(frame);
 
 	ev = talloc_zero(request, unlang_event_t);
 	if (!ev) return -1;
@@ -1436,8 +1507,7 @@ int unlang_event_fd_readable_add(REQUEST *request, fr_unlang_fd_callback_t callb
 
 	frame = &stack->frame[stack->depth];
 
-	rad_assert(frame->instruction->type == UNLANG_TYPE_MODULE_CALL);
-	sp = unlang_generic_to_module_call(frame->instruction);
+	sp = unlang_frame_module_call(frame);
 
 	ev = talloc_zero(request, unlang_event_t);
 	if (!ev) return -1;
@@ -1542,6 +1612,8 @@ void unlang_action(REQUEST *request, fr_state_action_t action)
 }
 
 /** Yield a request
+ *
+ * May also be called from a resumption callback, to wait for another event.
  *
  * @param[in] request		The current request.
  * @param[in] callback		to call on unlang_resumable().
@@ -1561,7 +1633,19 @@ rlm_rcode_t unlang_yield(REQUEST *request, fr_unlang_resume_t callback,
 
 	frame = &stack->frame[stack->depth];
 
-	rad_assert(frame->instruction->type == UNLANG_TYPE_MODULE_CALL);
+	/*
+	 *	Yielding again from a resumption callback,
+	 *	just update the resumption point.
+	 */
+	if (frame->instruction->type == UNLANG_TYPE_RESUME) {
+		mr = unlang_generic_to_resumption(frame->instruction);
+		mr->callback = callback;
+		mr->action_callback = action_callback;
+		mr->ctx = ctx;
+
+		return RLM_MODULE_YIELD;
+	}
+
 	sp = unlang_generic_to_module_call(frame->instruction);
 
 	mr = talloc(request, unlang_resumption_t);
@@ -1574,6 +1658,8 @@ rlm_rcode_t unlang_yield(REQUEST *request, fr_unlang_resume_t callback,
 	mr->action_callback = action_callback;
 	mr->thread = module_thread_instance_find(sp->module_instance);
 	mr->ctx = ctx;
+	mr->profile.active = false;
+	timerclear(&mr->profile.start);
 
 	frame->instruction = unlang_resumption_to_generic(mr);
 
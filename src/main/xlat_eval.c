@@ -28,6 +28,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/parser.h>
+#include <freeradius-devel/profile.h>
 #include <freeradius-devel/rad_assert.h>
 
 #include <ctype.h>
@@ -330,6 +331,7 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 	ssize_t rcode;
 	char *str = NULL, *child;
 	char const *p;
+	fr_profile_call_t call;
 
 	XLAT_DEBUG("%.*sxlat aprint %d %s", lvl, xlat_spaces, node->type, node->fmt);
 
@@ -478,7 +480,9 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 			str = talloc_array(ctx, char, node->xlat->buf_len);
 			str[0] = '\0';	/* Be sure the string is \0 terminated */
 		}
+		fr_profile_call_start(&call, false);
 		rcode = node->xlat->func(ctx, &str, node->xlat->buf_len, node->xlat->mod_inst, NULL, request, NULL);
+		fr_profile_call_end(request, FR_PROFILE_XLAT, node->xlat->name, &call, NULL);
 		if (rcode < 0) {
 			talloc_free(str);
 			return NULL;
@@ -556,7 +560,9 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 			str = talloc_array(ctx, char, node->xlat->buf_len);
 			str[0] = '\0';	/* Be sure the string is \0 terminated */
 		}
+		fr_profile_call_start(&call, false);
 		rcode = node->xlat->func(ctx, &str, node->xlat->buf_len, node->xlat->mod_inst, NULL, request, child);
+		fr_profile_call_end(request, FR_PROFILE_XLAT, node->xlat->name, &call, NULL);
 		talloc_free(child);
 		if (rcode < 0) {
 			talloc_free(str);
@@ -41,6 +41,7 @@ RCSID("$Id$")
 #include <pthread.h>
 
 #include <fcntl.h>
+#include <poll.h>
 
 #define USEC (1000000)
 
@@ -48,6 +49,7 @@ static FR_NAME_NUMBER state_names[] = {
 	{ "unopened", STATE_UNOPENED },
 	{ "unlocked", STATE_UNLOCKED },
 	{ "processing", STATE_PROCESSING },
+	{ "draining", STATE_DRAINING },
 
 	{ "header", STATE_HEADER },
 	{ "vps", STATE_VPS },
@@ -59,115 +61,357 @@ static FR_NAME_NUMBER state_names[] = {
 	{ NULL, 0 }
 };
 
+/** Sent from the master to the reader thread when a record completes
+ *
+ */
+typedef struct detail_ack_t {
+	uint32_t		id;		//!< Of the packet.
+	detail_entry_state_t	state;		//!< STATE_REPLIED or STATE_NO_REPLY.
+	int			rtt;		//!< In microseconds, or -1 if unknown.
+} detail_ack_t;
+
+/** Contents of the index file
+ *
+ */
+typedef struct detail_index_t {
+	uint64_t		inode;		//!< Of the work file the offset applies to.
+	uint64_t		offset;		//!< Offset past the last contiguous completed record.
+} detail_index_t;
+
+/** The nth oldest record in the window
+ *
+ */
+#define DETAIL_ENTRY(_data, _n) (&(_data)->entries[((_data)->head + (_n)) % (_data)->max_outstanding])
+
+/*
+ *	Recover the counter value we encoded in the packet's
+ *	ID, ports and destination IP.
+ */
+static uint32_t detail_packet_id(RADIUS_PACKET const *packet)
+{
+	return (packet->id & 0xff) |
+	       (((packet->src_port - 1024) & 0xff) << 8) |
+	       (((packet->dst_port - 1024) & 0xff) << 16) |
+	       ((ntohl(packet->dst_ipaddr.ipaddr.ip4addr.s_addr) & 0xff) << 24);
+}
 
 /*
- *	If we're limiting outstanding packets, then mark the response
- *	as being sent.
+ *	Tell the reader thread that a record has completed.
  */
 static int detail_send(rad_listen_t *listener, REQUEST *request)
 {
-	char c = 0;
+	detail_ack_t ack;
 	listen_detail_t *data = listener->data;
 
 	rad_assert(request->listener == listener);
 	rad_assert(listener->send == detail_send);
 
+	memset(&ack, 0, sizeof(ack));
+	ack.id = detail_packet_id(request->packet);
+
 	/*
 	 *	This request timed out.  Remember that, and tell the
 	 *	caller it's OK to read more "detail" file stuff.
 	 */
 	if (request->reply->code == 0) {
-		data->delay_time = data->retry_interval * USEC;
-		data->signal = 1;
-		data->entry_state = STATE_NO_REPLY;
+		ack.state = STATE_NO_REPLY;
+		ack.rtt = -1;
 
 		RDEBUG("detail (%s): No response to request.  Will retry in %d seconds",
 		       data->name, data->retry_interval);
 	} else {
-		int rtt;
 		struct timeval now;
-		/*
-		 *	We call gettimeofday a lot.  But it should be OK,
-		 *	because there's nothing else to do.
-		 */
+
 		gettimeofday(&now, NULL);
 
-		/*
-		 *	If we haven't sent a packet in the last second, reset
-		 *	the RTT.
-		 */
-		now.tv_sec -= 1;
-		if (fr_timeval_cmp(&data->last_packet, &now) < 0) {
-			data->has_rtt = false;
+		ack.state = STATE_REPLIED;
+		ack.rtt = now.tv_sec - request->packet->timestamp.tv_sec;
+		ack.rtt *= USEC;
+		ack.rtt += now.tv_usec;
+		ack.rtt -= request->packet->timestamp.tv_usec;
+	}
+
+	/*
+	 *	Writes smaller than PIPE_BUF are atomic, so
+	 *	workers can't interleave their acks.
+	 */
+	if (write(data->child_pipe[1], &ack, sizeof(ack)) < 0) {
+		RERROR("detail (%s): Failed writing ack to reader thread: %s", data->name, fr_syserror(errno));
+	}
+
+	return 0;
+}
+
+/*
+ *	Update the RTT estimate, and the delay we use to enforce the
+ *	load factor when only one record may be outstanding.
+ */
+static void detail_rtt_update(listen_detail_t *data, int rtt)
+{
+	struct timeval now;
+
+	/*
+	 *	We call gettimeofday a lot.  But it should be OK,
+	 *	because there's nothing else to do.
+	 */
+	gettimeofday(&now, NULL);
+
+	/*
+	 *	If we haven't sent a packet in the last second, reset
+	 *	the RTT.
+	 */
+	now.tv_sec -= 1;
+	if (fr_timeval_cmp(&data->last_packet, &now) < 0) {
+		data->has_rtt = false;
+	}
+	now.tv_sec += 1;
+
+	/*
+	 *	Only the reader thread processes acks, so it's safe
+	 *	to update some entries in the detail structure.
+	 *
+	 *	We keep smoothed round trip time (SRTT), but not round
+	 *	trip timeout (RTO).  We use SRTT to calculate a rough
+	 *	load factor.
+	 *
+	 *	If we're proxying, the RTT is our processing time,
+	 *	plus the network delay there and back, plus the time
+	 *	on the other end to process the packet.  Ideally, we
+	 *	should remove the network delays from the RTT, but we
+	 *	don't know what they are.
+	 *
+	 *	So, to be safe, we over-estimate the total cost of
+	 *	processing the packet.
+	 */
+	if (!data->has_rtt) {
+		data->has_rtt = true;
+		data->srtt = rtt;
+		data->rttvar = rtt / 2;
+
+	} else {
+		data->rttvar -= data->rttvar >> 2;
+		data->rttvar += (data->srtt - rtt);
+		data->srtt -= data->srtt >> 3;
+		data->srtt += rtt >> 3;
+	}
+
+	/*
+	 *	Calculate the time we wait before sending the next
+	 *	packet.
+	 *
+	 *	rtt / (rtt + delay) = load_factor / 100
+	 */
+	data->delay_time = (data->srtt * (100 - data->load_factor)) / (data->load_factor);
+
+	/*
+	 *	Cap delay at no less than 4 packets/s.  If the
+	 *	end system can't handle this, then it's very
+	 *	broken.
+	 */
+	if (data->delay_time > (USEC / 4)) data->delay_time= USEC / 4;
+
+	data->last_packet = now;
+}
+
+/*
+ *	Grow the window by one record each time a full window of
+ *	records completes under the latency target, and shrink it
+ *	by a quarter when they don't.
+ */
+static void detail_window_update(listen_detail_t *data)
+{
+	uint32_t shrink;
+
+	if (!data->latency_target) return;
+
+	if (++data->window_acks < data->window) return;
+	data->window_acks = 0;
+
+	if (data->srtt < (int) (data->latency_target * 1000)) {
+		if (data->window < data->max_outstanding) data->window++;
+		return;
+	}
+
+	shrink = data->window / 4;
+	if (!shrink) shrink = 1;
+	if (data->window > shrink) data->window -= shrink;
+
+	DEBUG3("detail (%s): SRTT %d.%06d sec is above target, window is now %u",
+	       data->name, data->srtt / USEC, data->srtt % USEC, data->window);
+}
+
+/*
+ *	Mark a record as done in the detail file, so it's skipped if
+ *	the file is read again.
+ */
+static void detail_mark_done(listen_detail_t *data, detail_entry_t *entry)
+{
+	rad_assert(data->fp != NULL);
+
+	if (entry->binary) {
+		uint8_t flags = DETAIL_BINARY_FLAG_DONE;
+
+		if (fseek(data->fp, entry->timestamp_offset + DETAIL_BINARY_FLAGS_OFFSET, SEEK_SET) < 0) {
+			WARN("detail (%s): Failed seeking to record flags: %s",
+			     data->name, fr_syserror(errno));
+		} else if (fwrite(&flags, 1, 1, data->fp) < 1) {
+			WARN("detail (%s): Failed marking request as done: %s",
+			     data->name, fr_syserror(errno));
+		} else if (fflush(data->fp) != 0) {
+			WARN("detail (%s): Failed flushing marked detail file to disk: %s",
+			     data->name, fr_syserror(errno));
 		}
-		now.tv_sec += 1;
+	} else if (fseek(data->fp, entry->timestamp_offset, SEEK_SET) < 0) {
+		WARN("detail (%s): Failed seeking to timestamp offset: %s",
+		     data->name, fr_syserror(errno));
+	} else if (fwrite("\tDone", 1, 5, data->fp) < 5) {
+		WARN("detail (%s): Failed marking request as done: %s",
+		     data->name, fr_syserror(errno));
+	} else if (fflush(data->fp) != 0) {
+		WARN("detail (%s): Failed flushing marked detail file to disk: %s",
+		     data->name, fr_syserror(errno));
+	}
 
-		/*
-		 *	Only one detail packet may be outstanding at a time,
-		 *	so it's safe to update some entries in the detail
-		 *	structure.
-		 *
-		 *	We keep smoothed round trip time (SRTT), but not round
-		 *	trip timeout (RTO).  We use SRTT to calculate a rough
-		 *	load factor.
-		 */
-		rtt = now.tv_sec - request->packet->timestamp.tv_sec;
-		rtt *= USEC;
-		rtt += now.tv_usec;
-		rtt -= request->packet->timestamp.tv_usec;
+	if (fseek(data->fp, data->offset, SEEK_SET) < 0) {
+		WARN("detail (%s): Failed seeking to next detail request: %s",
+		     data->name, fr_syserror(errno));
+	}
+}
 
-		/*
-		 *	If we're proxying, the RTT is our processing time,
-		 *	plus the network delay there and back, plus the time
-		 *	on the other end to process the packet.  Ideally, we
-		 *	should remove the network delays from the RTT, but we
-		 *	don't know what they are.
-		 *
-		 *	So, to be safe, we over-estimate the total cost of
-		 *	processing the packet.
-		 */
-		if (!data->has_rtt) {
-			data->has_rtt = true;
-			data->srtt = rtt;
-			data->rttvar = rtt / 2;
+/*
+ *	Record how far through the work file we've got, so that a
+ *	restarted reader doesn't have to re-read completed records.
+ */
+static void detail_index_update(listen_detail_t *data)
+{
+	detail_index_t idx;
 
-		} else {
-			data->rttvar -= data->rttvar >> 2;
-			data->rttvar += (data->srtt - rtt);
-			data->srtt -= data->srtt >> 3;
-			data->srtt += rtt >> 3;
+	if (data->index_fd < 0) return;
+
+	idx.inode = data->work_inode;
+	idx.offset = data->done_offset;
+
+	if (pwrite(data->index_fd, &idx, sizeof(idx), 0) != sizeof(idx)) {
+		WARN("detail (%s): Failed updating index file %s: %s",
+		     data->name, data->filename_index, fr_syserror(errno));
+	}
+}
+
+/*
+ *	Open the index file, and skip the records it says have
+ *	already been completed.
+ */
+static void detail_index_open(listen_detail_t *data)
+{
+	detail_index_t	idx;
+	struct stat	st;
+
+	rad_assert(data->index_fd < 0);
+
+	if (fstat(data->work_fd, &st) < 0) {
+		WARN("detail (%s): Failed to stat detail file: %s", data->name, fr_syserror(errno));
+		return;
+	}
+	data->work_inode = st.st_ino;
+
+	data->index_fd = open(data->filename_index, O_RDWR | O_CREAT, 0600);
+	if (data->index_fd < 0) {
+		WARN("detail (%s): Failed opening index file %s: %s",
+		     data->name, data->filename_index, fr_syserror(errno));
+		return;
+	}
+
+	if (pread(data->index_fd, &idx, sizeof(idx), 0) != sizeof(idx)) return;
+
+	/*
+	 *	Left over from a different work file.
+	 */
+	if ((idx.inode != (uint64_t) st.st_ino) || (idx.offset > (uint64_t) st.st_size)) {
+		DEBUG2("detail (%s): Ignoring stale index file %s", data->name, data->filename_index);
+		return;
+	}
+
+	if (fseek(data->fp, idx.offset, SEEK_SET) < 0) {
+		WARN("detail (%s): Failed seeking to offset %" PRIu64 " from index file: %s",
+		     data->name, idx.offset, fr_syserror(errno));
+		return;
+	}
+
+	DEBUG("detail (%s): Resuming %s at offset %" PRIu64, data->name, data->filename_work, idx.offset);
+	data->offset = data->last_offset = data->done_offset = idx.offset;
+}
+
+/*
+ *	Process an ack from the master.  Records may complete in any
+ *	order, but they're only retired (and done_offset advanced)
+ *	once every record before them has completed.
+ */
+static void detail_ack(listen_detail_t *data, detail_ack_t const *ack)
+{
+	detail_entry_t	*entry = NULL;
+	int		i;
+
+	for (i = 0; i < data->outstanding; i++) {
+		detail_entry_t *e = DETAIL_ENTRY(data, i);
+
+		if ((e->state == STATE_RUNNING) && (e->id == ack->id)) {
+			entry = e;
+			break;
 		}
+	}
 
-		/*
-		 *	Calculate the time we wait before sending the next
-		 *	packet.
-		 *
-		 *	rtt / (rtt + delay) = load_factor / 100
-		 */
-		data->delay_time = (data->srtt * (100 - data->load_factor)) / (data->load_factor);
+	/*
+	 *	The record was retransmitted, and this is the
+	 *	answer to the old packet.
+	 */
+	if (!entry) {
+		DEBUG3("detail (%s): Ignoring ack for packet %u which is no longer outstanding",
+		       data->name, ack->id);
+		return;
+	}
+
+	if (ack->state == STATE_NO_REPLY) {
+		entry->state = STATE_NO_REPLY;
+		entry->running = time(NULL);
 
 		/*
-		 *	Cap delay at no less than 4 packets/s.  If the
-		 *	end system can't handle this, then it's very
-		 *	broken.
+		 *	Back off, the server is probably struggling.
 		 */
-		if (data->delay_time > (USEC / 4)) data->delay_time= USEC / 4;
+		if (data->latency_target && (data->window > 1)) {
+			data->window /= 2;
+			data->window_acks = 0;
+		}
+		return;
+	}
 
-		RDEBUG3("detail (%s): Received response for request %" PRIu64 ".  "
-			"Will read the next packet in %d seconds",
-			data->name, request->number, data->delay_time / USEC);
+	entry->state = STATE_REPLIED;
 
-		data->last_packet = now;
-		data->signal = 1;
-		data->entry_state = STATE_REPLIED;
-		data->counter++;
+	if (ack->rtt >= 0) {
+		detail_rtt_update(data, ack->rtt);
+		detail_window_update(data);
+
+		DEBUG3("detail (%s): Received response for record %u.  "
+		       "Will read the next packet in %d seconds",
+		       data->name, ack->id, data->delay_time / USEC);
 	}
 
-	if (write(data->child_pipe[1], &c, 1) < 0) {
-		RERROR("detail (%s): Failed writing ack to reader thread: %s", data->name, fr_syserror(errno));
+	if (data->track) detail_mark_done(data, entry);
+
+	if (DETAIL_ENTRY(data, 0)->state != STATE_REPLIED) return;
+
+	while (data->outstanding > 0) {
+		entry = DETAIL_ENTRY(data, 0);
+		if (entry->state != STATE_REPLIED) break;
+
+		data->done_offset = entry->end_offset;
+		fr_pair_list_free(&entry->vps);
+		entry->state = STATE_HEADER;
+
+		data->head = (data->head + 1) % data->max_outstanding;
+		data->outstanding--;
 	}
 
-	return 0;
+	if (data->track) detail_index_update(data);
 }
 
 
@@ -285,6 +529,7 @@ static int detail_open(rad_listen_t *this)
 	data->client_ip.af = AF_UNSPEC;
 	data->timestamp = 0;
 	data->offset = data->last_offset = data->timestamp_offset = 0;
+	data->done_offset = 0;
 	data->packets = 0;
 	data->tries = 0;
 	data->done_entry = false;
@@ -310,7 +555,7 @@ static int detail_open(rad_listen_t *this)
  */
 static int detail_recv(rad_listen_t *listener)
 {
-	char c = 0;
+	detail_ack_t ack;
 	ssize_t rcode;
 	RADIUS_PACKET *packet;
 	listen_detail_t *data = listener->data;
@@ -324,6 +569,10 @@ static int detail_recv(rad_listen_t *listener)
 
 	rad_assert(packet != NULL);
 
+	memset(&ack, 0, sizeof(ack));
+	ack.id = detail_packet_id(packet);
+	ack.rtt = -1;
+
 	switch (packet->code) {
 	case PW_CODE_ACCOUNTING_REQUEST:
 		fun = rad_accounting;
@@ -335,16 +584,16 @@ static int detail_recv(rad_listen_t *listener)
 		break;
 
 	default:
-		data->entry_state = STATE_REPLIED;
+		ack.state = STATE_REPLIED;
 		goto signal_thread;
 	}
 
 	if (!request_receive(NULL, listener, packet, &data->detail_client, fun)) {
-		data->entry_state = STATE_NO_REPLY;	/* try again later */
+		ack.state = STATE_NO_REPLY;	/* try again later */
 
 	signal_thread:
 		fr_radius_free(&packet);
-		if (write(data->child_pipe[1], &c, 1) < 0) {
+		if (write(data->child_pipe[1], &ack, sizeof(ack)) < 0) {
 			ERROR("detail (%s): Failed writing ack to reader thread: %s", data->name,
 			      fr_syserror(errno));
 		}
@@ -356,15 +605,97 @@ static int detail_recv(rad_listen_t *listener)
 	return 0;
 }
 
-static RADIUS_PACKET *detail_poll(rad_listen_t *listener)
+/*
+ *	Read a binary record.  The whole record is read at once,
+ *	so it's always either queued or skipped.
+ */
+static int detail_read_binary(listen_detail_t *data)
+{
+	detail_binary_hdr_t	hdr;
+	uint8_t			buffer[MAX_PACKET_LEN];
+	off_t			start;
+	VALUE_PAIR		*vp;
+	bool			corrupt = false;
+
+	start = ftell(data->fp);
+
+	switch (detail_binary_read(data->fp, &hdr, buffer, sizeof(buffer))) {
+	case 1:
+		break;
+
+	/*
+	 *	The record was bad, but we know where the next one
+	 *	starts.  Skip it rather than abandoning the file.
+	 */
+	case -2:
+		WARN("detail (%s): Skipping record at offset %" PRIu64 ": %s",
+		     data->name, (uint64_t) start, fr_strerror());
+		corrupt = true;
+		break;
+
+	case 0:
+		fr_strerror_printf("Truncated record");
+		/* FALL-THROUGH */
+
+	default:
+		ERROR("detail (%s): %s at offset %" PRIu64 ": treating it as EOF for detail file %s",
+		      data->name, fr_strerror(), (uint64_t) start, data->filename_work);
+		return -1;
+	}
+
+	data->last_offset = start;
+	data->offset = ftell(data->fp);
+	data->binary = true;
+	data->entry_state = STATE_QUEUED;
+	data->packets++;
+
+	if (corrupt) {
+		data->timestamp = 0;
+		data->timestamp_offset = start;
+		data->done_entry = true;
+		return 0;
+	}
+
+	data->timestamp = ntohl(hdr.timestamp);
+	data->timestamp_offset = start;
+	data->done_entry = ((hdr.flags & DETAIL_BINARY_FLAG_DONE) != 0);
+
+	detail_binary_ipaddr(&data->client_ip, hdr.client_af, hdr.client_ipaddr);
+
+	if (data->done_entry) return 0;
+
+	rad_assert(data->vps == NULL);
+	if (detail_binary_decode(data, &data->vps, &hdr, buffer) < 0) {
+		WARN("detail (%s): Skipping record at offset %" PRIu64 " which failed decoding: %s",
+		     data->name, (uint64_t) start, fr_strerror());
+		data->done_entry = true;
+		return 0;
+	}
+
+	vp = fr_pair_afrom_num(data, 0, PW_PACKET_ORIGINAL_TIMESTAMP);
+	if (vp) {
+		vp->vp_date = (uint32_t) data->timestamp;
+		vp->type = VT_DATA;
+		fr_pair_add(&data->vps, vp);
+	}
+
+	return 0;
+}
+
+/*
+ *	Read the next record from the detail file into the window.
+ */
+static detail_entry_t *detail_read(rad_listen_t *listener)
 {
 	char		key[256], op[8], value[1024];
 	vp_cursor_t	cursor;
 	VALUE_PAIR	*vp;
-	RADIUS_PACKET	*packet;
+	detail_entry_t	*entry;
 	char		buffer[2048];
 	listen_detail_t *data = listener->data;
 
+	rad_assert(data->outstanding < (int) data->max_outstanding);
+
 	switch (data->file_state) {
 	case STATE_UNOPENED:
 open_file:
@@ -419,6 +750,11 @@ open_file:
 			fr_exit(1);
 		}
 
+		/*
+		 *	Skip the records we completed before a restart.
+		 */
+		if (data->track) detail_index_open(data);
+
 		/*
 		 *	Look for the header
 		 */
@@ -433,6 +769,14 @@ open_file:
 		 */
 	case STATE_PROCESSING:
 		break;
+
+	/*
+	 *	We've read everything, the file can be
+	 *	removed once the last records complete.
+	 */
+	case STATE_DRAINING:
+		if (data->outstanding > 0) return NULL;
+		goto cleanup;
 	}
 
 
@@ -440,9 +784,9 @@ open_file:
 	case STATE_HEADER:
 	do_header:
 		data->done_entry = false;
+		data->binary = false;
 		data->timestamp_offset = 0;
 
-		data->tries = 0;
 		if (!data->fp) {
 			data->file_state = STATE_UNOPENED;
 			goto open_file;
@@ -468,6 +812,25 @@ open_file:
 		 */
 		if (feof(data->fp)) {
 		cleanup:
+			/*
+			 *	Records may still be marked as done
+			 *	in this file, don't remove it yet.
+			 */
+			if (data->outstanding > 0) {
+				data->file_state = STATE_DRAINING;
+				return NULL;
+			}
+
+			/*
+			 *	Remove the index first, so it's never
+			 *	left behind for a new work file.
+			 */
+			if (data->index_fd >= 0) {
+				close(data->index_fd);
+				data->index_fd = -1;
+			}
+			unlink(data->filename_index);
+
 			DEBUG("detail (%s): Unlinking %s", data->name, data->filename_work);
 			unlink(data->filename_work);
 			if (data->fp) fclose(data->fp);
@@ -501,58 +864,32 @@ open_file:
 		/* FALL-THROUGH */
 
 	case STATE_QUEUED:
-		goto alloc_packet;
+		goto queue_entry;
 
 	/*
-	 *	Periodically check what's going on.
-	 *	If the request is taking too long,
-	 *	retry it.
+	 *	Completion is tracked per-record, in the window.
 	 */
-	case STATE_RUNNING:
-		if (time(NULL) < (data->running + (int)data->retry_interval)) {
-			return NULL;
-		}
-
-		DEBUG("detail (%s): No response to detail request.  Retrying", data->name);
-		/* FALL-THROUGH */
+	default:
+		break;
+	}
 
 	/*
-	 *	If there's no reply, keep
-	 *	retransmitting the current packet
-	 *	forever.
+	 *	Binary records start with a magic number, which
+	 *	can't start a text entry.
 	 */
-	case STATE_NO_REPLY:
-		data->entry_state = STATE_QUEUED;
-		goto alloc_packet;
+	if (data->entry_state == STATE_HEADER) {
+		int c;
 
-	/*
-	 *	We have a reply.  Clean up the old
-	 *	request, and go read another one.
-	 */
-	case STATE_REPLIED:
-		if (data->track) {
-			rad_assert(data->fp != NULL);
-
-			if (fseek(data->fp, data->timestamp_offset, SEEK_SET) < 0) {
-				WARN("detail (%s): Failed seeking to timestamp offset: %s",
-				     data->name, fr_syserror(errno));
-			} else if (fwrite("\tDone", 1, 5, data->fp) < 5) {
-				WARN("detail (%s): Failed marking request as done: %s",
-				     data->name, fr_syserror(errno));
-			} else if (fflush(data->fp) != 0) {
-				WARN("detail (%s): Failed flushing marked detail file to disk: %s",
-				     data->name, fr_syserror(errno));
-			}
+		c = getc(data->fp);
+		if (c != EOF) ungetc(c, data->fp);
 
-			if (fseek(data->fp, data->offset, SEEK_SET) < 0) {
-				WARN("detail (%s): Failed seeking to next detail request: %s",
-				     data->name, fr_syserror(errno));
+		if (c == (uint8_t) DETAIL_BINARY_MAGIC[0]) {
+			if (detail_read_binary(data) < 0) {
+				fr_pair_list_free(&data->vps);
+				goto cleanup;
 			}
+			goto queue_entry;
 		}
-
-		fr_pair_list_free(&data->vps);
-		data->entry_state = STATE_HEADER;
-		goto do_header;
 	}
 
 	fr_pair_cursor_init(&cursor, &data->vps);
@@ -689,13 +1026,12 @@ open_file:
 	 */
 	if (ferror(data->fp)) goto cleanup;
 
-	data->tries = 0;
 	data->packets++;
 
 	/*
-	 *	Process the packet.
+	 *	Add the record to the window.
 	 */
- alloc_packet:
+ queue_entry:
 	if (data->done_entry) {
 		DEBUG2("detail (%s): Skipping record for timestamp %lu", data->name, data->timestamp);
 		fr_pair_list_free(&data->vps);
@@ -703,8 +1039,6 @@ open_file:
 		goto do_header;
 	}
 
-	data->tries++;
-
 	/*
 	 *	The writer doesn't check that the record was
 	 *	completely written.  If the disk is full, this can
@@ -730,6 +1064,36 @@ open_file:
 		return NULL;
 	}
 
+	entry = DETAIL_ENTRY(data, data->outstanding);
+	memset(entry, 0, sizeof(*entry));
+	entry->state = STATE_QUEUED;
+	entry->vps = data->vps;
+	entry->client_ip = data->client_ip;
+	entry->timestamp = data->timestamp;
+	entry->timestamp_offset = data->timestamp_offset;
+	entry->end_offset = data->offset;
+	entry->binary = data->binary;
+
+	data->vps = NULL;
+	data->entry_state = STATE_HEADER;
+	data->outstanding++;
+
+	return entry;
+}
+
+/*
+ *	Build a packet from a record in the window.
+ */
+static RADIUS_PACKET *detail_packet_alloc(listen_detail_t *data, detail_entry_t *entry)
+{
+	VALUE_PAIR	*vp;
+	RADIUS_PACKET	*packet;
+	time_t		timestamp = entry->timestamp;
+
+	entry->tries++;
+	entry->id = data->counter++;
+	data->tries = entry->tries;
+
 	/*
 	 *	Allocate the packet.  If we fail, it's a serious
 	 *	problem.
@@ -750,7 +1114,7 @@ open_file:
 	 *	Otherwise, it lets us re-send the original packet
 	 *	contents, unmolested.
 	 */
-	packet->vps = fr_pair_list_copy(packet, data->vps);
+	packet->vps = fr_pair_list_copy(packet, entry->vps);
 
 	packet->code = PW_CODE_ACCOUNTING_REQUEST;
 	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TYPE, TAG_ANY);
@@ -762,8 +1126,8 @@ open_file:
 	 *	Remember where it came from, so that we don't
 	 *	proxy it to the place it came from...
 	 */
-	if (data->client_ip.af != AF_UNSPEC) {
-		packet->src_ipaddr = data->client_ip;
+	if (entry->client_ip.af != AF_UNSPEC) {
+		packet->src_ipaddr = entry->client_ip;
 	}
 
 	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IP_ADDRESS, TAG_ANY);
@@ -799,12 +1163,12 @@ open_file:
 	/*
 	 *	Generate packet ID, ports, IP via a counter.
 	 */
-	packet->id = data->counter & 0xff;
-	packet->src_port = 1024 + ((data->counter >> 8) & 0xff);
-	packet->dst_port = 1024 + ((data->counter >> 16) & 0xff);
+	packet->id = entry->id & 0xff;
+	packet->src_port = 1024 + ((entry->id >> 8) & 0xff);
+	packet->dst_port = 1024 + ((entry->id >> 16) & 0xff);
 
 	packet->dst_ipaddr.af = AF_INET;
-	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((data->counter >> 24) & 0xff));
+	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((entry->id >> 24) & 0xff));
 
 	/*
 	 *	Create / update accounting attributes.
@@ -818,7 +1182,7 @@ open_file:
 		 */
 		vp = fr_pair_find_by_num(packet->vps, 0, PW_EVENT_TIMESTAMP, TAG_ANY);
 		if (vp) {
-			data->timestamp = vp->vp_integer;
+			timestamp = vp->vp_integer;
 		}
 
 		/*
@@ -831,8 +1195,8 @@ open_file:
 			rad_assert(vp != NULL);
 			fr_pair_add(&packet->vps, vp);
 		}
-		if (data->timestamp != 0) {
-			vp->vp_integer += time(NULL) - data->timestamp;
+		if (timestamp != 0) {
+			vp->vp_integer += time(NULL) - timestamp;
 		}
 	}
 
@@ -845,10 +1209,10 @@ open_file:
 		rad_assert(vp != NULL);
 		fr_pair_add(&packet->vps, vp);
 	}
-	vp->vp_integer = data->tries;
+	vp->vp_integer = entry->tries;
 
-	data->entry_state = STATE_RUNNING;
-	data->running = packet->timestamp.tv_sec;
+	entry->state = STATE_RUNNING;
+	entry->running = packet->timestamp.tv_sec;
 
 	return packet;
 }
@@ -898,6 +1262,11 @@ static int _detail_free(listen_detail_t *data)
 		data->fp = NULL;
 	}
 
+	if (data->index_fd >= 0) {
+		close(data->index_fd);
+		data->index_fd = -1;
+	}
+
 	return 0;
 }
 
@@ -960,54 +1329,118 @@ static int detail_decode(rad_listen_t *this, REQUEST *request)
 }
 
 
+/*
+ *	Send (or re-send) a record to the master.
+ */
+static void detail_send_entry(rad_listen_t *this, detail_entry_t *entry)
+{
+	RADIUS_PACKET *packet;
+	listen_detail_t *data = this->data;
+
+	packet = detail_packet_alloc(data, entry);
+	if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+		ERROR("detail (%s): Failed passing detail packet pointer to master: %s",
+		      data->name, fr_syserror(errno));
+		fr_radius_free(&packet);
+		entry->state = STATE_NO_REPLY;
+	}
+}
+
+/*
+ *	Keep retrying records forever, if they don't get a reply.
+ *
+ *	FIXME: cap the retries.
+ */
+static void detail_retransmit(rad_listen_t *this)
+{
+	int		i;
+	time_t		now = time(NULL);
+	listen_detail_t *data = this->data;
+
+	for (i = 0; i < data->outstanding; i++) {
+		detail_entry_t *entry = DETAIL_ENTRY(data, i);
+
+		if ((entry->state != STATE_RUNNING) && (entry->state != STATE_NO_REPLY)) continue;
+		if (now < (entry->running + (int)data->retry_interval)) continue;
+
+		if (entry->state == STATE_RUNNING) {
+			DEBUG("detail (%s): No response to detail request.  Retrying", data->name);
+		}
+
+		detail_send_entry(this, entry);
+	}
+}
+
 static void *detail_handler_thread(void *arg)
 {
-	char c;
 	rad_listen_t *this = arg;
 	listen_detail_t *data = this->data;
 
 	while (true) {
-		RADIUS_PACKET *packet;
+		detail_entry_t	*entry;
+		detail_ack_t	ack;
+		struct pollfd	pfd;
 
-		while ((packet = detail_poll(this)) == NULL) {
-			usleep(detail_delay(data));
+		/*
+		 *	If we're supposed to exit then tell
+		 *	the master thread we've exited.
+		 */
+		if (data->child_pipe[0] < 0) {
+			RADIUS_PACKET *packet = NULL;
 
-			/*
-			 *	If we're supposed to exit then tell
-			 *	the master thread we've exited.
-			 */
-			if (data->child_pipe[0] < 0) {
-				packet = NULL;
-				if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
-					ERROR("detail (%s): Failed writing exit status to master: %s",
-					      data->name, fr_syserror(errno));
-				}
-				return NULL;
+			if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+				ERROR("detail (%s): Failed writing exit status to master: %s",
+				      data->name, fr_syserror(errno));
 			}
+			return NULL;
 		}
 
+		detail_retransmit(this);
+
 		/*
-		 *	Keep retrying forever.
-		 *
-		 *	FIXME: cap the retries.
+		 *	Fill the window with new records.
 		 */
-		do {
-			if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
-				ERROR("detail (%s): Failed passing detail packet pointer to master: %s",
-				      data->name, fr_syserror(errno));
-			}
+		while (data->outstanding < (int) data->window) {
+			entry = detail_read(this);
+			if (!entry) break;
 
-			if (read(data->child_pipe[0], &c, 1) < 0) {
+			detail_send_entry(this, entry);
+		}
+
+		/*
+		 *	Nothing outstanding, and nothing to read.
+		 */
+		if (data->outstanding == 0) {
+			usleep(detail_delay(data));
+			continue;
+		}
+
+		/*
+		 *	Wait for acks.  Wake up every second to
+		 *	check for records which need retransmitting.
+		 */
+		pfd.fd = data->child_pipe[0];
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, 1000) <= 0) continue;
+
+		do {
+			if (read(data->child_pipe[0], &ack, sizeof(ack)) != sizeof(ack)) {
 				ERROR("detail (%s): Failed getting detail packet ack from master: %s",
 				      data->name, fr_syserror(errno));
 				break;
 			}
 
-			if (data->delay_time > 0) usleep(data->delay_time);
+			detail_ack(data, &ack);
+		} while ((data->child_pipe[0] >= 0) && (poll(&pfd, 1, 0) > 0));
 
-			packet = detail_poll(this);
-			if (!packet) break;
-		} while (data->entry_state != STATE_REPLIED);
+		/*
+		 *	With only one record outstanding, pace reads
+		 *	to enforce the load factor.  With a larger window
+		 *	the latency target controls the rate instead.
+		 */
+		if ((data->max_outstanding == 1) && (data->delay_time > 0)) usleep(data->delay_time);
 	}
 
 	return NULL;
@@ -1022,6 +1455,8 @@ static const CONF_PARSER detail_config[] = {
 	{ FR_CONF_OFFSET("retry_interval", PW_TYPE_INTEGER, listen_detail_t, retry_interval), .dflt = STRINGIFY(30) },
 	{ FR_CONF_OFFSET("one_shot", PW_TYPE_BOOLEAN, listen_detail_t, one_shot), .dflt = "no" },
 	{ FR_CONF_OFFSET("track", PW_TYPE_BOOLEAN, listen_detail_t, track), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_outstanding", PW_TYPE_INTEGER, listen_detail_t, max_outstanding), .dflt = STRINGIFY(1) },
+	{ FR_CONF_OFFSET("latency_target", PW_TYPE_INTEGER, listen_detail_t, latency_target), .dflt = STRINGIFY(0) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -1065,6 +1500,15 @@ static int detail_parse(CONF_SECTION *cs, rad_listen_t *this)
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, >=, 4);
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, <=, 3600);
 
+	/*
+	 *	Each outstanding record has a pointer in the
+	 *	master pipe, which mustn't fill up.
+	 */
+	FR_INTEGER_BOUND_CHECK("max_outstanding", data->max_outstanding, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_outstanding", data->max_outstanding, <=, 1024);
+
+	FR_INTEGER_BOUND_CHECK("latency_target", data->latency_target, <=, 60000);
+
 	/*
 	 *	Only checking the config.  Don't start threads or anything else.
 	 */
@@ -1107,8 +1551,10 @@ static int detail_parse(CONF_SECTION *cs, rad_listen_t *this)
 	}
 
 	data->filename_work = talloc_strdup(data, buffer);
+	data->filename_index = talloc_asprintf(data, "%s.idx", data->filename_work);
 
 	data->work_fd = -1;
+	data->index_fd = -1;
 	data->vps = NULL;
 	data->fp = NULL;
 	data->file_state = STATE_UNOPENED;
@@ -1116,6 +1562,14 @@ static int detail_parse(CONF_SECTION *cs, rad_listen_t *this)
 	data->delay_time = data->poll_interval * USEC;
 	data->signal = 1;
 
+	/*
+	 *	With a latency target, start small and grow the
+	 *	window while the server keeps up.
+	 */
+	data->entries = talloc_zero_array(data, detail_entry_t, data->max_outstanding);
+	if (!data->entries) return -1;
+	data->window = data->latency_target ? 1 : data->max_outstanding;
+
 	/*
 	 *	Initialize the fake client.
 	 */
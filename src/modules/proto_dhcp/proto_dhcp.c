@@ -832,7 +832,7 @@ static int dhcp_socket_recv(rad_listen_t *listener)
 	if (!rad_cond_assert(client != NULL)) return 1;
 
 	FR_STATS_INC(auth, total_requests);
-	FR_STATS_TYPE_INC(client->auth.total_requests);
+	FR_STATS_TYPE_INC(client->auth, total_requests);
 
 #ifdef PCAP_RAW_SOCKETS
 	if (sock->lsock.pcap) {
@@ -30,6 +30,9 @@ RCSID("$Id$")
 
 #include <freeradius-devel/map_proc.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+
 static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, REQUEST *request,
 				vp_tmpl_t const *key, vp_map_t const *maps);
 
@@ -54,6 +57,18 @@ typedef struct rlm_csv_t {
 	char const     	**field_names;
 	int		*field_offsets; /* field X from the file maps to array entry Y here */
 	rbtree_t	*tree;
+
+	char const	*index_filename;	//!< If set, lookups use a sorted on-disk index
+						//!< instead of an in-memory tree.
+
+	int		csv_fd;			//!< Rows are read from here on demand.
+	uint64_t	csv_size;		//!< Size of the CSV file when the index was loaded.
+	uint8_t		*index_data;		//!< Copy of the index file.
+	size_t		index_data_len;		//!< Length of the index file.
+
+	struct rlm_csv_index_entry_t const *index;	//!< Sorted index entries.
+	uint64_t	index_count;		//!< Number of index entries.
+	uint8_t const	*index_keys;		//!< Key blob which follows the entries.
 } rlm_csv_t;
 
 typedef struct rlm_csv_entry_t {
@@ -62,6 +77,40 @@ typedef struct rlm_csv_entry_t {
 	char *data[];
 } rlm_csv_entry_t;
 
+#define CSV_INDEX_MAGIC		0x49565343	/* "CSVI" */
+#define CSV_INDEX_VERSION	1
+
+/** Header of an on-disk CSV index
+ *
+ * The index is only ever read by the host that wrote it, so all fields
+ * are in native byte order.  It is followed by num_entries
+ * #rlm_csv_index_entry_t, sorted by key, then by the blob of decoded keys.
+ */
+typedef struct rlm_csv_index_hdr_t {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	num_entries;
+	uint64_t	csv_size;		//!< Size of the CSV file the index was built from.
+	int64_t		csv_mtime;		//!< Modification time of the CSV file.
+	uint32_t	num_fields;		//!< Number of fields in the header.
+	uint32_t	key_field;		//!< Which field was used as the key.
+	uint64_t	keys_len;		//!< Length of the key blob.
+} rlm_csv_index_hdr_t;
+
+typedef struct rlm_csv_index_entry_t {
+	uint64_t	key_offset;		//!< Offset of the key in the key blob.
+	uint64_t	row_offset;		//!< Offset of the row in the CSV file.
+	uint32_t	key_len;		//!< Length of the key (no trailing \0).
+	uint32_t	row_len;		//!< Length of the row, including the EOL.
+} rlm_csv_index_entry_t;
+
+/** Used to sort index entries whilst the index is being built
+ */
+typedef struct rlm_csv_index_sort_t {
+	char const		*key;
+	rlm_csv_index_entry_t	entry;
+} rlm_csv_index_sort_t;
+
 /*
  *	A mapping of configuration file names to internal variables.
  */
@@ -70,6 +119,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("delimiter", PW_TYPE_STRING | PW_TYPE_REQUIRED | PW_TYPE_NOT_EMPTY, rlm_csv_t, delimiter), .dflt = "," },
 	{ FR_CONF_OFFSET("header", PW_TYPE_STRING | PW_TYPE_REQUIRED | PW_TYPE_NOT_EMPTY, rlm_csv_t, header) },
 	{ FR_CONF_OFFSET("key_field", PW_TYPE_STRING | PW_TYPE_REQUIRED | PW_TYPE_NOT_EMPTY, rlm_csv_t, key) },
+	{ FR_CONF_OFFSET("index_filename", PW_TYPE_FILE_OUTPUT, rlm_csv_t, index_filename) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -153,35 +203,59 @@ static bool buf2entry(rlm_csv_t *inst, char *buf, char **out)
 }
 
 /*
- *	Convert a buffer to a CSV entry
+ *	Split a line into its fields, in place.
  */
-static rlm_csv_entry_t *file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buffer)
+static int buf2fields(rlm_csv_t *inst, char *buffer, char **fields)
 {
-	rlm_csv_entry_t *e;
 	int i;
 	char *p, *q;
 
-	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst->tree, uint8_t,
-						     sizeof(*e) + inst->used_fields + sizeof(e->data[0])));
-
 	for (p = buffer, i = 0; p != NULL; p = q, i++) {
 		if (!buf2entry(inst, p, &q)) {
-			cf_log_err_cs(conf, "Malformed entry in file %s line %d", inst->filename, lineno);
-			return NULL;
+			fr_strerror_printf("Malformed entry");
+			return -1;
 		}
 
 		if (q) *(q++) = '\0';
 
 		if (i >= inst->num_fields) {
-			cf_log_err_cs(conf, "Too many fields at file %s line %d", inst->filename, lineno);
-			return NULL;
+			fr_strerror_printf("Too many fields");
+			return -1;
 		}
 
+		fields[i] = p;
+	}
+
+	if (i < inst->num_fields) {
+		fr_strerror_printf("Too few fields (%d < %d)", i, inst->num_fields);
+		return -1;
+	}
+
+	return i;
+}
+
+/*
+ *	Convert a buffer to a CSV entry
+ */
+static rlm_csv_entry_t *file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buffer, char **fields)
+{
+	rlm_csv_entry_t *e;
+	int i;
+
+	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst->tree, uint8_t,
+						     sizeof(*e) + inst->used_fields + sizeof(e->data[0])));
+
+	if (buf2fields(inst, buffer, fields) < 0) {
+		cf_log_err_cs(conf, "%s at file %s line %d", fr_strerror(), inst->filename, lineno);
+		return NULL;
+	}
+
+	for (i = 0; i < inst->num_fields; i++) {
 		/*
 		 *	This is the key field.
 		 */
 		if (i == inst->key_field) {
-			e->key = talloc_strdup(e, p);
+			e->key = talloc_strdup(e, fields[i]);
 			continue;
 		}
 
@@ -190,12 +264,7 @@ static rlm_csv_entry_t *file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno
 		 */
 		if (inst->field_offsets[i] < 0) continue;
 
-		MEM(e->data[inst->field_offsets[i]] = talloc_strdup(e, p));
-	}
-
-	if (i < inst->num_fields) {
-		cf_log_err_cs(conf, "Too few fields at file %s line %d (%d < %d)", inst->filename, lineno, i, inst->num_fields);
-		return NULL;
+		MEM(e->data[inst->field_offsets[i]] = talloc_strdup(e, fields[i]));
 	}
 
 	/*
@@ -210,6 +279,355 @@ static rlm_csv_entry_t *file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno
 	return e;
 }
 
+static int csv_index_sort_cmp(void const *one, void const *two)
+{
+	rlm_csv_index_sort_t const *a = one;
+	rlm_csv_index_sort_t const *b = two;
+	int ret;
+
+	ret = memcmp(a->key, b->key, (a->entry.key_len < b->entry.key_len) ? a->entry.key_len : b->entry.key_len);
+	if (ret != 0) return ret;
+
+	return (a->entry.key_len > b->entry.key_len) - (a->entry.key_len < b->entry.key_len);
+}
+
+/*
+ *	Write the sorted index for the CSV file.
+ *
+ *	Only the key of each row is decoded, so memory use is
+ *	proportional to the size of the keys, not the size of the
+ *	file.  The index is written to a temporary file and renamed
+ *	into place so that a partially written index is never used.
+ */
+static int csv_index_build(CONF_SECTION *conf, rlm_csv_t *inst, struct stat const *csv_st, char **fields)
+{
+	TALLOC_CTX		*ctx;
+	FILE			*fp, *out;
+	char			buffer[8192];
+	char			*tmp_filename;
+	int			lineno;
+	long			offset;
+	uint64_t		i, num_entries = 0, alloced = 1024;
+	size_t			keys_len = 0, keys_alloced = 65536;
+	char			*keys;
+	rlm_csv_index_sort_t	*sorted;
+	rlm_csv_index_hdr_t	hdr;
+
+	fp = fopen(inst->filename, "r");
+	if (!fp) {
+		cf_log_err_cs(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	MEM(ctx = talloc_new(NULL));
+	MEM(sorted = talloc_array(ctx, rlm_csv_index_sort_t, alloced));
+	MEM(keys = talloc_array(ctx, char, keys_alloced));
+
+	lineno = 1;
+	offset = 0;
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		size_t	row_len = strlen(buffer);
+		size_t	key_len;
+
+		if (buf2fields(inst, buffer, fields) < 0) {
+			cf_log_err_cs(conf, "%s at file %s line %d", fr_strerror(), inst->filename, lineno);
+			fclose(fp);
+			talloc_free(ctx);
+			return -1;
+		}
+
+		if (num_entries == alloced) {
+			alloced *= 2;
+			MEM(sorted = talloc_realloc(ctx, sorted, rlm_csv_index_sort_t, alloced));
+		}
+
+		key_len = strlen(fields[inst->key_field]);
+		while ((keys_len + key_len) > keys_alloced) {
+			keys_alloced *= 2;
+			MEM(keys = talloc_realloc(ctx, keys, char, keys_alloced));
+		}
+		memcpy(keys + keys_len, fields[inst->key_field], key_len);
+
+		sorted[num_entries].entry.key_offset = keys_len;
+		sorted[num_entries].entry.key_len = key_len;
+		sorted[num_entries].entry.row_offset = offset;
+		sorted[num_entries].entry.row_len = row_len;
+		num_entries++;
+
+		keys_len += key_len;
+		offset += row_len;
+		lineno++;
+	}
+	fclose(fp);
+
+	/*
+	 *	The key blob has stopped moving, so we can now point
+	 *	at the keys.
+	 */
+	for (i = 0; i < num_entries; i++) sorted[i].key = keys + sorted[i].entry.key_offset;
+
+	qsort(sorted, num_entries, sizeof(sorted[0]), csv_index_sort_cmp);
+
+	/*
+	 *	Duplicate keys are refused, the same as when the file
+	 *	is loaded into memory.  They're adjacent once sorted.
+	 */
+	for (i = 1; i < num_entries; i++) {
+		if (csv_index_sort_cmp(&sorted[i - 1], &sorted[i]) == 0) {
+			cf_log_err_cs(conf, "Failed indexing filename %s: duplicate entry for key '%.*s'",
+				      inst->filename, (int)sorted[i].entry.key_len, sorted[i].key);
+			talloc_free(ctx);
+			return -1;
+		}
+	}
+
+	MEM(tmp_filename = talloc_asprintf(ctx, "%s.tmp", inst->index_filename));
+	out = fopen(tmp_filename, "w");
+	if (!out) {
+		cf_log_err_cs(conf, "Error opening index file %s: %s", tmp_filename, fr_syserror(errno));
+		talloc_free(ctx);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CSV_INDEX_MAGIC;
+	hdr.version = CSV_INDEX_VERSION;
+	hdr.num_entries = num_entries;
+	hdr.csv_size = csv_st->st_size;
+	hdr.csv_mtime = csv_st->st_mtime;
+	hdr.num_fields = inst->num_fields;
+	hdr.key_field = inst->key_field;
+	hdr.keys_len = keys_len;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) {
+	write_error:
+		cf_log_err_cs(conf, "Error writing index file %s: %s", tmp_filename, fr_syserror(errno));
+		fclose(out);
+		unlink(tmp_filename);
+		talloc_free(ctx);
+		return -1;
+	}
+
+	for (i = 0; i < num_entries; i++) {
+		if (fwrite(&sorted[i].entry, sizeof(sorted[i].entry), 1, out) != 1) goto write_error;
+	}
+
+	if (keys_len && (fwrite(keys, keys_len, 1, out) != 1)) goto write_error;
+
+	if (fclose(out) != 0) {
+		cf_log_err_cs(conf, "Error writing index file %s: %s", tmp_filename, fr_syserror(errno));
+		unlink(tmp_filename);
+		talloc_free(ctx);
+		return -1;
+	}
+
+	if (rename(tmp_filename, inst->index_filename) < 0) {
+		cf_log_err_cs(conf, "Error renaming %s to %s: %s", tmp_filename, inst->index_filename,
+			      fr_syserror(errno));
+		unlink(tmp_filename);
+		talloc_free(ctx);
+		return -1;
+	}
+
+	cf_log_info(conf, "Wrote index %s with %" PRIu64 " entries", inst->index_filename, num_entries);
+
+	talloc_free(ctx);
+	return 0;
+}
+
+/*
+ *	Read a whole file into memory.
+ *
+ *	The index is read rather than mapped, so that it can't change
+ *	underneath us, and truncating it can't crash the server.
+ */
+static int csv_read_file(CONF_SECTION *conf, TALLOC_CTX *ctx, char const *filename, uint8_t **out, size_t *out_len)
+{
+	int		fd;
+	struct stat	st;
+	uint8_t		*p;
+	size_t		total = 0;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		cf_log_err_cs(conf, "Error opening %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		cf_log_err_cs(conf, "Error reading %s: %s", filename, fr_syserror(errno));
+		close(fd);
+		return -1;
+	}
+
+	MEM(p = talloc_array(ctx, uint8_t, st.st_size + 1));
+
+	while (total < (size_t) st.st_size) {
+		ssize_t len;
+
+		len = read(fd, p + total, st.st_size - total);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+
+			cf_log_err_cs(conf, "Error reading %s: %s", filename, fr_syserror(errno));
+			talloc_free(p);
+			close(fd);
+			return -1;
+		}
+
+		/*
+		 *	Truncated whilst we were reading it.
+		 */
+		if (len == 0) break;
+
+		total += len;
+	}
+	close(fd);
+
+	*out = p;
+	*out_len = total;
+
+	return 0;
+}
+
+/*
+ *	Check that the index matches the CSV file and our configuration.
+ */
+static bool csv_index_valid(rlm_csv_t *inst, struct stat const *csv_st)
+{
+	rlm_csv_index_hdr_t const	*hdr;
+	rlm_csv_index_entry_t const	*entry;
+	uint64_t			i;
+
+	if (inst->index_data_len < sizeof(*hdr)) return false;
+
+	hdr = (rlm_csv_index_hdr_t const *) inst->index_data;
+	if ((hdr->magic != CSV_INDEX_MAGIC) || (hdr->version != CSV_INDEX_VERSION)) return false;
+
+	if ((hdr->csv_size != (uint64_t) csv_st->st_size) || (hdr->csv_mtime != (int64_t) csv_st->st_mtime)) {
+		return false;
+	}
+
+	if ((hdr->num_fields != (uint32_t) inst->num_fields) || (hdr->key_field != (uint32_t) inst->key_field)) {
+		return false;
+	}
+
+	if ((inst->index_data_len - sizeof(*hdr)) / sizeof(rlm_csv_index_entry_t) < hdr->num_entries) return false;
+
+	if ((inst->index_data_len - sizeof(*hdr) - (hdr->num_entries * sizeof(rlm_csv_index_entry_t))) !=
+	    hdr->keys_len) return false;
+
+	/*
+	 *	Every key has to be inside of the key blob, and every
+	 *	row inside of the CSV file.  Lookups then don't need
+	 *	to check.
+	 */
+	entry = (rlm_csv_index_entry_t const *) (inst->index_data + sizeof(*hdr));
+	for (i = 0; i < hdr->num_entries; i++, entry++) {
+		if ((entry->key_offset > hdr->keys_len) || (entry->key_len > (hdr->keys_len - entry->key_offset))) {
+			return false;
+		}
+
+		if ((entry->row_len == 0) || (entry->row_offset > hdr->csv_size) ||
+		    (entry->row_len > (hdr->csv_size - entry->row_offset))) return false;
+	}
+
+	return true;
+}
+
+/*
+ *	Load the index and open the CSV file, (re)building the index
+ *	if it's missing or out of date.
+ */
+static int csv_index_load(CONF_SECTION *conf, rlm_csv_t *inst, char **fields)
+{
+	struct stat		csv_st, fd_st;
+	rlm_csv_index_hdr_t const *hdr;
+	bool			built = false;
+
+	if (stat(inst->filename, &csv_st) < 0) {
+		cf_log_err_cs(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (access(inst->index_filename, R_OK) < 0) {
+	build:
+		if (csv_index_build(conf, inst, &csv_st, fields) < 0) return -1;
+		built = true;
+	}
+
+	if (csv_read_file(conf, inst, inst->index_filename, &inst->index_data, &inst->index_data_len) < 0) return -1;
+
+	if (!csv_index_valid(inst, &csv_st)) {
+		TALLOC_FREE(inst->index_data);
+		inst->index_data_len = 0;
+
+		if (built) {
+			cf_log_err_cs(conf, "Index file %s is invalid", inst->index_filename);
+			return -1;
+		}
+
+		cf_log_info(conf, "Index file %s is out of date, rebuilding", inst->index_filename);
+		goto build;
+	}
+
+	/*
+	 *	Rows are read with pread() when they're needed.  The
+	 *	file isn't mapped, so that if it's truncated or
+	 *	rewritten in place, lookups fail instead of the
+	 *	server being killed with SIGBUS.
+	 */
+	inst->csv_fd = open(inst->filename, O_RDONLY);
+	if (inst->csv_fd < 0) {
+		cf_log_err_cs(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	The CSV file changed between stat() and open().
+	 */
+	if ((fstat(inst->csv_fd, &fd_st) < 0) || (fd_st.st_size != csv_st.st_size) ||
+	    (fd_st.st_mtime != csv_st.st_mtime)) {
+		cf_log_err_cs(conf, "File %s changed whilst it was being loaded", inst->filename);
+		close(inst->csv_fd);
+		return -1;
+	}
+
+	hdr = (rlm_csv_index_hdr_t const *) inst->index_data;
+	inst->csv_size = hdr->csv_size;
+	inst->index_count = hdr->num_entries;
+	inst->index = (rlm_csv_index_entry_t const *) (inst->index_data + sizeof(*hdr));
+	inst->index_keys = (uint8_t const *) (inst->index + inst->index_count);
+
+	return 0;
+}
+
+/*
+ *	Binary search the index for a key.
+ */
+static rlm_csv_index_entry_t const *csv_index_find(rlm_csv_t const *inst, char const *key, size_t key_len)
+{
+	uint64_t lo = 0, hi = inst->index_count;
+
+	while (lo < hi) {
+		uint64_t			mid = lo + ((hi - lo) / 2);
+		rlm_csv_index_entry_t const	*entry = &inst->index[mid];
+		int				ret;
+
+		ret = memcmp(key, inst->index_keys + entry->key_offset,
+			     (key_len < entry->key_len) ? key_len : entry->key_len);
+		if (ret == 0) ret = (key_len > entry->key_len) - (key_len < entry->key_len);
+
+		if (ret == 0) return entry;
+		if (ret < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return NULL;
+}
 
 static int fieldname2offset(rlm_csv_t *inst, char const *field_name)
 {
@@ -279,6 +697,7 @@ static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 	FILE *fp;
 	int lineno;
 	char buffer[8192];
+	char **fields;
 
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
@@ -365,6 +784,21 @@ static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	fields = talloc_array(inst, char *, inst->num_fields);
+	if (!fields) goto oom;
+
+	/*
+	 *	With an index, nothing is parsed up front.  Rows are
+	 *	read from the file with pread(), and decoded, as they
+	 *	are looked up.
+	 */
+	if (inst->index_filename) {
+		if (csv_index_load(conf, inst, fields) < 0) return -1;
+
+		talloc_free(fields);
+		goto done;
+	}
+
 	inst->tree = rbtree_create(inst, csv_entry_cmp, NULL, 0);
 	if (!inst->tree) goto oom;
 
@@ -381,7 +815,7 @@ static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 	while (fgets(buffer, sizeof(buffer), fp)) {
 		rlm_csv_entry_t *e;
 
-		e = file2csv(conf, inst, lineno, buffer);
+		e = file2csv(conf, inst, lineno, buffer, fields);
 		if (!e) {
 			fclose(fp);
 			return -1;
@@ -391,7 +825,9 @@ static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 	}
 
 	fclose(fp);
+	talloc_free(fields);
 
+done:
 	/*
 	 *	And register the map function.
 	 */
@@ -400,6 +836,15 @@ static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+static int mod_detach(void *instance)
+{
+	rlm_csv_t *inst = instance;
+
+	if (inst->index) close(inst->csv_fd);
+
+	return 0;
+}
+
 /*
  *	Convert field X to a VP.
  */
@@ -474,18 +919,67 @@ static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, REQUEST
 {
 	rlm_rcode_t		rcode = RLM_MODULE_UPDATED;
 	rlm_csv_t		*inst = talloc_get_type_abort(mod_inst, rlm_csv_t);
-	rlm_csv_entry_t		*e, my_entry;
+	rlm_csv_entry_t		*e = NULL, my_entry;
 	vp_map_t const		*map;
 	char			*key_str = NULL;
+	char			*row = NULL;
+	char			**data = NULL;
 
 	if (tmpl_aexpand(request, &key_str, request, key, NULL, NULL) < 0) return RLM_MODULE_FAIL;
 
-	my_entry.key = key_str;
+	if (inst->index) {
+		rlm_csv_index_entry_t const	*entry;
+		char				**fields;
+		int				i;
 
-	e = rbtree_finddata(inst->tree, &my_entry);
-	if (!e) {
-		rcode = RLM_MODULE_NOOP;
-		goto finish;
+		entry = csv_index_find(inst, key_str, strlen(key_str));
+		if (!entry) {
+			rcode = RLM_MODULE_NOOP;
+			goto finish;
+		}
+
+		/*
+		 *	Only the matched row is read and decoded.
+		 */
+		MEM(row = talloc_array(request, char, entry->row_len + 1));
+		if (pread(inst->csv_fd, row, entry->row_len, entry->row_offset) != (ssize_t) entry->row_len) {
+		changed:
+			REDEBUG("File %s has changed since it was indexed.  Restart the server to re-index it",
+				inst->filename);
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+		row[entry->row_len] = '\0';
+
+		MEM(fields = talloc_array(row, char *, inst->num_fields));
+		if (buf2fields(inst, row, fields) < 0) {
+			REDEBUG("%s in row for key '%s'", fr_strerror(), key_str);
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+
+		/*
+		 *	If the file was rewritten in place, the row may
+		 *	be for a different key.
+		 */
+		if (strcmp(fields[inst->key_field], key_str) != 0) goto changed;
+
+		MEM(data = talloc_zero_array(row, char *, inst->used_fields));
+		for (i = 0; i < inst->num_fields; i++) {
+			if (inst->field_offsets[i] < 0) continue;
+
+			data[inst->field_offsets[i]] = fields[i];
+		}
+	} else {
+		my_entry.key = key_str;
+
+		e = rbtree_finddata(inst->tree, &my_entry);
+		if (!e) {
+			rcode = RLM_MODULE_NOOP;
+			goto finish;
+		}
+
+		data = e->data;
 	}
 
 	RINDENT();
@@ -494,6 +988,7 @@ static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, REQUEST
 	     map = map->next) {
 		int field;
 		char *field_name;
+		char *value;
 
 		/*
 		 *	Avoid memory allocations if possible.
@@ -518,17 +1013,28 @@ static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, REQUEST
 			goto finish;
 		}
 
+		/*
+		 *	The callback needs a talloced string.  Fields
+		 *	decoded from the index aren't, so copy them.
+		 */
+		if (e) {
+			value = data[field];
+		} else {
+			MEM(value = talloc_strdup(row, data[field]));
+		}
+
 		/*
 		 *	Pass the raw data to the callback, which will
 		 *	create the VP and add it to the map.
 		 */
-		if (map_to_request(request, map, csv_map_getvalue, e->data[field]) < 0) {
+		if (map_to_request(request, map, csv_map_getvalue, value) < 0) {
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
 	}
 
 finish:
+	talloc_free(row);
 	talloc_free(key_str);
 	return rcode;
 }
@@ -541,4 +1047,5 @@ rad_module_t rlm_csv = {
 	.inst_size	= sizeof(rlm_csv_t),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
+	.detach		= mod_detach,
 };
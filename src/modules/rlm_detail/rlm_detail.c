@@ -31,10 +31,19 @@ RCSID("$Id$")
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/detail.h>
 #include <freeradius-devel/exfile.h>
+#include <freeradius-devel/io/atomic_queue.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #ifdef HAVE_FNMATCH_H
 #  include <fnmatch.h>
@@ -50,6 +59,84 @@ RCSID("$Id$")
 
 #define DIRLEN	8192		//!< Maximum path length.
 
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+#  define WITH_DETAIL_WRITER
+#endif
+
+/** When the writer thread should fsync() detail files
+ *
+ */
+typedef enum {
+	DETAIL_FSYNC_NONE = 0,			//!< Leave it to the OS.
+	DETAIL_FSYNC_INTERVAL,			//!< At most once every fsync_interval.
+	DETAIL_FSYNC_BATCH			//!< After every batch.  Requests wait until their
+						//!< entry has been synced.
+} detail_fsync_t;
+
+static const FR_NAME_NUMBER detail_fsync_table[] = {
+	{ "none",	DETAIL_FSYNC_NONE },
+	{ "interval",	DETAIL_FSYNC_INTERVAL },
+	{ "batch",	DETAIL_FSYNC_BATCH },
+
+	{  NULL , -1 }
+};
+
+/** How entries are written
+ *
+ */
+typedef enum {
+	DETAIL_FORMAT_TEXT = 0,			//!< "attribute = value" lines.
+	DETAIL_FORMAT_BINARY			//!< Length prefixed records holding a RADIUS packet.
+} detail_format_t;
+
+static const FR_NAME_NUMBER detail_format_table[] = {
+	{ "text",	DETAIL_FORMAT_TEXT },
+	{ "binary",	DETAIL_FORMAT_BINARY },
+
+	{  NULL , -1 }
+};
+
+typedef struct detail_notify detail_notify_t;
+
+/** A formatted entry, passed from a worker to the writer thread
+ *
+ * Allocated with malloc(), as it's freed by a different thread to
+ * the one which allocated it.
+ */
+typedef struct detail_record detail_record_t;
+struct detail_record {
+	char		*filename;	//!< Expanded filename.
+	char		*data;		//!< Formatted entry.
+	size_t		len;		//!< Length of the entry.
+	size_t		size;		//!< Space allocated for the entry.
+
+	detail_notify_t	*notify;	//!< To pass the record back to the worker once it's been
+					//!< written, or NULL if the worker isn't waiting.
+	detail_record_t	*next;		//!< Next record passed back to the worker.
+	REQUEST		*request;	//!< Waiting for the entry to be written.  NULL if the
+					//!< request was cancelled.
+	bool		notified;	//!< Request has been marked as resumable.
+	rlm_rcode_t	rcode;		//!< Result of writing the entry.
+};
+
+/** Passes written records back from the writer thread to a worker
+ *
+ * Allocated with malloc(), and freed when the worker, and all the records
+ * referring to it, have released it.  The worker can detach whilst the
+ * writer still has its records, they're then freed by the writer.
+ */
+struct detail_notify {
+	pthread_mutex_t	mutex;		//!< Protects the list, detached and refs.
+	detail_record_t	*head;		//!< Records written, and not yet collected by the worker.
+	detail_record_t	**tail;		//!< Where to add the next record.
+	int		fd[2];		//!< Pipe used to wake the worker.
+	bool		detached;	//!< The worker has gone.  Records are freed, not passed back.
+	uint32_t	refs;		//!< The worker, records, and the writer's retry list.
+
+	bool		retry;		//!< Waking the worker failed.  Only used by the writer.
+	detail_notify_t	*next_retry;	//!< Next worker to try waking again.  Only used by the writer.
+};
+
 /** Instance configuration for rlm_detail
  *
  * Holds the configuration and preparsed data for a instance of rlm_detail.
@@ -61,6 +148,8 @@ typedef struct detail_instance {
 	char const	*group;		//!< Group to use for new files.
 
 	char const	*header;	//!< Header format.
+	char const	*format_str;	//!< Entry format.
+	detail_format_t	format;		//!< Entry format.
 	bool		locking;	//!< Whether the file should be locked.
 
 	bool		log_srcdst;	//!< Add IP src/dst attributes to entries.
@@ -72,20 +161,535 @@ typedef struct detail_instance {
 	exfile_t    	*ef;		//!< Log file handler
 
 	fr_hash_table_t *ht;		//!< Holds suppressed attributes.
+
+	bool		writer;		//!< Write entries from a dedicated thread.
+	char const	*fsync_str;	//!< When to fsync() files.
+	detail_fsync_t	fsync;		//!< When to fsync() files.
+	struct timeval	fsync_interval;	//!< Minimum time between fsync() calls.
+	uint32_t	queue_size;	//!< Maximum number of entries waiting to be written.
+	uint32_t	max_batch;	//!< Maximum number of entries written at once.
+	gid_t		gid;		//!< Resolved group, for files written by the writer thread.
+	bool		have_gid;	//!< Whether the group was resolved.
+
+	fr_atomic_queue_t *queue;	//!< Entries waiting to be written.
+	int		wake[2];	//!< Pipe to wake the writer thread.
+	atomic_bool	wake_pending;	//!< Whether a wakeup has been sent, and not yet consumed.
+	pthread_t	writer_id;	//!< Writer thread.
+	detail_notify_t	*retry;		//!< Workers the writer thread failed to wake.
+	bool		writer_running;	//!< Whether the writer thread was started.
+	bool volatile	writer_stop;	//!< Tell the writer thread to exit.
 } rlm_detail_t;
 
+/** Thread specific rlm_detail data
+ *
+ */
+typedef struct {
+	rlm_detail_t const *inst;	//!< Instance the thread belongs to.
+	fr_event_list_t	*el;		//!< Of the worker.
+	detail_notify_t	*notify;	//!< Records are passed back to the worker on.
+} rlm_detail_thread_t;
+
+static const CONF_PARSER writer_config[] = {
+	{ FR_CONF_OFFSET("enable", PW_TYPE_BOOLEAN, rlm_detail_t, writer), .dflt = "no" },
+	{ FR_CONF_OFFSET("fsync", PW_TYPE_STRING, rlm_detail_t, fsync_str), .dflt = "none" },
+	{ FR_CONF_OFFSET("fsync_interval", PW_TYPE_TIMEVAL, rlm_detail_t, fsync_interval), .dflt = "1.0" },
+	{ FR_CONF_OFFSET("queue_size", PW_TYPE_INTEGER, rlm_detail_t, queue_size), .dflt = "4096" },
+	{ FR_CONF_OFFSET("max_batch", PW_TYPE_INTEGER, rlm_detail_t, max_batch), .dflt = "256" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_OUTPUT | PW_TYPE_REQUIRED | PW_TYPE_XLAT, rlm_detail_t, filename), .dflt = "%A/%{Client-IP-Address}/detail" },
 	{ FR_CONF_OFFSET("header", PW_TYPE_STRING | PW_TYPE_XLAT, rlm_detail_t, header), .dflt = "%t" },
+	{ FR_CONF_OFFSET("format", PW_TYPE_STRING, rlm_detail_t, format_str), .dflt = "text" },
 	{ FR_CONF_OFFSET("permissions", PW_TYPE_INTEGER, rlm_detail_t, perm), .dflt = "0600" },
 	{ FR_CONF_OFFSET("group", PW_TYPE_STRING, rlm_detail_t, group) },
 	{ FR_CONF_OFFSET("locking", PW_TYPE_BOOLEAN, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", PW_TYPE_BOOLEAN, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", PW_TYPE_BOOLEAN, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_POINTER("writer", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) writer_config },
 	CONF_PARSER_TERMINATOR
 };
 
 
+#ifdef WITH_DETAIL_WRITER
+#ifndef IOV_MAX
+#  define IOV_MAX 1024
+#endif
+
+/** Allocate the structure records are passed back to a worker with
+ *
+ */
+static detail_notify_t *detail_notify_alloc(void)
+{
+	detail_notify_t *notify;
+
+	notify = calloc(1, sizeof(*notify));
+	if (!notify) return NULL;
+
+	if (pipe(notify->fd) < 0) {
+		free(notify);
+		return NULL;
+	}
+
+	/*
+	 *	If the pipe is full, the worker has
+	 *	already been woken.
+	 */
+	fr_nonblock(notify->fd[0]);
+	fr_nonblock(notify->fd[1]);
+
+	pthread_mutex_init(&notify->mutex, NULL);
+	notify->tail = &notify->head;
+	notify->refs = 1;
+
+	return notify;
+}
+
+static void detail_notify_acquire(detail_notify_t *notify)
+{
+	pthread_mutex_lock(&notify->mutex);
+	notify->refs++;
+	pthread_mutex_unlock(&notify->mutex);
+}
+
+/** Release a reference, freeing the structure if it was the last one
+ *
+ */
+static void detail_notify_release(detail_notify_t *notify)
+{
+	bool last;
+
+	pthread_mutex_lock(&notify->mutex);
+	last = (--notify->refs == 0);
+	pthread_mutex_unlock(&notify->mutex);
+
+	if (!last) return;
+
+	close(notify->fd[0]);
+	close(notify->fd[1]);
+	pthread_mutex_destroy(&notify->mutex);
+	free(notify);
+}
+
+/** Wake the worker
+ *
+ * @return
+ *	- 0 on success, or if the worker has already been woken.
+ *	- -1 on failure.
+ */
+static int detail_notify_wake(detail_notify_t *notify)
+{
+	char	c = 0;
+	ssize_t	ret;
+
+	do {
+		ret = write(notify->fd[1], &c, 1);
+	} while ((ret < 0) && (errno == EINTR));
+
+	if ((ret < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) return -1;
+
+	return 0;
+}
+
+static void detail_record_free(detail_record_t *record)
+{
+	detail_notify_t *notify = record->notify;
+
+	free(record->filename);
+	free(record->data);
+	free(record);
+
+	if (notify) detail_notify_release(notify);
+}
+
+/** Pass a record back to the worker waiting for it, or free it if nothing is waiting
+ *
+ * If the worker can't be woken, it's added to the list of workers the
+ * writer thread tries to wake again, so the request is always resumed.
+ */
+static void detail_record_done(rlm_detail_t *inst, detail_record_t *record, rlm_rcode_t rcode)
+{
+	detail_notify_t	*notify = record->notify;
+	bool		retry = false;
+
+	record->rcode = rcode;
+
+	if (!notify) {
+		detail_record_free(record);
+		return;
+	}
+
+	pthread_mutex_lock(&notify->mutex);
+	if (notify->detached) {
+		pthread_mutex_unlock(&notify->mutex);
+		detail_record_free(record);
+		return;
+	}
+
+	record->next = NULL;
+	*notify->tail = record;
+	notify->tail = &record->next;
+
+	/*
+	 *	Only wake the worker for the first record,
+	 *	it collects the whole list.
+	 */
+	if ((notify->head == record) && !notify->retry && (detail_notify_wake(notify) < 0)) {
+		ERROR("Failed waking worker, will retry: %s", fr_syserror(errno));
+		notify->retry = true;
+		notify->refs++;
+		retry = true;
+	}
+	pthread_mutex_unlock(&notify->mutex);
+
+	if (retry) {
+		notify->next_retry = inst->retry;
+		inst->retry = notify;
+	}
+}
+
+/** Try waking the workers which couldn't be woken before
+ *
+ */
+static void detail_notify_retry(rlm_detail_t *inst)
+{
+	detail_notify_t **last = &inst->retry, *notify;
+
+	while ((notify = *last)) {
+		pthread_mutex_lock(&notify->mutex);
+		if (!notify->detached && (detail_notify_wake(notify) < 0)) {
+			pthread_mutex_unlock(&notify->mutex);
+			last = &notify->next_retry;
+			continue;
+		}
+		notify->retry = false;
+		pthread_mutex_unlock(&notify->mutex);
+
+		*last = notify->next_retry;
+		detail_notify_release(notify);
+	}
+}
+
+/** Write all the iovecs, retrying after short writes
+ *
+ */
+static int detail_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t len;
+
+		len = writev(fd, iov, (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		while ((iovcnt > 0) && ((size_t) len >= iov->iov_len)) {
+			len -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = ((uint8_t *) iov->iov_base) + len;
+			iov->iov_len -= len;
+		}
+	}
+
+	return 0;
+}
+
+/** Remember a file needs syncing at the next interval
+ *
+ */
+static void detail_dirty_add(char ***dirty, uint32_t *num_dirty, char const *filename)
+{
+	uint32_t	i;
+	char		**p;
+
+	for (i = 0; i < *num_dirty; i++) if (strcmp((*dirty)[i], filename) == 0) return;
+
+	p = realloc(*dirty, sizeof(*p) * (*num_dirty + 1));
+	if (!p) return;
+	*dirty = p;
+
+	p[*num_dirty] = strdup(filename);
+	if (p[*num_dirty]) (*num_dirty)++;
+}
+
+/** Sync all the files written to since the last interval
+ *
+ */
+static void detail_dirty_sync(rlm_detail_t const *inst, char **dirty, uint32_t *num_dirty)
+{
+	uint32_t i;
+
+	for (i = 0; i < *num_dirty; i++) {
+		int fd;
+
+		fd = exfile_open(inst->ef, NULL, dirty[i], inst->perm, true);
+		if (fd >= 0) {
+			if (fsync(fd) < 0) ERROR("Failed syncing %s: %s", dirty[i], fr_syserror(errno));
+			exfile_unlock(inst->ef, NULL, fd);
+		}
+		free(dirty[i]);
+	}
+	*num_dirty = 0;
+}
+
+/** Write a batch of records, with one open, lock, writev and (optionally) fsync per file
+ *
+ */
+static void detail_batch_write(rlm_detail_t *inst, detail_record_t **batch, uint32_t num,
+			       struct iovec *iov, char ***dirty, uint32_t *num_dirty)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < num; i++) {
+		char const	*filename;
+		rlm_rcode_t	rcode = RLM_MODULE_OK;
+		int		fd, iovcnt = 0;
+
+		if (!batch[i]) continue;
+
+		/*
+		 *	Gather all the entries for this file,
+		 *	keeping them in the order they were queued.
+		 */
+		filename = batch[i]->filename;
+		for (j = i; j < num; j++) {
+			if (!batch[j] || (strcmp(batch[j]->filename, filename) != 0)) continue;
+
+			iov[iovcnt].iov_base = batch[j]->data;
+			iov[iovcnt].iov_len = batch[j]->len;
+			iovcnt++;
+		}
+
+		fd = exfile_open(inst->ef, NULL, filename, inst->perm, true);
+		if (fd < 0) {
+			ERROR("Couldn't open file %s: %s", filename, fr_strerror());
+			rcode = RLM_MODULE_FAIL;
+			goto done;
+		}
+
+		if (inst->have_gid && (fchown(fd, -1, inst->gid) < 0)) {
+			DEBUG2("Unable to change system group of '%s'", filename);
+		}
+
+		if (detail_writev(fd, iov, iovcnt) < 0) {
+			ERROR("Failed writing to detail file %s: %s", filename, fr_syserror(errno));
+			rcode = RLM_MODULE_FAIL;
+
+		} else if ((inst->fsync == DETAIL_FSYNC_BATCH) && (fsync(fd) < 0)) {
+			ERROR("Failed syncing detail file %s: %s", filename, fr_syserror(errno));
+			rcode = RLM_MODULE_FAIL;
+
+		} else if (inst->fsync == DETAIL_FSYNC_INTERVAL) {
+			detail_dirty_add(dirty, num_dirty, filename);
+		}
+
+		exfile_unlock(inst->ef, NULL, fd);
+
+	done:
+		for (j = num; j > i; j--) {
+			detail_record_t *record = batch[j - 1];
+
+			if (!record || (strcmp(record->filename, filename) != 0)) continue;
+
+			batch[j - 1] = NULL;
+			detail_record_done(inst, record, rcode);
+		}
+	}
+}
+
+/** Write entries queued by workers, until told to stop
+ *
+ */
+static void *detail_writer_thread(void *arg)
+{
+	rlm_detail_t	*inst = arg;
+	detail_record_t	**batch;
+	struct iovec	*iov;
+	char		**dirty = NULL;
+	uint32_t	num_dirty = 0;
+	struct timeval	when, now;
+	int		timeout = -1;
+
+	batch = malloc(sizeof(*batch) * inst->max_batch);
+	iov = malloc(sizeof(*iov) * inst->max_batch);
+	if (!batch || !iov) {
+		ERROR("Out of memory");
+		free(batch);
+		free(iov);
+		return NULL;
+	}
+
+	if (inst->fsync == DETAIL_FSYNC_INTERVAL) {
+		timeout = (inst->fsync_interval.tv_sec * 1000) + (inst->fsync_interval.tv_usec / 1000);
+		if (timeout < 1) timeout = 1;
+	}
+
+	gettimeofday(&when, NULL);
+	fr_timeval_add(&when, &when, &inst->fsync_interval);
+
+	while (true) {
+		struct pollfd	pfd;
+		uint32_t	num = 0;
+		void		*data;
+
+		while ((num < inst->max_batch) && fr_atomic_queue_pop(inst->queue, &data)) batch[num++] = data;
+
+		if (num > 0) detail_batch_write(inst, batch, num, iov, &dirty, &num_dirty);
+
+		if (inst->retry) detail_notify_retry(inst);
+
+		if (num_dirty > 0) {
+			gettimeofday(&now, NULL);
+			if (fr_timeval_cmp(&now, &when) >= 0) {
+				detail_dirty_sync(inst, dirty, &num_dirty);
+				fr_timeval_add(&when, &now, &inst->fsync_interval);
+			}
+		}
+
+		/*
+		 *	Keep going until the queue is empty.
+		 */
+		if (num > 0) continue;
+
+		if (inst->writer_stop) break;
+
+		pfd.fd = inst->wake[0];
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, (inst->retry && ((timeout < 0) || (timeout > 100))) ? 100 : timeout) > 0) {
+			char buffer[64];
+
+			while (read(inst->wake[0], buffer, sizeof(buffer)) > 0);
+
+			/*
+			 *	Cleared after draining the pipe, and
+			 *	before checking the queue, so a worker
+			 *	queueing an entry now will wake us again.
+			 */
+			atomic_store(&inst->wake_pending, false);
+		}
+	}
+
+	detail_dirty_sync(inst, dirty, &num_dirty);
+	free(dirty);
+	free(batch);
+	free(iov);
+
+	while (inst->retry) {
+		detail_notify_t *notify = inst->retry;
+
+		inst->retry = notify->next_retry;
+		detail_notify_release(notify);
+	}
+
+	return NULL;
+}
+
+/** Wake the writer thread, unless it's already been woken
+ *
+ */
+static void detail_writer_wake(rlm_detail_t *inst)
+{
+	char c = 0;
+
+	if (atomic_exchange(&inst->wake_pending, true)) return;
+
+	if (write(inst->wake[1], &c, 1) < 0) {
+		ERROR("Failed waking writer thread: %s", fr_syserror(errno));
+	}
+}
+
+/** Start the writer thread
+ *
+ */
+static int detail_writer_start(CONF_SECTION *conf, rlm_detail_t *inst)
+{
+	int fsync;
+
+	fsync = fr_str2int(detail_fsync_table, inst->fsync_str, -1);
+	if (fsync < 0) {
+		cf_log_err_cs(conf, "Invalid 'writer.fsync' value \"%s\", expected 'none', 'interval' or 'batch'",
+			      inst->fsync_str);
+		return -1;
+	}
+	inst->fsync = fsync;
+
+	FR_INTEGER_BOUND_CHECK("writer.queue_size", inst->queue_size, >=, 16);
+	FR_INTEGER_BOUND_CHECK("writer.max_batch", inst->max_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("writer.max_batch", inst->max_batch, <=, inst->queue_size);
+	FR_TIMEVAL_BOUND_CHECK("writer.fsync_interval", &inst->fsync_interval, >=, 0, 10000);
+
+	/*
+	 *	Resolve the group once, rather than for each batch.
+	 */
+	if (inst->group) {
+		char *endptr;
+
+		inst->gid = strtol(inst->group, &endptr, 10);
+		inst->have_gid = true;
+		if ((*endptr != '\0') && (rad_getgid(inst, &inst->gid, inst->group) < 0)) {
+			WARN("Unable to find system group '%s'", inst->group);
+			inst->have_gid = false;
+		}
+	}
+
+	/*
+	 *	Only checking the config.  Don't start threads.
+	 */
+	if (check_config) return 0;
+
+	inst->queue = fr_atomic_queue_create(inst, inst->queue_size);
+	if (!inst->queue) {
+		cf_log_err_cs(conf, "Failed creating writer queue");
+		return -1;
+	}
+
+	if (pipe(inst->wake) < 0) {
+		cf_log_err_cs(conf, "Failed creating writer pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+	fr_nonblock(inst->wake[0]);
+	atomic_init(&inst->wake_pending, false);
+
+	if (pthread_create(&inst->writer_id, NULL, detail_writer_thread, inst) != 0) {
+		cf_log_err_cs(conf, "Failed creating writer thread: %s", fr_syserror(errno));
+		close(inst->wake[0]);
+		close(inst->wake[1]);
+		return -1;
+	}
+	inst->writer_running = true;
+
+	return 0;
+}
+
+/** Write any remaining entries, and stop the writer thread
+ *
+ */
+static void detail_writer_stop(rlm_detail_t *inst)
+{
+	char c = 0;
+
+	if (!inst->writer_running) return;
+
+	inst->writer_stop = true;
+	if (write(inst->wake[1], &c, 1) < 0) {
+		ERROR("Failed waking writer thread: %s", fr_syserror(errno));
+	}
+	pthread_join(inst->writer_id, NULL);
+	inst->writer_running = false;
+
+	close(inst->wake[0]);
+	close(inst->wake[1]);
+}
+#endif
+
 /*
  *	Clean up.
  */
@@ -93,6 +697,10 @@ static int mod_detach(void *instance)
 {
 	rlm_detail_t *inst = instance;
 
+#ifdef WITH_DETAIL_WRITER
+	detail_writer_stop(inst);
+#endif
+
 	if (inst->ht) fr_hash_table_free(inst->ht);
 	return 0;
 }
@@ -119,10 +727,18 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 {
 	rlm_detail_t *inst = instance;
 	CONF_SECTION	*cs;
+	int		format;
 
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
 
+	format = fr_str2int(detail_format_table, inst->format_str, -1);
+	if (format < 0) {
+		cf_log_err_cs(conf, "Invalid 'format' value \"%s\", expected 'text' or 'binary'", inst->format_str);
+		return -1;
+	}
+	inst->format = format;
+
 	/*
 	 *	Escape filenames only if asked.
 	 */
@@ -138,6 +754,15 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	if (inst->writer) {
+#ifdef WITH_DETAIL_WRITER
+		if (detail_writer_start(conf, inst) < 0) return -1;
+#else
+		cf_log_err_cs(conf, "'writer' is not supported on this system");
+		return -1;
+#endif
+	}
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -210,6 +835,62 @@ static void detail_fr_pair_fprint(TALLOC_CTX *ctx, FILE *out, VALUE_PAIR const *
 }
 
 
+/** Write a single binary detail record to file pointer
+ *
+ * Attributes which can't be sent in a RADIUS packet aren't written.
+ *
+ * @param[in] out Where to write the record.
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request (request, reply, proxy-request, proxy-reply...).
+ * @param[in] compat Write out entry in compatibility mode.
+ */
+static int detail_write_binary(FILE *out, rlm_detail_t const *inst, REQUEST *request, RADIUS_PACKET *packet,
+			       bool compat)
+{
+	VALUE_PAIR	*vps = packet->vps;
+	uint8_t		*record;
+	ssize_t		len;
+
+	/*
+	 *	Only copy the list if something has to be left out.
+	 */
+	if (inst->ht || compat) {
+		vp_cursor_t	cursor, out_cursor;
+		VALUE_PAIR	*vp;
+
+		vps = NULL;
+		fr_pair_cursor_init(&out_cursor, &vps);
+
+		for (vp = fr_pair_cursor_init(&cursor, &packet->vps);
+		     vp;
+		     vp = fr_pair_cursor_next(&cursor)) {
+			if (inst->ht && fr_hash_table_finddata(inst->ht, vp->da)) continue;
+			if (compat && !vp->da->vendor && (vp->da->attr == PW_USER_PASSWORD)) continue;
+
+			fr_pair_cursor_append(&out_cursor, fr_pair_copy(request, vp));
+		}
+	}
+
+	len = detail_binary_encode(request, &record, packet, vps,
+				   request->client ? &request->client->ipaddr : NULL,
+				   request->packet->timestamp.tv_sec, inst->log_srcdst);
+	if (vps != packet->vps) fr_pair_list_free(&vps);
+	if (len < 0) {
+		RERROR("Failed encoding detail record: %s", fr_strerror());
+		return -1;
+	}
+
+	if (fwrite(record, 1, len, out) < (size_t) len) {
+		RERROR("Failed writing to detail file: %s", fr_syserror(errno));
+		talloc_free(record);
+		return -1;
+	}
+	talloc_free(record);
+
+	return 0;
+}
+
 /** Write a single detail entry to file pointer
  *
  * @param[in] out Where to write entry.
@@ -223,6 +904,15 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 	VALUE_PAIR *vp;
 	char timestamp[256];
 
+	if (inst->format == DETAIL_FORMAT_BINARY) {
+		if (!packet->vps) {
+			RWDEBUG("Skipping empty packet");
+			return 0;
+		}
+
+		return detail_write_binary(out, inst, request, packet, compat);
+	}
+
 	if (xlat_eval(timestamp, sizeof(timestamp), request, inst->header, NULL, NULL) < 0) {
 		return -1;
 	}
@@ -342,10 +1032,242 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 	return 0;
 }
 
+#ifdef WITH_DETAIL_WRITER
+/** Append formatted output to a record
+ *
+ */
+#ifdef HAVE_FOPENCOOKIE
+static ssize_t _detail_record_write(void *cookie, char const *buffer, size_t len)
+#else
+static int _detail_record_write(void *cookie, char const *buffer, int len)
+#endif
+{
+	detail_record_t *record = cookie;
+
+	if ((record->len + len) > record->size) {
+		size_t	size = record->size ? record->size : 1024;
+		char	*p;
+
+		while (size < (record->len + len)) size *= 2;
+
+		p = realloc(record->data, size);
+		if (!p) return -1;
+
+		record->data = p;
+		record->size = size;
+	}
+
+	memcpy(record->data + record->len, buffer, len);
+	record->len += len;
+
+	return len;
+}
+
+/** Open a FILE * which writes into a record
+ *
+ */
+static FILE *detail_record_fopen(detail_record_t *record)
+{
+#ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t io;
+
+	/*
+	 *	These must be set separately as they have different prototypes.
+	 */
+	io.read = NULL;
+	io.seek = NULL;
+	io.close = NULL;
+	io.write = _detail_record_write;
+
+	return fopencookie(record, "w", io);
+#else
+	return funopen(record, NULL, _detail_record_write, NULL, NULL);
+#endif
+}
+
+/** Pass records the writer thread has finished with back to the requests waiting for them
+ *
+ */
+static void _detail_notify_read(UNUSED fr_event_list_t *el, int fd, void *ctx)
+{
+	rlm_detail_thread_t	*t = ctx;
+	detail_notify_t		*notify = t->notify;
+	detail_record_t		*record, *next;
+	char			buffer[64];
+
+	/*
+	 *	Drain the pipe before collecting the list, so a
+	 *	record added after we've collected it wakes us
+	 *	again.
+	 */
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+
+	pthread_mutex_lock(&notify->mutex);
+	record = notify->head;
+	notify->head = NULL;
+	notify->tail = &notify->head;
+	pthread_mutex_unlock(&notify->mutex);
+
+	for (; record; record = next) {
+		next = record->next;
+
+		/*
+		 *	The request was cancelled while the
+		 *	entry was being written.
+		 */
+		if (!record->request) {
+			detail_record_free(record);
+			continue;
+		}
+
+		record->notified = true;
+		unlang_resumable(record->request);
+	}
+}
+
+static rlm_rcode_t mod_writer_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx)
+{
+	detail_record_t	*record = ctx;
+	rlm_rcode_t	rcode = record->rcode;
+
+	if (rcode == RLM_MODULE_OK) {
+		RDEBUG2("Entry written to %s", record->filename);
+	} else {
+		REDEBUG("Failed writing entry to %s", record->filename);
+	}
+
+	detail_record_free(record);
+
+	return rcode;
+}
+
+static void mod_writer_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+			      fr_state_action_t action)
+{
+	detail_record_t *record = ctx;
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Request cancelled, not waiting for entry to be written");
+
+	/*
+	 *	Already passed back, but the request won't
+	 *	be resumed now, so free it here.
+	 */
+	if (record->notified) {
+		detail_record_free(record);
+		return;
+	}
+
+	/*
+	 *	Freed when the writer thread passes it back.
+	 */
+	record->request = NULL;
+}
+
+/** Format an entry, and queue it for the writer thread
+ *
+ * @param[in] inst of rlm_detail.
+ * @param[in] t thread specific data.
+ * @param[in] request The current request.
+ * @param[in] filename to write the entry to.
+ * @param[in] packet to write.
+ * @param[in] compat Write out entry in compatibility mode.
+ * @param[out] queued Whether the entry was queued.  If not, the caller should write it directly.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t detail_queue(rlm_detail_t const *inst, rlm_detail_thread_t *t, REQUEST *request,
+				char const *filename, RADIUS_PACKET *packet, bool compat, bool *queued)
+{
+	detail_record_t	*record;
+	rlm_detail_t	*mutable;
+	FILE		*out;
+	bool		wait = false;
+
+	*queued = false;
+
+	/*
+	 *	Nothing can mark the request as resumable (e.g.
+	 *	in unit_test_module), so the caller writes and
+	 *	syncs the entry itself.
+	 */
+	if ((inst->fsync == DETAIL_FSYNC_BATCH) && !request->backlog) return RLM_MODULE_NOOP;
+
+	record = calloc(1, sizeof(*record));
+	if (!record) return RLM_MODULE_FAIL;
+
+	record->filename = strdup(filename);
+	if (!record->filename) {
+	error:
+		detail_record_free(record);
+		return RLM_MODULE_FAIL;
+	}
+
+	out = detail_record_fopen(record);
+	if (!out) {
+		RERROR("Failed creating entry buffer: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if (detail_write(out, inst, request, packet, compat) < 0) {
+		fclose(out);
+		goto error;
+	}
+
+	if (fclose(out) != 0) {
+		RERROR("Failed formatting entry: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	Empty packet, there's nothing to write.
+	 */
+	if (!record->data) {
+		*queued = true;
+		detail_record_free(record);
+		return RLM_MODULE_OK;
+	}
+
+	/*
+	 *	Only wait if the entry will be synced,
+	 *	and we can be told when it has been.
+	 */
+	if ((inst->fsync == DETAIL_FSYNC_BATCH) && t->notify) {
+		detail_notify_acquire(t->notify);
+		record->notify = t->notify;
+		record->request = request;
+		wait = true;
+	}
+
+	if (!fr_atomic_queue_push(inst->queue, record)) {
+		RWDEBUG("Writer queue is full, writing entry directly");
+		detail_record_free(record);
+		return RLM_MODULE_NOOP;
+	}
+	*queued = true;
+
+	/*
+	 *	The writer owns the record now.  If we're not
+	 *	waiting for it, it may already have been freed.
+	 */
+	memcpy(&mutable, &inst, sizeof(mutable));
+	detail_writer_wake(mutable);
+
+	if (!wait) {
+		RDEBUG2("Entry queued for %s", filename);
+		return RLM_MODULE_OK;
+	}
+
+	RDEBUG2("Entry queued for %s, waiting for it to be written", filename);
+
+	return unlang_yield(request, mod_writer_resume, mod_writer_action, record);
+}
+#endif
+
 /*
  *	Do detail, compatible with old accounting
  */
-static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *request,
+static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, void *thread, REQUEST *request,
 					      RADIUS_PACKET *packet, bool compat)
 {
 	int		outfd;
@@ -388,6 +1310,16 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 #endif
 #endif
 
+#ifdef WITH_DETAIL_WRITER
+	if (inst->writer) {
+		rlm_rcode_t	rcode;
+		bool		queued;
+
+		rcode = detail_queue(inst, thread, request, buffer, packet, compat, &queued);
+		if (queued || (rcode == RLM_MODULE_FAIL)) return rcode;
+	}
+#endif
+
 	outfd = exfile_open(inst->ef, request, buffer, inst->perm, true);
 	if (outfd < 0) {
 		RERROR("Couldn't open file %s: %s", buffer, fr_strerror());
@@ -422,6 +1354,18 @@ skip_group:
 
 	if (detail_write(outfp, inst, request, packet, compat) < 0) goto fail;
 
+#ifdef WITH_DETAIL_WRITER
+	/*
+	 *	Entries which couldn't be queued are still
+	 *	synced before the request continues.
+	 */
+	if (inst->writer && (inst->fsync == DETAIL_FSYNC_BATCH) &&
+	    ((fflush(outfp) != 0) || (fsync(outfd) < 0))) {
+		RERROR("Failed syncing detail file %s: %s", buffer, fr_syserror(errno));
+		goto fail;
+	}
+#endif
+
 	/*
 	 *	Flush everything
 	 */
@@ -437,7 +1381,7 @@ skip_group:
 /*
  *	Accounting - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 #ifdef WITH_DETAIL
 	if (request->listener->type == RAD_LISTEN_DETAIL &&
@@ -448,40 +1392,40 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *
 	}
 #endif
 
-	return detail_do(instance, request, request->packet, true);
+	return detail_do(instance, thread, request, request->packet, true);
 }
 
 /*
  *	Incoming Access Request - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->packet, false);
+	return detail_do(instance, thread, request, request->packet, false);
 }
 
 /*
  *	Outgoing Access-Request Reply - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->reply, false);
+	return detail_do(instance, thread, request, request->reply, false);
 }
 
 #ifdef WITH_COA
 /*
  *	Incoming CoA - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_recv_coa(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_recv_coa(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->packet, false);
+	return detail_do(instance, thread, request, request->packet, false);
 }
 
 /*
  *	Outgoing CoA - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_send_coa(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_send_coa(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->reply, false);
+	return detail_do(instance, thread, request, request->reply, false);
 }
 #endif
 
@@ -489,9 +1433,9 @@ static rlm_rcode_t CC_HINT(nonnull) mod_send_coa(void *instance, UNUSED void *th
  *	Outgoing Access-Request to home server - write the detail files.
  */
 #ifdef WITH_PROXY
-static rlm_rcode_t CC_HINT(nonnull) mod_pre_proxy(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_pre_proxy(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->proxy->packet, false);
+	return detail_do(instance, thread, request, request->proxy->packet, false);
 }
 
 
@@ -511,25 +1455,110 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_proxy(void *instance, void *thread,
 		rlm_rcode_t rcode;
 
 		rcode = mod_accounting(instance, thread, request);
-		if (rcode == RLM_MODULE_OK) {
+
+		/*
+		 *	If we're waiting for the writer thread, the
+		 *	reply code has to be set before we resume.
+		 */
+		if ((rcode == RLM_MODULE_OK) || (rcode == RLM_MODULE_YIELD)) {
 			request->reply->code = PW_CODE_ACCOUNTING_RESPONSE;
 		}
 		return rcode;
 	}
 
-	return detail_do(instance, request, request->proxy->reply, false);
+	return detail_do(instance, thread, request, request->proxy->reply, false);
 }
 #endif
 
+/** Create the pipe the writer thread passes completed records back on
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_detail.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_detail_t		*inst = instance;
+	rlm_detail_thread_t	*t = thread;
+
+	t->inst = inst;
+	t->el = el;
+
+#ifdef WITH_DETAIL_WRITER
+	if (!inst->writer || (inst->fsync != DETAIL_FSYNC_BATCH)) return 0;
+
+	t->notify = detail_notify_alloc();
+	if (!t->notify) {
+		ERROR("Failed creating writer notification pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (fr_event_fd_insert(el, t->notify->fd[0], _detail_notify_read, NULL, NULL, t) < 0) {
+		ERROR("Failed adding writer notification pipe to event list: %s", fr_strerror());
+		detail_notify_release(t->notify);
+		t->notify = NULL;
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+/** Stop receiving records from the writer thread
+ *
+ * Records the writer thread still has are freed by it once they've
+ * been written, so we don't wait for them.
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+#ifdef WITH_DETAIL_WRITER
+	rlm_detail_thread_t	*t = thread;
+	detail_notify_t		*notify = t->notify;
+	detail_record_t		*record, *next;
+
+	if (!notify) return 0;
+
+	(void) fr_event_fd_delete(t->el, notify->fd[0]);
+
+	pthread_mutex_lock(&notify->mutex);
+	notify->detached = true;
+	record = notify->head;
+	notify->head = NULL;
+	notify->tail = &notify->head;
+	pthread_mutex_unlock(&notify->mutex);
+
+	for (; record; record = next) {
+		next = record->next;
+		detail_record_free(record);
+	}
+
+	detail_notify_release(notify);
+	t->notify = NULL;
+#endif
+
+	return 0;
+}
+
 /* globally exported name */
 extern rad_module_t rlm_detail;
 rad_module_t rlm_detail = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "detail",
 	.inst_size	= sizeof(rlm_detail_t),
+	.thread_inst_size	= sizeof(rlm_detail_thread_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
 	.detach		= mod_detach,
+	.thread_detach	= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 		[MOD_PREACCT]		= mod_accounting,
@@ -85,6 +85,8 @@ struct _eap_session {
 
 	bool		tls;				//!< Whether EAP method uses TLS.
 	bool		finished;			//!< Whether we consider this session complete.
+	bool		yielded;			//!< Whether the EAP method is waiting on an event, and
+							//!< should be called again when the request is resumed.
 };
 
 /** Configuration for an instance of rlm_eap
@@ -78,6 +78,7 @@ FR_NAME_NUMBER const eap_tls_status_table[] = {
 	{ "established",		EAP_TLS_ESTABLISHED },
 	{ "fail",			EAP_TLS_FAIL },
 	{ "handled",			EAP_TLS_HANDLED },
+	{ "yield",			EAP_TLS_YIELD },
 
 	{ "start",			EAP_TLS_START_SEND },
 	{ "request",			EAP_TLS_RECORD_SEND },
@@ -774,12 +775,220 @@ ignore_length:
 	return EAP_TLS_RECORD_RECV_COMPLETE;
 }
 
+#ifdef SSL_MODE_ASYNC
+/** Stop waiting on the fds of an async job
+ *
+ * @param eap_tls_session with pending fd events.
+ */
+static void eap_tls_async_fd_delete(eap_tls_session_t *eap_tls_session)
+{
+	size_t i;
+
+	if (!eap_tls_session->async_request) return;
+
+	for (i = 0; i < eap_tls_session->async_fd_count; i++) {
+		(void) unlang_event_fd_delete(eap_tls_session->async_request, eap_tls_session,
+					      eap_tls_session->async_fd[i]);
+	}
+	eap_tls_session->async_fd_count = 0;
+	eap_tls_session->async_request = NULL;
+}
+
+/** Called when an async job signals one of its fds
+ *
+ * Marks the request as resumable, so the handshake can continue.
+ */
+static void _eap_tls_async_ready(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				 UNUSED int fd)
+{
+	eap_tls_session_t *eap_tls_session = talloc_get_type_abort(ctx, eap_tls_session_t);
+
+	RDEBUG3("Async TLS job signalled completion");
+
+	eap_tls_async_fd_delete(eap_tls_session);
+	unlang_resumable(request);
+}
+
+/** Ensure we don't leave fd events for a freed session
+ *
+ * If the request is cancelled whilst waiting on an async job, the
+ * eap_session is destroyed without the fds ever being signalled.
+ */
+static int _eap_tls_session_free(eap_tls_session_t *eap_tls_session)
+{
+	eap_tls_async_fd_delete(eap_tls_session);
+
+	return 0;
+}
+
+/** Check whether the ClientHello can be processed by an async job
+ *
+ * OpenSSL runs the whole handshake step on the job's fibre, not just the
+ * private key operation, and the fibre has a small stack.  We only allow
+ * async jobs for a ClientHello which starts a full handshake, as that's
+ * where the server performs its private key operation.  Callbacks which
+ * may run policy, or perform I/O, are then called outside of the job.
+ *
+ * - A session id is often sent by clients which don't want to resume
+ *   (TLS 1.3 middlebox compatibility mode always sends one), so it's
+ *   looked up in the session cache before the job is started.  Only a
+ *   session id which resumes a cached session prevents async jobs, as
+ *   the certificate chain is then revalidated.
+ * - A ticket or PSK means a resumption attempt.
+ * - A status request means the OCSP stapling callback may be called.
+ *
+ * Anything we can't parse is processed synchronously.
+ *
+ * The job only pauses if the engine (or provider) performing the private
+ * key operation calls ASYNC_pause_job(), e.g. one which offloads the
+ * operation to a hardware accelerator.  An RSA_METHOD or EC_KEY_METHOD,
+ * or an OpenSSL 3.x provider, can offload the operation in the same way,
+ * but the server doesn't install one of its own.
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	The handshake is being performed for.
+ * @param[in] data		The TLS records received from the peer.
+ * @param[in] data_len		Length of the data.
+ * @return true if async jobs may be used.
+ */
+static bool eap_tls_client_hello_async_ok(REQUEST *request, tls_session_t *tls_session,
+					  uint8_t const *data, size_t data_len)
+{
+	uint8_t const	*p = data, *end;
+	uint8_t const	*session_id;
+	size_t		len, session_id_len;
+
+	/*
+	 *	Record header, and handshake header
+	 */
+	if (data_len < 9) return false;
+	if ((p[0] != SSL3_RT_HANDSHAKE) || (p[5] != SSL3_MT_CLIENT_HELLO)) return false;
+
+	len = (p[3] << 8) | p[4];
+	if ((len + 5) > data_len) return false;
+	end = p + 5 + len;
+
+	len = (p[6] << 16) | (p[7] << 8) | p[8];
+	if ((p + 9 + len) > end) return false;		/* ClientHello spans multiple records */
+	end = p + 9 + len;
+	p += 9;
+
+	/*
+	 *	client_version and random
+	 */
+	if ((end - p) < 35) return false;
+	p += 34;
+
+	session_id_len = p[0];				/* session_id */
+	if ((session_id_len > 32) || ((size_t)(end - p) < (1 + session_id_len))) return false;
+	session_id = p + 1;
+	p += 1 + session_id_len;
+
+	if ((end - p) < 2) return false;		/* cipher_suites */
+	len = (p[0] << 8) | p[1];
+	if ((size_t)(end - p) < (2 + len + 1)) return false;
+	p += 2 + len;
+
+	len = p[0];					/* compression_methods */
+	if ((size_t)(end - p) < (1 + len)) return false;
+	p += 1 + len;
+
+	if (p == end) goto check_session_id;		/* No extensions */
+
+	if ((end - p) < 2) return false;
+	len = (p[0] << 8) | p[1];
+	p += 2;
+	if ((size_t)(end - p) < len) return false;
+	end = p + len;
+
+	while (p < end) {
+		uint16_t	type;
+
+		if ((end - p) < 4) return false;
+		type = (p[0] << 8) | p[1];
+		len = (p[2] << 8) | p[3];
+		p += 4;
+		if ((size_t)(end - p) < len) return false;
+
+		switch (type) {
+		case TLSEXT_TYPE_status_request:
+			return false;
+
+		case TLSEXT_TYPE_session_ticket:
+			if (len > 0) return false;
+			break;
+
+#ifdef TLSEXT_TYPE_psk
+		case TLSEXT_TYPE_psk:
+			return false;
+#endif
+
+		default:
+			break;
+		}
+		p += len;
+	}
+
+check_session_id:
+	if (session_id_len && tls_cache_prefetch(request, tls_session, session_id, session_id_len)) {
+		RDEBUG2("ClientHello resumes a cached session, not using async jobs");
+		return false;
+	}
+
+	return true;
+}
+
+/** Wait for the fds of the async job the handshake is paused on
+ *
+ * @param eap_session the handshake belongs to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int eap_tls_async_wait(eap_session_t *eap_session)
+{
+	REQUEST			*request = eap_session->request;
+	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
+	SSL			*ssl = eap_tls_session->tls_session->ssl;
+	size_t			num_fds = 0, i;
+
+	if (!SSL_get_all_async_fds(ssl, NULL, &num_fds) || (num_fds == 0)) {
+		REDEBUG("Async TLS job did not provide any fds to wait on");
+		return -1;
+	}
+
+	if (num_fds > EAP_TLS_ASYNC_MAX_FDS) {
+		REDEBUG("Async TLS job wants us to wait on too many fds (%zu), max is %i",
+			num_fds, EAP_TLS_ASYNC_MAX_FDS);
+		return -1;
+	}
+
+	(void) SSL_get_all_async_fds(ssl, eap_tls_session->async_fd, &num_fds);
+
+	eap_tls_session->async_request = request;
+	for (i = 0; i < num_fds; i++) {
+		if (unlang_event_fd_readable_add(request, _eap_tls_async_ready, eap_tls_session,
+						 eap_tls_session->async_fd[i]) < 0) {
+			REDEBUG("Failed adding event for async TLS job");
+			eap_tls_async_fd_delete(eap_tls_session);
+			return -1;
+		}
+		eap_tls_session->async_fd_count++;
+	}
+
+	eap_session->yielded = true;
+
+	return 0;
+}
+#endif
+
 /** Continue with the handshake
  *
  * @param eap_session to continue.
  * @return
  *	- EAP_TLS_FAIL if the message is invalid.
  *	- EAP_TLS_HANDLED if we need to send an additional request to the peer.
+ *	- EAP_TLS_YIELD if the handshake is waiting on an async job.
  *	- EAP_TLS_ESTABLISHED if the handshake completed successfully, and there's
  *	  no more data to send.
  */
@@ -788,16 +997,50 @@ static eap_tls_status_t eap_tls_handshake(eap_session_t *eap_session)
 	REQUEST			*request = eap_session->request;
 	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
 	tls_session_t		*tls_session = eap_tls_session->tls_session;
+	int			ret;
+
+#ifdef SSL_MODE_ASYNC
+	/*
+	 *	Only the ClientHello which starts a full handshake
+	 *	is processed by an async job.  Jobs which have
+	 *	paused must be resumed in async mode.
+	 */
+	if (!eap_tls_session->async_pending) {
+		if (eap_tls_session->async && SSL_in_before(tls_session->ssl) &&
+		    eap_tls_client_hello_async_ok(request, tls_session,
+						  tls_session->dirty_in.data, tls_session->dirty_in.used)) {
+			SSL_set_mode(tls_session->ssl, SSL_MODE_ASYNC);
+		} else {
+			SSL_clear_mode(tls_session->ssl, SSL_MODE_ASYNC);
+		}
+	}
+#endif
 
 	/*
 	 *	Continue the TLS handshake
 	 */
-	if (!tls_session_handshake(eap_session->request, tls_session)) {
+	ret = tls_session_handshake(eap_session->request, tls_session);
+	if (!ret) {
+	fail:
 		REDEBUG("TLS receive handshake failed during operation");
 		tls_cache_deny(tls_session);
 		return EAP_TLS_FAIL;
 	}
 
+#ifdef SSL_MODE_ASYNC
+	/*
+	 *	Private key operation is being performed by
+	 *	an async engine.  Yield until it completes,
+	 *	and continue the handshake when we're called
+	 *	again.
+	 */
+	eap_tls_session->async_pending = (ret == 2);
+	if (eap_tls_session->async_pending) {
+		if (eap_tls_async_wait(eap_session) < 0) goto fail;
+		return EAP_TLS_YIELD;
+	}
+#endif
+
 	/*
 	 *	FIXME: return success/fail.
 	 *
@@ -855,6 +1098,7 @@ static eap_tls_status_t eap_tls_handshake(eap_session_t *eap_session)
  * @return
  *	- EAP_TLS_ESTABLISHED
  *	- EAP_TLS_HANDLED
+ *	- EAP_TLS_YIELD
  */
 eap_tls_status_t eap_tls_process(eap_session_t *eap_session)
 {
@@ -875,6 +1119,18 @@ eap_tls_status_t eap_tls_process(eap_session_t *eap_session)
 
 	SSL_set_ex_data(tls_session->ssl, FR_TLS_EX_INDEX_REQUEST, request);
 
+#ifdef SSL_MODE_ASYNC
+	/*
+	 *	We were called again after the handshake paused.
+	 *	The record was consumed the first time around,
+	 *	so just continue the handshake.
+	 */
+	if (eap_tls_session->async_pending) {
+		status = eap_tls_handshake(eap_session);
+		goto done;
+	}
+#endif
+
 	/*
 	 *	Call eap_tls_verify to sanity check the incoming EAP data.
 	 */
@@ -1060,6 +1316,20 @@ eap_tls_session_t *eap_tls_session_init(eap_session_t *eap_session, fr_tls_conf_
 									     request, client_cert);
 	if (!tls_session) return NULL;
 
+#ifdef SSL_MODE_ASYNC
+	talloc_set_destructor(eap_tls_session, _eap_tls_session_free);
+
+	/*
+	 *	Tunneled requests are run synchronously by
+	 *	the outer method, so can't yield.
+	 *
+	 *	Async mode is only enabled for the steps of the
+	 *	handshake which need it, see eap_tls_handshake.
+	 */
+	eap_tls_session->async = tls_conf->async && !request->parent;
+	SSL_clear_mode(tls_session->ssl, SSL_MODE_ASYNC);
+#endif
+
 	/*
 	 *	Associate various bits of opaque data with the session.
 	 */
@@ -53,6 +53,7 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include "eap.h"
 
 #define TLS_HEADER_LEN 4
+#define EAP_TLS_ASYNC_MAX_FDS 4
 #define TLS_HEADER_LENGTH_FIELD_LEN 4
 
 /*
@@ -92,6 +93,7 @@ typedef enum {
 	EAP_TLS_ESTABLISHED,       			//!< Session established, send success (or start phase2).
 	EAP_TLS_FAIL,       				//!< Fail, send fail.
 	EAP_TLS_HANDLED,	  			//!< TLS code has handled it.
+	EAP_TLS_YIELD,					//!< Handshake is waiting on an async job.
 
 	/*
 	 *	Composition states, we need to
@@ -146,6 +148,14 @@ typedef struct eap_tls_session {
 	size_t			record_in_total_len;	//!< How long the peer indicated the complete tls record
 							//!< would be.
 	size_t			record_in_recvd_len;	//!< How much of the record we've received so far.
+
+#ifdef SSL_MODE_ASYNC
+	bool			async;			//!< Whether the handshake may use async jobs.
+	bool			async_pending;		//!< Whether the handshake is waiting on an async job.
+	REQUEST			*async_request;		//!< Request with fd events for the async job.
+	OSSL_ASYNC_FD		async_fd[EAP_TLS_ASYNC_MAX_FDS];	//!< fds signalled when the job completes.
+	size_t			async_fd_count;		//!< How many fds we're waiting on.
+#endif
 } eap_tls_session_t;
 
 extern FR_NAME_NUMBER const eap_tls_status_table[];
@@ -48,6 +48,8 @@ static const CONF_PARSER module_config[] = {
 static rlm_rcode_t mod_post_proxy(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authenticate_result(rlm_eap_t *inst, REQUEST *request,
+					   eap_session_t *eap_session, rlm_rcode_t rcode) CC_HINT(nonnull);
 
 /** Frees the memory allocated to hold method submodule handles and interfaces
  *
@@ -337,6 +339,43 @@ static eap_type_t eap_process_nak(rlm_eap_t *inst, REQUEST *request,
 	return method;
 }
 
+/** Call the process function of the current EAP method
+ *
+ * @param inst Configuration data for this instance of rlm_eap.
+ * @param eap_session State data that persists over multiple rounds of EAP.
+ * @return a status code.
+ */
+static rlm_rcode_t eap_method_call(rlm_eap_t *inst, eap_session_t *eap_session)
+{
+	rlm_rcode_t		rcode;
+	char const		*caller;
+	rlm_eap_method_t	*method = inst->methods[eap_session->type];
+	REQUEST			*request = eap_session->request;
+
+	RDEBUG2("Calling submodule %s", method->submodule->name);
+
+	caller = request->module;
+	request->module = method->submodule->name;
+	rcode = eap_session->process(method->submodule_inst, eap_session);
+	request->module = caller;
+
+	switch (rcode) {
+	default:
+		REDEBUG2("Failed in EAP %s (%d) session.  EAP sub-module failed",
+			 eap_type2name(eap_session->type), eap_session->type);
+		break;
+
+	case RLM_MODULE_OK:
+	case RLM_MODULE_NOOP:
+	case RLM_MODULE_UPDATED:
+	case RLM_MODULE_HANDLED:
+	case RLM_MODULE_YIELD:
+		break;
+	}
+
+	return rcode;
+}
+
 /** Select the correct callback based on a response
  *
  * Based on the EAP response from the supplicant, call the appropriate
@@ -351,8 +390,6 @@ static eap_type_t eap_process_nak(rlm_eap_t *inst, REQUEST *request,
 static rlm_rcode_t eap_method_select(rlm_eap_t *inst, eap_session_t *eap_session)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
-	char const		*caller;
-	rlm_eap_method_t	*method;
 	eap_type_data_t		*type = &eap_session->this_round->response->type;
 	REQUEST			*request = eap_session->request;
 
@@ -459,31 +496,39 @@ static rlm_rcode_t eap_method_select(rlm_eap_t *inst, eap_session_t *eap_session
 		eap_session->type = type->num;
 
 	module_call:
-		method = inst->methods[eap_session->type];
+		rcode = eap_method_call(inst, eap_session);
+		break;
+	}
 
-		RDEBUG2("Calling submodule %s", method->submodule->name);
+	return rcode;
+}
 
-		caller = request->module;
-		request->module = method->submodule->name;
-		rcode = eap_session->process(method->submodule_inst, eap_session);
-		request->module = caller;
+/** Continue a round of EAP after the method yielded
+ *
+ */
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_eap_t		*inst = talloc_get_type_abort(instance, rlm_eap_t);
+	eap_session_t		*eap_session = talloc_get_type_abort(ctx, eap_session_t);
 
-		switch (rcode) {
-		default:
-			REDEBUG2("Failed in EAP %s (%d) session.  EAP sub-module failed",
-				 eap_type2name(eap_session->type), eap_session->type);
-			break;
+	eap_session->yielded = false;
 
-		case RLM_MODULE_OK:
-		case RLM_MODULE_NOOP:
-		case RLM_MODULE_UPDATED:
-		case RLM_MODULE_HANDLED:
-			break;
-		}
-		break;
-	}
+	return mod_authenticate_result(inst, request, eap_session, eap_method_call(inst, eap_session));
+}
 
-	return rcode;
+/** Give up on a round of EAP if the request is cancelled whilst the method is yielded
+ *
+ */
+static void mod_authenticate_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				    fr_state_action_t action)
+{
+	eap_session_t		*eap_session = talloc_get_type_abort(ctx, eap_session_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending EAP %s (%d) session", eap_type2name(eap_session->type), eap_session->type);
+
+	eap_session_destroy(&eap_session);
 }
 
 static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
@@ -528,6 +573,28 @@ static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST
 	 */
 	rcode = eap_method_select(inst, eap_session);
 
+	return mod_authenticate_result(inst, request, eap_session, rcode);
+}
+
+/** Finish processing a round of EAP, once the method has returned
+ *
+ * @param inst Configuration data for this instance of rlm_eap.
+ * @param request The current request.
+ * @param eap_session State data that persists over multiple rounds of EAP.
+ * @param rcode returned by the EAP method.
+ * @return a status code.
+ */
+static rlm_rcode_t mod_authenticate_result(rlm_eap_t *inst, REQUEST *request,
+					   eap_session_t *eap_session, rlm_rcode_t rcode)
+{
+	/*
+	 *	The method is waiting on an event.  Call
+	 *	it again when the request is resumed.
+	 */
+	if ((rcode == RLM_MODULE_YIELD) && eap_session->yielded) {
+		return unlang_yield(request, mod_authenticate_resume, mod_authenticate_action, eap_session);
+	}
+
 	/*
 	 *	The submodule failed.  Die.
 	 */
@@ -149,6 +149,13 @@ static rlm_rcode_t mod_process(void *arg, eap_session_t *eap_session)
 		 */
 		return RLM_MODULE_HANDLED;
 
+	/*
+	 *	The handshake is waiting on an async job,
+	 *	we'll be called again when it completes.
+	 */
+	case EAP_TLS_YIELD:
+		return RLM_MODULE_YIELD;
+
 	/*
 	 *	Handshake is done, proceed with decoding tunneled
 	 *	data.
@@ -241,6 +248,16 @@ static rlm_rcode_t mod_session_init(void *type_arg, eap_session_t *eap_session)
 	eap_session->opaque = eap_tls_session = eap_tls_session_init(eap_session, inst->tls_conf, client_cert);
 	if (!eap_tls_session) return RLM_MODULE_FAIL;
 
+	/*
+	 *	Tickets are issued when the TLS handshake completes,
+	 *	before phase 2, and a resumed session skips phase 2.
+	 *	Accepting them would let the client bypass inner
+	 *	authentication.
+	 */
+#ifdef SSL_OP_NO_TICKET
+	SSL_set_options(eap_tls_session->tls_session->ssl, SSL_OP_NO_TICKET);
+#endif
+
 	/*
 	 *	Set up type-specific information.
 	 */
@@ -308,6 +325,10 @@ static int mod_instantiate(UNUSED rlm_eap_config_t const *config, void *instance
 		return -1;
 	}
 
+	if (inst->tls_conf->session_tickets) {
+		WARN("Session tickets are not supported by PEAP, sessions will only be resumed from the cache");
+	}
+
 	/*
 	 *	Don't expose this if we don't need it.
 	 */
@@ -93,6 +93,95 @@ static int _get_client_value(char **out, CONF_PAIR const *cp, void *data)
 	return 0;
 }
 
+/** Build the list of attributes to retrieve for client objects
+ *
+ * @param[in] ctx to allocate the array in.
+ * @param[in] map to load client attribute/LDAP attribute mappings from.
+ * @return
+ *	- A NULL terminated array of attribute names.
+ *	- NULL on failure.
+ */
+char const **rlm_ldap_client_attrs(TALLOC_CTX *ctx, CONF_SECTION *map)
+{
+	char const	**attrs;
+	int		count, idx = 0;
+
+	count = cf_pair_count(map);
+	count++;
+
+	/*
+	 *	Create an array of LDAP attributes to feed to fr_ldap_search.
+	 */
+	attrs = talloc_array(ctx, char const *, count);
+	if (rlm_ldap_client_get_attrs(attrs, &idx, map) < 0) {
+		talloc_free(attrs);
+		return NULL;
+	}
+
+	return attrs;
+}
+
+/** Create a client from a client object
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] tmpl to use as the base for the new client.
+ * @param[in] map to load client attribute/LDAP attribute mappings from.
+ * @param[in] conn the client object was retrieved with.
+ * @param[in] entry the client object.
+ * @param[in] dn of the client object.
+ * @return
+ *	- A new client.
+ *	- NULL on failure.
+ */
+RADCLIENT *rlm_ldap_client_afrom_entry(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTION *map,
+				       ldap_handle_t *conn, LDAPMessage *entry, char const *dn)
+{
+	ldap_client_data_t	data;
+	CONF_SECTION		*client;
+	CONF_PAIR		*cp;
+	char			*id = NULL;
+	struct berval		**values;
+	RADCLIENT		*c;
+
+	cp = cf_pair_find(map, "identifier");
+	if (cp) {
+		values = ldap_get_values_len(conn->handle, entry, cf_pair_value(cp));
+		if (values) id = fr_ldap_berval_to_string(NULL, values[0]);
+		ldap_value_free_len(values);
+	}
+
+	/*
+	 *	Iterate over mapping sections
+	 */
+	client = tmpl ? cf_section_dup(NULL, tmpl, "client", id ? id : dn, true) :
+			cf_section_alloc(NULL, "client", id ? id : dn);
+	talloc_free(id);
+
+	data.conn = conn;
+	data.entry = entry;
+
+	if (client_map_section(client, map, _get_client_value, &data) < 0) {
+		talloc_free(client);
+		return NULL;
+	}
+
+	/*
+	 *@todo these should be parented from something
+	 */
+	c = client_afrom_cs(NULL, client, false, false);
+	if (!c) {
+		talloc_free(client);
+		return NULL;
+	}
+
+	/*
+	 *	Client parents the CONF_SECTION which defined it
+	 */
+	talloc_steal(c, client);
+
+	return c;
+}
+
 /** Load clients from LDAP on server start
  *
  * @param[in] inst rlm_ldap configuration.
@@ -110,9 +199,6 @@ int rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTIO
 
 	char const	**attrs = NULL;
 
-	CONF_PAIR	*cp;
-	int		count = 0, idx = 0;
-
 	LDAPMessage	*result = NULL;
 	LDAPMessage	*entry;
 	char		*dn = NULL;
@@ -123,17 +209,8 @@ int rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTIO
 
 	rad_assert(inst->clientobj_base_dn);
 
-	count = cf_pair_count(map);
-	count++;
-
-	/*
-	 *	Create an array of LDAP attributes to feed to fr_ldap_search.
-	 */
-	attrs = talloc_array(inst, char const *, count);
-	if (rlm_ldap_client_get_attrs(attrs, &idx, map) < 0) {
-		talloc_free(attrs);
-		return -1;
-	}
+	attrs = rlm_ldap_client_attrs(NULL, map);
+	if (!attrs) return -1;
 
 	conn = mod_conn_get(inst, NULL);
 	if (!conn) {
@@ -189,14 +266,7 @@ int rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTIO
 	}
 
 	do {
-		ldap_client_data_t	data;
-
-		CONF_SECTION		*client;
-		char			*id;
-
-		struct berval		**values;
-
-		id = dn = ldap_get_dn(conn->handle, entry);
+		dn = ldap_get_dn(conn->handle, entry);
 		if (!dn) {
 			int ldap_errno;
 
@@ -207,43 +277,12 @@ int rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTIO
 		}
 		fr_ldap_util_normalise_dn(dn, dn);
 
-		cp = cf_pair_find(map, "identifier");
-		if (cp) {
-			values = ldap_get_values_len(conn->handle, entry, cf_pair_value(cp));
-			if (values) id = fr_ldap_berval_to_string(NULL, values[0]);
-			ldap_value_free_len(values);
-		}
-
-		/*
-		 *	Iterate over mapping sections
-		 */
-		client = tmpl ? cf_section_dup(NULL, tmpl, "client", id, true) :
-				cf_section_alloc(NULL, "client", id);
-
-		data.conn = conn;
-		data.entry = entry;
-
-		if (client_map_section(client, map, _get_client_value, &data) < 0) {
-			talloc_free(client);
-			ret = -1;
-			goto finish;
-		}
-
-		/*
-		 *@todo these should be parented from something
-		 */
-		c = client_afrom_cs(NULL, client, false, false);
+		c = rlm_ldap_client_afrom_entry(inst, tmpl, map, conn, entry, dn);
 		if (!c) {
-			talloc_free(client);
 			ret = -1;
 			goto finish;
 		}
 
-		/*
-		 *	Client parents the CONF_SECTION which defined it
-		 */
-		talloc_steal(c, client);
-
 		if (!client_add(NULL, c)) {
 			ERROR("Failed to add client \"%s\", possible duplicate?", dn);
 			ret = -1;
@@ -0,0 +1,557 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file group_cache.c
+ * @brief Cache of group DNs and names, shared between all threads.
+ *
+ * Every group object under the group base_dn is loaded with a single
+ * (paged) search when the module is instantiated, and again every
+ * refresh_interval seconds.  Between full loads, groups whose change
+ * attribute (modifyTimestamp, or uSNChanged for Active Directory) is
+ * greater than the highest value previously seen are searched for every
+ * check_interval seconds, and the cache is updated with their current
+ * names.
+ *
+ * Refreshes are performed by whichever request next consults the cache
+ * after a refresh becomes due, using that request's connection.  Deleted
+ * groups are only removed by full loads.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+#include <freeradius-devel/rad_assert.h>
+
+#define LOG_PREFIX "rlm_ldap (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include "rlm_ldap.h"
+
+#ifdef HAVE_PTHREAD_H
+#  define CACHE_LOCK(_cache)	pthread_mutex_lock(&(_cache)->mutex)
+#  define CACHE_UNLOCK(_cache)	pthread_mutex_unlock(&(_cache)->mutex)
+#else
+#  define CACHE_LOCK(_cache)
+#  define CACHE_UNLOCK(_cache)
+#endif
+
+#define GROUP_CACHE_PAGE_SIZE	500			//!< Number of group objects to retrieve per page.
+
+/** A group object
+ *
+ */
+typedef struct rlm_ldap_group {
+	char const		*dn;			//!< Of the group object.
+	char const		*name;			//!< Value of the group name attribute.
+	bool			in_names;		//!< Whether this group is in the name tree.  Groups
+							//!< which share a name with another aren't.
+	bool			ambiguous;		//!< Another group has the same name.
+} rlm_ldap_group_t;
+
+/** Groups loaded by a single full search
+ *
+ * Replaced as a whole on every full load.
+ */
+typedef struct rlm_ldap_group_set {
+	rbtree_t		*dns;			//!< Groups by DN.
+	rbtree_t		*names;			//!< Groups by name.
+} rlm_ldap_group_set_t;
+
+struct rlm_ldap_group_cache {
+	rlm_ldap_t const	*inst;			//!< Instance the cache belongs to.
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+#endif
+	rlm_ldap_group_set_t	*set;			//!< Current set of groups.
+	char			*high_water;		//!< Highest value of the change attribute seen.
+
+	time_t			next_load;		//!< When we next perform a full load.
+	time_t			next_check;		//!< When we next check for changed groups.
+	bool			refreshing;		//!< A thread is refreshing the cache.
+};
+
+static int _group_dn_cmp(void const *one, void const *two)
+{
+	rlm_ldap_group_t const *a = one, *b = two;
+
+	return strcasecmp(a->dn, b->dn);
+}
+
+static int _group_name_cmp(void const *one, void const *two)
+{
+	rlm_ldap_group_t const *a = one, *b = two;
+
+	return strcmp(a->name, b->name);
+}
+
+/** Compare two values of the change attribute
+ *
+ * Works for both GeneralizedTime values (which are all the same length) and
+ * integers (which don't have leading zeros).
+ */
+static int group_change_cmp(char const *a, char const *b)
+{
+	size_t a_len = strlen(a), b_len = strlen(b);
+
+	if (a_len != b_len) return (a_len < b_len) ? -1 : 1;
+
+	return strcmp(a, b);
+}
+
+static rlm_ldap_group_set_t *group_set_alloc(TALLOC_CTX *ctx)
+{
+	rlm_ldap_group_set_t *set;
+
+	set = talloc_zero(ctx, rlm_ldap_group_set_t);
+	if (!set) return NULL;
+
+	set->dns = rbtree_create(set, _group_dn_cmp, NULL, RBTREE_FLAG_NONE);
+	set->names = rbtree_create(set, _group_name_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!set->dns || !set->names) {
+		talloc_free(set);
+		return NULL;
+	}
+
+	return set;
+}
+
+/** Add a group to the set, or update the name of an existing group
+ *
+ */
+static void group_set_update(rlm_ldap_group_set_t *set, char const *dn, char const *name)
+{
+	rlm_ldap_group_t	find, *group, *other;
+
+	memcpy(&find.dn, &dn, sizeof(find.dn));
+
+	group = rbtree_finddata(set->dns, &find);
+	if (group) {
+		if (strcmp(group->name, name) == 0) return;
+
+		if (group->in_names) rbtree_deletebydata(set->names, group);
+		talloc_const_free(group->name);
+	} else {
+		group = talloc_zero(set, rlm_ldap_group_t);
+		if (!group) return;
+
+		group->dn = talloc_typed_strdup(group, dn);
+		if (!rbtree_insert(set->dns, group)) {
+			talloc_free(group);
+			return;
+		}
+	}
+
+	group->name = talloc_typed_strdup(group, name);
+	group->in_names = false;
+	group->ambiguous = false;
+
+	/*
+	 *	Names aren't necessarily unique, if
+	 *	they're not, we can't use the cache
+	 *	to resolve them to DNs.
+	 */
+	other = rbtree_finddata(set->names, group);
+	if (other) {
+		other->ambiguous = true;
+		group->ambiguous = true;
+		return;
+	}
+
+	group->in_names = rbtree_insert(set->names, group);
+}
+
+/** Search for group objects, adding them to a set
+ *
+ * @param[in] cache		being refreshed.
+ * @param[in] request		Current request.
+ * @param[in,out] pconn		to use. May change as this function calls functions which auto re-connect.
+ * @param[in] filter		to use, may be NULL to retrieve all objects under the group base_dn.
+ * @param[in] set		to add groups to.
+ * @param[in,out] high_water	highest value of the change attribute seen.  Updated with values
+ *				of the group objects found.
+ * @return
+ *	- Number of groups found.
+ *	- -1 on failure.
+ */
+static int group_cache_search(rlm_ldap_group_cache_t *cache, REQUEST *request, ldap_handle_t **pconn,
+			      char const *filter, rlm_ldap_group_set_t *set, char **high_water)
+{
+	rlm_ldap_t const	*inst = cache->inst;
+	ldap_rcode_t		status;
+	LDAPMessage		*result, *entry;
+	char const		*attrs[] = { inst->groupobj_name_attr, inst->group_cache_change_attr, NULL };
+	char const		*base_dn = inst->groupobj_base_dn->name;
+	int			count = 0;
+	LDAPControl		*serverctrls[] = { NULL, NULL };
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+	struct berval		cookie = { 0, NULL };
+#endif
+
+	do {
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+		LDAPControl	**ctrls = NULL, *page;
+		ber_int_t	total;
+
+		if (ldap_create_page_control((*pconn)->handle, GROUP_CACHE_PAGE_SIZE, &cookie, 0,
+					     &serverctrls[0]) != LDAP_SUCCESS) {
+			ROPTIONAL(REDEBUG, ERROR, "Failed creating paged results control");
+			count = -1;
+			break;
+		}
+#endif
+
+		status = fr_ldap_search(&result, request, pconn, base_dn, inst->groupobj_scope,
+					filter, attrs, serverctrls, NULL);
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+		ldap_control_free(serverctrls[0]);
+		serverctrls[0] = NULL;
+		if (cookie.bv_val) ber_memfree(cookie.bv_val);
+		cookie.bv_val = NULL;
+		cookie.bv_len = 0;
+#endif
+		switch (status) {
+		case LDAP_PROC_SUCCESS:
+			break;
+
+		case LDAP_PROC_NO_RESULT:
+			return count;
+
+		default:
+			return -1;
+		}
+
+		for (entry = ldap_first_entry((*pconn)->handle, result);
+		     entry;
+		     entry = ldap_next_entry((*pconn)->handle, entry)) {
+			struct berval	**names, **changes;
+			char		*dn, *name;
+
+			dn = ldap_get_dn((*pconn)->handle, entry);
+			if (!dn) continue;
+			fr_ldap_util_normalise_dn(dn, dn);
+
+			names = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
+			if (!names) {
+				ldap_memfree(dn);
+				continue;
+			}
+
+			name = fr_ldap_berval_to_string(NULL, names[0]);
+			group_set_update(set, dn, name);
+			talloc_free(name);
+			ldap_value_free_len(names);
+			ldap_memfree(dn);
+			count++;
+
+			if (!inst->group_cache_change_attr) continue;
+
+			changes = ldap_get_values_len((*pconn)->handle, entry, inst->group_cache_change_attr);
+			if (!changes) continue;
+
+			if (!*high_water || (group_change_cmp(changes[0]->bv_val, *high_water) > 0)) {
+				talloc_free(*high_water);
+				*high_water = fr_ldap_berval_to_string(NULL, changes[0]);
+			}
+			ldap_value_free_len(changes);
+		}
+
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+		/*
+		 *	Servers indicate there are more results
+		 *	by returning a non-empty cookie.
+		 */
+		if ((ldap_parse_result((*pconn)->handle, result, NULL, NULL, NULL, NULL, &ctrls, 0) == LDAP_SUCCESS) &&
+		    (page = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, ctrls, NULL))) {
+			(void) ldap_parse_pageresponse_control((*pconn)->handle, page, &total, &cookie);
+		}
+		if (ctrls) ldap_controls_free(ctrls);
+#endif
+		ldap_msgfree(result);
+
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+	} while (cookie.bv_len > 0);
+#else
+	} while (0);
+#endif
+
+	return count;
+}
+
+/** Load all group objects, replacing the current set
+ *
+ */
+static int group_cache_load(rlm_ldap_group_cache_t *cache, REQUEST *request, ldap_handle_t **pconn)
+{
+	rlm_ldap_t const	*inst = cache->inst;
+	rlm_ldap_group_set_t	*set;
+	char			*high_water = NULL;
+	int			count;
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Loading group objects into cache");
+
+	set = group_set_alloc(cache);
+	if (!set) return -1;
+
+	count = group_cache_search(cache, request, pconn, inst->groupobj_filter, set, &high_water);
+	if (count < 0) {
+		talloc_free(set);
+		talloc_free(high_water);
+		return -1;
+	}
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Loaded %i group object(s) into cache", count);
+
+	CACHE_LOCK(cache);
+	talloc_free(cache->set);
+	cache->set = set;
+	talloc_free(cache->high_water);
+	cache->high_water = talloc_steal(cache, high_water);
+	CACHE_UNLOCK(cache);
+
+	return 0;
+}
+
+static int _group_cache_merge(void *ctx, void *data)
+{
+	rlm_ldap_group_set_t	*set = ctx;
+	rlm_ldap_group_t	*group = data;
+
+	group_set_update(set, group->dn, group->name);
+
+	return 0;
+}
+
+/** Update groups which have changed since we last checked
+ *
+ */
+static int group_cache_check(rlm_ldap_group_cache_t *cache, REQUEST *request, ldap_handle_t **pconn)
+{
+	rlm_ldap_t const	*inst = cache->inst;
+	rlm_ldap_group_set_t	*changed;
+	char			*high_water, *filter;
+	char			buffer[LDAP_MAX_FILTER_STR_LEN];
+	int			count;
+
+	CACHE_LOCK(cache);
+	high_water = talloc_typed_strdup(NULL, cache->high_water);
+	CACHE_UNLOCK(cache);
+
+	/*
+	 *	We didn't see any change attributes last time
+	 *	so there's nothing to compare against.
+	 */
+	if (!high_water) return group_cache_load(cache, request, pconn);
+
+	changed = group_set_alloc(NULL);
+	if (!changed) {
+		talloc_free(high_water);
+		return -1;
+	}
+
+	fr_ldap_escape_func(request, buffer, sizeof(buffer), high_water, NULL);
+	filter = talloc_typed_asprintf(changed, "(&%s(%s>=%s))",
+				       inst->groupobj_filter ? inst->groupobj_filter : "(objectClass=*)",
+				       inst->group_cache_change_attr, buffer);
+
+	count = group_cache_search(cache, request, pconn, filter, changed, &high_water);
+	if (count < 0) {
+		talloc_free(changed);
+		talloc_free(high_water);
+		return -1;
+	}
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Found %i changed group object(s)", count);
+
+	CACHE_LOCK(cache);
+	(void) rbtree_walk(changed->dns, RBTREE_IN_ORDER, _group_cache_merge, cache->set);
+	talloc_free(cache->high_water);
+	cache->high_water = talloc_steal(cache, high_water);
+	CACHE_UNLOCK(cache);
+
+	talloc_free(changed);
+
+	return 0;
+}
+
+/** Perform a full load, or check for changed groups, if one is due
+ *
+ * Only one thread refreshes the cache at a time.  Other threads continue
+ * to use the current set of groups.
+ */
+static void group_cache_refresh(rlm_ldap_group_cache_t *cache, REQUEST *request, ldap_handle_t **pconn)
+{
+	rlm_ldap_t const	*inst = cache->inst;
+	time_t			now = time(NULL);
+	bool			load = false, check = false;
+	int			ret;
+
+	CACHE_LOCK(cache);
+	if (!cache->refreshing) {
+		if (now >= cache->next_load) {
+			load = true;
+		} else if (cache->next_check && (now >= cache->next_check)) {
+			check = true;
+		}
+		cache->refreshing = load || check;
+	}
+	CACHE_UNLOCK(cache);
+
+	if (!load && !check) return;
+
+	ret = load ? group_cache_load(cache, request, pconn) : group_cache_check(cache, request, pconn);
+	if (ret < 0) ROPTIONAL(RWDEBUG, WARN, "Failed refreshing group cache, continuing with cached groups");
+
+	CACHE_LOCK(cache);
+	/*
+	 *	Don't retry failed loads immediately,
+	 *	the directory is probably unavailable.
+	 */
+	if (load && (ret == 0)) cache->next_load = now + inst->group_cache_refresh;
+	if (load && (ret < 0)) cache->next_load = now + (inst->group_cache_check ? inst->group_cache_check :
+							 inst->group_cache_refresh);
+	if (inst->group_cache_check && inst->group_cache_change_attr) cache->next_check = now + inst->group_cache_check;
+	cache->refreshing = false;
+	CACHE_UNLOCK(cache);
+}
+
+/** Resolve a group DN to a name using the cache
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use if the cache needs refreshing.
+ * @param[in] dn to resolve.
+ * @param[out] out Where to write group name (must be freed with talloc_free).
+ * @return
+ *	- true if the group was found.
+ *	- false if the group wasn't found, and the directory should be searched instead.
+ */
+bool rlm_ldap_group_cache_dn2name(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
+				  char const *dn, char **out)
+{
+	rlm_ldap_group_cache_t	*cache = inst->group_cache;
+	rlm_ldap_group_t	find, *group;
+
+	*out = NULL;
+
+	group_cache_refresh(cache, request, pconn);
+
+	memcpy(&find.dn, &dn, sizeof(find.dn));
+
+	CACHE_LOCK(cache);
+	if (cache->set) {
+		group = rbtree_finddata(cache->set->dns, &find);
+		if (group) *out = talloc_typed_strdup(request, group->name);
+	}
+	CACHE_UNLOCK(cache);
+
+	if (!*out) return false;
+
+	RDEBUG("Group DN \"%s\" resolves to name \"%s\" (cached)", dn, *out);
+
+	return true;
+}
+
+/** Resolve a group name to a DN using the cache
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use if the cache needs refreshing.
+ * @param[in] name to resolve.
+ * @param[out] out Where to write group DN (must be freed with talloc_free).
+ * @return
+ *	- true if the group was found.
+ *	- false if the group wasn't found, or its name is ambiguous, and the
+ *	  directory should be searched instead.
+ */
+bool rlm_ldap_group_cache_name2dn(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
+				  char const *name, char **out)
+{
+	rlm_ldap_group_cache_t	*cache = inst->group_cache;
+	rlm_ldap_group_t	find, *group;
+
+	*out = NULL;
+
+	group_cache_refresh(cache, request, pconn);
+
+	memcpy(&find.name, &name, sizeof(find.name));
+
+	CACHE_LOCK(cache);
+	if (cache->set) {
+		group = rbtree_finddata(cache->set->names, &find);
+		if (group && !group->ambiguous) *out = talloc_typed_strdup(request, group->dn);
+	}
+	CACHE_UNLOCK(cache);
+
+	if (!*out) return false;
+
+	RDEBUG("Group name \"%s\" resolves to DN \"%s\" (cached)", name, *out);
+
+	return true;
+}
+
+static int _group_cache_free(rlm_ldap_group_cache_t *cache)
+{
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_destroy(&cache->mutex);
+#endif
+	return 0;
+}
+
+/** Allocate the group cache, and load all group objects into it
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst)
+{
+	rlm_ldap_group_cache_t	*cache;
+	ldap_handle_t		*conn;
+	int			ret;
+
+	cache = talloc_zero(inst, rlm_ldap_group_cache_t);
+	if (!cache) return -1;
+
+	cache->inst = inst;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&cache->mutex, NULL);
+#endif
+	talloc_set_destructor(cache, _group_cache_free);
+
+	conn = mod_conn_get(inst, NULL);
+	if (!conn) {
+		talloc_free(cache);
+		return -1;
+	}
+
+	cache->next_load = 0;
+	group_cache_refresh(cache, NULL, &conn);
+	ret = cache->set ? 0 : -1;
+
+	mod_conn_release(inst, NULL, conn);
+
+	if (ret < 0) {
+		ERROR("Failed loading group objects into cache");
+		talloc_free(cache);
+		return -1;
+	}
+
+	inst->group_cache = cache;
+
+	return 0;
+}
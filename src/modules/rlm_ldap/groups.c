@@ -211,6 +211,8 @@ static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *reque
 		return RLM_MODULE_INVALID;
 	}
 
+	if (inst->group_cache && rlm_ldap_group_cache_dn2name(inst, request, pconn, dn, out)) return RLM_MODULE_OK;
+
 	RDEBUG("Resolving group DN \"%s\" to group name", dn);
 
 	status = fr_ldap_search(&result, request, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs, NULL, NULL);
@@ -329,7 +331,22 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 			 *	this to a DN. Store all the group names in an array so we can do one query.
 			 */
 			} else {
-				*name_p++ = fr_ldap_berval_to_string(value_ctx, values[i]);
+				char *group, *dn;
+
+				/*
+				 *	Names found in the group cache don't need
+				 *	to be included in the search.
+				 */
+				group = fr_ldap_berval_to_string(value_ctx, values[i]);
+				if (inst->group_cache &&
+				    rlm_ldap_group_cache_name2dn(inst, request, pconn, group, &dn)) {
+					MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
+					fr_pair_value_strcpy(vp, dn);
+					fr_pair_cursor_append(&groups_cursor, vp);
+					talloc_free(dn);
+				} else {
+					*name_p++ = group;
+				}
 			}
 		}
 
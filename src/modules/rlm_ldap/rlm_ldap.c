@@ -113,6 +113,8 @@ static CONF_PARSER profile_config[] = {
 	{ FR_CONF_OFFSET("filter", PW_TYPE_TMPL, rlm_ldap_t, profile_filter), .dflt = "(&)", .quote = T_SINGLE_QUOTED_STRING },	//!< Correct filter for when the DN is known.
 	{ FR_CONF_OFFSET("attribute", PW_TYPE_STRING, rlm_ldap_t, profile_attr) },
 	{ FR_CONF_OFFSET("default", PW_TYPE_TMPL, rlm_ldap_t, default_profile) },
+	{ FR_CONF_OFFSET("base_dn", PW_TYPE_STRING, rlm_ldap_t, profile_base_dn), .dflt = "" },
+	{ FR_CONF_OFFSET("sync", PW_TYPE_BOOLEAN, rlm_ldap_t, profile_sync), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -133,6 +135,17 @@ static CONF_PARSER user_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Group cache configuration
+ */
+static CONF_PARSER group_cache_config[] = {
+	{ FR_CONF_OFFSET("enable", PW_TYPE_BOOLEAN, rlm_ldap_t, group_cache_enable), .dflt = "no" },
+	{ FR_CONF_OFFSET("refresh_interval", PW_TYPE_INTEGER, rlm_ldap_t, group_cache_refresh), .dflt = "3600" },
+	{ FR_CONF_OFFSET("check_interval", PW_TYPE_INTEGER, rlm_ldap_t, group_cache_check), .dflt = "60" },
+	{ FR_CONF_OFFSET("change_attribute", PW_TYPE_STRING, rlm_ldap_t, group_cache_change_attr), .dflt = "modifyTimestamp" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	Group configuration
  */
@@ -148,6 +161,7 @@ static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("cacheable_dn", PW_TYPE_BOOLEAN, rlm_ldap_t, cacheable_group_dn), .dflt = "no" },
 	{ FR_CONF_OFFSET("cache_attribute", PW_TYPE_STRING, rlm_ldap_t, cache_attribute) },
 	{ FR_CONF_OFFSET("group_attribute", PW_TYPE_STRING, rlm_ldap_t, group_attribute) },
+	{ FR_CONF_POINTER("cache", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) group_cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -155,6 +169,7 @@ static CONF_PARSER client_config[] = {
 	{ FR_CONF_OFFSET("filter", PW_TYPE_STRING, rlm_ldap_t, clientobj_filter) },
 	{ FR_CONF_OFFSET("scope", PW_TYPE_STRING, rlm_ldap_t, clientobj_scope_str), .dflt = "sub" },
 	{ FR_CONF_OFFSET("base_dn", PW_TYPE_STRING, rlm_ldap_t, clientobj_base_dn), .dflt = "" },
+	{ FR_CONF_OFFSET("sync", PW_TYPE_BOOLEAN, rlm_ldap_t, clientobj_sync), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -207,6 +222,13 @@ static CONF_PARSER option_config[] = {
 	/* timeout for search results */
 	{ FR_CONF_OFFSET("res_timeout", PW_TYPE_TIMEVAL, rlm_ldap_t, handle_config.res_timeout), .dflt = "20" },
 
+	/* send user searches and binds without blocking the worker */
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, rlm_ldap_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_outstanding", PW_TYPE_INTEGER, rlm_ldap_t, max_outstanding), .dflt = "64" },
+
+	/* wait before re-establishing the client/profile sync connection */
+	{ FR_CONF_OFFSET("sync_retry_delay", PW_TYPE_INTEGER, rlm_ldap_t, sync_retry_delay), .dflt = "10" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -692,8 +714,140 @@ finish:
 	return 0;
 }
 
-static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+/** State of an asynchronous user search or bind
+ *
+ */
+typedef struct {
+	rlm_ldap_map_exp_t	expanded;		//!< Attributes requested in the user object search.
+	fr_ldap_query_t		*query;			//!< Search or bind we're waiting for.
+	char const		*dn;			//!< We're binding as.
+} rlm_ldap_rctx_t;
+
+/** Convert the result of binding as the user to a module return code
+ *
+ */
+static rlm_rcode_t rlm_ldap_bind_rcode(REQUEST *request, char const *dn, ldap_rcode_t status)
+{
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		RDEBUG("Bind as user \"%s\" was successful", dn);
+		return RLM_MODULE_OK;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		return RLM_MODULE_USERLOCK;
+
+	case LDAP_PROC_REJECT:
+		return RLM_MODULE_REJECT;
+
+	case LDAP_PROC_BAD_DN:
+		return RLM_MODULE_INVALID;
+
+	case LDAP_PROC_NO_RESULT:
+		return RLM_MODULE_NOTFOUND;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+}
+
+/** Cancel the outstanding search or bind if the request is stopped
+ *
+ */
+static void mod_async_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+			     fr_state_action_t action)
+{
+	rlm_ldap_rctx_t	*rctx = talloc_get_type_abort(ctx, rlm_ldap_rctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending LDAP operation");
+
+	talloc_free(rctx);
+}
+
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, void *instance, void *thread, void *ctx);
+
+/** Send a simple bind as the user, and wait for the result
+ *
+ */
+static rlm_rcode_t mod_authenticate_bind(rlm_ldap_thread_t *t, REQUEST *request, rlm_ldap_rctx_t *rctx,
+					 char const *dn)
+{
+	rctx->dn = talloc_typed_strdup(rctx, dn);
+	rctx->query = fr_ldap_async_bind(t->async, request, rctx->dn, request->password->vp_strvalue, NULL, NULL);
+	if (!rctx->query) {
+		talloc_free(rctx);
+		return RLM_MODULE_FAIL;
+	}
+	talloc_steal(rctx, rctx->query);
+
+	return unlang_yield(request, mod_authenticate_resume, mod_async_action, rctx);
+}
+
+/** Called when the user object search, or the bind as the user, has completed
+ *
+ */
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_rctx_t		*rctx = talloc_get_type_abort(ctx, rlm_ldap_rctx_t);
+	rlm_rcode_t		rcode;
+	char const		*dn;
+
+	/*
+	 *	Result of the bind
+	 */
+	if (rctx->dn) {
+		rcode = rlm_ldap_bind_rcode(request, rctx->dn, fr_ldap_async_result(NULL, NULL, rctx->query));
+		talloc_free(rctx);
+
+		return rcode;
+	}
+
+	/*
+	 *	Result of the user object search
+	 */
+	dn = rlm_ldap_find_user_async_result(inst, request, rctx->query, NULL, NULL, &rcode);
+	TALLOC_FREE(rctx->query);
+	if (!dn) {
+		talloc_free(rctx);
+		return rcode;
+	}
+
+	return mod_authenticate_bind(thread, request, rctx, dn);
+}
+
+/** Authenticate the user with a simple bind, without blocking the worker
+ *
+ */
+static rlm_rcode_t mod_authenticate_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request)
+{
+	rlm_ldap_rctx_t		*rctx;
+	rlm_rcode_t		rcode;
+	VALUE_PAIR		*vp;
+
+	RDEBUG("Login attempt by \"%s\"", request->username->vp_strvalue);
+
+	MEM(rctx = talloc_zero(request, rlm_ldap_rctx_t));
+
+	vp = fr_pair_find_by_num(request->control, 0, PW_LDAP_USERDN, TAG_ANY);
+	if (vp) {
+		RDEBUG("Using user DN from request \"%s\"", vp->vp_strvalue);
+		return mod_authenticate_bind(t, request, rctx, vp->vp_strvalue);
+	}
+
+	rctx->query = rlm_ldap_find_user_async(inst, t->async, request, NULL, &rcode);
+	if (!rctx->query) {
+		talloc_free(rctx);
+		return rcode;
+	}
+	talloc_steal(rctx, rctx->query);
+
+	return unlang_yield(request, mod_authenticate_resume, mod_async_action, rctx);
+}
+
+static rlm_rcode_t mod_authenticate(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rcode_t		rcode;
 	ldap_rcode_t		status;
@@ -736,6 +890,12 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 		return RLM_MODULE_INVALID;
 	}
 
+	/*
+	 *	SASL binds need multiple round trips,
+	 *	so they're always performed synchronously.
+	 */
+	if (inst->async && !inst->user_sasl.mech) return mod_authenticate_async(inst, thread, request);
+
 	conn = mod_conn_get(inst, request);
 	if (!conn) return RLM_MODULE_FAIL;
 
@@ -789,32 +949,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 			      inst->user_sasl.mech ? &sasl : NULL,
 			      NULL,
 			      NULL, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		rcode = RLM_MODULE_OK;
-		RDEBUG("Bind as user \"%s\" was successful", dn);
-		break;
-
-	case LDAP_PROC_NOT_PERMITTED:
-		rcode = RLM_MODULE_USERLOCK;
-		break;
-
-	case LDAP_PROC_REJECT:
-		rcode = RLM_MODULE_REJECT;
-		break;
-
-	case LDAP_PROC_BAD_DN:
-		rcode = RLM_MODULE_INVALID;
-		break;
-
-	case LDAP_PROC_NO_RESULT:
-		rcode = RLM_MODULE_NOTFOUND;
-		break;
-
-	default:
-		rcode = RLM_MODULE_FAIL;
-		break;
-	};
+	rcode = rlm_ldap_bind_rcode(request, dn, status);
 
 finish:
 	mod_conn_release(inst, request, conn);
@@ -850,6 +985,15 @@ static rlm_rcode_t rlm_ldap_map_profile(rlm_ldap_t const *inst, REQUEST *request
 
 	if (!dn || !*dn) return RLM_MODULE_OK;
 
+	/*
+	 *	Use the replicated profile object if we have one.
+	 */
+	if (inst->sync) {
+		rcode = rlm_ldap_sync_profile_map(inst, request, handle, dn, expanded);
+		if (rcode != RLM_MODULE_NOOP) return rcode;
+		rcode = RLM_MODULE_OK;
+	}
+
 	if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request,
 			inst->profile_filter, fr_ldap_escape_func, NULL) < 0) {
 		REDEBUG("Failed creating profile filter");
@@ -896,71 +1040,54 @@ free_result:
 	return rcode;
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+/** Get a connection from the pool, if we don't already have one
+ *
+ */
+static inline int mod_conn_need(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn)
+{
+	if (*pconn) return 0;
+
+	*pconn = mod_conn_get(inst, request);
+	if (!*pconn) return -1;
+
+	return 0;
+}
+
+/** Perform access checks, cache group memberships, apply profiles and map attributes from the user object
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] rconn the user object search was performed on, or NULL if it was performed on *pconn.
+ * @param[in,out] pconn to use for any further searches.  If *pconn is NULL, a connection will be
+ *	retrieved from the pool when one is required.
+ * @param[in] dn of the user object.
+ * @param[in] entry the user object.
+ * @param[in] expanded Structure containing a list of xlat expanded attribute names and mapping information.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t mod_authorize_entry(rlm_ldap_t const *inst, REQUEST *request,
+				       ldap_handle_t const *rconn, ldap_handle_t **pconn,
+				       char const *dn, LDAPMessage *entry, rlm_ldap_map_exp_t const *expanded)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
-	ldap_rcode_t		status;
-	int			ldap_errno;
 	int			i;
-	rlm_ldap_t const	*inst = instance;
 	struct berval		**values;
+#ifdef WITH_EDIR
+	ldap_rcode_t		status;
 	VALUE_PAIR		*vp;
-	ldap_handle_t		*conn;
-	LDAPMessage		*result, *entry;
-	char const 		*dn = NULL;
-	rlm_ldap_map_exp_t	expanded; /* faster than allocing every time */
-
-	/*
-	 *	Don't be tempted to add a check for request->username
-	 *	or request->password here. rlm_ldap.authorize can be used for
-	 *	many things besides searching for users.
-	 */
-
-	if (rlm_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
-
-	conn = mod_conn_get(inst, request);
-	if (!conn) return RLM_MODULE_FAIL;
-
-	/*
-	 *	Add any additional attributes we need for checking access, memberships, and profiles
-	 */
-	if (inst->userobj_access_attr) {
-		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
-	}
-
-	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
-		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
-	}
-
-	if (inst->profile_attr) {
-		expanded.attrs[expanded.count++] = inst->profile_attr;
-	}
-
-	if (inst->valuepair_attr) {
-		expanded.attrs[expanded.count++] = inst->valuepair_attr;
-	}
-
-	expanded.attrs[expanded.count] = NULL;
-
-	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
-	if (!dn) {
-		goto finish;
-	}
-
-	entry = ldap_first_entry(conn->handle, result);
-	if (!entry) {
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+#endif
 
-		goto finish;
-	}
+/*
+ *	The pooled connection may change if it's reconnected,
+ *	so don't cache the handle used to parse the entry.
+ */
+#define ENTRY_CONN (rconn ? rconn : *pconn)
 
 	/*
 	 *	Check for access.
 	 */
 	if (inst->userobj_access_attr) {
-		rcode = rlm_ldap_check_access(inst, request, conn, entry);
+		rcode = rlm_ldap_check_access(inst, request, ENTRY_CONN, entry);
 		if (rcode != RLM_MODULE_OK) {
 			goto finish;
 		}
@@ -970,14 +1097,16 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 	 *	Check if we need to cache group memberships
 	 */
 	if (inst->cacheable_group_dn || inst->cacheable_group_name) {
+		if (mod_conn_need(inst, request, pconn) < 0) return RLM_MODULE_FAIL;
+
 		if (inst->userobj_membership_attr) {
-			rcode = rlm_ldap_cacheable_userobj(inst, request, &conn, entry, inst->userobj_membership_attr);
+			rcode = rlm_ldap_cacheable_userobj(inst, request, pconn, entry, inst->userobj_membership_attr);
 			if (rcode != RLM_MODULE_OK) {
 				goto finish;
 			}
 		}
 
-		rcode = rlm_ldap_cacheable_groupobj(inst, request, &conn);
+		rcode = rlm_ldap_cacheable_groupobj(inst, request, pconn);
 		if (rcode != RLM_MODULE_OK) {
 			goto finish;
 		}
@@ -999,10 +1128,12 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 		char password[256];
 		size_t pass_size = sizeof(password);
 
+		if (mod_conn_need(inst, request, pconn) < 0) return RLM_MODULE_FAIL;
+
 		/*
 		 *	Retrive universal password
 		 */
-		res = fr_ldap_edir_get_password(conn->handle, dn, password, &pass_size);
+		res = fr_ldap_edir_get_password((*pconn)->handle, dn, password, &pass_size);
 		if (res != 0) {
 			REDEBUG("Failed to retrieve eDirectory password: (%i) %s", res, fr_ldap_edir_errstr(res));
 			rcode = RLM_MODULE_FAIL;
@@ -1028,8 +1159,8 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 			/*
 			 *	Bind as the user
 			 */
-			conn->rebound = true;
-			status = fr_ldap_bind(request, &conn, dn, vp->vp_strvalue, NULL, NULL, NULL, NULL);
+			(*pconn)->rebound = true;
+			status = fr_ldap_bind(request, pconn, dn, vp->vp_strvalue, NULL, NULL, NULL, NULL);
 			switch (status) {
 			case LDAP_PROC_SUCCESS:
 				rcode = RLM_MODULE_OK;
@@ -1077,7 +1208,9 @@ skip_edir:
 			goto finish;
 		}
 
-		switch (rlm_ldap_map_profile(inst, request, &conn, profile, &expanded)) {
+		if (mod_conn_need(inst, request, pconn) < 0) return RLM_MODULE_FAIL;
+
+		switch (rlm_ldap_map_profile(inst, request, pconn, profile, expanded)) {
 		case RLM_MODULE_INVALID:
 			rcode = RLM_MODULE_INVALID;
 			goto finish;
@@ -1098,14 +1231,19 @@ skip_edir:
 	 *	Apply a SET of user profiles.
 	 */
 	if (inst->profile_attr) {
-		values = ldap_get_values_len(conn->handle, entry, inst->profile_attr);
+		values = ldap_get_values_len(ENTRY_CONN->handle, entry, inst->profile_attr);
 		if (values != NULL) {
 			for (i = 0; values[i] != NULL; i++) {
 				rlm_rcode_t ret;
 				char *value;
 
+				if (mod_conn_need(inst, request, pconn) < 0) {
+					ldap_value_free_len(values);
+					return RLM_MODULE_FAIL;
+				}
+
 				value = fr_ldap_berval_to_string(request, values[i]);
-				ret = rlm_ldap_map_profile(inst, request, &conn, value, &expanded);
+				ret = rlm_ldap_map_profile(inst, request, pconn, value, expanded);
 				talloc_free(value);
 				if (ret == RLM_MODULE_FAIL) {
 					ldap_value_free_len(values);
@@ -1121,11 +1259,134 @@ skip_edir:
 	if (inst->user_map || inst->valuepair_attr) {
 		RDEBUG("Processing user attributes");
 		RINDENT();
-		if (rlm_ldap_map_do(inst, request, conn->handle, &expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
+		if (rlm_ldap_map_do(inst, request, ENTRY_CONN->handle, expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
 		REXDENT();
-		rlm_ldap_check_reply(inst, request, conn);
+		rlm_ldap_check_reply(inst, request, ENTRY_CONN);
+	}
+
+finish:
+#undef ENTRY_CONN
+	return rcode;
+}
+
+static rlm_rcode_t mod_authorize_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_rctx_t		*rctx = talloc_get_type_abort(ctx, rlm_ldap_rctx_t);
+	rlm_rcode_t		rcode;
+	int			ldap_errno;
+	ldap_handle_t		*rconn, *conn = NULL;
+	LDAPMessage		*result, *entry;
+	char const		*dn;
+
+	dn = rlm_ldap_find_user_async_result(inst, request, rctx->query, &result, &rconn, &rcode);
+	if (!dn) goto finish;
+
+	entry = ldap_first_entry(rconn->handle, result);
+	if (!entry) {
+		ldap_get_option(rconn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+
+		goto finish;
 	}
 
+	rcode = mod_authorize_entry(inst, request, rconn, &conn, dn, entry, &rctx->expanded);
+
+finish:
+	talloc_free(rctx);
+	if (conn) mod_conn_release(inst, request, conn);
+
+	return rcode;
+}
+
+/** Search for the user object without blocking the worker
+ *
+ * Any group or profile searches needed once the user object has been
+ * retrieved are performed synchronously.
+ */
+static rlm_rcode_t mod_authorize_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request,
+				       rlm_ldap_map_exp_t const *expanded)
+{
+	rlm_ldap_rctx_t		*rctx;
+	rlm_rcode_t		rcode;
+
+	MEM(rctx = talloc_zero(request, rlm_ldap_rctx_t));
+	rctx->expanded = *expanded;
+	if (rctx->expanded.ctx) talloc_steal(rctx, rctx->expanded.ctx);
+
+	rctx->query = rlm_ldap_find_user_async(inst, t->async, request, rctx->expanded.attrs, &rcode);
+	if (!rctx->query) {
+		talloc_free(rctx);
+		return rcode;
+	}
+	talloc_steal(rctx, rctx->query);
+
+	return unlang_yield(request, mod_authorize_resume, mod_async_action, rctx);
+}
+
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	int			ldap_errno;
+	rlm_ldap_t const	*inst = instance;
+	ldap_handle_t		*conn;
+	LDAPMessage		*result, *entry;
+	char const 		*dn = NULL;
+	rlm_ldap_map_exp_t	expanded; /* faster than allocing every time */
+
+	/*
+	 *	Don't be tempted to add a check for request->username
+	 *	or request->password here. rlm_ldap.authorize can be used for
+	 *	many things besides searching for users.
+	 */
+
+	if (rlm_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
+
+	/*
+	 *	Add any additional attributes we need for checking access, memberships, and profiles
+	 */
+	if (inst->userobj_access_attr) {
+		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
+	}
+
+	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
+		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
+	}
+
+	if (inst->profile_attr) {
+		expanded.attrs[expanded.count++] = inst->profile_attr;
+	}
+
+	if (inst->valuepair_attr) {
+		expanded.attrs[expanded.count++] = inst->valuepair_attr;
+	}
+
+	expanded.attrs[expanded.count] = NULL;
+
+	if (inst->async) return mod_authorize_async(inst, thread, request, &expanded);
+
+	conn = mod_conn_get(inst, request);
+	if (!conn) {
+		talloc_free(expanded.ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
+	if (!dn) {
+		goto finish;
+	}
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+
+		goto finish;
+	}
+
+	rcode = mod_authorize_entry(inst, request, NULL, &conn, dn, entry, &expanded);
+
 finish:
 	talloc_free(expanded.ctx);
 	if (result) ldap_msgfree(result);
@@ -1386,6 +1647,52 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, UNUSED void *t
 	return RLM_MODULE_NOOP;
 }
 
+/** Allocate the connections used for asynchronous operations by this thread
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_ldap_t.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_ldap_t		*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+	bool			session_tracking = false;
+
+	if (!inst->async) return 0;
+
+#ifdef LDAP_CONTROL_X_SESSION_TRACKING
+	session_tracking = inst->session_tracking;
+#endif
+
+	t->async = fr_ldap_async_alloc(t, el, &inst->handle_config, mod_conn_create, &inst->handle_config,
+				       inst->max_outstanding, session_tracking);
+	if (!t->async) {
+		ERROR("Failed allocating asynchronous connections");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Close the connections used for asynchronous operations by this thread
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_ldap_thread_t	*t = thread;
+
+	TALLOC_FREE(t->async);
+
+	return 0;
+}
 
 /** Detach from the LDAP server and cleanup internal state.
  *
@@ -1398,6 +1705,7 @@ static int mod_detach(void *instance)
 	if (inst->userobj_sort_ctrl) ldap_control_free(inst->userobj_sort_ctrl);
 #endif
 
+	TALLOC_FREE(inst->sync);
 	fr_connection_pool_free(inst->pool);
 	talloc_free(inst->user_map);
 
@@ -1542,6 +1850,69 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		goto error;
 	}
 
+	FR_INTEGER_BOUND_CHECK("max_outstanding", inst->max_outstanding, >=, 1);
+
+	/*
+	 *	Sanity checks for the group cache.
+	 */
+	if (inst->group_cache_enable) {
+		if (!inst->groupobj_name_attr) {
+			cf_log_err_cs(conf, "Configuration item 'group.name_attribute' must be set if the "
+				      "group cache is enabled");
+
+			goto error;
+		}
+
+		if (inst->groupobj_base_dn->type != TMPL_TYPE_UNPARSED) {
+			cf_log_err_cs(conf, "Configuration item 'group.base_dn' must be a literal string if the "
+				      "group cache is enabled");
+
+			goto error;
+		}
+
+		FR_INTEGER_BOUND_CHECK("group.cache.refresh_interval", inst->group_cache_refresh, >=, 10);
+		if (inst->group_cache_change_attr && !*inst->group_cache_change_attr) {
+			inst->group_cache_change_attr = NULL;
+		}
+	}
+
+	/*
+	 *	Sanity checks for client and profile replication.
+	 */
+	if (inst->clientobj_sync || inst->profile_sync) {
+#ifndef LDAP_CONTROL_SYNC
+		cf_log_err_cs(conf, "Replicating clients and profiles is not supported by current version "
+			      "of libldap. Please upgrade or substitute current libldap and rebuild this module");
+
+		goto error;
+#endif
+#ifndef WITH_DYNAMIC_CLIENTS
+		if (inst->clientobj_sync) {
+			cf_log_err_cs(conf, "Configuration item 'client.sync' requires the server to be built "
+				      "with dynamic clients");
+
+			goto error;
+		}
+#endif
+		if (inst->profile_sync) {
+			if (!*inst->profile_base_dn) {
+				cf_log_err_cs(conf, "Configuration item 'profile.base_dn' must be set if "
+					      "profile replication is enabled");
+
+				goto error;
+			}
+
+			if (inst->profile_filter->type != TMPL_TYPE_UNPARSED) {
+				cf_log_err_cs(conf, "Configuration item 'profile.filter' must be a literal string if "
+					      "profile replication is enabled");
+
+				goto error;
+			}
+		}
+
+		FR_INTEGER_BOUND_CHECK("sync_retry_delay", inst->sync_retry_delay, >=, 1);
+	}
+
 	/*
 	 *	Sanity checks for cacheable groups code.
 	 */
@@ -1961,26 +2332,46 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	if (!inst->pool) goto error;
 
 	/*
-	 *	Bulk load dynamic clients.
+	 *	Bulk load groups.
 	 */
-	if (inst->do_clients) {
-		CONF_SECTION *cs, *map, *tmpl;
+	if (inst->group_cache_enable && (rlm_ldap_group_cache_init(inst) < 0)) {
+		cf_log_err_cs(conf, "Error loading groups");
 
-		cs = cf_section_sub_find(inst->cs, "client");
-		if (!cs) {
-			cf_log_err_cs(conf, "Told to load clients but no client section found");
-			goto error;
-		}
+		goto error;
+	}
 
-		map = cf_section_sub_find(cs, "attribute");
-		if (!map) {
-			cf_log_err_cs(cs, "Told to load clients but no attribute section found");
-			goto error;
+	/*
+	 *	Bulk load, or replicate, dynamic clients and profiles.
+	 */
+	if (inst->do_clients || inst->clientobj_sync || inst->profile_sync) {
+		CONF_SECTION *cs = NULL, *map = NULL, *tmpl = NULL;
+
+		if (inst->do_clients || inst->clientobj_sync) {
+			cs = cf_section_sub_find(inst->cs, "client");
+			if (!cs) {
+				cf_log_err_cs(conf, "Told to load clients but no client section found");
+				goto error;
+			}
+
+			map = cf_section_sub_find(cs, "attribute");
+			if (!map) {
+				cf_log_err_cs(cs, "Told to load clients but no attribute section found");
+				goto error;
+			}
+
+			tmpl = cf_section_sub_find(cs, "template");
 		}
 
-		tmpl = cf_section_sub_find(cs, "template");
+		if (inst->clientobj_sync || inst->profile_sync) {
+			if (rlm_ldap_sync_start(inst, tmpl, map) < 0) {
+				cf_log_err_cs(conf, "Error replicating %s",
+					      inst->clientobj_sync ? "clients" : "profiles");
+
+				goto error;
+			}
+		}
 
-		if (rlm_ldap_client_load(inst, tmpl, map) < 0) {
+		if (inst->do_clients && !inst->clientobj_sync && (rlm_ldap_client_load(inst, tmpl, map) < 0)) {
 			cf_log_err_cs(cs, "Error loading clients");
 
 			return -1;
@@ -2014,11 +2405,14 @@ rad_module_t rlm_ldap = {
 	.name		= "ldap",
 	.type		= 0,
 	.inst_size	= sizeof(rlm_ldap_t),
+	.thread_inst_size	= sizeof(rlm_ldap_thread_t),
 	.config		= module_config,
 	.load		= mod_load,
 	.unload		= mod_unload,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach	= mod_thread_detach,
 	.detach		= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
@@ -20,6 +20,8 @@
 #include <freeradius-devel/ldap/libfreeradius-ldap.h>
 
 typedef struct ldap_inst_s rlm_ldap_t;
+typedef struct rlm_ldap_group_cache rlm_ldap_group_cache_t;
+typedef struct rlm_ldap_sync rlm_ldap_sync_t;
 
 typedef struct {
 	vp_tmpl_t	*mech;				//!< SASL mech(s) to try.
@@ -55,6 +57,11 @@ struct ldap_inst_s {
 							//!< issued for.
 #endif
 
+	bool		async;				//!< Send user searches and binds asynchronously, servicing
+							//!< the connections from the worker's event loop.
+	uint32_t	max_outstanding;		//!< Maximum number of asynchronous searches to send on
+							//!< a single connection.
+
 	/*
 	 *	User object attributes and filters
 	 */
@@ -111,6 +118,14 @@ struct ldap_inst_s {
 	fr_dict_attr_t const	*group_da;		//!< The DA associated with this specific instance of the
 							//!< rlm_ldap module.
 
+	bool		group_cache_enable;		//!< Load all group objects into a cache shared by all
+							//!< threads, and use it to resolve group DNs and names.
+	uint32_t	group_cache_refresh;		//!< How often all group objects are reloaded.
+	uint32_t	group_cache_check;		//!< How often we check for changed group objects.
+	char const	*group_cache_change_attr;	//!< Attribute which is updated when a group object
+							//!< changes, e.g. modifyTimestamp or uSNChanged.
+	rlm_ldap_group_cache_t	*group_cache;		//!< Cache of group DNs and names.
+
 	/*
 	 *	Dynamic clients
 	 */
@@ -120,6 +135,8 @@ struct ldap_inst_s {
 	int		clientobj_scope;		//!< Search scope.
 
 	bool		do_clients;			//!< If true, attempt to load clients on instantiation.
+	bool		clientobj_sync;			//!< If true, keep clients up to date using content
+							//!< synchronisation (RFC 4533).
 
 	/*
 	 *	Profiles
@@ -131,6 +148,13 @@ struct ldap_inst_s {
 	char const	*profile_attr;			//!< Attribute that identifies profiles to apply. May appear
 							//!< in userobj or groupobj.
 	vp_tmpl_t	*profile_filter;		//!< Filter to retrieve only retrieve group objects.
+	char const	*profile_base_dn;		//!< DN to replicate profiles from.
+	bool		profile_sync;			//!< If true, replicate profile objects using content
+							//!< synchronisation (RFC 4533).
+
+	uint32_t	sync_retry_delay;		//!< How long to wait before re-establishing a failed
+							//!< sync connection.
+	rlm_ldap_sync_t	*sync;				//!< Replicated clients and profiles.
 
 	/*
 	 *	Accounting
@@ -160,6 +184,13 @@ struct ldap_inst_s {
 	uint32_t	ldap_debug;			//!< Debug flag for the SDK.
 };
 
+/** Thread specific rlm_ldap instance data
+ *
+ */
+typedef struct {
+	fr_ldap_async_t	*async;				//!< Connections for asynchronous operations.
+} rlm_ldap_thread_t;
+
 /** Result of expanding the RHS of a set of maps
  *
  * Used to store the array of attributes we'll be querying for.
@@ -178,6 +209,12 @@ typedef struct rlm_ldap_map_exp {
 char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
 			       char const *attrs[], bool force, LDAPMessage **result, rlm_rcode_t *rcode);
 
+fr_ldap_query_t *rlm_ldap_find_user_async(rlm_ldap_t const *inst, fr_ldap_async_t *async, REQUEST *request,
+					  char const *attrs[], rlm_rcode_t *rcode);
+
+char const *rlm_ldap_find_user_async_result(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_query_t *query,
+					    LDAPMessage **result, ldap_handle_t **conn, rlm_rcode_t *rcode);
+
 rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, REQUEST *request,
 				  ldap_handle_t const *conn, LDAPMessage *entry);
 
@@ -199,6 +236,17 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 
 rlm_rcode_t rlm_ldap_check_cached(rlm_ldap_t const *inst, REQUEST *request, VALUE_PAIR *check);
 
+/*
+ *	group_cache.c - Group DN and name cache.
+ */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst);
+
+bool rlm_ldap_group_cache_dn2name(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
+				  char const *dn, char **out);
+
+bool rlm_ldap_group_cache_name2dn(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
+				  char const *name, char **out);
+
 /*
  *	conn.c - Connection wrappers.
  */
@@ -223,5 +271,18 @@ int rlm_ldap_map_do(rlm_ldap_t const *inst, REQUEST *request, LDAP *handle,
 /*
  *	clients.c - Dynamic clients (bulk load).
  */
+char const **rlm_ldap_client_attrs(TALLOC_CTX *ctx, CONF_SECTION *map);
+
+RADCLIENT *rlm_ldap_client_afrom_entry(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTION *map,
+				       ldap_handle_t *conn, LDAPMessage *entry, char const *dn);
+
 int  rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTION *cs);
+
+/*
+ *	sync.c - Client and profile replication.
+ */
+int rlm_ldap_sync_start(rlm_ldap_t *inst, CONF_SECTION *tmpl, CONF_SECTION *map);
+
+rlm_rcode_t rlm_ldap_sync_profile_map(rlm_ldap_t const *inst, REQUEST *request, LDAP *handle,
+				      char const *dn, rlm_ldap_map_exp_t const *expanded);
 #endif
@@ -0,0 +1,808 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file sync.c
+ * @brief Replicate client and profile objects using LDAP content synchronisation (RFC 4533).
+ *
+ * A refreshAndPersist search is sent for client objects, and another for
+ * profile objects, on a dedicated connection.  The initial content is
+ * received when the module is instantiated.  After that, a thread reads
+ * changes as the directory sends them:
+ *
+ * - Client objects are converted to dynamic clients, which are added
+ *   to, replaced in, or deleted from the client lists.  The changes are
+ *   queued, and applied by the main thread which owns the lists.
+ * - Profile objects are stored in an index keyed by DN, so they can be
+ *   mapped without searching the directory.
+ *
+ * No cookie is ever sent.  If the connection fails, the searches are
+ * sent again once it has been re-established.  The whole content is
+ * then received again, and any objects which weren't seen are removed.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+#include <freeradius-devel/rad_assert.h>
+
+#define LOG_PREFIX "rlm_ldap (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include "rlm_ldap.h"
+
+#ifdef LDAP_CONTROL_SYNC
+/*
+ *	Values from RFC 4533, not all versions of
+ *	ldap.h define them.
+ */
+#define SYNC_MODE_REFRESH_AND_PERSIST	3
+
+#define SYNC_STATE_PRESENT		0
+#define SYNC_STATE_ADD			1
+#define SYNC_STATE_MODIFY		2
+#define SYNC_STATE_DELETE		3
+
+#define SYNC_INFO_NEW_COOKIE		0x80
+#define SYNC_INFO_REFRESH_DELETE	0xa1
+#define SYNC_INFO_REFRESH_PRESENT	0xa2
+#define SYNC_INFO_ID_SET		0xa3
+
+#define SYNC_UUID_LEN			16
+
+/** An object received from the directory
+ *
+ */
+typedef struct rlm_ldap_sync_entry {
+	uint8_t			uuid[SYNC_UUID_LEN];	//!< entryUUID of the object.
+	char			*dn;			//!< Of the object.
+	LDAPMessage		*msg;			//!< Profile object, retained so it can be mapped.
+	RADCLIENT		*client;		//!< Client created from the object.
+
+	uint32_t		generation;		//!< Refresh the object was last seen in.
+	uint32_t		refs;			//!< Requests currently mapping the object.
+	bool			removed;		//!< Object has been removed from the index, and
+							//!< should be freed when refs reaches 0.
+} rlm_ldap_sync_entry_t;
+
+/** A replicated search
+ *
+ */
+typedef struct rlm_ldap_sync_search {
+	char const		*name;			//!< Type of object, for log messages.
+	char const		*base_dn;		//!< To search under.
+	int			scope;			//!< Of the search.
+	char const		*filter;		//!< To select objects.
+	char const		**attrs;		//!< To retrieve, NULL for all user attributes.
+
+	CONF_SECTION		*tmpl;			//!< To use as the base for clients.
+	CONF_SECTION		*map;			//!< Client attribute/LDAP attribute mappings.
+							//!< NULL if this search is for profiles.
+
+	int			msgid;			//!< Of the search, -1 if it hasn't been sent.
+	bool			refreshing;		//!< Still receiving the initial content.
+	uint32_t		generation;		//!< Incremented each time the search is sent.
+
+	rbtree_t		*uuids;			//!< Objects by entryUUID.
+	rbtree_t		*dns;			//!< Objects by DN.
+} rlm_ldap_sync_search_t;
+
+struct rlm_ldap_sync {
+	rlm_ldap_t		*inst;			//!< Instance the searches belong to.
+	ldap_handle_t		*conn;			//!< Searches are sent on.
+
+	rlm_ldap_sync_search_t	*clients;		//!< Search for client objects.
+	rlm_ldap_sync_search_t	*profiles;		//!< Search for profile objects.
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;			//!< Protects the indexes.
+	pthread_t		pthread_id;		//!< Of the thread reading changes.
+	bool			running;		//!< Whether the thread was started.
+#endif
+	bool volatile		stop;			//!< Tell the thread to exit.
+};
+
+#ifdef HAVE_PTHREAD_H
+#  define SYNC_LOCK(_sync)	pthread_mutex_lock(&(_sync)->mutex)
+#  define SYNC_UNLOCK(_sync)	pthread_mutex_unlock(&(_sync)->mutex)
+#else
+#  define SYNC_LOCK(_sync)
+#  define SYNC_UNLOCK(_sync)
+#endif
+
+static int _sync_entry_uuid_cmp(void const *one, void const *two)
+{
+	rlm_ldap_sync_entry_t const *a = one, *b = two;
+
+	return memcmp(a->uuid, b->uuid, sizeof(a->uuid));
+}
+
+static int _sync_entry_dn_cmp(void const *one, void const *two)
+{
+	rlm_ldap_sync_entry_t const *a = one, *b = two;
+
+	return strcasecmp(a->dn, b->dn);
+}
+
+static int _sync_entry_free(rlm_ldap_sync_entry_t *entry)
+{
+	if (entry->msg) ldap_msgfree(entry->msg);
+
+	return 0;
+}
+
+/** Remove an object from the index of a search
+ *
+ * Must be called with the mutex held.
+ */
+static void sync_entry_remove(rlm_ldap_sync_t *sync, rlm_ldap_sync_search_t *search,
+			      rlm_ldap_sync_entry_t *entry)
+{
+	rlm_ldap_t const *inst = sync->inst;
+
+	rbtree_deletebydata(search->uuids, entry);
+	rbtree_deletebydata(search->dns, entry);
+
+#ifdef WITH_DYNAMIC_CLIENTS
+	if (entry->client) {
+		DEBUG("Client \"%s\" removed", entry->dn);
+
+		client_delete_deferred(entry->client);
+		entry->client = NULL;
+	}
+#endif
+
+	/*
+	 *	Requests may still be mapping the profile,
+	 *	the last one to finish frees it.
+	 */
+	if (entry->refs > 0) {
+		entry->removed = true;
+		(void) talloc_steal(NULL, entry);
+		return;
+	}
+
+	talloc_free(entry);
+}
+
+/** Add or replace an object in the index of a search
+ *
+ * @param[in] sync	the search belongs to.
+ * @param[in] search	the object was received for.
+ * @param[in] uuid	of the object.
+ * @param[in] msg	containing the object.  Freed, or retained by the index.
+ */
+static void sync_entry_update(rlm_ldap_sync_t *sync, rlm_ldap_sync_search_t *search,
+			      uint8_t const uuid[SYNC_UUID_LEN], LDAPMessage *msg)
+{
+	rlm_ldap_t const	*inst = sync->inst;
+	rlm_ldap_sync_entry_t	find, *entry, *old;
+	char			*dn;
+	RADCLIENT		*client = NULL;
+
+	dn = ldap_get_dn(sync->conn->handle, msg);
+	if (!dn) {
+		ERROR("Retrieving %s object DN from entry failed: %s", search->name, fr_ldap_error_str(sync->conn));
+		ldap_msgfree(msg);
+		return;
+	}
+	fr_ldap_util_normalise_dn(dn, dn);
+
+#ifdef WITH_DYNAMIC_CLIENTS
+	if (search->map) {
+		client = rlm_ldap_client_afrom_entry(inst, search->tmpl, search->map, sync->conn, msg, dn);
+		ldap_msgfree(msg);
+		msg = NULL;
+		if (!client) {
+			ERROR("Failed creating client from \"%s\"", dn);
+			ldap_memfree(dn);
+			return;
+		}
+	}
+#endif
+
+	entry = talloc_zero(search, rlm_ldap_sync_entry_t);
+	if (!entry) {
+		if (msg) ldap_msgfree(msg);
+		if (client) client_free(client);
+		ldap_memfree(dn);
+		return;
+	}
+	memcpy(entry->uuid, uuid, sizeof(entry->uuid));
+	entry->dn = talloc_typed_strdup(entry, dn);
+	entry->msg = msg;
+	entry->generation = search->generation;
+	talloc_set_destructor(entry, _sync_entry_free);
+	ldap_memfree(dn);
+
+	memcpy(find.uuid, uuid, sizeof(find.uuid));
+
+	SYNC_LOCK(sync);
+	old = rbtree_finddata(search->uuids, &find);
+	if (old) sync_entry_remove(sync, search, old);
+
+	/*
+	 *	A different object may have had this DN
+	 *	if it was renamed and we missed the change.
+	 */
+	old = rbtree_finddata(search->dns, entry);
+	if (old) sync_entry_remove(sync, search, old);
+
+	/*
+	 *	The client lists belong to the main thread,
+	 *	which adds the client, and frees it once
+	 *	it's been deleted.
+	 */
+	if (client) {
+		client_add_deferred(client);
+		entry->client = client;
+
+		DEBUG("Client \"%s\" added", entry->dn);
+	}
+
+	if (!rbtree_insert(search->uuids, entry) || !rbtree_insert(search->dns, entry)) {
+		sync_entry_remove(sync, search, entry);
+		SYNC_UNLOCK(sync);
+		return;
+	}
+	SYNC_UNLOCK(sync);
+
+	DEBUG2("Updated %s object \"%s\"", search->name, entry->dn);
+}
+
+/** Remove an object the directory told us was deleted
+ *
+ */
+static void sync_entry_delete(rlm_ldap_sync_t *sync, rlm_ldap_sync_search_t *search,
+			      uint8_t const uuid[SYNC_UUID_LEN])
+{
+	rlm_ldap_sync_entry_t	find, *entry;
+
+	memcpy(find.uuid, uuid, sizeof(find.uuid));
+
+	SYNC_LOCK(sync);
+	entry = rbtree_finddata(search->uuids, &find);
+	if (entry) sync_entry_remove(sync, search, entry);
+	SYNC_UNLOCK(sync);
+}
+
+/** Mark an object as still present in the directory
+ *
+ */
+static void sync_entry_present(rlm_ldap_sync_t *sync, rlm_ldap_sync_search_t *search,
+			       uint8_t const uuid[SYNC_UUID_LEN])
+{
+	rlm_ldap_sync_entry_t	find, *entry;
+
+	memcpy(find.uuid, uuid, sizeof(find.uuid));
+
+	SYNC_LOCK(sync);
+	entry = rbtree_finddata(search->uuids, &find);
+	if (entry) entry->generation = search->generation;
+	SYNC_UNLOCK(sync);
+}
+
+typedef struct {
+	rlm_ldap_sync_search_t	*search;
+	rlm_ldap_sync_entry_t	**stale;
+} sync_sweep_ctx_t;
+
+static int _sync_entry_stale(void *ctx, void *data)
+{
+	sync_sweep_ctx_t	*sweep = ctx;
+	rlm_ldap_sync_entry_t	*entry = data;
+
+	if (entry->generation == sweep->search->generation) return 0;
+
+	sweep->stale[talloc_array_length(sweep->stale) - 1] = entry;
+	sweep->stale = talloc_realloc(NULL, sweep->stale, rlm_ldap_sync_entry_t *,
+				      talloc_array_length(sweep->stale) + 1);
+
+	return sweep->stale ? 0 : -1;
+}
+
+/** Remove objects which weren't received during the refresh
+ *
+ */
+static void sync_refresh_done(rlm_ldap_sync_t *sync, rlm_ldap_sync_search_t *search)
+{
+	rlm_ldap_t const	*inst = sync->inst;
+	sync_sweep_ctx_t	sweep = { .search = search };
+	size_t			i;
+
+	search->refreshing = false;
+
+	SYNC_LOCK(sync);
+	sweep.stale = talloc_array(NULL, rlm_ldap_sync_entry_t *, 1);
+	if (sweep.stale) (void) rbtree_walk(search->uuids, RBTREE_IN_ORDER, _sync_entry_stale, &sweep);
+	if (sweep.stale) {
+		for (i = 0; i < (talloc_array_length(sweep.stale) - 1); i++) {
+			sync_entry_remove(sync, search, sweep.stale[i]);
+		}
+	}
+	SYNC_UNLOCK(sync);
+
+	DEBUG("Received %u %s object(s)", rbtree_num_elements(search->uuids), search->name);
+	talloc_free(sweep.stale);
+}
+
+/** Send a refreshAndPersist search
+ *
+ */
+static int sync_search_send(rlm_ldap_sync_t *sync, rlm_ldap_sync_search_t *search)
+{
+	rlm_ldap_t const	*inst = sync->inst;
+	BerElement		*ber;
+	struct berval		bv;
+	LDAPControl		*serverctrls[] = { NULL, NULL };
+	char			**attrs;
+	int			ret;
+
+	ber = ber_alloc_t(LBER_USE_DER);
+	if (!ber) return -1;
+
+	if ((ber_printf(ber, "{e}", (ber_int_t) SYNC_MODE_REFRESH_AND_PERSIST) < 0) ||
+	    (ber_flatten2(ber, &bv, 0) < 0) ||
+	    (ldap_control_create(LDAP_CONTROL_SYNC, 1, &bv, 1, &serverctrls[0]) != LDAP_SUCCESS)) {
+		ERROR("Failed creating sync request control");
+		ber_free(ber, 1);
+		return -1;
+	}
+	ber_free(ber, 1);
+
+	memcpy(&attrs, &search->attrs, sizeof(attrs));
+
+	ret = ldap_search_ext(sync->conn->handle, search->base_dn, search->scope, search->filter, attrs,
+			      0, serverctrls, NULL, NULL, LDAP_NO_LIMIT, &search->msgid);
+	ldap_control_free(serverctrls[0]);
+	if (ret != LDAP_SUCCESS) {
+		ERROR("Failed sending %s object sync search: %s", search->name, ldap_err2string(ret));
+		search->msgid = -1;
+		return -1;
+	}
+
+	search->refreshing = true;
+	search->generation++;
+
+	DEBUG("Synchronising %s objects under \"%s\"", search->name, search->base_dn);
+
+	return 0;
+}
+
+/** Open the connection and send the searches
+ *
+ */
+static int sync_connect(rlm_ldap_sync_t *sync)
+{
+	rlm_ldap_t const	*inst = sync->inst;
+	int			no_limit = LDAP_NO_LIMIT;
+
+	sync->conn = mod_conn_create(sync, &sync->inst->handle_config, &inst->handle_config.res_timeout);
+	if (!sync->conn) return -1;
+
+	/*
+	 *	The searches never complete, so they
+	 *	mustn't be subject to the time limit.
+	 */
+	ldap_set_option(sync->conn->handle, LDAP_OPT_TIMELIMIT, &no_limit);
+
+	if ((sync->clients && (sync_search_send(sync, sync->clients) < 0)) ||
+	    (sync->profiles && (sync_search_send(sync, sync->profiles) < 0))) {
+		TALLOC_FREE(sync->conn);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Process a Sync Info message
+ *
+ */
+static void sync_info_process(rlm_ldap_sync_t *sync, rlm_ldap_sync_search_t *search, struct berval *data)
+{
+	rlm_ldap_t const	*inst = sync->inst;
+	BerElement		*ber;
+	ber_tag_t		tag;
+	ber_len_t		len;
+	ber_int_t		done = 1;
+
+	ber = ber_init(data);
+	if (!ber) return;
+
+	tag = ber_peek_tag(ber, &len);
+	switch (tag) {
+	case SYNC_INFO_NEW_COOKIE:
+		break;
+
+	/*
+	 *	We never send a cookie, so both of these
+	 *	end a refresh of the whole content.
+	 */
+	case SYNC_INFO_REFRESH_DELETE:
+	case SYNC_INFO_REFRESH_PRESENT:
+		if (ber_scanf(ber, "{") == LBER_ERROR) break;
+
+		if (ber_peek_tag(ber, &len) == LBER_OCTETSTRING) (void) ber_scanf(ber, "x");
+		if (ber_peek_tag(ber, &len) == LBER_BOOLEAN) (void) ber_scanf(ber, "b", &done);
+
+		if (done && search->refreshing) sync_refresh_done(sync, search);
+		break;
+
+	case SYNC_INFO_ID_SET:
+		WARN("Ignoring unexpected syncIdSet for %s objects", search->name);
+		break;
+
+	default:
+		WARN("Ignoring malformed sync info message for %s objects", search->name);
+		break;
+	}
+
+	ber_free(ber, 1);
+}
+
+/** Process a message received on the sync connection
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if a search has ended, and the connection should be re-established.
+ */
+static int sync_msg_process(rlm_ldap_sync_t *sync, LDAPMessage *msg)
+{
+	rlm_ldap_t const	*inst = sync->inst;
+	rlm_ldap_sync_search_t	*search = NULL;
+	int			msgid = ldap_msgid(msg);
+	int			ret = 0;
+
+	if (sync->clients && (sync->clients->msgid == msgid)) search = sync->clients;
+	if (sync->profiles && (sync->profiles->msgid == msgid)) search = sync->profiles;
+	if (!search) {
+		ldap_msgfree(msg);
+		return 0;
+	}
+
+	switch (ldap_msgtype(msg)) {
+	case LDAP_RES_SEARCH_ENTRY:
+	{
+		LDAPControl	**ctrls = NULL, *state_ctrl;
+		BerElement	*ber;
+		ber_int_t	state;
+		struct berval	uuid;
+		uint8_t		uuid_buff[SYNC_UUID_LEN];
+
+		if ((ldap_get_entry_controls(sync->conn->handle, msg, &ctrls) != LDAP_SUCCESS) ||
+		    !(state_ctrl = ldap_control_find(LDAP_CONTROL_SYNC_STATE, ctrls, NULL))) {
+			WARN("Ignoring %s object without sync state", search->name);
+		malformed:
+			if (ctrls) ldap_controls_free(ctrls);
+			ldap_msgfree(msg);
+			break;
+		}
+
+		ber = ber_init(&state_ctrl->ldctl_value);
+		if (!ber) goto malformed;
+
+		if ((ber_scanf(ber, "{em", &state, &uuid) == LBER_ERROR) || (uuid.bv_len != SYNC_UUID_LEN)) {
+			WARN("Ignoring %s object with malformed sync state", search->name);
+			ber_free(ber, 1);
+			goto malformed;
+		}
+		memcpy(uuid_buff, uuid.bv_val, sizeof(uuid_buff));
+		ber_free(ber, 1);
+		ldap_controls_free(ctrls);
+
+		switch (state) {
+		case SYNC_STATE_PRESENT:
+			sync_entry_present(sync, search, uuid_buff);
+			ldap_msgfree(msg);
+			break;
+
+		case SYNC_STATE_ADD:
+		case SYNC_STATE_MODIFY:
+			sync_entry_update(sync, search, uuid_buff, msg);
+			break;
+
+		case SYNC_STATE_DELETE:
+			sync_entry_delete(sync, search, uuid_buff);
+			ldap_msgfree(msg);
+			break;
+
+		default:
+			WARN("Ignoring %s object with unknown sync state %i", search->name, state);
+			ldap_msgfree(msg);
+			break;
+		}
+	}
+		break;
+
+	case LDAP_RES_INTERMEDIATE:
+	{
+		char		*oid = NULL;
+		struct berval	*data = NULL;
+
+		if ((ldap_parse_intermediate(sync->conn->handle, msg, &oid, &data, NULL, 0) == LDAP_SUCCESS) &&
+		    oid && data && (strcmp(oid, LDAP_SYNC_INFO) == 0)) {
+			sync_info_process(sync, search, data);
+		}
+		if (oid) ldap_memfree(oid);
+		if (data) ber_bvfree(data);
+		ldap_msgfree(msg);
+	}
+		break;
+
+	/*
+	 *	The server ended the search, we need
+	 *	to start again.
+	 */
+	case LDAP_RES_SEARCH_RESULT:
+	{
+		int	code = LDAP_OTHER;
+		char	*text = NULL;
+
+		(void) ldap_parse_result(sync->conn->handle, msg, &code, NULL, &text, NULL, NULL, 1);
+		ERROR("Server ended %s object sync search: %s%s%s", search->name, ldap_err2string(code),
+		      text ? ": " : "", text ? text : "");
+		if (text) ldap_memfree(text);
+		search->msgid = -1;
+		ret = -1;
+	}
+		break;
+
+	default:
+		ldap_msgfree(msg);
+		break;
+	}
+
+	return ret;
+}
+
+/** Read and process one message from the sync connection
+ *
+ * @return
+ *	- 1 if a message was processed.
+ *	- 0 if no message was received before the timeout.
+ *	- -1 if the connection should be re-established.
+ */
+static int sync_read(rlm_ldap_sync_t *sync, struct timeval const *timeout)
+{
+	rlm_ldap_t const	*inst = sync->inst;
+	LDAPMessage		*msg = NULL;
+	struct timeval		tv = *timeout;
+	int			ret;
+
+	ret = ldap_result(sync->conn->handle, LDAP_RES_ANY, LDAP_MSG_ONE, &tv, &msg);
+	if (ret == 0) return 0;
+	if (ret < 0) {
+		ERROR("Failed reading from sync connection: %s", fr_ldap_error_str(sync->conn));
+		return -1;
+	}
+
+	if (sync_msg_process(sync, msg) < 0) return -1;
+
+	return 1;
+}
+
+#ifdef HAVE_PTHREAD_H
+/** Read changes until told to stop, re-establishing the connection if it fails
+ *
+ */
+static void *sync_thread(void *arg)
+{
+	rlm_ldap_sync_t		*sync = arg;
+	rlm_ldap_t const	*inst = sync->inst;
+	struct timeval		timeout = { 1, 0 };
+	uint32_t		i;
+
+	while (!sync->stop) {
+		if (!sync->conn) {
+			if (sync_connect(sync) == 0) continue;
+
+			for (i = 0; (i < inst->sync_retry_delay) && !sync->stop; i++) sleep(1);
+			continue;
+		}
+
+		if (sync_read(sync, &timeout) < 0) {
+			WARN("Sync connection failed, reconnecting in %u seconds", inst->sync_retry_delay);
+			TALLOC_FREE(sync->conn);
+
+			for (i = 0; (i < inst->sync_retry_delay) && !sync->stop; i++) sleep(1);
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+static int _sync_free(rlm_ldap_sync_t *sync)
+{
+#ifdef HAVE_PTHREAD_H
+	if (sync->running) {
+		sync->stop = true;
+		pthread_join(sync->pthread_id, NULL);
+	}
+	pthread_mutex_destroy(&sync->mutex);
+#endif
+
+	return 0;
+}
+
+static rlm_ldap_sync_search_t *sync_search_alloc(rlm_ldap_sync_t *sync, char const *name, char const *base_dn,
+						 int scope, char const *filter)
+{
+	rlm_ldap_sync_search_t *search;
+
+	search = talloc_zero(sync, rlm_ldap_sync_search_t);
+	if (!search) return NULL;
+
+	search->name = name;
+	search->base_dn = base_dn;
+	search->scope = scope;
+	search->filter = filter;
+	search->msgid = -1;
+
+	search->uuids = rbtree_create(search, _sync_entry_uuid_cmp, NULL, RBTREE_FLAG_NONE);
+	search->dns = rbtree_create(search, _sync_entry_dn_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!search->uuids || !search->dns) {
+		talloc_free(search);
+		return NULL;
+	}
+
+	return search;
+}
+
+/** Receive the initial content of client and profile objects, then start a thread to receive changes
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] tmpl to use as the base for new clients.
+ * @param[in] map to load client attribute/LDAP attribute mappings from.  NULL if clients
+ *	aren't being synchronised.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rlm_ldap_sync_start(rlm_ldap_t *inst, CONF_SECTION *tmpl, CONF_SECTION *map)
+{
+	rlm_ldap_sync_t		*sync;
+
+	sync = talloc_zero(inst, rlm_ldap_sync_t);
+	if (!sync) return -1;
+
+	sync->inst = inst;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&sync->mutex, NULL);
+#endif
+	talloc_set_destructor(sync, _sync_free);
+
+#ifdef WITH_DYNAMIC_CLIENTS
+	if (map) {
+		sync->clients = sync_search_alloc(sync, "client", inst->clientobj_base_dn, inst->clientobj_scope,
+						  inst->clientobj_filter);
+		if (!sync->clients) goto error;
+
+		sync->clients->tmpl = tmpl;
+		sync->clients->map = map;
+		sync->clients->attrs = rlm_ldap_client_attrs(sync->clients, map);
+		if (!sync->clients->attrs) goto error;
+	}
+#endif
+
+	if (inst->profile_sync) {
+		sync->profiles = sync_search_alloc(sync, "profile", inst->profile_base_dn, LDAP_SCOPE_SUB,
+						   inst->profile_filter->name);
+		if (!sync->profiles) goto error;
+	}
+
+	if (sync_connect(sync) < 0) goto error;
+
+	/*
+	 *	Wait for the initial content, so clients
+	 *	are available before we start processing
+	 *	packets.
+	 */
+	while ((sync->clients && sync->clients->refreshing) || (sync->profiles && sync->profiles->refreshing)) {
+		int ret;
+
+		ret = sync_read(sync, &inst->handle_config.res_timeout);
+		if (ret == 0) {
+			ERROR("Timed out waiting for sync search results");
+			goto error;
+		}
+		if (ret < 0) goto error;
+	}
+
+#ifdef WITH_DYNAMIC_CLIENTS
+	/*
+	 *	We're still in the main thread, so the
+	 *	initial clients can be added now.
+	 */
+	if (sync->clients) client_deferred_process();
+#endif
+
+#ifdef HAVE_PTHREAD_H
+	if (pthread_create(&sync->pthread_id, NULL, sync_thread, sync) != 0) {
+		ERROR("Failed creating sync thread: %s", fr_syserror(errno));
+		goto error;
+	}
+	sync->running = true;
+#endif
+
+	inst->sync = sync;
+
+	return 0;
+
+error:
+	talloc_free(sync);
+	return -1;
+}
+
+/** Map attributes from a replicated profile object
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] handle to use when parsing the profile object.
+ * @param[in] dn of profile object to apply.
+ * @param[in] expanded Structure containing a list of xlat expanded attribute names and mapping information.
+ * @return
+ *	- RLM_MODULE_NOOP if the profile object hasn't been replicated, and should be searched for.
+ *	- RLM_MODULE_UPDATED if attributes were added to the request.
+ *	- RLM_MODULE_OK if the profile object contained no attributes to map.
+ */
+rlm_rcode_t rlm_ldap_sync_profile_map(rlm_ldap_t const *inst, REQUEST *request, LDAP *handle,
+				      char const *dn, rlm_ldap_map_exp_t const *expanded)
+{
+	rlm_ldap_sync_t		*sync = inst->sync;
+	rlm_ldap_sync_entry_t	find, *entry;
+	LDAPMessage		*msg;
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+
+	if (!sync || !sync->profiles) return RLM_MODULE_NOOP;
+
+	memcpy(&find.dn, &dn, sizeof(find.dn));
+
+	SYNC_LOCK(sync);
+	entry = rbtree_finddata(sync->profiles->dns, &find);
+	if (entry) entry->refs++;
+	SYNC_UNLOCK(sync);
+
+	if (!entry) return RLM_MODULE_NOOP;
+
+	msg = ldap_first_entry(handle, entry->msg);
+	if (msg) {
+		RDEBUG("Processing profile attributes (replicated)");
+		RINDENT();
+		if (rlm_ldap_map_do(inst, request, handle, expanded, msg) > 0) rcode = RLM_MODULE_UPDATED;
+		REXDENT();
+	}
+
+	SYNC_LOCK(sync);
+	if ((--entry->refs == 0) && entry->removed) talloc_free(entry);
+	SYNC_UNLOCK(sync);
+
+	return rcode;
+}
+#else
+int rlm_ldap_sync_start(rlm_ldap_t *inst, UNUSED CONF_SECTION *tmpl, UNUSED CONF_SECTION *map)
+{
+	ERROR("Content synchronisation isn't supported by this version of libldap");
+
+	return -1;
+}
+
+rlm_rcode_t rlm_ldap_sync_profile_map(UNUSED rlm_ldap_t const *inst, UNUSED REQUEST *request,
+				      UNUSED LDAP *handle, UNUSED char const *dn,
+				      UNUSED rlm_ldap_map_exp_t const *expanded)
+{
+	return RLM_MODULE_NOOP;
+}
+#endif
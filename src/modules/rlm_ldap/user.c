@@ -32,6 +32,125 @@
 
 #include "rlm_ldap.h"
 
+/** Expand the base DN and filter used to search for user objects
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[out] base_dn Where to write a pointer to the expanded base DN.
+ * @param[in] base_dn_buff Buffer of #LDAP_MAX_DN_STR_LEN bytes to expand the base DN into.
+ * @param[out] filter Where to write a pointer to the expanded filter, NULL if there's no filter.
+ * @param[in] filter_buff Buffer of #LDAP_MAX_FILTER_STR_LEN bytes to expand the filter into.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int rlm_ldap_user_search_expand(rlm_ldap_t const *inst, REQUEST *request,
+				       char const **base_dn, char *base_dn_buff,
+				       char const **filter, char *filter_buff)
+{
+	*filter = NULL;
+
+	if (inst->userobj_filter) {
+		if (tmpl_expand(filter, filter_buff, LDAP_MAX_FILTER_STR_LEN, request, inst->userobj_filter,
+				fr_ldap_escape_func, NULL) < 0) {
+			REDEBUG("Unable to create filter");
+			return -1;
+		}
+	}
+
+	if (tmpl_expand(base_dn, base_dn_buff, LDAP_MAX_DN_STR_LEN, request,
+			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Unable to create base_dn");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Extract the DN of the user object from a search result
+ *
+ * Adds the DN to the control list as LDAP-UserDN.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the search was performed on.
+ * @param[in] result of the user object search.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return The user's DN or NULL on error.
+ */
+static char const *rlm_ldap_user_dn(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t const *conn,
+				    LDAPMessage *result, rlm_rcode_t *rcode)
+{
+	VALUE_PAIR	*vp = NULL;
+	LDAPMessage	*entry = NULL;
+	int		ldap_errno;
+	int		cnt;
+	char		*dn = NULL;
+
+	*rcode = RLM_MODULE_FAIL;
+
+	/*
+	 *	Forbid the use of unsorted search results that
+	 *	contain multiple entries, as it's a potential
+	 *	security issue, and likely non deterministic.
+	 */
+	if (!inst->userobj_sort_ctrl) {
+		cnt = ldap_count_entries(conn->handle, result);
+		if (cnt > 1) {
+			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
+				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
+			REDEBUG("The following entries were returned:");
+			RINDENT();
+			for (entry = ldap_first_entry(conn->handle, result);
+			     entry;
+			     entry = ldap_next_entry(conn->handle, entry)) {
+				dn = ldap_get_dn(conn->handle, entry);
+				REDEBUG("%s", dn);
+				ldap_memfree(dn);
+			}
+			REXDENT();
+			*rcode = RLM_MODULE_INVALID;
+			return NULL;
+		}
+	}
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s",
+			ldap_err2string(ldap_errno));
+
+		return NULL;
+	}
+
+	dn = ldap_get_dn(conn->handle, entry);
+	if (!dn) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+		return NULL;
+	}
+	fr_ldap_util_normalise_dn(dn, dn);
+
+	/*
+	 *	We can't use fr_pair_make here to copy the value into the
+	 *	attribute, as the dn must be copied into the attribute
+	 *	verbatim (without de-escaping).
+	 *
+	 *	Special chars are pre-escaped by libldap, and because
+	 *	we pass the string back to libldap we must not alter it.
+	 */
+	RDEBUG("User object found at DN \"%s\"", dn);
+	vp = fr_pair_make(request, &request->control, "LDAP-UserDN", NULL, T_OP_EQ);
+	if (vp) {
+		fr_pair_value_strcpy(vp, dn);
+		*rcode = RLM_MODULE_OK;
+	}
+	ldap_memfree(dn);
+
+	return vp ? vp->vp_strvalue : NULL;
+}
+
 /** Retrieve the DN of a user object
  *
  * Retrieves the DN of a user and adds it to the control list as LDAP-UserDN. Will also retrieve any
@@ -57,10 +176,8 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_ha
 
 	ldap_rcode_t	status;
 	VALUE_PAIR	*vp = NULL;
-	LDAPMessage	*tmp_msg = NULL, *entry = NULL;
-	int		ldap_errno;
-	int		cnt;
-	char		*dn = NULL;
+	LDAPMessage	*tmp_msg = NULL;
+	char const	*dn;
 	char const	*filter = NULL;
 	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
 	char const	*base_dn;
@@ -111,21 +228,8 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_ha
 		(*pconn)->rebound = false;
 	}
 
-	if (inst->userobj_filter) {
-		if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request, inst->userobj_filter,
-				fr_ldap_escape_func, NULL) < 0) {
-			REDEBUG("Unable to create filter");
-			*rcode = RLM_MODULE_INVALID;
-
-			return NULL;
-		}
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Unable to create base_dn");
+	if (rlm_ldap_user_search_expand(inst, request, &base_dn, base_dn_buff, &filter, filter_buff) < 0) {
 		*rcode = RLM_MODULE_INVALID;
-
 		return NULL;
 	}
 
@@ -147,72 +251,91 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_ha
 
 	rad_assert(*pconn);
 
-	/*
-	 *	Forbid the use of unsorted search results that
-	 *	contain multiple entries, as it's a potential
-	 *	security issue, and likely non deterministic.
-	 */
-	if (!inst->userobj_sort_ctrl) {
-		cnt = ldap_count_entries((*pconn)->handle, *result);
-		if (cnt > 1) {
-			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
-				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
-			REDEBUG("The following entries were returned:");
-			RINDENT();
-			for (entry = ldap_first_entry((*pconn)->handle, *result);
-			     entry;
-			     entry = ldap_next_entry((*pconn)->handle, entry)) {
-				dn = ldap_get_dn((*pconn)->handle, entry);
-				REDEBUG("%s", dn);
-				ldap_memfree(dn);
-			}
-			REXDENT();
-			*rcode = RLM_MODULE_INVALID;
-			goto finish;
-		}
-	}
-
-	entry = ldap_first_entry((*pconn)->handle, *result);
-	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s",
-			ldap_err2string(ldap_errno));
+	dn = rlm_ldap_user_dn(inst, request, *pconn, *result, rcode);
 
-		goto finish;
+	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
+		ldap_msgfree(*result);
+		*result = NULL;
 	}
 
-	dn = ldap_get_dn((*pconn)->handle, entry);
-	if (!dn) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+	return dn;
+}
+
+/** Start an asynchronous search for a user object
+ *
+ * The request is marked as resumable when the result is available, which should then
+ * be passed to #rlm_ldap_find_user_async_result.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] async Connections to send the search on.
+ * @param[in] request Current request.
+ * @param[in] attrs Additional attributes to retrieve, may be NULL.
+ * @param[out] rcode The status of the operation if the search couldn't be sent.
+ * @return The query, or NULL on error.
+ */
+fr_ldap_query_t *rlm_ldap_find_user_async(rlm_ldap_t const *inst, fr_ldap_async_t *async, REQUEST *request,
+					  char const *attrs[], rlm_rcode_t *rcode)
+{
+	fr_ldap_query_t	*query;
+	char const	*filter = NULL;
+	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const	*base_dn;
+	char	    	base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	LDAPControl	*serverctrls[] = { inst->userobj_sort_ctrl, NULL };
 
-		goto finish;
+	if (rlm_ldap_user_search_expand(inst, request, &base_dn, base_dn_buff, &filter, filter_buff) < 0) {
+		*rcode = RLM_MODULE_INVALID;
+		return NULL;
 	}
-	fr_ldap_util_normalise_dn(dn, dn);
 
-	/*
-	 *	We can't use fr_pair_make here to copy the value into the
-	 *	attribute, as the dn must be copied into the attribute
-	 *	verbatim (without de-escaping).
-	 *
-	 *	Special chars are pre-escaped by libldap, and because
-	 *	we pass the string back to libldap we must not alter it.
-	 */
-	RDEBUG("User object found at DN \"%s\"", dn);
-	vp = fr_pair_make(request, &request->control, "LDAP-UserDN", NULL, T_OP_EQ);
-	if (vp) {
-		fr_pair_value_strcpy(vp, dn);
-		*rcode = RLM_MODULE_OK;
+	query = fr_ldap_async_search(async, request, base_dn, inst->userobj_scope, filter, attrs, serverctrls, NULL);
+	if (!query) {
+		*rcode = RLM_MODULE_FAIL;
+		return NULL;
 	}
-	ldap_memfree(dn);
 
-finish:
-	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
-		ldap_msgfree(*result);
-		*result = NULL;
+	*rcode = RLM_MODULE_OK;
+
+	return query;
+}
+
+/** Process the result of an asynchronous search for a user object
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] query returned by #rlm_ldap_find_user_async.
+ * @param[out] result Where to write the result, owned by the query.  May be NULL.
+ * @param[out] conn Where to write the connection the search was performed on.  May be NULL.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return The user's DN or NULL on error.
+ */
+char const *rlm_ldap_find_user_async_result(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_query_t *query,
+					    LDAPMessage **result, ldap_handle_t **conn, rlm_rcode_t *rcode)
+{
+	LDAPMessage	*our_result;
+	ldap_handle_t	*our_conn;
+
+	if (result) *result = NULL;
+	if (conn) *conn = NULL;
+
+	switch (fr_ldap_async_result(&our_result, &our_conn, query)) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_BAD_DN:
+	case LDAP_PROC_NO_RESULT:
+		*rcode = RLM_MODULE_NOTFOUND;
+		return NULL;
+
+	default:
+		*rcode = RLM_MODULE_FAIL;
+		return NULL;
 	}
 
-	return vp ? vp->vp_strvalue : NULL;
+	if (result) *result = our_result;
+	if (conn) *conn = our_conn;
+
+	return rlm_ldap_user_dn(inst, request, our_conn, our_result, rcode);
 }
 
 /** Check for presence of access attribute in result
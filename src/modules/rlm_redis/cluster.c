@@ -85,9 +85,17 @@
  *   indexes in the fr_redis_cluster_t.node array.  We use 8bit unsigned integers instead of
  *   pointers to save space.  Using pointers, the node[] array would need 784K, using IDs
  *   it uses 112K.  Still not light on memory, but a bit more acceptable.
- *   Currently the key_slot array is shadowed by key_slot_pending, used to stage new key_slot
- *   mappings.  This doubles the memory used.  We may want to consider allocating key_slot_pending
- *   only during remappings and freeing it after.
+ *
+ *   The key_slot array lives in a #cluster_slot_map_t, which is never modified once applied.
+ *   A remap builds a new map, and swaps the cluster's map pointer atomically.  Workers resolving
+ *   keys load the pointer and copy out the single key slot they need, so they never contend on
+ *   the cluster mutex, even while a remap is in progress.
+ *
+ *   Readers announce themselves in one of two counters, picked by the low bit of a map epoch.
+ *   After swapping in a new map, the remapping thread flips the epoch, so new readers use the
+ *   other counter, and waits for the counter of the previous epoch to drain before freeing
+ *   the superseded map.  Readers only hold a map for long enough to hash a key and copy a
+ *   key slot, so the wait is short, and can't be prolonged by a steady stream of new readers.
  *
  * Mapping/Remapping the cluster
  * -----------------------------
@@ -103,11 +111,11 @@
  *     4. Connecting to nodes that were in the result, but not in the tree.
  *        Note: If we can't connect to any of the masters, we count the map as invalid, roll
  *        back any newly connected nodes, and error out. Slave failure is OK.
- *     5. Mapping keyslot ranges to nodes in the key_slot_pending array.
+ *     5. Mapping keyslot ranges to nodes in a newly allocated key slot map.
  *     6. Verifying there are no holes in the ranges (if there are, we roll back and error out).
- *     7. Applying the new keyslot ranges.
- *     8. Removing nodes no longer used by the key slots, and adding them back to the free
+ *     7. Removing nodes no longer used by the key slots, and adding them back to the free
  *        nodes queue.
+ *     8. Publishing the new key slot map.
  *
  *   #cluster_map_get and #cluster_map_apply, perform the operations described
  *   above. The get function, issues the 'cluster slots' command and performs validation, the
@@ -122,6 +130,10 @@
  *   Remaps are limited to one per second.  If any operation sets the remap_needed flag, or
  *   attempts a remap directly, the remap may be skipped if one occurred recently.
  *
+ *   Callers which must not block (#fr_redis_cluster_addr_by_key) don't remap themselves.
+ *   Instead they wake a remap thread, which is started the first time it's needed, and
+ *   keep routing with the current map until the thread publishes a new one.
+ *
  *
  * Processing '-ASK' and '-MOVE' redirects
  * ---------------------------------------
@@ -144,17 +156,45 @@
  *   should attempt the operation again.  The cluster spec says we should attempt the operation
  *   after some time.  This time is configurable.
  *
+ * Selecting slaves
+ * ----------------
+ *
+ *   Each node keeps a moving average of the round trip time of commands sent to it, with
+ *   penalties added for redirects and connection failures.  Read only commands go to whichever
+ *   of two randomly chosen slaves for the key slot has the lower average, and
+ *   #fr_redis_cluster_node_addr_by_role returns addresses ordered by it.
+ *
  */
 #include "redis.h"
 #include "cluster.h"
 #include "crc16.h"
 #include <freeradius-devel/rad_assert.h>
 
+#include <sched.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 #define KEY_SLOTS		16384			//!< Maximum number of keyslots (should not change).
 
 #define MAX_SLAVES		5			//!< Maximum number of slaves associated
 							//!< with a keyslot.
 
+/*
+ *	Node latency scoring, used to select slaves
+ */
+#define LATENCY_WEIGHT		3			//!< Each sample contributes 1/(2^n) to a node's
+							//!< latency average.
+
+#define REDIRECT_PENALTY	5000			//!< Microseconds added to the latency sample for
+							//!< a command which was redirected.
+
+#define FAILURE_PENALTY		100000			//!< Microseconds added to the latency sample for
+							//!< a command whose connection failed.
+
 /*
  *	Periods and weights for live node selection
  */
@@ -220,6 +260,11 @@ typedef struct fr_redis_cluster_node {
 	bool			is_master;		//!< Whether this node is a master.
 							//!< This is needed for commands like 'KEYS', which
 							//!< we need to issue to every master in the cluster.
+
+	atomic_uint_fast64_t	latency;		//!< Moving average of command round trip times
+							//!< (in microseconds), including penalties.
+	atomic_uint_fast64_t	redirects;		//!< -MOVED and -ASK redirects received from this node.
+	atomic_uint_fast64_t	failures;		//!< Commands which failed due to connection errors.
 } cluster_node_t;
 
 /** Indexes in the cluster_node_t array for a single key slot
@@ -234,6 +279,19 @@ typedef struct cluster_key_slot {
 	uint8_t			master;			//!< R/W node (master) for this key slot.
 } cluster_key_slot_t;
 
+/** An immutable mapping of key slots to nodes
+ *
+ * A new map is built on each remap, and swapped in atomically, so workers
+ * resolving keys never need to take the cluster mutex.
+ */
+typedef struct cluster_slot_map {
+	uint64_t		version;		//!< Incremented each time a new map is applied.
+	uint32_t		num_nodes;		//!< Number of nodes in use when the map was applied.
+	cluster_key_slot_t	key_slot[KEY_SLOTS];	//!< Lookup table of slots to pools.
+} cluster_slot_map_t;
+
+typedef _Atomic(cluster_slot_map_t *) cluster_slot_map_ptr_t;
+
 /** A redis cluster
  *
  * Holds all the structures and collections of nodes, to represent a Redis cluster.
@@ -245,7 +303,7 @@ struct fr_redis_cluster {
 	bool			triggers_enabled;	//!< Whether triggers are enabled.
 
 	bool			remapping;		//!< True when cluster is being remapped.
-	bool			remap_needed;		//!< Set true if at least one cluster node is definitely
+	atomic_bool		remap_needed;		//!< Set true if at least one cluster node is definitely
 							//!< unreachable. Set false on successful remap.
 	time_t			last_updated;		//!< Last time the cluster mappings were updated.
 	CONF_SECTION		*module;		//!< Module configuration.
@@ -259,10 +317,16 @@ struct fr_redis_cluster {
 	fr_fifo_t		*free_nodes;		//!< Queue of free nodes (or nodes waiting to be reused).
 	rbtree_t		*used_nodes;		//!< Tree of used nodes.
 
-	cluster_key_slot_t	key_slot[KEY_SLOTS];		//!< Lookup table of slots to pools.
-	cluster_key_slot_t	key_slot_pending[KEY_SLOTS];	//!< Pending key slot table.
+	cluster_slot_map_ptr_t	map;			//!< Current key slot map.  Read without locking.
+	atomic_uint		map_epoch;		//!< Low bit selects the reader counter to use.
+	atomic_uint_fast32_t	map_readers[2];		//!< Threads currently reading a key slot map.
 
 	pthread_mutex_t		mutex;			//!< Mutex to synchronise cluster operations.
+
+	pthread_t		remap_thread;		//!< Remaps the cluster for callers which can't block.
+	pthread_cond_t		remap_cond;		//!< Signalled to wake the remap thread.
+	bool			remap_thread_running;	//!< The remap thread has been started.
+	bool			remap_thread_exit;	//!< The remap thread should exit.
 };
 
 
@@ -478,6 +542,138 @@ static cluster_rcode_t cluster_node_conf_from_redirect(uint16_t *key_slot, fr_so
 	return CLUSTER_OP_SUCCESS;
 }
 
+/** Start reading the current key slot map
+ *
+ * @param[in] cluster	to read the map of.
+ * @param[out] epoch	to pass to #cluster_map_read_end.
+ * @return the current map.  Valid until #cluster_map_read_end is called.
+ */
+static inline cluster_slot_map_t *cluster_map_read_start(fr_redis_cluster_t *cluster, unsigned int *epoch)
+{
+	/*
+	 *	The counter must be incremented before the map
+	 *	pointer is loaded, so these are sequentially
+	 *	consistent, as are the stores in cluster_map_publish().
+	 */
+	*epoch = atomic_load(&cluster->map_epoch) & 0x01;
+	atomic_fetch_add(&cluster->map_readers[*epoch], 1);
+
+	return atomic_load(&cluster->map);
+}
+
+/** Finish reading a key slot map
+ *
+ * @param[in] cluster	the map was read from.
+ * @param[in] epoch	from #cluster_map_read_start.
+ */
+static inline void cluster_map_read_end(fr_redis_cluster_t *cluster, unsigned int epoch)
+{
+	atomic_fetch_sub_explicit(&cluster->map_readers[epoch], 1, memory_order_release);
+}
+
+/** Make a new key slot map visible to readers, and free the previous one
+ *
+ * Once the new map has been stored, readers which start afterwards can only
+ * see the new map.  Readers which may still hold the previous map incremented
+ * the counter for the current epoch before loading it.  The epoch is flipped,
+ * so new readers use the other counter, and we wait for the counter of the
+ * old epoch to drain.
+ *
+ * A reader which loaded the old epoch, but incremented its counter after we
+ * saw it reach zero, loads the map pointer after the new map was stored, so
+ * it can't see the previous map either.
+ *
+ * @note Must be called with the cluster mutex held.
+ *
+ * @param[in] cluster	to apply the map to.
+ * @param[in] map	to apply.  Ownership passes to the cluster.
+ */
+static void cluster_map_publish(fr_redis_cluster_t *cluster, cluster_slot_map_t *map)
+{
+	cluster_slot_map_t	*old;
+	unsigned int		epoch;
+
+	old = atomic_load_explicit(&cluster->map, memory_order_relaxed);
+	map->version = old ? old->version + 1 : 1;
+
+	atomic_store(&cluster->map, map);
+	if (!old) return;
+
+	epoch = atomic_fetch_add(&cluster->map_epoch, 1) & 0x01;
+	while (atomic_load(&cluster->map_readers[epoch]) != 0) sched_yield();
+
+	talloc_free(old);
+}
+
+/** Record the outcome of a command sent to a node
+ *
+ * Updates the node's latency average, which is used to prefer faster slaves
+ * for read only commands.  Redirects and failures are added as penalties, so
+ * nodes which are misbehaving are avoided until they recover.
+ *
+ * @param[in] node	the command was sent to.
+ * @param[in] sent	When the command was sent.
+ * @param[in] status	of the command.
+ */
+static void cluster_node_stats_update(cluster_node_t *node, struct timeval const *sent, fr_redis_rcode_t status)
+{
+	struct timeval		now, elapsed;
+	uint_fast64_t		sample, old, new;
+
+	gettimeofday(&now, NULL);
+	fr_timeval_subtract(&elapsed, &now, sent);
+	sample = ((uint_fast64_t)elapsed.tv_sec * 1000000) + elapsed.tv_usec;
+
+	switch (status) {
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		atomic_fetch_add_explicit(&node->redirects, 1, memory_order_relaxed);
+		sample += REDIRECT_PENALTY;
+		break;
+
+	case REDIS_RCODE_RECONNECT:
+		atomic_fetch_add_explicit(&node->failures, 1, memory_order_relaxed);
+		sample += FAILURE_PENALTY;
+		break;
+
+	default:
+		break;
+	}
+
+	old = atomic_load_explicit(&node->latency, memory_order_relaxed);
+	do {
+		new = old ? (old - (old >> LATENCY_WEIGHT) + (sample >> LATENCY_WEIGHT)) : sample;
+	} while (!atomic_compare_exchange_weak_explicit(&node->latency, &old, new,
+							memory_order_relaxed, memory_order_relaxed));
+}
+
+/** Pick the slave to try first for a read only command
+ *
+ * Uses "power of two choices", picking two slaves at random and selecting the
+ * one with the lowest latency average.  This avoids every worker piling onto
+ * whichever slave is currently fastest.
+ *
+ * @param[in] cluster	the key slot belongs to.
+ * @param[in] key_slot	to pick a slave from.  Must have at least one slave.
+ * @return the index of the slave in the key slot.
+ */
+static uint8_t cluster_slave_select(fr_redis_cluster_t *cluster, cluster_key_slot_t const *key_slot)
+{
+	uint8_t		a, b;
+
+	rad_assert(key_slot->slave_num > 0);
+
+	a = fr_rand() % key_slot->slave_num;
+	if (key_slot->slave_num == 1) return a;
+
+	b = (a + 1 + (fr_rand() % (key_slot->slave_num - 1))) % key_slot->slave_num;
+
+	if (atomic_load_explicit(&cluster->node[key_slot->slave[b]].latency, memory_order_relaxed) <
+	    atomic_load_explicit(&cluster->node[key_slot->slave[a]].latency, memory_order_relaxed)) return b;
+
+	return a;
+}
+
 /** Apply a cluster map received from a cluster node
  *
  * @note Errors may be retrieved with fr_strerror().
@@ -522,6 +718,7 @@ static cluster_rcode_t cluster_map_apply(fr_redis_cluster_t *cluster, redisReply
 	uint8_t		r = 0;
 
 	cluster_rcode_t	rcode;
+	cluster_slot_map_t *pending;
 
 	uint8_t		rollback[UINT8_MAX];		// Set of nodes to re-add to the queue on failure.
 	bool		active[UINT8_MAX];		// Set of nodes active in the new cluster map.
@@ -568,9 +765,15 @@ do { \
 	cluster->remapping = true;
 
 	/*
-	 *	Must be cleared with the mutex held
+	 *	Not allocated in the cluster ctx, as other
+	 *	threads may be reading the current map.
 	 */
-	memset(&cluster->key_slot_pending, 0, sizeof(cluster->key_slot_pending));
+	pending = talloc_zero(NULL, cluster_slot_map_t);
+	if (!pending) {
+		fr_strerror_printf("Out of memory");
+		cluster->remapping = false;
+		return CLUSTER_OP_FAILED;
+	}
 
 	/*
 	 *	Insert new nodes and markup the keyslot indexes
@@ -613,6 +816,7 @@ do { \
 			fr_strerror_printf("Reached maximum connected nodes");
 			rcode = CLUSTER_OP_FAILED;
 		error:
+			talloc_free(pending);
 			cluster->remapping = false;
 			cluster->last_updated = time(NULL);
 			/* Re-insert new nodes back into the free_nodes queue */
@@ -674,8 +878,7 @@ do { \
 		 *	specified by the range for this map.
 		 */
 		for (k = map->element[0]->integer; k <= map->element[1]->integer; k++) {
-			memcpy(&cluster->key_slot_pending[k], &tmpl_slot,
-			       sizeof(*(cluster->key_slot_pending)));
+			memcpy(&pending->key_slot[k], &tmpl_slot, sizeof(pending->key_slot[k]));
 		}
 	}
 
@@ -691,24 +894,13 @@ do { \
 	 *	error out.
 	 */
 	for (i = 0; i < KEY_SLOTS; i++) {
-		if (cluster->key_slot_pending[i].master == 0) {
+		if (pending->key_slot[i].master == 0) {
 			fr_strerror_printf("Cluster is misconfigured, no node assigned for key %zu", i);
 			rcode = CLUSTER_OP_BAD_INPUT;
 			goto error;
 		}
 	}
 
-	/*
-	 *	We have connections/pools for all the nodes in
-	 *	the new map, apply it to the live cluster.
-	 *
-	 *	Other workers may be using the key slot table,
-	 *	but that's ok. Nodes and pools are never freed,
-	 *	so the worst that will happen, is they'll hit
-	 *	the wrong node for the key, and get redirected.
-	 */
-	memcpy(&cluster->key_slot, &cluster->key_slot_pending, sizeof(cluster->key_slot));
-
 	/*
 	 *	Anything not in the active set of nodes gets
 	 *	added back into the queue, to be re-used.
@@ -740,6 +932,18 @@ do { \
 		}
 	}
 
+	/*
+	 *	We have connections/pools for all the nodes in
+	 *	the new map, apply it to the live cluster.
+	 *
+	 *	Other workers may still be using the old map,
+	 *	but that's ok. Nodes and pools are never freed,
+	 *	so the worst that will happen, is they'll hit
+	 *	the wrong node for the key, and get redirected.
+	 */
+	pending->num_nodes = rbtree_num_elements(cluster->used_nodes);
+	cluster_map_publish(cluster, pending);
+
 	cluster->remapping = false;
 	cluster->last_updated = time(NULL);
 
@@ -1012,7 +1216,7 @@ static cluster_rcode_t cluster_remap(REQUEST *request, fr_redis_cluster_t *clust
 		return ret;
 
 	case CLUSTER_OP_IGNORED:		/* Clustering not enabled, or not supported */
-		cluster->remap_needed = false;
+		atomic_store_explicit(&cluster->remap_needed, false, memory_order_relaxed);
 		return CLUSTER_OP_IGNORED;
 
 	case CLUSTER_OP_SUCCESS:		/* Success */
@@ -1060,7 +1264,7 @@ static cluster_rcode_t cluster_remap(REQUEST *request, fr_redis_cluster_t *clust
 		goto too_soon;
 	}
 	ret = cluster_map_apply(cluster, map);
-	if (ret == CLUSTER_OP_SUCCESS) cluster->remap_needed = false;	/* Change on successful remap */
+	if (ret == CLUSTER_OP_SUCCESS) atomic_store_explicit(&cluster->remap_needed, false, memory_order_relaxed);	/* Change on successful remap */
 	pthread_mutex_unlock(&cluster->mutex);
 
 	fr_redis_reply_free(map);	/* Free the map */
@@ -1550,43 +1754,64 @@ void *fr_redis_cluster_conn_create(TALLOC_CTX *ctx, void *instance, struct timev
  * If there's only a single node in the cluster, then we avoid the CRC16
  * and just use key slot 0.
  *
- * @param cluster to determine key slot for.
- * @param request The current request.
- * @param key the key to resolve.
- * @param key_len the length of the key.
- * @return pointer to key slot key resolves to.
+ * The key slot is copied out of the current map, so the caller doesn't need
+ * to hold the cluster mutex, and remaps can't alter it while it's being used.
+ *
+ * @param[out] out	Where to copy the key slot.
+ * @param cluster	to determine key slot for.
+ * @param request	The current request.
+ * @param key		the key to resolve.
+ * @param key_len	the length of the key.
+ * @return index of the key slot the key resolves to.
  */
-static cluster_key_slot_t *cluster_slot_by_key(fr_redis_cluster_t *cluster, REQUEST *request,
-					       uint8_t const *key, size_t key_len)
+static uint16_t cluster_slot_by_key(cluster_key_slot_t *out, fr_redis_cluster_t *cluster, REQUEST *request,
+				    uint8_t const *key, size_t key_len)
 {
-	cluster_key_slot_t *key_slot;
+	cluster_slot_map_t	*map;
+	unsigned int		epoch;
+	uint16_t		slot;
+	bool			hashed = false;
 
-	if (!key || (key_len == 0)) {
-		key_slot = &cluster->key_slot[(uint16_t)(fr_rand() & (KEY_SLOTS - 1))];
-		RDEBUG2("Key rand() -> slot %zu", key_slot - cluster->key_slot);
+	if (!key || (key_len == 0)) slot = (uint16_t)(fr_rand() & (KEY_SLOTS - 1));
 
-		return key_slot;
-	}
+	/*
+	 *	Nothing which can block, or log, whilst the
+	 *	map is held.  Remaps wait for us to finish.
+	 */
+	map = cluster_map_read_start(cluster, &epoch);
 
 	/*
 	 *	Avoid CRC16 if we're operating with one cluster node or
 	 *	without clustering.
 	 */
-	if (rbtree_num_elements(cluster->used_nodes) > 1) {
-		key_slot = &cluster->key_slot[cluster_key_hash(key, key_len)];
+	if (key && (key_len > 0)) {
+		if (map->num_nodes > 1) {
+			slot = cluster_key_hash(key, key_len);
+			hashed = true;
+		} else {
+			slot = 0;
+		}
+	}
+	*out = map->key_slot[slot];
+	cluster_map_read_end(cluster, epoch);
+
+	if (!key || (key_len == 0)) {
+		RDEBUG2("Key rand() -> slot %u", slot);
+
+	} else if (hashed) {
 		if (RDEBUG_ENABLED2) {
 			char *p;
 
 			p = fr_asprint(request, (char const *)key, key_len, '"');
-			RDEBUG2("Key \"%s\" -> slot %zu", p, key_slot - cluster->key_slot);
+			RDEBUG2("Key \"%s\" -> slot %u", p, slot);
 			talloc_free(p);
 		}
 
-		return key_slot;
+	} else {
+		RDEBUG3("Single node available, skipping key selection");
 	}
-	RDEBUG3("Single node available, skipping key selection");
 
-	return &cluster->key_slot[0];
+	return slot;
 }
 
 /** Resolve a key to a pool, and reserve a connection in that pool
@@ -1637,7 +1862,8 @@ fr_redis_rcode_t fr_redis_cluster_state_init(fr_redis_cluster_state_t *state, fr
 					     uint8_t const *key, size_t key_len, bool read_only)
 {
 	cluster_node_t		*node;
-	cluster_key_slot_t	*key_slot;
+	cluster_key_slot_t	key_slot;
+	uint16_t		slot;
 	uint8_t			first, i;
 	int			used_nodes;
 
@@ -1654,24 +1880,25 @@ fr_redis_rcode_t fr_redis_cluster_state_init(fr_redis_cluster_state_t *state, fr
 	}
 
 again:
-	key_slot = cluster_slot_by_key(cluster, request, key, key_len);
+	slot = cluster_slot_by_key(&key_slot, cluster, request, key, key_len);
 
 	/*
-	 *	1. Try each of the slaves for the key slot
+	 *	1. Try each of the slaves for the key slot, starting
+	 *	   with one that's been responding quickly.
 	 *	2. Fall through to trying the master, and a single alternate node.
 	 */
-	if (read_only) {
-		first = fr_rand() & key_slot->slave_num;
-		for (i = 0; i < key_slot->slave_num; i++) {
+	if (read_only && (key_slot.slave_num > 0)) {
+		first = cluster_slave_select(cluster, &key_slot);
+		for (i = 0; i < key_slot.slave_num; i++) {
 			uint8_t node_id;
 
-			node_id = key_slot->slave[(first + i) % key_slot->slave_num];
+			node_id = key_slot.slave[(first + i) % key_slot.slave_num];
 			node = &cluster->node[node_id];
 			*conn = fr_connection_get(node->pool, request);
 			if (!*conn) {
-				RDEBUG2("[%i] No connections available (key slot %zu slave %i)",
-					node->id, key_slot - cluster->key_slot, (first + i) % key_slot->slave_num);
-				cluster->remap_needed = true;
+				RDEBUG2("[%i] No connections available (key slot %u slave %i)",
+					node->id, slot, (first + i) % key_slot.slave_num);
+				atomic_store_explicit(&cluster->remap_needed, true, memory_order_relaxed);
 				continue;	/* Continue until we find a live pool */
 			}
 
@@ -1686,12 +1913,12 @@ again:
 	 *	3. If there are no pools, or we can't reserve a handle,
 	 *	   give up.
 	 */
-	node = &cluster->node[key_slot->master];
+	node = &cluster->node[key_slot.master];
 	*conn = fr_connection_get(node->pool, request);
 	if (!*conn) {
-		RDEBUG2("[%i] No connections available (key slot %zu master)",
-			node->id, key_slot - cluster->key_slot);
-		cluster->remap_needed = true;
+		RDEBUG2("[%i] No connections available (key slot %u master)",
+			node->id, slot);
+		atomic_store_explicit(&cluster->remap_needed, true, memory_order_relaxed);
 
 		if (cluster_node_find_live(&node, conn, request, cluster, node) < 0) return REDIS_RCODE_RECONNECT;
 	}
@@ -1700,7 +1927,7 @@ finish:
 	/*
 	 *	Something set the remap_needed flag, and we have a live connection
 	 */
-	if (cluster->remap_needed) {
+	if (atomic_load_explicit(&cluster->remap_needed, memory_order_relaxed)) {
 		if (cluster_remap(request, cluster, *conn) == CLUSTER_OP_SUCCESS) {
 			fr_connection_release(node->pool, request, *conn);
 			goto again;	/* New map, try again */
@@ -1711,6 +1938,7 @@ finish:
 	state->node = node;
 	state->key = key;
 	state->key_len = key_len;
+	gettimeofday(&state->sent, NULL);
 
 	RDEBUG2("[%i] >>> Sending command(s) to %s:%i", state->node->id, state->node->name, state->node->addr.port);
 
@@ -1763,6 +1991,8 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 
  	RDEBUG2("[%i] <<< Returned: %s", state->node->id, fr_int2str(redis_rcodes, status, "<UNKNOWN>"));
 
+	cluster_node_stats_update(state->node, &state->sent, status);
+
 	/*
 	 *	Caller indicated we should close the connection
 	 */
@@ -1778,7 +2008,7 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 	 *	has set the remap_needed flag, do that now before
 	 *	releasing the connection.
 	 */
-	if (cluster->remap_needed && *conn) switch(status) {
+	if (atomic_load_explicit(&cluster->remap_needed, memory_order_relaxed) && *conn) switch(status) {
 	case REDIS_RCODE_MOVE:		/* We're going to remap anyway */
 	case REDIS_RCODE_RECONNECT:	/* The connection's dead */
 		break;
@@ -1839,7 +2069,7 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 	 */
 	case REDIS_RCODE_RECONNECT:
 	{
-		cluster_key_slot_t *key_slot;
+		cluster_key_slot_t key_slot;
 
 		RERROR("[%i] Failed communicating with %s:%i: %s", state->node->id, state->node->name,
 		       state->node->addr.port, fr_strerror());
@@ -1848,21 +2078,21 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 
 		if (state->reconnects++ > state->in_pool) {
 			REDEBUG("[%i] Hit maximum reconnect attempts", state->node->id);
-			cluster->remap_needed = true;
+			atomic_store_explicit(&cluster->remap_needed, true, memory_order_relaxed);
 			return REDIS_RCODE_RECONNECT;
 		}
 
 		/*
 		 *	Refresh the key slot
 		 */
-		key_slot = cluster_slot_by_key(cluster, request, state->key, state->key_len);
-		state->node = &cluster->node[key_slot->master];
+		cluster_slot_by_key(&key_slot, cluster, request, state->key, state->key_len);
+		state->node = &cluster->node[key_slot.master];
 
 		*conn = fr_connection_get(state->node->pool, request);
 		if (!*conn) {
 			REDEBUG("[%i] No connections available for %s:%i", state->node->id, state->node->name,
 				state->node->addr.port);
-			cluster->remap_needed = true;
+			atomic_store_explicit(&cluster->remap_needed, true, memory_order_relaxed);
 			return REDIS_RCODE_RECONNECT;
 		}
 
@@ -1924,7 +2154,7 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 			goto try_again;
 
 		case CLUSTER_OP_NO_CONNECTION:
-			cluster->remap_needed = true;
+			atomic_store_explicit(&cluster->remap_needed, true, memory_order_relaxed);
 			return REDIS_RCODE_RECONNECT;
 
 		default:
@@ -1938,10 +2168,164 @@ try_again:
 
 	fr_redis_reply_free(*reply);
 	*reply = NULL;
+	gettimeofday(&state->sent, NULL);
 
 	return REDIS_RCODE_TRY_AGAIN;
 }
 
+/** Remap the cluster in the background
+ *
+ * Wakes up when signalled, or once a second, and remaps the cluster if the
+ * remap_needed flag is set.  If the remap fails, or is skipped because one
+ * occurred recently, it's retried on the next wake up.
+ *
+ * @param[in] arg	the cluster to remap.
+ * @return NULL.
+ */
+static void *cluster_remap_thread(void *arg)
+{
+	fr_redis_cluster_t	*cluster = arg;
+
+	pthread_mutex_lock(&cluster->mutex);
+	while (!cluster->remap_thread_exit) {
+		REQUEST			*request;
+		cluster_key_slot_t	key_slot;
+		cluster_node_t		*node;
+		fr_redis_conn_t		*conn;
+		struct timespec		wake;
+
+		if (!atomic_load_explicit(&cluster->remap_needed, memory_order_relaxed)) {
+			clock_gettime(CLOCK_REALTIME, &wake);
+			wake.tv_sec++;
+			pthread_cond_timedwait(&cluster->remap_cond, &cluster->mutex, &wake);
+			continue;
+		}
+		pthread_mutex_unlock(&cluster->mutex);
+
+		/*
+		 *	Any node will do, they should all have
+		 *	the same view of the cluster.
+		 */
+		request = request_alloc(NULL);
+		cluster_slot_by_key(&key_slot, cluster, request, NULL, 0);
+		node = &cluster->node[key_slot.master];
+		conn = node->pool ? fr_connection_get(node->pool, request) : NULL;
+		if (conn) {
+			if (cluster_remap(request, cluster, conn) == CLUSTER_OP_FAILED) {
+				RERROR("%s", fr_strerror());
+			}
+			fr_connection_release(node->pool, request, conn);
+		}
+		talloc_free(request);
+
+		pthread_mutex_lock(&cluster->mutex);
+		if (cluster->remap_thread_exit ||
+		    !atomic_load_explicit(&cluster->remap_needed, memory_order_relaxed)) continue;
+
+		/*
+		 *	Don't spin if the remap was skipped, or
+		 *	we couldn't get a connection.
+		 */
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_sec++;
+		pthread_cond_timedwait(&cluster->remap_cond, &cluster->mutex, &wake);
+	}
+	pthread_mutex_unlock(&cluster->mutex);
+
+	return NULL;
+}
+
+/** Ask the remap thread to remap the cluster
+ *
+ * Never blocks.  If the mutex is held, either a remap is in progress, or the
+ * remap thread will see the remap_needed flag within a second anyway.
+ *
+ * @param[in] cluster	to remap.
+ */
+static void cluster_remap_schedule(fr_redis_cluster_t *cluster)
+{
+	if (pthread_mutex_trylock(&cluster->mutex) != 0) return;
+
+	if (!cluster->remap_thread_running) {
+		if (pthread_create(&cluster->remap_thread, NULL, cluster_remap_thread, cluster) != 0) {
+			pthread_mutex_unlock(&cluster->mutex);
+			return;
+		}
+		cluster->remap_thread_running = true;
+	}
+	pthread_cond_signal(&cluster->remap_cond);
+	pthread_mutex_unlock(&cluster->mutex);
+}
+
+/** Resolve a key to the address of the node which should service it
+ *
+ * Used by callers which maintain their own connections to cluster nodes (such
+ * as the asynchronous pipeline), instead of reserving connections from the
+ * node pools.
+ *
+ * If a remap is needed the remap thread is woken, and the key is resolved
+ * with the current map.  This function never blocks, commands sent to the
+ * wrong node are redirected until the new map is published.
+ *
+ * @param[out] out		Address of the node.
+ * @param[in] cluster		to resolve key in.
+ * @param[in] request		The current request.
+ * @param[in] key		to resolve.  If NULL or key_len is 0, a random slot is chosen.
+ * @param[in] key_len		Length of the key.
+ * @param[in] read_only		If true, will pick a random slave in preference to the master.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there are no nodes in the cluster.
+ */
+int fr_redis_cluster_addr_by_key(fr_socket_addr_t *out, fr_redis_cluster_t *cluster, REQUEST *request,
+				 uint8_t const *key, size_t key_len, bool read_only)
+{
+	cluster_key_slot_t	key_slot;
+	cluster_node_t		*node;
+
+	if (rbtree_num_elements(cluster->used_nodes) == 0) {
+		fr_strerror_printf("No nodes in cluster");
+		return -1;
+	}
+
+	cluster_slot_by_key(&key_slot, cluster, request, key, key_len);
+	node = &cluster->node[key_slot.master];
+
+	if (atomic_load_explicit(&cluster->remap_needed, memory_order_relaxed)) cluster_remap_schedule(cluster);
+
+	if (read_only && (key_slot.slave_num > 0)) {
+		node = &cluster->node[key_slot.slave[cluster_slave_select(cluster, &key_slot)]];
+	}
+
+	*out = node->addr;
+
+	return 0;
+}
+
+/** Extract the node address from a -MOVED or -ASK redirect
+ *
+ * A -MOVED redirect also flags that the cluster needs remapping.  As with
+ * #fr_redis_cluster_state_next, the data from the redirect isn't used to
+ * alter the cluster map.
+ *
+ * @param[out] out		Address of the node we were redirected to.
+ * @param[in] cluster		the redirect was received from.
+ * @param[in] reply		containing the redirect.
+ * @param[in] status		#REDIS_RCODE_MOVE or #REDIS_RCODE_ASK.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the redirect was invalid.
+ */
+int fr_redis_cluster_addr_by_redirect(fr_socket_addr_t *out, fr_redis_cluster_t *cluster,
+				      redisReply *reply, fr_redis_rcode_t status)
+{
+	if (cluster_node_conf_from_redirect(NULL, out, reply) != CLUSTER_OP_SUCCESS) return -1;
+
+	if (status == REDIS_RCODE_MOVE) atomic_store_explicit(&cluster->remap_needed, true, memory_order_relaxed);
+
+	return 0;
+}
+
 /** Get the pool associated with a node in the cluster
  *
  * @note This is used for testing only.  It's not ifdef'd out because
@@ -2016,6 +2400,7 @@ typedef struct addr_by_role_ctx {
 	bool			is_slave;
 	uint8_t			count;
 	fr_socket_addr_t	*found;
+	uint_fast64_t		latency[UINT8_MAX];	//!< Latency of each node in found.
 } addr_by_role_ctx_t;
 
 /** Walk all used pools, recording the IP addresses of ones matching the filter
@@ -2032,7 +2417,20 @@ static int _cluster_role_walk(void *context, void *data)
 	cluster_node_t		*node = data;
 
 	if ((ctx->is_master && node->is_master) || (ctx->is_slave && !node->is_master)) {
-		ctx->found[ctx->count++] = node->addr;
+		uint8_t		i;
+		uint_fast64_t	latency = atomic_load_explicit(&node->latency, memory_order_relaxed);
+
+		/*
+		 *	Insertion sort, there are at most
+		 *	UINT8_MAX - 1 nodes.
+		 */
+		for (i = ctx->count; (i > 0) && (ctx->latency[i - 1] > latency); i--) {
+			ctx->found[i] = ctx->found[i - 1];
+			ctx->latency[i] = ctx->latency[i - 1];
+		}
+		ctx->found[i] = node->addr;
+		ctx->latency[i] = latency;
+		ctx->count++;
 	}
 	return 0;
 }
@@ -2041,6 +2439,8 @@ static int _cluster_role_walk(void *context, void *data)
  *
  * @note We return IP addresses as they're safe to use across cluster remaps.
  * @note Result array must be freed (talloc_free()) after use.
+ * @note Addresses are ordered by node latency, fastest first, so callers wanting
+ *	a single replica should use the first.
  *
  * @param[in] ctx to allocate array of IP addresses in.
  * @param[out] out		Where to write the addresses of the nodes.
@@ -2085,15 +2485,24 @@ ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_addr_t *ou
 	return context.count;
 }
 
-/** Destroy mutex associated with cluster slots structure
+/** Stop the remap thread, and destroy mutex associated with cluster slots structure
  *
  * @param cluster being freed.
  * @return 0
  */
 static int _fr_redis_cluster_free(fr_redis_cluster_t *cluster)
 {
+	pthread_mutex_lock(&cluster->mutex);
+	cluster->remap_thread_exit = true;
+	pthread_cond_signal(&cluster->remap_cond);
+	pthread_mutex_unlock(&cluster->mutex);
+	if (cluster->remap_thread_running) pthread_join(cluster->remap_thread, NULL);
+
+	pthread_cond_destroy(&cluster->remap_cond);
 	pthread_mutex_destroy(&cluster->mutex);
 
+	talloc_free(atomic_load_explicit(&cluster->map, memory_order_relaxed));
+
 	return 0;
 }
 
@@ -2296,8 +2705,20 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 	cluster->conf = conf;
 
 	pthread_mutex_init(&cluster->mutex, NULL);
+	pthread_cond_init(&cluster->remap_cond, NULL);
 	talloc_set_destructor(cluster, _fr_redis_cluster_free);
 
+	/*
+	 *	Readers expect there to always be a map.
+	 */
+	{
+		cluster_slot_map_t *map;
+
+		map = talloc_zero(NULL, cluster_slot_map_t);
+		if (!map) goto oom;
+		cluster_map_publish(cluster, map);
+	}
+
 	/*
 	 *	Node id 0 is reserved, so we can detect misconfigured
 	 *	clusters.
@@ -2451,7 +2872,16 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 	 *	hopefully we'll get one when we start processing
 	 *	requests.
 	 */
-	for (s = 0; s < KEY_SLOTS; s++) cluster->key_slot[s].master = (s % (uint16_t) num_nodes) + 1;
+	{
+		cluster_slot_map_t *map;
+
+		map = talloc_zero(NULL, cluster_slot_map_t);
+		if (!map) goto oom;
+
+		map->num_nodes = num_nodes;
+		for (s = 0; s < KEY_SLOTS; s++) map->key_slot[s].master = (s % (uint16_t) num_nodes) + 1;
+		cluster_map_publish(cluster, map);
+	}
 
 	return cluster;
 }
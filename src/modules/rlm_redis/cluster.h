@@ -56,6 +56,9 @@ typedef struct fr_redis_cluster_state {
 	uint32_t		retries;	//!< How many times we've received TRYAGAIN
 	uint32_t		in_pool;	//!< How many available connections are there in the pool.
 	uint32_t		reconnects;	//!< How many connections we've tried in this pool.
+
+	struct timeval		sent;		//!< When we last sent command(s) to the node.
+						//!< Used to maintain the node's latency average.
 } fr_redis_cluster_state_t;
 
 /*
@@ -75,6 +78,16 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 					     fr_redis_cluster_t *cluster, REQUEST *request,
 					     fr_redis_rcode_t status, redisReply **reply);
 
+/*
+ *	Resolve keys and redirects to node addresses, for callers
+ *	which manage their own connections.
+ */
+int fr_redis_cluster_addr_by_key(fr_socket_addr_t *out, fr_redis_cluster_t *cluster, REQUEST *request,
+				 uint8_t const *key, size_t key_len, bool read_only);
+
+int fr_redis_cluster_addr_by_redirect(fr_socket_addr_t *out, fr_redis_cluster_t *cluster,
+				      redisReply *reply, fr_redis_rcode_t status);
+
 /*
  *	Useful for running commands over every node, such as PING
  *	or KEYS.
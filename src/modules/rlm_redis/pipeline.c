@@ -0,0 +1,713 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file pipeline.c
+ * @brief Asynchronous, pipelined command execution against a Redis cluster.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ *
+ * Overview
+ * ========
+ *
+ * The synchronous cluster API (#fr_redis_cluster_state_init and
+ * #fr_redis_cluster_state_next) reserves a connection per command, and blocks the
+ * worker until the reply is received.  Throughput is then bounded by the round trip
+ * time to the Redis node, multiplied by the number of connections.
+ *
+ * A pipeline is allocated per worker thread, and holds a single asynchronous
+ * (hiredis async) connection to each cluster node that thread has sent commands to.
+ * The connection's file descriptor is serviced by the worker's event loop.
+ *
+ * Commands enqueued by different requests, destined for the same node, are appended
+ * to that node's output buffer.  The buffer is only flushed when the event loop
+ * indicates the socket is writable, so all commands enqueued during one pass of the
+ * event loop are sent with a single write.  Redis processes commands on a connection
+ * in order, so hiredis can demultiplex the replies back to the commands which
+ * generated them.
+ *
+ * '-MOVED' and '-ASK' redirects are followed as with the synchronous API, up to
+ * max_redirects.  '-MOVED' flags the cluster as needing a remap, and '-ASK' sends
+ * 'ASKING' to the new node before re-issuing the command.  '-TRYAGAIN' re-issues the
+ * command after retry_delay, using a timer instead of sleeping.
+ */
+#include "redis.h"
+#include "cluster.h"
+#include "pipeline.h"
+#include <hiredis/async.h>
+#include <freeradius-devel/rad_assert.h>
+
+/** A set of asynchronous connections, one per cluster node
+ *
+ * Must only be used by the thread which allocated it.
+ */
+struct fr_redis_pipeline {
+	fr_event_list_t		*el;			//!< Event list servicing the connections.
+	fr_redis_cluster_t	*cluster;		//!< Cluster to resolve keys and redirects with.
+	fr_redis_conf_t const	*conf;			//!< Password, database, redirect and retry limits.
+	char const		*log_prefix;		//!< What to prepend to log messages.
+
+	rbtree_t		*conns;			//!< Live connections, keyed by node address.
+	bool			freeing;		//!< Pipeline is being freed, don't call callbacks.
+};
+
+/** An asynchronous connection to a single cluster node
+ */
+typedef struct fr_redis_pipeline_conn {
+	fr_socket_addr_t	addr;			//!< Address of the node.
+	char			name[FR_IPADDR_STRLEN];	//!< Buffer to hold IP string.
+
+	fr_redis_pipeline_t	*pipeline;		//!< Pipeline this connection belongs to.
+	redisAsyncContext	*ac;			//!< Hiredis async context.
+
+	bool			in_tree;		//!< Whether the connection is in the pipeline's tree.
+	bool			read;			//!< Hiredis wants to be told when the fd is readable.
+	bool			write;			//!< Hiredis wants to be told when the fd is writable.
+	bool			registered;		//!< Whether the fd is in the event list.
+
+	uint32_t		outstanding;		//!< Commands sent, or queued, awaiting replies.
+} fr_redis_pipeline_conn_t;
+
+/** A command enqueued by a request
+ */
+struct fr_redis_pipeline_cmd {
+	fr_redis_pipeline_t	*pipeline;		//!< Pipeline the command was enqueued in.
+	REQUEST			*request;		//!< That enqueued the command.  NULL if cancelled.
+
+	fr_redis_pipeline_cb_t	callback;		//!< To call with the final reply.
+	void			*uctx;			//!< To pass to the callback.
+
+	uint8_t const		*key;			//!< Key used to select the node.
+	size_t			key_len;		//!< Length of the key.
+	bool			read_only;		//!< Whether a slave may service the command.
+
+	int			argc;			//!< Number of arguments.
+	char const		**argv;			//!< Copies of the arguments.
+	size_t			*argvlen;		//!< Length of each argument.
+
+	fr_socket_addr_t	redirect;		//!< Node we were redirected to.
+	bool			redirected;		//!< Use the redirect address instead of the key.
+	bool			asking;			//!< Send ASKING before the command.
+	bool			reconnected;		//!< Already retried after a connection failure.
+
+	uint32_t		redirects;		//!< How many redirects we've followed.
+	uint32_t		retries;		//!< How many times we've received -TRYAGAIN.
+
+	fr_event_timer_t	*ev;			//!< Retry timer.
+};
+
+static int pipeline_cmd_send(fr_redis_pipeline_cmd_t *cmd);
+
+static int _pipeline_conn_cmp(void const *a, void const *b)
+{
+	int ret;
+
+	fr_redis_pipeline_conn_t const *my_a = a;
+	fr_redis_pipeline_conn_t const *my_b = b;
+
+	ret = fr_ipaddr_cmp(&my_a->addr.ipaddr, &my_b->addr.ipaddr);
+	if (ret != 0) return ret;
+
+	if (my_a->addr.port < my_b->addr.port) return -1;
+	if (my_a->addr.port > my_b->addr.port) return +1;
+
+	return 0;
+}
+
+/** Remove a connection from the set of live connections
+ *
+ * The connection structure itself is freed when hiredis calls the cleanup
+ * callback, as hiredis may still reference it until then.
+ */
+static void pipeline_conn_unlink(fr_redis_pipeline_conn_t *conn)
+{
+	if (!conn->in_tree) return;
+
+	rbtree_deletebydata(conn->pipeline->conns, conn);
+	conn->in_tree = false;
+}
+
+/*
+ *	Event loop -> hiredis
+ */
+static void _pipeline_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	fr_redis_pipeline_conn_t *conn = talloc_get_type_abort(ctx, fr_redis_pipeline_conn_t);
+
+	if (conn->ac) redisAsyncHandleRead(conn->ac);	/* May free conn */
+}
+
+static void _pipeline_conn_writable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	fr_redis_pipeline_conn_t *conn = talloc_get_type_abort(ctx, fr_redis_pipeline_conn_t);
+
+	if (conn->ac) redisAsyncHandleWrite(conn->ac);	/* May free conn */
+}
+
+static void _pipeline_conn_errored(UNUSED fr_event_list_t *el, int fd, void *ctx)
+{
+	fr_redis_pipeline_conn_t *conn = talloc_get_type_abort(ctx, fr_redis_pipeline_conn_t);
+
+	DEBUG4("%s - [%s:%i] fd %i errored", conn->pipeline->log_prefix, conn->name, conn->addr.port, fd);
+
+	/*
+	 *	Let hiredis discover the error, and tear down
+	 *	the connection.
+	 */
+	if (conn->ac) redisAsyncHandleRead(conn->ac);	/* May free conn */
+}
+
+/** Register or deregister the connection's fd with the event loop
+ */
+static void pipeline_conn_events_update(fr_redis_pipeline_conn_t *conn)
+{
+	fr_redis_pipeline_t	*pipeline = conn->pipeline;
+	int			fd = conn->ac->c.fd;
+
+	if (!conn->read && !conn->write) {
+		if (!conn->registered) return;
+
+		if (fr_event_fd_delete(pipeline->el, fd) < 0) {
+			ERROR("%s - [%s:%i] Failed deregistering fd %i: %s", pipeline->log_prefix,
+			      conn->name, conn->addr.port, fd, fr_strerror());
+		}
+		conn->registered = false;
+		return;
+	}
+
+	if (fr_event_fd_insert(pipeline->el, fd,
+			       conn->read ? _pipeline_conn_readable : NULL,
+			       conn->write ? _pipeline_conn_writable : NULL,
+			       _pipeline_conn_errored, conn) < 0) {
+		ERROR("%s - [%s:%i] Failed registering fd %i: %s", pipeline->log_prefix,
+		      conn->name, conn->addr.port, fd, fr_strerror());
+		return;
+	}
+	conn->registered = true;
+}
+
+/*
+ *	hiredis -> Event loop
+ */
+static void _pipeline_conn_add_read(void *ctx)
+{
+	fr_redis_pipeline_conn_t *conn = ctx;
+
+	conn->read = true;
+	pipeline_conn_events_update(conn);
+}
+
+static void _pipeline_conn_del_read(void *ctx)
+{
+	fr_redis_pipeline_conn_t *conn = ctx;
+
+	conn->read = false;
+	pipeline_conn_events_update(conn);
+}
+
+static void _pipeline_conn_add_write(void *ctx)
+{
+	fr_redis_pipeline_conn_t *conn = ctx;
+
+	conn->write = true;
+	pipeline_conn_events_update(conn);
+}
+
+static void _pipeline_conn_del_write(void *ctx)
+{
+	fr_redis_pipeline_conn_t *conn = ctx;
+
+	conn->write = false;
+	pipeline_conn_events_update(conn);
+}
+
+/** Called by hiredis when it's about to free the async context
+ *
+ * This is the last time hiredis references our connection structure.
+ */
+static void _pipeline_conn_cleanup(void *ctx)
+{
+	fr_redis_pipeline_conn_t *conn = ctx;
+
+	conn->read = false;
+	conn->write = false;
+	pipeline_conn_events_update(conn);
+
+	pipeline_conn_unlink(conn);
+	conn->ac = NULL;
+
+	talloc_free(conn);
+}
+
+static void _pipeline_conn_connected(redisAsyncContext const *ac, int status)
+{
+	fr_redis_pipeline_conn_t *conn = ac->data;
+
+	if (status != REDIS_OK) {
+		ERROR("%s - [%s:%i] Connection failed: %s", conn->pipeline->log_prefix,
+		      conn->name, conn->addr.port, ac->errstr);
+		pipeline_conn_unlink(conn);
+		return;
+	}
+
+	DEBUG2("%s - [%s:%i] Connected", conn->pipeline->log_prefix, conn->name, conn->addr.port);
+}
+
+static void _pipeline_conn_disconnected(redisAsyncContext const *ac, int status)
+{
+	fr_redis_pipeline_conn_t *conn = ac->data;
+
+	if (status != REDIS_OK) {
+		ERROR("%s - [%s:%i] Connection lost: %s", conn->pipeline->log_prefix,
+		      conn->name, conn->addr.port, ac->errstr);
+	} else {
+		DEBUG2("%s - [%s:%i] Disconnected", conn->pipeline->log_prefix, conn->name, conn->addr.port);
+	}
+	pipeline_conn_unlink(conn);
+}
+
+/** Log failures of AUTH and SELECT
+ *
+ * Subsequent commands will fail with an appropriate error, so there's no
+ * need to do anything else.
+ */
+static void _pipeline_conn_setup_reply(redisAsyncContext *ac, void *r, void *privdata)
+{
+	fr_redis_pipeline_conn_t	*conn = ac->data;
+	redisReply			*reply = r;
+	char const			*command = privdata;
+
+	if (!reply || (reply->type != REDIS_REPLY_ERROR)) return;
+
+	ERROR("%s - [%s:%i] %s failed: %s", conn->pipeline->log_prefix, conn->name, conn->addr.port,
+	      command, reply->str);
+}
+
+/** Free a connection when the tree of connections is freed
+ */
+static void _pipeline_conn_free(void *data)
+{
+	fr_redis_pipeline_conn_t *conn = talloc_get_type_abort(data, fr_redis_pipeline_conn_t);
+
+	conn->in_tree = false;
+
+	/*
+	 *	Calls the reply callbacks of any pending commands
+	 *	then _pipeline_conn_cleanup, which frees conn.
+	 */
+	if (conn->ac) {
+		redisAsyncFree(conn->ac);
+		return;
+	}
+
+	talloc_free(conn);
+}
+
+/** Find, or establish, a connection to a cluster node
+ *
+ * @param[in] pipeline	to search for the connection in.
+ * @param[in] request	The current request.
+ * @param[in] addr	of the node.
+ * @return
+ *	- A connection on success.
+ *	- NULL on failure.
+ */
+static fr_redis_pipeline_conn_t *pipeline_conn_get(fr_redis_pipeline_t *pipeline, REQUEST *request,
+						   fr_socket_addr_t const *addr)
+{
+	fr_redis_pipeline_conn_t	find, *conn;
+	redisAsyncContext		*ac;
+
+	memset(&find, 0, sizeof(find));
+	find.addr = *addr;
+
+	conn = rbtree_finddata(pipeline->conns, &find);
+	if (conn) return conn;
+
+	MEM(conn = talloc_zero(pipeline, fr_redis_pipeline_conn_t));
+	conn->addr = *addr;
+	conn->pipeline = pipeline;
+	fr_inet_ntop(conn->name, sizeof(conn->name), &addr->ipaddr);
+
+	RDEBUG2("[%s:%i] Connecting", conn->name, conn->addr.port);
+
+	ac = redisAsyncConnect(conn->name, conn->addr.port);
+	if (!ac) {
+		REDEBUG("[%s:%i] Connection failed", conn->name, conn->addr.port);
+		talloc_free(conn);
+		return NULL;
+	}
+	if (ac->err) {
+		REDEBUG("[%s:%i] Connection failed: %s", conn->name, conn->addr.port, ac->errstr);
+		redisAsyncFree(ac);
+		talloc_free(conn);
+		return NULL;
+	}
+
+	conn->ac = ac;
+	ac->data = conn;
+	ac->ev.data = conn;
+	ac->ev.addRead = _pipeline_conn_add_read;
+	ac->ev.delRead = _pipeline_conn_del_read;
+	ac->ev.addWrite = _pipeline_conn_add_write;
+	ac->ev.delWrite = _pipeline_conn_del_write;
+	ac->ev.cleanup = _pipeline_conn_cleanup;
+
+	redisAsyncSetConnectCallback(ac, _pipeline_conn_connected);
+	redisAsyncSetDisconnectCallback(ac, _pipeline_conn_disconnected);
+
+	/*
+	 *	These are queued, and sent as soon as the
+	 *	connection completes.  Their replies will
+	 *	always arrive before the replies to any
+	 *	commands we pipeline after them.
+	 */
+	if (pipeline->conf->password) {
+		redisAsyncCommand(ac, _pipeline_conn_setup_reply, "AUTH", "AUTH %s", pipeline->conf->password);
+	}
+	if (pipeline->conf->database) {
+		redisAsyncCommand(ac, _pipeline_conn_setup_reply, "SELECT", "SELECT %i", pipeline->conf->database);
+	}
+
+	rbtree_insert(pipeline->conns, conn);
+	conn->in_tree = true;
+
+	return conn;
+}
+
+static int _pipeline_cmd_free(fr_redis_pipeline_cmd_t *cmd)
+{
+	if (cmd->ev) fr_event_timer_delete(cmd->pipeline->el, &cmd->ev);
+
+	return 0;
+}
+
+/** Re-issue a command after a -TRYAGAIN
+ */
+static void _pipeline_cmd_retry(UNUSED struct timeval *now, void *ctx)
+{
+	fr_redis_pipeline_cmd_t	*cmd = talloc_get_type_abort(ctx, fr_redis_pipeline_cmd_t);
+	REQUEST			*request = cmd->request;
+
+	if (pipeline_cmd_send(cmd) < 0) {
+		cmd->callback(request, REDIS_RCODE_RECONNECT, NULL, cmd->uctx);
+		talloc_free(cmd);
+	}
+}
+
+/** Process the reply to a pipelined command
+ *
+ * Follows redirects and retries, or passes the reply to the caller's callback.
+ */
+static void _pipeline_cmd_reply(redisAsyncContext *ac, void *r, void *privdata)
+{
+	fr_redis_pipeline_cmd_t		*cmd = talloc_get_type_abort(privdata, fr_redis_pipeline_cmd_t);
+	fr_redis_pipeline_conn_t	*conn = ac->data;
+	fr_redis_pipeline_t		*pipeline = cmd->pipeline;
+	REQUEST				*request = cmd->request;
+	redisReply			*reply = r;
+	fr_redis_rcode_t		status;
+
+	if (conn) conn->outstanding--;
+
+	/*
+	 *	Request was cancelled, or we're shutting down.
+	 */
+	if (!request || pipeline->freeing) {
+		talloc_free(cmd);
+		return;
+	}
+
+	if (!reply) {
+		fr_strerror_printf("Connection error: %s", ac->errstr);
+		status = REDIS_RCODE_RECONNECT;
+
+		/*
+		 *	Don't queue anything else on a connection
+		 *	that's being torn down.
+		 */
+		if (conn) pipeline_conn_unlink(conn);
+	} else {
+		fr_redis_reply_print(L_DBG_LVL_3, reply, request, 0);
+		status = fr_redis_command_status(NULL, reply);
+	}
+
+	RDEBUG2("[%s:%i] <<< Returned: %s", conn ? conn->name : "?", conn ? conn->addr.port : 0,
+		fr_int2str(redis_rcodes, status, "<UNKNOWN>"));
+
+	switch (status) {
+	/*
+	 *	-MOVED and -ASK redirects.
+	 */
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		RDEBUG("Processing redirect \"%s\"", reply->str);
+		if (cmd->redirects++ >= pipeline->conf->max_redirects) {
+			REDEBUG("Reached max_redirects (%i)", cmd->redirects);
+			status = REDIS_RCODE_ERROR;
+			break;
+		}
+
+		if (fr_redis_cluster_addr_by_redirect(&cmd->redirect, pipeline->cluster, reply, status) < 0) {
+			REDEBUG("Invalid redirect: %s", fr_strerror());
+			status = REDIS_RCODE_ERROR;
+			break;
+		}
+		cmd->redirected = true;
+		cmd->asking = (status == REDIS_RCODE_ASK);
+		cmd->retries = 0;
+
+		if (pipeline_cmd_send(cmd) < 0) {
+			status = REDIS_RCODE_RECONNECT;
+			break;
+		}
+		return;
+
+	/*
+	 *	Cluster's unstable, try again later.
+	 */
+	case REDIS_RCODE_TRY_AGAIN:
+		if (cmd->retries++ >= pipeline->conf->max_retries) {
+			REDEBUG("Hit maximum retry attempts");
+			status = REDIS_RCODE_ERROR;
+			break;
+		}
+
+		if (FR_TIMEVAL_TO_MS(&pipeline->conf->retry_delay)) {
+			struct timeval now, when;
+
+			gettimeofday(&now, NULL);
+			fr_timeval_add(&when, &now, &pipeline->conf->retry_delay);
+
+			if (fr_event_timer_insert(pipeline->el, _pipeline_cmd_retry, cmd, &when, &cmd->ev) < 0) {
+				REDEBUG("Failed inserting retry timer: %s", fr_strerror());
+				status = REDIS_RCODE_ERROR;
+				break;
+			}
+			return;
+		}
+
+		if (pipeline_cmd_send(cmd) < 0) {
+			status = REDIS_RCODE_RECONNECT;
+			break;
+		}
+		return;
+
+	/*
+	 *	Connection's dead.  Try once more with a new
+	 *	connection to whichever node now owns the key.
+	 */
+	case REDIS_RCODE_RECONNECT:
+		RERROR("%s", fr_strerror());
+		if (cmd->reconnected) break;
+
+		cmd->reconnected = true;
+		cmd->redirected = false;
+		cmd->asking = false;
+		if (pipeline_cmd_send(cmd) < 0) break;
+		return;
+
+	case REDIS_RCODE_NO_SCRIPT:
+	case REDIS_RCODE_ERROR:
+		REDEBUG("Command failed: %s", fr_strerror());
+		break;
+
+	default:
+		break;
+	}
+
+	cmd->callback(request, status, reply, cmd->uctx);
+	talloc_free(cmd);
+}
+
+/** Append a command to the output buffer of the connection to the correct node
+ */
+static int pipeline_cmd_send(fr_redis_pipeline_cmd_t *cmd)
+{
+	fr_redis_pipeline_t		*pipeline = cmd->pipeline;
+	fr_redis_pipeline_conn_t	*conn;
+	REQUEST				*request = cmd->request;
+	fr_socket_addr_t		addr;
+
+	if (cmd->redirected) {
+		addr = cmd->redirect;
+	} else if (fr_redis_cluster_addr_by_key(&addr, pipeline->cluster, request,
+						cmd->key, cmd->key_len, cmd->read_only) < 0) {
+		REDEBUG("%s", fr_strerror());
+		return -1;
+	}
+
+	conn = pipeline_conn_get(pipeline, request, &addr);
+	if (!conn) return -1;
+
+	if (cmd->asking) {
+		if (redisAsyncCommand(conn->ac, NULL, NULL, "ASKING") != REDIS_OK) {
+		error:
+			REDEBUG("[%s:%i] Failed queueing command: %s", conn->name, conn->addr.port,
+				conn->ac->errstr ? conn->ac->errstr : "unknown error");
+			return -1;
+		}
+		cmd->asking = false;
+	}
+
+	if (redisAsyncCommandArgv(conn->ac, _pipeline_cmd_reply, cmd,
+				  cmd->argc, cmd->argv, cmd->argvlen) != REDIS_OK) goto error;
+	conn->outstanding++;
+
+	RDEBUG2("[%s:%i] >>> Pipelined command (%u outstanding on connection)",
+		conn->name, conn->addr.port, conn->outstanding);
+
+	return 0;
+}
+
+/** Enqueue a command for asynchronous execution
+ *
+ * The command will be written to the node responsible for the key, along with
+ * any other commands enqueued for that node, the next time the worker services
+ * its event loop.
+ *
+ * The caller should yield, and call #unlang_resumable from the callback.
+ *
+ * @param[in] pipeline	to enqueue command in.
+ * @param[in] request	The current request.
+ * @param[in] key	to resolve to a cluster node. If NULL or key_len is 0 a random
+ *			slot will be chosen.
+ * @param[in] key_len	Length of the key.
+ * @param[in] read_only	If true, the command may be sent to a slave.
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Command arguments.  Copied, so may be freed after this call returns.
+ * @param[in] argvlen	Length of each argument.  If NULL, arguments are treated as
+ *			\0 terminated strings.
+ * @param[in] callback	to call when the final reply is received.
+ * @param[in] uctx	to pass to the callback.
+ * @return
+ *	- A handle for the command which may be passed to #fr_redis_pipeline_cancel.
+ *	- NULL on error.
+ */
+fr_redis_pipeline_cmd_t *fr_redis_pipeline_enqueue(fr_redis_pipeline_t *pipeline, REQUEST *request,
+						   uint8_t const *key, size_t key_len, bool read_only,
+						   int argc, char const **argv, size_t const *argvlen,
+						   fr_redis_pipeline_cb_t callback, void *uctx)
+{
+	fr_redis_pipeline_cmd_t	*cmd;
+	int			i;
+
+	MEM(cmd = talloc_zero(pipeline, fr_redis_pipeline_cmd_t));
+	talloc_set_destructor(cmd, _pipeline_cmd_free);
+
+	cmd->pipeline = pipeline;
+	cmd->request = request;
+	cmd->callback = callback;
+	cmd->uctx = uctx;
+	cmd->read_only = read_only;
+
+	/*
+	 *	The request may yield, so everything we need to
+	 *	re-issue the command must be copied.
+	 */
+	if (key && key_len) {
+		MEM(cmd->key = talloc_memdup(cmd, key, key_len));
+		cmd->key_len = key_len;
+	}
+
+	cmd->argc = argc;
+	MEM(cmd->argv = talloc_array(cmd, char const *, argc));
+	MEM(cmd->argvlen = talloc_array(cmd, size_t, argc));
+	for (i = 0; i < argc; i++) {
+		cmd->argvlen[i] = argvlen ? argvlen[i] : strlen(argv[i]);
+		MEM(cmd->argv[i] = talloc_memdup(cmd->argv, argv[i], cmd->argvlen[i]));
+	}
+
+	if (pipeline_cmd_send(cmd) < 0) {
+		talloc_free(cmd);
+		return NULL;
+	}
+
+	return cmd;
+}
+
+/** Cancel a pending command
+ *
+ * The callback will not be called.  If the command has already been written,
+ * the reply is discarded when it arrives.
+ *
+ * @param[in] cmd	to cancel.
+ */
+void fr_redis_pipeline_cancel(fr_redis_pipeline_cmd_t *cmd)
+{
+	/*
+	 *	Waiting to be re-issued, so nothing
+	 *	references the command.
+	 */
+	if (cmd->ev) {
+		talloc_free(cmd);
+		return;
+	}
+
+	cmd->request = NULL;
+}
+
+static int _fr_redis_pipeline_free(fr_redis_pipeline_t *pipeline)
+{
+	pipeline->freeing = true;
+
+	/*
+	 *	Close all the connections before the
+	 *	commands are freed.
+	 */
+	talloc_free(pipeline->conns);
+	pipeline->conns = NULL;
+
+	return 0;
+}
+
+/** Allocate a new pipeline
+ *
+ * Should be called once per worker thread, usually from a module's
+ * thread_instantiate callback.
+ *
+ * @param[in] ctx		to allocate the pipeline in.
+ * @param[in] el		Event list of the thread which will use the pipeline.
+ * @param[in] cluster		to send commands to.
+ * @param[in] conf		Connection configuration.
+ * @param[in] log_prefix	to prepend to log messages.
+ * @return
+ *	- A new pipeline on success.
+ *	- NULL on failure.
+ */
+fr_redis_pipeline_t *fr_redis_pipeline_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_redis_cluster_t *cluster,
+					     fr_redis_conf_t const *conf, char const *log_prefix)
+{
+	fr_redis_pipeline_t *pipeline;
+
+	pipeline = talloc_zero(ctx, fr_redis_pipeline_t);
+	if (!pipeline) return NULL;
+
+	pipeline->el = el;
+	pipeline->cluster = cluster;
+	pipeline->conf = conf;
+	pipeline->log_prefix = log_prefix ? log_prefix : "rlm_redis";
+
+	pipeline->conns = rbtree_create(pipeline, _pipeline_conn_cmp, _pipeline_conn_free, 0);
+	if (!pipeline->conns) {
+		talloc_free(pipeline);
+		return NULL;
+	}
+	talloc_set_destructor(pipeline, _fr_redis_pipeline_free);
+
+	return pipeline;
+}
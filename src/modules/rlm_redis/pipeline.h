@@ -0,0 +1,62 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file pipeline.h
+ * @brief Asynchronous, pipelined command execution against a Redis cluster.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+
+#ifndef LIBFREERADIUS_REDIS_PIPELINE_H
+#define	LIBFREERADIUS_REDIS_PIPELINE_H
+
+RCSIDH(pipeline_h, "$Id$")
+
+#include <freeradius-devel/event.h>
+#include "redis.h"
+#include "cluster.h"
+
+typedef struct fr_redis_pipeline fr_redis_pipeline_t;
+typedef struct fr_redis_pipeline_cmd fr_redis_pipeline_cmd_t;
+
+/** Called when the final reply to a pipelined command is received
+ *
+ * Redirects, and -TRYAGAIN responses have already been processed when this
+ * is called.
+ *
+ * @note The reply is freed by hiredis when the callback returns, so any data
+ *	needed from it must be copied.
+ *
+ * @param[in] request	that enqueued the command.
+ * @param[in] status	of the command.
+ * @param[in] reply	from the server.  May be NULL if the connection failed.
+ * @param[in] uctx	passed to #fr_redis_pipeline_enqueue.
+ */
+typedef void (*fr_redis_pipeline_cb_t)(REQUEST *request, fr_redis_rcode_t status, redisReply *reply, void *uctx);
+
+fr_redis_pipeline_t	*fr_redis_pipeline_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_redis_cluster_t *cluster,
+						 fr_redis_conf_t const *conf, char const *log_prefix);
+
+fr_redis_pipeline_cmd_t	*fr_redis_pipeline_enqueue(fr_redis_pipeline_t *pipeline, REQUEST *request,
+						   uint8_t const *key, size_t key_len, bool read_only,
+						   int argc, char const **argv, size_t const *argvlen,
+						   fr_redis_pipeline_cb_t callback, void *uctx);
+
+void			fr_redis_pipeline_cancel(fr_redis_pipeline_cmd_t *cmd);
+
+#endif	/* LIBFREERADIUS_REDIS_PIPELINE_H */
@@ -35,6 +35,17 @@
  * - @verbatim {<pool name>:<pool type>}:device:<client id> @endverbatim (string) contains last
  *	IP address bound by this client.
  *
+ * If reserve_size is set, each instance reserves blocks of addresses from a pool with a
+ * single script call, and makes offers from that block to devices without an existing
+ * lease.  Reserved addresses have their device set to a marker derived from reserve_id,
+ * and an expiry time like any other lease.  When a client requests the address it was offered, the update
+ * script transfers the lease from the marker to the client's device, and releases any
+ * other lease the device held.  Offers which are never taken up simply expire.  Reservations
+ * which were never offered are returned to the pool when the server exits.
+ *
+ * The instance also remembers the leases it allocates and updates, so devices with an
+ * existing lease are offered the same address again without contacting Redis.
+ *
  * @copyright 2015 Arran Cudbard-Bell <a.cudbardb@freeradius.org>
  * @copyright 2015 The FreeRADIUS server project
  */
@@ -50,6 +61,69 @@ RCSID("$Id$")
 #include "cluster.h"
 #include "redis_ippool.h"
 
+#include <pthread.h>
+
+/** An address reserved from a pool by this instance
+ *
+ */
+typedef struct ippool_reservation {
+	char			ip[FR_IPADDR_PREFIX_STRLEN];	//!< Address, as stored in the pool.
+	char			*range;			//!< Range the address belongs to.  May be NULL.
+	time_t			expires;		//!< When the reservation lapses in Redis.
+
+	uint8_t			*device;		//!< Device the address was offered to.
+							//!< NULL if the address hasn't been offered.
+	size_t			device_len;		//!< Length of the device identifier.
+	time_t			offer_expires;		//!< When the offer lapses.
+
+	int			heap_id;		//!< Position in the free, or the offered heap.
+} ippool_reservation_t;
+
+/** A lease this instance knows a device holds
+ *
+ * Lets devices which already have a lease be offered the same address
+ * again, without asking Redis.
+ */
+typedef struct ippool_lease {
+	uint8_t			*device;		//!< Device holding the lease.
+	size_t			device_len;		//!< Length of the device identifier.
+	int			heap_id;		//!< Position in the expiry heap.
+
+	char			ip[FR_IPADDR_PREFIX_STRLEN];	//!< Address, as stored in the pool.
+	char			*range;			//!< Range the address belongs to.  May be NULL.
+	time_t			expires;		//!< When the lease lapses.
+} ippool_lease_t;
+
+/** Addresses reserved from a single pool
+ *
+ */
+typedef struct ippool_reserve_pool {
+	uint8_t			*name;			//!< Pool name (key prefix).
+	size_t			name_len;		//!< Length of the pool name.
+
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+
+	fr_heap_t		*free;			//!< Reservations not yet offered, soonest to lapse first.
+	fr_heap_t		*offered;		//!< Reservations which have been offered, soonest
+							//!< offer to lapse first.
+	rbtree_t		*by_ip;			//!< All reservations, by address.
+	rbtree_t		*by_device;		//!< Reservations which have been offered, by device.
+
+	rbtree_t		*leases;		//!< Leases we know about, by device.
+	fr_heap_t		*lease_expiry;		//!< Leases we know about, soonest to lapse first.
+
+	bool			refilling;		//!< A thread is reserving more addresses.
+} ippool_reserve_pool_t;
+
+/** Whether we hold a reservation for an address
+ *
+ */
+typedef enum {
+	IPPOOL_RESERVE_NONE = 0,			//!< Not reserved by us, or reserved before a restart.
+	IPPOOL_RESERVE_HELD,				//!< Reserved by us, not offered to the device.
+	IPPOOL_RESERVE_OFFERED				//!< Reserved by us, and offered to the device.
+} ippool_reserve_state_t;
+
 /** rlm_redis module instance
  *
  */
@@ -93,9 +167,29 @@ typedef struct rlm_redis_ippool {
 	bool			copy_on_update; //!< Copy the address provided by ip_address to the
 						//!< allocated_address_attr if updates are successful.
 
+	uint32_t		reserve_size;	//!< How many addresses to reserve from a pool at once.
+						//!< 0 disables the reservation cache.
+	uint32_t		reserve_time;	//!< How long reservations may remain unoffered.
+
+	char const		*reserve_id;		//!< Identifies this server's reservations.
+	char const		*reserve_marker;	//!< Device identifier used to mark addresses
+							//!< reserved by this instance.
+	rbtree_t		*reserve_pools;		//!< Reserved addresses, by pool name.
+	pthread_mutex_t		reserve_mutex;		//!< Protects reserve_pools, but not the pools in it.
+	uint32_t		reserve_threads;	//!< Threads using the instance.  Protected by
+							//!< reserve_mutex.  The last one to exit releases
+							//!< our reservations.
+
 	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
 } rlm_redis_ippool_t;
 
+/** rlm_redis_ippool thread instance
+ *
+ */
+typedef struct rlm_redis_ippool_thread {
+	rlm_redis_ippool_t	*inst;		//!< Instance the thread is using.
+} rlm_redis_ippool_thread_t;
+
 static CONF_PARSER redis_config[] = {
 	REDIS_COMMON_CONFIG,
 	CONF_PARSER_TERMINATOR
@@ -125,6 +219,10 @@ static CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("ipv4_integer", PW_TYPE_BOOLEAN, rlm_redis_ippool_t, ipv4_integer) },
 	{ FR_CONF_OFFSET("copy_on_update", PW_TYPE_BOOLEAN, rlm_redis_ippool_t, copy_on_update), .dflt = "yes", .quote = T_BARE_WORD },
 
+	{ FR_CONF_OFFSET("reserve_size", PW_TYPE_INTEGER, rlm_redis_ippool_t, reserve_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("reserve_time", PW_TYPE_INTEGER, rlm_redis_ippool_t, reserve_time), .dflt = "30" },
+	{ FR_CONF_OFFSET("reserve_id", PW_TYPE_STRING, rlm_redis_ippool_t, reserve_id) },
+
 	/*
 	 *	Split out to allow conversion to universal ippool module with
 	 *	minimum of config changes.
@@ -212,6 +310,9 @@ static char lua_alloc_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
  * - ARGV[3] IP address to update.
  * - ARGV[4] Device identifier.
  * - ARGV[5] (optional) Gateway identifier.
+ * - ARGV[6] (optional) Reservation marker.  If the address is reserved with this
+ *   marker, the lease is transferred to the device, and its counter incremented
+ *   as if it had been allocated.  Any other lease the device holds is released.
  *
  * Returns @verbatim array { <rcode>[, <range>] } @endverbatim
  * - IPPOOL_RCODE_SUCCESS lease updated..
@@ -222,29 +323,47 @@ static char lua_alloc_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
 static char lua_update_cmd[] =
 	"local ret" EOL									/* 1 */
 	"local found" EOL								/* 2 */
+	"local previous" EOL								/* 3 */
 
-	"local pool_key" EOL								/* 3 */
-	"local address_key" EOL								/* 4 */
-	"local device_key" EOL								/* 5 */
+	"local pool_key" EOL								/* 4 */
+	"local address_key" EOL								/* 5 */
+	"local device_key" EOL								/* 6 */
+
+	"pool_key = '{' .. KEYS[1] .. '}:"IPPOOL_POOL_KEY"'" EOL			/* 7 */
+	"device_key = '{' .. KEYS[1] .. '}:"IPPOOL_DEVICE_KEY":' .. ARGV[4]" EOL	/* 8 */
 
 	/*
 	 *	We either need to know that the IP was last allocated to the
 	 *	same device, or that the lease on the IP has NOT expired.
 	 */
-	"address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ARGV[3]" EOL	/* 6 */
-	"found = redis.call('HMGET', address_key, 'range', 'device', 'gateway', 'counter' )" EOL	/* 7 */
-	"if not found[1] then" EOL							/* 8 */
-	"  return {" STRINGIFY(_IPPOOL_RCODE_NOT_FOUND) "}" EOL				/* 9 */
-	"end" EOL									/* 10 */
-	"if found[2] ~= ARGV[4] then" EOL						/* 11 */
-	"  return {" STRINGIFY(_IPPOOL_RCODE_DEVICE_MISMATCH) ", found[2]}" EOL		/* 12 */
+	"address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ARGV[3]" EOL	/* 9 */
+	"found = redis.call('HMGET', address_key, 'range', 'device', 'gateway', 'counter' )" EOL	/* 10 */
+	"if not found[1] then" EOL							/* 11 */
+	"  return {" STRINGIFY(_IPPOOL_RCODE_NOT_FOUND) "}" EOL				/* 12 */
 	"end" EOL									/* 13 */
+	"if found[2] ~= ARGV[4] then" EOL						/* 14 */
+	"  if not ARGV[6] or ARGV[6] == '' or found[2] ~= ARGV[6] then" EOL		/* 15 */
+	"    return {" STRINGIFY(_IPPOOL_RCODE_DEVICE_MISMATCH) ", found[2]}" EOL	/* 16 */
+	"  end" EOL									/* 17 */
+	"  redis.call('HSET', address_key, 'device', ARGV[4])" EOL			/* 18 */
+	"  found[4] = redis.call('HINCRBY', address_key, 'counter', 1)" EOL		/* 19 */
+
+	/*
+	 *	The device may have been offered a reserved address
+	 *	whilst holding a lease on another.  It only keeps one.
+	 */
+	"  previous = redis.call('GET', device_key)" EOL				/* 20 */
+	"  if previous and previous ~= ARGV[3] and" EOL					/* 21 */
+	"     redis.call('HGET', '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. previous, 'device') == ARGV[4] then" EOL	/* 22 */
+	"    redis.call('ZADD', pool_key, 'XX', ARGV[1] - 1, previous)" EOL		/* 23 */
+	"  end" EOL									/* 24 */
+	"  redis.call('SET', device_key, ARGV[3])" EOL					/* 25 */
+	"end" EOL									/* 26 */
 
 	/*
 	 *	Update the expiry time
 	 */
-	"pool_key = '{' .. KEYS[1] .. '}:"IPPOOL_POOL_KEY"'" EOL			/* 14 */
-	"redis.call('ZADD', pool_key, 'XX', ARGV[1] + ARGV[2], ARGV[3])" EOL		/* 15 */
+	"redis.call('ZADD', pool_key, 'XX', ARGV[1] + ARGV[2], ARGV[3])" EOL		/* 27 */
 
 	/*
 	 *	The device key should usually exist, but
@@ -252,19 +371,18 @@ static char lua_update_cmd[] =
 	 *	of a lease being expired, it may have been
 	 *	removed.
 	 */
-	"device_key = '{' .. KEYS[1] .. '}:"IPPOOL_DEVICE_KEY":' .. ARGV[4]" EOL	/* 16 */
-	"if redis.call('EXPIRE', device_key, ARGV[2]) == 0 then" EOL			/* 17 */
-	"  redis.call('SET', device_key, ARGV[3])" EOL					/* 18 */
-	"  redis.call('EXPIRE', device_key, ARGV[2])" EOL				/* 19 */
-	"end" EOL									/* 20 */
+	"if redis.call('EXPIRE', device_key, ARGV[2]) == 0 then" EOL			/* 28 */
+	"  redis.call('SET', device_key, ARGV[3])" EOL					/* 29 */
+	"  redis.call('EXPIRE', device_key, ARGV[2])" EOL				/* 30 */
+	"end" EOL									/* 31 */
 
 	/*
 	 *	Update the gateway address
 	 */
-	"if ARGV[5] ~= found[3] then" EOL						/* 21 */
-	"  redis.call('HSET', address_key, 'gateway', ARGV[5])" EOL			/* 22 */
-	"end" EOL									/* 23 */
-	"return { " STRINGIFY(_IPPOOL_RCODE_SUCCESS) ", found[1], found[4] }"EOL;	/* 24 */
+	"if ARGV[5] ~= found[3] then" EOL						/* 32 */
+	"  redis.call('HSET', address_key, 'gateway', ARGV[5])" EOL			/* 33 */
+	"end" EOL									/* 34 */
+	"return { " STRINGIFY(_IPPOOL_RCODE_SUCCESS) ", found[1], found[4] }"EOL;	/* 35 */
 static char lua_update_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
 
 /** Lua script for releasing leases
@@ -320,6 +438,77 @@ static char lua_release_cmd[] =
 	"}";										/* 21 */
 static char lua_release_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
 
+/** Lua script for reserving a block of addresses
+ *
+ * - KEYS[1] The pool name.
+ * - ARGV[1] Wall time (seconds since epoch).
+ * - ARGV[2] Reserve for (seconds).
+ * - ARGV[3] Maximum number of addresses to reserve.
+ * - ARGV[4] Reservation marker.
+ *
+ * Marks the addresses which expired the longest time ago as belonging to the
+ * reservation marker, and extends their expiry time, so no other server will
+ * allocate them.
+ *
+ * Returns @verbatim array { <rcode>[, <ip>, <range>]... } @endverbatim
+ * - IPPOOL_RCODE_SUCCESS one or more addresses reserved.
+ * - IPPOOL_RCODE_POOL_EMPTY no free addresses in pool.
+ */
+static char lua_reserve_cmd[] =
+	"local ips" EOL									/* 1 */
+	"local ret" EOL									/* 2 */
+
+	"local pool_key" EOL								/* 3 */
+	"local address_key" EOL								/* 4 */
+
+	"pool_key = '{' .. KEYS[1] .. '}:"IPPOOL_POOL_KEY"'" EOL			/* 5 */
+	"ips = redis.call('ZRANGEBYSCORE', pool_key, '-inf', '(' .. ARGV[1], 'LIMIT', 0, ARGV[3])" EOL	/* 6 */
+	"if not ips or not ips[1] then" EOL						/* 7 */
+	"  return {" STRINGIFY(_IPPOOL_RCODE_POOL_EMPTY) "}" EOL			/* 8 */
+	"end" EOL									/* 9 */
+
+	"ret = {" STRINGIFY(_IPPOOL_RCODE_SUCCESS) "}" EOL				/* 10 */
+	"for _, ip in ipairs(ips) do" EOL						/* 11 */
+	"  redis.call('ZADD', pool_key, ARGV[1] + ARGV[2], ip)" EOL			/* 12 */
+	"  address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ip" EOL		/* 13 */
+	"  redis.call('HMSET', address_key, 'device', ARGV[4], 'gateway', '')" EOL	/* 14 */
+	"  table.insert(ret, ip)" EOL							/* 15 */
+	"  table.insert(ret, redis.call('HGET', address_key, 'range'))" EOL		/* 16 */
+	"end" EOL									/* 17 */
+	"return ret" EOL;								/* 18 */
+static char lua_reserve_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
+
+/** Lua script for returning reserved addresses to a pool
+ *
+ * - KEYS[1] The pool name.
+ * - ARGV[1] Wall time (seconds since epoch).
+ * - ARGV[2] Reservation marker.
+ * - ARGV[3] Space separated list of addresses.
+ *
+ * Addresses which are still reserved with the marker are made free
+ * again.  Addresses which have been transferred to a device are left alone.
+ *
+ * Returns @verbatim array { <rcode>, <released> } @endverbatim
+ * - IPPOOL_RCODE_SUCCESS.
+ */
+static char lua_unreserve_cmd[] =
+	"local released = 0" EOL							/* 1 */
+
+	"local pool_key" EOL								/* 2 */
+	"local address_key" EOL								/* 3 */
+
+	"pool_key = '{' .. KEYS[1] .. '}:"IPPOOL_POOL_KEY"'" EOL			/* 4 */
+	"for ip in string.gmatch(ARGV[3], '%S+') do" EOL				/* 5 */
+	"  address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ip" EOL		/* 6 */
+	"  if redis.call('HGET', address_key, 'device') == ARGV[2] then" EOL		/* 7 */
+	"    redis.call('ZADD', pool_key, 'XX', ARGV[1] - 1, ip)" EOL			/* 8 */
+	"    redis.call('HSET', address_key, 'device', '')" EOL				/* 9 */
+	"    released = released + 1" EOL						/* 10 */
+	"  end" EOL									/* 11 */
+	"end" EOL									/* 12 */
+	"return { " STRINGIFY(_IPPOOL_RCODE_SUCCESS) ", released }" EOL;		/* 13 */
+static char lua_unreserve_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
+
 /** Check the requisite number of slaves replicated the lease info
  *
  * @param request The current request.
@@ -547,10 +736,698 @@ finish:
 	return s_ret;
 }
 
+static int _reservation_ip_cmp(void const *a, void const *b)
+{
+	ippool_reservation_t const *my_a = a, *my_b = b;
+
+	return strcmp(my_a->ip, my_b->ip);
+}
+
+static int _reservation_device_cmp(void const *a, void const *b)
+{
+	ippool_reservation_t const *my_a = a, *my_b = b;
+
+	if (my_a->device_len < my_b->device_len) return -1;
+	if (my_a->device_len > my_b->device_len) return +1;
+
+	return memcmp(my_a->device, my_b->device, my_a->device_len);
+}
+
+static int _reservation_expires_cmp(void const *a, void const *b)
+{
+	ippool_reservation_t const *my_a = a, *my_b = b;
+
+	return (my_a->expires > my_b->expires) - (my_a->expires < my_b->expires);
+}
+
+static int _reservation_offer_cmp(void const *a, void const *b)
+{
+	ippool_reservation_t const *my_a = a, *my_b = b;
+
+	return (my_a->offer_expires > my_b->offer_expires) - (my_a->offer_expires < my_b->offer_expires);
+}
+
+static int _lease_device_cmp(void const *a, void const *b)
+{
+	ippool_lease_t const *my_a = a, *my_b = b;
+
+	if (my_a->device_len < my_b->device_len) return -1;
+	if (my_a->device_len > my_b->device_len) return +1;
+
+	return memcmp(my_a->device, my_b->device, my_a->device_len);
+}
+
+static int _lease_expires_cmp(void const *a, void const *b)
+{
+	ippool_lease_t const *my_a = a, *my_b = b;
+
+	return (my_a->expires > my_b->expires) - (my_a->expires < my_b->expires);
+}
+
+static int _reserve_pool_cmp(void const *a, void const *b)
+{
+	ippool_reserve_pool_t const *my_a = a, *my_b = b;
+
+	if (my_a->name_len < my_b->name_len) return -1;
+	if (my_a->name_len > my_b->name_len) return +1;
+
+	return memcmp(my_a->name, my_b->name, my_a->name_len);
+}
+
+static int _ippool_reserve_pool_free(ippool_reserve_pool_t *pool)
+{
+	fr_heap_delete(pool->free);
+	fr_heap_delete(pool->offered);
+	fr_heap_delete(pool->lease_expiry);
+	pthread_mutex_destroy(&pool->mutex);
+
+	return 0;
+}
+
+static void _reserve_pool_free(void *data)
+{
+	talloc_free(data);
+}
+
+/** Print an address the same way it's sent to the update and release scripts
+ *
+ */
+static inline void ippool_ip_print(char *out, size_t outlen, rlm_redis_ippool_t const *inst, fr_ipaddr_t *ip)
+{
+	char ip_buff[FR_IPADDR_PREFIX_STRLEN];
+
+	if ((ip->af == AF_INET) && inst->ipv4_integer) {
+		snprintf(out, outlen, "%u", (unsigned int)htonl(ip->ipaddr.ip4addr.s_addr));
+		return;
+	}
+
+	IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
+	strlcpy(out, ip_buff, outlen);
+}
+
+/** Find the reserved addresses for a pool
+ *
+ * Pools are only freed when the instance is detached, so the pool may be
+ * used after reserve_mutex is released.  Its own mutex must be held to
+ * access anything in it.
+ */
+static ippool_reserve_pool_t *ippool_reserve_pool_find(rlm_redis_ippool_t *inst,
+						       uint8_t const *key_prefix, size_t key_prefix_len,
+						       bool create)
+{
+	ippool_reserve_pool_t find, *pool;
+
+	memcpy(&find.name, &key_prefix, sizeof(find.name));
+	find.name_len = key_prefix_len;
+
+	pthread_mutex_lock(&inst->reserve_mutex);
+	pool = rbtree_finddata(inst->reserve_pools, &find);
+	if (pool || !create) goto finish;
+
+	MEM(pool = talloc_zero(NULL, ippool_reserve_pool_t));
+	MEM(pool->name = talloc_memdup(pool, key_prefix, key_prefix_len));
+	pool->name_len = key_prefix_len;
+	MEM(pool->free = fr_heap_create(_reservation_expires_cmp, offsetof(ippool_reservation_t, heap_id)));
+	MEM(pool->offered = fr_heap_create(_reservation_offer_cmp, offsetof(ippool_reservation_t, heap_id)));
+	MEM(pool->by_ip = rbtree_create(pool, _reservation_ip_cmp, NULL, RBTREE_FLAG_NONE));
+	MEM(pool->by_device = rbtree_create(pool, _reservation_device_cmp, NULL, RBTREE_FLAG_NONE));
+	MEM(pool->leases = rbtree_create(pool, _lease_device_cmp, NULL, RBTREE_FLAG_NONE));
+	MEM(pool->lease_expiry = fr_heap_create(_lease_expires_cmp, offsetof(ippool_lease_t, heap_id)));
+	pthread_mutex_init(&pool->mutex, NULL);
+	talloc_set_destructor(pool, _ippool_reserve_pool_free);
+
+	rbtree_insert(inst->reserve_pools, pool);
+
+finish:
+	pthread_mutex_unlock(&inst->reserve_mutex);
+
+	return pool;
+}
+
+/** Find a reservation by address
+ *
+ * @note Must be called with the pool's mutex held.
+ */
+static ippool_reservation_t *ippool_reservation_find(ippool_reserve_pool_t *pool, char const *ip)
+{
+	ippool_reservation_t find;
+
+	strlcpy(find.ip, ip, sizeof(find.ip));
+
+	return rbtree_finddata(pool->by_ip, &find);
+}
+
+/** Remove the association between a reservation and the device it was offered to
+ *
+ * The reservation is left on neither heap.
+ *
+ * @note Must be called with the pool's mutex held.
+ */
+static void ippool_reservation_unoffer(ippool_reserve_pool_t *pool, ippool_reservation_t *res)
+{
+	if (!res->device) return;
+
+	rbtree_deletebydata(pool->by_device, res);
+	(void) fr_heap_extract(pool->offered, res);
+	TALLOC_FREE(res->device);
+	res->device_len = 0;
+}
+
+/** Forget about a reservation
+ *
+ * Called once the reservation has lapsed, or has been transferred to a device.
+ *
+ * @note Must be called with the pool's mutex held.
+ */
+static void ippool_reservation_remove(ippool_reserve_pool_t *pool, ippool_reservation_t *res)
+{
+	if (res->device) {
+		ippool_reservation_unoffer(pool, res);
+	} else if (res->heap_id >= 0) {
+		(void) fr_heap_extract(pool->free, res);
+	}
+	rbtree_deletebydata(pool->by_ip, res);
+	talloc_free(res);
+}
+
+/** Return an offered reservation to the free heap
+ *
+ * @note Must be called with the pool's mutex held.
+ */
+static void ippool_reservation_free(ippool_reserve_pool_t *pool, ippool_reservation_t *res)
+{
+	ippool_reservation_unoffer(pool, res);
+	fr_heap_insert(pool->free, res);
+}
+
+/** Pop a reservation which can be offered for at least expires seconds
+ *
+ * Offers which weren't taken up are returned to the free heap first.
+ * Reservations which would lapse before the offer does are discarded.
+ *
+ * @note Must be called with the pool's mutex held.
+ */
+static ippool_reservation_t *ippool_reservation_pop(ippool_reserve_pool_t *pool, time_t now, uint32_t expires)
+{
+	ippool_reservation_t *res;
+
+	while ((res = fr_heap_peek(pool->offered)) && (res->offer_expires < now)) {
+		ippool_reservation_free(pool, res);
+	}
+
+	while ((res = fr_heap_pop(pool->free))) {
+		if (res->expires >= (time_t)(now + expires)) return res;
+
+		ippool_reservation_remove(pool, res);
+	}
+
+	return NULL;
+}
+
+/** Forget about a lease
+ *
+ * @note Must be called with the pool's mutex held.
+ */
+static void ippool_lease_remove(ippool_reserve_pool_t *pool, ippool_lease_t *lease)
+{
+	(void) fr_heap_extract(pool->lease_expiry, lease);
+	rbtree_deletebydata(pool->leases, lease);
+	talloc_free(lease);
+}
+
+/** Forget about leases which have lapsed
+ *
+ * @note Must be called with the pool's mutex held.
+ */
+static void ippool_lease_expire(ippool_reserve_pool_t *pool, time_t now)
+{
+	ippool_lease_t *lease;
+
+	while ((lease = fr_heap_peek(pool->lease_expiry)) && (lease->expires <= now)) {
+		ippool_lease_remove(pool, lease);
+	}
+}
+
+/** Find the lease a device holds
+ *
+ * @note Must be called with the pool's mutex held.
+ */
+static ippool_lease_t *ippool_lease_find(ippool_reserve_pool_t *pool, uint8_t const *device_id, size_t device_id_len)
+{
+	ippool_lease_t find;
+
+	memcpy(&find.device, &device_id, sizeof(find.device));
+	find.device_len = device_id_len;
+
+	return rbtree_finddata(pool->leases, &find);
+}
+
+/** Record the lease a device holds, so it can be offered the same address again without asking Redis
+ *
+ * @param[in] inst	of rlm_redis_ippool.
+ * @param[in] key_prefix	Pool name.
+ * @param[in] key_prefix_len	Length of the pool name.
+ * @param[in] device_id	holding the lease.
+ * @param[in] device_id_len	Length of the device identifier.
+ * @param[in] ip	as stored in the pool.
+ * @param[in] range	the address belongs to.  May be NULL.
+ * @param[in] range_len	Length of the range identifier.
+ * @param[in] expires	When the lease lapses.
+ */
+static void redis_ippool_lease_learn(rlm_redis_ippool_t *inst,
+				     uint8_t const *key_prefix, size_t key_prefix_len,
+				     uint8_t const *device_id, size_t device_id_len,
+				     char const *ip, char const *range, size_t range_len, time_t expires)
+{
+	ippool_reserve_pool_t	*pool;
+	ippool_lease_t		*lease;
+
+	if (!inst->reserve_size || !device_id || !device_id_len || (strlen(ip) >= sizeof(lease->ip))) return;
+
+	pool = ippool_reserve_pool_find(inst, key_prefix, key_prefix_len, true);
+
+	pthread_mutex_lock(&pool->mutex);
+	ippool_lease_expire(pool, time(NULL));
+
+	lease = ippool_lease_find(pool, device_id, device_id_len);
+	if (lease) {
+		(void) fr_heap_extract(pool->lease_expiry, lease);
+		TALLOC_FREE(lease->range);
+	} else {
+		MEM(lease = talloc_zero(pool, ippool_lease_t));
+		MEM(lease->device = talloc_memdup(lease, device_id, device_id_len));
+		lease->device_len = device_id_len;
+		rbtree_insert(pool->leases, lease);
+	}
+
+	strlcpy(lease->ip, ip, sizeof(lease->ip));
+	if (range) MEM(lease->range = talloc_bstrndup(lease, range, range_len));
+	lease->expires = expires;
+	fr_heap_insert(pool->lease_expiry, lease);
+
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/** Forget the lease a device holds on an address
+ *
+ * @param[in] inst	of rlm_redis_ippool.
+ * @param[in] key_prefix	Pool name.
+ * @param[in] key_prefix_len	Length of the pool name.
+ * @param[in] device_id	holding the lease.
+ * @param[in] device_id_len	Length of the device identifier.
+ * @param[in] ip	as printed by #ippool_ip_print.
+ */
+static void redis_ippool_lease_forget(rlm_redis_ippool_t *inst,
+				      uint8_t const *key_prefix, size_t key_prefix_len,
+				      uint8_t const *device_id, size_t device_id_len, char const *ip)
+{
+	ippool_reserve_pool_t	*pool;
+	ippool_lease_t		*lease;
+
+	if (!inst->reserve_size || !device_id) return;
+
+	pool = ippool_reserve_pool_find(inst, key_prefix, key_prefix_len, false);
+	if (!pool) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	lease = ippool_lease_find(pool, device_id, device_id_len);
+	if (lease && (strcmp(lease->ip, ip) == 0)) ippool_lease_remove(pool, lease);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/** Reserve a block of addresses from a pool
+ *
+ * The cluster is contacted without holding the pool's mutex.  Other threads which
+ * find the pool empty whilst it's being refilled fall back to allocating directly.
+ *
+ * @note Must be called with the pool's mutex held, returns with it held.
+ */
+static ippool_rcode_t ippool_reserve_refill(rlm_redis_ippool_t *inst, REQUEST *request,
+					    ippool_reserve_pool_t *pool, uint32_t expires)
+{
+	struct timeval		now;
+	redisReply		*reply = NULL;
+	fr_redis_rcode_t	status;
+	ippool_rcode_t		ret;
+	uint32_t		reserve_for = expires + inst->reserve_time;
+	size_t			i;
+
+	if (pool->refilling) return IPPOOL_RCODE_POOL_EMPTY;
+	pool->refilling = true;
+	pthread_mutex_unlock(&pool->mutex);
+
+	gettimeofday(&now, NULL);
+
+	RDEBUG2("Reserving up to %u addresses", inst->reserve_size);
+	status = ippool_script(&reply, request, inst->cluster,
+			       pool->name, pool->name_len,
+			       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
+			       lua_reserve_digest, lua_reserve_cmd,
+			       "EVALSHA %s 1 %b %u %u %u %s",
+			       lua_reserve_digest,
+			       pool->name, pool->name_len,
+			       (unsigned int)now.tv_sec, reserve_for,
+			       inst->reserve_size, inst->reserve_marker);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->refilling = false;
+
+	if (status != REDIS_RCODE_SUCCESS) {
+		ret = IPPOOL_RCODE_FAIL;
+		goto finish;
+	}
+
+	rad_assert(reply);
+	if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements == 0) ||
+	    (reply->element[0]->type != REDIS_REPLY_INTEGER)) {
+		REDEBUG("Unexpected result from reserve script");
+		ret = IPPOOL_RCODE_FAIL;
+		goto finish;
+	}
+	ret = reply->element[0]->integer;
+	if (ret < 0) goto finish;
+
+	for (i = 1; (i + 1) < reply->elements; i += 2) {
+		ippool_reservation_t	*res;
+		redisReply		*ip = reply->element[i], *range = reply->element[i + 1];
+
+		if ((ip->type != REDIS_REPLY_STRING) || (ip->len >= sizeof(res->ip))) {
+			REDEBUG("Server returned unexpected type \"%s\" for reserved IP element (result[%zu])",
+				fr_int2str(redis_reply_types, ip->type, "<UNKNOWN>"), i);
+			continue;
+		}
+
+		MEM(res = talloc_zero(pool, ippool_reservation_t));
+		strlcpy(res->ip, ip->str, sizeof(res->ip));
+		if (range->type == REDIS_REPLY_STRING) MEM(res->range = talloc_bstrndup(res, range->str, range->len));
+		res->expires = now.tv_sec + reserve_for;
+		res->heap_id = -1;
+
+		/*
+		 *	We reserved it again, after our previous
+		 *	reservation lapsed.
+		 */
+		if (!rbtree_insert(pool->by_ip, res)) {
+			talloc_free(res);
+			continue;
+		}
+
+		fr_heap_insert(pool->free, res);
+	}
+	RDEBUG2("Reserved %zu addresses", (reply->elements - 1) / 2);
+
+finish:
+	fr_redis_reply_free(reply);
+
+	return ret;
+}
+
+/** Write an offered reservation to the request
+ *
+ */
+static ippool_rcode_t ippool_reservation_to_request(rlm_redis_ippool_t const *inst, REQUEST *request,
+						    char const *ip, char const *range, uint32_t expires)
+{
+	vp_tmpl_t ip_rhs = {
+		.name = "",
+		.type = TMPL_TYPE_DATA,
+		.quote = T_BARE_WORD
+	};
+	vp_map_t ip_map = {
+		.lhs = inst->allocated_address_attr,
+		.op = T_OP_SET,
+		.rhs = &ip_rhs
+	};
+
+	ip_rhs.tmpl_value_box_datum.strvalue = ip;
+	ip_rhs.tmpl_value_box_length = strlen(ip);
+	ip_rhs.tmpl_value_box_type = PW_TYPE_STRING;
+	if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) return IPPOOL_RCODE_FAIL;
+
+	if (range) {
+		vp_tmpl_t range_rhs = {
+			.name = "",
+			.type = TMPL_TYPE_DATA,
+			.quote = T_DOUBLE_QUOTED_STRING
+		};
+		vp_map_t range_map = {
+			.lhs = inst->range_attr,
+			.op = T_OP_SET,
+			.rhs = &range_rhs
+		};
+
+		range_rhs.tmpl_value_box_datum.strvalue = range;
+		range_rhs.tmpl_value_box_length = strlen(range);
+		range_rhs.tmpl_value_box_type = PW_TYPE_STRING;
+		if (map_to_request(request, &range_map, map_to_vp, NULL) < 0) return IPPOOL_RCODE_FAIL;
+	}
+
+	if (inst->expiry_attr) {
+		vp_tmpl_t expiry_rhs = {
+			.name = "",
+			.type = TMPL_TYPE_DATA,
+			.quote = T_BARE_WORD
+		};
+		vp_map_t expiry_map = {
+			.lhs = inst->expiry_attr,
+			.op = T_OP_SET,
+			.rhs = &expiry_rhs
+		};
+
+		expiry_rhs.tmpl_value_box_datum.integer = expires;
+		expiry_rhs.tmpl_value_box_length = sizeof(expiry_rhs.tmpl_value_box_datum.integer);
+		expiry_rhs.tmpl_value_box_type = PW_TYPE_INTEGER;
+		if (map_to_request(request, &expiry_map, map_to_vp, NULL) < 0) return IPPOOL_RCODE_FAIL;
+	}
+
+	return IPPOOL_RCODE_SUCCESS;
+}
+
+/** Offer an address from the addresses this instance has reserved
+ *
+ * Devices with a lease we know about are offered the same address again.
+ * Neither that, nor offering a reserved address, requires contacting Redis
+ * unless the reservations need refilling.
+ *
+ * @return
+ *	- IPPOOL_RCODE_SUCCESS if an address was offered.
+ *	- IPPOOL_RCODE_POOL_EMPTY if no reservations were available, and the
+ *	  caller should allocate directly.
+ *	- IPPOOL_RCODE_FAIL on error.
+ */
+static ippool_rcode_t redis_ippool_reserve_offer(rlm_redis_ippool_t *inst, REQUEST *request,
+						 uint8_t const *key_prefix, size_t key_prefix_len,
+						 uint8_t const *device_id, size_t device_id_len,
+						 uint32_t expires)
+{
+	ippool_reserve_pool_t	*pool;
+	ippool_reservation_t	*res, find;
+	ippool_lease_t		*lease;
+	time_t			now = time(NULL);
+	char			ip[FR_IPADDR_PREFIX_STRLEN];
+	char			*range = NULL;
+	ippool_rcode_t		ret;
+
+	pool = ippool_reserve_pool_find(inst, key_prefix, key_prefix_len, true);
+
+	pthread_mutex_lock(&pool->mutex);
+
+	/*
+	 *	The device already has a lease which will
+	 *	outlast the offer.
+	 */
+	ippool_lease_expire(pool, now);
+	lease = ippool_lease_find(pool, device_id, device_id_len);
+	if (lease && (lease->expires >= (time_t)(now + expires))) {
+		strlcpy(ip, lease->ip, sizeof(ip));
+		if (lease->range) MEM(range = talloc_typed_strdup(request, lease->range));
+		pthread_mutex_unlock(&pool->mutex);
+
+		RDEBUG2("Offering existing lease %s", ip);
+		goto done;
+	}
+
+	/*
+	 *	Re-offer the same address if the device
+	 *	asks again.
+	 */
+	memcpy(&find.device, &device_id, sizeof(find.device));
+	find.device_len = device_id_len;
+	res = rbtree_finddata(pool->by_device, &find);
+	if (res) {
+		if (res->expires >= (time_t)(now + expires)) {
+			(void) fr_heap_extract(pool->offered, res);
+			goto offer;
+		}
+		ippool_reservation_remove(pool, res);
+	}
+
+	res = ippool_reservation_pop(pool, now, expires);
+	if (!res) {
+		ret = ippool_reserve_refill(inst, request, pool, expires);
+		if (ret < 0) {
+			pthread_mutex_unlock(&pool->mutex);
+			return ret;
+		}
+
+		res = ippool_reservation_pop(pool, now, expires);
+		if (!res) {
+			pthread_mutex_unlock(&pool->mutex);
+			return IPPOOL_RCODE_POOL_EMPTY;
+		}
+	}
+
+	MEM(res->device = talloc_memdup(res, device_id, device_id_len));
+	res->device_len = device_id_len;
+	rbtree_insert(pool->by_device, res);
+
+offer:
+	res->offer_expires = now + expires;
+	fr_heap_insert(pool->offered, res);
+
+	/*
+	 *	The reservation may be reclaimed by another
+	 *	thread once we release the mutex.
+	 */
+	strlcpy(ip, res->ip, sizeof(ip));
+	if (res->range) MEM(range = talloc_typed_strdup(request, res->range));
+	pthread_mutex_unlock(&pool->mutex);
+
+	RDEBUG2("Offering reserved address %s", ip);
+
+done:
+	ret = ippool_reservation_to_request(inst, request, ip, range, expires);
+	talloc_free(range);
+
+	return ret;
+}
+
+/** Check whether an address was offered to a device from this instance's reservations
+ *
+ * @param[in] inst	of rlm_redis_ippool.
+ * @param[in] key_prefix	Pool name.
+ * @param[in] key_prefix_len	Length of the pool name.
+ * @param[in] ip	as printed by #ippool_ip_print.
+ * @param[in] device_id	the address was offered to.
+ * @param[in] device_id_len	Length of the device identifier.
+ * @param[in] release	If the address was offered to the device, return it to the
+ *			free heap.
+ * @return
+ *	- IPPOOL_RESERVE_NONE if we don't hold a reservation for the address.
+ *	- IPPOOL_RESERVE_HELD if we hold a reservation for the address, but it
+ *	  wasn't offered to the device.
+ *	- IPPOOL_RESERVE_OFFERED if the address was offered to the device.
+ */
+static ippool_reserve_state_t redis_ippool_reserve_offered(rlm_redis_ippool_t *inst,
+							   uint8_t const *key_prefix, size_t key_prefix_len,
+							   char const *ip, uint8_t const *device_id, size_t device_id_len,
+							   bool release)
+{
+	ippool_reserve_pool_t	*pool;
+	ippool_reservation_t	*res;
+	ippool_reserve_state_t	state = IPPOOL_RESERVE_NONE;
+
+	pool = ippool_reserve_pool_find(inst, key_prefix, key_prefix_len, false);
+	if (!pool) return IPPOOL_RESERVE_NONE;
+
+	pthread_mutex_lock(&pool->mutex);
+	res = ippool_reservation_find(pool, ip);
+	if (!res) goto finish;
+
+	state = IPPOOL_RESERVE_HELD;
+	if (!device_id || !res->device || (res->device_len != device_id_len) ||
+	    (memcmp(res->device, device_id, device_id_len) != 0)) goto finish;
+
+	state = IPPOOL_RESERVE_OFFERED;
+	if (release) ippool_reservation_free(pool, res);
+
+finish:
+	pthread_mutex_unlock(&pool->mutex);
+
+	return state;
+}
+
+/** Forget about a reservation once the address has been leased
+ *
+ * @param[in] inst	of rlm_redis_ippool.
+ * @param[in] key_prefix	Pool name.
+ * @param[in] key_prefix_len	Length of the pool name.
+ * @param[in] ip	as printed by #ippool_ip_print.
+ */
+static void redis_ippool_reserve_forget(rlm_redis_ippool_t *inst,
+					uint8_t const *key_prefix, size_t key_prefix_len, char const *ip)
+{
+	ippool_reserve_pool_t	*pool;
+	ippool_reservation_t	*res;
+
+	pool = ippool_reserve_pool_find(inst, key_prefix, key_prefix_len, false);
+	if (!pool) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	res = ippool_reservation_find(pool, ip);
+	if (res) ippool_reservation_remove(pool, res);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static int _reserve_pool_release(void *ctx, void *data)
+{
+	rlm_redis_ippool_t	*inst = ctx;
+	ippool_reserve_pool_t	*pool = data;
+	ippool_reservation_t	*res;
+	REQUEST			*request;
+	redisReply		*reply = NULL;
+	char			*ips = NULL;
+	size_t			count = 0;
+
+	/*
+	 *	Addresses we've offered are left to lapse, the
+	 *	device may still claim them through another server
+	 *	using the same reserve_id.
+	 */
+	pthread_mutex_lock(&pool->mutex);
+	while ((res = fr_heap_pop(pool->free))) {
+		ips = talloc_asprintf_append_buffer(ips, "%s%s", ips ? " " : "", res->ip);
+		count++;
+		rbtree_deletebydata(pool->by_ip, res);
+		talloc_free(res);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (!ips) return 0;
+
+	request = request_alloc(NULL);
+	RDEBUG2("Releasing %zu reserved addresses", count);
+	if (ippool_script(&reply, request, inst->cluster,
+			  pool->name, pool->name_len,
+			  inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
+			  lua_unreserve_digest, lua_unreserve_cmd,
+			  "EVALSHA %s 1 %b %u %s %s",
+			  lua_unreserve_digest,
+			  pool->name, pool->name_len,
+			  (unsigned int)time(NULL), inst->reserve_marker, ips) != REDIS_RCODE_SUCCESS) {
+		WARN("Failed releasing %zu reserved addresses, they will lapse in %u seconds",
+		     count, inst->reserve_time);
+	}
+	fr_redis_reply_free(reply);
+	talloc_free(request);
+	talloc_free(ips);
+
+	return 0;
+}
+
+/** Release the addresses this instance has reserved, but not offered
+ *
+ * @param[in] inst	of rlm_redis_ippool.
+ */
+static void redis_ippool_reserve_release(rlm_redis_ippool_t *inst)
+{
+	rbtree_walk(inst->reserve_pools, RBTREE_IN_ORDER, _reserve_pool_release, inst);
+}
+
 /** Allocate a new IP address from a pool
  *
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQUEST *request,
+static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t *inst, REQUEST *request,
 					    uint8_t const *key_prefix, size_t key_prefix_len,
 					    uint8_t const *device_id, size_t device_id_len,
 					    uint8_t const *gateway_id, size_t gateway_id_len,
@@ -753,6 +1630,30 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQU
 			goto finish;
 		}
 	}
+
+	/*
+	 *	Remember the lease, so the device can be offered
+	 *	the same address again without asking Redis.
+	 */
+	if (inst->reserve_size && (reply->elements > 1)) {
+		char		ip_key[FR_IPADDR_PREFIX_STRLEN];
+		redisReply	*range = (reply->elements > 2) ? reply->element[2] : NULL;
+		time_t		lease_expires = now.tv_sec + expires;
+
+		if (reply->element[1]->type == REDIS_REPLY_INTEGER) {
+			snprintf(ip_key, sizeof(ip_key), "%lld", reply->element[1]->integer);
+		} else {
+			strlcpy(ip_key, reply->element[1]->str, sizeof(ip_key));
+		}
+		if ((reply->elements > 3) && (reply->element[3]->type == REDIS_REPLY_INTEGER)) {
+			lease_expires = now.tv_sec + reply->element[3]->integer;
+		}
+
+		redis_ippool_lease_learn(inst, key_prefix, key_prefix_len, device_id, device_id_len, ip_key,
+					 (range && (range->type == REDIS_REPLY_STRING)) ? range->str : NULL,
+					 range ? range->len : 0, lease_expires);
+	}
+
 finish:
 	fr_redis_reply_free(reply);
 	return ret;
@@ -761,12 +1662,12 @@ finish:
 /** Update an existing IP address in a pool
  *
  */
-static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUEST *request,
+static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t *inst, REQUEST *request,
 					  uint8_t const *key_prefix, size_t key_prefix_len,
 					  fr_ipaddr_t *ip,
 					  uint8_t const *device_id, size_t device_id_len,
 					  uint8_t const *gateway_id, size_t gateway_id_len,
-					  uint32_t expires)
+					  uint32_t expires, char const *reservation)
 {
 	struct			timeval now;
 	redisReply		*reply = NULL;
@@ -784,19 +1685,21 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUES
 	 */
 	if (!device_id) device_id = (uint8_t const *)"";
 	if (!gateway_id) gateway_id = (uint8_t const *)"";
+	if (!reservation) reservation = "";
 
 	if ((ip->af == AF_INET) && inst->ipv4_integer) {
 		status = ippool_script(&reply, request, inst->cluster,
 				       key_prefix, key_prefix_len,
 				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
 				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %u %b %b",
+				       "EVALSHA %s 1 %b %u %u %u %b %b %s",
 				       lua_update_digest,
 				       key_prefix, key_prefix_len,
 				       (unsigned int)now.tv_sec, expires,
 				       htonl(ip->ipaddr.ip4addr.s_addr),
 				       device_id, device_id_len,
-				       gateway_id, gateway_id_len);
+				       gateway_id, gateway_id_len,
+				       reservation);
 	} else {
 		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
 
@@ -805,13 +1708,14 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUES
 				       key_prefix, key_prefix_len,
 				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
 				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %s %b %b",
+				       "EVALSHA %s 1 %b %u %u %s %b %b %s",
 				       lua_update_digest,
 				       key_prefix, key_prefix_len,
 				       (unsigned int)now.tv_sec, expires,
 				       ip_buff,
 				       device_id, device_id_len,
-				       gateway_id, gateway_id_len);
+				       gateway_id, gateway_id_len,
+				       reservation);
 	}
 	if (status != REDIS_RCODE_SUCCESS) {
 		ret = IPPOOL_RCODE_FAIL;
@@ -897,6 +1801,16 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUES
 		}
 	}
 
+	if (inst->reserve_size) {
+		char		ip_key[FR_IPADDR_PREFIX_STRLEN];
+		redisReply	*range = (reply->elements > 1) ? reply->element[1] : NULL;
+
+		ippool_ip_print(ip_key, sizeof(ip_key), inst, ip);
+		redis_ippool_lease_learn(inst, key_prefix, key_prefix_len, device_id, device_id_len, ip_key,
+					 (range && (range->type == REDIS_REPLY_STRING)) ? range->str : NULL,
+					 range ? range->len : 0, now.tv_sec + expires);
+	}
+
 finish:
 	fr_redis_reply_free(reply);
 
@@ -1025,7 +1939,7 @@ static inline ssize_t ippool_pool_name(uint8_t const **out, uint8_t buff[], size
 	return slen;
 }
 
-static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request, ippool_action_t action)
+static rlm_rcode_t mod_action(rlm_redis_ippool_t *inst, REQUEST *request, ippool_action_t action)
 {
 	uint8_t		key_prefix_buff[IPPOOL_MAX_KEY_PREFIX_SIZE], device_id_buff[256], gateway_id_buff[256];
 	uint8_t const	*key_prefix, *device_id = NULL, *gateway_id = NULL;
@@ -1081,6 +1995,32 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len, NULL,
 				    device_id, device_id_len, gateway_id, gateway_id_len, expires);
+
+		/*
+		 *	Devices with a lease we know about get the same
+		 *	address again.  Otherwise try and offer one of
+		 *	the addresses we've already reserved, else fall
+		 *	back to allocating directly.
+		 *
+		 *	Devices with a lease we don't know about may be
+		 *	offered a reserved address.  The update script
+		 *	releases their old lease if they accept it.
+		 */
+		if (inst->reserve_size && device_id) {
+			switch (redis_ippool_reserve_offer(inst, request, key_prefix, key_prefix_len,
+							   device_id, device_id_len, (uint32_t)expires)) {
+			case IPPOOL_RCODE_SUCCESS:
+				RDEBUG2("IP address lease offered from reservation");
+				return RLM_MODULE_UPDATED;
+
+			case IPPOOL_RCODE_POOL_EMPTY:
+				break;
+
+			default:
+				return RLM_MODULE_FAIL;
+			}
+		}
+
 		switch (redis_ippool_allocate(inst, request, key_prefix, key_prefix_len,
 					      device_id, device_id_len,
 					      gateway_id, gateway_id_len, (uint32_t)expires)) {
@@ -1098,8 +2038,12 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 
 	case POOL_ACTION_UPDATE:
 	{
-		char		ip_buff[INET6_ADDRSTRLEN + 4];
-		char const	*ip_str;
+		char			ip_buff[INET6_ADDRSTRLEN + 4];
+		char const		*ip_str;
+		char			ip_key[FR_IPADDR_PREFIX_STRLEN];
+		char const		*reservation = NULL;
+		ippool_reserve_state_t	reserved = IPPOOL_RESERVE_NONE;
+		ippool_rcode_t		ret;
 
 		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
 				request, inst->lease_time, NULL, NULL) < 0) {
@@ -1125,9 +2069,52 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
 				    ip_str, device_id, device_id_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_update(inst, request, key_prefix, key_prefix_len,
-					    &ip, device_id, device_id_len,
-					    gateway_id, gateway_id_len, (uint32_t)expires)) {
+
+		/*
+		 *	If we offered the address from our reservations
+		 *	the update script needs our marker to transfer
+		 *	the lease to the device.
+		 *
+		 *	We also pass the marker for addresses we know
+		 *	nothing about, as they may have been offered
+		 *	before a restart, or by another server using the
+		 *	same reserve_id.  The script only transfers the
+		 *	lease if the address is still reserved with
+		 *	the marker.
+		 */
+		if (inst->reserve_size) {
+			ippool_ip_print(ip_key, sizeof(ip_key), inst, &ip);
+			reserved = redis_ippool_reserve_offered(inst, key_prefix, key_prefix_len, ip_key,
+								device_id, device_id_len, false);
+			if (reserved != IPPOOL_RESERVE_HELD) {
+				if (reserved == IPPOOL_RESERVE_OFFERED) RDEBUG2("Claiming reserved address %s", ip_str);
+				reservation = inst->reserve_marker;
+			}
+		}
+
+		ret = redis_ippool_update(inst, request, key_prefix, key_prefix_len,
+					  &ip, device_id, device_id_len,
+					  gateway_id, gateway_id_len, (uint32_t)expires, reservation);
+
+		/*
+		 *	Only forget the reservation once the lease has
+		 *	been transferred, or we know it's no longer ours.
+		 *	If the update failed the device may try again.
+		 */
+		if ((reserved != IPPOOL_RESERVE_NONE) &&
+		    ((ret == IPPOOL_RCODE_SUCCESS) ||
+		     ((reserved == IPPOOL_RESERVE_OFFERED) && (ret != IPPOOL_RCODE_FAIL)))) {
+			redis_ippool_reserve_forget(inst, key_prefix, key_prefix_len, ip_key);
+		}
+
+		/*
+		 *	Whatever we thought the device held, it doesn't.
+		 */
+		if (inst->reserve_size && (ret != IPPOOL_RCODE_SUCCESS) && (ret != IPPOOL_RCODE_FAIL)) {
+			redis_ippool_lease_forget(inst, key_prefix, key_prefix_len, device_id, device_id_len, ip_key);
+		}
+
+		switch (ret) {
 		case IPPOOL_RCODE_SUCCESS:
 			RDEBUG2("Requested IP address' \"%s\" lease updated", ip_str);
 
@@ -1193,6 +2180,23 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
 				    ip_str, device_id, device_id_len, gateway_id, gateway_id_len, 0);
+
+		/*
+		 *	An address we offered, but which was never
+		 *	claimed, goes back into our reservations.
+		 */
+		if (inst->reserve_size) {
+			char ip_key[FR_IPADDR_PREFIX_STRLEN];
+
+			ippool_ip_print(ip_key, sizeof(ip_key), inst, &ip);
+			redis_ippool_lease_forget(inst, key_prefix, key_prefix_len, device_id, device_id_len, ip_key);
+			if (redis_ippool_reserve_offered(inst, key_prefix, key_prefix_len, ip_key,
+							 device_id, device_id_len, true) == IPPOOL_RESERVE_OFFERED) {
+				RDEBUG2("Offered IP address \"%s\" returned to reservations", ip_str);
+				return RLM_MODULE_UPDATED;
+			}
+		}
+
 		switch (redis_ippool_release(inst, request, key_prefix, key_prefix_len,
 					     &ip, device_id, device_id_len)) {
 		case IPPOOL_RCODE_SUCCESS:
@@ -1230,7 +2234,7 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	rlm_redis_ippool_t const	*inst = instance;
+	rlm_redis_ippool_t		*inst = instance;
 	VALUE_PAIR			*vp;
 
 	/*
@@ -1268,7 +2272,7 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	rlm_redis_ippool_t const	*inst = instance;
+	rlm_redis_ippool_t		*inst = instance;
 	VALUE_PAIR			*vp;
 
 	/*
@@ -1282,7 +2286,7 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	rlm_redis_ippool_t const	*inst = instance;
+	rlm_redis_ippool_t		*inst = instance;
 	VALUE_PAIR			*vp;
 
 	/*
@@ -1332,6 +2336,38 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		fr_sha1_update(&sha1_ctx, (uint8_t const *)lua_release_cmd, sizeof(lua_release_cmd) - 1);
 		fr_sha1_final(digest, &sha1_ctx);
 		fr_bin2hex(lua_release_digest, digest, sizeof(digest));
+
+		fr_sha1_init(&sha1_ctx);
+		fr_sha1_update(&sha1_ctx, (uint8_t const *)lua_reserve_cmd, sizeof(lua_reserve_cmd) - 1);
+		fr_sha1_final(digest, &sha1_ctx);
+		fr_bin2hex(lua_reserve_digest, digest, sizeof(digest));
+
+		fr_sha1_init(&sha1_ctx);
+		fr_sha1_update(&sha1_ctx, (uint8_t const *)lua_unreserve_cmd, sizeof(lua_unreserve_cmd) - 1);
+		fr_sha1_final(digest, &sha1_ctx);
+		fr_bin2hex(lua_unreserve_digest, digest, sizeof(digest));
+	}
+
+	/*
+	 *	The marker must stay the same across restarts,
+	 *	and be shared by all servers which may receive
+	 *	updates for each other's offers, else valid
+	 *	offers can't be claimed.
+	 */
+	if (inst->reserve_size) {
+		if (!inst->reserve_time) {
+			cf_log_err_cs(conf, "reserve_time must be greater than 0");
+			return -1;
+		}
+
+		if (!inst->reserve_id) {
+			inst->reserve_id = cf_section_name2(conf);
+			if (!inst->reserve_id) inst->reserve_id = cf_section_name1(conf);
+		}
+		inst->reserve_marker = talloc_asprintf(inst, "reserved:%s", inst->reserve_id);
+		inst->reserve_pools = rbtree_create(NULL, _reserve_pool_cmp, _reserve_pool_free, RBTREE_FLAG_NONE);
+		if (!inst->reserve_pools) return -1;
+		pthread_mutex_init(&inst->reserve_mutex, NULL);
 	}
 
 	/*
@@ -1343,6 +2379,67 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/** Count the threads using the instance
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_redis_ippool.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return 0
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, UNUSED fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_redis_ippool_t		*inst = instance;
+	rlm_redis_ippool_thread_t	*t = thread;
+
+	t->inst = inst;
+	if (!inst->reserve_size) return 0;
+
+	pthread_mutex_lock(&inst->reserve_mutex);
+	inst->reserve_threads++;
+	pthread_mutex_unlock(&inst->reserve_mutex);
+
+	return 0;
+}
+
+/** Return reserved addresses to their pools once the last thread using them exits
+ *
+ * Reservations are shared by all threads, so they're only released
+ * when none remain which could offer them.
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_redis_ippool_thread_t	*t = thread;
+	rlm_redis_ippool_t		*inst = t->inst;
+	bool				last;
+
+	if (!inst->reserve_size) return 0;
+
+	pthread_mutex_lock(&inst->reserve_mutex);
+	last = (--inst->reserve_threads == 0);
+	pthread_mutex_unlock(&inst->reserve_mutex);
+
+	if (last) redis_ippool_reserve_release(inst);
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_redis_ippool_t *inst = instance;
+
+	if (inst->reserve_pools) {
+		pthread_mutex_destroy(&inst->reserve_mutex);
+		talloc_free(inst->reserve_pools);
+	}
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -1356,9 +2453,13 @@ rad_module_t rlm_redis_ippool = {
 	.name		= "redis",
 	.type		= RLM_TYPE_THREAD_SAFE,
 	.inst_size	= sizeof(rlm_redis_ippool_t),
+	.thread_inst_size	= sizeof(rlm_redis_ippool_thread_t),
 	.config		= module_config,
 	.load		= mod_load,
 	.instantiate	= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.detach		= mod_detach,
+	.thread_detach	= mod_thread_detach,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_AUTHORIZE]		= mod_authorize,
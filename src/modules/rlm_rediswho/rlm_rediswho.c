@@ -35,6 +35,7 @@ RCSID("$Id$")
 
 #include "../rlm_redis/redis.h"
 #include "../rlm_redis/cluster.h"
+#include "../rlm_redis/pipeline.h"
 
 typedef struct rlm_rediswho {
 	fr_redis_conf_t		*conf;		//!< Connection parameters for the Redis server.
@@ -51,8 +52,41 @@ typedef struct rlm_rediswho {
 	char const		*insert;	//!< Command for inserting session data
 	char const		*trim;		//!< Command for trimming the session list.
 	char const		*expire;	//!< Command for expiring entries.
+
+	bool			pipeline;	//!< Issue commands asynchronously, batching them
+						//!< with those of other requests.
 } rlm_rediswho_t;
 
+typedef struct rlm_rediswho_thread {
+	fr_redis_pipeline_t	*pipeline;	//!< Async connections used by this thread.
+} rlm_rediswho_thread_t;
+
+typedef struct rlm_rediswho_rctx rlm_rediswho_rctx_t;
+
+/** A command issued by an accounting request using the pipeline
+ */
+typedef struct rlm_rediswho_slot {
+	rlm_rediswho_rctx_t	*rctx;		//!< Request context this command belongs to.
+	char const		*name;		//!< Of the command, for error messages.
+	fr_redis_pipeline_cmd_t	*cmd;		//!< Handle for the command.  NULL once complete.
+} rlm_rediswho_slot_t;
+
+/** State of an accounting request using the pipeline
+ */
+struct rlm_rediswho_rctx {
+	rlm_rediswho_t const	*inst;		//!< Module instance.
+	rlm_rediswho_thread_t	*thread;	//!< Pipeline to enqueue the trim command in.
+	REQUEST			*request;	//!< The accounting request.
+	char const		*trim;		//!< Command for trimming the session list.
+	rlm_rediswho_slot_t	*insert;	//!< Slot of the insert command.  NULL if there wasn't one.
+
+	bool			failed;		//!< Whether any command failed.
+
+	int			used;		//!< Slots used.
+	int			pending;	//!< Commands waiting for replies.
+	rlm_rediswho_slot_t	slot[3];	//!< Insert, expire and trim.
+};
+
 static CONF_PARSER section_config[] = {
 	{ FR_CONF_OFFSET("insert", PW_TYPE_STRING | PW_TYPE_REQUIRED | PW_TYPE_XLAT, rlm_rediswho_t, insert) },
 	{ FR_CONF_OFFSET("trim", PW_TYPE_STRING | PW_TYPE_XLAT, rlm_rediswho_t, trim) }, /* required only if trim_count > 0 */
@@ -64,6 +98,7 @@ static CONF_PARSER module_config[] = {
 	REDIS_COMMON_CONFIG,
 
 	{ FR_CONF_OFFSET("trim_count", PW_TYPE_SIGNED, rlm_rediswho_t, trim_count), .dflt = "-1" },
+	{ FR_CONF_OFFSET("pipeline", PW_TYPE_BOOLEAN, rlm_rediswho_t, pipeline), .dflt = "no" },
 
 	/*
 	 *	These all smash the same variables, because we don't care about them right now.
@@ -146,6 +181,183 @@ static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char c
 	return ret;
 }
 
+static int rediswho_pipeline_enqueue(rlm_rediswho_rctx_t *rctx, char const *name, char const *fmt);
+
+/** Record the result of a pipelined command, and resume the request once all commands are complete
+ *
+ * Whether the session list needs trimming depends on the result of the insert
+ * command, so the trim command is enqueued from here.  The request only yields
+ * once, for all of the commands.
+ */
+static void rediswho_pipeline_reply(REQUEST *request, fr_redis_rcode_t status, redisReply *reply, void *uctx)
+{
+	rlm_rediswho_slot_t	*slot = uctx;
+	rlm_rediswho_rctx_t	*rctx = slot->rctx;
+	rlm_rediswho_t const	*inst = rctx->inst;
+	int			ret = 0;
+
+	slot->cmd = NULL;
+
+	if (status != REDIS_RCODE_SUCCESS) {
+		RERROR("Failed running %s command", slot->name);
+		rctx->failed = true;
+	} else if (!rad_cond_assert(reply)) {
+		rctx->failed = true;
+	} else switch (reply->type) {
+	case REDIS_REPLY_INTEGER:
+		RDEBUG2("Query response %lld", reply->integer);
+		if (reply->integer > 0) ret = reply->integer;
+		break;
+
+	case REDIS_REPLY_STRING:
+		REDEBUG2("Query response %s", reply->str);
+		break;
+
+	default:
+		break;
+	}
+
+	/*
+	 *	Only trim if necessary.
+	 */
+	if (!rctx->failed && (slot == rctx->insert) && (inst->trim_count >= 0) && (ret > inst->trim_count)) {
+		if (rediswho_pipeline_enqueue(rctx, "trim", rctx->trim) < 0) rctx->failed = true;
+	}
+
+	if (--rctx->pending == 0) unlang_resumable(request);
+}
+
+/** Expand a command and enqueue it in the thread's pipeline
+ *
+ * @return
+ *	- 1 if the command was enqueued.
+ *	- 0 if there was no command to enqueue.
+ *	- -1 on error.
+ */
+static int rediswho_pipeline_enqueue(rlm_rediswho_rctx_t *rctx, char const *name, char const *fmt)
+{
+	REQUEST			*request = rctx->request;
+	rlm_rediswho_slot_t	*slot;
+
+	uint8_t	const		*key = NULL;
+	size_t			key_len = 0;
+
+	int			argc;
+	char const		*argv[MAX_REDIS_ARGS];
+	char			argv_buf[MAX_REDIS_COMMAND_LEN];
+
+	if (!fmt || !*fmt) return 0;
+
+	rad_assert(rctx->used < (int)(sizeof(rctx->slot) / sizeof(*rctx->slot)));
+
+	argc = rad_expand_xlat(request, fmt, MAX_REDIS_ARGS, argv, false, sizeof(argv_buf), argv_buf);
+	if (argc < 0) {
+		RERROR("Failed expanding %s command", name);
+		return -1;
+	}
+
+	if (argc > 1) {
+		key = (uint8_t const *)argv[1];
+		key_len = strlen((char const *)key);
+	}
+
+	/*
+	 *	Arguments are copied, so argv_buf may
+	 *	go out of scope.
+	 */
+	slot = &rctx->slot[rctx->used];
+	slot->rctx = rctx;
+	slot->name = name;
+	slot->cmd = fr_redis_pipeline_enqueue(rctx->thread->pipeline, request, key, key_len, false,
+					      argc, argv, NULL, rediswho_pipeline_reply, slot);
+	if (!slot->cmd) {
+		RERROR("Failed enqueueing %s command", name);
+		return -1;
+	}
+
+	rctx->used++;
+	rctx->pending++;
+
+	return 1;
+}
+
+/** Cancel any commands still pending, and free the request context
+ */
+static void rediswho_pipeline_cancel(rlm_rediswho_rctx_t *rctx)
+{
+	int i;
+
+	for (i = 0; i < rctx->used; i++) {
+		if (rctx->slot[i].cmd) fr_redis_pipeline_cancel(rctx->slot[i].cmd);
+	}
+	talloc_free(rctx);
+}
+
+/** Cancel any commands still pending if the request is stopped
+ */
+static void mod_accounting_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				  fr_state_action_t action)
+{
+	rlm_rediswho_rctx_t	*rctx = talloc_get_type_abort(ctx, rlm_rediswho_rctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending Redis commands");
+
+	rediswho_pipeline_cancel(rctx);
+}
+
+/** Called when all commands have completed
+ */
+static rlm_rcode_t mod_accounting_resume(UNUSED REQUEST *request, UNUSED void *instance, UNUSED void *thread,
+					 void *ctx)
+{
+	rlm_rediswho_rctx_t	*rctx = talloc_get_type_abort(ctx, rlm_rediswho_rctx_t);
+	bool			failed = rctx->failed;
+
+	rediswho_pipeline_cancel(rctx);
+
+	return failed ? RLM_MODULE_FAIL : RLM_MODULE_OK;
+}
+
+/** Start an accounting request using the pipeline
+ *
+ * The expire command doesn't depend on the result of the insert, so the two
+ * are pipelined together.  Commands for the same key go to the same node, on
+ * the same connection, so they're executed in order.
+ */
+static rlm_rcode_t mod_accounting_pipeline(rlm_rediswho_t const *inst, rlm_rediswho_thread_t *t, REQUEST *request,
+					   char const *insert,
+					   char const *trim,
+					   char const *expire)
+{
+	rlm_rediswho_rctx_t	*rctx;
+	int			ret;
+
+	MEM(rctx = talloc_zero(request, rlm_rediswho_rctx_t));
+	rctx->inst = inst;
+	rctx->thread = t;
+	rctx->request = request;
+	rctx->trim = trim;
+
+	ret = rediswho_pipeline_enqueue(rctx, "insert", insert);
+	if (ret < 0) {
+	fail:
+		rediswho_pipeline_cancel(rctx);
+		return RLM_MODULE_FAIL;
+	}
+	if (ret > 0) rctx->insert = &rctx->slot[0];
+
+	if (rediswho_pipeline_enqueue(rctx, "expire", expire) < 0) goto fail;
+
+	if (rctx->pending == 0) {
+		talloc_free(rctx);
+		return RLM_MODULE_OK;
+	}
+
+	return unlang_yield(request, mod_accounting_resume, mod_accounting_action, rctx);
+}
+
 static rlm_rcode_t mod_accounting_all(rlm_rediswho_t const *inst, REQUEST *request,
 				      char const *insert,
 				      char const *trim,
@@ -165,7 +377,7 @@ static rlm_rcode_t mod_accounting_all(rlm_rediswho_t const *inst, REQUEST *reque
 	return RLM_MODULE_OK;
 }
 
-static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rediswho_t const	*inst = instance;
 	rlm_rcode_t		rcode;
@@ -196,6 +408,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *
 	trim = cf_pair_value(cf_pair_find(cs, "trim"));
 	expire = cf_pair_value(cf_pair_find(cs, "expire"));
 
+	if (inst->pipeline) return mod_accounting_pipeline(inst, thread, request, insert, trim, expire);
+
 	rcode = mod_accounting_all(inst, request, insert, trim, expire);
 
 	return rcode;
@@ -222,6 +436,32 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_rediswho_t		*inst = instance;
+	rlm_rediswho_thread_t	*t = thread;
+
+	if (!inst->pipeline) return 0;
+
+	t->pipeline = fr_redis_pipeline_alloc(NULL, el, inst->cluster, inst->conf, inst->name);
+	if (!t->pipeline) {
+		ERROR("rlm_rediswho (%s) - Pipeline allocation failed", inst->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_rediswho_thread_t	*t = thread;
+
+	TALLOC_FREE(t->pipeline);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -239,6 +479,9 @@ rad_module_t rlm_rediswho = {
 	.load		= mod_load,
 	.instantiate	= mod_instantiate,
 	.bootstrap	= mod_bootstrap,
+	.thread_inst_size	= sizeof(rlm_rediswho_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting
 	},
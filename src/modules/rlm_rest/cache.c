@@ -0,0 +1,394 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_rest/cache.c
+ * @brief Cache responses from REST servers
+ *
+ * Responses are stored if the server indicates they may be, with a
+ * Cache-Control max-age (or s-maxage) directive, or an Expires header.
+ * They're indexed by a digest of everything which determines the
+ * response, the section, method, URI, credentials, headers and body.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+#include "rest.h"
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_PTHREAD_H
+#  define CACHE_LOCK(_cache)	if ((_cache)->shared) pthread_mutex_lock(&(_cache)->mutex)
+#  define CACHE_UNLOCK(_cache)	if ((_cache)->shared) pthread_mutex_unlock(&(_cache)->mutex)
+#else
+#  define CACHE_LOCK(_cache)
+#  define CACHE_UNLOCK(_cache)
+#endif
+
+/** A cached response
+ *
+ */
+typedef struct rest_cache_entry {
+	uint8_t			key[SHA1_DIGEST_LENGTH];	//!< Digest of the request.
+	uint32_t		hash;		//!< Of the key.
+
+	time_t			expires;	//!< When the response becomes stale.
+	int			code;		//!< HTTP status code.
+	http_body_type_t	type;		//!< Type of the body.
+	char			*body;		//!< Response body.
+	size_t			len;		//!< Length of the body.
+
+	struct rest_cache_entry	*prev;		//!< Towards the most recently used entry.
+	struct rest_cache_entry	*next;		//!< Towards the least recently used entry.
+} rest_cache_entry_t;
+
+struct rest_cache {
+	bool			shared;		//!< Whether the cache is used by multiple threads.
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;		//!< Protects everything below, if shared.
+#endif
+	fr_hash_table_t		*ht;		//!< Entries indexed by key.
+	rest_cache_entry_t	*head;		//!< Most recently used entry.
+	rest_cache_entry_t	*tail;		//!< Least recently used entry.
+	uint32_t		num;		//!< Number of entries in the cache.
+	uint32_t		max;		//!< Maximum number of entries in the cache.
+};
+
+static uint32_t rest_cache_entry_hash(void const *data)
+{
+	rest_cache_entry_t const *entry = data;
+
+	return entry->hash;
+}
+
+static int rest_cache_entry_cmp(void const *one, void const *two)
+{
+	rest_cache_entry_t const *a = one;
+	rest_cache_entry_t const *b = two;
+
+	return memcmp(a->key, b->key, sizeof(a->key));
+}
+
+static void rest_cache_entry_unlink(rest_cache_t *cache, rest_cache_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void rest_cache_entry_link_head(rest_cache_t *cache, rest_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head) cache->head->prev = entry;
+	cache->head = entry;
+	if (!cache->tail) cache->tail = entry;
+}
+
+static void rest_cache_entry_delete(rest_cache_t *cache, rest_cache_entry_t *entry)
+{
+	rest_cache_entry_unlink(cache, entry);
+	fr_hash_table_delete(cache->ht, entry);
+	cache->num--;
+	talloc_free(entry);
+}
+
+/** Add a string, and its terminator, to the digest
+ *
+ */
+static inline void rest_cache_key_add(fr_sha1_ctx *sha1, char const *str)
+{
+	if (!str) str = "";
+
+	fr_sha1_update(sha1, (uint8_t const *)str, strlen(str) + 1);
+}
+
+/** Calculate the key identifying a request
+ *
+ * @param[out] key		Where to write the digest.
+ * @param[in] section		configuration data.
+ * @param[in] request		Current request.
+ * @param[in] handle		configured for the request.
+ * @param[in] uri		the request will be sent to.
+ * @param[in] username		to use for HTTP authentication, may be NULL.
+ * @param[in] password		to use for HTTP authentication, may be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the request can't be cached.
+ */
+static int rest_cache_key(uint8_t key[SHA1_DIGEST_LENGTH], rlm_rest_section_t const *section, REQUEST *request,
+			  rlm_rest_handle_t *handle, char const *uri, char const *username, char const *password)
+{
+	rlm_rest_curl_context_t	*ctx = handle->ctx;
+	fr_sha1_ctx		sha1;
+	struct curl_slist	*header;
+	char			buffer[512];
+
+	/*
+	 *	Chunked bodies are never held in memory,
+	 *	so can't be part of the key.
+	 */
+	if ((section->chunk > 0) && (section->body != HTTP_BODY_NONE)) return -1;
+
+	fr_sha1_init(&sha1);
+
+	rest_cache_key_add(&sha1, section->name);
+	rest_cache_key_add(&sha1, (section->method == HTTP_METHOD_CUSTOM) ?
+			   section->method_str : fr_int2str(http_method_table, section->method, NULL));
+	rest_cache_key_add(&sha1, uri);
+
+	/*
+	 *	Credentials the same way rest_request_config
+	 *	determines them.
+	 */
+	if (section->auth != HTTP_AUTH_NONE) {
+		if (username) {
+			rest_cache_key_add(&sha1, username);
+		} else if (section->username) {
+			if (xlat_eval(buffer, sizeof(buffer), request, section->username, NULL, NULL) < 0) return -1;
+			rest_cache_key_add(&sha1, buffer);
+		}
+
+		if (password) {
+			rest_cache_key_add(&sha1, password);
+		} else if (section->password) {
+			if (xlat_eval(buffer, sizeof(buffer), request, section->password, NULL, NULL) < 0) return -1;
+			rest_cache_key_add(&sha1, buffer);
+		}
+	}
+
+	for (header = ctx->headers; header; header = header->next) rest_cache_key_add(&sha1, header->data);
+
+	rest_cache_key_add(&sha1, ctx->body);
+
+	fr_sha1_final(key, &sha1);
+
+	return 0;
+}
+
+/** Look for a cached response to a request
+ *
+ * If a fresh response is found, it's processed as if it had just been
+ * received, and the request needn't be sent.  Otherwise the handle is
+ * marked so that the response is stored by #rest_cache_store.
+ *
+ * @param[in] thread		Thread specific instance data.
+ * @param[in] section		configuration data.
+ * @param[in] request		Current request.
+ * @param[in] handle		configured for the request.
+ * @param[in] uri		the request will be sent to.
+ * @param[in] username		to use for HTTP authentication, may be NULL.
+ * @param[in] password		to use for HTTP authentication, may be NULL.
+ * @return
+ *	- 1 if a cached response was found.
+ *	- 0 if the request must be sent.
+ */
+int rest_cache_find(rlm_rest_thread_t *thread, rlm_rest_section_t const *section, REQUEST *request,
+		    void *handle, char const *uri, char const *username, char const *password)
+{
+	rlm_rest_handle_t	*randle = handle;
+	rlm_rest_curl_context_t	*ctx = randle->ctx;
+	rest_cache_t		*cache = thread->cache;
+	rest_cache_entry_t	my_entry, *entry;
+	time_t			now = time(NULL);
+	int			code = 0;
+	http_body_type_t	type = HTTP_BODY_NONE;
+	char			*body = NULL;
+	size_t			len = 0;
+	int			ret;
+
+	if (rest_cache_key(my_entry.key, section, request, randle, uri, username, password) < 0) {
+		RDEBUG3("Request can't be cached");
+		return 0;
+	}
+	my_entry.hash = fr_hash(my_entry.key, sizeof(my_entry.key));
+
+	CACHE_LOCK(cache);
+	entry = fr_hash_table_finddata(cache->ht, &my_entry);
+	if (entry && (entry->expires <= now)) {
+		rest_cache_entry_delete(cache, entry);
+		entry = NULL;
+	}
+	if (entry) {
+		if (entry != cache->head) {
+			rest_cache_entry_unlink(cache, entry);
+			rest_cache_entry_link_head(cache, entry);
+		}
+		code = entry->code;
+		type = entry->type;
+		len = entry->len;
+		if (len) body = talloc_memdup(request, entry->body, len);
+	}
+	CACHE_UNLOCK(cache);
+
+	if (!entry || (len && !body)) {
+		memcpy(ctx->cache_key, my_entry.key, sizeof(ctx->cache_key));
+		ctx->response.cache_max = thread->inst->cache_max_entry_size;
+		return 0;
+	}
+
+	RDEBUG2("Using cached response (%i)", code);
+
+	ret = rest_response_replay(request, randle, code, type, body, len);
+	talloc_free(body);
+	if (ret < 0) {
+		REDEBUG("Failed processing cached response");
+		return 0;
+	}
+
+	return 1;
+}
+
+/** Store a response in the cache, if it's cacheable
+ *
+ * @param[in] thread		Thread specific instance data.
+ * @param[in] request		Current request.
+ * @param[in] handle		the response was received on.
+ * @param[in] decoded		true if the response body was decoded successfully.
+ */
+void rest_cache_store(rlm_rest_thread_t *thread, REQUEST *request, void *handle, bool decoded)
+{
+	rlm_rest_handle_t	*randle = handle;
+	rlm_rest_curl_context_t	*ctx = randle->ctx;
+	rlm_rest_response_t	*response = &ctx->response;
+	rest_cache_t		*cache = thread->cache;
+	rest_cache_entry_t	*entry, *old;
+	time_t			now = time(NULL);
+	time_t			ttl;
+
+	if (!cache || !response->cache_max) return;
+	response->cache_max = 0;
+
+	/*
+	 *	Only successful responses we were able to use are
+	 *	stored, replaying an error or a body we failed to
+	 *	decode would just repeat the failure.
+	 */
+	if (!decoded || (response->code < 200) || (response->code >= 300)) return;
+
+	if (response->no_store) return;
+
+	if (response->max_age >= 0) {
+		ttl = response->max_age;
+	} else if (response->expires) {
+		ttl = response->expires - now;
+	} else {
+		return;
+	}
+	if (thread->inst->cache_max_ttl && (ttl > (time_t)thread->inst->cache_max_ttl)) {
+		ttl = thread->inst->cache_max_ttl;
+	}
+	if (ttl <= 0) return;
+
+	if (response->used > thread->inst->cache_max_entry_size) {
+		RDEBUG3("Response too large to cache");
+		return;
+	}
+
+	RDEBUG2("Caching response for %i seconds", (int)ttl);
+
+	CACHE_LOCK(cache);
+
+	entry = talloc_zero(cache->ht, rest_cache_entry_t);
+	if (!entry) goto done;
+
+	memcpy(entry->key, ctx->cache_key, sizeof(entry->key));
+	entry->hash = fr_hash(entry->key, sizeof(entry->key));
+	entry->expires = now + ttl;
+	entry->code = response->code;
+	entry->type = response->type;
+	entry->len = response->used;
+	if (entry->len) {
+		entry->body = talloc_memdup(entry, response->buffer, entry->len);
+		if (!entry->body) {
+			talloc_free(entry);
+			goto done;
+		}
+	}
+
+	/*
+	 *	Another request may have stored a response
+	 *	while ours was in progress.
+	 */
+	old = fr_hash_table_finddata(cache->ht, entry);
+	if (old) rest_cache_entry_delete(cache, old);
+
+	/*
+	 *	Evict the least recently used entry.
+	 */
+	if (cache->num >= cache->max) rest_cache_entry_delete(cache, cache->tail);
+
+	if (!fr_hash_table_insert(cache->ht, entry)) {
+		talloc_free(entry);
+		goto done;
+	}
+	rest_cache_entry_link_head(cache, entry);
+	cache->num++;
+
+done:
+	CACHE_UNLOCK(cache);
+}
+
+#ifdef HAVE_PTHREAD_H
+static int _rest_cache_free(rest_cache_t *cache)
+{
+	if (cache->shared) pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+#endif
+
+/** Allocate a response cache
+ *
+ * @param[in] ctx	to allocate the cache in.
+ * @param[in] max	number of responses to cache.
+ * @param[in] shared	whether the cache will be used by multiple threads.
+ * @return
+ *	- A new cache.
+ *	- NULL on error.
+ */
+rest_cache_t *rest_cache_alloc(TALLOC_CTX *ctx, uint32_t max, bool shared)
+{
+	rest_cache_t *cache;
+
+	MEM(cache = talloc_zero(ctx, rest_cache_t));
+	cache->max = max;
+	cache->shared = shared;
+	cache->ht = fr_hash_table_create(cache, rest_cache_entry_hash, rest_cache_entry_cmp, NULL);
+	if (!cache->ht) {
+		ERROR("Failed creating response cache");
+		talloc_free(cache);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	if (shared) {
+		pthread_mutex_init(&cache->mutex, NULL);
+		talloc_set_destructor(cache, _rest_cache_free);
+	}
+#endif
+
+	return cache;
+}
@@ -40,6 +40,285 @@ do {\
 	}\
 } while (0)
 
+#ifdef HAVE_PTHREAD_H
+#  define LATENCY_LOCK(_latency)	pthread_mutex_lock(&(_latency)->mutex)
+#  define LATENCY_UNLOCK(_latency)	pthread_mutex_unlock(&(_latency)->mutex)
+#else
+#  define LATENCY_LOCK(_latency)
+#  define LATENCY_UNLOCK(_latency)
+#endif
+
+/** Latency histogram for a single endpoint
+ *
+ */
+typedef struct {
+	char			*endpoint;	//!< scheme://host[:port] requests were sent to.
+	uint64_t		failed;		//!< Number of transfers which failed.
+	fr_hist_t		hist;		//!< Transfer times in microseconds.
+} rest_latency_entry_t;
+
+/** Latency histograms for a thread, or for a module instance
+ *
+ * Each thread records into its own set of histograms.  The instance's set
+ * links to those of the running threads, and holds the totals for threads
+ * which have exited.
+ */
+struct rest_latency {
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;		//!< Protects everything below.
+#endif
+	fr_hash_table_t		*ht;		//!< rest_latency_entry_t, keyed by endpoint.
+
+	rest_latency_t		*parent;	//!< Instance histograms, this thread's are merged into.
+	rest_latency_t		*threads;	//!< Histograms of the running threads.
+	rest_latency_t		*prev;		//!< Previous thread in the parent's list.
+	rest_latency_t		*next;		//!< Next thread in the parent's list.
+};
+
+static uint32_t _rest_latency_hash(void const *data)
+{
+	rest_latency_entry_t const *entry = data;
+
+	return fr_hash_string(entry->endpoint);
+}
+
+static int _rest_latency_cmp(void const *a, void const *b)
+{
+	rest_latency_entry_t const *my_a = a, *my_b = b;
+
+	return strcmp(my_a->endpoint, my_b->endpoint);
+}
+
+/** Find the histogram for an endpoint, creating it if it doesn't exist
+ *
+ * @note Must be called with the latency mutex held.
+ */
+static rest_latency_entry_t *_rest_latency_entry(rest_latency_t *latency, char const *endpoint)
+{
+	rest_latency_entry_t find, *entry;
+
+	memcpy(&find.endpoint, &endpoint, sizeof(find.endpoint));
+	entry = fr_hash_table_finddata(latency->ht, &find);
+	if (entry) return entry;
+
+	entry = talloc_zero(latency->ht, rest_latency_entry_t);
+	if (!entry) return NULL;
+	entry->endpoint = talloc_strdup(entry, endpoint);
+	if (!fr_hash_table_insert(latency->ht, entry)) {
+		talloc_free(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+/** Add the histograms in one table to another
+ *
+ */
+static int _rest_latency_merge(void *ctx, void *data)
+{
+	rest_latency_t		*out = ctx;
+	rest_latency_entry_t	*in = data, *entry;
+
+	entry = _rest_latency_entry(out, in->endpoint);
+	if (!entry) return -1;
+
+	entry->failed += in->failed;
+	fr_hist_merge(&entry->hist, &in->hist);
+
+	return 0;
+}
+
+/** Merge a thread's histograms into the instance's when the thread exits
+ *
+ */
+static int _rest_latency_free(rest_latency_t *latency)
+{
+	rest_latency_t *parent = latency->parent;
+
+	if (parent) {
+		LATENCY_LOCK(parent);
+		if (latency->prev) {
+			latency->prev->next = latency->next;
+		} else {
+			parent->threads = latency->next;
+		}
+		if (latency->next) latency->next->prev = latency->prev;
+
+		(void) fr_hash_table_walk(latency->ht, _rest_latency_merge, parent);
+		LATENCY_UNLOCK(parent);
+	}
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_destroy(&latency->mutex);
+#endif
+
+	return 0;
+}
+
+/** Allocate a set of latency histograms
+ *
+ * @param[in] ctx	to allocate the histograms in.
+ * @param[in] parent	the instance's histograms, if these are for a thread.
+ *			Thread histograms are included in the output of
+ *			#rest_latency_print, and are added to the parent's
+ *			when they're freed.
+ * @return
+ *	- New latency histograms.
+ *	- NULL on error.
+ */
+rest_latency_t *rest_latency_alloc(TALLOC_CTX *ctx, rest_latency_t *parent)
+{
+	rest_latency_t *latency;
+
+	MEM(latency = talloc_zero(ctx, rest_latency_t));
+	latency->ht = fr_hash_table_create(latency, _rest_latency_hash, _rest_latency_cmp, NULL);
+	if (!latency->ht) {
+		ERROR("Failed creating latency table");
+		talloc_free(latency);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&latency->mutex, NULL);
+#endif
+	talloc_set_destructor(latency, _rest_latency_free);
+
+	if (parent) {
+		LATENCY_LOCK(parent);
+		latency->parent = parent;
+		latency->next = parent->threads;
+		if (latency->next) latency->next->prev = latency;
+		parent->threads = latency;
+		LATENCY_UNLOCK(parent);
+	}
+
+	return latency;
+}
+
+typedef struct {
+	module_stats_print_t	print;
+	void			*uctx;
+} rest_latency_print_ctx_t;
+
+static int _rest_latency_print(void *ctx, void *data)
+{
+	rest_latency_print_ctx_t	*print_ctx = ctx;
+	rest_latency_entry_t		*entry = data;
+	fr_hist_t const			*hist = &entry->hist;
+	unsigned int			i;
+
+#define PRINT(_fmt, ...) print_ctx->print(print_ctx->uctx, "%s." _fmt "\n", entry->endpoint, ## __VA_ARGS__)
+	PRINT("transfers\t%" PRIu64, hist->count);
+	PRINT("failed\t%" PRIu64, entry->failed);
+	if (!hist->count) return 0;
+
+	PRINT("latency_us.mean\t%" PRIu64, hist->sum / hist->count);
+	PRINT("latency_us.p50\t%" PRIu64, fr_hist_percentile(hist, 500));
+	PRINT("latency_us.p90\t%" PRIu64, fr_hist_percentile(hist, 900));
+	PRINT("latency_us.p99\t%" PRIu64, fr_hist_percentile(hist, 990));
+	PRINT("latency_us.p999\t%" PRIu64, fr_hist_percentile(hist, 999));
+	PRINT("latency_us.max\t%" PRIu64, hist->max);
+
+	for (i = 0; i < FR_HIST_BUCKETS; i++) {
+		if (!hist->bucket[i]) continue;
+
+		PRINT("latency_us.le.%" PRIu64 "\t%" PRIu64, fr_hist_bucket_max(i), hist->bucket[i]);
+	}
+#undef PRINT
+
+	return 0;
+}
+
+/** Print the latency histograms for each endpoint, totalled over all threads
+ *
+ * Each line is prefixed with the endpoint, i.e. scheme://host[:port].
+ *
+ * @param[in] latency	the instance's histograms.
+ * @param[in] print	function to write each line with.
+ * @param[in] uctx	to pass to print.
+ */
+void rest_latency_print(rest_latency_t *latency, module_stats_print_t print, void *uctx)
+{
+	rest_latency_t			*total, *thread;
+	rest_latency_print_ctx_t	print_ctx = { .print = print, .uctx = uctx };
+
+	total = rest_latency_alloc(NULL, NULL);
+	if (!total) return;
+
+	/*
+	 *	Threads only hold their own lock when
+	 *	recording, so this doesn't stop them
+	 *	for long.
+	 */
+	LATENCY_LOCK(latency);
+	(void) fr_hash_table_walk(latency->ht, _rest_latency_merge, total);
+	for (thread = latency->threads; thread; thread = thread->next) {
+		LATENCY_LOCK(thread);
+		(void) fr_hash_table_walk(thread->ht, _rest_latency_merge, total);
+		LATENCY_UNLOCK(thread);
+	}
+	LATENCY_UNLOCK(latency);
+
+	(void) fr_hash_table_walk(total->ht, _rest_latency_print, &print_ctx);
+
+	talloc_free(total);
+}
+
+/** Record how long a transfer took, in the histogram for the endpoint it was sent to
+ *
+ * Endpoints are identified by the scheme, host and port of the effective URL,
+ * so all transfers which could share a connection are grouped together.
+ *
+ * @param[in] thread	the transfer completed in.
+ * @param[in] candle	of the completed transfer.
+ * @param[in] result	of the transfer.
+ */
+static void _rest_io_latency_record(rlm_rest_thread_t *thread, CURL *candle, CURLcode result)
+{
+	char const		*url = NULL, *p, *q, *at;
+	uint64_t		usec;
+	rest_latency_entry_t	*entry;
+	char			buffer[256];
+#if LIBCURL_VERSION_NUM >= 0x073d00
+	curl_off_t		total;
+
+	if (curl_easy_getinfo(candle, CURLINFO_TOTAL_TIME_T, &total) != CURLE_OK) return;
+	usec = (total < 0) ? 0 : (uint64_t)total;
+#else
+	double			total;
+
+	if (curl_easy_getinfo(candle, CURLINFO_TOTAL_TIME, &total) != CURLE_OK) return;
+	usec = (total < 0) ? 0 : (uint64_t)(total * 1000000);
+#endif
+
+	if ((curl_easy_getinfo(candle, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK) || !url) return;
+
+	/*
+	 *	Trim the URL down to scheme://host[:port], skipping
+	 *	over any credentials.
+	 */
+	p = strstr(url, "://");
+	p = p ? p + 3 : url;
+	q = p + strcspn(p, "/?#");
+	at = memchr(p, '@', q - p);
+	if (at) {
+		snprintf(buffer, sizeof(buffer), "%.*s%.*s", (int)(p - url), url, (int)(q - (at + 1)), at + 1);
+	} else {
+		snprintf(buffer, sizeof(buffer), "%.*s", (int)(q - url), url);
+	}
+
+	LATENCY_LOCK(thread->latency);
+	entry = _rest_latency_entry(thread->latency, buffer);
+	if (entry) {
+		fr_hist_add(&entry->hist, usec);
+		if (result != CURLE_OK) entry->failed++;
+	}
+	LATENCY_UNLOCK(thread->latency);
+
+	DEBUG3("Transfer to %s took %" PRIu64 " us", buffer, usec);
+}
+
 /** De-queue curl requests and wake up the requests that initiated them
  *
  * @param[in] thread	holding the requests to re-enliven.
@@ -69,6 +348,8 @@ static inline void _rest_io_demux(rlm_rest_thread_t *thread, CURLM *mandle)
 
 			VERIFY_REQUEST(request);
 
+			if (thread->latency) _rest_io_latency_record(thread, candle, m->data.result);
+
 			/*
 			 *	If the request failed, say why...
 			 */
@@ -420,6 +701,35 @@ int rest_io_init(rlm_rest_thread_t *thread)
 	SET_OPTION(CURLMOPT_SOCKETFUNCTION, _rest_io_event_modify);
 	SET_OPTION(CURLMOPT_SOCKETDATA, thread);
 
+	/*
+	 *	Connections are cached by the multi-handle, so are
+	 *	shared by all the easy handles in this thread's pool.
+	 *	With HTTP/2, many transfers to the same endpoint may
+	 *	be in progress on a single connection.
+	 */
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	SET_OPTION(CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	SET_OPTION(CURLMOPT_MAX_HOST_CONNECTIONS, (long)thread->inst->max_host_connections);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x074300
+	/*
+	 *	The library we're running with may be older
+	 *	than the headers we were built against.
+	 */
+	ret = curl_multi_setopt(mandle, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)thread->inst->max_streams);
+	if (ret != CURLM_OK) {
+		WARN("Failed setting max_streams, using libcurl's default: %s (%i)",
+		     curl_multi_strerror(ret), ret);
+	}
+#endif
+
+	if (thread->inst->latency) {
+		thread->latency = rest_latency_alloc(thread, thread->inst->latency);
+		if (!thread->latency) return -1;
+	}
+
 	return 0;
 
 error:
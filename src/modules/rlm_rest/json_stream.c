@@ -0,0 +1,818 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Incremental decoder for JSON responses.
+ * @file rlm_rest/json_stream.c
+ *
+ * Attribute declarations are built as their tokens are received, so
+ * neither the complete body nor a json-c object tree is ever held in
+ * memory.  It has no dependencies on json-c or libcurl.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <ctype.h>
+
+#include "json_stream.h"
+
+/** Append data to a JSON buffer
+ *
+ * @param[in] ctx to allocate the buffer in.
+ * @param[in] b buffer to append to.
+ * @param[in] in data to append.
+ * @param[in] inlen length of data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int json_buff_append(TALLOC_CTX *ctx, json_buff_t *b, char const *in, size_t inlen)
+{
+	if ((b->len + inlen + 1) > b->alloc) {
+		size_t	alloc = b->alloc ? b->alloc : 64;
+		char	*buff;
+
+		while (alloc < (b->len + inlen + 1)) alloc *= 2;
+
+		buff = talloc_realloc(ctx, b->buff, char, alloc);
+		if (!buff) return -1;
+
+		b->buff = buff;
+		b->alloc = alloc;
+	}
+
+	memcpy(b->buff + b->len, in, inlen);
+	b->len += inlen;
+	b->buff[b->len] = '\0';
+
+	return 0;
+}
+
+/** Mark the JSON data as malformed
+ *
+ * @param[in] s decoder state.
+ * @param[in] error describing what was wrong.
+ */
+static void json_stream_error(json_stream_t *s, char const *error)
+{
+	s->error = error;
+	s->state = JSON_STREAM_ERROR;
+}
+
+/** Append to the current token
+ *
+ * @param[in] s decoder state.
+ * @param[in] in data to append.
+ * @param[in] inlen length of data.
+ */
+static void json_stream_token_append(json_stream_t *s, char const *in, size_t inlen)
+{
+	if (json_buff_append(s, &s->token, in, inlen) < 0) json_stream_error(s, "out of memory");
+}
+
+/** Write a code point to the current token as UTF-8
+ *
+ * Any high surrogate still waiting for its pair is written as U+FFFD first.
+ *
+ * @param[in] s decoder state.
+ * @param[in] cp code point to write.
+ */
+static void json_stream_utf8_append(json_stream_t *s, uint32_t cp)
+{
+	char	buff[4];
+	size_t	len;
+
+	if (cp < 0x80) {
+		buff[0] = cp;
+		len = 1;
+	} else if (cp < 0x800) {
+		buff[0] = 0xc0 | (cp >> 6);
+		buff[1] = 0x80 | (cp & 0x3f);
+		len = 2;
+	} else if (cp < 0x10000) {
+		buff[0] = 0xe0 | (cp >> 12);
+		buff[1] = 0x80 | ((cp >> 6) & 0x3f);
+		buff[2] = 0x80 | (cp & 0x3f);
+		len = 3;
+	} else {
+		buff[0] = 0xf0 | (cp >> 18);
+		buff[1] = 0x80 | ((cp >> 12) & 0x3f);
+		buff[2] = 0x80 | ((cp >> 6) & 0x3f);
+		buff[3] = 0x80 | (cp & 0x3f);
+		len = 4;
+	}
+
+	json_stream_token_append(s, buff, len);
+}
+
+/** Write any high surrogate still waiting for its pair as U+FFFD
+ *
+ * @param[in] s decoder state.
+ */
+static inline void json_stream_surrogate_flush(json_stream_t *s)
+{
+	if (!s->surrogate) return;
+
+	s->surrogate = 0;
+	json_stream_utf8_append(s, 0xfffd);
+}
+
+/** Decode a complete \uXXXX escape sequence
+ *
+ * @param[in] s decoder state.
+ */
+static void json_stream_unicode(json_stream_t *s)
+{
+	uint32_t cp = s->unicode;
+
+	if ((cp >= 0xd800) && (cp < 0xdc00)) {
+		json_stream_surrogate_flush(s);
+		s->surrogate = cp;
+		return;
+	}
+
+	if ((cp >= 0xdc00) && (cp < 0xe000)) {
+		if (!s->surrogate) {
+			json_stream_utf8_append(s, 0xfffd);
+			return;
+		}
+		cp = 0x10000 + ((s->surrogate - 0xd800) << 10) + (cp - 0xdc00);
+		s->surrogate = 0;
+	} else {
+		json_stream_surrogate_flush(s);
+	}
+
+	json_stream_utf8_append(s, cp);
+}
+
+/** Start capturing the raw text of a container
+ *
+ * @param[in] s decoder state.
+ * @param[in] which capture to start.
+ * @param[in] c which opens the container.
+ */
+static void json_stream_capture_start(json_stream_t *s, json_capture_t which, char c)
+{
+	s->capture[which].len = 0;
+	s->capture_depth[which] = s->depth + 1;
+
+	if (json_buff_append(s, &s->capture[which], &c, 1) < 0) json_stream_error(s, "out of memory");
+}
+
+/** Add a value to the attribute declaration being received
+ *
+ * Values past max_values are discarded, as they'd never be converted
+ * to VALUE_PAIRs.
+ *
+ * @param[in] s decoder state.
+ * @param[in] type of value.
+ * @param[in] str text of the value, will be stolen.
+ * @param[in] len of str.
+ */
+static void json_stream_value_add(json_stream_t *s, json_value_type_t type, char *str, size_t len)
+{
+	json_attr_t	*attr = s->attr;
+	json_value_t	*value;
+
+	if (s->values >= s->max_values) {
+		talloc_free(str);
+		return;
+	}
+
+	value = talloc_zero(attr, json_value_t);
+	if (!value) {
+		talloc_free(str);
+		json_stream_error(s, "out of memory");
+		return;
+	}
+	value->type = type;
+	value->str = talloc_steal(value, str);
+	value->len = len;
+
+	*attr->tail = value;
+	attr->tail = &value->next;
+	s->values++;
+}
+
+/** Where a value being received is, relative to the attribute declarations
+ *
+ */
+typedef enum {
+	JSON_POS_IGNORE = 0,			//!< Not a value we're interested in.
+	JSON_POS_ROOT,				//!< The root object.
+	JSON_POS_ATTR,				//!< Value of an attribute declaration.
+	JSON_POS_FLAG,				//!< Value of a key in the expanded syntax.
+	JSON_POS_VALUE,				//!< Value of the "value" key in the expanded syntax.
+	JSON_POS_ELEMENT			//!< Element of an array of values.
+} json_pos_t;
+
+/** Determine where a value being received is
+ *
+ * @param[in] s decoder state.
+ * @return position of the value.
+ */
+static json_pos_t json_stream_pos(json_stream_t const *s)
+{
+	json_attr_t const *attr = s->attr;
+
+	switch (s->depth) {
+	case 0:
+		return JSON_POS_ROOT;
+
+	case 1:
+		return attr ? JSON_POS_ATTR : JSON_POS_IGNORE;
+
+	case 2:
+		if (!attr) return JSON_POS_IGNORE;
+		if (s->stack[1] == '[') {
+			if (attr->is_json_set && attr->flags.is_json) return JSON_POS_IGNORE;
+			return JSON_POS_ELEMENT;
+		}
+		return (s->key == JSON_KEY_VALUE) ? JSON_POS_VALUE : JSON_POS_FLAG;
+
+	case 3:
+		if (attr && (s->stack[1] == '{') && (s->stack[2] == '[') && (s->key == JSON_KEY_VALUE)) {
+			if (attr->is_json_set && attr->flags.is_json) return JSON_POS_IGNORE;
+			return JSON_POS_ELEMENT;
+		}
+		return JSON_POS_IGNORE;
+
+	default:
+		return JSON_POS_IGNORE;
+	}
+}
+
+/** Evaluate a scalar as a boolean, the same way json-c does
+ *
+ * @param[in] type of the scalar.
+ * @param[in] str text of the scalar.
+ * @param[in] len of str.
+ * @return the boolean value.
+ */
+static int json_stream_boolean(json_value_type_t type, char const *str, size_t len)
+{
+	switch (type) {
+	case JSON_VALUE_INT:
+	case JSON_VALUE_DOUBLE:
+		return strtod(str, NULL) != 0;
+
+	case JSON_VALUE_STRING:
+		return len != 0;
+
+	case JSON_VALUE_RAW:
+		return strcmp(str, "true") == 0;
+
+	default:
+		return 0;
+	}
+}
+
+/** Process an object key
+ *
+ * Keys of the root object start a new attribute declaration, keys of
+ * an expanded declaration select which flag, or the value, follows.
+ *
+ * @param[in] s decoder state.
+ */
+static void json_stream_key(json_stream_t *s)
+{
+	json_attr_t	*attr;
+	char const	*key = s->token.buff ? s->token.buff : "";
+
+	switch (s->depth) {
+	case 1:
+		s->attr = NULL;
+		s->key = JSON_KEY_OTHER;
+
+		if (s->values >= s->max_values) return;
+
+		attr = talloc_zero(s, json_attr_t);
+		if (!attr) {
+		oom:
+			json_stream_error(s, "out of memory");
+			return;
+		}
+		attr->name = talloc_bstrndup(attr, key, s->token.len);
+		if (!attr->name) goto oom;
+		attr->flags.op = T_OP_SET;
+		attr->flags.do_xlat = 1;
+		attr->tail = &attr->head;
+
+		*s->tail = attr;
+		s->tail = &attr->next;
+		s->attr = attr;
+		return;
+
+	case 2:
+		if (!s->attr || (s->stack[1] != '{')) return;
+
+		if (strcmp(key, "op") == 0) {
+			s->key = JSON_KEY_OP;
+		} else if (strcmp(key, "do_xlat") == 0) {
+			s->key = JSON_KEY_DO_XLAT;
+		} else if (strcmp(key, "is_json") == 0) {
+			s->key = JSON_KEY_IS_JSON;
+		} else if (strcmp(key, "value") == 0) {
+			s->key = JSON_KEY_VALUE;
+		} else {
+			s->key = JSON_KEY_OTHER;
+		}
+		return;
+
+	default:
+		return;
+	}
+}
+
+/** Process a complete scalar value
+ *
+ * @param[in] s decoder state.
+ * @param[in] type of the scalar.
+ */
+static void json_stream_scalar(json_stream_t *s, json_value_type_t type)
+{
+	json_attr_t	*attr = s->attr;
+	char const	*str = s->token.buff ? s->token.buff : "";
+	char		*value;
+
+	if ((type == JSON_VALUE_INT) || (type == JSON_VALUE_DOUBLE)) {
+		char *end;
+
+		strtod(str, &end);
+		if ((s->token.len == 0) || (end != (str + s->token.len))) {
+			json_stream_error(s, "invalid number");
+			return;
+		}
+	}
+
+	switch (json_stream_pos(s)) {
+	case JSON_POS_ROOT:
+		json_stream_error(s, "expected JSON object");
+		return;
+
+	case JSON_POS_ATTR:
+	case JSON_POS_VALUE:
+		attr->has_value = true;
+		/* FALL-THROUGH */
+
+	case JSON_POS_ELEMENT:
+		value = talloc_bstrndup(NULL, str, s->token.len);
+		if (!value) {
+			json_stream_error(s, "out of memory");
+			return;
+		}
+		json_stream_value_add(s, type, value, s->token.len);
+		return;
+
+	case JSON_POS_FLAG:
+		switch (s->key) {
+		case JSON_KEY_OP:
+			talloc_free(attr->op_str);
+			attr->op_str = talloc_bstrndup(attr, str, s->token.len);
+			if (!attr->op_str) json_stream_error(s, "out of memory");
+			return;
+
+		case JSON_KEY_DO_XLAT:
+			attr->flags.do_xlat = json_stream_boolean(type, str, s->token.len);
+			return;
+
+		case JSON_KEY_IS_JSON:
+			attr->flags.is_json = json_stream_boolean(type, str, s->token.len);
+			if (!attr->has_value) attr->is_json_set = true;
+			return;
+
+		default:
+			return;
+		}
+
+	default:
+		return;
+	}
+}
+
+/** Process the start of an object or array
+ *
+ * @param[in] s decoder state.
+ * @param[in] c '{' or '['.
+ */
+static void json_stream_open(json_stream_t *s, char c)
+{
+	json_attr_t *attr = s->attr;
+
+	switch (json_stream_pos(s)) {
+	case JSON_POS_ROOT:
+		if (c != '{') {
+			json_stream_error(s, "expected JSON object");
+			return;
+		}
+		break;
+
+	/*
+	 *	An object is the expanded syntax, an array is
+	 *	multiple values.
+	 */
+	case JSON_POS_ATTR:
+		if (c == '{') {
+			attr->expanded = true;
+			s->key = JSON_KEY_OTHER;
+			break;
+		}
+		attr->has_value = true;
+		attr->is_array = true;
+		break;
+
+	/*
+	 *	Keep the JSON text of the value in case is_json
+	 *	is set, unless we already know it isn't.
+	 */
+	case JSON_POS_VALUE:
+		attr->has_value = true;
+		if (c == '{') {
+			attr->is_object = true;
+		} else {
+			attr->is_array = true;
+		}
+		if (!attr->is_json_set || attr->flags.is_json) json_stream_capture_start(s, JSON_CAPTURE_VALUE, c);
+		break;
+
+	case JSON_POS_ELEMENT:
+		json_stream_capture_start(s, JSON_CAPTURE_ELEMENT, c);
+		break;
+
+	default:
+		break;
+	}
+
+	if (s->depth >= REST_JSON_MAX_DEPTH) {
+		json_stream_error(s, "too many nested containers");
+		return;
+	}
+	s->stack[s->depth++] = c;
+}
+
+/** Process the end of an object or array
+ *
+ * @param[in] s decoder state.
+ * @param[in] c '}' or ']'.
+ */
+static void json_stream_close(json_stream_t *s, char c)
+{
+	int i;
+
+	if ((s->depth == 0) || (s->stack[s->depth - 1] != ((c == '}') ? '{' : '['))) {
+		json_stream_error(s, "mismatched brackets");
+		return;
+	}
+
+	for (i = 0; i < JSON_CAPTURE_MAX; i++) {
+		json_buff_t	*b = &s->capture[i];
+		char		*raw;
+		size_t		len;
+
+		if (s->capture_depth[i] != s->depth) continue;
+		s->capture_depth[i] = 0;
+
+		if (json_buff_append(s, b, &c, 1) < 0) {
+			json_stream_error(s, "out of memory");
+			return;
+		}
+
+		raw = b->buff;
+		len = b->len;
+		memset(b, 0, sizeof(*b));
+
+		if (i == JSON_CAPTURE_VALUE) {
+			s->attr->raw = talloc_steal(s->attr, raw);
+			s->attr->raw_len = len;
+		} else {
+			json_stream_value_add(s, (c == '}') ? JSON_VALUE_OBJECT : JSON_VALUE_RAW, raw, len);
+		}
+	}
+
+	s->depth--;
+}
+
+/** Process a single character of JSON data
+ *
+ * @param[in] s decoder state.
+ * @param[in] c character to process.
+ * @return
+ *	- true if c was consumed.
+ *	- false if c terminated a number or literal, and must be processed again.
+ */
+static bool json_stream_step(json_stream_t *s, char c)
+{
+	switch (s->state) {
+	case JSON_STREAM_VALUE_OR_END:
+		if (c == ']') goto close;
+		/* FALL-THROUGH */
+
+	case JSON_STREAM_VALUE:
+		if (isspace((uint8_t) c)) return true;
+
+		switch (c) {
+		case '{':
+			json_stream_open(s, c);
+			if (s->state != JSON_STREAM_ERROR) s->state = JSON_STREAM_KEY_OR_END;
+			return true;
+
+		case '[':
+			json_stream_open(s, c);
+			if (s->state != JSON_STREAM_ERROR) s->state = JSON_STREAM_VALUE_OR_END;
+			return true;
+
+		case '"':
+			s->token.len = 0;
+			s->in_key = false;
+			s->state = JSON_STREAM_STRING;
+			return true;
+
+		case '-':
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			s->token.len = 0;
+			s->state = JSON_STREAM_NUMBER;
+			json_stream_token_append(s, &c, 1);
+			return true;
+
+		case 't':
+		case 'f':
+		case 'n':
+			s->token.len = 0;
+			s->state = JSON_STREAM_LITERAL;
+			json_stream_token_append(s, &c, 1);
+			return true;
+
+		default:
+			json_stream_error(s, "unexpected character");
+			return true;
+		}
+
+	case JSON_STREAM_KEY_OR_END:
+		if (c == '}') goto close;
+		/* FALL-THROUGH */
+
+	case JSON_STREAM_KEY:
+		if (isspace((uint8_t) c)) return true;
+
+		if (c != '"') {
+			json_stream_error(s, "expected object key");
+			return true;
+		}
+		s->token.len = 0;
+		s->in_key = true;
+		s->state = JSON_STREAM_STRING;
+		return true;
+
+	case JSON_STREAM_COLON:
+		if (isspace((uint8_t) c)) return true;
+
+		if (c != ':') {
+			json_stream_error(s, "expected ':'");
+			return true;
+		}
+		s->state = JSON_STREAM_VALUE;
+		return true;
+
+	case JSON_STREAM_AFTER_VALUE:
+		if (isspace((uint8_t) c)) return true;
+
+		switch (c) {
+		case ',':
+			s->state = (s->stack[s->depth - 1] == '{') ? JSON_STREAM_KEY : JSON_STREAM_VALUE;
+			return true;
+
+		case '}':
+		case ']':
+			goto close;
+
+		default:
+			json_stream_error(s, "expected ',' or end of container");
+			return true;
+		}
+
+	case JSON_STREAM_STRING:
+		switch (c) {
+		case '"':
+			json_stream_surrogate_flush(s);
+			if (s->in_key) {
+				json_stream_key(s);
+				if (s->state != JSON_STREAM_ERROR) s->state = JSON_STREAM_COLON;
+			} else {
+				json_stream_scalar(s, JSON_VALUE_STRING);
+				if (s->state != JSON_STREAM_ERROR) s->state = JSON_STREAM_AFTER_VALUE;
+			}
+			return true;
+
+		case '\\':
+			s->state = JSON_STREAM_STRING_ESCAPE;
+			return true;
+
+		default:
+			if ((uint8_t) c < 0x20) {
+				json_stream_error(s, "control character in string");
+				return true;
+			}
+			json_stream_surrogate_flush(s);
+			json_stream_token_append(s, &c, 1);
+			return true;
+		}
+
+	case JSON_STREAM_STRING_ESCAPE:
+	{
+		char unescaped;
+
+		switch (c) {
+		case '"':
+		case '\\':
+		case '/':
+			unescaped = c;
+			break;
+
+		case 'b':
+			unescaped = '\b';
+			break;
+
+		case 'f':
+			unescaped = '\f';
+			break;
+
+		case 'n':
+			unescaped = '\n';
+			break;
+
+		case 'r':
+			unescaped = '\r';
+			break;
+
+		case 't':
+			unescaped = '\t';
+			break;
+
+		case 'u':
+			s->unicode = 0;
+			s->hex = 0;
+			s->state = JSON_STREAM_STRING_UNICODE;
+			return true;
+
+		default:
+			json_stream_error(s, "invalid escape sequence");
+			return true;
+		}
+
+		json_stream_surrogate_flush(s);
+		json_stream_token_append(s, &unescaped, 1);
+		if (s->state != JSON_STREAM_ERROR) s->state = JSON_STREAM_STRING;
+		return true;
+	}
+
+	case JSON_STREAM_STRING_UNICODE:
+		if (!isxdigit((uint8_t) c)) {
+			json_stream_error(s, "invalid escape sequence");
+			return true;
+		}
+		s->unicode <<= 4;
+		if (isdigit((uint8_t) c)) {
+			s->unicode |= c - '0';
+		} else {
+			s->unicode |= tolower((uint8_t) c) - 'a' + 10;
+		}
+		if (++s->hex < 4) return true;
+
+		json_stream_unicode(s);
+		if (s->state != JSON_STREAM_ERROR) s->state = JSON_STREAM_STRING;
+		return true;
+
+	case JSON_STREAM_NUMBER:
+		if (isdigit((uint8_t) c) || (c == '.') || (c == 'e') || (c == 'E') || (c == '+') || (c == '-')) {
+			json_stream_token_append(s, &c, 1);
+			return true;
+		}
+
+		json_stream_scalar(s, strpbrk(s->token.buff, ".eE") ? JSON_VALUE_DOUBLE : JSON_VALUE_INT);
+		if (s->state != JSON_STREAM_ERROR) s->state = JSON_STREAM_AFTER_VALUE;
+		return false;
+
+	case JSON_STREAM_LITERAL:
+		if (islower((uint8_t) c)) {
+			json_stream_token_append(s, &c, 1);
+			return true;
+		}
+
+		if (strcmp(s->token.buff, "null") == 0) {
+			json_stream_scalar(s, JSON_VALUE_NULL);
+		} else if ((strcmp(s->token.buff, "true") == 0) || (strcmp(s->token.buff, "false") == 0)) {
+			json_stream_scalar(s, JSON_VALUE_RAW);
+		} else {
+			json_stream_error(s, "invalid literal");
+			return true;
+		}
+		if (s->state != JSON_STREAM_ERROR) s->state = JSON_STREAM_AFTER_VALUE;
+		return false;
+
+	case JSON_STREAM_DONE:
+		if (isspace((uint8_t) c)) return true;
+
+		json_stream_error(s, "data after end of root object");
+		return true;
+
+	case JSON_STREAM_ERROR:
+		return true;
+	}
+
+	return true;
+
+close:
+	json_stream_close(s, c);
+	if (s->state == JSON_STREAM_ERROR) return true;
+
+	s->state = s->depth ? JSON_STREAM_AFTER_VALUE : JSON_STREAM_DONE;
+	return true;
+}
+
+/** Feed JSON data to an incremental decoder
+ *
+ * @param[in] s decoder state.
+ * @param[in] data received.
+ * @param[in] len of data.
+ */
+void json_stream_parse(json_stream_t *s, char const *data, size_t len)
+{
+	char const	*p = data, *end = data + len, *q;
+	bool		capturing[JSON_CAPTURE_MAX];
+	int		i;
+
+	while ((p < end) && (s->state != JSON_STREAM_ERROR)) {
+		/*
+		 *	Copy runs of plain characters inside strings
+		 *	in one go.
+		 */
+		if ((s->state == JSON_STREAM_STRING) && !s->surrogate) {
+			for (q = p; (q < end) && (*q != '"') && (*q != '\\') && ((uint8_t) *q >= 0x20); q++);
+			if (q > p) {
+				json_stream_token_append(s, p, q - p);
+				for (i = 0; i < JSON_CAPTURE_MAX; i++) {
+					if (!s->capture_depth[i]) continue;
+					if (json_buff_append(s, &s->capture[i], p, q - p) < 0) {
+						json_stream_error(s, "out of memory");
+					}
+				}
+				p = q;
+				continue;
+			}
+		}
+
+		for (i = 0; i < JSON_CAPTURE_MAX; i++) capturing[i] = (s->capture_depth[i] != 0);
+
+		if (!json_stream_step(s, *p)) continue;
+
+		/*
+		 *	Characters which open and close a captured
+		 *	container are added by json_stream_open and
+		 *	json_stream_close.
+		 */
+		for (i = 0; i < JSON_CAPTURE_MAX; i++) {
+			if (!capturing[i] || !s->capture_depth[i]) continue;
+			if (json_buff_append(s, &s->capture[i], p, 1) < 0) json_stream_error(s, "out of memory");
+		}
+		p++;
+	}
+}
+
+/** Allocate an incremental JSON decoder
+ *
+ * @param[in] ctx to allocate the decoder in.
+ * @param[in] max_values to keep.  Values past this are discarded.
+ * @return
+ *	- New decoder.
+ *	- NULL on failure.
+ */
+json_stream_t *json_stream_alloc(TALLOC_CTX *ctx, unsigned int max_values)
+{
+	json_stream_t *s;
+
+	s = talloc_zero(ctx, json_stream_t);
+	if (!s) return NULL;
+
+	s->state = JSON_STREAM_VALUE;
+	s->tail = &s->head;
+	s->max_values = max_values;
+
+	return s;
+}
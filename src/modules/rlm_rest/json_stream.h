@@ -0,0 +1,175 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _REST_JSON_STREAM_H
+#define _REST_JSON_STREAM_H
+/**
+ * $Id$
+ *
+ * @brief Incremental decoder for JSON responses.
+ * @file rlm_rest/json_stream.h
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(json_stream_h, "$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+/** Flags to control the conversion of JSON values to VALUE_PAIRs.
+ *
+ * These fields are set when parsing the expanded format for value pairs in
+ * JSON, and control how json_pair_make_leaf and json_pair_make convert the JSON
+ * value, and move the new VALUE_PAIR into an attribute list.
+ *
+ * @see json_pair_make
+ * @see json_pair_make_leaf
+ */
+typedef struct json_flags {
+	int do_xlat;		//!< If true value will be expanded with xlat.
+	int is_json;		//!< If true value will be inserted as raw JSON
+				// (multiple values not supported).
+	FR_TOKEN op;		//!< The operator that determines how the new VP
+				// is processed. @see fr_tokens_table
+} json_flags_t;
+
+/** Maximum nesting depth of containers in a JSON response
+ *
+ */
+#define REST_JSON_MAX_DEPTH	32
+
+/** States of the incremental JSON parser
+ *
+ */
+typedef enum {
+	JSON_STREAM_VALUE = 0,			//!< Expecting a value.
+	JSON_STREAM_VALUE_OR_END,		//!< After '[', expecting a value or ']'.
+	JSON_STREAM_KEY_OR_END,			//!< After '{', expecting a key or '}'.
+	JSON_STREAM_KEY,			//!< After ',' in an object, expecting a key.
+	JSON_STREAM_COLON,			//!< After a key, expecting ':'.
+	JSON_STREAM_AFTER_VALUE,		//!< Expecting ',' or the end of the container.
+	JSON_STREAM_STRING,			//!< Inside a string.
+	JSON_STREAM_STRING_ESCAPE,		//!< After '\' inside a string.
+	JSON_STREAM_STRING_UNICODE,		//!< Inside a \uXXXX escape sequence.
+	JSON_STREAM_NUMBER,			//!< Inside a number.
+	JSON_STREAM_LITERAL,			//!< Inside true, false or null.
+	JSON_STREAM_DONE,			//!< Root object has been closed.
+	JSON_STREAM_ERROR			//!< Data was malformed, ignore the rest.
+} json_stream_state_t;
+
+/** Keys in the expanded attribute syntax
+ *
+ */
+typedef enum {
+	JSON_KEY_OTHER = 0,			//!< Unknown key, value is ignored.
+	JSON_KEY_OP,				//!< "op"
+	JSON_KEY_DO_XLAT,			//!< "do_xlat"
+	JSON_KEY_IS_JSON,			//!< "is_json"
+	JSON_KEY_VALUE				//!< "value"
+} json_key_t;
+
+/** Captures of raw JSON text
+ *
+ */
+typedef enum {
+	JSON_CAPTURE_VALUE = 0,			//!< The complete value of an attribute, for is_json.
+	JSON_CAPTURE_ELEMENT,			//!< A container inside an array of values.
+	JSON_CAPTURE_MAX
+} json_capture_t;
+
+/** Type of a value received in a JSON response
+ *
+ */
+typedef enum {
+	JSON_VALUE_NULL = 0,			//!< null, ignored.
+	JSON_VALUE_INT,				//!< Number without a fraction or exponent.
+	JSON_VALUE_DOUBLE,			//!< Number with a fraction or exponent.
+	JSON_VALUE_STRING,			//!< String, with escape sequences decoded.
+	JSON_VALUE_RAW,				//!< Boolean or array, as JSON text.
+	JSON_VALUE_OBJECT			//!< Object, as JSON text.
+} json_value_type_t;
+
+/** Growable buffer for tokens and captured JSON text
+ *
+ */
+typedef struct json_buff {
+	char			*buff;		//!< \0 terminated text.
+	size_t			len;		//!< Length of text in buff.
+	size_t			alloc;		//!< Space allocated for buff.
+} json_buff_t;
+
+/** A value received in a JSON response
+ *
+ */
+typedef struct json_value {
+	json_value_type_t	type;		//!< What kind of value this is.
+	char			*str;		//!< Text of the value.
+	size_t			len;		//!< Length of str.
+	struct json_value	*next;		//!< Next value of the attribute.
+} json_value_t;
+
+/** An attribute declaration received in a JSON response
+ *
+ */
+typedef struct json_attr {
+	char			*name;		//!< Attribute reference.
+	json_flags_t		flags;		//!< Flags from the expanded syntax.
+	char			*op_str;	//!< Operator, if one was specified.
+	bool			expanded;	//!< Declaration used the expanded syntax.
+	bool			is_json_set;	//!< is_json was specified before the value.
+	bool			has_value;	//!< Declaration had a value.
+	bool			is_array;	//!< Value was an array.
+	bool			is_object;	//!< Value was an object.
+	char			*raw;		//!< Array or object value as JSON text.
+	size_t			raw_len;	//!< Length of raw.
+	json_value_t		*head;		//!< First value.
+	json_value_t		**tail;		//!< Where to add the next value.
+	struct json_attr	*next;		//!< Next attribute declaration.
+} json_attr_t;
+
+/** Incremental JSON decoder
+ *
+ * Fed data by rest_response_body as it arrives.  Attribute declarations
+ * are built as their tokens are received, so neither the complete body
+ * nor a json-c object tree is ever held in memory.
+ */
+typedef struct json_stream {
+	json_stream_state_t	state;		//!< Current parser state.
+	char const		*error;		//!< Why the data was malformed.
+
+	char			stack[REST_JSON_MAX_DEPTH];	//!< '{' or '[' for each open container.
+	unsigned int		depth;		//!< Number of open containers.
+
+	json_buff_t		token;		//!< String, number or literal being received.
+	bool			in_key;		//!< String being received is an object key.
+	uint32_t		unicode;	//!< Code point of a \uXXXX escape sequence.
+	uint32_t		surrogate;	//!< High surrogate waiting for its pair.
+	int			hex;		//!< Number of hex digits received.
+
+	json_attr_t		*attr;		//!< Attribute declaration being received.
+	json_key_t		key;		//!< Key of the expanded syntax we're in.
+	json_attr_t		*head;		//!< First attribute declaration.
+	json_attr_t		**tail;		//!< Where to add the next attribute declaration.
+	unsigned int		values;		//!< Number of values received.
+	unsigned int		max_values;	//!< Values past this are discarded, as they'd never
+						//!< be converted to VALUE_PAIRs.
+
+	json_buff_t		capture[JSON_CAPTURE_MAX];	//!< Raw JSON text being captured.
+	unsigned int		capture_depth[JSON_CAPTURE_MAX];	//!< Depth of the captured container,
+									//!< 0 if not capturing.
+} json_stream_t;
+
+json_stream_t	*json_stream_alloc(TALLOC_CTX *ctx, unsigned int max_values);
+void		json_stream_parse(json_stream_t *s, char const *data, size_t len);
+#endif /* _REST_JSON_STREAM_H */
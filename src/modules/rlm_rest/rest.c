@@ -38,6 +38,7 @@ RCSID("$Id$")
 #include <freeradius-devel/connection.h>
 
 #include "rest.h"
+#include "json_stream.h"
 
 /** Table of encoder/decoder support.
  *
@@ -212,6 +213,30 @@ const FR_NAME_NUMBER http_content_type_table[] = {
 	{  NULL , -1 }
 };
 
+/** Conversion table for http_version config values.
+ *
+ * Maps the versions of HTTP we allow to be configured to libcurl's
+ * CURL_HTTP_VERSION_* values.
+ *
+ * @see fr_str2int
+ */
+const FR_NAME_NUMBER http_version_table[] = {
+	{ "default",				CURL_HTTP_VERSION_NONE	},
+	{ "1.0",				CURL_HTTP_VERSION_1_0	},
+	{ "1.1",				CURL_HTTP_VERSION_1_1	},
+#if LIBCURL_VERSION_NUM >= 0x072100
+	{ "2",					CURL_HTTP_VERSION_2_0	},
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072f00
+	{ "2-tls",				CURL_HTTP_VERSION_2TLS	},
+#endif
+#if LIBCURL_VERSION_NUM >= 0x073100
+	{ "2-prior-knowledge",			CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE },
+#endif
+
+	{  NULL , -1 }
+};
+
 /*
  *	Encoder specific structures.
  *	@todo split encoders/decoders into submodules.
@@ -222,25 +247,6 @@ typedef struct rest_custom_data {
 	size_t		len;	//!< Length of data
 } rest_custom_data_t;
 
-#ifdef HAVE_JSON
-/** Flags to control the conversion of JSON values to VALUE_PAIRs.
- *
- * These fields are set when parsing the expanded format for value pairs in
- * JSON, and control how json_pair_make_leaf and json_pair_make convert the JSON
- * value, and move the new VALUE_PAIR into an attribute list.
- *
- * @see json_pair_make
- * @see json_pair_make_leaf
- */
-typedef struct json_flags {
-	int do_xlat;		//!< If true value will be expanded with xlat.
-	int is_json;		//!< If true value will be inserted as raw JSON
-				// (multiple values not supported).
-	FR_TOKEN op;		//!< The operator that determines how the new VP
-				// is processed. @see fr_tokens_table
-} json_flags_t;
-#endif
-
 /** Frees a libcurl handle, and any additional memory used by context data.
  *
  * @param[in] randle rlm_rest_handle_t to close and free.
@@ -872,7 +878,7 @@ static int rest_decode_post(UNUSED rlm_rest_t const *instance, UNUSED rlm_rest_s
 }
 
 #ifdef HAVE_JSON
-/** Converts JSON "value" key into VALUE_PAIR.
+/** Converts a JSON value into a VALUE_PAIR.
  *
  * If leaf is not in fact a leaf node, but contains JSON data, the data will
  * written to the attribute in JSON string format.
@@ -884,24 +890,24 @@ static int rest_decode_post(UNUSED rlm_rest_t const *instance, UNUSED rlm_rest_s
  * @param[in] da Attribute to create.
  * @param[in] flags containing the operator other flags controlling value
  *	expansion.
- * @param[in] leaf object containing the VALUE_PAIR value.
+ * @param[in] leaf containing the VALUE_PAIR value.
  * @return
  *	- #VALUE_PAIR just created.
  *	- NULL on error.
  */
 static VALUE_PAIR *json_pair_make_leaf(UNUSED rlm_rest_t const *instance, UNUSED rlm_rest_section_t const *section,
 				      TALLOC_CTX *ctx, REQUEST *request,
-				      fr_dict_attr_t const *da, json_flags_t *flags, json_object *leaf)
+				      fr_dict_attr_t const *da, json_flags_t *flags, json_value_t const *leaf)
 {
-	char const	*value;
 	char		*expanded = NULL;
 	int 		ret;
+	long long	num;
 
 	VALUE_PAIR	*vp;
 
 	value_box_t	src;
 
-	if (fr_json_object_is_type(leaf, json_type_null)) {
+	if (leaf->type == JSON_VALUE_NULL) {
 		RDEBUG3("Got null value for attribute \"%s\", skipping...", da->name);
 		return NULL;
 	}
@@ -909,35 +915,45 @@ static VALUE_PAIR *json_pair_make_leaf(UNUSED rlm_rest_t const *instance, UNUSED
 	vp = fr_pair_afrom_da(ctx, da);
 	if (!vp) {
 		RWDEBUG("Failed creating valuepair for attribute \"%s\", skipping...", da->name);
-		talloc_free(expanded);
 
 		return NULL;
 	}
 
 	memset(&src, 0, sizeof(src));
 
-	switch (json_object_get_type(leaf)) {
-	case json_type_int:
+	switch (leaf->type) {
+	case JSON_VALUE_INT:
 		if (flags->do_xlat) RWDEBUG("Ignoring do_xlat on 'int', attribute \"%s\"", da->name);
-		src.datum.sinteger = json_object_get_int(leaf);
+
+		/*
+		 *	Clamp to the range of a signed 32bit integer,
+		 *	as json-c does.
+		 */
+		num = strtoll(leaf->str, NULL, 10);
+		if (num > INT32_MAX) num = INT32_MAX;
+		if (num < INT32_MIN) num = INT32_MIN;
+
+		src.datum.sinteger = num;
 		src.type = PW_TYPE_SIGNED;
 		break;
 
-	case json_type_double:
+	case JSON_VALUE_DOUBLE:
 		if (flags->do_xlat) RWDEBUG("Ignoring do_xlat on 'double', attribute \"%s\"", da->name);
-		src.datum.decimal = json_object_get_double(leaf);
+		src.datum.decimal = strtod(leaf->str, NULL);
 		src.type = PW_TYPE_DECIMAL;
 		break;
 
-	case json_type_string:
-		value = json_object_get_string(leaf);
+	case JSON_VALUE_STRING:
 		if (flags->do_xlat) {
-			if (xlat_aeval(request, &expanded, request, value, NULL, NULL) < 0) return NULL;
+			if (xlat_aeval(request, &expanded, request, leaf->str, NULL, NULL) < 0) {
+				talloc_free(vp);
+				return NULL;
+			}
 			src.datum.strvalue = expanded;
 			src.length = talloc_array_length(src.datum.strvalue) - 1;
 		} else {
-			src.datum.strvalue = value;
-			src.length = json_object_get_string_len(leaf);
+			src.datum.strvalue = leaf->str;
+			src.length = leaf->len;
 		}
 		src.type = PW_TYPE_STRING;
 
@@ -947,18 +963,13 @@ static VALUE_PAIR *json_pair_make_leaf(UNUSED rlm_rest_t const *instance, UNUSED
 		if (flags->do_xlat) RWDEBUG("Ignoring do_xlat on 'object', attribute \"%s\"", da->name);
 
 		/*
-		 *	Should encode any nested JSON structures into JSON strings.
+		 *	Nested JSON structures are inserted as JSON strings.
 		 *
 		 *	"I knew you liked JSON so I put JSON in your JSON!"
 		 */
-		src.datum.strvalue = json_object_get_string(leaf);
-		if (!src.datum.strvalue) {
-			RWDEBUG("Failed getting string value for attribute \"%s\", skipping...", da->name);
-
-			return NULL;
-		}
+		src.datum.strvalue = leaf->str;
 		src.type = PW_TYPE_STRING;
-		src.length = strlen(src.datum.strvalue);
+		src.length = leaf->len;
 	}
 
 	ret = value_box_cast(vp, &vp->data, da->type, da, &src);
@@ -974,11 +985,10 @@ static VALUE_PAIR *json_pair_make_leaf(UNUSED rlm_rest_t const *instance, UNUSED
 	return vp;
 }
 
-/** Processes JSON response and converts it into multiple VALUE_PAIRs
+/** Converts attribute declarations from a JSON response into VALUE_PAIRs
  *
- * Processes JSON attribute declarations in the format below. Will recurse when
- * processing nested attributes. When processing nested attributes flags and
- * operators from previous attributes are not inherited.
+ * Processes JSON attribute declarations in the format below. Flags and
+ * operators are not inherited between attribute declarations.
  *
  * JSON response format is:
 @verbatim
@@ -1018,8 +1028,7 @@ static VALUE_PAIR *json_pair_make_leaf(UNUSED rlm_rest_t const *instance, UNUSED
  * @param[in] instance configuration data.
  * @param[in] section configuration data.
  * @param[in] request Current request.
- * @param[in] object containing root node, or parent node.
- * @param[in] level Current nesting level.
+ * @param[in] head of the list of attribute declarations.
  * @param[in] max counter, decremented after each VALUE_PAIR is created,
  * 	      when 0 no more attributes will be processed.
  * @return
@@ -1027,48 +1036,30 @@ static VALUE_PAIR *json_pair_make_leaf(UNUSED rlm_rest_t const *instance, UNUSED
  *	- < 0 on error.
  */
 static int json_pair_make(rlm_rest_t const *instance, rlm_rest_section_t const *section,
-			 REQUEST *request, json_object *object, UNUSED int level, int max)
+			  REQUEST *request, json_attr_t const *head, int max)
 {
-	int max_attrs = max;
-	vp_tmpl_t *dst = NULL;
-
-	if (!fr_json_object_is_type(object, json_type_object)) {
-#ifdef HAVE_JSON_TYPE_TO_NAME
-		REDEBUG("Can't process VP container, expected JSON object"
-			"got \"%s\", skipping...",
-			json_type_to_name(json_object_get_type(object)));
-#else
-		REDEBUG("Can't process VP container, expected JSON object"
-			", skipping...");
-#endif
-		return -1;
-	}
+	int			max_attrs = max;
+	vp_tmpl_t		*dst = NULL;
+	json_attr_t const	*attr;
 
-	/*
-	 *	Process VP container
-	 */
-	json_object_object_foreach(object, name, value) {
-		int i = 0, elements;
-		struct json_object *element, *tmp;
-		TALLOC_CTX *ctx;
-
-		json_flags_t flags = {
-			.op = T_OP_SET,
-			.do_xlat = 1,
-			.is_json = 0
-		};
+	for (attr = head; attr; attr = attr->next) {
+		int		i = 0;
+		json_value_t	raw;
+		json_value_t	const *value;
+		TALLOC_CTX	*ctx;
+		json_flags_t	flags = attr->flags;
 
-		REQUEST *current = request;
-		VALUE_PAIR **vps, *vp = NULL;
+		REQUEST		*current = request;
+		VALUE_PAIR	**vps, *vp = NULL;
 
 		TALLOC_FREE(dst);
 
 		/*
 		 *  Resolve attribute name to a dictionary entry and pairlist.
 		 */
-		RDEBUG2("Parsing attribute \"%s\"", name);
+		RDEBUG2("Parsing attribute \"%s\"", attr->name);
 
-		if (tmpl_afrom_attr_str(request, &dst, name, REQUEST_CURRENT, PAIR_LIST_REPLY, false, false) <= 0) {
+		if (tmpl_afrom_attr_str(request, &dst, attr->name, REQUEST_CURRENT, PAIR_LIST_REPLY, false, false) <= 0) {
 			RWDEBUG("Failed parsing attribute: %s, skipping...", fr_strerror());
 			continue;
 		}
@@ -1086,79 +1077,58 @@ static int json_pair_make(rlm_rest_t const *instance, rlm_rest_section_t const *
 		ctx = radius_list_ctx(current, dst->tmpl_list);
 
 		/*
-		 *  Alternative JSON structure which allows operator,
-		 *  and other flags to be specified.
-		 *
-		 *	"<name>":{
-		 *		"do_xlat":<bool>,
-		 *		"is_json":<bool>,
-		 *		"op":"<op>",
-		 *		"value":<value>
-		 *	}
-		 *
-		 *	Where value is a:
-		 *	  - []	Multivalued array
-		 *	  - {}	Nested Valuepair
-		 *	  - *	Integer or string value
+		 *  Process operator if present.
 		 */
-		if (fr_json_object_is_type(value, json_type_object)) {
-			/*
-			 *  Process operator if present.
-			 */
-			if (json_object_object_get_ex(value, "op", &tmp)) {
-				flags.op = fr_str2int(fr_tokens_table, json_object_get_string(tmp), 0);
-				if (!flags.op) {
-					RWDEBUG("Invalid operator value \"%s\", skipping...",
-						json_object_get_string(tmp));
-					continue;
-				}
-			}
-
-			/*
-			 *  Process optional do_xlat bool.
-			 */
-			if (json_object_object_get_ex(value, "do_xlat", &tmp)) {
-				flags.do_xlat = json_object_get_boolean(tmp);
-			}
-
-			/*
-			 *  Process optional is_json bool.
-			 */
-			if (json_object_object_get_ex(value, "is_json", &tmp)) {
-				flags.is_json = json_object_get_boolean(tmp);
-			}
-
-			/*
-			 *  Value key must be present if were using the expanded syntax.
-			 */
-			if (!json_object_object_get_ex(value, "value", &tmp)) {
-				RWDEBUG("Value key missing, skipping...");
+		if (attr->op_str) {
+			flags.op = fr_str2int(fr_tokens_table, attr->op_str, 0);
+			if (!flags.op) {
+				RWDEBUG("Invalid operator value \"%s\", skipping...", attr->op_str);
 				continue;
 			}
 		}
 
 		/*
-		 *  Setup fr_pair_make / recursion loop.
+		 *  Value key must be present if were using the expanded syntax.
 		 */
-		if (!flags.is_json && fr_json_object_is_type(value, json_type_array)) {
-			elements = json_object_array_length(value);
-			if (!elements) {
-				RWDEBUG("Zero length value array, skipping...");
-				continue;
+		if (!attr->has_value) {
+			RWDEBUG("Value key missing, skipping...");
+			continue;
+		}
+
+		/*
+		 *  Arrays and objects are inserted as JSON strings
+		 *  if is_json is set.
+		 */
+		if (flags.is_json && attr->raw) {
+			memset(&raw, 0, sizeof(raw));
+			raw.type = JSON_VALUE_RAW;
+			raw.str = attr->raw;
+			raw.len = attr->raw_len;
+			value = &raw;
+		} else if (attr->is_object) {
+			if (max_attrs-- <= 0) {
+				RWDEBUG("At maximum attribute limit");
+				break;
 			}
-			element = json_object_array_get_idx(value, 0);
+
+			/* TODO: Insert nested VP into VP structure...*/
+			RWDEBUG("Found nested VP, these are not yet supported, skipping...");
+			continue;
+		} else if (!attr->head) {
+			if (attr->is_array) RWDEBUG("Zero length value array, skipping...");
+			continue;
 		} else {
-			elements = 1;
-			element = value;
+			value = attr->head;
 		}
 
 		/*
 		 *  A JSON 'value' key, may have multiple elements, iterate
 		 *  over each of them, creating a new VALUE_PAIR.
 		 */
-		do {
+		for (; value; value = value->next, i++) {
 			if (max_attrs-- <= 0) {
 				RWDEBUG("At maximum attribute limit");
+				talloc_free(dst);
 				return max;
 			}
 
@@ -1169,28 +1139,18 @@ static int json_pair_make(rlm_rest_t const *instance, rlm_rest_section_t const *
 				flags.op = T_OP_ADD;
 			}
 
-			if (fr_json_object_is_type(element, json_type_object) && !flags.is_json) {
+			if (value->type == JSON_VALUE_OBJECT) {
 				/* TODO: Insert nested VP into VP structure...*/
 				RWDEBUG("Found nested VP, these are not yet supported, skipping...");
-
 				continue;
-
-				/*
-				vp = json_pair_make(instance, section,
-						   request, value,
-						   level + 1, max_attrs);*/
-			} else {
-				vp = json_pair_make_leaf(instance, section, ctx, request,
-							 dst->tmpl_da, &flags, element);
-				if (!vp) continue;
 			}
+
+			vp = json_pair_make_leaf(instance, section, ctx, request, dst->tmpl_da, &flags, value);
+			if (!vp) continue;
+
 			rdebug_pair(2, request, vp, NULL);
 			radius_pairmove(current, vps, vp, false);
-		/*
-		 *  If we call json_object_array_get_idx on something that's not an array
-		 *  the behaviour appears to be to occasionally segfault.
-		 */
-		} while ((++i < elements) && (element = json_object_array_get_idx(value, i)));
+		}
 	}
 
 	talloc_free(dst);
@@ -1200,10 +1160,9 @@ static int json_pair_make(rlm_rest_t const *instance, rlm_rest_section_t const *
 
 /** Converts JSON response into VALUE_PAIRs and adds them to the request.
  *
- * Converts the raw JSON string into a json-c object tree and passes it to
- * json_pair_make. After the tree has been parsed json_object_put is called
- * which decrements the reference count of the root node by one, and frees
- * the entire tree.
+ * The response was parsed incrementally by json_stream_parse as it was
+ * received.  The attribute declarations it produced are passed to
+ * json_pair_make.
  *
  * @see rest_encode_json
  * @see json_pair_make
@@ -1212,43 +1171,76 @@ static int json_pair_make(rlm_rest_t const *instance, rlm_rest_section_t const *
  * @param[in] section configuration data.
  * @param[in,out] request Current request.
  * @param[in] handle REST handle.
- * @param[in] raw buffer containing JSON data.
+ * @param[in] raw buffer containing the start of the JSON data.
  * @param[in] rawlen Length of data in raw buffer.
  * @return
  *	- The number of #VALUE_PAIR processed.
  *	- -1 on unrecoverable error.
  */
 static int rest_decode_json(rlm_rest_t const *instance, rlm_rest_section_t const *section,
-			    REQUEST *request, UNUSED void *handle, char *raw, UNUSED size_t rawlen)
+			    REQUEST *request, void *handle, char *raw, UNUSED size_t rawlen)
 {
-	char const *p = raw;
-
-	struct json_object *json;
-
-	int ret;
+	rlm_rest_curl_context_t	*ctx = ((rlm_rest_handle_t *)handle)->ctx;
+	json_stream_t		*s = ctx->response.decoder;
 
 	/*
 	 *  Empty response?
 	 */
-	while (isspace(*p)) p++;
-	if (*p == '\0') return 0;
+	if (!s || ((s->state == JSON_STREAM_VALUE) && (s->depth == 0))) return 0;
 
-	json = json_tokener_parse(p);
-	if (!json) {
-		REDEBUG("Malformed JSON data \"%s\"", raw);
+	if (s->state != JSON_STREAM_DONE) {
+		REDEBUG("Malformed JSON data (%s) \"%s\"", s->error ? s->error : "truncated", raw);
 		return -1;
 	}
 
-	ret = json_pair_make(instance, section, request, json, 0, REST_BODY_MAX_ATTRS);
+	return json_pair_make(instance, section, request, s->head, REST_BODY_MAX_ATTRS);
+}
+#endif
 
-	/*
-	 *  Decrement reference count for root object, should free entire JSON tree.
-	 */
-	json_object_put(json);
+/** Processes the directives of a Cache-Control header
+ *
+ * Records whether the response may be stored, and for how long.
+ *
+ * @param[in] ctx response context.
+ * @param[in] p start of the header value.
+ * @param[in] len of the header value.
+ */
+static void rest_response_cache_control(rlm_rest_response_t *ctx, char const *p, size_t len)
+{
+	char const	*end = p + len, *q;
+	size_t		dlen;
 
-	return ret;
+	while (p < end) {
+		while ((p < end) && (isspace(*p) || (*p == ','))) p++;
+
+		for (q = p; (q < end) && (*q != ',') && (*q != '\r') && (*q != '\n'); q++);
+		dlen = q - p;
+		while ((dlen > 0) && isspace(p[dlen - 1])) dlen--;
+
+		/*
+		 *  Cached responses are replayed for any user, so
+		 *  private responses are treated the same as no-store.
+		 */
+		if (((dlen == 8) && (strncasecmp(p, "no-store", 8) == 0)) ||
+		    ((dlen == 8) && (strncasecmp(p, "no-cache", 8) == 0)) ||
+		    ((dlen == 7) && (strncasecmp(p, "private", 7) == 0)) ||
+		    ((dlen > 8) && (strncasecmp(p, "private=", 8) == 0))) {
+			ctx->no_store = true;
+
+		/*
+		 *  s-maxage is for shared caches, so overrides max-age.
+		 */
+		} else if ((dlen > 9) && (strncasecmp(p, "s-maxage=", 9) == 0)) {
+			ctx->max_age = atoi(p + 9);
+
+		} else if ((dlen > 8) && (strncasecmp(p, "max-age=", 8) == 0)) {
+			if (ctx->max_age < 0) ctx->max_age = atoi(p + 8);
+		}
+
+		p = q;
+		if ((p < end) && ((*p == '\r') || (*p == '\n'))) break;
+	}
 }
-#endif
 
 /** Processes incoming HTTP header data from libcurl.
  *
@@ -1290,6 +1282,10 @@ static size_t rest_response_header(void *in, size_t size, size_t nmemb, void *us
 	case WRITE_STATE_INIT:
 		RDEBUG2("Processing response header");
 
+		ctx->max_age = -1;
+		ctx->expires = 0;
+		ctx->no_store = false;
+
 		/*
 		 *  HTTP/<version> <reason_code>[ <reason_phrase>]\r\n
 		 *
@@ -1425,6 +1421,32 @@ static size_t rest_response_header(void *in, size_t size, size_t nmemb, void *us
 					break;
 				}
 			}
+		} else if ((s >= 14) &&
+			   (strncasecmp("Cache-Control:", p, 14) == 0)) {
+			rest_response_cache_control(ctx, p + 14, s - 14);
+		} else if ((s >= 8) &&
+			   (strncasecmp("Expires:", p, 8) == 0)) {
+			char	buffer[64];
+			time_t	when;
+
+			p += 8;
+			s -= 8;
+			while ((s > 0) && isspace(*p)) {
+				p++;
+				s--;
+			}
+
+			q = memchr(p, '\r', s);
+			len = !q ? s : (size_t) (q - p);
+			if (len >= sizeof(buffer)) len = sizeof(buffer) - 1;
+			memcpy(buffer, p, len);
+			buffer[len] = '\0';
+
+			/*
+			 *  Invalid dates mean the response has already expired.
+			 */
+			when = curl_getdate(buffer, NULL);
+			ctx->expires = (when > 0) ? when : 1;
 		}
 		break;
 
@@ -1457,10 +1479,36 @@ malformed:
 	return (t - s);
 }
 
+/** Appends incoming HTTP body data to the response buffer
+ *
+ * @param[in] ctx response context to append data to.
+ * @param[in] p data to append.
+ * @param[in] t length of data.
+ */
+static void rest_response_buffer(rlm_rest_response_t *ctx, char const *p, size_t t)
+{
+	char *tmp;
+
+	if (t > (ctx->alloc - ctx->used)) {
+		ctx->alloc += ((t + 1) > REST_BODY_INIT) ? t + 1 : REST_BODY_INIT;
+
+		tmp = ctx->buffer;
+		ctx->buffer = talloc_array(NULL, char, ctx->alloc);
+		/* If data has been written previously */
+		if (tmp) {
+			strlcpy(ctx->buffer, tmp, (ctx->used + 1));
+			talloc_free(tmp);
+		}
+	}
+	strlcpy(ctx->buffer + ctx->used, p, t + 1);
+	ctx->used += t;
+}
+
 /** Processes incoming HTTP body data from libcurl.
  *
  * Writes incoming body data to an intermediary buffer for later parsing by
- * one of the decode functions.
+ * one of the decode functions.  JSON data is instead passed straight to the
+ * incremental JSON decoder.
  *
  * @param[in] ptr Char buffer where inbound header data is written
  * @param[in] size Multiply by nmemb to get the length of ptr.
@@ -1476,7 +1524,6 @@ static size_t rest_response_body(void *ptr, size_t size, size_t nmemb, void *use
 	REQUEST *request = ctx->request; /* Used by RDEBUG */
 
 	char const *p = ptr, *q;
-	char *tmp;
 
 	size_t const t = (size * nmemb);
 
@@ -1512,21 +1559,41 @@ static size_t rest_response_body(void *ptr, size_t size, size_t nmemb, void *use
 
 		return t;
 
-	default:
-		if (t > (ctx->alloc - ctx->used)) {
-			ctx->alloc += ((t + 1) > REST_BODY_INIT) ? t + 1 : REST_BODY_INIT;
-
-			tmp = ctx->buffer;
-			ctx->buffer = talloc_array(NULL, char, ctx->alloc);
-			/* If data has been written previously */
-			if (tmp) {
-				strlcpy(ctx->buffer, tmp, (ctx->used + 1));
-				talloc_free(tmp);
+#ifdef HAVE_JSON
+	/*
+	 *  JSON is decoded as it arrives.  Unless the caller wants
+	 *  the raw body, only the start of the body is kept, so it
+	 *  can be printed if there's an error.
+	 */
+	case HTTP_BODY_JSON:
+		if (!ctx->decoder) {
+			ctx->decoder = json_stream_alloc(NULL, REST_BODY_MAX_ATTRS);
+			if (!ctx->decoder) {
+				REDEBUG("Failed allocating JSON decoder");
+				return 0;
 			}
 		}
-		strlcpy(ctx->buffer + ctx->used, p, t + 1);
-		ctx->used += t;
+		json_stream_parse(ctx->decoder, p, t);
 
+		if (ctx->keep_body) {
+			rest_response_buffer(ctx, p, t);
+			break;
+		}
+
+		/*
+		 *  If the response may be cached, keep enough to
+		 *  know whether it was too large.
+		 */
+		{
+			size_t max = (ctx->cache_max >= REST_BODY_MAX_LEN) ? ctx->cache_max + 1 : REST_BODY_MAX_LEN;
+
+			if (ctx->used < max) rest_response_buffer(ctx, p, ((max - ctx->used) < t) ? (max - ctx->used) : t);
+		}
+		break;
+#endif
+
+	default:
+		rest_response_buffer(ctx, p, t);
 		break;
 	}
 
@@ -1578,9 +1645,17 @@ static void rest_response_init(REQUEST *request, rlm_rest_response_t *ctx, http_
 	ctx->alloc = 0;
 	ctx->used = 0;
 	ctx->buffer = NULL;
+	ctx->max_age = -1;
+	ctx->expires = 0;
+	ctx->no_store = false;
+	ctx->cache_max = 0;
+	ctx->keep_body = false;
 }
 
 /** Extracts pointer to buffer containing response data
+ *
+ * For JSON responses only the first REST_BODY_MAX_LEN bytes are available,
+ * unless the section has raw_body set.
  *
  * @param[out] out Where to write the pointer to the buffer.
  * @param[in] handle used for the last request.
@@ -1596,6 +1671,35 @@ size_t rest_get_handle_data(char const **out, rlm_rest_handle_t *handle)
 	return ctx->response.used;
 }
 
+/** Process a response from the cache as if it had just been received
+ *
+ * @param[in] request Current request.
+ * @param[in] handle configured for the request.
+ * @param[in] code HTTP status code of the response.
+ * @param[in] type of the response body.
+ * @param[in] body of the response.
+ * @param[in] len of the body.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rest_response_replay(REQUEST *request, void *handle, int code, http_body_type_t type,
+			 char *body, size_t len)
+{
+	rlm_rest_handle_t	*randle = handle;
+	rlm_rest_curl_context_t	*ctx = randle->ctx;
+
+	ctx->response.request = request;
+	ctx->response.code = code;
+	ctx->response.type = type;
+	ctx->response.state = WRITE_STATE_PARSE_HEADERS;
+	ctx->response.cache_max = 0;
+
+	if (len && (rest_response_body(body, 1, len, &ctx->response) != len)) return -1;
+
+	return 0;
+}
+
 /** Configures body specific curlopts.
  *
  * Configures libcurl handle to use either chunked mode, where the request
@@ -1750,6 +1854,19 @@ int rest_request_config(rlm_rest_t const *inst, rlm_rest_thread_t *t, rlm_rest_s
 	SET_OPTION(CURLOPT_PROTOCOLS, (CURLPROTO_HTTP | CURLPROTO_HTTPS));
 #endif
 
+	/*
+	 *	Request the configured HTTP version.  If it allows
+	 *	HTTP/2, then prefer waiting for a connection which
+	 *	may be multiplexed over opening a new one.  Once
+	 *	the first transfer to an endpoint has negotiated
+	 *	HTTP/2, subsequent transfers are added as streams
+	 *	on the existing connection.
+	 */
+	if (inst->http_version != CURL_HTTP_VERSION_NONE) SET_OPTION(CURLOPT_HTTP_VERSION, inst->http_version);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	SET_OPTION(CURLOPT_PIPEWAIT, (inst->http_version >= CURL_HTTP_VERSION_2_0) ? 1L : 0L);
+#endif
+
 	/*
 	 *	FreeRADIUS custom headers
 	 */
@@ -1921,6 +2038,7 @@ int rest_request_config(rlm_rest_t const *inst, rlm_rest_thread_t *t, rlm_rest_s
 	 *  Force parsing the body text as a particular encoding.
 	 */
 	ctx->response.force_to = section->force_to;
+	ctx->response.keep_body = section->raw_body;
 
 	switch (method) {
 	case HTTP_METHOD_GET:
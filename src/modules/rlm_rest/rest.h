@@ -25,6 +25,7 @@
 RCSIDH(other_h, "$Id$")
 
 #include <freeradius-devel/connection.h>
+#include <freeradius-devel/modules.h>
 #include "config.h"
 
 #define CURL_NO_OLDIES 1
@@ -98,6 +99,11 @@ extern const FR_NAME_NUMBER http_body_type_table[];
 
 extern const FR_NAME_NUMBER http_content_type_table[];
 
+extern const FR_NAME_NUMBER http_version_table[];
+
+typedef struct rest_cache rest_cache_t;
+typedef struct rest_latency rest_latency_t;
+
 /*
  *	Structure for section configuration
  */
@@ -116,6 +122,8 @@ typedef struct {
 	char const		*force_to_str;	//!< Force decoding with this decoder.
 	http_body_type_t	force_to;	//!< Override the Content-Type header in the response
 						//!< to force decoding as a particular type.
+	bool			raw_body;	//!< The response body is used as is, so must be kept
+						//!< in full, even if it's decoded as it arrives.
 
 	char const		*data;		//!< Custom body data (optional).
 
@@ -137,6 +145,8 @@ typedef struct {
 
 	struct timeval		timeout_tv;	//!< Timeout timeval.
 	uint32_t		chunk;		//!< Max chunk-size (mainly for testing the encoders)
+
+	bool			cache;		//!< Cache responses to requests from this section.
 } rlm_rest_section_t;
 
 /*
@@ -147,6 +157,19 @@ typedef struct {
 
 	char const		*connect_proxy;	//!< Send request via this proxy.
 
+	char const		*http_version_str;	//!< The string version of the HTTP version.
+	long			http_version;	//!< CURL_HTTP_VERSION_* to request.
+	uint32_t		max_host_connections;	//!< Max connections per endpoint, per thread.
+	uint32_t		max_streams;	//!< Max concurrent HTTP/2 streams per connection.
+	bool			latency_stats;	//!< Record per-endpoint latency histograms.
+	rest_latency_t		*latency;	//!< Latency histograms for all threads.
+
+	uint32_t		cache_size;	//!< Maximum number of cached responses.
+	uint32_t		cache_max_ttl;	//!< Maximum time a response may be cached for.
+	uint32_t		cache_max_entry_size;	//!< Largest response body which may be cached.
+	bool			cache_shared;	//!< Share cached responses between threads.
+	rest_cache_t		*cache;		//!< Response cache shared between threads.
+
 	fr_connection_pool_t	*pool;		//!< Pointer to the connection pool.
 
 	rlm_rest_section_t	xlat;		//!< Configuration specific to xlat.
@@ -170,6 +193,8 @@ typedef struct {
 	fr_event_timer_t	*ev;		//!< Used to manage IO timers for libcurl.
 	unsigned int		transfers;	//!< Keep track of how many outstanding transfers
 						//!< we think there are.
+	rest_latency_t		*latency;	//!< Per-endpoint latency histograms for this thread.
+	rest_cache_t		*cache;		//!< Response cache used by this thread.
 } rlm_rest_thread_t;
 
 /*
@@ -224,6 +249,14 @@ typedef struct {
 	http_body_type_t	type;		//!< HTTP Content Type.
 	http_body_type_t	force_to;	//!< Force decoding the body type as a particular encoding.
 
+	int			max_age;	//!< From the Cache-Control header, -1 if not present.
+	time_t			expires;	//!< From the Expires header, 0 if not present.
+	bool			no_store;	//!< Cache-Control forbids caching the response.
+	size_t			cache_max;	//!< Largest body we'll cache, 0 if the response won't
+						//!< be cached.
+	bool			keep_body;	//!< Keep the whole body, not just enough to print
+						//!< if there's an error.
+
 	void			*decoder;	//!< Decoder specific data.
 } rlm_rest_response_t;
 
@@ -239,6 +272,8 @@ typedef struct {
 
 	rlm_rest_request_t	request;	//!< Request context data.
 	rlm_rest_response_t	response;	//!< Response context data.
+
+	uint8_t			cache_key[SHA1_DIGEST_LENGTH];	//!< Identifies the request in the response cache.
 } rlm_rest_curl_context_t;
 
 /*
@@ -285,6 +320,9 @@ void rest_request_cleanup(rlm_rest_t const *instance, void *handle);
 
 size_t rest_get_handle_data(char const **out, rlm_rest_handle_t *handle);
 
+int rest_response_replay(REQUEST *request, void *handle, int code, http_body_type_t type,
+			 char *body, size_t len);
+
 /*
  *	Helper functions
  */
@@ -300,3 +338,17 @@ void rest_io_action(REQUEST *request, void *instance, void *thread, void *ctx, f
 int rest_io_request_enqueue(rlm_rest_thread_t *thread, REQUEST *request, void *handle);
 int rest_io_init(rlm_rest_thread_t *thread);
 
+/*
+ *	Latency histograms
+ */
+rest_latency_t *rest_latency_alloc(TALLOC_CTX *ctx, rest_latency_t *parent);
+void rest_latency_print(rest_latency_t *latency, module_stats_print_t print, void *uctx);
+
+/*
+ *	Response cache
+ */
+rest_cache_t *rest_cache_alloc(TALLOC_CTX *ctx, uint32_t max, bool shared);
+int rest_cache_find(rlm_rest_thread_t *thread, rlm_rest_section_t const *section, REQUEST *request,
+		    void *handle, char const *uri, char const *username, char const *password);
+void rest_cache_store(rlm_rest_thread_t *thread, REQUEST *request, void *handle, bool decoded);
+
@@ -64,6 +64,7 @@ static const CONF_PARSER section_config[] = {
 	/* Transfer configuration */
 	{ FR_CONF_OFFSET("timeout", PW_TYPE_TIMEVAL, rlm_rest_section_t, timeout_tv), .dflt = "4.0" },
 	{ FR_CONF_OFFSET("chunk", PW_TYPE_INTEGER, rlm_rest_section_t, chunk), .dflt = "0" },
+	{ FR_CONF_OFFSET("cache", PW_TYPE_BOOLEAN, rlm_rest_section_t, cache), .dflt = "no" },
 
 	/* TLS Parameters */
 	{ FR_CONF_POINTER("tls", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) tls_config },
@@ -88,9 +89,23 @@ static const CONF_PARSER xlat_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER cache_config[] = {
+	{ FR_CONF_OFFSET("size", PW_TYPE_INTEGER, rlm_rest_t, cache_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_ttl", PW_TYPE_INTEGER, rlm_rest_t, cache_max_ttl), .dflt = "300" },
+	{ FR_CONF_OFFSET("max_entry_size", PW_TYPE_INTEGER, rlm_rest_t, cache_max_entry_size), .dflt = "65536" },
+	{ FR_CONF_OFFSET("shared", PW_TYPE_BOOLEAN, rlm_rest_t, cache_shared), .dflt = "no" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_DEPRECATED("connect_timeout", PW_TYPE_TIMEVAL, rlm_rest_t, connect_timeout) },
 	{ FR_CONF_OFFSET("connect_proxy", PW_TYPE_STRING, rlm_rest_t, connect_proxy) },
+	{ FR_CONF_OFFSET("http_version", PW_TYPE_STRING, rlm_rest_t, http_version_str), .dflt = "default" },
+	{ FR_CONF_OFFSET("max_host_connections", PW_TYPE_INTEGER, rlm_rest_t, max_host_connections), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_streams", PW_TYPE_INTEGER, rlm_rest_t, max_streams), .dflt = "100" },
+	{ FR_CONF_OFFSET("latency_stats", PW_TYPE_BOOLEAN, rlm_rest_t, latency_stats), .dflt = "no" },
+
+	{ FR_CONF_POINTER("cache", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -131,6 +146,13 @@ static int rlm_rest_status_update(REQUEST *request,  void *handle)
 	return 0;
 }
 
+/** Configure a request, and send it (unless a cached response is available)
+ *
+ * @return
+ *	- 1 if a cached response was used, the result can be processed immediately.
+ *	- 0 if the request was sent.
+ *	- -1 on failure.
+ */
 static int rlm_rest_perform(rlm_rest_t const *instance, rlm_rest_thread_t *thread,
 			    rlm_rest_section_t const *section, void *handle,
 			    REQUEST *request, char const *username, char const *password)
@@ -156,8 +178,17 @@ static int rlm_rest_perform(rlm_rest_t const *instance, rlm_rest_thread_t *threa
 	 */
 	ret = rest_request_config(instance, thread, section, request, handle, section->method, section->body,
 				  uri, username, password);
+	if (ret < 0) {
+		talloc_free(uri);
+		return -1;
+	}
+
+	if (section->cache && thread->cache &&
+	    (rest_cache_find(thread, section, request, handle, uri, username, password) == 1)) {
+		talloc_free(uri);
+		return 1;
+	}
 	talloc_free(uri);
-	if (ret < 0) return -1;
 
 	/*
 	 *  Send the CURL request, pre-parse headers, aggregate incoming
@@ -428,6 +459,7 @@ static rlm_rcode_t mod_authorize_result(REQUEST *request, void *instance, void *
 	}
 
 finish:
+	rest_cache_store(t, request, handle, (rcode == RLM_MODULE_OK) || (rcode == RLM_MODULE_UPDATED));
 	rest_request_cleanup(instance, handle);
 
 	fr_connection_release(t->pool, request, handle);
@@ -462,6 +494,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, void *thread,
 
 		return RLM_MODULE_FAIL;
 	}
+	if (ret == 1) return mod_authorize_result(request, instance, thread, handle);
 
 	return unlang_yield(request, mod_authorize_result, rest_io_action, handle);
 }
@@ -541,6 +574,7 @@ static rlm_rcode_t mod_authenticate_result(REQUEST *request, void *instance, voi
 	}
 
 finish:
+	rest_cache_store(t, request, handle, (rcode == RLM_MODULE_OK) || (rcode == RLM_MODULE_UPDATED));
 	rest_request_cleanup(instance, handle);
 
 	fr_connection_release(t->pool, request, handle);
@@ -590,6 +624,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *threa
 
 		return RLM_MODULE_FAIL;
 	}
+	if (ret == 1) return mod_authenticate_result(request, instance, thread, handle);
 
 	return unlang_yield(request, mod_authenticate_result, NULL, handle);
 }
@@ -637,6 +672,7 @@ static rlm_rcode_t mod_accounting_result(REQUEST *request, void *instance, void
 	}
 
 finish:
+	rest_cache_store(t, request, handle, (rcode == RLM_MODULE_OK) || (rcode == RLM_MODULE_UPDATED));
 	rest_request_cleanup(instance, handle);
 
 	fr_connection_release(t->pool, request, handle);
@@ -668,6 +704,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread,
 
 		return RLM_MODULE_FAIL;
 	}
+	if (ret == 1) return mod_accounting_result(request, instance, thread, handle);
 
 	return unlang_yield(request, mod_accounting_result, NULL, handle);
 }
@@ -715,6 +752,7 @@ static rlm_rcode_t mod_post_auth_result(REQUEST *request, void *instance, void *
 	}
 
 finish:
+	rest_cache_store(t, request, handle, (rcode == RLM_MODULE_OK) || (rcode == RLM_MODULE_UPDATED));
 	rest_request_cleanup(inst, handle);
 
 	fr_connection_release(t->pool, request, handle);
@@ -747,6 +785,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, void *thread,
 
 		return RLM_MODULE_FAIL;
 	}
+	if (ret == 1) return mod_post_auth_result(request, instance, thread, handle);
 
 	return unlang_yield(request, mod_post_auth_result, NULL, handle);
 }
@@ -781,6 +820,15 @@ static int parse_sub_section(CONF_SECTION *parent, CONF_PARSER const *config_ite
 		return -1;
 	 }
 
+	/*
+	 *  Cached responses don't include the server's certificate.
+	 */
+	if (config->cache && config->tls_extract_cert_attrs) {
+		cf_log_err_cs(cs, "'cache' and 'extract_cert_attrs' can't be used together");
+
+		return -1;
+	}
+
 	/*
 	 *  Convert HTTP method auth and body type strings into their integer equivalents.
 	 */
@@ -798,6 +846,17 @@ static int parse_sub_section(CONF_SECTION *parent, CONF_PARSER const *config_ite
 
 	config->method = fr_str2int(http_method_table, config->method_str, HTTP_METHOD_CUSTOM);
 
+	/*
+	 *  Only safe methods may be cached, replaying any other
+	 *  would skip the side effects of the request.
+	 */
+	if (config->cache && (config->method != HTTP_METHOD_GET) &&
+	    ((config->method != HTTP_METHOD_CUSTOM) || (strcasecmp(config->method_str, "HEAD") != 0))) {
+		cf_log_err_cs(cs, "'cache' may only be used with the GET or HEAD methods");
+
+		return -1;
+	}
+
 	/*
 	 *  We don't have any custom user data, so we need to select the right encoder based
 	 *  on the body type.
@@ -903,6 +962,17 @@ static int mod_thread_instantiate(CONF_SECTION const *conf, void *instance, fr_e
 	t->el = el;
 	t->inst = instance;
 
+	/*
+	 *	Each thread gets a private cache unless
+	 *	one is shared between all of them.
+	 */
+	if (inst->cache) {
+		t->cache = inst->cache;
+	} else if (inst->cache_size) {
+		t->cache = rest_cache_alloc(t, inst->cache_size, false);
+		if (!t->cache) return -1;
+	}
+
 	/*
 	 *	Temporary hack to make config parsing
 	 *	thread safe.
@@ -919,6 +989,24 @@ static int mod_thread_instantiate(CONF_SECTION const *conf, void *instance, fr_e
 	return rest_io_init(t);
 }
 
+/** Print the latency histograms for each endpoint
+ *
+ * @param[in] instance	of rlm_rest_t.
+ * @param[in] print	function to write each line with.
+ * @param[in] uctx	to pass to print.
+ */
+static void mod_stats(void *instance, module_stats_print_t print, void *uctx)
+{
+	rlm_rest_t *inst = instance;
+
+	if (!inst->latency) {
+		print(uctx, "Latency histograms are disabled, see 'latency_stats'\n");
+		return;
+	}
+
+	rest_latency_print(inst->latency, print, uctx);
+}
+
 /** Cleanup all outstanding requests associated with this thread
  *
  * Destroys all curl easy handles, and then the multihandle associated
@@ -931,6 +1019,12 @@ static int mod_thread_detach(void *thread)
 {
 	rlm_rest_thread_t	*t = thread;
 
+	/*
+	 *	Add this thread's latency histograms
+	 *	to the totals for the instance.
+	 */
+	TALLOC_FREE(t->latency);
+
 	curl_multi_cleanup(t->mandle);
 	fr_connection_pool_free(t->pool);
 
@@ -949,12 +1043,57 @@ static int mod_thread_detach(void *thread)
  */
 static int mod_instantiate(CONF_SECTION *conf, void *instance)
 {
-	rlm_rest_t *inst = instance;
+	rlm_rest_t		*inst = instance;
+#if LIBCURL_VERSION_NUM >= 0x072100
+	curl_version_info_data	*curlversion;
+#endif
+
+	inst->http_version = fr_str2int(http_version_table, inst->http_version_str, -1);
+	if (inst->http_version < 0) {
+		cf_log_err_cs(conf, "Unknown or unsupported HTTP version '%s'", inst->http_version_str);
+		return -1;
+	}
+
+#if LIBCURL_VERSION_NUM >= 0x072100
+	curlversion = curl_version_info(CURLVERSION_NOW);
+	if ((inst->http_version >= CURL_HTTP_VERSION_2_0) && !(curlversion->features & CURL_VERSION_HTTP2)) {
+		cf_log_err_cs(conf, "HTTP version '%s' requested, but libcurl was built without HTTP/2 support",
+			      inst->http_version_str);
+		return -1;
+	}
+#endif
+
+	FR_INTEGER_BOUND_CHECK("max_streams", inst->max_streams, >=, 1);
+#if LIBCURL_VERSION_NUM < 0x074300
+	{
+		CONF_PAIR *cp = cf_pair_find(conf, "max_streams");
+
+		if (cp) cf_log_warn_cp(cp, "Ignoring max_streams, it requires libcurl >= 7.67.0");
+	}
+#endif
+#if LIBCURL_VERSION_NUM < 0x071e00
+	{
+		CONF_PAIR *cp = cf_pair_find(conf, "max_host_connections");
+
+		if (cp) cf_log_warn_cp(cp, "Ignoring max_host_connections, it requires libcurl >= 7.30.0");
+	}
+#endif
+
+	if (inst->cache_size && inst->cache_shared) {
+		inst->cache = rest_cache_alloc(inst, inst->cache_size, true);
+		if (!inst->cache) return -1;
+	}
+
+	if (inst->latency_stats) {
+		inst->latency = rest_latency_alloc(inst, NULL);
+		if (!inst->latency) return -1;
+	}
 
 	inst->xlat.method_str = "GET";
 	inst->xlat.body = HTTP_BODY_NONE;
 	inst->xlat.body_str = "application/x-www-form-urlencoded";
 	inst->xlat.force_to_str = "plain";
+	inst->xlat.raw_body = true;
 
 	/*
 	 *	Parse sub-section configs.
@@ -1078,4 +1217,5 @@ rad_module_t rlm_rest = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_POST_AUTH]		= mod_post_auth
 	},
+	.stats			= mod_stats,
 };
@@ -0,0 +1,7 @@
+#
+#  Test the "csv" module
+#
+
+#  MODULE.test is the main target for this module.
+csv.test:
+	${Q}echo OK: csv.test
@@ -0,0 +1,7 @@
+#
+#  Test the "detail" module
+#
+
+#  MODULE.test is the main target for this module.
+detail.test:
+	${Q}echo OK: detail.test
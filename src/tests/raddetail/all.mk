@@ -0,0 +1,89 @@
+#
+#  Tests for converting detail files with raddetail
+#
+
+#
+#  The test files are text detail files.  Each one is converted to
+#  binary and back, and then checked.
+#
+RADDETAIL_FILES := $(subst $(DIR)/,,$(wildcard $(DIR)/*.txt))
+
+#
+#  Timestamps are written in local time.
+#
+RADDETAIL := TZ=UTC $(TESTBIN)/raddetail -D share -d raddb
+
+#
+#  Create the output directory
+#
+.PHONY: $(BUILD_DIR)/tests/raddetail
+$(BUILD_DIR)/tests/raddetail:
+	${Q}mkdir -p $@
+
+#
+#  Files in the output dir depend on the tests
+#
+#	src/tests/raddetail/FOO.txt	text detail file
+#	build/tests/raddetail/FOO.txt	updated if the test succeeds
+#	build/tests/raddetail/FOO.txt.*	intermediate files
+#
+#  The conversions have to be stable in both directions, every entry
+#  has to survive them, and entries which have already been replayed
+#  are only copied with -a.
+#
+#  A record with a bad checksum is skipped, and the rest of the file is
+#  still converted.  Text and binary entries can be mixed in one file.
+#
+$(BUILD_DIR)/tests/raddetail/%: $(DIR)/% $(TESTBINDIR)/raddetail | $(BUILD_DIR)/tests/raddetail
+	${Q}echo RADDETAIL-TEST $(notdir $@)
+	${Q}ENTRIES=$$(grep -c '^	User-Name' $<); \
+	DONE=$$(grep -c '^	Donestamp' $<); \
+	if ! $(RADDETAIL) -a -b $< $@.bin || \
+	   ! $(RADDETAIL) -a -t $@.bin $@.out || \
+	   ! $(RADDETAIL) -a -b $@.out $@.bin2 || \
+	   ! $(RADDETAIL) -a -t $@.bin2 $@.out2; then \
+		echo "FAILED: $(RADDETAIL) -a -b $<"; \
+		exit 1; \
+	fi; \
+	if ! cmp $@.bin $@.bin2 || ! diff $@.out $@.out2; then \
+		echo "FAILED: conversion of $< isn't stable"; \
+		exit 1; \
+	fi; \
+	for user in $$(sed -n 's/^	User-Name = //p' $<); do \
+		if ! grep -q "^	User-Name = $$user" $@.out; then \
+			echo "FAILED: User-Name = $$user missing from $@.out"; \
+			exit 1; \
+		fi; \
+	done; \
+	if [ "$$($(RADDETAIL) -t $< | grep -c '^	User-Name')" != "$$(($$ENTRIES - $$DONE))" ]; then \
+		echo "FAILED: $(RADDETAIL) -t $< copied replayed entries"; \
+		exit 1; \
+	fi; \
+	cp $@.bin $@.bad; \
+	printf 'XXXX' | dd of=$@.bad bs=1 seek=16 conv=notrunc 2>/dev/null; \
+	if ! $(RADDETAIL) -a -t $@.bad $@.skip 2> $@.log || \
+	   [ "$$(grep -c '^	User-Name' $@.skip)" != "$$(($$ENTRIES - 1))" ] || \
+	   ! grep -q 'Skipping corrupt entry 1' $@.log; then \
+		cat $@.log; \
+		echo "FAILED: $(RADDETAIL) -a -t $@.bad"; \
+		exit 1; \
+	fi; \
+	if [ "$$(cat $@.bin $< | $(RADDETAIL) -a -t - | grep -c '^	User-Name')" != "$$(($$ENTRIES * 2))" ]; then \
+		echo "FAILED: $(RADDETAIL) -a -t with mixed input"; \
+		exit 1; \
+	fi
+	${Q}touch $@
+
+#
+#  Get all of the test output files
+#
+TESTS.RADDETAIL_FILES := $(addprefix $(BUILD_DIR)/tests/raddetail/,$(RADDETAIL_FILES))
+
+#
+#  Depend on the output files, and create the directory first.
+#
+tests.raddetail: $(TESTS.RADDETAIL_FILES)
+
+.PHONY: clean.tests.raddetail
+clean.tests.raddetail:
+	${Q}rm -rf $(BUILD_DIR)/tests/raddetail/
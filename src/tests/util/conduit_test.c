@@ -0,0 +1,207 @@
+/*
+ * conduit_test.c	Tests for the radmin batch framing
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/conduit.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <sys/socket.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: conduit_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/*
+ *	Blank lines aren't commands, on either side.
+ */
+static void test_is_command(void)
+{
+	rad_assert(!fr_conduit_batch_is_command("", 0));
+	rad_assert(!fr_conduit_batch_is_command(" \t\r", 3));
+	rad_assert(fr_conduit_batch_is_command(" show", 5));
+	rad_assert(fr_conduit_batch_is_command("x", 1));
+
+	/*
+	 *	Only the given length is checked.
+	 */
+	rad_assert(!fr_conduit_batch_is_command("  show", 2));
+
+	MPRINT1("is_command: OK\n");
+}
+
+/*
+ *	Send a batch the way radmin does, split it into commands the
+ *	way the server does, and check the results come back in order.
+ */
+static void test_round_trip(int fd[2])
+{
+	static char const	batch[] = "show version\n\n  \r\nadd client foo\n\t\nshow clients";
+	static char const	*expected[] = { "show version", "add client foo", "show clients" };
+	char			buffer[COMMAND_BUFFER_SIZE];
+	char			line[256];
+	fr_conduit_type_t	conduit;
+	uint8_t			*command;
+	ssize_t			r, have_read = 0;
+	char			*p, *next, *end;
+	int			num = 0, i;
+	uint32_t		status;
+	char const		*out, *err;
+	size_t			out_len, err_len;
+
+	r = fr_conduit_write(fd[0], FR_CONDUIT_BATCH, batch, sizeof(batch) - 1);
+	rad_assert(r == (sizeof(batch) - 1));
+
+	do {
+		r = fr_conduit_drain(fd[1], &conduit, buffer, sizeof(buffer) - 1, &command, &have_read);
+		rad_assert(r > 0);
+	} while (conduit == FR_CONDUIT_WANT_MORE);
+
+	rad_assert(conduit == FR_CONDUIT_BATCH);
+	rad_assert(r == (sizeof(batch) - 1));
+	command[r] = '\0';
+
+	end = (char *) command + r;
+	for (p = (char *) command; p < end; p = next) {
+		next = memchr(p, '\n', end - p);
+		if (next) {
+			*next++ = '\0';
+		} else {
+			next = end;
+		}
+
+		if (!fr_conduit_batch_is_command(p, strlen(p))) continue;
+
+		rad_assert(num < (int) (sizeof(expected) / sizeof(expected[0])));
+		rad_assert(strcmp(p, expected[num]) == 0);
+
+		snprintf(line, sizeof(line), "output of %s\n", p);
+		r = fr_conduit_batch_result_write(fd[1], (num == 1) ? FR_CONDUIT_FAIL : FR_CONDUIT_SUCCESS,
+						  line, strlen(line), (num == 1) ? "failed\n" : "", (num == 1) ? 7 : 0);
+		rad_assert(r > 0);
+		num++;
+	}
+	rad_assert(num == 3);
+
+	for (i = 0; i < num; i++) {
+		r = fr_conduit_read(fd[0], &conduit, buffer, sizeof(buffer));
+		rad_assert(r > 0);
+		rad_assert(conduit == FR_CONDUIT_BATCH_RESULT);
+
+		rad_assert(fr_conduit_batch_result_parse(&status, &out, &out_len, &err, &err_len, buffer, r) == 0);
+
+		snprintf(line, sizeof(line), "output of %s\n", expected[i]);
+		rad_assert(out_len == strlen(line));
+		rad_assert(memcmp(out, line, out_len) == 0);
+
+		if (i == 1) {
+			rad_assert(status == FR_CONDUIT_FAIL);
+			rad_assert(err_len == 7);
+			rad_assert(memcmp(err, "failed\n", 7) == 0);
+		} else {
+			rad_assert(status == FR_CONDUIT_SUCCESS);
+			rad_assert(err_len == 0);
+		}
+	}
+
+	MPRINT1("round trip: OK\n");
+}
+
+/*
+ *	Results read into a buffer which is too small are truncated,
+ *	and the lengths are clamped to what was read.
+ */
+static void test_truncated(int fd[2])
+{
+	char			buffer[sizeof(fr_conduit_batch_result_t) + 8];
+	char			big[64];
+	fr_conduit_type_t	conduit;
+	ssize_t			r;
+	uint32_t		status;
+	char const		*out, *err;
+	size_t			out_len, err_len;
+
+	memset(big, 'a', sizeof(big));
+
+	r = fr_conduit_batch_result_write(fd[1], FR_CONDUIT_SUCCESS, big, sizeof(big), "error", 5);
+	rad_assert(r == (ssize_t) (sizeof(fr_conduit_batch_result_t) + sizeof(big) + 5));
+
+	r = fr_conduit_read(fd[0], &conduit, buffer, sizeof(buffer));
+	rad_assert(r == sizeof(buffer));
+	rad_assert(conduit == FR_CONDUIT_BATCH_RESULT);
+
+	rad_assert(fr_conduit_batch_result_parse(&status, &out, &out_len, &err, &err_len, buffer, r) == 0);
+	rad_assert(status == FR_CONDUIT_SUCCESS);
+	rad_assert(out_len == 8);
+	rad_assert(err_len == 0);
+
+	/*
+	 *	Too short to hold the header.
+	 */
+	rad_assert(fr_conduit_batch_result_parse(&status, &out, &out_len, &err, &err_len,
+						 buffer, sizeof(fr_conduit_batch_result_t) - 1) < 0);
+
+	MPRINT1("truncated: OK\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	int fd[2];
+
+	while ((c = getopt(argc, argv, "hx")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+		fprintf(stderr, "Failed creating socket pair: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	test_is_command();
+	test_round_trip(fd);
+	test_truncated(fd);
+
+	close(fd[0]);
+	close(fd[1]);
+
+	return 0;
+}
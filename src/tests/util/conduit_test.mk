@@ -0,0 +1,6 @@
+TARGET := conduit_test
+
+SOURCES		:= conduit_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,300 @@
+/*
+ * detail_test.c	Tests for binary detail records
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: detail_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to share).\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/*
+ *	Encode an Accounting-Request for a user, and append it to the file.
+ *
+ *	Returns the length of the record.
+ */
+static size_t write_record(TALLOC_CTX *ctx, FILE *fp, char const *user, time_t timestamp)
+{
+	RADIUS_PACKET	*packet;
+	fr_ipaddr_t	client = { .af = AF_INET, .prefix = 32 };
+	uint8_t		*record;
+	ssize_t		len;
+
+	packet = fr_radius_alloc(ctx, false);
+	rad_assert(packet != NULL);
+
+	packet->code = PW_CODE_ACCOUNTING_REQUEST;
+	packet->id = 42;
+	packet->src_ipaddr.af = AF_INET;
+	packet->src_ipaddr.prefix = 32;
+	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(0x7f000001);
+	packet->src_port = 1813;
+	packet->dst_ipaddr = packet->src_ipaddr;
+	packet->dst_port = 1814;
+	client.ipaddr.ip4addr.s_addr = htonl(0xc0000201);
+
+	rad_assert(fr_pair_make(packet, &packet->vps, "User-Name", user, T_OP_EQ) != NULL);
+	rad_assert(fr_pair_make(packet, &packet->vps, "Acct-Status-Type", "Start", T_OP_EQ) != NULL);
+
+	len = detail_binary_encode(ctx, &record, packet, packet->vps, &client, timestamp, true);
+	rad_assert(len > (ssize_t) DETAIL_BINARY_HDR_LEN);
+
+	rad_assert(fwrite(record, 1, len, fp) == (size_t) len);
+	rad_assert(fflush(fp) == 0);
+
+	talloc_free(record);
+	talloc_free(packet);
+
+	return len;
+}
+
+/*
+ *	Overwrite a byte of the file, leaving the position alone.
+ */
+static void corrupt(FILE *fp, off_t offset, uint8_t value)
+{
+	off_t here = ftell(fp);
+
+	rad_assert(fseek(fp, offset, SEEK_SET) == 0);
+	rad_assert(fputc(value, fp) != EOF);
+	rad_assert(fseek(fp, here, SEEK_SET) == 0);
+}
+
+/*
+ *	Read a record, and check it's the one for this user.
+ */
+static void check_record(TALLOC_CTX *ctx, FILE *fp, char const *user, time_t timestamp)
+{
+	detail_binary_hdr_t	hdr;
+	uint8_t			buffer[MAX_PACKET_LEN];
+	VALUE_PAIR		*vps, *vp;
+	fr_ipaddr_t		client;
+
+	rad_assert(detail_binary_read(fp, &hdr, buffer, sizeof(buffer)) == 1);
+	rad_assert(ntohl(hdr.timestamp) == (uint32_t) timestamp);
+	rad_assert((hdr.flags & DETAIL_BINARY_FLAG_DONE) == 0);
+
+	detail_binary_ipaddr(&client, hdr.client_af, hdr.client_ipaddr);
+	rad_assert(client.af == AF_INET);
+	rad_assert(client.ipaddr.ip4addr.s_addr == htonl(0xc0000201));
+
+	rad_assert(detail_binary_decode(ctx, &vps, &hdr, buffer) == 0);
+
+	vp = fr_pair_find_by_num(vps, 0, PW_PACKET_TYPE, TAG_ANY);
+	rad_assert(vp && (vp->vp_integer == PW_CODE_ACCOUNTING_REQUEST));
+
+	vp = fr_pair_find_by_num(vps, 0, PW_PACKET_SRC_IP_ADDRESS, TAG_ANY);
+	rad_assert(vp && (vp->vp_ipaddr == htonl(0x7f000001)));
+
+	vp = fr_pair_find_by_num(vps, 0, PW_PACKET_SRC_PORT, TAG_ANY);
+	rad_assert(vp && (vp->vp_integer == 1813));
+
+	vp = fr_pair_find_by_num(vps, 0, PW_PACKET_DST_PORT, TAG_ANY);
+	rad_assert(vp && (vp->vp_integer == 1814));
+
+	vp = fr_pair_find_by_num(vps, 0, PW_USER_NAME, TAG_ANY);
+	rad_assert(vp && (strcmp(vp->vp_strvalue, user) == 0));
+
+	vp = fr_pair_find_by_num(vps, 0, PW_ACCT_STATUS_TYPE, TAG_ANY);
+	rad_assert(vp && (vp->vp_integer == PW_STATUS_START));
+
+	fr_pair_list_free(&vps);
+}
+
+/*
+ *	Records decode to the attributes they were encoded from.
+ */
+static void test_round_trip(TALLOC_CTX *ctx)
+{
+	FILE			*fp;
+	detail_binary_hdr_t	hdr;
+	uint8_t			buffer[MAX_PACKET_LEN];
+
+	fp = tmpfile();
+	rad_assert(fp != NULL);
+
+	(void) write_record(ctx, fp, "bob", 1000);
+	(void) write_record(ctx, fp, "alice", 2000);
+	rewind(fp);
+
+	check_record(ctx, fp, "bob", 1000);
+	check_record(ctx, fp, "alice", 2000);
+	rad_assert(detail_binary_read(fp, &hdr, buffer, sizeof(buffer)) == 0);
+
+	fclose(fp);
+
+	MPRINT1("round trip: OK\n");
+}
+
+/*
+ *	A corrupt record whose length is sane is skipped, and the
+ *	records after it can still be read.
+ */
+static void test_corrupt(TALLOC_CTX *ctx)
+{
+	FILE			*fp;
+	detail_binary_hdr_t	hdr;
+	uint8_t			buffer[MAX_PACKET_LEN];
+	size_t			first, second;
+
+	fp = tmpfile();
+	rad_assert(fp != NULL);
+
+	first = write_record(ctx, fp, "bob", 1000);
+	second = write_record(ctx, fp, "alice", 2000);
+	(void) write_record(ctx, fp, "carol", 3000);
+
+	/*
+	 *	Last byte of the packet, so the checksum no longer matches.
+	 */
+	corrupt(fp, first + second - 1, 'X');
+
+	/*
+	 *	Magic of the third record.
+	 */
+	corrupt(fp, first + second + 1, 'X');
+	rewind(fp);
+
+	check_record(ctx, fp, "bob", 1000);
+	rad_assert(detail_binary_read(fp, &hdr, buffer, sizeof(buffer)) == -2);
+	rad_assert(ftell(fp) == (long) (first + second));
+	rad_assert(detail_binary_read(fp, &hdr, buffer, sizeof(buffer)) == -2);
+	rad_assert(detail_binary_read(fp, &hdr, buffer, sizeof(buffer)) == 0);
+
+	/*
+	 *	The flags aren't covered by the checksum, so records
+	 *	can be marked as done in place.
+	 */
+	corrupt(fp, DETAIL_BINARY_FLAGS_OFFSET, DETAIL_BINARY_FLAG_DONE);
+	rewind(fp);
+	rad_assert(detail_binary_read(fp, &hdr, buffer, sizeof(buffer)) == 1);
+	rad_assert((hdr.flags & DETAIL_BINARY_FLAG_DONE) != 0);
+
+	fclose(fp);
+
+	MPRINT1("corrupt: OK\n");
+}
+
+/*
+ *	Records which are truncated, or whose length is invalid,
+ *	can't be skipped.
+ */
+static void test_unrecoverable(TALLOC_CTX *ctx)
+{
+	FILE			*fp;
+	detail_binary_hdr_t	hdr;
+	uint8_t			buffer[MAX_PACKET_LEN];
+	size_t			len;
+
+	/*
+	 *	Truncated packet.
+	 */
+	fp = tmpfile();
+	rad_assert(fp != NULL);
+
+	len = write_record(ctx, fp, "bob", 1000);
+	rad_assert(ftruncate(fileno(fp), len - 1) == 0);
+	rewind(fp);
+	rad_assert(detail_binary_read(fp, &hdr, buffer, sizeof(buffer)) == -1);
+	fclose(fp);
+
+	/*
+	 *	Truncated header.
+	 */
+	fp = tmpfile();
+	rad_assert(fp != NULL);
+
+	(void) write_record(ctx, fp, "bob", 1000);
+	rad_assert(ftruncate(fileno(fp), DETAIL_BINARY_HDR_LEN - 1) == 0);
+	rewind(fp);
+	rad_assert(detail_binary_read(fp, &hdr, buffer, sizeof(buffer)) == -1);
+	fclose(fp);
+
+	/*
+	 *	Length which is too short to hold a RADIUS packet.
+	 */
+	fp = tmpfile();
+	rad_assert(fp != NULL);
+
+	(void) write_record(ctx, fp, "bob", 1000);
+	corrupt(fp, offsetof(detail_binary_hdr_t, length) + 2, 0);
+	corrupt(fp, offsetof(detail_binary_hdr_t, length) + 3, 4);
+	rewind(fp);
+	rad_assert(detail_binary_read(fp, &hdr, buffer, sizeof(buffer)) == -1);
+	fclose(fp);
+
+	MPRINT1("unrecoverable: OK\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char const	*dict_dir = "share";
+	fr_dict_t	*dict = NULL;
+	TALLOC_CTX	*ctx;
+
+	while ((c = getopt(argc, argv, "D:hx")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(NULL, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("detail_test");
+		exit(1);
+	}
+
+	ctx = talloc_init("detail_test");
+
+	test_round_trip(ctx);
+	test_corrupt(ctx);
+	test_unrecoverable(ctx);
+
+	talloc_free(ctx);
+	talloc_free(dict);
+
+	return 0;
+}
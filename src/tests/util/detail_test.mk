@@ -0,0 +1,6 @@
+TARGET := detail_test
+
+SOURCES		:= detail_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,152 @@
+/*
+ * hist_test.c	Tests for the latency histograms
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/hist.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: hist_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/*
+ *	Every value lands in a bucket whose upper bound is at least the
+ *	value, and within 1/FR_HIST_SUB of it.  Buckets are contiguous.
+ */
+static void test_buckets(void)
+{
+	unsigned int	i, bucket;
+	uint64_t	value;
+
+	for (i = 0; i < (2 * FR_HIST_SUB); i++) {
+		rad_assert(fr_hist_bucket(i) == i);
+		rad_assert(fr_hist_bucket_max(i) == i);
+	}
+
+	for (i = 1; i < (FR_HIST_BUCKETS - 1); i++) {
+		rad_assert(fr_hist_bucket(fr_hist_bucket_max(i - 1) + 1) == i);
+		rad_assert(fr_hist_bucket(fr_hist_bucket_max(i)) == i);
+	}
+
+	for (value = 1; value < ((uint64_t) 1 << FR_HIST_MAX_BITS); value = (value * 3) + 1) {
+		bucket = fr_hist_bucket(value);
+		rad_assert(fr_hist_bucket_max(bucket) >= value);
+		rad_assert((fr_hist_bucket_max(bucket) - value) <= (value / FR_HIST_SUB));
+	}
+
+	rad_assert(fr_hist_bucket((uint64_t) 1 << FR_HIST_MAX_BITS) == (FR_HIST_BUCKETS - 1));
+	rad_assert(fr_hist_bucket(UINT64_MAX) == (FR_HIST_BUCKETS - 1));
+
+	MPRINT1("buckets: OK\n");
+}
+
+static void test_percentile(void)
+{
+	fr_hist_t	hist;
+	uint64_t	p50, p99;
+	unsigned int	i;
+
+	memset(&hist, 0, sizeof(hist));
+	rad_assert(fr_hist_percentile(&hist, 500) == 0);
+
+	for (i = 1; i <= 1000; i++) fr_hist_add(&hist, i);
+
+	rad_assert(hist.count == 1000);
+	rad_assert(hist.sum == 500500);
+	rad_assert(hist.min == 1);
+	rad_assert(hist.max == 1000);
+
+	p50 = fr_hist_percentile(&hist, 500);
+	rad_assert((p50 >= 500) && (p50 <= (500 + (500 / FR_HIST_SUB))));
+
+	p99 = fr_hist_percentile(&hist, 990);
+	rad_assert((p99 >= 990) && (p99 <= 1000));
+
+	/*
+	 *	Never more than the largest value recorded.
+	 */
+	rad_assert(fr_hist_percentile(&hist, 1000) == 1000);
+
+	MPRINT1("percentile: p50 %" PRIu64 " p99 %" PRIu64 " OK\n", p50, p99);
+}
+
+static void test_merge(void)
+{
+	fr_hist_t	a, b, all;
+	unsigned int	i;
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	memset(&all, 0, sizeof(all));
+
+	for (i = 0; i < 100; i++) {
+		fr_hist_add((i & 1) ? &a : &b, i * 7);
+		fr_hist_add(&all, i * 7);
+	}
+
+	fr_hist_merge(&a, &b);
+	rad_assert(memcmp(&a, &all, sizeof(a)) == 0);
+
+	/*
+	 *	Merging an empty histogram changes nothing, including min.
+	 */
+	memset(&b, 0, sizeof(b));
+	fr_hist_merge(&a, &b);
+	rad_assert(memcmp(&a, &all, sizeof(a)) == 0);
+
+	MPRINT1("merge: OK\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "hx")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	test_buckets();
+	test_percentile();
+	test_merge();
+
+	return 0;
+}
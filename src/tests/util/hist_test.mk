@@ -0,0 +1,6 @@
+TARGET := hist_test
+
+SOURCES		:= hist_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,444 @@
+/*
+ * json_stream_test.c	Tests for the rlm_rest incremental JSON decoder
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "json_stream.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: json_stream_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/*
+ *	Print everything the decoder produced, so the results of
+ *	feeding the same data in different sized chunks can be compared.
+ */
+static char *dump(TALLOC_CTX *ctx, json_stream_t const *s)
+{
+	json_attr_t const	*attr;
+	json_value_t const	*value;
+	char			*out;
+
+	out = talloc_asprintf(ctx, "state %u error %s\n", s->state, s->error ? s->error : "none");
+
+	for (attr = s->head; attr; attr = attr->next) {
+		out = talloc_asprintf_append(out, "%s op %s/%u xlat %i json %i/%i exp %i val %i arr %i obj %i raw %.*s\n",
+					     attr->name, attr->op_str ? attr->op_str : "-", attr->flags.op,
+					     attr->flags.do_xlat, attr->flags.is_json, attr->is_json_set,
+					     attr->expanded, attr->has_value, attr->is_array, attr->is_object,
+					     (int) attr->raw_len, attr->raw ? attr->raw : "");
+
+		for (value = attr->head; value; value = value->next) {
+			out = talloc_asprintf_append(out, "\t%u %zu %.*s\n",
+						     value->type, value->len, (int) value->len, value->str);
+		}
+	}
+	rad_assert(out != NULL);
+
+	return out;
+}
+
+/*
+ *	Feed the data in chunks of a fixed size.
+ */
+static json_stream_t *parse_chunked(TALLOC_CTX *ctx, char const *json, size_t len, size_t chunk)
+{
+	json_stream_t	*s;
+	size_t		i;
+
+	s = json_stream_alloc(ctx, 256);
+	rad_assert(s != NULL);
+
+	for (i = 0; i < len; i += chunk) json_stream_parse(s, json + i, ((len - i) < chunk) ? (len - i) : chunk);
+
+	return s;
+}
+
+/*
+ *	Feed the data in one go, and check every other way of splitting
+ *	it gives the same result.
+ */
+static json_stream_t *parse(TALLOC_CTX *ctx, char const *json)
+{
+	json_stream_t	*s, *split;
+	size_t		len = strlen(json), i;
+	char		*expected, *got;
+
+	s = parse_chunked(ctx, json, len, len ? len : 1);
+	expected = dump(ctx, s);
+
+	for (i = 1; i < len; i++) {
+		split = parse_chunked(ctx, json, len, i);
+		got = dump(split, split);
+		if (strcmp(expected, got) != 0) {
+			fprintf(stderr, "Chunks of %zu bytes of %s gave\n%s\nexpected\n%s\n", i, json, got, expected);
+			rad_assert(0);
+		}
+		talloc_free(split);
+
+		split = json_stream_alloc(ctx, 256);
+		rad_assert(split != NULL);
+		json_stream_parse(split, json, i);
+		json_stream_parse(split, json + i, len - i);
+		got = dump(split, split);
+		if (strcmp(expected, got) != 0) {
+			fprintf(stderr, "%s split at %zu gave\n%s\nexpected\n%s\n", json, i, got, expected);
+			rad_assert(0);
+		}
+		talloc_free(split);
+	}
+	talloc_free(expected);
+
+	if (debug_lvl > 1) printf("%s", dump(s, s));
+
+	return s;
+}
+
+/*
+ *	Find an attribute declaration by name.
+ */
+static json_attr_t const *find(json_stream_t const *s, char const *name)
+{
+	json_attr_t const *attr;
+
+	for (attr = s->head; attr; attr = attr->next) if (strcmp(attr->name, name) == 0) return attr;
+
+	rad_assert(0);
+	return NULL;
+}
+
+/*
+ *	Check a value has the expected type and text.
+ */
+static json_value_t const *check_value(json_value_t const *value, json_value_type_t type, char const *str)
+{
+	rad_assert(value != NULL);
+	rad_assert(value->type == type);
+	rad_assert(value->len == strlen(str));
+	rad_assert(memcmp(value->str, str, value->len) == 0);
+
+	return value->next;
+}
+
+/*
+ *	Parse data which must be malformed.
+ */
+static void check_error(TALLOC_CTX *ctx, char const *json, char const *error)
+{
+	json_stream_t *s;
+
+	s = parse(ctx, json);
+	rad_assert(s->state == JSON_STREAM_ERROR);
+	if (strcmp(s->error, error) != 0) {
+		fprintf(stderr, "%s gave error \"%s\", expected \"%s\"\n", json, s->error, error);
+		rad_assert(0);
+	}
+	talloc_free(s);
+}
+
+/*
+ *	Each type of scalar, in the simple syntax.
+ */
+static void test_scalars(TALLOC_CTX *ctx)
+{
+	json_stream_t		*s;
+	json_attr_t const	*attr;
+
+	s = parse(ctx, " {\n\t\"User-Name\" : \"bob\", \"Session-Timeout\":3600,\"Idle\":-1.5e2,"
+		  "\"Flag\":true,\"Other\":false,\"Nothing\":null,\"Empty\":\"\"} \r\n");
+	rad_assert(s->state == JSON_STREAM_DONE);
+
+	attr = find(s, "User-Name");
+	rad_assert(!attr->expanded && attr->has_value && !attr->is_array && !attr->is_object);
+	rad_assert(attr->flags.op == T_OP_SET);
+	rad_assert(attr->flags.do_xlat == 1);
+	rad_assert(!check_value(attr->head, JSON_VALUE_STRING, "bob"));
+
+	rad_assert(!check_value(find(s, "Session-Timeout")->head, JSON_VALUE_INT, "3600"));
+	rad_assert(!check_value(find(s, "Idle")->head, JSON_VALUE_DOUBLE, "-1.5e2"));
+	rad_assert(!check_value(find(s, "Flag")->head, JSON_VALUE_RAW, "true"));
+	rad_assert(!check_value(find(s, "Other")->head, JSON_VALUE_RAW, "false"));
+	rad_assert(!check_value(find(s, "Nothing")->head, JSON_VALUE_NULL, "null"));
+	rad_assert(!check_value(find(s, "Empty")->head, JSON_VALUE_STRING, ""));
+
+	talloc_free(s);
+
+	/*
+	 *	An empty object is fine, it just has no attributes.
+	 */
+	s = parse(ctx, "{}");
+	rad_assert(s->state == JSON_STREAM_DONE);
+	rad_assert(!s->head);
+	talloc_free(s);
+
+	MPRINT1("scalars: OK\n");
+}
+
+/*
+ *	Escape sequences, including \uXXXX and surrogate pairs.
+ */
+static void test_escapes(TALLOC_CTX *ctx)
+{
+	json_stream_t		*s;
+
+	s = parse(ctx, "{\"A\":\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\","
+		  "\"B\":\"\\u0041\\u00e9\\u20AC\\ud83d\\ude00\","
+		  "\"C\":\"\\ud83dx\","
+		  "\"D\":\"\\ude00\","
+		  "\"E\":\"\\ud83d\\ud83d\\ude00\","
+		  "\"F\":\"\\ud83d\","
+		  "\"G\":\"\\ud83d\\n\","
+		  "\"\\u0048\":1}");
+	rad_assert(s->state == JSON_STREAM_DONE);
+
+	rad_assert(!check_value(find(s, "A")->head, JSON_VALUE_STRING, "a\"b\\c/d\b\f\n\r\t"));
+	rad_assert(!check_value(find(s, "B")->head, JSON_VALUE_STRING, "A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"));
+
+	/*
+	 *	Unpaired surrogates become U+FFFD.
+	 */
+	rad_assert(!check_value(find(s, "C")->head, JSON_VALUE_STRING, "\xef\xbf\xbdx"));
+	rad_assert(!check_value(find(s, "D")->head, JSON_VALUE_STRING, "\xef\xbf\xbd"));
+	rad_assert(!check_value(find(s, "E")->head, JSON_VALUE_STRING, "\xef\xbf\xbd\xf0\x9f\x98\x80"));
+	rad_assert(!check_value(find(s, "F")->head, JSON_VALUE_STRING, "\xef\xbf\xbd"));
+	rad_assert(!check_value(find(s, "G")->head, JSON_VALUE_STRING, "\xef\xbf\xbd\n"));
+
+	/*
+	 *	Keys are unescaped too.
+	 */
+	rad_assert(!check_value(find(s, "H")->head, JSON_VALUE_INT, "1"));
+
+	talloc_free(s);
+
+	MPRINT1("escapes: OK\n");
+}
+
+/*
+ *	The expanded syntax, arrays of values, and nested containers.
+ */
+static void test_nesting(TALLOC_CTX *ctx)
+{
+	json_stream_t		*s;
+	json_attr_t const	*attr;
+	json_value_t const	*value;
+
+	s = parse(ctx, "{\"Reply-Message\":{\"op\":\"+=\",\"value\":[\"a\",\"b\"],\"do_xlat\":false},"
+		  "\"Obj\":{\"is_json\":true,\"value\":{\"x\":[1,{\"y\":\"}\"}]}},"
+		  "\"Late\":{\"value\":[1,2],\"is_json\":1},"
+		  "\"Skip\":{\"is_json\":false,\"value\":[[1],{\"q\":2}]},"
+		  "\"Arr\":[1,[2,3],{\"z\":\"w\"},\"s\",null],"
+		  "\"Ignored\":{\"unknown\":{\"deep\":[1,2,{\"deeper\":3}]},\"value\":\"v\"}}");
+	rad_assert(s->state == JSON_STREAM_DONE);
+
+	attr = find(s, "Reply-Message");
+	rad_assert(attr->expanded && attr->has_value && attr->is_array);
+	rad_assert(strcmp(attr->op_str, "+=") == 0);
+	rad_assert(attr->flags.do_xlat == 0);
+	value = check_value(attr->head, JSON_VALUE_STRING, "a");
+	rad_assert(!check_value(value, JSON_VALUE_STRING, "b"));
+
+	/*
+	 *	is_json before the value, so the value is kept as
+	 *	JSON text and not split into elements.
+	 */
+	attr = find(s, "Obj");
+	rad_assert(attr->is_json_set && attr->flags.is_json && attr->is_object);
+	rad_assert(attr->raw_len == strlen("{\"x\":[1,{\"y\":\"}\"}]}"));
+	rad_assert(strcmp(attr->raw, "{\"x\":[1,{\"y\":\"}\"}]}") == 0);
+	rad_assert(!attr->head);
+
+	/*
+	 *	is_json after the value, so both forms are kept.
+	 */
+	attr = find(s, "Late");
+	rad_assert(!attr->is_json_set && attr->flags.is_json && attr->is_array);
+	rad_assert(strcmp(attr->raw, "[1,2]") == 0);
+	value = check_value(attr->head, JSON_VALUE_INT, "1");
+	rad_assert(!check_value(value, JSON_VALUE_INT, "2"));
+
+	attr = find(s, "Skip");
+	rad_assert(attr->is_json_set && !attr->flags.is_json && !attr->raw);
+	value = check_value(attr->head, JSON_VALUE_RAW, "[1]");
+	rad_assert(!check_value(value, JSON_VALUE_OBJECT, "{\"q\":2}"));
+
+	attr = find(s, "Arr");
+	rad_assert(!attr->expanded && attr->is_array);
+	value = check_value(attr->head, JSON_VALUE_INT, "1");
+	value = check_value(value, JSON_VALUE_RAW, "[2,3]");
+	value = check_value(value, JSON_VALUE_OBJECT, "{\"z\":\"w\"}");
+	value = check_value(value, JSON_VALUE_STRING, "s");
+	rad_assert(!check_value(value, JSON_VALUE_NULL, "null"));
+
+	attr = find(s, "Ignored");
+	rad_assert(!check_value(attr->head, JSON_VALUE_STRING, "v"));
+
+	talloc_free(s);
+
+	MPRINT1("nesting: OK\n");
+}
+
+/*
+ *	Data which stops part way through isn't an error, it's just
+ *	not done.
+ */
+static void test_truncated(TALLOC_CTX *ctx)
+{
+	static char const	*truncated[] = {
+		"",
+		"   ",
+		"{",
+		"{\"A\"",
+		"{\"A\":",
+		"{\"A\":\"b",
+		"{\"A\":\"b\\",
+		"{\"A\":\"\\u00",
+		"{\"A\":12",
+		"{\"A\":tr",
+		"{\"A\":[1,{\"b\":",
+		"{\"A\":\"b\"",
+		"{\"A\":\"b\",",
+	};
+	json_stream_t		*s;
+	size_t			i;
+
+	for (i = 0; i < sizeof(truncated) / sizeof(*truncated); i++) {
+		s = parse(ctx, truncated[i]);
+		rad_assert(s->state != JSON_STREAM_DONE);
+		rad_assert(s->state != JSON_STREAM_ERROR);
+		talloc_free(s);
+	}
+
+	MPRINT1("truncated: OK\n");
+}
+
+/*
+ *	Malformed data.
+ */
+static void test_invalid(TALLOC_CTX *ctx)
+{
+	char		deep[128];
+	size_t		i;
+
+	check_error(ctx, "[\"a\"]", "expected JSON object");
+	check_error(ctx, "\"a\"", "expected JSON object");
+	check_error(ctx, "42 ", "expected JSON object");
+	check_error(ctx, "x", "unexpected character");
+	check_error(ctx, "{\"A\":x}", "unexpected character");
+	check_error(ctx, "{A:1}", "expected object key");
+	check_error(ctx, "{\"A\":1,}", "expected object key");
+	check_error(ctx, "{\"A\" 1}", "expected ':'");
+	check_error(ctx, "{\"A\":1 \"B\":2}", "expected ',' or end of container");
+	check_error(ctx, "{\"A\":[1}}", "mismatched brackets");
+	check_error(ctx, "{\"A\":1]", "mismatched brackets");
+	check_error(ctx, "{\"A\":\"b\\x\"}", "invalid escape sequence");
+	check_error(ctx, "{\"A\":\"\\u12g4\"}", "invalid escape sequence");
+	check_error(ctx, "{\"A\":\"a\nb\"}", "control character in string");
+	check_error(ctx, "{\"A\":1.2.3}", "invalid number");
+	check_error(ctx, "{\"A\":-}", "invalid number");
+	check_error(ctx, "{\"A\":tru}", "invalid literal");
+	check_error(ctx, "{\"A\":nulls}", "invalid literal");
+	check_error(ctx, "{\"A\":1}x", "data after end of root object");
+	check_error(ctx, "{\"A\":1}{}", "data after end of root object");
+
+	/*
+	 *	The limit is on the total depth, including the root.
+	 */
+	strcpy(deep, "{\"A\":");
+	for (i = 0; i < REST_JSON_MAX_DEPTH; i++) strcat(deep, "[");
+	check_error(ctx, deep, "too many nested containers");
+
+	MPRINT1("invalid: OK\n");
+}
+
+/*
+ *	Values past the limit are discarded, but the data is still
+ *	checked.
+ */
+static void test_max_values(TALLOC_CTX *ctx)
+{
+	json_stream_t		*s;
+	json_attr_t const	*attr;
+	static char const	json[] = "{\"A\":[1,2],\"B\":3,\"C\":4}";
+
+	s = json_stream_alloc(ctx, 2);
+	rad_assert(s != NULL);
+	json_stream_parse(s, json, sizeof(json) - 1);
+	rad_assert(s->state == JSON_STREAM_DONE);
+
+	attr = find(s, "A");
+	rad_assert(attr->next == NULL);
+	rad_assert(!check_value(check_value(attr->head, JSON_VALUE_INT, "1"), JSON_VALUE_INT, "2"));
+	talloc_free(s);
+
+	s = json_stream_alloc(ctx, 2);
+	rad_assert(s != NULL);
+	json_stream_parse(s, "{\"A\":1,\"B\":2,\"C\":", 17);
+	json_stream_parse(s, "x}", 2);
+	rad_assert(s->state == JSON_STREAM_ERROR);
+	talloc_free(s);
+
+	MPRINT1("max values: OK\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	TALLOC_CTX	*ctx;
+
+	while ((c = getopt(argc, argv, "hx")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	ctx = talloc_init("json_stream_test");
+
+	test_scalars(ctx);
+	test_escapes(ctx);
+	test_nesting(ctx);
+	test_truncated(ctx);
+	test_invalid(ctx);
+	test_max_values(ctx);
+
+	talloc_free(ctx);
+
+	return 0;
+}
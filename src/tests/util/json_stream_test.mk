@@ -0,0 +1,8 @@
+TARGET := json_stream_test
+
+SOURCES		:= json_stream_test.c ${top_srcdir}/src/modules/rlm_rest/json_stream.c
+
+SRC_CFLAGS	:= -I${top_srcdir}/src/modules/rlm_rest
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
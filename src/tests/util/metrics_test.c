@@ -0,0 +1,236 @@
+/*
+ * metrics_test.c	Tests for the metrics exposition format, and the allow-list
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/metrics.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: metrics_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+#ifdef WITH_METRICS
+#define has_line(_out, _line) (strstr(_out, _line "\n") != NULL)
+
+static void test_label(void)
+{
+	char buffer[32];
+
+	rad_assert(strcmp(metrics_label(buffer, sizeof(buffer), "plain"), "plain") == 0);
+	rad_assert(strcmp(metrics_label(buffer, sizeof(buffer), NULL), "") == 0);
+	rad_assert(strcmp(metrics_label(buffer, sizeof(buffer), "a\"b\\c\nd"), "a\\\"b\\\\c\\nd") == 0);
+
+	/*
+	 *	Truncation never leaves half an escape.
+	 */
+	rad_assert(strcmp(metrics_label(buffer, 5, "abc\"d"), "abc") == 0);
+	rad_assert(strcmp(metrics_label(buffer, 6, "abc\"d"), "abc\\\"") == 0);
+
+	MPRINT1("label: OK\n");
+}
+
+static void source_init(metrics_source_t *source, char const *labels)
+{
+	memset(source, 0, sizeof(*source));
+	strlcpy(source->labels, labels, sizeof(source->labels));
+}
+
+/*
+ *	Counter families have the "_total" suffix in the Prometheus
+ *	text format, but not in OpenMetrics.  The samples always do.
+ */
+static void test_counters(TALLOC_CTX *ctx)
+{
+	metrics_source_t	source[2];
+	metrics_sources_t	sources = { .source = source, .num = 2, .size = 2 };
+	metrics_ctx_t		mc;
+
+	source_init(&source[0], "type=\"auth\"");
+	source[0].stats.total_requests = 5;
+	source[0].stats.total_access_accepts = 3;
+	source_init(&source[1], "type=\"acct\"");
+	source[1].stats.total_requests = 7;
+
+	mc.openmetrics = false;
+	mc.out = talloc_strdup(ctx, "");
+	metrics_print_counters(&mc, "freeradius", &sources);
+	rad_assert(mc.out != NULL);
+	if (debug_lvl > 1) printf("%s", mc.out);
+
+	rad_assert(has_line(mc.out, "# HELP freeradius_requests_total Requests received"));
+	rad_assert(has_line(mc.out, "# TYPE freeradius_requests_total counter"));
+	rad_assert(has_line(mc.out, "freeradius_requests_total{type=\"auth\"} 5"));
+	rad_assert(has_line(mc.out, "freeradius_requests_total{type=\"acct\"} 7"));
+	rad_assert(has_line(mc.out, "freeradius_access_accepts_total{type=\"auth\"} 3"));
+	rad_assert(has_line(mc.out, "freeradius_access_accepts_total{type=\"acct\"} 0"));
+	talloc_free(mc.out);
+
+	mc.openmetrics = true;
+	mc.out = talloc_strdup(ctx, "");
+	metrics_print_counters(&mc, "freeradius", &sources);
+	rad_assert(mc.out != NULL);
+
+	rad_assert(has_line(mc.out, "# TYPE freeradius_requests counter"));
+	rad_assert(has_line(mc.out, "freeradius_requests_total{type=\"auth\"} 5"));
+	talloc_free(mc.out);
+
+	/*
+	 *	Nothing at all without sources.
+	 */
+	sources.num = 0;
+	mc.out = talloc_strdup(ctx, "");
+	metrics_print_counters(&mc, "freeradius", &sources);
+	rad_assert(mc.out && (mc.out[0] == '\0'));
+	talloc_free(mc.out);
+
+	MPRINT1("counters: OK\n");
+}
+
+/*
+ *	Buckets are cumulative, in seconds, and sources without a
+ *	histogram are left out.
+ */
+static void test_latency(TALLOC_CTX *ctx)
+{
+	metrics_source_t	source[2];
+	metrics_sources_t	sources = { .source = source, .num = 2, .size = 2 };
+	metrics_ctx_t		mc;
+
+	source_init(&source[0], "type=\"auth\"");
+	source[0].no_hist = true;
+	source_init(&source[1], "type=\"acct\"");
+	fr_hist_add(&source[1].hist, 50);
+	fr_hist_add(&source[1].hist, 300);
+	fr_hist_add(&source[1].hist, 20 * 1000000);
+
+	mc.openmetrics = false;
+	mc.out = talloc_strdup(ctx, "");
+	metrics_print_latency(&mc, "freeradius", "Time taken", &sources);
+	rad_assert(mc.out != NULL);
+	if (debug_lvl > 1) printf("%s", mc.out);
+
+	rad_assert(has_line(mc.out, "# TYPE freeradius_latency_seconds histogram"));
+	rad_assert(has_line(mc.out, "freeradius_latency_seconds_bucket{type=\"acct\",le=\"0.0001\"} 1"));
+	rad_assert(has_line(mc.out, "freeradius_latency_seconds_bucket{type=\"acct\",le=\"0.00025\"} 1"));
+	rad_assert(has_line(mc.out, "freeradius_latency_seconds_bucket{type=\"acct\",le=\"0.0005\"} 2"));
+	rad_assert(has_line(mc.out, "freeradius_latency_seconds_bucket{type=\"acct\",le=\"10.0\"} 2"));
+	rad_assert(has_line(mc.out, "freeradius_latency_seconds_bucket{type=\"acct\",le=\"+Inf\"} 3"));
+	rad_assert(has_line(mc.out, "freeradius_latency_seconds_count{type=\"acct\"} 3"));
+	rad_assert(has_line(mc.out, "freeradius_latency_seconds_sum{type=\"acct\"} 20.000350"));
+	rad_assert(!strstr(mc.out, "type=\"auth\""));
+	talloc_free(mc.out);
+
+	/*
+	 *	No family at all, if no source has a histogram.
+	 */
+	sources.num = 1;
+	mc.out = talloc_strdup(ctx, "");
+	metrics_print_latency(&mc, "freeradius", "Time taken", &sources);
+	rad_assert(mc.out && (mc.out[0] == '\0'));
+	talloc_free(mc.out);
+
+	MPRINT1("latency: OK\n");
+}
+
+static void test_allowed(TALLOC_CTX *ctx)
+{
+	fr_ipaddr_t	*allow, peer;
+
+	rad_assert(fr_inet_pton(&peer, "127.0.0.2", -1, AF_UNSPEC, false, true) == 0);
+	rad_assert(metrics_ipaddr_is_loopback(&peer));
+	rad_assert(metrics_ipaddr_allowed(NULL, &peer));
+
+	rad_assert(fr_inet_pton(&peer, "::1", -1, AF_UNSPEC, false, true) == 0);
+	rad_assert(metrics_ipaddr_is_loopback(&peer));
+
+	rad_assert(fr_inet_pton(&peer, "192.0.2.1", -1, AF_UNSPEC, false, true) == 0);
+	rad_assert(!metrics_ipaddr_is_loopback(&peer));
+
+	allow = talloc_array(ctx, fr_ipaddr_t, 2);
+	rad_assert(fr_inet_pton(&allow[0], "192.0.2.0/24", -1, AF_UNSPEC, false, true) == 0);
+	rad_assert(fr_inet_pton(&allow[1], "2001:db8::1", -1, AF_UNSPEC, false, true) == 0);
+
+	rad_assert(metrics_ipaddr_allowed(allow, &peer));
+
+	rad_assert(fr_inet_pton(&peer, "192.0.3.1", -1, AF_UNSPEC, false, true) == 0);
+	rad_assert(!metrics_ipaddr_allowed(allow, &peer));
+
+	rad_assert(fr_inet_pton(&peer, "2001:db8::1", -1, AF_UNSPEC, false, true) == 0);
+	rad_assert(metrics_ipaddr_allowed(allow, &peer));
+
+	rad_assert(fr_inet_pton(&peer, "2001:db8::2", -1, AF_UNSPEC, false, true) == 0);
+	rad_assert(!metrics_ipaddr_allowed(allow, &peer));
+
+	/*
+	 *	An IPv4 network doesn't match IPv6 peers.
+	 */
+	rad_assert(fr_inet_pton(&peer, "::ffff:192.0.2.1", -1, AF_UNSPEC, false, true) == 0);
+	rad_assert(!metrics_ipaddr_allowed(allow, &peer));
+
+	talloc_free(allow);
+
+	MPRINT1("allowed: OK\n");
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	TALLOC_CTX	*ctx;
+
+	while ((c = getopt(argc, argv, "hx")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	ctx = talloc_init("metrics_test");
+
+#ifdef WITH_METRICS
+	test_label();
+	test_counters(ctx);
+	test_latency(ctx);
+	test_allowed(ctx);
+#endif
+
+	talloc_free(ctx);
+
+	return 0;
+}
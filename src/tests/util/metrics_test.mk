@@ -0,0 +1,6 @@
+TARGET := metrics_test
+
+SOURCES		:= metrics_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,912 @@
+/*
+ * pipeline_bench.c	Benchmark for the master -> channel -> worker -> reply path
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/control.h>
+#include <freeradius-devel/io/worker.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/hist.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <sys/event.h>
+#include <sys/resource.h>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
+
+#define MAX_MESSAGES		(2048)
+#define MAX_CONTROL_PLANE	(1024)
+#define MAX_KEVENTS		(10)
+#define MAX_WORKERS		(1024)
+#define MAX_MESSAGE_SIZE	(65536)
+
+#define MPRINT1 if (debug_lvl) printf
+#define MPRINT2 if (debug_lvl > 1) printf
+
+/*
+ *	Where the time for each request goes.
+ */
+typedef enum {
+	STAGE_REQUEST = 0,				//!< Master sending, to the worker starting to process it.
+	STAGE_PROCESS,					//!< Worker processing, including decode and encode.
+	STAGE_REPLY,					//!< Worker sending the reply, to the master reading it.
+	STAGE_TOTAL,
+	STAGE_MAX
+} bench_stage_t;
+
+static char const *stage_names[STAGE_MAX] = {
+	[STAGE_REQUEST] = "request",
+	[STAGE_PROCESS] = "process",
+	[STAGE_REPLY] = "reply",
+	[STAGE_TOTAL] = "total"
+};
+
+/*
+ *	Hardware counters, for all threads in the process.
+ */
+typedef struct bench_counter_t {
+	char const	*name;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	uint32_t	type;
+	uint64_t	config;
+#endif
+	int		fd;
+	bool		valid;				//!< Whether the counter was read.
+	uint64_t	value;
+} bench_counter_t;
+
+static bench_counter_t counters[] = {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	{ .name = "cycles",		.type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_CPU_CYCLES },
+	{ .name = "instructions",	.type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_INSTRUCTIONS },
+	{ .name = "cache_references",	.type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_CACHE_REFERENCES },
+	{ .name = "cache_misses",	.type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_CACHE_MISSES },
+	{ .name = "context_switches",	.type = PERF_TYPE_SOFTWARE, .config = PERF_COUNT_SW_CONTEXT_SWITCHES },
+	{ .name = "cpu_migrations",	.type = PERF_TYPE_SOFTWARE, .config = PERF_COUNT_SW_CPU_MIGRATIONS },
+#endif
+	{ .name = NULL }
+};
+
+typedef struct fr_schedule_worker_t {
+	int		id;			//!< ID of the worker 0..N
+	pthread_t	pthread_id;		//!< pthread ID of the worker
+	fr_worker_t	*worker;		//!< pointer to the worker
+	fr_channel_t	*ch;			//!< channel for communicating with the worker
+} fr_schedule_worker_t;
+
+static int		debug_lvl = 0;
+static int		kq_master;
+static fr_atomic_queue_t *aq_master;
+static fr_control_t	*control_master;
+static int		max_messages = 100000;
+static int		max_warmup = 0;
+static int		max_control_plane = 0;
+static int		max_outstanding = 64;
+static int		burst_size = 0;
+static fr_time_t	burst_interval = 0;
+static size_t		message_size = 64;
+static size_t		reply_size = 64;
+static fr_time_t	work_time = 0;
+static bool		touch_memory = false;
+static bool		json_output = false;
+static int		num_workers = 1;
+static fr_schedule_worker_t workers[MAX_WORKERS];
+
+/*
+ *	Results
+ */
+static fr_hist_t	stage_hist[STAGE_MAX];	//!< Latency, in nanoseconds.
+static int		num_measured = 0;
+static fr_time_t	measure_start = 0;
+static fr_time_t	measure_end = 0;
+static struct rusage	usage_start, usage_end;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: pipeline_bench [OPTS]\n");
+	fprintf(stderr, "  -b <burst>             Send messages in bursts of this size.  Default is to keep\n");
+	fprintf(stderr, "                         the outstanding limit full.\n");
+	fprintf(stderr, "  -c <control-plane>     Size of the control plane queue.\n");
+	fprintf(stderr, "  -i <usec>              Time between the start of each burst.\n");
+	fprintf(stderr, "  -j                     Print the results as one line of JSON.\n");
+	fprintf(stderr, "  -m <messages>          Send number of messages.  Default is 100000.\n");
+	fprintf(stderr, "  -o <outstanding>       Keep at most number of messages outstanding.  Default is 64.\n");
+	fprintf(stderr, "  -r <size>              Size of the replies.  Default is 64.\n");
+	fprintf(stderr, "  -s <size>              Size of the requests.  Default is 64.\n");
+	fprintf(stderr, "  -t                     Touch every byte of the requests and replies.\n");
+	fprintf(stderr, "  -u <usec>              Spin for this long when processing each request.\n");
+	fprintf(stderr, "  -W <messages>          Send number of messages before starting measurements.\n");
+	fprintf(stderr, "  -w N                   Create N workers.  Default is 1.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+/** Open the hardware counters
+ *
+ *  The counters are inherited by threads created after this
+ *  function is called, and read as a total for the process.  Counters
+ *  which can't be opened (no PMU, or perf_event_paranoid is too
+ *  strict) are skipped.
+ */
+static void counters_open(void)
+{
+	bench_counter_t *c;
+
+	for (c = counters; c->name; c++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = c->type;
+		attr.config = c->config;
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		c->fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (c->fd < 0) {
+			MPRINT1("Failed opening counter %s: %s\n", c->name, strerror(errno));
+		}
+	}
+}
+
+static void counters_enable(void)
+{
+	bench_counter_t *c;
+
+	for (c = counters; c->name; c++) {
+		if (c->fd >= 0) (void) ioctl(c->fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+/** Stop the counters, and read them
+ *
+ *  If the kernel had to multiplex the counters, the values are
+ *  scaled up to the time the counter was enabled.
+ */
+static void counters_disable(void)
+{
+	bench_counter_t *c;
+
+	for (c = counters; c->name; c++) {
+		uint64_t data[3];
+
+		if (c->fd < 0) continue;
+
+		(void) ioctl(c->fd, PERF_EVENT_IOC_DISABLE, 0);
+
+		if (read(c->fd, data, sizeof(data)) != sizeof(data)) continue;
+		if (!data[2]) continue;
+
+		c->value = data[0];
+		if (data[2] < data[1]) c->value = (uint64_t) ((double) data[0] * data[1] / data[2]);
+		c->valid = true;
+	}
+}
+
+static void counters_close(void)
+{
+	bench_counter_t *c;
+
+	for (c = counters; c->name; c++) {
+		if (c->fd >= 0) close(c->fd);
+		c->fd = -1;
+	}
+}
+#else
+#define counters_open()
+#define counters_enable()
+#define counters_disable()
+#define counters_close()
+#endif
+
+/** Spin for the given time, to simulate processing a request
+ *
+ */
+static void spin(fr_time_t how_long)
+{
+	fr_time_t end = fr_time() + how_long;
+
+	while (fr_time() < end);
+}
+
+static int test_decode(void const *packet_ctx, uint8_t *const data, size_t data_len, REQUEST *request)
+{
+	uint32_t number;
+
+	/*
+	 *	The data is the packet number.
+	 */
+	memcpy(&number, data, sizeof(number));
+	request->number = number;
+
+	if (touch_memory) {
+		size_t j;
+		uint8_t k;
+
+		for (j = k = 0; j < data_len; j++) {
+			k += data[j];
+		}
+
+		data[data_len - 1] = k;
+	}
+
+	MPRINT2("\t\tDECODE <<< request %zd - %p data %p size %zd\n", request->number, packet_ctx, data, data_len);
+	return 0;
+}
+
+static ssize_t test_encode(void const *packet_ctx, REQUEST *request, uint8_t *const data, size_t data_len)
+{
+	size_t size = reply_size;
+
+	if (size > data_len) size = data_len;
+
+	if (touch_memory) memset(data, request->number & 0xff, size);
+
+	MPRINT2("\t\tENCODE >>> request %zd - data %p %p size %zd\n", request->number, packet_ctx, data, size);
+
+	return size;
+}
+
+static size_t test_nak(void const *packet_ctx, uint8_t *const packet, size_t packet_len, uint8_t *reply, UNUSED size_t reply_len)
+{
+	uint32_t number;
+
+	/*
+	 *	The data is the packet number.
+	 */
+	memcpy(&number, packet, sizeof(number));
+	memcpy(reply, packet, sizeof(number));
+
+	MPRINT1("\t\tNAK !!! request %zd - data %p %p size %zd\n", (uint64_t) number, packet_ctx, packet, packet_len);
+
+	return 10;
+}
+
+static fr_transport_final_t test_process(REQUEST *request, fr_transport_action_t action)
+{
+	MPRINT2("\t\tPROCESS --- request %zd action %d\n", request->number, action);
+
+	if (work_time) spin(work_time);
+
+	return FR_TRANSPORT_REPLY;
+}
+
+static fr_transport_t transport = {
+	.name = "pipeline-bench",
+	.id = 1,
+	.default_message_size = 4096,
+	.decode = test_decode,
+	.encode = test_encode,
+	.nak = test_nak,
+	.process = test_process,
+};
+
+static fr_transport_t *transports = &transport;
+
+static void *worker_thread(void *arg)
+{
+	TALLOC_CTX *ctx;
+	fr_worker_t *worker;
+	fr_schedule_worker_t *sw;
+
+	sw = (fr_schedule_worker_t *) arg;
+
+	MPRINT1("\tWorker %d started.\n", sw->id);
+
+	ctx = talloc_init("worker");
+	if (!ctx) _exit(1);
+
+	worker = sw->worker = fr_worker_create(ctx, &default_log, 1, &transports);
+	if (!worker) {
+		fprintf(stderr, "pipeline_bench: Failed to create the worker\n");
+		exit(1);
+	}
+
+	MPRINT1("\tWorker %d looping.\n", sw->id);
+	fr_worker(worker);
+
+	sw->worker = NULL;
+	MPRINT1("\tWorker %d exiting.\n", sw->id);
+
+	talloc_free(ctx);
+	return NULL;
+}
+
+/** Start measuring, once the warmup messages have been answered
+ *
+ */
+static void measure_begin(fr_time_t now)
+{
+	measure_start = now;
+	getrusage(RUSAGE_SELF, &usage_start);
+	counters_enable();
+}
+
+/** Record the timings for a reply
+ *
+ *  The worker sets the reply "when" to the time it finished the
+ *  request, and the "request_time" to the time the master sent it.
+ *  Anything which isn't processing or the reply is time the request
+ *  spent in the channel, or waiting to be decoded.
+ */
+static void master_reply(fr_channel_data_t *reply, int num_replies, fr_time_t now)
+{
+	fr_time_t total, process, from_worker, to_worker;
+
+	if (num_replies == max_warmup) measure_begin(now);
+	if (num_replies <= max_warmup) goto done;
+
+	total = now - reply->reply.request_time;
+	process = reply->reply.processing_time;
+	from_worker = (now > reply->m.when) ? now - reply->m.when : 0;
+	to_worker = (total > (process + from_worker)) ? total - process - from_worker : 0;
+
+	fr_hist_add(&stage_hist[STAGE_REQUEST], to_worker);
+	fr_hist_add(&stage_hist[STAGE_PROCESS], process);
+	fr_hist_add(&stage_hist[STAGE_REPLY], from_worker);
+	fr_hist_add(&stage_hist[STAGE_TOTAL], total);
+
+	num_measured++;
+	measure_end = now;
+
+done:
+	fr_message_done(&reply->m);
+}
+
+static void master_process(void)
+{
+	bool running, signaled_close;
+	int rcode, i, num_events, which_worker;
+	int num_outstanding, num_messages;
+	int num_replies, burst_left;
+	fr_time_t next_burst;
+	fr_message_set_t *ms;
+	TALLOC_CTX *ctx;
+	fr_channel_t *ch;
+	fr_channel_event_t ce;
+	pthread_attr_t	attr;
+	fr_schedule_worker_t *sw;
+	struct kevent events[MAX_KEVENTS];
+
+	ctx = talloc_init("master");
+	if (!ctx) _exit(1);
+
+	ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
+	if (!ms) {
+		fprintf(stderr, "Failed creating message set\n");
+		exit(1);
+	}
+
+	MPRINT1("Master started.\n");
+
+	/*
+	 *	Create the worker threads.
+	 */
+	(void) pthread_attr_init(&attr);
+	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	for (i = 0; i < num_workers; i++) {
+		workers[i].id = i;
+		(void) pthread_create(&workers[i].pthread_id, &attr, worker_thread, &workers[i]);
+	}
+
+	MPRINT1("Master created %d workers.\n", num_workers);
+
+	/*
+	 *	Busy loop because that's fine for the test
+	 */
+	num_outstanding = 0;
+	while (num_outstanding < num_workers) {
+		for (i = 0; i < num_workers; i++) {
+			if (!workers[i].worker) continue;
+			if (workers[i].ch != NULL) continue;
+
+			/*
+			 *	Create the channel and signal the
+			 *	worker that it is open
+			 */
+			MPRINT1("Master creating channel to worker %d.\n", i);
+			workers[i].ch = fr_worker_channel_create(workers[i].worker, ctx, control_master);
+			rad_assert(workers[i].ch != NULL);
+
+			(void) fr_channel_master_ctx_add(workers[i].ch, &workers[i]);
+
+			num_outstanding++;
+		}
+	}
+
+	MPRINT1("Master created all channels.\n");
+
+	num_replies = num_outstanding = num_messages = 0;
+	which_worker = 0;
+	burst_left = 0;
+	next_burst = fr_time();
+
+	if (!max_warmup) measure_begin(next_burst);
+
+	running = true;
+	signaled_close = false;
+
+	while (running) {
+		fr_time_t now;
+		int num_to_send;
+		struct timespec ts, *timeout = NULL;
+		fr_channel_data_t *cd, *reply;
+
+		if (num_messages >= max_messages) {
+			MPRINT1("Master DONE sending\n");
+			goto check_close;
+		}
+
+		/*
+		 *	Without bursts, keep the outstanding queue full.
+		 *	With bursts, start a new one every interval, and
+		 *	send as much of it as the outstanding queue allows.
+		 */
+		now = fr_time();
+		if (!burst_size) {
+			burst_left = max_messages - num_messages;
+
+		} else if (now >= next_burst) {
+			burst_left += burst_size;
+			next_burst += burst_interval;
+			if (next_burst < now) next_burst = now;
+		}
+
+		num_to_send = max_outstanding - num_outstanding;
+		if (num_to_send > burst_left) num_to_send = burst_left;
+		if ((num_messages + num_to_send) > max_messages) {
+			num_to_send = max_messages - num_messages;
+		}
+		MPRINT1("Master sending %d messages\n", num_to_send);
+
+		for (i = 0; i < num_to_send; i++) {
+			cd = (fr_channel_data_t *) fr_message_alloc(ms, NULL, message_size);
+			rad_assert(cd != NULL);
+
+			num_outstanding++;
+			num_messages++;
+			burst_left--;
+
+			if (touch_memory) memset(cd->m.data, num_messages & 0xff, cd->m.data_size);
+
+			memcpy(cd->m.data, &num_messages, sizeof(num_messages));
+
+			cd->m.when = fr_time();
+
+			MPRINT2("Master sent message %d to worker %d\n", num_messages, which_worker);
+			rcode = fr_channel_send_request(workers[which_worker].ch, cd, &reply);
+			if (rcode < 0) {
+				fprintf(stderr, "Failed sending request: %s\n", strerror(errno));
+			}
+			which_worker++;
+			if (which_worker >= num_workers) which_worker = 0;
+
+			rad_assert(rcode == 0);
+			if (reply) {
+				num_replies++;
+				num_outstanding--;
+				master_reply(reply, num_replies, fr_time());
+			}
+		}
+
+		/*
+		 *	Wake up for the next burst, unless we're waiting
+		 *	for replies to make space for this one.
+		 */
+		if (burst_size && !burst_left && (num_messages < max_messages)) {
+			fr_time_t delay;
+
+			now = fr_time();
+			delay = (next_burst > now) ? next_burst - now : 0;
+
+			ts.tv_sec = delay / NANOSEC;
+			ts.tv_nsec = delay % NANOSEC;
+			timeout = &ts;
+		}
+
+		/*
+		 *	Signal close only when done.
+		 */
+check_close:
+		if (!signaled_close && (num_messages >= max_messages) && (num_outstanding == 0)) {
+			counters_disable();
+			getrusage(RUSAGE_SELF, &usage_end);
+
+			MPRINT1("Master signaling workers to exit.\n");
+
+			for (i = 0; i < num_workers; i++) {
+				if (debug_lvl) {
+					printf("Worker %d\n", i);
+					fr_worker_debug(workers[i].worker, stdout);
+				}
+
+				rcode = fr_channel_signal_worker_close(workers[i].ch);
+				MPRINT1("Master asked exit for worker %d.\n", workers[i].id);
+				if (rcode < 0) {
+					fprintf(stderr, "Failed signaling close %d: %s\n", i, strerror(errno));
+					exit(1);
+				}
+			}
+			signaled_close = true;
+		}
+
+		MPRINT2("Master waiting on events.\n");
+		rad_assert(num_messages <= max_messages);
+
+		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, timeout);
+		MPRINT2("Master kevent returned %d\n", num_events);
+
+		if (num_events < 0) {
+			if (errno == EINTR) continue;
+
+			fprintf(stderr, "Failed waiting for kevent: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		if (num_events == 0) continue;
+
+		/*
+		 *	Service the events.
+		 *
+		 *	@todo this should NOT take a channel pointer
+		 */
+		for (i = 0; i < num_events; i++) {
+			(void) fr_channel_service_kevent(workers[0].ch, control_master, &events[i]);
+		}
+
+		now = fr_time();
+
+		while (true) {
+			uint32_t id;
+			size_t data_size;
+			char data[256];
+
+			data_size = fr_control_message_pop(aq_master, &id, data, sizeof(data));
+			if (!data_size) break;
+
+			rad_assert(id == FR_CONTROL_ID_CHANNEL);
+
+			ce = fr_channel_service_message(now, &ch, data, data_size);
+			MPRINT2("Master got channel event %d\n", ce);
+
+			switch (ce) {
+			case FR_CHANNEL_DATA_READY_RECEIVER:
+				reply = fr_channel_recv_reply(ch);
+				if (!reply) {
+					MPRINT1("Master SIGNAL WITH NO DATA!\n");
+					continue;
+				}
+
+				do {
+					num_replies++;
+					num_outstanding--;
+					MPRINT2("Master got reply %d, outstanding=%d, %d/%d sent.\n",
+						num_replies, num_outstanding, num_messages, max_messages);
+					master_reply(reply, num_replies, fr_time());
+				} while ((reply = fr_channel_recv_reply(ch)) != NULL);
+				break;
+
+			case FR_CHANNEL_CLOSE:
+				sw = fr_channel_master_ctx_get(ch);
+				rad_assert(sw != NULL);
+
+				MPRINT1("Master received close signal for worker %d\n", sw->id);
+				rad_assert(signaled_close == true);
+
+				/*
+				 *	Tell the event loop to exit, and signal the worker
+				 *	so that it stops waiting on the KQ.
+				 */
+				(void) fr_worker_exit(sw->worker);
+				(void) pthread_kill(sw->pthread_id, SIGTERM);
+				running = false;
+				break;
+
+			case FR_CHANNEL_NOOP:
+				break;
+
+			default:
+				fprintf(stderr, "Master got unexpected CE %d\n", ce);
+
+				/*
+				 *	Not written yet!
+				 */
+				rad_assert(0 == 1);
+				break;
+			} /* switch over signal returned */
+		} /* drain the control plane */
+	} /* loop until told to exit */
+
+	MPRINT1("Master exiting.\n");
+
+	/*
+	 *	Busy-wait for the workers to exit;
+	 */
+	do {
+		num_outstanding = num_workers;
+
+		for (i = 0; i < num_workers; i++) {
+			if (!workers[i].worker) num_outstanding--;
+		}
+	} while (num_outstanding > 0);
+
+	/*
+	 *	Force all messages to be garbage collected
+	 */
+	MPRINT2("GC\n");
+	fr_message_set_gc(ms);
+
+	if (debug_lvl > 1) fr_message_set_debug(ms, stdout);
+
+	/*
+	 *	After the garbage collection, all messages marked "done" MUST also be marked "free".
+	 */
+	rcode = fr_message_set_messages_used(ms);
+	MPRINT2("Master messages used = %d\n", rcode);
+	rad_assert(rcode == 0);
+
+	talloc_free(ctx);
+}
+
+static uint64_t rusage_usec(struct timeval const *end, struct timeval const *start)
+{
+	return ((end->tv_sec - start->tv_sec) * USEC) + (end->tv_usec - start->tv_usec);
+}
+
+/** Print the results, either for people, or as one line of JSON
+ *
+ *  The JSON contains the options, so that results from different
+ *  runs can be compared.  Latencies are in nanoseconds.  Counters
+ *  which couldn't be read are null.
+ */
+static void print_results(void)
+{
+	int		i;
+	double		elapsed, rate;
+	uint64_t	user, sys;
+	bench_counter_t	*c;
+
+	elapsed = (double) (measure_end - measure_start) / NANOSEC;
+	rate = (elapsed > 0) ? num_measured / elapsed : 0;
+	user = rusage_usec(&usage_end.ru_utime, &usage_start.ru_utime);
+	sys = rusage_usec(&usage_end.ru_stime, &usage_start.ru_stime);
+
+	if (json_output) {
+		printf("{\"workers\":%d,\"messages\":%d,\"warmup\":%d,\"outstanding\":%d,"
+		       "\"burst\":%d,\"interval_ns\":%" PRIu64 ",\"request_size\":%zu,\"reply_size\":%zu,"
+		       "\"work_ns\":%" PRIu64 ",\"touch\":%s,",
+		       num_workers, max_messages, max_warmup, max_outstanding,
+		       burst_size, burst_interval, message_size, reply_size,
+		       work_time, touch_memory ? "true" : "false");
+
+		printf("\"measured\":%d,\"elapsed_ns\":%" PRIu64 ",\"packets_per_sec\":%.0f,"
+		       "\"user_usec\":%" PRIu64 ",\"sys_usec\":%" PRIu64 ",",
+		       num_measured, measure_end - measure_start, rate, user, sys);
+
+		for (i = 0; i < STAGE_MAX; i++) {
+			fr_hist_t const *h = &stage_hist[i];
+
+			printf("\"%s\":{\"min\":%" PRIu64 ",\"mean\":%" PRIu64 ",\"p50\":%" PRIu64
+			       ",\"p90\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "},",
+			       stage_names[i], h->min, h->count ? h->sum / h->count : 0,
+			       fr_hist_percentile(h, 500), fr_hist_percentile(h, 900), fr_hist_percentile(h, 990),
+			       fr_hist_percentile(h, 999), h->max);
+		}
+
+		printf("\"counters\":{");
+		for (c = counters; c->name; c++) {
+			if (c != counters) printf(",");
+
+			if (c->valid) {
+				printf("\"%s\":%" PRIu64, c->name, c->value);
+			} else {
+				printf("\"%s\":null", c->name);
+			}
+		}
+		printf("}}\n");
+		return;
+	}
+
+	printf("Workers %d, request size %zu, reply size %zu, outstanding %d", num_workers,
+	       message_size, reply_size, max_outstanding);
+	if (burst_size) printf(", burst %d every %" PRIu64 "us", burst_size, burst_interval / 1000);
+	printf("\n");
+
+	printf("Measured %d of %d messages in %.3fs: %.0f packets/s\n",
+	       num_measured, max_messages, elapsed, rate);
+	printf("CPU user %.3fs, system %.3fs\n", (double) user / USEC, (double) sys / USEC);
+
+	printf("\n%-10s %10s %10s %10s %10s %10s %10s (usec)\n", "stage", "mean", "p50", "p90", "p99", "p99.9", "max");
+	for (i = 0; i < STAGE_MAX; i++) {
+		fr_hist_t const *h = &stage_hist[i];
+
+		printf("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", stage_names[i],
+		       h->count ? (double) h->sum / h->count / 1000 : 0,
+		       (double) fr_hist_percentile(h, 500) / 1000, (double) fr_hist_percentile(h, 900) / 1000,
+		       (double) fr_hist_percentile(h, 990) / 1000, (double) fr_hist_percentile(h, 999) / 1000,
+		       (double) h->max / 1000);
+	}
+
+	if (!counters[0].name) return;
+
+	printf("\n");
+	for (c = counters; c->name; c++) {
+		if (!c->valid) {
+			printf("%-18s %16s\n", c->name, "not supported");
+			continue;
+		}
+
+		printf("%-18s %16" PRIu64, c->name, c->value);
+		if (num_measured) printf("  %10.2f / packet", (double) c->value / num_measured);
+		printf("\n");
+	}
+}
+
+static void sig_ignore(int sig)
+{
+	(void) signal(sig, sig_ignore);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	if (fr_time_start() < 0) {
+		fprintf(stderr, "Failed to start time: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	fr_log_init(&default_log, false);
+
+	while ((c = getopt(argc, argv, "b:c:hi:jm:o:r:s:tu:W:w:x")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'b':
+			burst_size = atoi(optarg);
+			if (burst_size < 0) usage();
+			break;
+
+		case 'c':
+			max_control_plane = atoi(optarg);
+			break;
+
+		case 'i':
+			burst_interval = (fr_time_t) atoi(optarg) * 1000;
+			break;
+
+		case 'j':
+			json_output = true;
+			break;
+
+		case 'm':
+			max_messages = atoi(optarg);
+			if (max_messages <= 0) usage();
+			break;
+
+		case 'o':
+			max_outstanding = atoi(optarg);
+			if (max_outstanding <= 0) usage();
+			break;
+
+		case 'r':
+			reply_size = atoi(optarg);
+			if ((reply_size == 0) || (reply_size > MAX_MESSAGE_SIZE)) usage();
+			break;
+
+		case 's':
+			message_size = atoi(optarg);
+			if ((message_size < sizeof(uint32_t)) || (message_size > MAX_MESSAGE_SIZE)) usage();
+			break;
+
+		case 't':
+			touch_memory = true;
+			break;
+
+		case 'u':
+			work_time = (fr_time_t) atoi(optarg) * 1000;
+			break;
+
+		case 'W':
+			max_warmup = atoi(optarg);
+			if (max_warmup < 0) usage();
+			break;
+
+		case 'w':
+			num_workers = atoi(optarg);
+			if ((num_workers <= 0) || (num_workers >= MAX_WORKERS)) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (max_outstanding > max_messages) max_outstanding = max_messages;
+
+	/*
+	 *	The warmup messages are sent in addition to the measured ones.
+	 */
+	max_messages += max_warmup;
+
+	if (!max_control_plane) {
+		max_control_plane = MAX_CONTROL_PLANE;
+		if (max_outstanding > max_control_plane) max_control_plane = max_outstanding;
+		if (num_workers > max_control_plane) max_control_plane = num_workers + (num_workers >> 1);
+	}
+
+	/*
+	 *	The worker reserves this much for each reply.
+	 */
+	if (reply_size > transport.default_message_size) transport.default_message_size = reply_size;
+
+	kq_master = kqueue();
+	rad_assert(kq_master >= 0);
+
+	aq_master = fr_atomic_queue_create(autofree, max_control_plane);
+	rad_assert(aq_master != NULL);
+
+	control_master = fr_control_create(autofree, kq_master, aq_master);
+	rad_assert(control_master != NULL);
+
+	signal(SIGTERM, sig_ignore);
+
+	if (debug_lvl) {
+		setvbuf(stdout, NULL, _IONBF, 0);
+	}
+
+	/*
+	 *	Before the workers are created, so that they inherit
+	 *	the counters.
+	 */
+	counters_open();
+
+	master_process();
+
+	counters_close();
+
+	print_results();
+
+	close(kq_master);
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := pipeline_bench
+
+SOURCES		:= pipeline_bench.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-io.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,305 @@
+/*
+ * radclient_bench_test.c	Tests for the radclient benchmark templates
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radclient.h>
+#include <freeradius-devel/md5.h>
+#include <freeradius-devel/net.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+static int		debug_lvl = 0;
+static char		*secret;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: radclient_bench_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to share).\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/*
+ *	Find the first instance of an attribute in an encoded packet.
+ */
+static uint8_t const *find_attr(uint8_t const *packet, size_t len, unsigned int type, size_t *value_len)
+{
+	uint8_t const *attr = packet + RADIUS_HDR_LEN;
+	uint8_t const *end = packet + len;
+
+	while ((attr + 2) <= end) {
+		rad_assert(attr[1] >= 2);
+		rad_assert((attr + attr[1]) <= end);
+
+		if (attr[0] == type) {
+			*value_len = attr[1] - 2;
+			return attr + 2;
+		}
+		attr += attr[1];
+	}
+
+	return NULL;
+}
+
+/*
+ *	Check the Message-Authenticator of a packet.
+ */
+static void check_ma(uint8_t const *packet, size_t len)
+{
+	uint8_t		copy[MAX_PACKET_LEN];
+	uint8_t		digest[AUTH_VECTOR_LEN];
+	uint8_t const	*ma;
+	size_t		ma_len;
+
+	ma = find_attr(packet, len, PW_MESSAGE_AUTHENTICATOR, &ma_len);
+	rad_assert(ma && (ma_len == AUTH_VECTOR_LEN));
+
+	memcpy(copy, packet, len);
+	memset(copy + (ma - packet), 0, AUTH_VECTOR_LEN);
+	fr_hmac_md5(digest, copy, len, (uint8_t const *) secret, strlen(secret));
+
+	rad_assert(memcmp(digest, ma, AUTH_VECTOR_LEN) == 0);
+}
+
+static RADIUS_PACKET *request_alloc(TALLOC_CTX *ctx, PW_CODE code, char const *password_attr, char const *password)
+{
+	RADIUS_PACKET *packet;
+
+	packet = fr_radius_alloc(ctx, true);
+	rad_assert(packet != NULL);
+	packet->code = code;
+
+	rad_assert(fr_pair_make(packet, &packet->vps, "User-Name", "bob", T_OP_EQ) != NULL);
+	rad_assert(fr_pair_make(packet, &packet->vps, "Called-Station-Id", "station-####-x", T_OP_EQ) != NULL);
+	if (password_attr) rad_assert(fr_pair_make(packet, &packet->vps, password_attr, password, T_OP_EQ) != NULL);
+	if (code == PW_CODE_ACCESS_REQUEST) {
+		rad_assert(fr_pair_make(packet, &packet->vps, "Message-Authenticator", "0x00", T_OP_EQ) != NULL);
+	}
+
+	return packet;
+}
+
+/*
+ *	Each packet gets a new Request Authenticator, the User-Password
+ *	is encrypted with it, and the counter and User-Name are replaced.
+ */
+static void test_access_request(TALLOC_CTX *ctx)
+{
+	static char const	plaintext[] = "a password longer than sixteen";
+	RADIUS_PACKET		*packet;
+	rc_bench_template_t	tmpl;
+	uint8_t			out[2][MAX_PACKET_LEN];
+	size_t			len[2], value_len;
+	uint8_t			vector[2][AUTH_VECTOR_LEN];
+	uint8_t const		*value;
+	char			*name;
+	char			password[MAX_PASS_LEN + 1];
+	int			i;
+
+	packet = request_alloc(ctx, PW_CODE_ACCESS_REQUEST, "User-Password", plaintext);
+
+	rad_assert(rc_bench_template_prepare(packet, true) == 0);
+	rad_assert(!fr_pair_find_by_num(packet->vps, 0, PW_USER_NAME, TAG_ANY));
+	rad_assert(!fr_pair_find_by_num(packet->vps, 0, PW_CHAP_CHALLENGE, TAG_ANY));
+
+	rad_assert(rc_bench_template_init(ctx, &tmpl, packet, true, secret) == 0);
+	rad_assert(tmpl.counter_offset > 0);
+	rad_assert(tmpl.counter_len == 4);
+	rad_assert(tmpl.ma_offset > 0);
+	rad_assert(tmpl.password_offset > 0);
+	rad_assert(tmpl.password_len == (sizeof(plaintext) - 1));
+
+	name = talloc_strdup(ctx, "alice");
+
+	for (i = 0; i < 2; i++) {
+		memset(vector[i], 'a' + i, AUTH_VECTOR_LEN);
+		len[i] = rc_bench_packet(out[i], &tmpl, secret, i ? 123456 : 42, name, vector[i], 10 + i);
+
+		rad_assert(len[i] == (tmpl.data_len + 2 + strlen(name)));
+		rad_assert(out[i][0] == PW_CODE_ACCESS_REQUEST);
+		rad_assert(out[i][1] == (10 + i));
+		rad_assert((size_t) ((out[i][2] << 8) | out[i][3]) == len[i]);
+		rad_assert(memcmp(out[i] + 4, vector[i], AUTH_VECTOR_LEN) == 0);
+
+		value = find_attr(out[i], len[i], PW_USER_NAME, &value_len);
+		rad_assert(value && (value_len == strlen(name)) && (memcmp(value, name, value_len) == 0));
+
+		/*
+		 *	Digits which don't fit are dropped from the left.
+		 */
+		value = find_attr(out[i], len[i], PW_CALLED_STATION_ID, &value_len);
+		rad_assert(value && (value_len == 14));
+		rad_assert(memcmp(value, i ? "station-3456-x" : "station-0042-x", value_len) == 0);
+
+		value = find_attr(out[i], len[i], PW_USER_PASSWORD, &value_len);
+		rad_assert(value && (value_len == 32));
+		memcpy(password, value, value_len);
+		fr_radius_decode_password(password, value_len, secret, vector[i]);
+		rad_assert(strcmp(password, plaintext) == 0);
+
+		check_ma(out[i], len[i]);
+	}
+
+	/*
+	 *	The encrypted passwords differ, as the vectors do.
+	 */
+	rad_assert(memcmp(out[0] + tmpl.password_offset + 2 + strlen(name),
+			  out[1] + tmpl.password_offset + 2 + strlen(name), 32) != 0);
+
+	MPRINT1("access-request: OK\n");
+}
+
+/*
+ *	CHAP gets an explicit challenge when the template is prepared,
+ *	so the CHAP-Password stays valid with each new Request Authenticator.
+ */
+static void test_chap(TALLOC_CTX *ctx)
+{
+	RADIUS_PACKET		*packet;
+	VALUE_PAIR		*vp, *password;
+	rc_bench_template_t	tmpl;
+	uint8_t			out[MAX_PACKET_LEN];
+	uint8_t			buffer[17], vector[AUTH_VECTOR_LEN], digest[AUTH_VECTOR_LEN];
+	uint8_t			string[1 + 32 + AUTH_VECTOR_LEN];
+	uint8_t const		*chap, *challenge;
+	size_t			len, chap_len, challenge_len;
+
+	packet = request_alloc(ctx, PW_CODE_ACCESS_REQUEST, "CHAP-Password", "0x00");
+
+	rad_assert(rc_bench_template_prepare(packet, false) == 0);
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_CHAP_CHALLENGE, TAG_ANY);
+	rad_assert(vp && (vp->vp_length == AUTH_VECTOR_LEN));
+	rad_assert(memcmp(vp->vp_octets, packet->vector, AUTH_VECTOR_LEN) == 0);
+
+	/*
+	 *	As radclient does.
+	 */
+	password = fr_pair_make(packet, NULL, "Cleartext-Password", "chap-password", T_OP_EQ);
+	rad_assert(password != NULL);
+	fr_radius_encode_chap_password(buffer, packet, 7, password);
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_CHAP_PASSWORD, TAG_ANY);
+	fr_pair_value_memcpy(vp, buffer, sizeof(buffer));
+
+	rad_assert(rc_bench_template_init(ctx, &tmpl, packet, false, secret) == 0);
+	rad_assert(tmpl.password_offset == 0);
+
+	memset(vector, 'z', sizeof(vector));
+	len = rc_bench_packet(out, &tmpl, secret, 0, NULL, vector, 1);
+
+	chap = find_attr(out, len, PW_CHAP_PASSWORD, &chap_len);
+	rad_assert(chap && (chap_len == 17));
+	challenge = find_attr(out, len, PW_CHAP_CHALLENGE, &challenge_len);
+	rad_assert(challenge && (challenge_len == AUTH_VECTOR_LEN));
+	rad_assert(memcmp(challenge, vector, AUTH_VECTOR_LEN) != 0);
+
+	string[0] = chap[0];
+	memcpy(string + 1, password->vp_strvalue, password->vp_length);
+	memcpy(string + 1 + password->vp_length, challenge, challenge_len);
+	fr_md5_calc(digest, string, 1 + password->vp_length + challenge_len);
+	rad_assert(memcmp(digest, chap + 1, AUTH_VECTOR_LEN) == 0);
+
+	check_ma(out, len);
+
+	MPRINT1("chap: OK\n");
+}
+
+/*
+ *	Other packets get a Request Authenticator calculated from the
+ *	contents, and the vector is ignored.
+ */
+static void test_accounting_request(TALLOC_CTX *ctx)
+{
+	RADIUS_PACKET		*packet;
+	rc_bench_template_t	tmpl;
+	uint8_t			out[MAX_PACKET_LEN];
+	uint8_t			authenticator[AUTH_VECTOR_LEN], vector[AUTH_VECTOR_LEN];
+	size_t			len;
+	FR_MD5_CTX		md5;
+
+	packet = request_alloc(ctx, PW_CODE_ACCOUNTING_REQUEST, NULL, NULL);
+
+	rad_assert(rc_bench_template_prepare(packet, false) == 0);
+	rad_assert(rc_bench_template_init(ctx, &tmpl, packet, false, secret) == 0);
+	rad_assert(tmpl.ma_offset == 0);
+	rad_assert(tmpl.password_offset == 0);
+
+	memset(vector, 'v', sizeof(vector));
+	len = rc_bench_packet(out, &tmpl, secret, 99, NULL, vector, 200);
+
+	memcpy(authenticator, out + 4, AUTH_VECTOR_LEN);
+	memset(out + 4, 0, AUTH_VECTOR_LEN);
+
+	fr_md5_init(&md5);
+	fr_md5_update(&md5, out, len);
+	fr_md5_update(&md5, (uint8_t const *) secret, strlen(secret));
+	fr_md5_final(out + 4, &md5);
+
+	rad_assert(memcmp(authenticator, out + 4, AUTH_VECTOR_LEN) == 0);
+
+	MPRINT1("accounting-request: OK\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char const	*dict_dir = "share";
+	fr_dict_t	*dict = NULL;
+	TALLOC_CTX	*ctx;
+
+	while ((c = getopt(argc, argv, "D:hx")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(NULL, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("radclient_bench_test");
+		exit(1);
+	}
+
+	ctx = talloc_init("radclient_bench_test");
+	secret = talloc_strdup(ctx, "testing123");
+
+	test_access_request(ctx);
+	test_chap(ctx);
+	test_accounting_request(ctx);
+
+	talloc_free(ctx);
+	talloc_free(dict);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := radclient_bench_test
+
+SOURCES		:= radclient_bench_test.c ${top_srcdir}/src/main/radclient_bench.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)